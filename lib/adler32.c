@@ -124,6 +124,8 @@ adler32_generic(u32 adler, const u8 *p, size_t len)
 typedef u32 (*adler32_func_t)(u32 adler, const u8 *p, size_t len);
 #if defined(ARCH_ARM32) || defined(ARCH_ARM64)
 #  include "arm/adler32_impl.h"
+#elif defined(ARCH_RISCV) && defined(LIBDEFLATE_RISCV_CHECKSUMS)
+#  include "riscv/adler32_impl.h"
 #elif defined(ARCH_X86_32) || defined(ARCH_X86_64)
 #  include "x86/adler32_impl.h"
 #endif
@@ -160,3 +162,56 @@ libdeflate_adler32(u32 adler, const void *buffer, size_t len)
 		return 1;
 	return adler32_impl(adler, buffer, len);
 }
+
+LIBDEFLATEAPI u32
+libdeflate_adler32_copy(u32 adler, void *dst, const void *src, size_t len)
+{
+	u8 *out = dst;
+	const u8 *in = src;
+
+	while (len != 0) {
+		size_t n = MIN(len, CHECKSUM_COPY_PIECE_SIZE);
+
+		adler = adler32_impl(adler, in, n);
+		memcpy(out, in, n);
+		in += n;
+		out += n;
+		len -= n;
+	}
+	return adler;
+}
+
+/*
+ * Unlike with CRC-32, interleaving buffers doesn't speed up Adler-32: the
+ * portable implementation already keeps several independent sums, and the
+ * vectorized ones are faster even on small buffers.  So this just avoids the
+ * per-call overhead of libdeflate_adler32().
+ */
+LIBDEFLATEAPI void
+libdeflate_adler32_multi(const void * const bufs[], const size_t lens[],
+			 size_t count, u32 adlers[])
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		adlers[i] = adler32_impl(adlers[i], bufs[i], lens[i]);
+}
+
+/*
+ * Appending len2 bytes to the first piece adds the second piece's sums to s1
+ * and s2, and also adds len2 * s1 (of the first piece) to s2.  Each piece's s1
+ * includes the initial value of 1, so one of the two must be subtracted.
+ */
+LIBDEFLATEAPI u32
+libdeflate_adler32_combine(u32 adler1, u32 adler2, size_t len2)
+{
+	u32 rem = len2 % DIVISOR;
+	u32 s1 = adler1 & 0xFFFF;
+	u32 s2 = (u32)(((u64)rem * s1) % DIVISOR);
+
+	s1 += (adler2 & 0xFFFF) + DIVISOR - 1;
+	s2 += (adler1 >> 16) + (adler2 >> 16) + DIVISOR - rem;
+	s1 %= DIVISOR;
+	s2 %= DIVISOR;
+	return (s2 << 16) | s1;
+}
@@ -0,0 +1,88 @@
+#ifndef LIB_ARM_DECOMPRESS_IMPL_H
+#define LIB_ARM_DECOMPRESS_IMPL_H
+
+#include "cpu_features.h"
+
+/*
+ * NEON optimized decompression function, for arm64 where NEON is always
+ * available.  It's the same as the generic one, except that the fastloop
+ * copies matches with copy_match_neon().  vqtbl1q_u8() is arm64-only.
+ *
+ * This hasn't been run on arm64 hardware yet, so it's only built when
+ * LIBDEFLATE_NEON_DECOMPRESS is defined; otherwise arm64 keeps using the
+ * generic decompressor.
+ */
+#if defined(ARCH_ARM64) && HAVE_NEON_NATIVE && HAVE_NEON_INTRIN && \
+	defined(LIBDEFLATE_NEON_DECOMPRESS)
+
+#  include "../copy_match_tables.h"
+
+/*
+ * Copy the match that ends at @end from @src = @dst - @offset to @dst, writing
+ * up to 31 bytes past @end.  Offsets of 32 or more get 32 bytes per iteration
+ * and offsets of 16 to 31 get 16 bytes per iteration, which never read bytes
+ * that the same iteration writes.  Smaller offsets, i.e. short repeating
+ * patterns such as runs of the same byte, are replicated into two vectors by
+ * table lookups, which are then stored repeatedly without any further loads.
+ */
+static forceinline void
+copy_match_neon(u8 *dst, const u8 *src, u32 offset, const u8 *end)
+{
+	if (offset >= 32) {
+		do {
+			uint8x16_t a = vld1q_u8(src);
+			uint8x16_t b = vld1q_u8(src + 16);
+
+			vst1q_u8(dst, a);
+			vst1q_u8(dst + 16, b);
+			src += 32;
+			dst += 32;
+		} while (dst < end);
+	} else if (offset >= 16) {
+		do {
+			vst1q_u8(dst, vld1q_u8(src));
+			src += 16;
+			dst += 16;
+		} while (dst < end);
+	} else {
+		const uint8x16_t pattern = vld1q_u8(src);
+		const uint8x16_t v0 = vqtbl1q_u8(pattern,
+					vld1q_u8(&copy_match_shufs[offset][0]));
+		const uint8x16_t v1 = vqtbl1q_u8(pattern,
+					vld1q_u8(&copy_match_shufs[offset][16]));
+		const u32 advance = copy_match_advances[offset];
+
+		do {
+			vst1q_u8(dst, v0);
+			vst1q_u8(dst + 16, v1);
+			dst += advance;
+		} while (dst < end);
+	}
+}
+
+#  define deflate_decompress_neon	deflate_decompress_neon
+#  define FUNCNAME			deflate_decompress_neon
+#  define STREAM_FUNCNAME		deflate_decompress_stream_neon
+#  define COPY_MATCH			copy_match_neon
+   /*
+    * arm64 has nothing like bzhi, and ubfx only takes constant bit positions.
+    * But variable shifts use the count mod 64, so masking the count with 63
+    * is free, and 'word & ~(~0 << count)' is just lsl and bic, with the ~0
+    * kept in a register.  The generic 'word & BITMASK(count)' is lsl, sub and
+    * and, with the 1 kept in a register.  The counts are always less than
+    * 64 (for EXTRACT_VARBITS8(), the count's low byte is), so masking them
+    * with 63 gives the same result as the generic macros.  Like the rest of
+    * this function, this is only built with LIBDEFLATE_NEON_DECOMPRESS until
+    * it has passed the tests on arm64.
+    */
+#  define EXTRACT_VARBITS(word, count) \
+	((word) & ~(~(bitbuf_t)0 << ((count) & 63)))
+#  define EXTRACT_VARBITS8(word, count) \
+	((word) & ~(~(bitbuf_t)0 << ((count) & 63)))
+#  include "../decompress_template.h"
+
+#  define DEFAULT_IMPL			deflate_decompress_neon
+#  define DEFAULT_STREAM_IMPL		deflate_decompress_stream_neon
+#endif
+
+#endif /* LIB_ARM_DECOMPRESS_IMPL_H */
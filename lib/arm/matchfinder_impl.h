@@ -73,6 +73,50 @@ matchfinder_rebase_neon(mf_pos_t *data, size_t size)
 }
 #define matchfinder_rebase matchfinder_rebase_neon
 
+#if defined(ARCH_ARM64) && !defined(__ARM_BIG_ENDIAN)
+/*
+ * lz_extend() that compares 16 bytes at a time.  NEON has no movemask, so the
+ * byte comparison result is narrowed to a 64-bit mask with 4 bits per byte,
+ * and the first mismatch is found from its trailing zero count.  The tail is
+ * handled like in the x86 version, by comparing the last 16 bytes again.
+ */
+static forceinline u64
+lz_mismatch_mask_neon(const u8 *a, const u8 *b)
+{
+	uint8x16_t eq = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+
+	return ~vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static forceinline unsigned
+lz_extend_neon(const u8 * const strptr, const u8 * const matchptr,
+	       const unsigned start_len, const unsigned max_len)
+{
+	unsigned len = start_len;
+	u64 mask;
+
+	while (len + 16 <= max_len) {
+		mask = lz_mismatch_mask_neon(&strptr[len], &matchptr[len]);
+		if (mask != 0)
+			return len + (bsf64(mask) >> 2);
+		len += 16;
+	}
+	if (len < max_len) {
+		if (max_len >= 16) {
+			len = max_len - 16;
+			mask = lz_mismatch_mask_neon(&strptr[len],
+						     &matchptr[len]);
+			return (mask != 0) ? len + (bsf64(mask) >> 2) : max_len;
+		}
+		while (len < max_len && matchptr[len] == strptr[len])
+			len++;
+	}
+	return len;
+}
+#define lz_extend lz_extend_neon
+#endif /* ARCH_ARM64 */
+
 #endif /* HAVE_NEON_NATIVE */
 
 #endif /* LIB_ARM_MATCHFINDER_IMPL_H */
@@ -96,38 +96,66 @@ struct MATCHFINDER_ALIGNED bt_matchfinder {
 
 	/* The child node references for the binary trees.  The left and right
 	 * children of the node for the sequence with position 'pos' are
-	 * 'child_tab[pos * 2]' and 'child_tab[pos * 2 + 1]', respectively.  */
+	 * 'child_tab[(pos % window_size) * 2]' and
+	 * 'child_tab[(pos % window_size) * 2 + 1]', respectively.  Only the
+	 * first '2 * window_size' entries are used, so the rest needn't be
+	 * allocated.  */
 	mf_pos_t child_tab[2UL * MATCHFINDER_WINDOW_SIZE];
 };
 
+/* The number of bytes of the matchfinder that are used with a window size of
+ * @window_size.  */
+static forceinline size_t
+bt_matchfinder_size(u32 window_size)
+{
+	return offsetof(struct bt_matchfinder, child_tab) +
+	       2 * window_size * sizeof(mf_pos_t);
+}
+
 /* Prepare the matchfinder for a new input buffer.  */
 static forceinline void
-bt_matchfinder_init(struct bt_matchfinder *mf)
+bt_matchfinder_init(struct bt_matchfinder *mf, unsigned order_reduction)
 {
 	STATIC_ASSERT(BT_MATCHFINDER_TOTAL_HASH_SIZE %
 		      MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT((sizeof(mf->hash3_tab) >>
+		       MATCHFINDER_MAX_ORDER_REDUCTION) %
+		      MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT((sizeof(mf->hash4_tab) >>
+		       MATCHFINDER_MAX_ORDER_REDUCTION) %
+		      MATCHFINDER_SIZE_ALIGNMENT == 0);
 
-	matchfinder_init((mf_pos_t *)mf, BT_MATCHFINDER_TOTAL_HASH_SIZE);
+	if (order_reduction == 0) {
+		matchfinder_init((mf_pos_t *)mf,
+				 BT_MATCHFINDER_TOTAL_HASH_SIZE);
+	} else {
+		matchfinder_init(&mf->hash3_tab[0][0],
+				 sizeof(mf->hash3_tab) >> order_reduction);
+		matchfinder_init(mf->hash4_tab,
+				 sizeof(mf->hash4_tab) >> order_reduction);
+	}
 }
 
 static forceinline void
-bt_matchfinder_slide_window(struct bt_matchfinder *mf)
+bt_matchfinder_slide_window(struct bt_matchfinder *mf, u32 window_size)
 {
 	STATIC_ASSERT(sizeof(*mf) % MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT(((2UL << MATCHFINDER_MIN_WINDOW_ORDER) *
+		       sizeof(mf_pos_t)) % MATCHFINDER_SIZE_ALIGNMENT == 0);
 
-	matchfinder_rebase((mf_pos_t *)mf, sizeof(*mf));
+	matchfinder_rebase((mf_pos_t *)mf, bt_matchfinder_size(window_size));
 }
 
 static forceinline mf_pos_t *
-bt_left_child(struct bt_matchfinder *mf, s32 node)
+bt_left_child(struct bt_matchfinder *mf, s32 node, u32 window_size)
 {
-	return &mf->child_tab[2 * (node & (MATCHFINDER_WINDOW_SIZE - 1)) + 0];
+	return &mf->child_tab[2 * (node & (window_size - 1)) + 0];
 }
 
 static forceinline mf_pos_t *
-bt_right_child(struct bt_matchfinder *mf, s32 node)
+bt_right_child(struct bt_matchfinder *mf, s32 node, u32 window_size)
 {
-	return &mf->child_tab[2 * (node & (MATCHFINDER_WINDOW_SIZE - 1)) + 1];
+	return &mf->child_tab[2 * (node & (window_size - 1)) + 1];
 }
 
 /* The minimum permissible value of 'max_len' for bt_matchfinder_get_matches()
@@ -144,13 +172,16 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 				const u32 max_len,
 				const u32 nice_len,
 				const u32 max_search_depth,
+				const unsigned order_reduction,
+				const u32 window_size,
 				u32 * const next_hashes,
 				struct lz_match *lz_matchptr,
-				const bool record_matches)
+				const bool record_matches,
+				struct matchfinder_counters * const counters)
 {
 	const u8 *in_next = in_base + cur_pos;
 	u32 depth_remaining = max_search_depth;
-	const s32 cutoff = cur_pos - MATCHFINDER_WINDOW_SIZE;
+	const s32 cutoff = cur_pos - window_size;
 	u32 next_hashseq;
 	u32 hash3;
 	u32 hash4;
@@ -167,13 +198,17 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 	STATIC_ASSERT(BT_MATCHFINDER_HASH3_WAYS >= 1 &&
 		      BT_MATCHFINDER_HASH3_WAYS <= 2);
 
+	COUNTER_INC(counters->num_searches);
+
 	next_hashseq = get_unaligned_le32(in_next + 1);
 
 	hash3 = next_hashes[0];
 	hash4 = next_hashes[1];
 
-	next_hashes[0] = lz_hash(next_hashseq & 0xFFFFFF, BT_MATCHFINDER_HASH3_ORDER);
-	next_hashes[1] = lz_hash(next_hashseq, BT_MATCHFINDER_HASH4_ORDER);
+	next_hashes[0] = lz_hash(next_hashseq & 0xFFFFFF,
+				 BT_MATCHFINDER_HASH3_ORDER - order_reduction);
+	next_hashes[1] = lz_hash(next_hashseq,
+				 BT_MATCHFINDER_HASH4_ORDER - order_reduction);
 	prefetchw(&mf->hash3_tab[next_hashes[0]]);
 	prefetchw(&mf->hash4_tab[next_hashes[1]]);
 
@@ -185,6 +220,8 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 #endif
 	if (record_matches && cur_node > cutoff) {
 		u32 seq3 = load_u24_unaligned(in_next);
+
+		COUNTER_INC(counters->num_candidates);
 		if (seq3 == load_u24_unaligned(&in_base[cur_node])) {
 			lz_matchptr->length = 3;
 			lz_matchptr->offset = in_next - &in_base[cur_node];
@@ -192,7 +229,8 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 		}
 	#if BT_MATCHFINDER_HASH3_WAYS >= 2
 		else if (cur_node_2 > cutoff &&
-			seq3 == load_u24_unaligned(&in_base[cur_node_2]))
+			(COUNTER_INC(counters->num_candidates),
+			 seq3 == load_u24_unaligned(&in_base[cur_node_2])))
 		{
 			lz_matchptr->length = 3;
 			lz_matchptr->offset = in_next - &in_base[cur_node_2];
@@ -204,8 +242,8 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 	cur_node = mf->hash4_tab[hash4];
 	mf->hash4_tab[hash4] = cur_pos;
 
-	pending_lt_ptr = bt_left_child(mf, cur_pos);
-	pending_gt_ptr = bt_right_child(mf, cur_pos);
+	pending_lt_ptr = bt_left_child(mf, cur_pos, window_size);
+	pending_gt_ptr = bt_right_child(mf, cur_pos, window_size);
 
 	if (cur_node <= cutoff) {
 		*pending_lt_ptr = MATCHFINDER_INITVAL;
@@ -218,6 +256,7 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 	len = 0;
 
 	for (;;) {
+		COUNTER_INC(counters->num_candidates);
 		matchptr = &in_base[cur_node];
 
 		if (matchptr[len] == in_next[len]) {
@@ -230,8 +269,10 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 					lz_matchptr++;
 				}
 				if (len >= nice_len) {
-					*pending_lt_ptr = *bt_left_child(mf, cur_node);
-					*pending_gt_ptr = *bt_right_child(mf, cur_node);
+					*pending_lt_ptr = *bt_left_child(
+						mf, cur_node, window_size);
+					*pending_gt_ptr = *bt_right_child(
+						mf, cur_node, window_size);
 					return lz_matchptr;
 				}
 			}
@@ -239,14 +280,14 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
 
 		if (matchptr[len] < in_next[len]) {
 			*pending_lt_ptr = cur_node;
-			pending_lt_ptr = bt_right_child(mf, cur_node);
+			pending_lt_ptr = bt_right_child(mf, cur_node, window_size);
 			cur_node = *pending_lt_ptr;
 			best_lt_len = len;
 			if (best_gt_len < len)
 				len = best_gt_len;
 		} else {
 			*pending_gt_ptr = cur_node;
-			pending_gt_ptr = bt_left_child(mf, cur_node);
+			pending_gt_ptr = bt_left_child(mf, cur_node, window_size);
 			cur_node = *pending_gt_ptr;
 			best_gt_len = len;
 			if (best_lt_len < len)
@@ -280,6 +321,10 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
  *	Must be <= @max_len.
  * @max_search_depth
  *	Limit on the number of potential matches to consider.  Must be >= 1.
+ * @order_reduction
+ *	The value that was passed to bt_matchfinder_init().
+ * @window_size
+ *	The window size; see MATCHFINDER_MIN_WINDOW_ORDER.
  * @next_hashes
  *	The precomputed hash codes for the sequence beginning at @in_next.
  *	These will be used and then updated with the precomputed hashcodes for
@@ -289,6 +334,8 @@ bt_matchfinder_advance_one_byte(struct bt_matchfinder * const mf,
  *	matches will be sorted by strictly increasing length and (non-strictly)
  *	increasing offset.  The maximum number of matches that may be found is
  *	'nice_len - 2'.
+ * @counters
+ *	The counters to update if LIBDEFLATE_ENABLE_COUNTERS is defined.
  *
  * The return value is a pointer to the next available slot in the @lz_matchptr
  * array.  (If no matches were found, this will be the same as @lz_matchptr.)
@@ -300,8 +347,11 @@ bt_matchfinder_get_matches(struct bt_matchfinder *mf,
 			   u32 max_len,
 			   u32 nice_len,
 			   u32 max_search_depth,
+			   unsigned order_reduction,
+			   u32 window_size,
 			   u32 next_hashes[2],
-			   struct lz_match *lz_matchptr)
+			   struct lz_match *lz_matchptr,
+			   struct matchfinder_counters *counters)
 {
 	return bt_matchfinder_advance_one_byte(mf,
 					       in_base,
@@ -309,9 +359,12 @@ bt_matchfinder_get_matches(struct bt_matchfinder *mf,
 					       max_len,
 					       nice_len,
 					       max_search_depth,
+					       order_reduction,
+					       window_size,
 					       next_hashes,
 					       lz_matchptr,
-					       true);
+					       true,
+					       counters);
 }
 
 /*
@@ -326,7 +379,10 @@ bt_matchfinder_skip_byte(struct bt_matchfinder *mf,
 			 ptrdiff_t cur_pos,
 			 u32 nice_len,
 			 u32 max_search_depth,
-			 u32 next_hashes[2])
+			 unsigned order_reduction,
+			 u32 window_size,
+			 u32 next_hashes[2],
+			 struct matchfinder_counters *counters)
 {
 	bt_matchfinder_advance_one_byte(mf,
 					in_base,
@@ -334,9 +390,127 @@ bt_matchfinder_skip_byte(struct bt_matchfinder *mf,
 					nice_len,
 					nice_len,
 					max_search_depth,
+					order_reduction,
+					window_size,
 					next_hashes,
 					NULL,
-					false);
+					false,
+					counters);
+}
+
+/*
+ * Retrieve a list of matches with the current position like
+ * bt_matchfinder_get_matches(), but without inserting the current position.
+ *
+ * This is for positions that can't be inserted yet.  Each binary tree is sorted
+ * by the first 'nice_len' bytes of its sequences, so a sequence that fewer than
+ * 'nice_len' bytes are known of can't be put in its place yet: once the data
+ * that follows it became known, it could turn out to be out of order, and then
+ * searches that skip the prefix that they know a subtree shares would report
+ * matches longer than the data really matches.  The caller must insert the
+ * position with bt_matchfinder_skip_byte() once enough data follows it, which
+ * also makes the @next_hashes given to that function the ones for that
+ * position; this function computes its own hash codes and leaves them alone.
+ *
+ * The parameters are the same as for bt_matchfinder_get_matches(), except that
+ * @max_len may be less than @nice_len, in which case @max_len is used instead.
+ */
+static forceinline struct lz_match *
+bt_matchfinder_search(struct bt_matchfinder * const mf,
+		      const u8 * const in_base,
+		      const ptrdiff_t cur_pos,
+		      const u32 max_len,
+		      u32 nice_len,
+		      const u32 max_search_depth,
+		      const unsigned order_reduction,
+		      const u32 window_size,
+		      struct lz_match *lz_matchptr,
+		      struct matchfinder_counters * const counters)
+{
+	const u8 *in_next = in_base + cur_pos;
+	u32 depth_remaining = max_search_depth;
+	const s32 cutoff = cur_pos - window_size;
+	const u32 seq = get_unaligned_le32(in_next);
+	const u32 seq3 = seq & 0xFFFFFF;
+	const u32 hash3 = lz_hash(seq3, BT_MATCHFINDER_HASH3_ORDER -
+					order_reduction);
+	const u32 hash4 = lz_hash(seq, BT_MATCHFINDER_HASH4_ORDER -
+				       order_reduction);
+	s32 cur_node;
+#if BT_MATCHFINDER_HASH3_WAYS >= 2
+	s32 cur_node_2;
+#endif
+	const u8 *matchptr;
+	u32 best_lt_len, best_gt_len;
+	u32 len;
+	u32 best_len = 3;
+
+	COUNTER_INC(counters->num_searches);
+
+	nice_len = MIN(nice_len, max_len);
+
+	cur_node = mf->hash3_tab[hash3][0];
+#if BT_MATCHFINDER_HASH3_WAYS >= 2
+	cur_node_2 = mf->hash3_tab[hash3][1];
+#endif
+	if (cur_node > cutoff) {
+		COUNTER_INC(counters->num_candidates);
+		if (seq3 == load_u24_unaligned(&in_base[cur_node])) {
+			lz_matchptr->length = 3;
+			lz_matchptr->offset = in_next - &in_base[cur_node];
+			lz_matchptr++;
+		}
+	#if BT_MATCHFINDER_HASH3_WAYS >= 2
+		else if (cur_node_2 > cutoff &&
+			(COUNTER_INC(counters->num_candidates),
+			 seq3 == load_u24_unaligned(&in_base[cur_node_2])))
+		{
+			lz_matchptr->length = 3;
+			lz_matchptr->offset = in_next - &in_base[cur_node_2];
+			lz_matchptr++;
+		}
+	#endif
+	}
+
+	cur_node = mf->hash4_tab[hash4];
+	if (cur_node <= cutoff)
+		return lz_matchptr;
+
+	best_lt_len = 0;
+	best_gt_len = 0;
+	len = 0;
+
+	for (;;) {
+		COUNTER_INC(counters->num_candidates);
+		matchptr = &in_base[cur_node];
+
+		if (matchptr[len] == in_next[len]) {
+			len = lz_extend(in_next, matchptr, len + 1, max_len);
+			if (len > best_len) {
+				best_len = len;
+				lz_matchptr->length = len;
+				lz_matchptr->offset = in_next - matchptr;
+				lz_matchptr++;
+				if (len >= nice_len)
+					return lz_matchptr;
+			}
+		}
+
+		if (matchptr[len] < in_next[len]) {
+			cur_node = *bt_right_child(mf, cur_node, window_size);
+			best_lt_len = len;
+			if (best_gt_len < len)
+				len = best_gt_len;
+		} else {
+			cur_node = *bt_left_child(mf, cur_node, window_size);
+			best_gt_len = len;
+			if (best_lt_len < len)
+				len = best_lt_len;
+		}
+
+		if (cur_node <= cutoff || !--depth_remaining)
+			return lz_matchptr;
+	}
 }
 
 #endif /* LIB_BT_MATCHFINDER_H */
@@ -0,0 +1,69 @@
+/*
+ * copy_match_tables.h - tables for copying matches with short offsets
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIB_COPY_MATCH_TABLES_H
+#define LIB_COPY_MATCH_TABLES_H
+
+#include "lib_common.h"
+
+/*
+ * These are shared by the vectorized match copy functions in
+ * x86/decompress_impl.h and arm/decompress_impl.h.  For a match offset of 1 to
+ * 15, a vector of the repeating pattern is built by a byte shuffle and then
+ * stored repeatedly, 32 bytes at a time.
+ */
+
+/*
+ * For each match offset from 1 to 15, the shuffle indices (for pshufb or
+ * vqtbl1q_u8()) that replicate the first 'offset' bytes of a 16-byte vector
+ * across 32 bytes, as two 16-byte halves.  Row 0 is unused.
+ */
+#define SHUF_ROW(k)							\
+	{ 0 % (k), 1 % (k), 2 % (k), 3 % (k), 4 % (k), 5 % (k),		\
+	  6 % (k), 7 % (k), 8 % (k), 9 % (k), 10 % (k), 11 % (k),	\
+	  12 % (k), 13 % (k), 14 % (k), 15 % (k), 16 % (k), 17 % (k),	\
+	  18 % (k), 19 % (k), 20 % (k), 21 % (k), 22 % (k), 23 % (k),	\
+	  24 % (k), 25 % (k), 26 % (k), 27 % (k), 28 % (k), 29 % (k),	\
+	  30 % (k), 31 % (k) }
+static const u8 _aligned_attribute(32) copy_match_shufs[16][32] = {
+	SHUF_ROW(1), SHUF_ROW(1), SHUF_ROW(2), SHUF_ROW(3),
+	SHUF_ROW(4), SHUF_ROW(5), SHUF_ROW(6), SHUF_ROW(7),
+	SHUF_ROW(8), SHUF_ROW(9), SHUF_ROW(10), SHUF_ROW(11),
+	SHUF_ROW(12), SHUF_ROW(13), SHUF_ROW(14), SHUF_ROW(15),
+};
+#undef SHUF_ROW
+
+/*
+ * For each match offset from 1 to 15, the largest multiple of it that is <= 32.
+ * The 32 bytes of the replicated pattern can be stored again at this distance
+ * and still be in phase.  Entry 0 is unused.
+ */
+static const u8 copy_match_advances[16] = {
+	32, 32, 32, 30, 32, 30, 30, 28, 32, 27, 30, 22, 24, 26, 28, 30,
+};
+
+#endif /* LIB_COPY_MATCH_TABLES_H */
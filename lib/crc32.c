@@ -224,6 +224,8 @@ crc32_slice1(u32 crc, const u8 *p, size_t len)
 typedef u32 (*crc32_func_t)(u32 crc, const u8 *p, size_t len);
 #if defined(ARCH_ARM32) || defined(ARCH_ARM64)
 #  include "arm/crc32_impl.h"
+#elif defined(ARCH_RISCV) && defined(LIBDEFLATE_RISCV_CHECKSUMS)
+#  include "riscv/crc32_impl.h"
 #elif defined(ARCH_X86_32) || defined(ARCH_X86_64)
 #  include "x86/crc32_impl.h"
 #endif
@@ -260,3 +262,166 @@ libdeflate_crc32(u32 crc, const void *p, size_t len)
 		return 0;
 	return ~crc32_impl(~crc, p, len);
 }
+
+LIBDEFLATEAPI u32
+libdeflate_crc32_copy(u32 crc, void *dst, const void *src, size_t len)
+{
+	u8 *out = dst;
+	const u8 *in = src;
+
+	crc = ~crc;
+	while (len != 0) {
+		size_t n = MIN(len, CHECKSUM_COPY_PIECE_SIZE);
+
+		crc = crc32_impl(crc, in, n);
+		memcpy(out, in, n);
+		in += n;
+		out += n;
+		len -= n;
+	}
+	return ~crc;
+}
+
+/* The number of buffers that libdeflate_crc32_multi() works on at a time */
+#define CRC32_NUM_LANES		4
+
+/* The shortest buffer that libdeflate_crc32_multi() gives a lane of its own */
+#define CRC32_MIN_LANE_LEN	32
+
+/*
+ * Advance the CRCs of CRC32_NUM_LANES independent buffers by @len bytes each,
+ * where @len is a multiple of 8, using the slice-by-8 method.  On its own each
+ * buffer's CRC is a long chain of dependent table lookups, so this interleaves
+ * the chains of several buffers to keep more lookups in flight.
+ */
+static forceinline void
+crc32_slice8_lanes(u32 crc[CRC32_NUM_LANES], const u8 *p[CRC32_NUM_LANES],
+		   size_t len)
+{
+	const u8 * const end = p[0] + len;
+	int i;
+
+	while (p[0] != end) {
+		for (i = 0; i < CRC32_NUM_LANES; i++) {
+			u32 v1 = crc[i] ^ get_unaligned_le32(p[i] + 0);
+			u32 v2 = get_unaligned_le32(p[i] + 4);
+
+			crc[i] = crc32_slice8_table[0x700 + (u8)(v1 >> 0)] ^
+				 crc32_slice8_table[0x600 + (u8)(v1 >> 8)] ^
+				 crc32_slice8_table[0x500 + (u8)(v1 >> 16)] ^
+				 crc32_slice8_table[0x400 + (u8)(v1 >> 24)] ^
+				 crc32_slice8_table[0x300 + (u8)(v2 >> 0)] ^
+				 crc32_slice8_table[0x200 + (u8)(v2 >> 8)] ^
+				 crc32_slice8_table[0x100 + (u8)(v2 >> 16)] ^
+				 crc32_slice8_table[0x000 + (u8)(v2 >> 24)];
+			p[i] += 8;
+		}
+	}
+}
+
+/*
+ * Interleaving only pays off for the portable slice-by-8 implementation; the
+ * carryless multiplication ones are much faster even on small buffers.  With
+ * it, buffers are assigned to lanes as the lanes free up, as in multi-buffer
+ * hashing.  While all lanes are busy, they advance together by the length of
+ * the shortest buffer, and a lane is freed once it has fewer than 8 bytes left.
+ * Buffers too short to be worth a lane, and whatever is left when the buffers
+ * run out, go through crc32_impl() on their own, as does everything before the
+ * implementation has been chosen.
+ */
+LIBDEFLATEAPI void
+libdeflate_crc32_multi(const void * const bufs[], const size_t lens[],
+		       size_t count, u32 crcs[])
+{
+	size_t lane_idx[CRC32_NUM_LANES];
+	const u8 *lane_p[CRC32_NUM_LANES];
+	size_t lane_len[CRC32_NUM_LANES];
+	u32 lane_crc[CRC32_NUM_LANES];
+	const bool use_lanes = (crc32_impl == crc32_slice8);
+	int num_busy = 0;
+	size_t next = 0;
+	int i;
+
+	for (;;) {
+		size_t len;
+
+		/* Fill the free lanes. */
+		while (num_busy < CRC32_NUM_LANES && next < count) {
+			if (!use_lanes || lens[next] < CRC32_MIN_LANE_LEN) {
+				crcs[next] = ~crc32_impl(~crcs[next],
+							 bufs[next],
+							 lens[next]);
+			} else {
+				lane_idx[num_busy] = next;
+				lane_p[num_busy] = bufs[next];
+				lane_len[num_busy] = lens[next];
+				lane_crc[num_busy] = ~crcs[next];
+				num_busy++;
+			}
+			next++;
+		}
+		if (num_busy < CRC32_NUM_LANES)
+			break;
+
+		/* Advance all lanes, then free the ones that are done. */
+		len = lane_len[0];
+		for (i = 1; i < CRC32_NUM_LANES; i++)
+			len = MIN(len, lane_len[i]);
+		len &= ~7;
+		crc32_slice8_lanes(lane_crc, lane_p, len);
+		for (i = CRC32_NUM_LANES - 1; i >= 0; i--) {
+			lane_len[i] -= len;
+			if (lane_len[i] >= 8)
+				continue;
+			crcs[lane_idx[i]] = ~crc32_slice1(lane_crc[i], lane_p[i],
+							  lane_len[i]);
+			num_busy--;
+			lane_idx[i] = lane_idx[num_busy];
+			lane_p[i] = lane_p[num_busy];
+			lane_len[i] = lane_len[num_busy];
+			lane_crc[i] = lane_crc[num_busy];
+		}
+	}
+
+	for (i = 0; i < num_busy; i++)
+		crcs[lane_idx[i]] = ~crc32_impl(lane_crc[i], lane_p[i],
+						lane_len[i]);
+}
+
+/*
+ * Multiply the polynomials @a and @b modulo G(x).  As in the CRC itself, the
+ * highest order bit represents the coefficient of x^0.
+ */
+static u32
+crc32_multiply_modg(u32 a, u32 b)
+{
+	u32 product = 0;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		if (a & (0x80000000 >> i))
+			product ^= b;
+		/* b *= x (mod G(x)) */
+		b = (b >> 1) ^ ((b & 1) ? 0xEDB88320 : 0);
+	}
+	return product;
+}
+
+/*
+ * The CRC of the concatenation is the CRC of the first piece followed by len2
+ * zero bytes, plus the CRC of the second piece; the inversions cancel out.
+ * Appending len2 zero bytes multiplies the remainder by x^(8*len2) mod G(x),
+ * which is the product of the precomputed x^(8*2^k) mod G(x) for each bit k
+ * that is set in len2.
+ */
+LIBDEFLATEAPI u32
+libdeflate_crc32_combine(u32 crc1, u32 crc2, size_t len2)
+{
+	int k;
+
+	for (k = 0; len2 != 0; k++, len2 >>= 1) {
+		if (len2 & 1)
+			crc1 = crc32_multiply_modg(crc1, crc32_combine_mults[k]);
+	}
+	return crc1 ^ crc2;
+}
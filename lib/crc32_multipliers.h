@@ -100,6 +100,18 @@
 #define CRC32_X4127_MODG 0x1072db28 /* x^4127 mod G(x) */
 #define CRC32_X4063_MODG 0x0c30f51d /* x^4063 mod G(x) */
 
+#define CRC32_FOLD_ACROSS_128_BITS_CONST_1 0xae689191 /* x^159 mod G(x) */
+#define CRC32_FOLD_ACROSS_128_BITS_CONST_2 0xccaa009e /* x^95 mod G(x) */
+#define CRC32_FOLD_ACROSS_256_BITS_CONST_1 0xf1da05aa /* x^287 mod G(x) */
+#define CRC32_FOLD_ACROSS_256_BITS_CONST_2 0x81256527 /* x^223 mod G(x) */
+#define CRC32_FOLD_ACROSS_512_BITS_CONST_1 0x8f352d95 /* x^543 mod G(x) */
+#define CRC32_FOLD_ACROSS_512_BITS_CONST_2 0x1d9513d7 /* x^479 mod G(x) */
+#define CRC32_FOLD_ACROSS_1024_BITS_CONST_1 0x33fff533 /* x^1055 mod G(x) */
+#define CRC32_FOLD_ACROSS_1024_BITS_CONST_2 0x910eeec1 /* x^991 mod G(x) */
+#define CRC32_FOLD_ACROSS_2048_BITS_CONST_1 0xce3371cb /* x^2079 mod G(x) */
+#define CRC32_FOLD_ACROSS_2048_BITS_CONST_2 0xe95c1271 /* x^2015 mod G(x) */
+#define CRC32_FOLD_ACROSS_4096_BITS_CONST_1 0x1072db28 /* x^4127 mod G(x) */
+#define CRC32_FOLD_ACROSS_4096_BITS_CONST_2 0x0c30f51d /* x^4063 mod G(x) */
 #define CRC32_BARRETT_CONSTANT_1 0xb4e5b025f7011641ULL /* floor(x^95 / G(x)) */
 #define CRC32_BARRETT_CONSTANT_2 0x00000001db710641ULL /* G(x) */
 
@@ -373,3 +385,71 @@ static const u32 crc32_mults_for_chunklen[][CRC32_NUM_CHUNKS - 1] MAYBE_UNUSED =
 #define CRC32_FIXED_CHUNK_MULT_1 0x29c2448b /* x^262111 mod G(x) */
 #define CRC32_FIXED_CHUNK_MULT_2 0x4b912f53 /* x^524255 mod G(x) */
 #define CRC32_FIXED_CHUNK_MULT_3 0x454c93be /* x^786399 mod G(x) */
+
+/* Multipliers for libdeflate_crc32_combine() */
+static const u32 crc32_combine_mults[64] MAYBE_UNUSED = {
+	0x00800000, /* x^(8*2^0) mod G(x) */
+	0x00008000, /* x^(8*2^1) mod G(x) */
+	0xedb88320, /* x^(8*2^2) mod G(x) */
+	0xb1e6b092, /* x^(8*2^3) mod G(x) */
+	0xa06a2517, /* x^(8*2^4) mod G(x) */
+	0xed627dae, /* x^(8*2^5) mod G(x) */
+	0x88d14467, /* x^(8*2^6) mod G(x) */
+	0xd7bbfe6a, /* x^(8*2^7) mod G(x) */
+	0xec447f11, /* x^(8*2^8) mod G(x) */
+	0x8e7ea170, /* x^(8*2^9) mod G(x) */
+	0x6427800e, /* x^(8*2^10) mod G(x) */
+	0x4d47bae0, /* x^(8*2^11) mod G(x) */
+	0x09fe548f, /* x^(8*2^12) mod G(x) */
+	0x83852d0f, /* x^(8*2^13) mod G(x) */
+	0x30362f1a, /* x^(8*2^14) mod G(x) */
+	0x7b5a9cc3, /* x^(8*2^15) mod G(x) */
+	0x31fec169, /* x^(8*2^16) mod G(x) */
+	0x9fec022a, /* x^(8*2^17) mod G(x) */
+	0x6c8dedc4, /* x^(8*2^18) mod G(x) */
+	0x15d6874d, /* x^(8*2^19) mod G(x) */
+	0x5fde7a4e, /* x^(8*2^20) mod G(x) */
+	0xbad90e37, /* x^(8*2^21) mod G(x) */
+	0x2e4e5eef, /* x^(8*2^22) mod G(x) */
+	0x4eaba214, /* x^(8*2^23) mod G(x) */
+	0xa8a472c0, /* x^(8*2^24) mod G(x) */
+	0x429a969e, /* x^(8*2^25) mod G(x) */
+	0x148d302a, /* x^(8*2^26) mod G(x) */
+	0xc40ba6d0, /* x^(8*2^27) mod G(x) */
+	0xc4e22c3c, /* x^(8*2^28) mod G(x) */
+	0x40000000, /* x^(8*2^29) mod G(x) */
+	0x20000000, /* x^(8*2^30) mod G(x) */
+	0x08000000, /* x^(8*2^31) mod G(x) */
+	0x00800000, /* x^(8*2^32) mod G(x) */
+	0x00008000, /* x^(8*2^33) mod G(x) */
+	0xedb88320, /* x^(8*2^34) mod G(x) */
+	0xb1e6b092, /* x^(8*2^35) mod G(x) */
+	0xa06a2517, /* x^(8*2^36) mod G(x) */
+	0xed627dae, /* x^(8*2^37) mod G(x) */
+	0x88d14467, /* x^(8*2^38) mod G(x) */
+	0xd7bbfe6a, /* x^(8*2^39) mod G(x) */
+	0xec447f11, /* x^(8*2^40) mod G(x) */
+	0x8e7ea170, /* x^(8*2^41) mod G(x) */
+	0x6427800e, /* x^(8*2^42) mod G(x) */
+	0x4d47bae0, /* x^(8*2^43) mod G(x) */
+	0x09fe548f, /* x^(8*2^44) mod G(x) */
+	0x83852d0f, /* x^(8*2^45) mod G(x) */
+	0x30362f1a, /* x^(8*2^46) mod G(x) */
+	0x7b5a9cc3, /* x^(8*2^47) mod G(x) */
+	0x31fec169, /* x^(8*2^48) mod G(x) */
+	0x9fec022a, /* x^(8*2^49) mod G(x) */
+	0x6c8dedc4, /* x^(8*2^50) mod G(x) */
+	0x15d6874d, /* x^(8*2^51) mod G(x) */
+	0x5fde7a4e, /* x^(8*2^52) mod G(x) */
+	0xbad90e37, /* x^(8*2^53) mod G(x) */
+	0x2e4e5eef, /* x^(8*2^54) mod G(x) */
+	0x4eaba214, /* x^(8*2^55) mod G(x) */
+	0xa8a472c0, /* x^(8*2^56) mod G(x) */
+	0x429a969e, /* x^(8*2^57) mod G(x) */
+	0x148d302a, /* x^(8*2^58) mod G(x) */
+	0xc40ba6d0, /* x^(8*2^59) mod G(x) */
+	0xc4e22c3c, /* x^(8*2^60) mod G(x) */
+	0x40000000, /* x^(8*2^61) mod G(x) */
+	0x20000000, /* x^(8*2^62) mod G(x) */
+	0x08000000, /* x^(8*2^63) mod G(x) */
+};
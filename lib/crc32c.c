@@ -0,0 +1,126 @@
+/*
+ * crc32c.c - CRC-32C checksum algorithm
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * CRC-32C (the Castagnoli CRC, used by iSCSI, SCTP, ext4, and others) works
+ * exactly like the gzip CRC-32, including the bit order and the inversions,
+ * except that its generator polynomial is x^32 + x^28 + x^27 + x^26 + x^25 +
+ * x^23 + x^22 + x^20 + x^19 + x^18 + x^14 + x^13 + x^11 + x^10 + x^9 + x^8 +
+ * x^6 + 1.  So the implementations are the same as in crc32.c, which explains
+ * them, only with different constants.
+ */
+
+#include "lib_common.h"
+#include "crc32c_multipliers.h"
+#include "crc32c_tables.h"
+
+/* This is the default implementation.  It uses the slice-by-8 method. */
+static u32 MAYBE_UNUSED
+crc32c_slice8(u32 crc, const u8 *p, size_t len)
+{
+	const u8 * const end = p + len;
+	const u8 *end64;
+
+	for (; ((uintptr_t)p & 7) && p != end; p++)
+		crc = (crc >> 8) ^ crc32c_slice8_table[(u8)crc ^ *p];
+
+	end64 = p + ((end - p) & ~7);
+	for (; p != end64; p += 8) {
+		u32 v1 = le32_bswap(*(const u32 *)(p + 0));
+		u32 v2 = le32_bswap(*(const u32 *)(p + 4));
+
+		crc = crc32c_slice8_table[0x700 + (u8)((crc ^ v1) >> 0)] ^
+		      crc32c_slice8_table[0x600 + (u8)((crc ^ v1) >> 8)] ^
+		      crc32c_slice8_table[0x500 + (u8)((crc ^ v1) >> 16)] ^
+		      crc32c_slice8_table[0x400 + (u8)((crc ^ v1) >> 24)] ^
+		      crc32c_slice8_table[0x300 + (u8)(v2 >> 0)] ^
+		      crc32c_slice8_table[0x200 + (u8)(v2 >> 8)] ^
+		      crc32c_slice8_table[0x100 + (u8)(v2 >> 16)] ^
+		      crc32c_slice8_table[0x000 + (u8)(v2 >> 24)];
+	}
+
+	for (; p != end; p++)
+		crc = (crc >> 8) ^ crc32c_slice8_table[(u8)crc ^ *p];
+
+	return crc;
+}
+
+/*
+ * This is a more lightweight generic implementation, which can be used as a
+ * subroutine by architecture-specific implementations to process small amounts
+ * of unaligned data at the beginning and/or end of the buffer.
+ */
+static forceinline u32 MAYBE_UNUSED
+crc32c_slice1(u32 crc, const u8 *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		crc = (crc >> 8) ^ crc32c_slice1_table[(u8)crc ^ p[i]];
+	return crc;
+}
+
+/* Include architecture-specific implementation(s) if available. */
+#undef DEFAULT_IMPL
+#undef arch_select_crc32c_func
+typedef u32 (*crc32c_func_t)(u32 crc, const u8 *p, size_t len);
+#if defined(ARCH_X86_32) || defined(ARCH_X86_64)
+#  include "x86/crc32c_impl.h"
+#endif
+
+#ifndef DEFAULT_IMPL
+#  define DEFAULT_IMPL crc32c_slice8
+#endif
+
+#ifdef arch_select_crc32c_func
+static u32 dispatch_crc32c(u32 crc, const u8 *p, size_t len);
+
+static volatile crc32c_func_t crc32c_impl = dispatch_crc32c;
+
+/* Choose the best implementation at runtime. */
+static u32 dispatch_crc32c(u32 crc, const u8 *p, size_t len)
+{
+	crc32c_func_t f = arch_select_crc32c_func();
+
+	if (f == NULL)
+		f = DEFAULT_IMPL;
+
+	crc32c_impl = f;
+	return f(crc, p, len);
+}
+#else
+/* The best implementation is statically known, so call it directly. */
+#define crc32c_impl DEFAULT_IMPL
+#endif
+
+LIBDEFLATEAPI u32
+libdeflate_crc32c(u32 crc, const void *p, size_t len)
+{
+	if (p == NULL) /* Return initial value. */
+		return 0;
+	return ~crc32c_impl(~crc, p, len);
+}
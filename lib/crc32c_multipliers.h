@@ -0,0 +1,20 @@
+/*
+ * crc32c_multipliers.h - constants for CRC-32C folding
+ *
+ * THIS FILE WAS GENERATED BY gen-crc32-consts.py.  DO NOT EDIT.
+ */
+
+#define CRC32C_FOLD_ACROSS_128_BITS_CONST_1 0xf20c0dfe /* x^159 mod G(x) */
+#define CRC32C_FOLD_ACROSS_128_BITS_CONST_2 0x493c7d27 /* x^95 mod G(x) */
+#define CRC32C_FOLD_ACROSS_256_BITS_CONST_1 0x3da6d0cb /* x^287 mod G(x) */
+#define CRC32C_FOLD_ACROSS_256_BITS_CONST_2 0xba4fc28e /* x^223 mod G(x) */
+#define CRC32C_FOLD_ACROSS_512_BITS_CONST_1 0x740eef02 /* x^543 mod G(x) */
+#define CRC32C_FOLD_ACROSS_512_BITS_CONST_2 0x9e4addf8 /* x^479 mod G(x) */
+#define CRC32C_FOLD_ACROSS_1024_BITS_CONST_1 0x6992cea2 /* x^1055 mod G(x) */
+#define CRC32C_FOLD_ACROSS_1024_BITS_CONST_2 0x0d3b6092 /* x^991 mod G(x) */
+#define CRC32C_FOLD_ACROSS_2048_BITS_CONST_1 0xdcb17aa4 /* x^2079 mod G(x) */
+#define CRC32C_FOLD_ACROSS_2048_BITS_CONST_2 0xb9e02b86 /* x^2015 mod G(x) */
+#define CRC32C_FOLD_ACROSS_4096_BITS_CONST_1 0xbd6f81f8 /* x^4127 mod G(x) */
+#define CRC32C_FOLD_ACROSS_4096_BITS_CONST_2 0xdd7e3b0c /* x^4063 mod G(x) */
+#define CRC32C_BARRETT_CONSTANT_1 0x4869ec38dea713f1ULL /* floor(x^95 / G(x)) */
+#define CRC32C_BARRETT_CONSTANT_2 0x0000000105ec76f1ULL /* G(x) */
@@ -0,0 +1,130 @@
+/*
+ * crc64.c - CRC-64 checksum algorithm
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The CRC-64 implemented here is the one used by the xz format ("CRC-64/XZ").
+ * It works like the gzip CRC-32, including the bit order and the inversions,
+ * except that it is 64 bits long and its generator polynomial is the one from
+ * ECMA-182: x^64 + x^62 + x^57 + x^55 + x^54 + x^53 + x^52 + x^47 + x^46 +
+ * x^45 + x^40 + x^39 + x^38 + x^37 + x^35 + x^33 + x^32 + x^31 + x^29 + x^27 +
+ * x^24 + x^23 + x^22 + x^21 + x^19 + x^17 + x^13 + x^12 + x^10 + x^9 + x^7 +
+ * x^4 + x + 1.  So the implementations are the same as in crc32.c, which
+ * explains them, only with 64-bit state and different constants.
+ */
+
+#include "lib_common.h"
+#include "crc64_multipliers.h"
+#include "crc64_tables.h"
+
+/*
+ * This is the default implementation.  It uses the slice-by-8 method, which
+ * with a 64-bit CRC cancels out the whole CRC and the 8 new bytes at once.
+ */
+static u64 MAYBE_UNUSED
+crc64_slice8(u64 crc, const u8 *p, size_t len)
+{
+	const u8 * const end = p + len;
+	const u8 *end64;
+
+	for (; ((uintptr_t)p & 7) && p != end; p++)
+		crc = (crc >> 8) ^ crc64_slice8_table[(u8)crc ^ *p];
+
+	end64 = p + ((end - p) & ~7);
+	for (; p != end64; p += 8) {
+		u64 v = crc ^ le64_bswap(*(const u64 *)p);
+
+		crc = crc64_slice8_table[0x700 + (u8)(v >> 0)] ^
+		      crc64_slice8_table[0x600 + (u8)(v >> 8)] ^
+		      crc64_slice8_table[0x500 + (u8)(v >> 16)] ^
+		      crc64_slice8_table[0x400 + (u8)(v >> 24)] ^
+		      crc64_slice8_table[0x300 + (u8)(v >> 32)] ^
+		      crc64_slice8_table[0x200 + (u8)(v >> 40)] ^
+		      crc64_slice8_table[0x100 + (u8)(v >> 48)] ^
+		      crc64_slice8_table[0x000 + (u8)(v >> 56)];
+	}
+
+	for (; p != end; p++)
+		crc = (crc >> 8) ^ crc64_slice8_table[(u8)crc ^ *p];
+
+	return crc;
+}
+
+/*
+ * This is a more lightweight generic implementation, which can be used as a
+ * subroutine by architecture-specific implementations to process small amounts
+ * of unaligned data at the beginning and/or end of the buffer.
+ */
+static forceinline u64 MAYBE_UNUSED
+crc64_slice1(u64 crc, const u8 *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		crc = (crc >> 8) ^ crc64_slice1_table[(u8)crc ^ p[i]];
+	return crc;
+}
+
+/* Include architecture-specific implementation(s) if available. */
+#undef DEFAULT_IMPL
+#undef arch_select_crc64_func
+typedef u64 (*crc64_func_t)(u64 crc, const u8 *p, size_t len);
+#if defined(ARCH_X86_32) || defined(ARCH_X86_64)
+#  include "x86/crc64_impl.h"
+#endif
+
+#ifndef DEFAULT_IMPL
+#  define DEFAULT_IMPL crc64_slice8
+#endif
+
+#ifdef arch_select_crc64_func
+static u64 dispatch_crc64(u64 crc, const u8 *p, size_t len);
+
+static volatile crc64_func_t crc64_impl = dispatch_crc64;
+
+/* Choose the best implementation at runtime. */
+static u64 dispatch_crc64(u64 crc, const u8 *p, size_t len)
+{
+	crc64_func_t f = arch_select_crc64_func();
+
+	if (f == NULL)
+		f = DEFAULT_IMPL;
+
+	crc64_impl = f;
+	return f(crc, p, len);
+}
+#else
+/* The best implementation is statically known, so call it directly. */
+#define crc64_impl DEFAULT_IMPL
+#endif
+
+LIBDEFLATEAPI u64
+libdeflate_crc64(u64 crc, const void *p, size_t len)
+{
+	if (p == NULL) /* Return initial value. */
+		return 0;
+	return ~crc64_impl(~crc, p, len);
+}
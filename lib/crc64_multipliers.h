@@ -0,0 +1,20 @@
+/*
+ * crc64_multipliers.h - constants for CRC-64 folding
+ *
+ * THIS FILE WAS GENERATED BY gen-crc32-consts.py.  DO NOT EDIT.
+ */
+
+#define CRC64_FOLD_ACROSS_128_BITS_CONST_1 0xe05dd497ca393ae4ULL /* x^191 mod G(x) */
+#define CRC64_FOLD_ACROSS_128_BITS_CONST_2 0xdabe95afc7875f40ULL /* x^127 mod G(x) */
+#define CRC64_FOLD_ACROSS_256_BITS_CONST_1 0x60095b008a9efa44ULL /* x^319 mod G(x) */
+#define CRC64_FOLD_ACROSS_256_BITS_CONST_2 0x3be653a30fe1af51ULL /* x^255 mod G(x) */
+#define CRC64_FOLD_ACROSS_512_BITS_CONST_1 0x6ae3efbb9dd441f3ULL /* x^575 mod G(x) */
+#define CRC64_FOLD_ACROSS_512_BITS_CONST_2 0x081f6054a7842df4ULL /* x^511 mod G(x) */
+#define CRC64_FOLD_ACROSS_1024_BITS_CONST_1 0x8757d71d4fcc1000ULL /* x^1087 mod G(x) */
+#define CRC64_FOLD_ACROSS_1024_BITS_CONST_2 0xd7d86b2af73de740ULL /* x^1023 mod G(x) */
+#define CRC64_FOLD_ACROSS_2048_BITS_CONST_1 0x8260adf2381ad81cULL /* x^2111 mod G(x) */
+#define CRC64_FOLD_ACROSS_2048_BITS_CONST_2 0xf31fd9271e228b79ULL /* x^2047 mod G(x) */
+#define CRC64_FOLD_ACROSS_4096_BITS_CONST_1 0x6b6563c31e5df640ULL /* x^4159 mod G(x) */
+#define CRC64_FOLD_ACROSS_4096_BITS_CONST_2 0x430af18f45bfec70ULL /* x^4095 mod G(x) */
+#define CRC64_BARRETT_CONSTANT_1 0x9c3e466c172963d5ULL /* floor(x^127 / G(x)) */
+#define CRC64_BARRETT_CONSTANT_2 0x92d8af2baf0e1e84ULL /* (G(x) - x^64 - 1) / x */
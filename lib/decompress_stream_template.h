@@ -0,0 +1,305 @@
+/*
+ * decompress_stream_template.h
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * This is the DEFLATE decompression routine used by the streaming interface.
+ * It is included by decompress_template.h when STREAM_FUNCNAME is defined, so
+ * that it gets compiled for the same target instruction sets as the main
+ * routine, with the same ATTRIBUTES and EXTRACT_VARBITS*() definitions.
+ */
+
+/*
+ * In the streaming decompressor, a failed check doesn't necessarily mean that
+ * the data is invalid, since it may instead have been caused by consuming the
+ * zeroes that REFILL_BITS() appends past the end of the input provided so far.
+ * So redirect SAFETY_CHECK() to a label that can tell the difference.
+ */
+#undef SAFETY_CHECK
+#define SAFETY_CHECK(expr)	if (unlikely(!(expr))) goto check_failed
+
+/*
+ * Decompress as much as possible of the stream from the 'in_nbytes' bytes at
+ * 'in' into the window, stopping early if the window fills up.  The number of
+ * input bytes consumed is returned in *in_used_ret, or 0 for STREAM_BAD_DATA,
+ * which leaves the stream state unusable.  For STREAM_NEED_INPUT, the
+ * remaining bytes (if any) are the start of a block header or symbol that
+ * couldn't be completed, so the caller must provide them again together with
+ * the following input.
+ *
+ * This is structured like the function in decompress_template.h, and it uses
+ * the same fastloop, but it can stop at any block header or symbol and resume
+ * there on the next call.
+ */
+static ATTRIBUTES MAYBE_UNUSED enum deflate_stream_status
+STREAM_FUNCNAME(struct libdeflate_decompressor * restrict d,
+		struct deflate_decompress_stream * restrict s,
+		const u8 *in, size_t in_nbytes, size_t *in_used_ret)
+{
+	u8 * const out = s->window;
+	u8 *out_next = &s->window[s->out_pos];
+	u8 * const out_end = &s->window[STREAM_WINDOW_SIZE];
+	u8 * const out_fastloop_end = out_end - FASTLOOP_MAX_BYTES_WRITTEN;
+
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	const u8 * const in_fastloop_end =
+		in_end - MIN(in_nbytes, FASTLOOP_MAX_BYTES_READ);
+	bitbuf_t bitbuf = s->bitbuf;
+	bitbuf_t saved_bitbuf;
+	u32 bitsleft = s->bitsleft;
+	size_t overread_count = 0;
+
+	/* The state at the start of the current block header or symbol */
+	bitbuf_t checkpoint_bitbuf = bitbuf;
+	u32 checkpoint_bitsleft = bitsleft;
+	const u8 *checkpoint_in_next = in_next;
+
+	enum deflate_stream_status status;
+	unsigned block_type;
+	unsigned num_litlen_syms;
+	unsigned num_offset_syms;
+	bitbuf_t litlen_tablemask;
+	u32 entry;
+	size_t count;
+
+	if (s->state == STREAM_STATE_HUFFMAN_BLOCK) {
+		litlen_tablemask = BITMASK(d->litlen_tablebits);
+		goto huffman_block;
+	}
+	if (s->state == STREAM_STATE_STORED_BLOCK)
+		goto stored_block;
+
+next_block:
+	/* Starting to read the next block */
+	SET_CHECKPOINT();
+
+	STATIC_ASSERT(CAN_CONSUME(1 + 2 + 5 + 5 + 4 + 3));
+	REFILL_BITS();
+
+	/* BFINAL: 1 bit */
+	s->is_final_block = bitbuf & BITMASK(1);
+
+	/* BTYPE: 2 bits */
+	block_type = (bitbuf >> 1) & BITMASK(2);
+
+	if (block_type == DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN) {
+#include "decompress_dynamic_header.h"
+
+		/* Don't bother building tables from bits past the input. */
+		CHECK_NOT_OVERREAD();
+		SAFETY_CHECK(build_dynamic_decode_tables(d, num_litlen_syms,
+							 num_offset_syms,
+							 LITLEN_TABLE_FUNCS));
+	} else if (block_type == DEFLATE_BLOCKTYPE_UNCOMPRESSED) {
+		u16 len, nlen;
+
+		bitsleft -= 3; /* for BTYPE and BFINAL */
+
+		/*
+		 * Align the bitstream to the next byte boundary by giving back
+		 * the whole bytes that are still in the bitbuffer.  They were
+		 * all read from 'in' during this call, since the bitbuffer
+		 * never holds whole bytes between calls.
+		 */
+		CHECK_NOT_OVERREAD();
+		bitsleft = (u8)bitsleft;
+		in_next -= (bitsleft >> 3) - overread_count;
+		overread_count = 0;
+		bitbuf = 0;
+		bitsleft = 0;
+
+		if (in_end - in_next < 4)
+			goto need_input;
+		len = get_unaligned_le16(in_next);
+		nlen = get_unaligned_le16(in_next + 2);
+		in_next += 4;
+
+		SAFETY_CHECK(len == (u16)~nlen);
+		s->stored_len_remaining = len;
+		s->state = STREAM_STATE_STORED_BLOCK;
+		goto stored_block;
+	} else {
+		SAFETY_CHECK(block_type == DEFLATE_BLOCKTYPE_STATIC_HUFFMAN);
+
+		bitbuf >>= 3; /* for BTYPE and BFINAL */
+		bitsleft -= 3;
+		CHECK_NOT_OVERREAD();
+
+		if (!d->static_codes_loaded)
+			load_static_decode_tables(d);
+	}
+
+	/* Decompressing a Huffman block (either dynamic or static) */
+	s->state = STREAM_STATE_HUFFMAN_BLOCK;
+	litlen_tablemask = BITMASK(d->litlen_tablebits);
+huffman_block:
+#include "decompress_fastloop.h"
+
+	/*
+	 * This is the generic loop, like the one in decompress_template.h but
+	 * with a checkpoint before each symbol.  Symbols whose bits extend past
+	 * the input, or whose output doesn't fit in the window, are left for
+	 * the next call.
+	 */
+generic_loop:
+	COUNTER_INC(d->stats.num_generic_loop_entries);
+	for (;;) {
+		u32 length, offset;
+		const u8 *src;
+		u8 *dst;
+
+		SET_CHECKPOINT();
+		REFILL_BITS();
+		entry = d->litlen_decode_table[bitbuf & litlen_tablemask];
+		saved_bitbuf = bitbuf;
+		bitbuf >>= (u8)entry;
+		bitsleft -= entry;
+		if (unlikely(entry & HUFFDEC_SUBTABLE_POINTER)) {
+			COUNTER_INC(d->stats.num_litlen_subtable_lookups);
+			entry = d->litlen_decode_table[(entry >> 16) +
+					EXTRACT_VARBITS(bitbuf, (entry >> 8) & 0x3F)];
+			saved_bitbuf = bitbuf;
+			bitbuf >>= (u8)entry;
+			bitsleft -= entry;
+		}
+		length = entry >> 16;
+		if (entry & HUFFDEC_LITERAL) {
+			CHECK_NOT_OVERREAD();
+			if (unlikely(out_end - out_next <=
+				     !!(entry & HUFFDEC_2LITERALS)))
+				goto window_full;
+			*out_next++ = length;
+			if (entry & HUFFDEC_2LITERALS)
+				*out_next++ = (length >> 8) & 0x7F;
+			continue;
+		}
+		if (unlikely(entry & HUFFDEC_END_OF_BLOCK)) {
+			CHECK_NOT_OVERREAD();
+			goto block_done;
+		}
+		length += EXTRACT_VARBITS8(saved_bitbuf, entry) >> (u8)(entry >> 8);
+
+		if (!CAN_CONSUME(LENGTH_MAXBITS + OFFSET_MAXBITS))
+			REFILL_BITS();
+		entry = d->offset_decode_table[bitbuf & BITMASK(OFFSET_TABLEBITS)];
+		if (unlikely(entry & HUFFDEC_EXCEPTIONAL)) {
+			bitbuf >>= OFFSET_TABLEBITS;
+			bitsleft -= OFFSET_TABLEBITS;
+			entry = d->offset_decode_table[(entry >> 16) +
+					EXTRACT_VARBITS(bitbuf, (entry >> 8) & 0x3F)];
+			if (!CAN_CONSUME(OFFSET_MAXBITS))
+				REFILL_BITS();
+		}
+		offset = entry >> 16;
+		offset += EXTRACT_VARBITS8(bitbuf, entry) >> (u8)(entry >> 8);
+		bitbuf >>= (u8)entry;
+		bitsleft -= entry;
+
+		CHECK_NOT_OVERREAD();
+		if (unlikely(length > out_end - out_next))
+			goto window_full;
+		SAFETY_CHECK(offset <= out_next - out);
+		src = out_next - offset;
+		dst = out_next;
+		out_next += length;
+
+		STATIC_ASSERT(DEFLATE_MIN_MATCH_LEN == 3);
+		*dst++ = *src++;
+		*dst++ = *src++;
+		do {
+			*dst++ = *src++;
+		} while (dst < out_next);
+	}
+
+stored_block:
+	/* Copy as much of the uncompressed block as possible. */
+	count = MIN(s->stored_len_remaining,
+		    MIN(in_end - in_next, out_end - out_next));
+	if (count) {
+		memcpy(out_next, in_next, count);
+		in_next += count;
+		out_next += count;
+		s->stored_len_remaining -= count;
+	}
+	if (s->stored_len_remaining != 0) {
+		status = (out_next == out_end) ? STREAM_NEED_OUTPUT :
+						  STREAM_NEED_INPUT;
+		goto suspend;
+	}
+
+block_done:
+	/* Finished decoding a block */
+
+	if (!s->is_final_block) {
+		s->state = STREAM_STATE_BLOCK_HEADER;
+		goto next_block;
+	}
+
+	/* That was the last block. */
+	bitsleft = (u8)bitsleft - (8 * (u32)overread_count);
+	s->state = STREAM_STATE_DONE;
+	status = STREAM_END;
+	goto suspend;
+
+check_failed:
+	/*
+	 * If any appended zero bytes were refilled, the failure might have
+	 * been caused by them rather than by the real data.
+	 */
+	if (overread_count == 0) {
+		*in_used_ret = 0;
+		return STREAM_BAD_DATA;
+	}
+need_input:
+	status = STREAM_NEED_INPUT;
+	goto rollback;
+
+window_full:
+	status = STREAM_NEED_OUTPUT;
+rollback:
+	bitbuf = checkpoint_bitbuf;
+	bitsleft = checkpoint_bitsleft;
+	in_next = checkpoint_in_next;
+suspend:
+	/*
+	 * Give back the whole bytes in the bitbuffer.  This leaves the input
+	 * position at the next byte boundary, which at the end of the stream
+	 * is what is reported as the compressed size.
+	 */
+	in_next -= bitsleft >> 3;
+	bitsleft &= 7;
+	s->bitbuf = bitbuf & BITMASK(bitsleft);
+	s->bitsleft = bitsleft;
+	s->out_pos = out_next - out;
+	*in_used_ret = in_next - in;
+	return status;
+}
+
+/* Restore the definition from deflate_decompress.c. */
+#undef SAFETY_CHECK
+#define SAFETY_CHECK(expr)	if (unlikely(!(expr))) return LIBDEFLATE_BAD_DATA
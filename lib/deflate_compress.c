@@ -40,10 +40,10 @@
 
 /*
  * If this parameter is defined to 1, then the near-optimal parsing algorithm
- * will be included, and compression levels 10-12 will use it.  This algorithm
+ * will be included, and compression levels 10-14 will use it.  This algorithm
  * usually produces a compression ratio significantly better than the other
  * algorithms.  However, it is slow.  If this parameter is defined to 0, then
- * levels 10-12 will be the same as level 9 and will use the lazy2 algorithm.
+ * levels 10-14 will be the same as level 9 and will use the lazy2 algorithm.
  */
 #define SUPPORT_NEAR_OPTIMAL_PARSING	1
 
@@ -80,6 +80,14 @@
  */
 #define SOFT_MAX_BLOCK_LENGTH	300000
 
+/*
+ * For the near-optimal compressor: the soft maximum block length used when
+ * libdeflate_options::low_memory is set.  This cuts the memory used by the
+ * match cache and the optimum nodes, which are sized for the soft maximum block
+ * length, by almost 80%, at the cost of a slightly worse compression ratio.
+ */
+#define LOW_MEMORY_SOFT_MAX_BLOCK_LENGTH	65536
+
 /*
  * For the greedy, lazy, and lazy2 compressors: this is the length of the
  * sequence store, which is an array where the compressor temporarily stores
@@ -107,6 +115,36 @@
  */
 #define FAST_SEQ_STORE_LENGTH	8192
 
+/*
+ * For deflate_compress_ultrafast(): the size of the buffer that a block is
+ * written to when the output buffer might not have room for it.  This fits the
+ * block header, up to FAST_SOFT_MAX_BLOCK_LENGTH + DEFLATE_MAX_MATCH_LEN bytes
+ * of data at no more than 9 bits per byte, the end-of-block symbol, and a whole
+ * word written past the end.
+ */
+#define ULTRAFAST_BLOCK_BUF_LENGTH					\
+	(DIV_ROUND_UP(7 + 3 + 7 + 9 * (FAST_SOFT_MAX_BLOCK_LENGTH +	\
+				       DEFLATE_MAX_MATCH_LEN), 8) + WORDBYTES)
+
+/*
+ * This is the amount of new data that the streaming compression interface
+ * accumulates before compressing it.  Each such piece is compressed in one go,
+ * with the preceding STREAM_HISTORY_LENGTH bytes kept as history, so this
+ * is also the granularity at which the streaming interface produces output.
+ * Larger values let the block splitting algorithm work across more data, but
+ * increase the memory usage of streaming compression.  This must be at least
+ * MIN_BLOCK_LENGTH.
+ */
+#define STREAM_CHUNK_LENGTH	524288
+
+/*
+ * The amount of data that the streaming compression interface keeps as history
+ * for the next piece: the window, plus the end of the piece that the binary
+ * tree matchfinder may not have inserted yet (see deflate_bt_insert_end()),
+ * since inserting it then searches the window that precedes it.
+ */
+#define STREAM_HISTORY_LENGTH	(MATCHFINDER_WINDOW_SIZE + DEFLATE_MAX_MATCH_LEN)
+
 /*
  * These are the maximum codeword lengths, in bits, the compressor will use for
  * each Huffman code.  The DEFLATE format defines limits for these.  However,
@@ -152,10 +190,25 @@
 
 /*
  * This is (slightly less than) the maximum number of matches that the
- * near-optimal compressor will cache per block.  This behaves similarly to
- * SEQ_STORE_LENGTH for the other compressors.
+ * near-optimal compressor will cache per block, given the soft maximum block
+ * length.  This behaves similarly to SEQ_STORE_LENGTH for the other
+ * compressors.
+ */
+#define MATCH_CACHE_LENGTH(soft_max_len)	((soft_max_len) * 5)
+
+/*
+ * For levels 13 and 14, which split the data into blocks by searching over
+ * candidate block ends (see deflate_search_block_split()): the distance in
+ * bytes between the evenly spaced candidates.  Smaller values consider more
+ * ways to split the data but make the search slower and need more memory.
+ */
+#define SPLIT_GRANULARITY(level)	((level) == 13 ? 4096 : 1024)
+
+/*
+ * For levels 13 and 14: the maximum number of times the data is split into
+ * blocks again, after the blocks from the previous split have been reparsed
  */
-#define MATCH_CACHE_LENGTH	(SOFT_MAX_BLOCK_LENGTH * 5)
+#define MAX_SPLIT_SEARCH_ROUNDS		8
 
 #endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
 
@@ -176,18 +229,31 @@
  */
 #define MAX_MATCHES_PER_POS	\
 	(DEFLATE_MAX_MATCH_LEN - DEFLATE_MIN_MATCH_LEN + 1)
+
+/*
+ * The number of extra match cache entries beyond MATCH_CACHE_LENGTH.  These
+ * absorb the worst case overflow, which occurs if starting at the last entry
+ * before the limit, we write MAX_MATCHES_PER_POS matches and a match count
+ * header, then skip searching for matches at 'DEFLATE_MAX_MATCH_LEN - 1'
+ * positions and write the match count header for each, then write just a match
+ * count header for each position until the block reaches MIN_BLOCK_LENGTH.
+ */
+#define MATCH_CACHE_SLACK	\
+	(MAX_MATCHES_PER_POS + DEFLATE_MAX_MATCH_LEN - 1 + MIN_BLOCK_LENGTH)
 #endif
 
 /*
- * The largest block length we will ever use is when the final block is of
- * length SOFT_MAX_BLOCK_LENGTH + MIN_BLOCK_LENGTH - 1, or when any block is of
- * length SOFT_MAX_BLOCK_LENGTH + 1 + DEFLATE_MAX_MATCH_LEN.  The latter case
- * occurs when the lazy2 compressor chooses two literals and a maximum-length
- * match, starting at SOFT_MAX_BLOCK_LENGTH - 1.
+ * The largest block length we will ever use with a given soft maximum block
+ * length is when the final block is of length soft_max_len + MIN_BLOCK_LENGTH -
+ * 1, or when any block is of length soft_max_len + 1 + DEFLATE_MAX_MATCH_LEN.
+ * The latter case occurs when the lazy2 compressor chooses two literals and a
+ * maximum-length match, starting at soft_max_len - 1.
  */
-#define MAX_BLOCK_LENGTH	\
-	MAX(SOFT_MAX_BLOCK_LENGTH + MIN_BLOCK_LENGTH - 1,	\
-	    SOFT_MAX_BLOCK_LENGTH + 1 + DEFLATE_MAX_MATCH_LEN)
+#define MAX_BLOCK_LENGTH_FOR(soft_max_len)			\
+	MAX((soft_max_len) + MIN_BLOCK_LENGTH - 1,		\
+	    (soft_max_len) + 1 + DEFLATE_MAX_MATCH_LEN)
+
+#define MAX_BLOCK_LENGTH	MAX_BLOCK_LENGTH_FOR(SOFT_MAX_BLOCK_LENGTH)
 
 static forceinline void
 check_buildtime_parameters(void)
@@ -202,10 +268,7 @@ check_buildtime_parameters(void)
 		      MIN_BLOCK_LENGTH);
 	STATIC_ASSERT(FAST_SEQ_STORE_LENGTH * HT_MATCHFINDER_MIN_MATCH_LEN >=
 		      MIN_BLOCK_LENGTH);
-#if SUPPORT_NEAR_OPTIMAL_PARSING
-	STATIC_ASSERT(MIN_BLOCK_LENGTH * MAX_MATCHES_PER_POS <=
-		      MATCH_CACHE_LENGTH);
-#endif
+	STATIC_ASSERT(STREAM_CHUNK_LENGTH >= MIN_BLOCK_LENGTH);
 
 	/* The definition of MAX_BLOCK_LENGTH assumes this. */
 	STATIC_ASSERT(FAST_SOFT_MAX_BLOCK_LENGTH <= SOFT_MAX_BLOCK_LENGTH);
@@ -307,6 +370,18 @@ static const u8 deflate_offset_slot[256] = {
 	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
 };
 
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+/*
+ * Table: 'offset => offset_slot' for all offsets.  This differs from
+ * deflate_offset_slot[] in that this is a full map, not a condensed one.  The
+ * full map is more appropriate for the near-optimal parser, since the
+ * near-optimal parser does more offset => offset_slot translations, and it
+ * doesn't intersperse them with matchfinding (so cache evictions are less of a
+ * concern).  Being constant, it is shared by all compressors.
+ */
+#include "deflate_offset_slot_full.h"
+#endif
+
 /* The order in which precode codeword lengths are stored */
 static const u8 deflate_precode_lens_permutation[DEFLATE_NUM_PRECODE_SYMS] = {
 	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
@@ -433,6 +508,41 @@ struct deflate_optimum_node {
 
 };
 
+/*
+ * A candidate block end for the block split search of levels 13 and 14.  There
+ * is one every 'split_granularity' bytes from the start of the data being
+ * split, one wherever the block split heuristic would have ended a block, and
+ * one at the end of the data.  Each but the last also begins a segment that
+ * extends to the next one.
+ */
+struct deflate_split_point {
+
+	/* The position of this point in the data being split */
+	u32 pos;
+
+	/* The end of the cached matches for the data before this point */
+	struct lz_match *cache_ptr;
+
+	/*
+	 * The lowest cost of the data before this point found by the search,
+	 * and the point at which the last block of that split begins
+	 */
+	u32 cost;
+	u32 prev;
+
+	/*
+	 * For each of the two splits being compared, the point that ends the
+	 * block beginning here, if a block begins here
+	 */
+	u32 next[2];
+
+	/*
+	 * For each of the two parses being compared, the number of times each
+	 * symbol is used by the items that begin in this segment
+	 */
+	struct deflate_freqs freqs[2];
+};
+
 #endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
 
 /* Block split statistics.  See "Block splitting algorithm" below. */
@@ -448,24 +558,195 @@ struct block_split_stats {
 	u32 num_observations;
 };
 
+/*
+ * The maximum number of bits in the part of a dynamic Huffman block header that
+ * follows BTYPE: the HLIT, HDIST, and HCLEN fields, the precode codeword
+ * lengths, and each litlen and offset codeword length as a precode codeword
+ * plus at most 7 extra bits
+ */
+#define MAX_HUFFMAN_HEADER_NBITS					\
+	(5 + 5 + 4 + (3 * DEFLATE_NUM_PRECODE_SYMS) +			\
+	 ((DEFLATE_NUM_LITLEN_SYMS + DEFLATE_NUM_OFFSET_SYMS) *		\
+	  (MAX_PRE_CODEWORD_LEN + 7)))
+
+/* Huffman codes trained on sample data, with their block header precomputed */
+struct libdeflate_huffman_table {
+
+	/* The free() function for this struct */
+	free_func_t free_func;
+
+	/*
+	 * The codes.  Symbols that didn't occur in the samples have no
+	 * codeword, except for the end-of-block symbol which always has one.
+	 */
+	struct deflate_codes codes;
+
+	/*
+	 * The dynamic Huffman block header for the codes, minus BFINAL and
+	 * BTYPE, as a bitstring of 'header_nbits' bits.  The extra space is
+	 * because the header is generated with whole-word writes.
+	 */
+	u32 header_nbits;
+	u8 header[DIV_ROUND_UP(MAX_HUFFMAN_HEADER_NBITS, 8) + WORDBYTES];
+};
+
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+/*
+ * The symbol costs that the near-optimal compressor ended up with for a block,
+ * and the block's literal/match statistics; see libdeflate_save_cost_model()
+ */
+struct libdeflate_cost_model {
+
+	/* The free() function for this struct */
+	free_func_t free_func;
+
+	struct deflate_costs costs;
+	u32 observations[NUM_OBSERVATION_TYPES];
+	u32 num_observations;
+};
+#endif
+
 struct deflate_output_bitstream;
+struct deflate_stream;
+
+/*
+ * The number of "rungs" that a compressor with a target speed (see
+ * libdeflate_options::rate_control) can move between: the parameters of
+ * compression levels 2-9, which all use the hash chains matchfinder
+ */
+#define MAX_RATE_RUNGS		8
+
+/*
+ * The number of bytes to compress on a rung before measuring its speed, so that
+ * small buffers are measured together rather than one at a time
+ */
+#define RATE_SAMPLE_NBYTES	65536
+
+/*
+ * The state of a compressor with a target speed; see
+ * deflate_compress_adaptive()
+ */
+struct deflate_rate_state {
+
+	/* The target, as given in libdeflate_options */
+	struct libdeflate_rate_control control;
+
+	/*
+	 * The number of rungs, which are compression levels 2 up to the
+	 * compression level of the compressor, and the current one.  The top
+	 * rung uses the compressor's own parameters, which may have been
+	 * overridden in libdeflate_options.
+	 */
+	unsigned num_rungs;
+	unsigned rung;
+	void (*top_impl)(struct libdeflate_compressor *restrict c,
+			 const u8 *in, size_t in_nbytes, bool is_final,
+			 struct deflate_output_bitstream *os);
+	unsigned top_max_search_depth;
+	unsigned top_nice_match_length;
+
+	/*
+	 * The estimated time in nanoseconds that each rung takes per KiB of
+	 * input, or 0 if it hasn't been measured yet
+	 */
+	u64 ns_per_kib[MAX_RATE_RUNGS];
+
+	/* The time and input on the current rung since it was last measured */
+	u64 sample_ns;
+	u64 sample_nbytes;
+};
 
 /* The main DEFLATE compressor structure */
 struct libdeflate_compressor {
 
-	/* Pointer to the compress() implementation chosen at allocation time */
+	/*
+	 * Pointer to the compress() implementation chosen at allocation time.
+	 * It compresses the 'in_nbytes' bytes at 'in' as one or more blocks,
+	 * the last of which is marked final if 'is_final' is true.
+	 */
 	void (*impl)(struct libdeflate_compressor *restrict c, const u8 *in,
-		     size_t in_nbytes, struct deflate_output_bitstream *os);
+		     size_t in_nbytes, bool is_final,
+		     struct deflate_output_bitstream *os);
+
+	/* The malloc() function for this struct, chosen at allocation time */
+	malloc_func_t malloc_func;
 
 	/* The free() function for this struct, chosen at allocation time */
 	free_func_t free_func;
 
+	/*
+	 * State of the streaming compression interface, or NULL if it hasn't
+	 * been used with this compressor
+	 */
+	struct deflate_stream *stream;
+
+	/*
+	 * Buffer for compressing the start of the input together with a preset
+	 * dictionary, or NULL if no dictionary has been used
+	 */
+	u8 *dict_buf;
+
+	/*
+	 * If true, the compress() implementation doesn't reset the matchfinder
+	 * but rather continues from where the previous call left off, allowing
+	 * matches to refer to the data preceding 'in'.  That data must still be
+	 * in memory.  'mf_pending' is then the number of bytes just before
+	 * 'in' that the matchfinder hasn't inserted yet, which it inserts first
+	 * (see deflate_bt_insert_end()); 'mf_pos' is the position of the first
+	 * of them relative to the base pointer the matchfinder stores positions
+	 * relative to, and 'mf_next_hashes' holds the precomputed hash codes
+	 * for it.
+	 */
+	bool mf_resume;
+	u32 mf_pending;
+	u32 mf_pos;
+	u32 mf_next_hashes[2];
+
+	/*
+	 * The number of bits by which the matchfinder's hash orders are
+	 * currently reduced; see MATCHFINDER_MAX_ORDER_REDUCTION
+	 */
+	unsigned mf_order_reduction;
+
+	/*
+	 * The size of the window the matchfinder searches for matches in: a
+	 * power of 2 no larger than MATCHFINDER_WINDOW_SIZE
+	 */
+	u32 mf_window_size;
+
 	/* The compression level with which this compressor was created */
 	unsigned compression_level;
 
 	/* Anything of this size or less we won't bother trying to compress. */
 	size_t max_passthrough_size;
 
+	/* The offload backend; its functions are NULL if there is none */
+	struct libdeflate_backend backend;
+
+	/*
+	 * The checksum that libdeflate_begin_input_checksum() asked to compute
+	 * over the input, if any, and the input position it has reached
+	 */
+	checksum_func_t checksum_func;
+	u32 checksum;
+	const u8 *checksum_next;
+
+	/* Statistics since allocation or libdeflate_reset_compress_stats() */
+	struct libdeflate_compress_stats stats;
+
+	/*
+	 * The matchfinders' counters, which are copied into the statistics
+	 * when they are retrieved.  Only updated with LIBDEFLATE_ENABLE_COUNTERS.
+	 */
+	struct matchfinder_counters mf_counters;
+
+	/*
+	 * The adaptive parameters of a compressor with a target speed; see
+	 * libdeflate_options::rate_control.  Only used if c->impl is
+	 * deflate_compress_adaptive().
+	 */
+	struct deflate_rate_state rate;
+
 	/*
 	 * The maximum search depth: consider at most this many potential
 	 * matches at each position
@@ -478,6 +759,15 @@ struct libdeflate_compressor {
 	 */
 	unsigned nice_match_length;
 
+	/*
+	 * The soft maximum block length: SOFT_MAX_BLOCK_LENGTH, or
+	 * FAST_SOFT_MAX_BLOCK_LENGTH for deflate_compress_fastest(), or
+	 * LOW_MEMORY_SOFT_MAX_BLOCK_LENGTH for deflate_compress_near_optimal()
+	 * in low-memory mode, unless overridden by a smaller value in
+	 * libdeflate_options
+	 */
+	unsigned soft_max_block_length;
+
 	/* Frequency counters for the current block */
 	struct deflate_freqs freqs;
 
@@ -487,8 +777,23 @@ struct libdeflate_compressor {
 	/* Dynamic Huffman codes for the current block */
 	struct deflate_codes codes;
 
-	/* The static Huffman codes defined by the DEFLATE format */
-	struct deflate_codes static_codes;
+	/*
+	 * Trained Huffman codes to consider for each block, or NULL; see
+	 * libdeflate_set_huffman_table()
+	 */
+	const struct libdeflate_huffman_table *huffman_table;
+
+	/*
+	 * The cost model to start the first block of each call from at levels
+	 * 10-14, or NULL; see libdeflate_set_cost_model()
+	 */
+	const struct libdeflate_cost_model *cost_model;
+
+	/*
+	 * While training Huffman codes, the symbol frequencies of all blocks
+	 * so far.  NULL otherwise.
+	 */
+	struct deflate_freqs *train_freqs;
 
 	/* Temporary space for block flushing */
 	union {
@@ -517,12 +822,16 @@ struct libdeflate_compressor {
 	union {
 		/* Data for greedy or lazy parsing */
 		struct {
-			/* Hash chains matchfinder */
-			struct hc_matchfinder hc_mf;
-
 			/* Matches and literals chosen for the current block */
 			struct deflate_sequence sequences[SEQ_STORE_LENGTH + 1];
 
+			/*
+			 * Hash chains matchfinder.  It comes last since only
+			 * the part of it that the window size needs is
+			 * allocated.
+			 */
+			struct hc_matchfinder hc_mf;
+
 		} g; /* (g)reedy */
 
 		/* Data for fastest parsing */
@@ -536,13 +845,34 @@ struct libdeflate_compressor {
 
 		} f; /* (f)astest */
 
+		/* Data for Huffman-only and run-length compression */
+		struct {
+			/* Matches and literals chosen for the current block */
+			struct deflate_sequence sequences[
+						FAST_SEQ_STORE_LENGTH + 1];
+
+		} r; /* (r)un-length */
+
+		/* Data for ultrafast compression */
+		struct {
+			/*
+			 * Hash table matchfinder, of which only the first entry
+			 * in each bucket is used
+			 */
+			struct ht_matchfinder ht_mf;
+
+			/*
+			 * Where blocks are written when the output buffer
+			 * might not have room for them
+			 */
+			u8 block_buf[ULTRAFAST_BLOCK_BUF_LENGTH];
+
+		} u; /* (u)ltrafast */
+
 	#if SUPPORT_NEAR_OPTIMAL_PARSING
 		/* Data for near-optimal parsing */
 		struct {
 
-			/* Binary tree matchfinder */
-			struct bt_matchfinder bt_mf;
-
 			/*
 			 * Cached matches for the current block.  This array
 			 * contains the matches that were found at each position
@@ -558,30 +888,46 @@ struct libdeflate_compressor {
 			 * Note: in rare cases, there will be a very high number
 			 * of matches in the block and this array will overflow.
 			 * If this happens, we force the end of the current
-			 * block.  MATCH_CACHE_LENGTH is the length at which we
-			 * actually check for overflow.  The extra slots beyond
-			 * this are enough to absorb the worst case overflow,
-			 * which occurs if starting at
-			 * &match_cache[MATCH_CACHE_LENGTH - 1], we write
-			 * MAX_MATCHES_PER_POS matches and a match count header,
-			 * then skip searching for matches at
-			 * 'DEFLATE_MAX_MATCH_LEN - 1' positions and write the
-			 * match count header for each.
+			 * block, or if it is still shorter than
+			 * MIN_BLOCK_LENGTH, stop caching matches until it
+			 * isn't.  'match_cache_end' is where we actually check
+			 * for overflow; it is MATCH_CACHE_LENGTH entries in,
+			 * and MATCH_CACHE_SLACK more entries follow it.
+			 *
+			 * This array is allocated along with the compressor,
+			 * sized for the compressor's soft maximum block length.
+			 */
+			struct lz_match *match_cache;
+			struct lz_match *match_cache_end;
+
+			/*
+			 * If the compressor was allocated with a task
+			 * submitter, then the matches for the next block are
+			 * found by a task while the current block is being
+			 * optimized.  The task fills this second match cache,
+			 * which is the same size as the first, and records the
+			 * number of matches it found at each position in
+			 * 'match_counts', one entry per position from the start
+			 * of the next block.  Without a submitter, both are
+			 * NULL.
 			 */
-			struct lz_match match_cache[MATCH_CACHE_LENGTH +
-						    MAX_MATCHES_PER_POS +
-						    DEFLATE_MAX_MATCH_LEN - 1];
+			struct lz_match *next_match_cache;
+			u16 *match_counts;
+			struct libdeflate_task_submitter submitter;
 
 			/*
 			 * Array of nodes, one per position, for running the
 			 * minimum-cost path algorithm.
 			 *
 			 * This array must be large enough to accommodate the
-			 * worst-case number of nodes, which is MAX_BLOCK_LENGTH
-			 * plus 1 for the end-of-block node.
+			 * worst-case number of nodes, which is the maximum
+			 * block length for the compressor's soft maximum block
+			 * length, plus 1 for the end-of-block node.  Like
+			 * match_cache, it is allocated along with the
+			 * compressor.
 			 */
-			struct deflate_optimum_node optimum_nodes[
-				MAX_BLOCK_LENGTH + 1];
+			struct deflate_optimum_node *optimum_nodes;
+			u32 num_optimum_nodes;
 
 			/* The current cost model being used */
 			struct deflate_costs costs;
@@ -589,22 +935,16 @@ struct libdeflate_compressor {
 			/* Saved cost model */
 			struct deflate_costs costs_saved;
 
-			/*
-			 * A table that maps match offset to offset slot.  This
-			 * differs from deflate_offset_slot[] in that this is a
-			 * full map, not a condensed one.  The full map is more
-			 * appropriate for the near-optimal parser, since the
-			 * near-optimal parser does more offset => offset_slot
-			 * translations, it doesn't intersperse them with
-			 * matchfinding (so cache evictions are less of a
-			 * concern), and it uses more memory anyway.
-			 */
-			u8 offset_slot_full[DEFLATE_MAX_MATCH_OFFSET + 1];
-
 			/* Literal/match statistics saved from previous block */
 			u32 prev_observations[NUM_OBSERVATION_TYPES];
 			u32 prev_num_observations;
 
+			/*
+			 * Whether a block has been optimized yet, so that
+			 * 'costs' and the statistics above are from one
+			 */
+			bool have_costs;
+
 			/*
 			 * Approximate match length frequencies based on a
 			 * greedy parse, gathered during matchfinding.  This is
@@ -655,6 +995,27 @@ struct libdeflate_compressor {
 			 */
 			unsigned max_len_to_optimize_static_block;
 
+			/*
+			 * At levels 13 and 14, the distance between the evenly
+			 * spaced candidate block ends that the block split
+			 * search considers, the candidates, and the block ends
+			 * that the block split heuristic suggested, which are
+			 * all allocated along with the compressor.  The search
+			 * chooses where blocks end, with the heuristic's
+			 * suggestions as a starting point.  At levels 10-12
+			 * 'split_granularity' is 0.
+			 */
+			u32 split_granularity;
+			struct deflate_split_point *split_points;
+			const u8 **split_hints;
+
+			/*
+			 * Binary tree matchfinder.  It comes last since only
+			 * the part of it that the window size needs is
+			 * allocated.
+			 */
+			struct bt_matchfinder bt_mf;
+
 		} n; /* (n)ear-optimal */
 	#endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
 
@@ -707,6 +1068,104 @@ struct deflate_output_bitstream {
 
 	/* true if the output buffer ran out of space */
 	bool overflow;
+
+	/*
+	 * If non-NULL, the output is being fit into the buffer that ends here
+	 * (libdeflate_deflate_compress_fit()).  @end is then kept short of it
+	 * by FIT_RESERVE_NBYTES, so that there is always room to end the stream
+	 * once a block doesn't fit.
+	 */
+	u8 *fit_end;
+
+	/* The end of the input that was compressed, when the fit stream ended */
+	const u8 *fit_in_end;
+};
+
+/*
+ * Space held back from the blocks when fitting the output into a buffer: enough
+ * for an empty final static Huffman block after a partial byte
+ */
+#define FIT_RESERVE_NBYTES	2
+
+/*
+ * When fitting the output into a buffer, the input is compressed in pieces so
+ * that little work is wasted on input that won't fit.  The first piece is
+ * FIT_PIECE_RATIO times the output space.  Later ones are 1.5 times what the
+ * compression ratio so far says will fill the remaining space, so that usually
+ * the second piece is the last.  Pieces other than the whole input are at least
+ * MIN_BLOCK_LENGTH bytes, since blocks that aren't final can't be shorter.
+ */
+#define FIT_PIECE_RATIO		4
+
+/* State of a streaming compression operation */
+struct deflate_stream {
+
+	/* Bits of output that don't yet make up a full byte */
+	bitbuf_t bitbuf;
+	unsigned bitcount;
+
+	/*
+	 * Number of bytes at the beginning of 'buf' that have already been
+	 * compressed and are kept only so that later matches can refer to them
+	 */
+	size_t history_nbytes;
+
+	/* Total number of bytes in 'buf', including the history */
+	size_t buf_nbytes;
+
+	/* true if a call failed, so the stream can't be continued */
+	bool failed;
+
+	/* Window of recent data, followed by data not yet compressed */
+	u8 buf[STREAM_HISTORY_LENGTH + STREAM_CHUNK_LENGTH];
+};
+
+/*
+ * When compressing with a preset dictionary, this much data at the start of the
+ * input is copied into a buffer after the dictionary, so that matches can refer
+ * to it.  The rest of the input is too far from the dictionary to need that.
+ * This is a multiple of MIN_BLOCK_LENGTH so that splitting the input here can't
+ * increase the worst-case number of blocks.
+ */
+#define DICT_HEAD_LENGTH	(7 * MIN_BLOCK_LENGTH)
+
+/*
+ * The number of bytes at the end of a dictionary which can't be inserted into
+ * the matchfinder until the data that follows it is known.  The binary tree
+ * matchfinder holds back more than this by itself; see deflate_bt_insert_end().
+ */
+#define DICT_TAIL_LENGTH	5
+
+/* A preset dictionary, with its matchfinder state precomputed */
+struct libdeflate_compression_dict {
+
+	/* The match finding parameters the matchfinder state is for */
+	void (*impl)(struct libdeflate_compressor *restrict c, const u8 *in,
+		     size_t in_nbytes, bool is_final,
+		     struct deflate_output_bitstream *os);
+	unsigned max_search_depth;
+	unsigned nice_match_length;
+	u32 window_size;
+
+	/* The free() function for this struct */
+	free_func_t free_func;
+
+	/* The full dictionary, and the part of it that matches can refer to */
+	const u8 *dict;
+	size_t dict_nbytes;
+	const u8 *window;
+	u32 window_nbytes;
+
+	/*
+	 * The matchfinder state after inserting all of the window except the
+	 * last DICT_TAIL_LENGTH bytes, and except the 'mf_pending' bytes before
+	 * those that the binary tree matchfinder holds back
+	 */
+	u32 mf_pending;
+	u32 mf_pos;
+	u32 mf_next_hashes[2];
+	size_t mf_size;
+	u8 mf[];
 };
 
 /*
@@ -729,11 +1188,14 @@ do {						\
  * remaining before actually writing the block, it's guaranteed that out_next
  * won't exceed os->end.  However, there might not be enough space remaining to
  * flush a whole word, even though that's fastest.  Therefore, flush a whole
- * word if there is space for it, otherwise flush a byte at a time.
+ * word if there is space for it, otherwise flush a byte at a time.  Callers
+ * that know there is always space for a whole word set 'out_unchecked' so that
+ * the check is compiled out.
  */
 #define FLUSH_BITS()							\
 do {									\
-	if (UNALIGNED_ACCESS_IS_FAST && likely(out_next < out_fast_end)) { \
+	if (UNALIGNED_ACCESS_IS_FAST &&					\
+	    (out_unchecked || likely(out_next < out_fast_end))) {	\
 		/* Flush a whole word (branchlessly). */		\
 		put_unaligned_leword(bitbuf, out_next);			\
 		bitbuf >>= bitcount & ~7;				\
@@ -1428,26 +1890,85 @@ deflate_make_huffman_codes(const struct deflate_freqs *freqs,
 				  codes->codewords.offset);
 }
 
-/* Initialize c->static_codes. */
-static void
-deflate_init_static_codes(struct libdeflate_compressor *c)
-{
-	unsigned i;
-
-	for (i = 0; i < 144; i++)
-		c->freqs.litlen[i] = 1 << (9 - 8);
-	for (; i < 256; i++)
-		c->freqs.litlen[i] = 1 << (9 - 9);
-	for (; i < 280; i++)
-		c->freqs.litlen[i] = 1 << (9 - 7);
-	for (; i < 288; i++)
-		c->freqs.litlen[i] = 1 << (9 - 8);
-
-	for (i = 0; i < 32; i++)
-		c->freqs.offset[i] = 1 << (5 - 5);
-
-	deflate_make_huffman_codes(&c->freqs, &c->static_codes);
-}
+/*
+ * The static Huffman codes defined by the DEFLATE format.  These are the same
+ * for every compressor, so they are a constant rather than being built at
+ * allocation time.  Generated by scripts/gen_static_codes.py.
+ */
+static const struct deflate_codes deflate_static_codes = {
+	.codewords = {
+		.litlen = {
+			0x00c, 0x08c, 0x04c, 0x0cc, 0x02c, 0x0ac, 0x06c, 0x0ec,
+			0x01c, 0x09c, 0x05c, 0x0dc, 0x03c, 0x0bc, 0x07c, 0x0fc,
+			0x002, 0x082, 0x042, 0x0c2, 0x022, 0x0a2, 0x062, 0x0e2,
+			0x012, 0x092, 0x052, 0x0d2, 0x032, 0x0b2, 0x072, 0x0f2,
+			0x00a, 0x08a, 0x04a, 0x0ca, 0x02a, 0x0aa, 0x06a, 0x0ea,
+			0x01a, 0x09a, 0x05a, 0x0da, 0x03a, 0x0ba, 0x07a, 0x0fa,
+			0x006, 0x086, 0x046, 0x0c6, 0x026, 0x0a6, 0x066, 0x0e6,
+			0x016, 0x096, 0x056, 0x0d6, 0x036, 0x0b6, 0x076, 0x0f6,
+			0x00e, 0x08e, 0x04e, 0x0ce, 0x02e, 0x0ae, 0x06e, 0x0ee,
+			0x01e, 0x09e, 0x05e, 0x0de, 0x03e, 0x0be, 0x07e, 0x0fe,
+			0x001, 0x081, 0x041, 0x0c1, 0x021, 0x0a1, 0x061, 0x0e1,
+			0x011, 0x091, 0x051, 0x0d1, 0x031, 0x0b1, 0x071, 0x0f1,
+			0x009, 0x089, 0x049, 0x0c9, 0x029, 0x0a9, 0x069, 0x0e9,
+			0x019, 0x099, 0x059, 0x0d9, 0x039, 0x0b9, 0x079, 0x0f9,
+			0x005, 0x085, 0x045, 0x0c5, 0x025, 0x0a5, 0x065, 0x0e5,
+			0x015, 0x095, 0x055, 0x0d5, 0x035, 0x0b5, 0x075, 0x0f5,
+			0x00d, 0x08d, 0x04d, 0x0cd, 0x02d, 0x0ad, 0x06d, 0x0ed,
+			0x01d, 0x09d, 0x05d, 0x0dd, 0x03d, 0x0bd, 0x07d, 0x0fd,
+			0x013, 0x113, 0x093, 0x193, 0x053, 0x153, 0x0d3, 0x1d3,
+			0x033, 0x133, 0x0b3, 0x1b3, 0x073, 0x173, 0x0f3, 0x1f3,
+			0x00b, 0x10b, 0x08b, 0x18b, 0x04b, 0x14b, 0x0cb, 0x1cb,
+			0x02b, 0x12b, 0x0ab, 0x1ab, 0x06b, 0x16b, 0x0eb, 0x1eb,
+			0x01b, 0x11b, 0x09b, 0x19b, 0x05b, 0x15b, 0x0db, 0x1db,
+			0x03b, 0x13b, 0x0bb, 0x1bb, 0x07b, 0x17b, 0x0fb, 0x1fb,
+			0x007, 0x107, 0x087, 0x187, 0x047, 0x147, 0x0c7, 0x1c7,
+			0x027, 0x127, 0x0a7, 0x1a7, 0x067, 0x167, 0x0e7, 0x1e7,
+			0x017, 0x117, 0x097, 0x197, 0x057, 0x157, 0x0d7, 0x1d7,
+			0x037, 0x137, 0x0b7, 0x1b7, 0x077, 0x177, 0x0f7, 0x1f7,
+			0x00f, 0x10f, 0x08f, 0x18f, 0x04f, 0x14f, 0x0cf, 0x1cf,
+			0x02f, 0x12f, 0x0af, 0x1af, 0x06f, 0x16f, 0x0ef, 0x1ef,
+			0x01f, 0x11f, 0x09f, 0x19f, 0x05f, 0x15f, 0x0df, 0x1df,
+			0x03f, 0x13f, 0x0bf, 0x1bf, 0x07f, 0x17f, 0x0ff, 0x1ff,
+			0x000, 0x040, 0x020, 0x060, 0x010, 0x050, 0x030, 0x070,
+			0x008, 0x048, 0x028, 0x068, 0x018, 0x058, 0x038, 0x078,
+			0x004, 0x044, 0x024, 0x064, 0x014, 0x054, 0x034, 0x074,
+			0x003, 0x083, 0x043, 0x0c3, 0x023, 0x0a3, 0x063, 0x0e3,
+		},
+		.offset = {
+			0x00, 0x10, 0x08, 0x18, 0x04, 0x14, 0x0c, 0x1c,
+			0x02, 0x12, 0x0a, 0x1a, 0x06, 0x16, 0x0e, 0x1e,
+			0x01, 0x11, 0x09, 0x19, 0x05, 0x15, 0x0d, 0x1d,
+			0x03, 0x13, 0x0b, 0x1b, 0x07, 0x17, 0x0f, 0x1f,
+		},
+	},
+	.lens = {
+		.litlen = {
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+			7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+			7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8,
+		},
+		.offset = {
+			5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+			5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+		},
+	},
+};
 
 /* Return the offset slot for the given match offset, using the small map. */
 static forceinline unsigned
@@ -1657,6 +2178,58 @@ deflate_compute_full_len_codewords(struct libdeflate_compressor *c,
 	}
 }
 
+/*
+ * Write the run of @litrunlen_ literals at @in_next_ to the output buffer, and
+ * advance @in_next_ past them.
+ */
+#define WRITE_LITERALS(codes_, in_next_, litrunlen_)			\
+do {									\
+	const struct deflate_codes *codes__ = (codes_);			\
+	u32 litrunlen__ = (litrunlen_);					\
+	unsigned lit__;							\
+									\
+	if (CAN_BUFFER(4 * MAX_LITLEN_CODEWORD_LEN)) {			\
+		for (; litrunlen__ >= 4; litrunlen__ -= 4) {		\
+			lit__ = *(in_next_)++;				\
+			ADD_BITS(codes__->codewords.litlen[lit__],	\
+				 codes__->lens.litlen[lit__]);		\
+			lit__ = *(in_next_)++;				\
+			ADD_BITS(codes__->codewords.litlen[lit__],	\
+				 codes__->lens.litlen[lit__]);		\
+			lit__ = *(in_next_)++;				\
+			ADD_BITS(codes__->codewords.litlen[lit__],	\
+				 codes__->lens.litlen[lit__]);		\
+			lit__ = *(in_next_)++;				\
+			ADD_BITS(codes__->codewords.litlen[lit__],	\
+				 codes__->lens.litlen[lit__]);		\
+			FLUSH_BITS();					\
+		}							\
+		if (litrunlen__-- != 0) {				\
+			lit__ = *(in_next_)++;				\
+			ADD_BITS(codes__->codewords.litlen[lit__],	\
+				 codes__->lens.litlen[lit__]);		\
+			if (litrunlen__-- != 0) {			\
+				lit__ = *(in_next_)++;			\
+				ADD_BITS(codes__->codewords.litlen[lit__], \
+					 codes__->lens.litlen[lit__]);	\
+				if (litrunlen__-- != 0) {		\
+					lit__ = *(in_next_)++;		\
+					ADD_BITS(codes__->codewords.litlen[lit__], \
+						 codes__->lens.litlen[lit__]); \
+				}					\
+			}						\
+			FLUSH_BITS();					\
+		}							\
+	} else {							\
+		while (litrunlen__--) {					\
+			lit__ = *(in_next_)++;				\
+			ADD_BITS(codes__->codewords.litlen[lit__],	\
+				 codes__->lens.litlen[lit__]);		\
+			FLUSH_BITS();					\
+		}							\
+	}								\
+} while (0)
+
 /* Write a match to the output buffer. */
 #define WRITE_MATCH(c_, codes_, length_, offset_, offset_slot_)		\
 do {									\
@@ -1694,235 +2267,240 @@ do {									\
 } while (0)
 
 /*
- * Choose the best type of block to use (dynamic Huffman, static Huffman, or
- * uncompressed), then output it.
- *
- * The uncompressed data of the block is @block_begin[0..@block_length-1].  The
- * sequence of literals and matches that will be used to compress the block (if
- * a compressed block is chosen) is given by @sequences if it's non-NULL, or
- * else @c->p.n.optimum_nodes.  @c->freqs and @c->codes must be already set
- * according to the literals, matches, and end-of-block symbol.
+ * Write the part of a dynamic Huffman block header that follows BTYPE, for the
+ * codes that deflate_precompute_huffman_header() was last called for.
  */
-static void
-deflate_flush_block(struct libdeflate_compressor *c,
-		    struct deflate_output_bitstream *os,
-		    const u8 *block_begin, u32 block_length,
-		    const struct deflate_sequence *sequences,
-		    bool is_final_block)
-{
-	/*
-	 * It is hard to get compilers to understand that writes to 'os->next'
-	 * don't alias 'os'.  That hurts performance significantly, as
-	 * everything in 'os' would keep getting re-loaded.  ('restrict'
-	 * *should* do the trick, but it's unreliable.)  Therefore, we keep all
-	 * the output bitstream state in local variables, and output bits using
-	 * macros.  This is similar to what the decompressor does.
-	 */
-	const u8 *in_next = block_begin;
-	const u8 * const in_end = block_begin + block_length;
-	bitbuf_t bitbuf = os->bitbuf;
-	unsigned bitcount = os->bitcount;
-	u8 *out_next = os->next;
-	u8 * const out_fast_end =
-		os->end - MIN(WORDBYTES - 1, os->end - out_next);
-	/*
-	 * The cost for each block type, in bits.  Start with the cost of the
-	 * block header which is 3 bits.
-	 */
-	u32 dynamic_cost = 3;
-	u32 static_cost = 3;
-	u32 uncompressed_cost = 3;
-	u32 best_cost;
-	struct deflate_codes *codes;
-	unsigned sym;
-
-	ASSERT(block_length >= MIN_BLOCK_LENGTH ||
-	       (is_final_block && block_length > 0));
-	ASSERT(block_length <= MAX_BLOCK_LENGTH);
-	ASSERT(bitcount <= 7);
-	ASSERT((bitbuf & ~(((bitbuf_t)1 << bitcount) - 1)) == 0);
-	ASSERT(out_next <= os->end);
-	ASSERT(!os->overflow);
-
-	/* Precompute the precode items and build the precode. */
-	deflate_precompute_huffman_header(c);
+#define WRITE_HUFFMAN_HEADER(c_)					\
+do {									\
+	const struct libdeflate_compressor *c__ = (c_);			\
+	const unsigned num_explicit_lens__ =				\
+		c__->o.precode.num_explicit_lens;			\
+	const unsigned num_precode_items__ = c__->o.precode.num_items;	\
+	unsigned precode_sym__, precode_item__;				\
+	unsigned i__;							\
+									\
+	STATIC_ASSERT(CAN_BUFFER(1 + 2 + 5 + 5 + 4 + 3));		\
+	ADD_BITS(c__->o.precode.num_litlen_syms - 257, 5);		\
+	ADD_BITS(c__->o.precode.num_offset_syms - 1, 5);		\
+	ADD_BITS(num_explicit_lens__ - 4, 4);				\
+									\
+	/* Output the lengths of the codewords in the precode. */	\
+	if (CAN_BUFFER(3 * (DEFLATE_NUM_PRECODE_SYMS - 1))) {		\
+		/*							\
+		 * A 64-bit bitbuffer is just one bit too small to hold	\
+		 * the maximum number of precode lens, so to minimize	\
+		 * flushes we merge one len with the previous fields.	\
+		 */							\
+		precode_sym__ = deflate_precode_lens_permutation[0];	\
+		ADD_BITS(c__->o.precode.lens[precode_sym__], 3);	\
+		FLUSH_BITS();						\
+		i__ = 1; /* num_explicit_lens >= 4 */			\
+		do {							\
+			precode_sym__ =					\
+				deflate_precode_lens_permutation[i__];	\
+			ADD_BITS(c__->o.precode.lens[precode_sym__], 3); \
+		} while (++i__ < num_explicit_lens__);			\
+		FLUSH_BITS();						\
+	} else {							\
+		FLUSH_BITS();						\
+		i__ = 0;						\
+		do {							\
+			precode_sym__ =					\
+				deflate_precode_lens_permutation[i__];	\
+			ADD_BITS(c__->o.precode.lens[precode_sym__], 3); \
+			FLUSH_BITS();					\
+		} while (++i__ < num_explicit_lens__);			\
+	}								\
+									\
+	/*								\
+	 * Output the lengths of the codewords in the litlen and offset	\
+	 * codes, encoded by the precode.				\
+	 */								\
+	i__ = 0;							\
+	do {								\
+		precode_item__ = c__->o.precode.items[i__];		\
+		precode_sym__ = precode_item__ & 0x1F;			\
+		STATIC_ASSERT(CAN_BUFFER(MAX_PRE_CODEWORD_LEN + 7));	\
+		ADD_BITS(c__->o.precode.codewords[precode_sym__],	\
+			 c__->o.precode.lens[precode_sym__]);		\
+		ADD_BITS(precode_item__ >> 5,				\
+			 deflate_extra_precode_bits[precode_sym__]);	\
+		FLUSH_BITS();						\
+	} while (++i__ < num_precode_items__);				\
+} while (0)
 
-	/* Account for the cost of encoding dynamic Huffman codes. */
-	dynamic_cost += 5 + 5 + 4 + (3 * c->o.precode.num_explicit_lens);
-	for (sym = 0; sym < DEFLATE_NUM_PRECODE_SYMS; sym++) {
-		u32 extra = deflate_extra_precode_bits[sym];
 
-		dynamic_cost += c->o.precode.freqs[sym] *
-				(extra + c->o.precode.lens[sym]);
-	}
+/*
+ * Return true if the trained codes @table have a codeword for every symbol that
+ * is counted in @freqs.
+ */
+static bool
+deflate_trained_codes_fit(const struct libdeflate_huffman_table *table,
+			  const struct deflate_freqs *freqs)
+{
+	const struct deflate_lens *lens = &table->codes.lens;
+	bool missing = false;
+	unsigned sym;
 
-	/* Account for the cost of encoding literals. */
-	for (sym = 0; sym < 144; sym++) {
-		dynamic_cost += c->freqs.litlen[sym] *
-				c->codes.lens.litlen[sym];
-		static_cost += c->freqs.litlen[sym] * 8;
-	}
-	for (; sym < 256; sym++) {
-		dynamic_cost += c->freqs.litlen[sym] *
-				c->codes.lens.litlen[sym];
-		static_cost += c->freqs.litlen[sym] * 9;
-	}
+	for (sym = 0; sym < DEFLATE_NUM_LITLEN_SYMS; sym++)
+		missing |= (freqs->litlen[sym] != 0 && lens->litlen[sym] == 0);
+	for (sym = 0; sym < DEFLATE_NUM_OFFSET_SYMS; sym++)
+		missing |= (freqs->offset[sym] != 0 && lens->offset[sym] == 0);
+	return !missing;
+}
 
-	/* Account for the cost of encoding the end-of-block symbol. */
-	dynamic_cost += c->codes.lens.litlen[DEFLATE_END_OF_BLOCK];
-	static_cost += 7;
+/*
+ * Return the cost, in bits, of encoding the symbols counted in @freqs with the
+ * trained codes @table, including their header but not BFINAL and BTYPE.  The
+ * codes must fit the symbols.
+ */
+static u32
+deflate_trained_codes_cost(const struct libdeflate_huffman_table *table,
+			   const struct deflate_freqs *freqs)
+{
+	const struct deflate_lens *lens = &table->codes.lens;
+	u32 cost = table->header_nbits;
+	unsigned sym;
 
-	/* Account for the cost of encoding lengths. */
+	for (sym = 0; sym < DEFLATE_NUM_LITERALS; sym++)
+		cost += freqs->litlen[sym] * lens->litlen[sym];
+	cost += lens->litlen[DEFLATE_END_OF_BLOCK];
 	for (sym = DEFLATE_FIRST_LEN_SYM;
 	     sym < DEFLATE_FIRST_LEN_SYM + ARRAY_LEN(deflate_extra_length_bits);
 	     sym++) {
 		u32 extra = deflate_extra_length_bits[
 					sym - DEFLATE_FIRST_LEN_SYM];
 
-		dynamic_cost += c->freqs.litlen[sym] *
-				(extra + c->codes.lens.litlen[sym]);
-		static_cost += c->freqs.litlen[sym] *
-				(extra + c->static_codes.lens.litlen[sym]);
+		cost += freqs->litlen[sym] * (extra + lens->litlen[sym]);
 	}
-
-	/* Account for the cost of encoding offsets. */
 	for (sym = 0; sym < ARRAY_LEN(deflate_extra_offset_bits); sym++) {
 		u32 extra = deflate_extra_offset_bits[sym];
 
-		dynamic_cost += c->freqs.offset[sym] *
-				(extra + c->codes.lens.offset[sym]);
-		static_cost += c->freqs.offset[sym] * (extra + 5);
+		cost += freqs->offset[sym] * (extra + lens->offset[sym]);
 	}
+	return cost;
+}
 
-	/* Compute the cost of using uncompressed blocks. */
-	uncompressed_cost += (-(bitcount + 3) & 7) + 32 +
-			     (40 * (DIV_ROUND_UP(block_length,
-						 UINT16_MAX) - 1)) +
-			     (8 * block_length);
-
-	/*
-	 * Choose and output the cheapest type of block.  If there is a tie,
-	 * prefer uncompressed, then static, then dynamic.
-	 */
+/*
+ * Add a block of @block_length bytes whose literals and matches are given by
+ * @c->freqs to the compression statistics.
+ */
+static void
+deflate_count_block(struct libdeflate_compressor *c, u32 block_length)
+{
+	u32 num_literals = 0;
+	u32 num_matches = 0;
+	unsigned sym;
 
-	best_cost = MIN(dynamic_cost, MIN(static_cost, uncompressed_cost));
+	for (sym = 0; sym < 256; sym++)
+		num_literals += c->freqs.litlen[sym];
+	for (sym = DEFLATE_FIRST_LEN_SYM; sym < DEFLATE_NUM_LITLEN_SYMS; sym++)
+		num_matches += c->freqs.litlen[sym];
 
-	/* If the block isn't going to fit, then stop early. */
-	if (DIV_ROUND_UP(bitcount + best_cost, 8) > os->end - out_next) {
-		os->overflow = true;
-		return;
-	}
-	/*
-	 * Else, now we know that the block fits, so no further bounds checks on
-	 * the output buffer are required until the next block.
-	 */
+	c->stats.in_nbytes += block_length;
+	c->stats.num_blocks++;
+	c->stats.num_literals += num_literals;
+	c->stats.num_matches += num_matches;
+	c->stats.total_match_length += block_length - num_literals;
+}
 
-	if (best_cost == uncompressed_cost) {
-		/*
-		 * Uncompressed block(s).  DEFLATE limits the length of
-		 * uncompressed blocks to UINT16_MAX bytes, so if the length of
-		 * the "block" we're flushing is over UINT16_MAX, we actually
-		 * output multiple blocks.
-		 */
-		do {
-			u8 bfinal = 0;
-			size_t len = UINT16_MAX;
+/* Add unparsed data that is output uncompressed to the statistics. */
+static void
+deflate_count_passthrough(struct libdeflate_compressor *c, size_t in_nbytes)
+{
+	c->stats.in_nbytes += in_nbytes;
+	c->stats.num_blocks++;
+	c->stats.num_uncompressed_blocks++;
+	c->stats.num_literals += in_nbytes;
+}
 
-			if (in_end - in_next <= UINT16_MAX) {
-				bfinal = is_final_block;
-				len = in_end - in_next;
-			}
-			/* It was already checked that there is enough space. */
-			ASSERT(os->end - out_next >=
-			       DIV_ROUND_UP(bitcount + 3, 8) + 4 + len);
-			/*
-			 * Output BFINAL (1 bit) and BTYPE (2 bits), then align
-			 * to a byte boundary.
-			 */
-			STATIC_ASSERT(DEFLATE_BLOCKTYPE_UNCOMPRESSED == 0);
-			*out_next++ = (bfinal << bitcount) | bitbuf;
-			if (bitcount > 5)
-				*out_next++ = 0;
-			bitbuf = 0;
-			bitcount = 0;
-			/* Output LEN and NLEN, then the data itself. */
-			put_unaligned_le16(len, out_next);
-			out_next += 2;
-			put_unaligned_le16(~len, out_next);
-			out_next += 2;
-			memcpy(out_next, in_next, len);
-			out_next += len;
-			in_next += len;
-		} while (in_next != in_end);
-		/* Done outputting uncompressed block(s) */
-		goto out;
+/*
+ * If a checksum of the input was requested, extend it over the block of input
+ * @block_begin[0..@block_length-1], which was just compressed and so is likely
+ * still in the CPU cache.  Only blocks that continue the input from where the
+ * checksum left off are used, e.g. not ones in the preset dictionary buffer;
+ * libdeflate_end_input_checksum() does the rest.
+ */
+static forceinline void
+deflate_checksum_block(struct libdeflate_compressor *c,
+		       const u8 *block_begin, size_t block_length)
+{
+	if (c->checksum_func != NULL && block_begin == c->checksum_next) {
+		c->checksum = (*c->checksum_func)(c->checksum, block_begin,
+						  block_length);
+		c->checksum_next = block_begin + block_length;
 	}
+}
+
+/*
+ * Write a static or dynamic Huffman block, as chosen by deflate_flush_block(),
+ * whose cost is @best_cost.  If @out_unchecked, then the caller guarantees that
+ * the output buffer has room for a whole word past the end of the block, so
+ * all flushes can write whole words without checking for the end.  This is
+ * always inlined so that it gets compiled once with each value of it.
+ */
+static forceinline void
+deflate_write_huffman_block(struct libdeflate_compressor *c,
+			    struct deflate_output_bitstream *os,
+			    const u8 *block_begin, u32 block_length,
+			    const struct deflate_sequence *sequences,
+			    bool codes_are_trained, bool is_final_block,
+			    u32 best_cost, u32 dynamic_cost, u32 static_cost,
+			    const bool out_unchecked)
+{
+	const u8 *in_next = block_begin;
+	const u8 * const in_end = block_begin + block_length;
+	bitbuf_t bitbuf = os->bitbuf;
+	unsigned bitcount = os->bitcount;
+	u8 *out_next = os->next;
+	u8 * const out_fast_end =
+		os->end - MIN(WORDBYTES - 1, os->end - out_next);
+	const struct deflate_codes *codes;
 
 	if (best_cost == static_cost) {
 		/* Static Huffman block */
-		codes = &c->static_codes;
+		c->stats.num_static_blocks++;
+		codes = &deflate_static_codes;
 		ADD_BITS(is_final_block, 1);
 		ADD_BITS(DEFLATE_BLOCKTYPE_STATIC_HUFFMAN, 2);
 		FLUSH_BITS();
-	} else {
-		const unsigned num_explicit_lens = c->o.precode.num_explicit_lens;
-		const unsigned num_precode_items = c->o.precode.num_items;
-		unsigned precode_sym, precode_item;
-		unsigned i;
-
+	} else if (best_cost == dynamic_cost && !codes_are_trained) {
 		/* Dynamic Huffman block */
-
+		c->stats.num_dynamic_blocks++;
 		codes = &c->codes;
-		STATIC_ASSERT(CAN_BUFFER(1 + 2 + 5 + 5 + 4 + 3));
 		ADD_BITS(is_final_block, 1);
 		ADD_BITS(DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN, 2);
-		ADD_BITS(c->o.precode.num_litlen_syms - 257, 5);
-		ADD_BITS(c->o.precode.num_offset_syms - 1, 5);
-		ADD_BITS(num_explicit_lens - 4, 4);
+		WRITE_HUFFMAN_HEADER(c);
+	} else {
+		/*
+		 * Dynamic Huffman block using the trained codes, whose header
+		 * was already generated
+		 */
+		const struct libdeflate_huffman_table *table = c->huffman_table;
+		const u32 nbits = table->header_nbits;
+		u32 i = 0;
 
-		/* Output the lengths of the codewords in the precode. */
-		if (CAN_BUFFER(3 * (DEFLATE_NUM_PRECODE_SYMS - 1))) {
-			/*
-			 * A 64-bit bitbuffer is just one bit too small to hold
-			 * the maximum number of precode lens, so to minimize
-			 * flushes we merge one len with the previous fields.
-			 */
-			precode_sym = deflate_precode_lens_permutation[0];
-			ADD_BITS(c->o.precode.lens[precode_sym], 3);
-			FLUSH_BITS();
-			i = 1; /* num_explicit_lens >= 4 */
-			do {
-				precode_sym =
-					deflate_precode_lens_permutation[i];
-				ADD_BITS(c->o.precode.lens[precode_sym], 3);
-			} while (++i < num_explicit_lens);
-			FLUSH_BITS();
-		} else {
-			FLUSH_BITS();
-			i = 0;
-			do {
-				precode_sym =
-					deflate_precode_lens_permutation[i];
-				ADD_BITS(c->o.precode.lens[precode_sym], 3);
+		c->stats.num_trained_blocks++;
+		codes = (best_cost == dynamic_cost) ? &c->codes : &table->codes;
+		ADD_BITS(is_final_block, 1);
+		ADD_BITS(DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN, 2);
+		FLUSH_BITS();
+		if (CAN_BUFFER(32)) {
+			for (; i + 32 <= nbits; i += 32) {
+				ADD_BITS(get_unaligned_le32(&table->header[i / 8]),
+					 32);
 				FLUSH_BITS();
-			} while (++i < num_explicit_lens);
+			}
 		}
-
-		/*
-		 * Output the lengths of the codewords in the litlen and offset
-		 * codes, encoded by the precode.
-		 */
-		i = 0;
-		do {
-			precode_item = c->o.precode.items[i];
-			precode_sym = precode_item & 0x1F;
-			STATIC_ASSERT(CAN_BUFFER(MAX_PRE_CODEWORD_LEN + 7));
-			ADD_BITS(c->o.precode.codewords[precode_sym],
-				 c->o.precode.lens[precode_sym]);
-			ADD_BITS(precode_item >> 5,
-				 deflate_extra_precode_bits[precode_sym]);
+		for (; i + 8 <= nbits; i += 8) {
+			ADD_BITS(table->header[i / 8], 8);
 			FLUSH_BITS();
-		} while (++i < num_precode_items);
+		}
+		/* The unused high bits of the last byte are zero. */
+		if (i < nbits) {
+			ADD_BITS(table->header[i / 8], nbits - i);
+			FLUSH_BITS();
+		}
 	}
 
 	/* Output the literals and matches for a dynamic or static block. */
@@ -1947,7 +2525,7 @@ deflate_flush_block(struct libdeflate_compressor *c,
 			} else {
 				/* Match */
 				WRITE_MATCH(c, codes, length, offset,
-					    c->p.n.offset_slot_full[offset]);
+					    deflate_offset_slot_full[offset]);
 			}
 			cur_node += length;
 		} while (cur_node != end_node);
@@ -1962,49 +2540,9 @@ deflate_flush_block(struct libdeflate_compressor *c,
 					SEQ_LITRUNLEN_MASK;
 			unsigned length = seq->litrunlen_and_length >>
 					  SEQ_LENGTH_SHIFT;
-			unsigned lit;
 
 			/* Output a run of literals. */
-			if (CAN_BUFFER(4 * MAX_LITLEN_CODEWORD_LEN)) {
-				for (; litrunlen >= 4; litrunlen -= 4) {
-					lit = *in_next++;
-					ADD_BITS(codes->codewords.litlen[lit],
-						 codes->lens.litlen[lit]);
-					lit = *in_next++;
-					ADD_BITS(codes->codewords.litlen[lit],
-						 codes->lens.litlen[lit]);
-					lit = *in_next++;
-					ADD_BITS(codes->codewords.litlen[lit],
-						 codes->lens.litlen[lit]);
-					lit = *in_next++;
-					ADD_BITS(codes->codewords.litlen[lit],
-						 codes->lens.litlen[lit]);
-					FLUSH_BITS();
-				}
-				if (litrunlen-- != 0) {
-					lit = *in_next++;
-					ADD_BITS(codes->codewords.litlen[lit],
-						 codes->lens.litlen[lit]);
-					if (litrunlen-- != 0) {
-						lit = *in_next++;
-						ADD_BITS(codes->codewords.litlen[lit],
-							 codes->lens.litlen[lit]);
-						if (litrunlen-- != 0) {
-							lit = *in_next++;
-							ADD_BITS(codes->codewords.litlen[lit],
-								 codes->lens.litlen[lit]);
-						}
-					}
-					FLUSH_BITS();
-				}
-			} else {
-				while (litrunlen--) {
-					lit = *in_next++;
-					ADD_BITS(codes->codewords.litlen[lit],
-						 codes->lens.litlen[lit]);
-					FLUSH_BITS();
-				}
-			}
+			WRITE_LITERALS(codes, in_next, litrunlen);
 
 			if (length == 0) { /* Last sequence? */
 				ASSERT(in_next == in_end);
@@ -2023,979 +2561,2413 @@ deflate_flush_block(struct libdeflate_compressor *c,
 	ADD_BITS(codes->codewords.litlen[DEFLATE_END_OF_BLOCK],
 		 codes->lens.litlen[DEFLATE_END_OF_BLOCK]);
 	FLUSH_BITS();
-out:
 	ASSERT(bitcount <= 7);
-	/*
-	 * Assert that the block cost was computed correctly.  This is relied on
-	 * above for the bounds check on the output buffer.  Also,
-	 * libdeflate_deflate_compress_bound() relies on this via the assumption
-	 * that uncompressed blocks will always be used when cheapest.
-	 */
+	/* See deflate_flush_block() */
 	ASSERT(8 * (out_next - os->next) + bitcount - os->bitcount == best_cost);
 	os->bitbuf = bitbuf;
 	os->bitcount = bitcount;
 	os->next = out_next;
 }
 
-static void
-deflate_finish_block(struct libdeflate_compressor *c,
-		     struct deflate_output_bitstream *os,
-		     const u8 *block_begin, u32 block_length,
-		     const struct deflate_sequence *sequences,
-		     bool is_final_block)
+/*
+ * Return the length of the longest prefix of @in_nbytes bytes that uncompressed
+ * blocks could hold in the rest of the output buffer.
+ */
+static size_t
+deflate_stored_fit_length(const struct deflate_output_bitstream *os,
+			  size_t in_nbytes)
 {
-	c->freqs.litlen[DEFLATE_END_OF_BLOCK]++;
-	deflate_make_huffman_codes(&c->freqs, &c->codes);
-	deflate_flush_block(c, os, block_begin, block_length, sequences,
-			    is_final_block);
-}
+	size_t avail = os->end - os->next;
+	size_t header_nbytes = DIV_ROUND_UP(os->bitcount + 3, 8) + 4;
+	size_t len = 0;
 
-/******************************************************************************/
+	while (avail > header_nbytes && len < in_nbytes) {
+		size_t n = MIN(avail - header_nbytes, UINT16_MAX);
+
+		n = MIN(n, in_nbytes - len);
+		len += n;
+		avail -= header_nbytes + n;
+		header_nbytes = 5; /* Later blocks start byte-aligned. */
+	}
+	return len;
+}
 
 /*
- * Block splitting algorithm.  The problem is to decide when it is worthwhile to
- * start a new block with new Huffman codes.  There is a theoretically optimal
- * solution: recursively consider every possible block split, considering the
- * exact cost of each block, and choose the minimum cost approach.  But this is
- * far too slow.  Instead, as an approximation, we can count symbols and after
- * every N symbols, compare the expected distribution of symbols based on the
- * previous data with the actual distribution.  If they differ "by enough", then
- * start a new block.
- *
- * As an optimization and heuristic, we don't distinguish between every symbol
- * but rather we combine many symbols into a single "observation type".  For
- * literals we only look at the high bits and low bits, and for matches we only
- * look at whether the match is long or not.  The assumption is that for typical
- * "real" data, places that are good block boundaries will tend to be noticeable
- * based only on changes in these aggregate probabilities, without looking for
- * subtle differences in individual symbols.  For example, a change from ASCII
- * bytes to non-ASCII bytes, or from few matches (generally less compressible)
- * to many matches (generally more compressible), would be easily noticed based
- * on the aggregates.
- *
- * For determining whether the probability distributions are "different enough"
- * to start a new block, the simple heuristic of splitting when the sum of
- * absolute differences exceeds a constant seems to be good enough.  We also add
- * a number proportional to the block length so that the algorithm is more
- * likely to end long blocks than short blocks.  This reflects the general
- * expectation that it will become increasingly beneficial to start a new block
- * as the current block grows longer.
- *
- * Finally, for an approximation, it is not strictly necessary that the exact
- * symbols being used are considered.  With "near-optimal parsing", for example,
- * the actual symbols that will be used are unknown until after the block
- * boundary is chosen and the block has been optimized.  Since the final choices
- * cannot be used, we can use preliminary "greedy" choices instead.
+ * End a fit stream (see @os->fit_end) after the input up to @in_end, which was
+ * output with BFINAL set.  Setting the overflow flag makes the compressor stop.
  */
-
-/* Initialize the block split statistics when starting a new block. */
 static void
-init_block_split_stats(struct block_split_stats *stats)
+deflate_end_fit_stream(struct deflate_output_bitstream *os, const u8 *in_end)
 {
-	int i;
-
-	for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
-		stats->new_observations[i] = 0;
-		stats->observations[i] = 0;
-	}
-	stats->num_new_observations = 0;
-	stats->num_observations = 0;
+	os->fit_in_end = in_end;
+	os->overflow = true;
 }
 
 /*
- * Literal observation.  Heuristic: use the top 2 bits and low 1 bits of the
- * literal, for 8 possible literal observation types.
+ * End a fit stream with an empty final block, for when none of the remaining
+ * input fits.  A static Huffman block holding just the 7-bit end-of-block
+ * symbol is the smallest, and FIT_RESERVE_NBYTES guarantees room for it.
  */
-static forceinline void
-observe_literal(struct block_split_stats *stats, u8 lit)
-{
-	stats->new_observations[((lit >> 5) & 0x6) | (lit & 1)]++;
-	stats->num_new_observations++;
-}
-
-/*
- * Match observation.  Heuristic: use one observation type for "short match" and
- * one observation type for "long match".
- */
-static forceinline void
-observe_match(struct block_split_stats *stats, unsigned length)
-{
-	stats->new_observations[NUM_LITERAL_OBSERVATION_TYPES +
-				(length >= 9)]++;
-	stats->num_new_observations++;
-}
-
 static void
-merge_new_observations(struct block_split_stats *stats)
+deflate_end_fit_stream_empty(struct deflate_output_bitstream *os,
+			     const u8 *in_end)
 {
-	int i;
+	bitbuf_t bitbuf = os->bitbuf;
+	unsigned bitcount = os->bitcount;
 
-	for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
-		stats->observations[i] += stats->new_observations[i];
-		stats->new_observations[i] = 0;
+	os->end = os->fit_end;
+	ASSERT(os->end - os->next >= DIV_ROUND_UP(bitcount + 10, 8));
+	/* BFINAL, BTYPE, and the end-of-block codeword, which is all zeroes */
+	bitbuf |= (bitbuf_t)(1 | (DEFLATE_BLOCKTYPE_STATIC_HUFFMAN << 1)) <<
+		  bitcount;
+	bitcount += 3 + 7;
+	for (; bitcount >= 8; bitcount -= 8) {
+		*os->next++ = (u8)bitbuf;
+		bitbuf >>= 8;
 	}
-	stats->num_observations += stats->num_new_observations;
-	stats->num_new_observations = 0;
+	os->bitbuf = bitbuf;
+	os->bitcount = bitcount;
+	deflate_end_fit_stream(os, in_end);
 }
 
-static bool
-do_end_block_check(struct block_split_stats *stats, u32 block_length)
+/*
+ * Output the data @in[0..@in_nbytes-1] as a series of uncompressed blocks,
+ * continuing the output bitstream @os.  Unlike deflate_compress_none(), this
+ * doesn't require that the output be byte-aligned initially.  If @in_nbytes is
+ * 0, this still outputs one (empty) block.  If the data doesn't fit and the
+ * output is being fit into a buffer, then as much of it as fits is output
+ * instead, ending the stream.
+ */
+static void
+deflate_write_uncompressed_blocks(struct deflate_output_bitstream *os,
+				  const u8 *in, size_t in_nbytes,
+				  bool is_final)
 {
-	if (stats->num_observations > 0) {
-		/*
-		 * Compute the sum of absolute differences of probabilities.  To
-		 * avoid needing to use floating point arithmetic or do slow
-		 * divisions, we do all arithmetic with the probabilities
-		 * multiplied by num_observations * num_new_observations.  E.g.,
-		 * for the "old" observations the probabilities would be
-		 * (double)observations[i] / num_observations, but since we
-		 * multiply by both num_observations and num_new_observations we
-		 * really do observations[i] * num_new_observations.
-		 */
-		u32 total_delta = 0;
-		u32 num_items;
-		u32 cutoff;
-		int i;
+	const u8 *in_next = in;
+	const u8 *in_end = in + in_nbytes;
+	u8 *out_next = os->next;
+	bool ending_fit = false;
 
-		for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
-			u32 expected = stats->observations[i] *
-				       stats->num_new_observations;
-			u32 actual = stats->new_observations[i] *
-				     stats->num_observations;
-			u32 delta = (actual > expected) ? actual - expected :
-							  expected - actual;
+	ASSERT(os->bitcount <= 7);
+	ASSERT(!os->overflow);
+	do {
+		u8 bfinal = 0;
+		size_t len = UINT16_MAX;
 
-			total_delta += delta;
+		if (in_end - in_next <= UINT16_MAX) {
+			bfinal = is_final;
+			len = in_end - in_next;
+		}
+		if (os->end - out_next <
+		    DIV_ROUND_UP(os->bitcount + 3, 8) + 4 + len) {
+			if (os->fit_end == NULL || ending_fit) {
+				os->overflow = true;
+				return;
+			}
+			/* Use the reserved space too, and end the stream. */
+			os->end = os->fit_end;
+			in_end = in_next + deflate_stored_fit_length(
+						os, in_end - in_next);
+			if (in_end == in_next) {
+				deflate_end_fit_stream_empty(os, in_end);
+				return;
+			}
+			is_final = true;
+			ending_fit = true;
+			continue;
 		}
-
-		num_items = stats->num_observations +
-			    stats->num_new_observations;
-		/*
-		 * Heuristic: the cutoff is when the sum of absolute differences
-		 * of probabilities becomes at least 200/512.  As above, the
-		 * probability is multiplied by both num_new_observations and
-		 * num_observations.  Be careful to avoid integer overflow.
-		 */
-		cutoff = stats->num_new_observations * 200 / 512 *
-			 stats->num_observations;
 		/*
-		 * Very short blocks have a lot of overhead for the Huffman
-		 * codes, so only use them if it clearly seems worthwhile.
-		 * (This is an additional penalty, which adds to the smaller
-		 * penalty below which scales more slowly.)
+		 * Output BFINAL (1 bit) and BTYPE (2 bits), then align to a
+		 * byte boundary.
 		 */
-		if (block_length < 10000 && num_items < 8192)
-			cutoff += (u64)cutoff * (8192 - num_items) / 8192;
-
-		/* Ready to end the block? */
-		if (total_delta +
-		    (block_length / 4096) * stats->num_observations >= cutoff)
-			return true;
-	}
-	merge_new_observations(stats);
-	return false;
-}
-
-static forceinline bool
-ready_to_check_block(const struct block_split_stats *stats,
-		     const u8 *in_block_begin, const u8 *in_next,
-		     const u8 *in_end)
-{
-	return stats->num_new_observations >= NUM_OBSERVATIONS_PER_BLOCK_CHECK
-		&& in_next - in_block_begin >= MIN_BLOCK_LENGTH
-		&& in_end - in_next >= MIN_BLOCK_LENGTH;
-}
-
-static forceinline bool
-should_end_block(struct block_split_stats *stats,
-		 const u8 *in_block_begin, const u8 *in_next, const u8 *in_end)
-{
-	/* Ready to try to end the block (again)? */
-	if (!ready_to_check_block(stats, in_block_begin, in_next, in_end))
-		return false;
-
-	return do_end_block_check(stats, in_next - in_block_begin);
-}
-
-/******************************************************************************/
-
-static void
-deflate_begin_sequences(struct libdeflate_compressor *c,
-			struct deflate_sequence *first_seq)
-{
-	deflate_reset_symbol_frequencies(c);
-	first_seq->litrunlen_and_length = 0;
+		STATIC_ASSERT(DEFLATE_BLOCKTYPE_UNCOMPRESSED == 0);
+		*out_next++ = (bfinal << os->bitcount) | os->bitbuf;
+		if (os->bitcount > 5)
+			*out_next++ = 0;
+		os->bitbuf = 0;
+		os->bitcount = 0;
+		/* Output LEN and NLEN, then the data itself. */
+		put_unaligned_le16(len, out_next);
+		out_next += 2;
+		put_unaligned_le16(~len, out_next);
+		out_next += 2;
+		memcpy(out_next, in_next, len);
+		out_next += len;
+		in_next += len;
+		os->next = out_next;
+	} while (in_next != in_end);
+	if (ending_fit)
+		deflate_end_fit_stream(os, in_end);
 }
 
-static forceinline void
-deflate_choose_literal(struct libdeflate_compressor *c, unsigned literal,
-		       bool gather_split_stats, struct deflate_sequence *seq)
+/* Return the cost, in bits, of a match with the codeword lengths @lens. */
+static forceinline u32
+deflate_match_cost(const struct deflate_lens *lens,
+		   unsigned length, unsigned offset_slot)
 {
-	c->freqs.litlen[literal]++;
-
-	if (gather_split_stats)
-		observe_literal(&c->split_stats, literal);
+	unsigned length_slot = deflate_length_slot[length];
 
-	STATIC_ASSERT(MAX_BLOCK_LENGTH <= SEQ_LITRUNLEN_MASK);
-	seq->litrunlen_and_length++;
+	return lens->litlen[DEFLATE_FIRST_LEN_SYM + length_slot] +
+	       deflate_extra_length_bits[length_slot] +
+	       lens->offset[offset_slot] +
+	       deflate_extra_offset_bits[offset_slot];
 }
 
-static forceinline void
-deflate_choose_match(struct libdeflate_compressor *c,
-		     unsigned length, unsigned offset, bool gather_split_stats,
-		     struct deflate_sequence **seq_p)
+/*
+ * Return the length of the longest prefix of the block, ending at a literal or
+ * match boundary, whose literals and matches cost at most @max_cost bits with
+ * the codeword lengths @lens.  Return the cost of the prefix in *@cost_ret.
+ * The block is given the same way as to deflate_flush_block().
+ */
+static u32
+deflate_prefix_fit_length(const struct libdeflate_compressor *c,
+			  const u8 *block_begin, u32 block_length,
+			  const struct deflate_sequence *sequences,
+			  const struct deflate_lens *lens, u32 max_cost,
+			  u32 *cost_ret)
 {
-	struct deflate_sequence *seq = *seq_p;
-	unsigned length_slot = deflate_length_slot[length];
-	unsigned offset_slot = deflate_get_offset_slot(offset);
-
-	c->freqs.litlen[DEFLATE_FIRST_LEN_SYM + length_slot]++;
-	c->freqs.offset[offset_slot]++;
-	if (gather_split_stats)
-		observe_match(&c->split_stats, length);
-
-	seq->litrunlen_and_length |= (u32)length << SEQ_LENGTH_SHIFT;
-	seq->offset = offset;
-	seq->offset_slot = offset_slot;
+	const struct deflate_sequence *seq;
+	u32 pos = 0;
+	u32 cost = 0;
+	u32 item_cost;
 
-	seq++;
-	seq->litrunlen_and_length = 0;
-	*seq_p = seq;
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	if (sequences == NULL) {
+		while (pos < block_length) {
+			u32 item = c->p.n.optimum_nodes[pos].item;
+			unsigned length = item & OPTIMUM_LEN_MASK;
+			unsigned offset = item >> OPTIMUM_OFFSET_SHIFT;
+
+			if (length == 1)
+				item_cost = lens->litlen[offset];
+			else
+				item_cost = deflate_match_cost(
+					lens, length,
+					deflate_offset_slot_full[offset]);
+			if (item_cost > max_cost - cost)
+				break;
+			cost += item_cost;
+			pos += length;
+		}
+		*cost_ret = cost;
+		return pos;
+	}
+#endif
+	for (seq = sequences; ; seq++) {
+		u32 litrunlen = seq->litrunlen_and_length & SEQ_LITRUNLEN_MASK;
+		unsigned length = seq->litrunlen_and_length >> SEQ_LENGTH_SHIFT;
+
+		for (; litrunlen != 0; litrunlen--) {
+			item_cost = lens->litlen[block_begin[pos]];
+			if (item_cost > max_cost - cost)
+				goto out;
+			cost += item_cost;
+			pos++;
+		}
+		if (length == 0)
+			break;
+		item_cost = deflate_match_cost(lens, length, seq->offset_slot);
+		if (item_cost > max_cost - cost)
+			break;
+		cost += item_cost;
+		pos += length;
+	}
+out:
+	*cost_ret = cost;
+	return pos;
 }
 
 /*
- * Decrease the maximum and nice match lengths if we're approaching the end of
- * the input buffer.
+ * Cut a sequences list short after its first @length bytes, which must end at a
+ * literal or match boundary.
  */
-static forceinline void
-adjust_max_and_nice_len(unsigned *max_len, unsigned *nice_len, size_t remaining)
+static void
+deflate_truncate_sequences(struct deflate_sequence *seq, u32 length)
 {
-	if (unlikely(remaining < DEFLATE_MAX_MATCH_LEN)) {
-		*max_len = remaining;
-		*nice_len = MIN(*nice_len, *max_len);
+	u32 pos = 0;
+
+	for (;; seq++) {
+		u32 litrunlen = seq->litrunlen_and_length & SEQ_LITRUNLEN_MASK;
+
+		if (length - pos <= litrunlen) {
+			seq->litrunlen_and_length = length - pos;
+			return;
+		}
+		pos += litrunlen +
+		       (seq->litrunlen_and_length >> SEQ_LENGTH_SHIFT);
 	}
 }
 
 /*
- * Choose the minimum match length for the greedy and lazy parsers.
- *
- * By default the minimum match length is 3, which is the smallest length the
- * DEFLATE format allows.  However, with greedy and lazy parsing, some data
- * (e.g. DNA sequencing data) benefits greatly from a longer minimum length.
- * Typically, this is because literals are very cheap.  In general, the
- * near-optimal parser handles this case naturally, but the greedy and lazy
- * parsers need a heuristic to decide when to use short matches.
- *
- * The heuristic we use is to make the minimum match length depend on the number
- * of different literals that exist in the data.  If there are many different
- * literals, then literals will probably be expensive, so short matches will
- * probably be worthwhile.  Conversely, if not many literals are used, then
- * probably literals will be cheap and short matches won't be worthwhile.
+ * When fitting the output into a buffer, end the stream with as much of a block
+ * that doesn't fit as does.  Each way of encoding the block that
+ * deflate_flush_block() considered is tried for the longest prefix that fits:
+ * its Huffman codes (which can encode any prefix, as they can encode the whole
+ * block), the static codes, the trained codes if @trained_codes_fit, and
+ * uncompressed blocks.  The one that covers the most input is used.
+ * @dynamic_header_cost is the cost of the block header with the block's codes.
  */
-static unsigned
-choose_min_match_len(unsigned num_used_literals, unsigned max_search_depth)
+static void
+deflate_flush_block_prefix(struct libdeflate_compressor *c,
+			   struct deflate_output_bitstream *os,
+			   const u8 *block_begin, u32 block_length,
+			   const struct deflate_sequence *sequences,
+			   bool codes_are_trained, u32 dynamic_header_cost,
+			   bool trained_codes_fit)
 {
-	/* map from num_used_literals to min_len */
-	static const u8 min_lens[] = {
-		9, 9, 9, 9, 9, 9, 8, 8, 7, 7, 6, 6, 6, 6, 6, 6,
-		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 4, 4, 4,
-		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-		/* The rest is implicitly 3. */
+	const struct deflate_lens *lens[3] = {
+		&deflate_static_codes.lens,
+		&c->codes.lens,
+		trained_codes_fit ? &c->huffman_table->codes.lens : NULL,
 	};
-	unsigned min_len;
+	const u32 header_costs[3] = {
+		3,
+		dynamic_header_cost,
+		trained_codes_fit ? 3 + c->huffman_table->header_nbits : 0,
+	};
+	u32 best_length = 0;
+	u32 best_cost = 0;
+	unsigned best = 0;
+	size_t avail_bits;
+	size_t stored_length;
+	unsigned i;
 
-	STATIC_ASSERT(DEFLATE_MIN_MATCH_LEN <= 3);
-	STATIC_ASSERT(ARRAY_LEN(min_lens) <= DEFLATE_NUM_LITERALS + 1);
+	os->end = os->fit_end;
+	avail_bits = 8 * (size_t)(os->end - os->next) - os->bitcount;
+	for (i = 0; i < ARRAY_LEN(lens); i++) {
+		u32 fixed_cost, cost, length;
+
+		if (lens[i] == NULL)
+			continue;
+		fixed_cost = header_costs[i] +
+			     lens[i]->litlen[DEFLATE_END_OF_BLOCK];
+		if (fixed_cost > avail_bits)
+			continue;
+		length = deflate_prefix_fit_length(
+				c, block_begin, block_length, sequences,
+				lens[i], MIN(avail_bits - fixed_cost,
+					     UINT32_MAX - fixed_cost),
+				&cost);
+		if (length > best_length) {
+			best_length = length;
+			best_cost = fixed_cost + cost;
+			best = i;
+		}
+	}
 
-	if (num_used_literals >= ARRAY_LEN(min_lens))
-		return 3;
-	min_len = min_lens[num_used_literals];
-	/*
-	 * With a low max_search_depth, it may be too hard to find long matches.
-	 */
-	if (max_search_depth < 16) {
-		if (max_search_depth < 5)
-			min_len = MIN(min_len, 4);
-		else if (max_search_depth < 10)
-			min_len = MIN(min_len, 5);
-		else
-			min_len = MIN(min_len, 7);
+	stored_length = deflate_stored_fit_length(os, block_length);
+	if (stored_length > best_length) {
+		c->stats.num_uncompressed_blocks++;
+		best_length = stored_length;
+		deflate_write_uncompressed_blocks(os, block_begin, best_length,
+						  true);
+	} else if (best_length == 0) {
+		deflate_end_fit_stream_empty(os, block_begin);
+		return;
+	} else {
+		/*
+		 * This is the last block, so its sequences can be cut short in
+		 * place.  Pass costs that make deflate_write_huffman_block()
+		 * choose the codes that were chosen here.
+		 */
+		if (sequences != NULL)
+			deflate_truncate_sequences(
+				(struct deflate_sequence *)sequences,
+				best_length);
+		deflate_write_huffman_block(c, os, block_begin, best_length,
+					    sequences, codes_are_trained, true,
+					    best_cost,
+					    best == 1 ? best_cost : UINT32_MAX,
+					    best == 0 ? best_cost : UINT32_MAX,
+					    false);
 	}
-	return min_len;
+	c->stats.in_nbytes += best_length;
+	c->stats.num_blocks++;
+	deflate_end_fit_stream(os, block_begin + best_length);
 }
 
-static unsigned
-calculate_min_match_len(const u8 *data, size_t data_len,
-			unsigned max_search_depth)
+/*
+ * Choose the best type of block to use (dynamic Huffman, static Huffman, or
+ * uncompressed), then output it.  Dynamic Huffman blocks can use either codes
+ * made for this block or the compressor's trained codes, if it has any.
+ *
+ * The uncompressed data of the block is @block_begin[0..@block_length-1].  The
+ * sequence of literals and matches that will be used to compress the block (if
+ * a compressed block is chosen) is given by @sequences if it's non-NULL, or
+ * else @c->p.n.optimum_nodes.  @c->freqs and @c->codes must be already set
+ * according to the literals, matches, and end-of-block symbol.  If
+ * @codes_are_trained, then @c->codes is a copy of the trained codes, so their
+ * precomputed header is used instead of generating one.
+ */
+static void
+deflate_flush_block(struct libdeflate_compressor *c,
+		    struct deflate_output_bitstream *os,
+		    const u8 *block_begin, u32 block_length,
+		    const struct deflate_sequence *sequences,
+		    bool codes_are_trained, bool is_final_block)
 {
-	u8 used[256] = { 0 };
-	unsigned num_used_literals = 0;
-	size_t i;
-
 	/*
-	 * For very short inputs, the static Huffman code has a good chance of
-	 * being best, in which case there is no reason to avoid short matches.
+	 * It is hard to get compilers to understand that writes to 'os->next'
+	 * don't alias 'os'.  That hurts performance significantly, as
+	 * everything in 'os' would keep getting re-loaded.  ('restrict'
+	 * *should* do the trick, but it's unreliable.)  Therefore, we keep all
+	 * the output bitstream state in local variables, and output bits using
+	 * macros.  This is similar to what the decompressor does.
 	 */
-	if (data_len < 512)
-		return DEFLATE_MIN_MATCH_LEN;
-
+	const u8 *in_next = block_begin;
+	const u8 * const in_end = block_begin + block_length;
+	bitbuf_t bitbuf = os->bitbuf;
+	unsigned bitcount = os->bitcount;
+	u8 *out_next = os->next;
 	/*
-	 * For an initial approximation, scan the first 4 KiB of data.  The
-	 * caller may use recalculate_min_match_len() to update min_len later.
+	 * The cost for each block type, in bits.  Start with the cost of the
+	 * block header which is 3 bits.
 	 */
-	data_len = MIN(data_len, 4096);
-	for (i = 0; i < data_len; i++)
-		used[data[i]] = 1;
-	for (i = 0; i < 256; i++)
-		num_used_literals += used[i];
-	return choose_min_match_len(num_used_literals, max_search_depth);
-}
+	u32 dynamic_cost = 3;
+	u32 static_cost = 3;
+	u32 uncompressed_cost = 3;
+	u32 trained_cost = UINT32_MAX;
+	u32 dynamic_header_cost;
+	u32 best_cost;
+	unsigned sym;
 
-/*
- * Recalculate the minimum match length for a block, now that we know the
- * distribution of literals that are actually being used (freqs->litlen).
- */
-static unsigned
-recalculate_min_match_len(const struct deflate_freqs *freqs,
-			  unsigned max_search_depth)
-{
-	u32 literal_freq = 0;
-	u32 cutoff;
-	unsigned num_used_literals = 0;
-	int i;
+	ASSERT(block_length >= MIN_BLOCK_LENGTH ||
+	       (is_final_block && block_length > 0));
+	ASSERT(block_length <= MAX_BLOCK_LENGTH);
+	ASSERT(bitcount <= 7);
+	ASSERT((bitbuf & ~(((bitbuf_t)1 << bitcount) - 1)) == 0);
+	ASSERT(out_next <= os->end);
+	ASSERT(!os->overflow);
 
-	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
-		literal_freq += freqs->litlen[i];
+	deflate_checksum_block(c, block_begin, block_length);
 
-	cutoff = literal_freq >> 10; /* Ignore literals used very rarely. */
+	if (unlikely(c->train_freqs != NULL)) {
+		/* Training Huffman codes; just collect the symbol counts. */
+		for (sym = 0; sym < DEFLATE_NUM_LITLEN_SYMS; sym++)
+			c->train_freqs->litlen[sym] += c->freqs.litlen[sym];
+		for (sym = 0; sym < DEFLATE_NUM_OFFSET_SYMS; sym++)
+			c->train_freqs->offset[sym] += c->freqs.offset[sym];
+	}
 
-	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
-		if (freqs->litlen[i] > cutoff)
-			num_used_literals++;
+	if (codes_are_trained) {
+		/* The header of the trained codes was already generated. */
+		dynamic_cost += c->huffman_table->header_nbits;
+	} else {
+		/* Precompute the precode items and build the precode. */
+		deflate_precompute_huffman_header(c);
+
+		/* Account for the cost of encoding dynamic Huffman codes. */
+		dynamic_cost += 5 + 5 + 4 +
+				(3 * c->o.precode.num_explicit_lens);
+		for (sym = 0; sym < DEFLATE_NUM_PRECODE_SYMS; sym++) {
+			u32 extra = deflate_extra_precode_bits[sym];
+
+			dynamic_cost += c->o.precode.freqs[sym] *
+					(extra + c->o.precode.lens[sym]);
+		}
 	}
-	return choose_min_match_len(num_used_literals, max_search_depth);
-}
+	dynamic_header_cost = dynamic_cost;
 
-static forceinline const u8 *
-choose_max_block_end(const u8 *in_block_begin, const u8 *in_end,
-		     size_t soft_max_len)
-{
-	if (in_end - in_block_begin < soft_max_len + MIN_BLOCK_LENGTH)
-		return in_end;
-	return in_block_begin + soft_max_len;
-}
+	/* Account for the cost of encoding literals. */
+	for (sym = 0; sym < 144; sym++) {
+		dynamic_cost += c->freqs.litlen[sym] *
+				c->codes.lens.litlen[sym];
+		static_cost += c->freqs.litlen[sym] * 8;
+	}
+	for (; sym < 256; sym++) {
+		dynamic_cost += c->freqs.litlen[sym] *
+				c->codes.lens.litlen[sym];
+		static_cost += c->freqs.litlen[sym] * 9;
+	}
 
-/*
- * This is the level 0 "compressor".  It always outputs uncompressed blocks.
- */
-static size_t
-deflate_compress_none(const u8 *in, size_t in_nbytes,
-		      u8 *out, size_t out_nbytes_avail)
-{
-	const u8 *in_next = in;
-	const u8 * const in_end = in + in_nbytes;
-	u8 *out_next = out;
-	u8 * const out_end = out + out_nbytes_avail;
+	/* Account for the cost of encoding the end-of-block symbol. */
+	dynamic_cost += c->codes.lens.litlen[DEFLATE_END_OF_BLOCK];
+	static_cost += 7;
+
+	/* Account for the cost of encoding lengths. */
+	for (sym = DEFLATE_FIRST_LEN_SYM;
+	     sym < DEFLATE_FIRST_LEN_SYM + ARRAY_LEN(deflate_extra_length_bits);
+	     sym++) {
+		u32 extra = deflate_extra_length_bits[
+					sym - DEFLATE_FIRST_LEN_SYM];
+
+		dynamic_cost += c->freqs.litlen[sym] *
+				(extra + c->codes.lens.litlen[sym]);
+		static_cost += c->freqs.litlen[sym] *
+				(extra + deflate_static_codes.lens.litlen[sym]);
+	}
+
+	/* Account for the cost of encoding offsets. */
+	for (sym = 0; sym < ARRAY_LEN(deflate_extra_offset_bits); sym++) {
+		u32 extra = deflate_extra_offset_bits[sym];
+
+		dynamic_cost += c->freqs.offset[sym] *
+				(extra + c->codes.lens.offset[sym]);
+		static_cost += c->freqs.offset[sym] * (extra + 5);
+	}
+
+	/* Compute the cost of using uncompressed blocks. */
+	uncompressed_cost += (-(bitcount + 3) & 7) + 32 +
+			     (40 * (DIV_ROUND_UP(block_length,
+						 UINT16_MAX) - 1)) +
+			     (8 * block_length);
 
 	/*
-	 * If the input is zero-length, we still must output a block in order
-	 * for the output to be a valid DEFLATE stream.  Handle this case
-	 * specially to avoid potentially passing NULL to memcpy() below.
+	 * If codes were made for this block but there are also trained codes
+	 * that fit it, compute the cost of using the trained codes instead.
 	 */
-	if (unlikely(in_nbytes == 0)) {
-		if (out_nbytes_avail < 5)
-			return 0;
-		/* BFINAL and BTYPE */
-		*out_next++ = 1 | (DEFLATE_BLOCKTYPE_UNCOMPRESSED << 1);
-		/* LEN and NLEN */
-		put_unaligned_le32(0xFFFF0000, out_next);
-		return 5;
+	if (!codes_are_trained && c->huffman_table != NULL &&
+	    deflate_trained_codes_fit(c->huffman_table, &c->freqs))
+		trained_cost = 3 + deflate_trained_codes_cost(c->huffman_table,
+							      &c->freqs);
+
+	/*
+	 * Choose and output the cheapest type of block.  If there is a tie,
+	 * prefer uncompressed, then static, then dynamic, then trained.
+	 */
+
+	best_cost = MIN(MIN(dynamic_cost, trained_cost),
+			MIN(static_cost, uncompressed_cost));
+
+	/*
+	 * If the block isn't going to fit, then stop early, or end the stream
+	 * with as much of the block as fits if that was requested.
+	 */
+	if (DIV_ROUND_UP(bitcount + best_cost, 8) > os->end - out_next) {
+		if (os->fit_end != NULL)
+			deflate_flush_block_prefix(c, os, block_begin,
+						   block_length, sequences,
+						   codes_are_trained,
+						   dynamic_header_cost,
+						   trained_cost != UINT32_MAX);
+		else
+			os->overflow = true;
+		return;
 	}
+	/*
+	 * Else, now we know that the block fits, so no further bounds checks on
+	 * the output buffer are required until the next block.
+	 */
 
-	do {
-		u8 bfinal = 0;
-		size_t len = UINT16_MAX;
+	deflate_count_block(c, block_length);
 
-		if (in_end - in_next <= UINT16_MAX) {
-			bfinal = 1;
-			len = in_end - in_next;
-		}
-		if (out_end - out_next < 5 + len)
-			return 0;
+	if (best_cost == uncompressed_cost) {
+		c->stats.num_uncompressed_blocks++;
 		/*
-		 * Output BFINAL and BTYPE.  The stream is already byte-aligned
-		 * here, so this step always requires outputting exactly 1 byte.
+		 * Uncompressed block(s).  DEFLATE limits the length of
+		 * uncompressed blocks to UINT16_MAX bytes, so if the length of
+		 * the "block" we're flushing is over UINT16_MAX, we actually
+		 * output multiple blocks.
 		 */
-		*out_next++ = bfinal | (DEFLATE_BLOCKTYPE_UNCOMPRESSED << 1);
+		do {
+			u8 bfinal = 0;
+			size_t len = UINT16_MAX;
 
-		/* Output LEN and NLEN, then the data itself. */
-		put_unaligned_le16(len, out_next);
-		out_next += 2;
-		put_unaligned_le16(~len, out_next);
-		out_next += 2;
-		memcpy(out_next, in_next, len);
-		out_next += len;
-		in_next += len;
-	} while (in_next != in_end);
+			if (in_end - in_next <= UINT16_MAX) {
+				bfinal = is_final_block;
+				len = in_end - in_next;
+			}
+			/* It was already checked that there is enough space. */
+			ASSERT(os->end - out_next >=
+			       DIV_ROUND_UP(bitcount + 3, 8) + 4 + len);
+			/*
+			 * Output BFINAL (1 bit) and BTYPE (2 bits), then align
+			 * to a byte boundary.
+			 */
+			STATIC_ASSERT(DEFLATE_BLOCKTYPE_UNCOMPRESSED == 0);
+			*out_next++ = (bfinal << bitcount) | bitbuf;
+			if (bitcount > 5)
+				*out_next++ = 0;
+			bitbuf = 0;
+			bitcount = 0;
+			/* Output LEN and NLEN, then the data itself. */
+			put_unaligned_le16(len, out_next);
+			out_next += 2;
+			put_unaligned_le16(~len, out_next);
+			out_next += 2;
+			memcpy(out_next, in_next, len);
+			out_next += len;
+			in_next += len;
+		} while (in_next != in_end);
+		/* Done outputting uncompressed block(s) */
+		goto out;
+	}
 
-	return out_next - out;
+	/*
+	 * If there is room for a whole word past the end of the block, which
+	 * is always the case with an output buffer of
+	 * libdeflate_deflate_compress_bound() bytes except maybe at the very
+	 * end, then flush whole words without checking for the end.
+	 */
+	os->bitbuf = bitbuf;
+	os->bitcount = bitcount;
+	if (os->end - out_next >=
+	    DIV_ROUND_UP(bitcount + best_cost, 8) + WORDBYTES)
+		deflate_write_huffman_block(c, os, in_next, block_length,
+					    sequences, codes_are_trained,
+					    is_final_block, best_cost,
+					    dynamic_cost, static_cost, true);
+	else
+		deflate_write_huffman_block(c, os, in_next, block_length,
+					    sequences, codes_are_trained,
+					    is_final_block, best_cost,
+					    dynamic_cost, static_cost, false);
+	return;
+
+out:
+	ASSERT(bitcount <= 7);
+	/*
+	 * Assert that the block cost was computed correctly.  This is relied on
+	 * above for the bounds check on the output buffer.  Also,
+	 * libdeflate_deflate_compress_bound() relies on this via the assumption
+	 * that uncompressed blocks will always be used when cheapest.
+	 */
+	ASSERT(8 * (out_next - os->next) + bitcount - os->bitcount == best_cost);
+	os->bitbuf = bitbuf;
+	os->bitcount = bitcount;
+	os->next = out_next;
 }
 
-/*
- * This is a faster variant of deflate_compress_greedy().  It uses the
- * ht_matchfinder rather than the hc_matchfinder.  It also skips the block
- * splitting algorithm and just uses fixed length blocks.  c->max_search_depth
- * has no effect with this algorithm, as it is hardcoded in ht_matchfinder.h.
- */
 static void
-deflate_compress_fastest(struct libdeflate_compressor * restrict c,
-			 const u8 *in, size_t in_nbytes,
-			 struct deflate_output_bitstream *os)
+deflate_finish_block(struct libdeflate_compressor *c,
+		     struct deflate_output_bitstream *os,
+		     const u8 *block_begin, u32 block_length,
+		     const struct deflate_sequence *sequences,
+		     bool is_final_block)
 {
-	const u8 *in_next = in;
-	const u8 *in_end = in_next + in_nbytes;
-	const u8 *in_cur_base = in_next;
-	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
-	unsigned nice_len = MIN(c->nice_match_length, max_len);
-	u32 next_hash = 0;
+	bool codes_are_trained = false;
 
-	ht_matchfinder_init(&c->p.f.ht_mf);
+	c->freqs.litlen[DEFLATE_END_OF_BLOCK]++;
+	/*
+	 * If there are trained codes that fit this block, use them instead of
+	 * making codes for it.  That saves building the codes and their header,
+	 * which for small blocks is a large part of the compression time.
+	 */
+	if (c->huffman_table != NULL &&
+	    deflate_trained_codes_fit(c->huffman_table, &c->freqs)) {
+		c->codes = c->huffman_table->codes;
+		codes_are_trained = true;
+	} else {
+		deflate_make_huffman_codes(&c->freqs, &c->codes);
+	}
+	deflate_flush_block(c, os, block_begin, block_length, sequences,
+			    codes_are_trained, is_final_block);
+}
 
-	do {
-		/* Starting a new DEFLATE block */
+/******************************************************************************/
 
-		const u8 * const in_block_begin = in_next;
-		const u8 * const in_max_block_end = choose_max_block_end(
-				in_next, in_end, FAST_SOFT_MAX_BLOCK_LENGTH);
-		struct deflate_sequence *seq = c->p.f.sequences;
-
-		deflate_begin_sequences(c, seq);
-
-		do {
-			u32 length;
-			u32 offset;
-			size_t remaining = in_end - in_next;
+/*
+ * Block splitting algorithm.  The problem is to decide when it is worthwhile to
+ * start a new block with new Huffman codes.  There is a theoretically optimal
+ * solution: recursively consider every possible block split, considering the
+ * exact cost of each block, and choose the minimum cost approach.  But this is
+ * far too slow.  Instead, as an approximation, we can count symbols and after
+ * every N symbols, compare the expected distribution of symbols based on the
+ * previous data with the actual distribution.  If they differ "by enough", then
+ * start a new block.
+ *
+ * As an optimization and heuristic, we don't distinguish between every symbol
+ * but rather we combine many symbols into a single "observation type".  For
+ * literals we only look at the high bits and low bits, and for matches we only
+ * look at whether the match is long or not.  The assumption is that for typical
+ * "real" data, places that are good block boundaries will tend to be noticeable
+ * based only on changes in these aggregate probabilities, without looking for
+ * subtle differences in individual symbols.  For example, a change from ASCII
+ * bytes to non-ASCII bytes, or from few matches (generally less compressible)
+ * to many matches (generally more compressible), would be easily noticed based
+ * on the aggregates.
+ *
+ * For determining whether the probability distributions are "different enough"
+ * to start a new block, the simple heuristic of splitting when the sum of
+ * absolute differences exceeds a constant seems to be good enough.  We also add
+ * a number proportional to the block length so that the algorithm is more
+ * likely to end long blocks than short blocks.  This reflects the general
+ * expectation that it will become increasingly beneficial to start a new block
+ * as the current block grows longer.
+ *
+ * Finally, for an approximation, it is not strictly necessary that the exact
+ * symbols being used are considered.  With "near-optimal parsing", for example,
+ * the actual symbols that will be used are unknown until after the block
+ * boundary is chosen and the block has been optimized.  Since the final choices
+ * cannot be used, we can use preliminary "greedy" choices instead.
+ */
 
-			if (unlikely(remaining < DEFLATE_MAX_MATCH_LEN)) {
-				max_len = remaining;
-				if (max_len < HT_MATCHFINDER_REQUIRED_NBYTES) {
-					do {
-						deflate_choose_literal(c,
-							*in_next++, false, seq);
-					} while (--max_len);
-					break;
-				}
-				nice_len = MIN(nice_len, max_len);
-			}
-			length = ht_matchfinder_longest_match(&c->p.f.ht_mf,
-							      &in_cur_base,
-							      in_next,
-							      max_len,
-							      nice_len,
-							      &next_hash,
-							      &offset);
-			if (length) {
-				/* Match found */
-				deflate_choose_match(c, length, offset, false,
-						     &seq);
-				ht_matchfinder_skip_bytes(&c->p.f.ht_mf,
-							  &in_cur_base,
-							  in_next + 1,
-							  in_end,
-							  length - 1,
-							  &next_hash);
-				in_next += length;
-			} else {
-				/* No match found */
-				deflate_choose_literal(c, *in_next++, false,
-						       seq);
-			}
+/* Initialize the block split statistics when starting a new block. */
+static void
+init_block_split_stats(struct block_split_stats *stats)
+{
+	int i;
 
-			/* Check if it's time to output another block. */
-		} while (in_next < in_max_block_end &&
-			 seq < &c->p.f.sequences[FAST_SEQ_STORE_LENGTH]);
+	for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
+		stats->new_observations[i] = 0;
+		stats->observations[i] = 0;
+	}
+	stats->num_new_observations = 0;
+	stats->num_observations = 0;
+}
 
-		deflate_finish_block(c, os, in_block_begin,
-				     in_next - in_block_begin,
-				     c->p.f.sequences, in_next == in_end);
-	} while (in_next != in_end && !os->overflow);
+/*
+ * Literal observation.  Heuristic: use the top 2 bits and low 1 bits of the
+ * literal, for 8 possible literal observation types.
+ */
+static forceinline void
+observe_literal(struct block_split_stats *stats, u8 lit)
+{
+	stats->new_observations[((lit >> 5) & 0x6) | (lit & 1)]++;
+	stats->num_new_observations++;
 }
 
 /*
- * This is the "greedy" DEFLATE compressor. It always chooses the longest match.
+ * Match observation.  Heuristic: use one observation type for "short match" and
+ * one observation type for "long match".
  */
+static forceinline void
+observe_match(struct block_split_stats *stats, unsigned length)
+{
+	stats->new_observations[NUM_LITERAL_OBSERVATION_TYPES +
+				(length >= 9)]++;
+	stats->num_new_observations++;
+}
+
 static void
-deflate_compress_greedy(struct libdeflate_compressor * restrict c,
-			const u8 *in, size_t in_nbytes,
-			struct deflate_output_bitstream *os)
+merge_new_observations(struct block_split_stats *stats)
 {
-	const u8 *in_next = in;
-	const u8 *in_end = in_next + in_nbytes;
-	const u8 *in_cur_base = in_next;
-	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
-	unsigned nice_len = MIN(c->nice_match_length, max_len);
-	u32 next_hashes[2] = {0, 0};
+	int i;
 
-	hc_matchfinder_init(&c->p.g.hc_mf);
+	for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
+		stats->observations[i] += stats->new_observations[i];
+		stats->new_observations[i] = 0;
+	}
+	stats->num_observations += stats->num_new_observations;
+	stats->num_new_observations = 0;
+}
 
-	do {
-		/* Starting a new DEFLATE block */
+static bool
+do_end_block_check(struct libdeflate_compressor *c, u32 block_length)
+{
+	struct block_split_stats *stats = &c->split_stats;
 
-		const u8 * const in_block_begin = in_next;
-		const u8 * const in_max_block_end = choose_max_block_end(
-				in_next, in_end, SOFT_MAX_BLOCK_LENGTH);
-		struct deflate_sequence *seq = c->p.g.sequences;
-		unsigned min_len;
+	if (stats->num_observations > 0) {
+		/*
+		 * Compute the sum of absolute differences of probabilities.  To
+		 * avoid needing to use floating point arithmetic or do slow
+		 * divisions, we do all arithmetic with the probabilities
+		 * multiplied by num_observations * num_new_observations.  E.g.,
+		 * for the "old" observations the probabilities would be
+		 * (double)observations[i] / num_observations, but since we
+		 * multiply by both num_observations and num_new_observations we
+		 * really do observations[i] * num_new_observations.
+		 */
+		u32 total_delta = 0;
+		u32 num_items;
+		u32 cutoff;
+		int i;
 
-		init_block_split_stats(&c->split_stats);
-		deflate_begin_sequences(c, seq);
-		min_len = calculate_min_match_len(in_next,
-						  in_max_block_end - in_next,
-						  c->max_search_depth);
-		do {
-			u32 length;
-			u32 offset;
+		for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
+			u32 expected = stats->observations[i] *
+				       stats->num_new_observations;
+			u32 actual = stats->new_observations[i] *
+				     stats->num_observations;
+			u32 delta = (actual > expected) ? actual - expected :
+							  expected - actual;
 
-			adjust_max_and_nice_len(&max_len, &nice_len,
-						in_end - in_next);
-			length = hc_matchfinder_longest_match(
-						&c->p.g.hc_mf,
-						&in_cur_base,
-						in_next,
-						min_len - 1,
-						max_len,
-						nice_len,
-						c->max_search_depth,
-						next_hashes,
-						&offset);
+			total_delta += delta;
+		}
 
-			if (length >= min_len &&
-			    (length > DEFLATE_MIN_MATCH_LEN ||
-			     offset <= 4096)) {
-				/* Match found */
-				deflate_choose_match(c, length, offset, true,
-						     &seq);
-				hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
-							  &in_cur_base,
-							  in_next + 1,
-							  in_end,
-							  length - 1,
-							  next_hashes);
-				in_next += length;
-			} else {
-				/* No match found */
-				deflate_choose_literal(c, *in_next++, true,
-						       seq);
-			}
+		num_items = stats->num_observations +
+			    stats->num_new_observations;
+		/*
+		 * Heuristic: the cutoff is when the sum of absolute differences
+		 * of probabilities becomes at least 200/512.  As above, the
+		 * probability is multiplied by both num_new_observations and
+		 * num_observations.  Be careful to avoid integer overflow.
+		 */
+		cutoff = stats->num_new_observations * 200 / 512 *
+			 stats->num_observations;
+		/*
+		 * Very short blocks have a lot of overhead for the Huffman
+		 * codes, so only use them if it clearly seems worthwhile.
+		 * (This is an additional penalty, which adds to the smaller
+		 * penalty below which scales more slowly.)
+		 */
+		if (block_length < 10000 && num_items < 8192)
+			cutoff += (u64)cutoff * (8192 - num_items) / 8192;
 
-			/* Check if it's time to output another block. */
-		} while (in_next < in_max_block_end &&
-			 seq < &c->p.g.sequences[SEQ_STORE_LENGTH] &&
-			 !should_end_block(&c->split_stats,
-					   in_block_begin, in_next, in_end));
+		/* Ready to end the block? */
+		if (total_delta +
+		    (block_length / 4096) * stats->num_observations >= cutoff) {
+			c->stats.num_block_split_ends++;
+			return true;
+		}
+	}
+	merge_new_observations(stats);
+	return false;
+}
 
-		deflate_finish_block(c, os, in_block_begin,
-				     in_next - in_block_begin,
-				     c->p.g.sequences, in_next == in_end);
-	} while (in_next != in_end && !os->overflow);
+static forceinline bool
+ready_to_check_block(const struct block_split_stats *stats,
+		     const u8 *in_block_begin, const u8 *in_next,
+		     const u8 *in_end)
+{
+	return stats->num_new_observations >= NUM_OBSERVATIONS_PER_BLOCK_CHECK
+		&& in_next - in_block_begin >= MIN_BLOCK_LENGTH
+		&& in_end - in_next >= MIN_BLOCK_LENGTH;
 }
 
-static forceinline void
-deflate_compress_lazy_generic(struct libdeflate_compressor * restrict c,
-			      const u8 *in, size_t in_nbytes,
-			      struct deflate_output_bitstream *os, bool lazy2)
+static forceinline bool
+should_end_block(struct libdeflate_compressor *c,
+		 const u8 *in_block_begin, const u8 *in_next, const u8 *in_end)
 {
-	const u8 *in_next = in;
-	const u8 *in_end = in_next + in_nbytes;
-	const u8 *in_cur_base = in_next;
-	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
-	unsigned nice_len = MIN(c->nice_match_length, max_len);
-	u32 next_hashes[2] = {0, 0};
+	/* Ready to try to end the block (again)? */
+	if (!ready_to_check_block(&c->split_stats, in_block_begin, in_next,
+				  in_end))
+		return false;
 
-	hc_matchfinder_init(&c->p.g.hc_mf);
+	return do_end_block_check(c, in_next - in_block_begin);
+}
 
-	do {
-		/* Starting a new DEFLATE block */
+/******************************************************************************/
 
-		const u8 * const in_block_begin = in_next;
-		const u8 * const in_max_block_end = choose_max_block_end(
-				in_next, in_end, SOFT_MAX_BLOCK_LENGTH);
-		const u8 *next_recalc_min_len =
-			in_next + MIN(in_end - in_next, 10000);
-		struct deflate_sequence *seq = c->p.g.sequences;
-		unsigned min_len;
+static void
+deflate_begin_sequences(struct libdeflate_compressor *c,
+			struct deflate_sequence *first_seq)
+{
+	deflate_reset_symbol_frequencies(c);
+	first_seq->litrunlen_and_length = 0;
+}
 
-		init_block_split_stats(&c->split_stats);
-		deflate_begin_sequences(c, seq);
-		min_len = calculate_min_match_len(in_next,
-						  in_max_block_end - in_next,
-						  c->max_search_depth);
-		do {
-			unsigned cur_len;
-			unsigned cur_offset;
-			unsigned next_len;
-			unsigned next_offset;
+static forceinline void
+deflate_choose_literal(struct libdeflate_compressor *c, unsigned literal,
+		       bool gather_split_stats, struct deflate_sequence *seq)
+{
+	c->freqs.litlen[literal]++;
 
-			/*
-			 * Recalculate the minimum match length if it hasn't
-			 * been done recently.
-			 */
-			if (in_next >= next_recalc_min_len) {
-				min_len = recalculate_min_match_len(
-						&c->freqs,
-						c->max_search_depth);
-				next_recalc_min_len +=
-					MIN(in_end - next_recalc_min_len,
-					    in_next - in_block_begin);
-			}
+	if (gather_split_stats)
+		observe_literal(&c->split_stats, literal);
 
-			/* Find the longest match at the current position. */
-			adjust_max_and_nice_len(&max_len, &nice_len,
-						in_end - in_next);
-			cur_len = hc_matchfinder_longest_match(
-						&c->p.g.hc_mf,
-						&in_cur_base,
-						in_next,
-						min_len - 1,
-						max_len,
-						nice_len,
-						c->max_search_depth,
-						next_hashes,
-						&cur_offset);
-			if (cur_len < min_len ||
-			    (cur_len == DEFLATE_MIN_MATCH_LEN &&
-			     cur_offset > 8192)) {
-				/* No match found.  Choose a literal. */
-				deflate_choose_literal(c, *in_next++, true,
-						       seq);
-				continue;
-			}
-			in_next++;
+	STATIC_ASSERT(MAX_BLOCK_LENGTH <= SEQ_LITRUNLEN_MASK);
+	seq->litrunlen_and_length++;
+}
 
-have_cur_match:
-			/*
-			 * We have a match at the current position.
-			 * If it's very long, choose it immediately.
-			 */
-			if (cur_len >= nice_len) {
-				deflate_choose_match(c, cur_len, cur_offset,
-						     true, &seq);
-				hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
-							  &in_cur_base,
-							  in_next,
-							  in_end,
-							  cur_len - 1,
-							  next_hashes);
-				in_next += cur_len - 1;
-				continue;
-			}
+static forceinline void
+deflate_choose_match(struct libdeflate_compressor *c,
+		     unsigned length, unsigned offset, bool gather_split_stats,
+		     struct deflate_sequence **seq_p)
+{
+	struct deflate_sequence *seq = *seq_p;
+	unsigned length_slot = deflate_length_slot[length];
+	unsigned offset_slot = deflate_get_offset_slot(offset);
 
-			/*
-			 * Try to find a better match at the next position.
-			 *
-			 * Note: since we already have a match at the *current*
-			 * position, we use only half the 'max_search_depth'
-			 * when checking the *next* position.  This is a useful
-			 * trade-off because it's more worthwhile to use a
-			 * greater search depth on the initial match.
-			 *
-			 * Note: it's possible to structure the code such that
-			 * there's only one call to longest_match(), which
-			 * handles both the "find the initial match" and "try to
-			 * find a better match" cases.  However, it is faster to
-			 * have two call sites, with longest_match() inlined at
-			 * each.
-			 */
-			adjust_max_and_nice_len(&max_len, &nice_len,
-						in_end - in_next);
-			next_len = hc_matchfinder_longest_match(
-						&c->p.g.hc_mf,
-						&in_cur_base,
-						in_next++,
-						cur_len - 1,
-						max_len,
-						nice_len,
-						c->max_search_depth >> 1,
-						next_hashes,
-						&next_offset);
-			if (next_len >= cur_len &&
-			    4 * (int)(next_len - cur_len) +
-			    ((int)bsr32(cur_offset) -
-			     (int)bsr32(next_offset)) > 2) {
-				/*
-				 * Found a better match at the next position.
-				 * Output a literal.  Then the next match
-				 * becomes the current match.
-				 */
-				deflate_choose_literal(c, *(in_next - 2), true,
-						       seq);
-				cur_len = next_len;
-				cur_offset = next_offset;
-				goto have_cur_match;
-			}
+	c->freqs.litlen[DEFLATE_FIRST_LEN_SYM + length_slot]++;
+	c->freqs.offset[offset_slot]++;
+	if (gather_split_stats)
+		observe_match(&c->split_stats, length);
 
-			if (lazy2) {
-				/* In lazy2 mode, look ahead another position */
-				adjust_max_and_nice_len(&max_len, &nice_len,
-							in_end - in_next);
-				next_len = hc_matchfinder_longest_match(
-						&c->p.g.hc_mf,
-						&in_cur_base,
-						in_next++,
-						cur_len - 1,
-						max_len,
-						nice_len,
-						c->max_search_depth >> 2,
-						next_hashes,
-						&next_offset);
-				if (next_len >= cur_len &&
-				    4 * (int)(next_len - cur_len) +
-				    ((int)bsr32(cur_offset) -
-				     (int)bsr32(next_offset)) > 6) {
-					/*
-					 * There's a much better match two
-					 * positions ahead, so use two literals.
-					 */
-					deflate_choose_literal(
-						c, *(in_next - 3), true, seq);
-					deflate_choose_literal(
-						c, *(in_next - 2), true, seq);
-					cur_len = next_len;
-					cur_offset = next_offset;
-					goto have_cur_match;
-				}
-				/*
-				 * No better match at either of the next 2
-				 * positions.  Output the current match.
-				 */
-				deflate_choose_match(c, cur_len, cur_offset,
-						     true, &seq);
-				if (cur_len > 3) {
-					hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
-								  &in_cur_base,
-								  in_next,
-								  in_end,
-								  cur_len - 3,
-								  next_hashes);
-					in_next += cur_len - 3;
-				}
-			} else { /* !lazy2 */
-				/*
-				 * No better match at the next position.  Output
-				 * the current match.
-				 */
-				deflate_choose_match(c, cur_len, cur_offset,
-						     true, &seq);
-				hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
-							  &in_cur_base,
-							  in_next,
-							  in_end,
-							  cur_len - 2,
-							  next_hashes);
-				in_next += cur_len - 2;
-			}
-			/* Check if it's time to output another block. */
-		} while (in_next < in_max_block_end &&
-			 seq < &c->p.g.sequences[SEQ_STORE_LENGTH] &&
-			 !should_end_block(&c->split_stats,
-					   in_block_begin, in_next, in_end));
+	seq->litrunlen_and_length |= (u32)length << SEQ_LENGTH_SHIFT;
+	seq->offset = offset;
+	seq->offset_slot = offset_slot;
 
-		deflate_finish_block(c, os, in_block_begin,
-				     in_next - in_block_begin,
-				     c->p.g.sequences, in_next == in_end);
-	} while (in_next != in_end && !os->overflow);
+	seq++;
+	seq->litrunlen_and_length = 0;
+	*seq_p = seq;
 }
 
 /*
- * This is the "lazy" DEFLATE compressor.  Before choosing a match, it checks to
- * see if there's a better match at the next position.  If yes, it outputs a
- * literal and continues to the next position.  If no, it outputs the match.
+ * Decrease the maximum and nice match lengths if we're approaching the end of
+ * the input buffer.
  */
-static void
-deflate_compress_lazy(struct libdeflate_compressor * restrict c,
-		      const u8 *in, size_t in_nbytes,
-		      struct deflate_output_bitstream *os)
+static forceinline void
+adjust_max_and_nice_len(unsigned *max_len, unsigned *nice_len, size_t remaining)
 {
-	deflate_compress_lazy_generic(c, in, in_nbytes, os, false);
+	if (unlikely(remaining < DEFLATE_MAX_MATCH_LEN)) {
+		*max_len = remaining;
+		*nice_len = MIN(*nice_len, *max_len);
+	}
 }
 
 /*
- * The lazy2 compressor.  This is similar to the regular lazy one, but it looks
- * for a better match at the next 2 positions rather than the next 1.  This
- * makes it take slightly more time, but compress some inputs slightly more.
+ * Choose the minimum match length for the greedy and lazy parsers.
+ *
+ * By default the minimum match length is 3, which is the smallest length the
+ * DEFLATE format allows.  However, with greedy and lazy parsing, some data
+ * (e.g. DNA sequencing data) benefits greatly from a longer minimum length.
+ * Typically, this is because literals are very cheap.  In general, the
+ * near-optimal parser handles this case naturally, but the greedy and lazy
+ * parsers need a heuristic to decide when to use short matches.
+ *
+ * The heuristic we use is to make the minimum match length depend on the number
+ * of different literals that exist in the data.  If there are many different
+ * literals, then literals will probably be expensive, so short matches will
+ * probably be worthwhile.  Conversely, if not many literals are used, then
+ * probably literals will be cheap and short matches won't be worthwhile.
  */
-static void
-deflate_compress_lazy2(struct libdeflate_compressor * restrict c,
-		       const u8 *in, size_t in_nbytes,
-		       struct deflate_output_bitstream *os)
+static unsigned
+choose_min_match_len(unsigned num_used_literals, unsigned max_search_depth)
 {
-	deflate_compress_lazy_generic(c, in, in_nbytes, os, true);
-}
+	/* map from num_used_literals to min_len */
+	static const u8 min_lens[] = {
+		9, 9, 9, 9, 9, 9, 8, 8, 7, 7, 6, 6, 6, 6, 6, 6,
+		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 4, 4, 4,
+		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+		/* The rest is implicitly 3. */
+	};
+	unsigned min_len;
 
-#if SUPPORT_NEAR_OPTIMAL_PARSING
+	STATIC_ASSERT(DEFLATE_MIN_MATCH_LEN <= 3);
+	STATIC_ASSERT(ARRAY_LEN(min_lens) <= DEFLATE_NUM_LITERALS + 1);
 
-/*
- * Follow the minimum-cost path in the graph of possible match/literal choices
- * for the current block and compute the frequencies of the Huffman symbols that
- * would be needed to output those matches and literals.
- */
-static void
-deflate_tally_item_list(struct libdeflate_compressor *c, u32 block_length)
-{
-	struct deflate_optimum_node *cur_node = &c->p.n.optimum_nodes[0];
-	struct deflate_optimum_node *end_node =
-		&c->p.n.optimum_nodes[block_length];
-
-	do {
-		unsigned length = cur_node->item & OPTIMUM_LEN_MASK;
-		unsigned offset = cur_node->item >> OPTIMUM_OFFSET_SHIFT;
-
-		if (length == 1) {
-			/* Literal */
-			c->freqs.litlen[offset]++;
-		} else {
-			/* Match */
-			c->freqs.litlen[DEFLATE_FIRST_LEN_SYM +
-					deflate_length_slot[length]]++;
-			c->freqs.offset[c->p.n.offset_slot_full[offset]]++;
-		}
-		cur_node += length;
-	} while (cur_node != end_node);
-
-	/* Tally the end-of-block symbol. */
-	c->freqs.litlen[DEFLATE_END_OF_BLOCK]++;
+	if (num_used_literals >= ARRAY_LEN(min_lens))
+		return 3;
+	min_len = min_lens[num_used_literals];
+	/*
+	 * With a low max_search_depth, it may be too hard to find long matches.
+	 */
+	if (max_search_depth < 16) {
+		if (max_search_depth < 5)
+			min_len = MIN(min_len, 4);
+		else if (max_search_depth < 10)
+			min_len = MIN(min_len, 5);
+		else
+			min_len = MIN(min_len, 7);
+	}
+	return min_len;
 }
 
-static void
-deflate_choose_all_literals(struct libdeflate_compressor *c,
-			    const u8 *block, u32 block_length)
+static unsigned
+calculate_min_match_len(const u8 *data, size_t data_len,
+			unsigned max_search_depth)
 {
-	u32 i;
+	u8 used[256] = { 0 };
+	unsigned num_used_literals = 0;
+	size_t i;
 
-	deflate_reset_symbol_frequencies(c);
-	for (i = 0; i < block_length; i++)
-		c->freqs.litlen[block[i]]++;
-	c->freqs.litlen[DEFLATE_END_OF_BLOCK]++;
+	/*
+	 * For very short inputs, the static Huffman code has a good chance of
+	 * being best, in which case there is no reason to avoid short matches.
+	 */
+	if (data_len < 512)
+		return DEFLATE_MIN_MATCH_LEN;
 
-	deflate_make_huffman_codes(&c->freqs, &c->codes);
+	/*
+	 * For an initial approximation, scan the first 4 KiB of data.  The
+	 * caller may use recalculate_min_match_len() to update min_len later.
+	 */
+	data_len = MIN(data_len, 4096);
+	for (i = 0; i < data_len; i++)
+		used[data[i]] = 1;
+	for (i = 0; i < 256; i++)
+		num_used_literals += used[i];
+	return choose_min_match_len(num_used_literals, max_search_depth);
 }
 
 /*
- * Compute the exact cost, in bits, that would be required to output the matches
- * and literals described by @c->freqs as a dynamic Huffman block.  The litlen
- * and offset codes are assumed to have already been built in @c->codes.
+ * Recalculate the minimum match length for a block, now that we know the
+ * distribution of literals that are actually being used (freqs->litlen).
  */
-static u32
-deflate_compute_true_cost(struct libdeflate_compressor *c)
+static unsigned
+recalculate_min_match_len(const struct deflate_freqs *freqs,
+			  unsigned max_search_depth)
 {
-	u32 cost = 0;
-	unsigned sym;
+	u32 literal_freq = 0;
+	u32 cutoff;
+	unsigned num_used_literals = 0;
+	int i;
 
-	deflate_precompute_huffman_header(c);
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
+		literal_freq += freqs->litlen[i];
 
-	memset(&c->codes.lens.litlen[c->o.precode.num_litlen_syms], 0,
-	       DEFLATE_NUM_LITLEN_SYMS - c->o.precode.num_litlen_syms);
+	cutoff = literal_freq >> 10; /* Ignore literals used very rarely. */
 
-	cost += 5 + 5 + 4 + (3 * c->o.precode.num_explicit_lens);
-	for (sym = 0; sym < DEFLATE_NUM_PRECODE_SYMS; sym++) {
-		cost += c->o.precode.freqs[sym] *
-			(c->o.precode.lens[sym] +
-			 deflate_extra_precode_bits[sym]);
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
+		if (freqs->litlen[i] > cutoff)
+			num_used_literals++;
 	}
+	return choose_min_match_len(num_used_literals, max_search_depth);
+}
 
-	for (sym = 0; sym < DEFLATE_FIRST_LEN_SYM; sym++)
-		cost += c->freqs.litlen[sym] * c->codes.lens.litlen[sym];
+static forceinline const u8 *
+choose_max_block_end(const u8 *in_block_begin, const u8 *in_end,
+		     size_t soft_max_len)
+{
+	if (in_end - in_block_begin < soft_max_len + MIN_BLOCK_LENGTH)
+		return in_end;
+	return in_block_begin + soft_max_len;
+}
 
-	for (; sym < DEFLATE_FIRST_LEN_SYM +
-	       ARRAY_LEN(deflate_extra_length_bits); sym++)
-		cost += c->freqs.litlen[sym] *
-			(c->codes.lens.litlen[sym] +
-			 deflate_extra_length_bits[sym - DEFLATE_FIRST_LEN_SYM]);
+/*
+ * Choose how much to shrink the matchfinder's hash tables for an input of
+ * @in_nbytes bytes.  The largest table of each matchfinder has 2^16 entries at
+ * full size; shrink it to no fewer than twice as many entries as there are
+ * input positions, so that hash collisions stay rare.
+ */
+static forceinline unsigned
+deflate_choose_order_reduction(size_t in_nbytes)
+{
+	unsigned min_order;
 
-	for (sym = 0; sym < ARRAY_LEN(deflate_extra_offset_bits); sym++)
-		cost += c->freqs.offset[sym] *
-			(c->codes.lens.offset[sym] +
-			 deflate_extra_offset_bits[sym]);
-	return cost;
+	if (in_nbytes >= 16384)
+		return 0;
+	min_order = in_nbytes <= 1 ? 1 : 2 + bsr32(in_nbytes - 1);
+	return MIN(16 - min_order, MATCHFINDER_MAX_ORDER_REDUCTION);
 }
 
-/* Set the current cost model from the codeword lengths specified in @lens. */
-static void
-deflate_set_costs_from_codes(struct libdeflate_compressor *c,
-			     const struct deflate_lens *lens)
+/*
+ * Prepare to find matches in the input buffer @in of @in_nbytes bytes.  If
+ * c->mf_resume is set, then the matchfinder continues from where the previous
+ * call left off: set *in_cur_base_ret and @next_hashes accordingly and return
+ * true.  Otherwise, set *in_cur_base_ret to @in, choose the hash table size,
+ * and return false, in which case the caller must initialize the matchfinder
+ * with c->mf_order_reduction.  The hash tables are shrunk only if @is_final is
+ * set, since otherwise more data may be compressed with the matchfinder later.
+ */
+static forceinline bool
+deflate_resume_matchfinder(struct libdeflate_compressor *c,
+			   const u8 *in, size_t in_nbytes, bool is_final,
+			   const u8 **in_cur_base_ret, u32 next_hashes[2])
 {
-	unsigned i;
+	if (!c->mf_resume) {
+		*in_cur_base_ret = in;
+		c->mf_order_reduction = is_final ?
+			deflate_choose_order_reduction(in_nbytes) : 0;
+		return false;
+	}
+	*in_cur_base_ret = in - c->mf_pending - c->mf_pos;
+	next_hashes[0] = c->mf_next_hashes[0];
+	next_hashes[1] = c->mf_next_hashes[1];
+	return true;
+}
 
-	/* Literals */
-	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
-		u32 bits = (lens->litlen[i] ?
-			    lens->litlen[i] : LITERAL_NOSTAT_BITS);
+/*
+ * Save the state of the matchfinder @mf, which is @mf_size bytes, at the end of
+ * the input buffer, so that the next call can resume from it if it is given the
+ * data that follows.  @in_end is where the matchfinder stopped inserting the
+ * data, which the caller must set c->mf_pending for if it isn't the end.
+ */
+static forceinline void
+deflate_save_matchfinder(struct libdeflate_compressor *c,
+			 mf_pos_t *mf, size_t mf_size, const u8 *in_end,
+			 const u8 *in_cur_base, const u32 next_hashes[2])
+{
+	u32 pos = in_end - in_cur_base;
 
-		c->p.n.costs.literal[i] = bits * BIT_COST;
+	/*
+	 * The matchfinders skip inserting the last few positions of the buffer,
+	 * which may have made them miss sliding the window at the usual place.
+	 * Do it now, since on resuming they expect to be within the window.
+	 */
+	if (pos >= MATCHFINDER_WINDOW_SIZE) {
+		matchfinder_rebase(mf, mf_size);
+		pos -= MATCHFINDER_WINDOW_SIZE;
 	}
+	c->mf_pending = 0;
+	c->mf_pos = pos;
+	c->mf_next_hashes[0] = next_hashes[0];
+	c->mf_next_hashes[1] = next_hashes[1];
+}
 
-	/* Lengths */
-	for (i = DEFLATE_MIN_MATCH_LEN; i <= DEFLATE_MAX_MATCH_LEN; i++) {
-		unsigned length_slot = deflate_length_slot[i];
-		unsigned litlen_sym = DEFLATE_FIRST_LEN_SYM + length_slot;
-		u32 bits = (lens->litlen[litlen_sym] ?
-			    lens->litlen[litlen_sym] : LENGTH_NOSTAT_BITS);
+/*
+ * This is the level 0 "compressor".  It always outputs uncompressed blocks.
+ */
+static size_t
+deflate_compress_none(const u8 *in, size_t in_nbytes,
+		      u8 *out, size_t out_nbytes_avail)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in + in_nbytes;
+	u8 *out_next = out;
+	u8 * const out_end = out + out_nbytes_avail;
 
-		bits += deflate_extra_length_bits[length_slot];
-		c->p.n.costs.length[i] = bits * BIT_COST;
+	/*
+	 * If the input is zero-length, we still must output a block in order
+	 * for the output to be a valid DEFLATE stream.  Handle this case
+	 * specially to avoid potentially passing NULL to memcpy() below.
+	 */
+	if (unlikely(in_nbytes == 0)) {
+		if (out_nbytes_avail < 5)
+			return 0;
+		/* BFINAL and BTYPE */
+		*out_next++ = 1 | (DEFLATE_BLOCKTYPE_UNCOMPRESSED << 1);
+		/* LEN and NLEN */
+		put_unaligned_le32(0xFFFF0000, out_next);
+		return 5;
 	}
 
-	/* Offset slots */
-	for (i = 0; i < ARRAY_LEN(deflate_offset_slot_base); i++) {
-		u32 bits = (lens->offset[i] ?
-			    lens->offset[i] : OFFSET_NOSTAT_BITS);
+	do {
+		u8 bfinal = 0;
+		size_t len = UINT16_MAX;
 
-		bits += deflate_extra_offset_bits[i];
-		c->p.n.costs.offset_slot[i] = bits * BIT_COST;
-	}
+		if (in_end - in_next <= UINT16_MAX) {
+			bfinal = 1;
+			len = in_end - in_next;
+		}
+		if (out_end - out_next < 5 + len)
+			return 0;
+		/*
+		 * Output BFINAL and BTYPE.  The stream is already byte-aligned
+		 * here, so this step always requires outputting exactly 1 byte.
+		 */
+		*out_next++ = bfinal | (DEFLATE_BLOCKTYPE_UNCOMPRESSED << 1);
+
+		/* Output LEN and NLEN, then the data itself. */
+		put_unaligned_le16(len, out_next);
+		out_next += 2;
+		put_unaligned_le16(~len, out_next);
+		out_next += 2;
+		memcpy(out_next, in_next, len);
+		out_next += len;
+		in_next += len;
+	} while (in_next != in_end);
+
+	return out_next - out;
 }
 
 /*
- * This lookup table gives the default cost of a literal symbol and of a length
- * symbol, depending on the characteristics of the input data.  It was generated
- * by scripts/gen_default_litlen_costs.py.
- *
- * This table is indexed first by the estimated match probability:
- *
- *	i=0: data doesn't contain many matches	[match_prob=0.25]
- *	i=1: neutral				[match_prob=0.50]
- *	i=2: data contains lots of matches	[match_prob=0.75]
- *
- * This lookup produces a subtable which maps the number of distinct used
- * literals to the default cost of a literal symbol, i.e.:
- *
- *	int(-log2((1 - match_prob) / num_used_literals) * BIT_COST)
- *
- * ... for num_used_literals in [1, 256] (and 0, which is copied from 1).  This
- * accounts for literals usually getting cheaper as the number of distinct
- * literals decreases, and as the proportion of literals to matches increases.
- *
- * The lookup also produces the cost of a length symbol, which is:
- *
- *	int(-log2(match_prob/NUM_LEN_SLOTS) * BIT_COST)
+ * This is a faster variant of deflate_compress_greedy().  It uses the
+ * ht_matchfinder rather than the hc_matchfinder.  It also skips the block
+ * splitting algorithm and just uses fixed length blocks.  c->max_search_depth
+ * has no effect with this algorithm, as it is hardcoded in ht_matchfinder.h.
  *
- * Note: we don't currently assign different costs to different literal symbols,
- * or to different length symbols, as this is hard to do in a useful way.
+ * Positions are searched one at a time.  The time goes mostly to checking the
+ * candidates and to the mispredicted branches on whether they match, not to
+ * hashing or to waiting on the hash table; hashing several positions from one
+ * load, checking both bucket entries without branches, and prefetching the
+ * next position's candidate all measured no faster.  Inserting fewer positions
+ * from long matches, as zlib's level 1 does, is a few percent faster but costs
+ * up to 1% in compression ratio, so every position is still inserted.
  */
-static const struct {
-	u8 used_lits_to_lit_cost[257];
-	u8 len_sym_cost;
-} default_litlen_costs[] = {
-	{ /* match_prob = 0.25 */
-		.used_lits_to_lit_cost = {
-			6, 6, 22, 32, 38, 43, 48, 51,
-			54, 57, 59, 61, 64, 65, 67, 69,
-			70, 72, 73, 74, 75, 76, 77, 79,
-			80, 80, 81, 82, 83, 84, 85, 85,
-			86, 87, 88, 88, 89, 89, 90, 91,
-			91, 92, 92, 93, 93, 94, 95, 95,
+static void
+deflate_compress_fastest(struct libdeflate_compressor * restrict c,
+			 const u8 *in, size_t in_nbytes, bool is_final,
+			 struct deflate_output_bitstream *os)
+{
+	const u8 *in_next = in;
+	const u8 *in_end = in_next + in_nbytes;
+	const u8 *in_cur_base;
+	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
+	unsigned nice_len = MIN(c->nice_match_length, max_len);
+	u32 next_hashes[2] = {0, 0};
+	const u32 window_size = c->mf_window_size;
+	unsigned order_reduction;
+
+	if (!deflate_resume_matchfinder(c, in, in_nbytes, is_final,
+					&in_cur_base, next_hashes))
+		ht_matchfinder_init(&c->p.f.ht_mf, c->mf_order_reduction);
+	order_reduction = c->mf_order_reduction;
+
+	do {
+		/* Starting a new DEFLATE block */
+
+		const u8 * const in_block_begin = in_next;
+		const u8 * const in_max_block_end = choose_max_block_end(
+				in_next, in_end, c->soft_max_block_length);
+		struct deflate_sequence *seq = c->p.f.sequences;
+
+		deflate_begin_sequences(c, seq);
+
+		do {
+			u32 length;
+			u32 offset;
+			size_t remaining = in_end - in_next;
+
+			if (unlikely(remaining < DEFLATE_MAX_MATCH_LEN)) {
+				max_len = remaining;
+				if (max_len < HT_MATCHFINDER_REQUIRED_NBYTES) {
+					do {
+						deflate_choose_literal(c,
+							*in_next++, false, seq);
+					} while (--max_len);
+					break;
+				}
+				nice_len = MIN(nice_len, max_len);
+			}
+			length = ht_matchfinder_longest_match(&c->p.f.ht_mf,
+							      &in_cur_base,
+							      in_next,
+							      max_len,
+							      nice_len,
+							      order_reduction,
+							      window_size,
+							      &next_hashes[0],
+							      &offset,
+							      &c->mf_counters);
+			if (length) {
+				/* Match found */
+				deflate_choose_match(c, length, offset, false,
+						     &seq);
+				ht_matchfinder_skip_bytes(&c->p.f.ht_mf,
+							  &in_cur_base,
+							  in_next + 1,
+							  in_end,
+							  length - 1,
+							  order_reduction,
+							  &next_hashes[0]);
+				in_next += length;
+			} else {
+				/* No match found */
+				deflate_choose_literal(c, *in_next++, false,
+						       seq);
+			}
+
+			/* Check if it's time to output another block. */
+		} while (in_next < in_max_block_end &&
+			 seq < &c->p.f.sequences[FAST_SEQ_STORE_LENGTH]);
+
+		deflate_finish_block(c, os, in_block_begin,
+				     in_next - in_block_begin,
+				     c->p.f.sequences,
+				     is_final && in_next == in_end);
+	} while (in_next != in_end && !os->overflow);
+
+	deflate_save_matchfinder(c, (mf_pos_t *)&c->p.f.ht_mf,
+				 sizeof(c->p.f.ht_mf), in_end, in_cur_base,
+				 next_hashes);
+}
+
+/*
+ * This is the "ultrafast" DEFLATE compressor, used by
+ * LIBDEFLATE_STRATEGY_ULTRAFAST.  It is like deflate_compress_fastest(), but it
+ * gives up more compression ratio for speed:
+ *
+ * - It checks just one match candidate at each position, and it searches less
+ *   and less often while it keeps finding no matches, emitting the positions it
+ *   passes over as literals.  This is similar to what LZ4 does.
+ *
+ * - It always uses the static Huffman codes, so it doesn't need to gather the
+ *   block's symbol frequencies and build codes from them.  That lets it write
+ *   the literals and matches to the output as soon as it chooses them.  Once a
+ *   block is done, it is replaced with uncompressed blocks if those would be
+ *   smaller.
+ *
+ * The ht_matchfinder is used just for its hash table, of which only the first
+ * entry in each bucket is used.  That keeps the dictionary and streaming
+ * support compatible with deflate_compress_fastest().
+ */
+static void
+deflate_compress_ultrafast(struct libdeflate_compressor * restrict c,
+			   const u8 *in, size_t in_nbytes, bool is_final,
+			   struct deflate_output_bitstream *os)
+{
+	const struct deflate_codes * const codes = &deflate_static_codes;
+	struct ht_matchfinder * const mf = &c->p.u.ht_mf;
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	const u8 *in_cur_base;
+	u32 next_hashes[2] = {0, 0};
+	const u32 window_size = c->mf_window_size;
+	unsigned hash_order;
+
+	if (!deflate_resume_matchfinder(c, in, in_nbytes, is_final,
+					&in_cur_base, next_hashes))
+		ht_matchfinder_init(mf, c->mf_order_reduction);
+	hash_order = HT_MATCHFINDER_HASH_ORDER - c->mf_order_reduction;
+	deflate_compute_full_len_codewords(c, codes);
+
+	do {
+		/* Starting a new DEFLATE block */
+		const u8 * const in_block_begin = in_next;
+		const u8 *in_block_end = in_end;
+		const u8 *in_search_end;
+		bool is_final_block = is_final;
+		bitbuf_t bitbuf = os->bitbuf;
+		unsigned bitcount = os->bitcount;
+		u8 *out_begin = os->next;
+		u8 *out_end = os->end;
+		u8 *out_next;
+		u8 *out_fast_end;
+		const bool out_unchecked = false;
+		u32 num_literals = 0;
+		u32 num_matches = 0;
+		u32 num_misses = 0;
+		const u8 *lit_next = in_next;
+		u32 block_length;
+		u32 static_cost;
+		u32 uncompressed_cost;
+
+		/*
+		 * Choose where the block ends.  Matches may run past that
+		 * point, so make the last block a bit longer rather than leave
+		 * less than a match's worth of data after it, as whether a
+		 * block is the final one must be known to write its header.
+		 */
+		if (in_end - in_next > c->soft_max_block_length +
+				       DEFLATE_MAX_MATCH_LEN) {
+			in_block_end = in_next + c->soft_max_block_length;
+			is_final_block = false;
+		}
+		/* Matches can be searched for wherever 4 bytes remain. */
+		in_search_end = in_block_end;
+		if (in_end - in_search_end < 3)
+			in_search_end = in_end - MIN(3, in_end - in_next);
+
+		/*
+		 * Write the block directly to the output buffer if it fits
+		 * even at the worst case of 9 bits per byte, which is the cost
+		 * of the most expensive literals and more than the cost of any
+		 * match.  Otherwise write it to the block buffer, and copy it
+		 * over only if it turns out to fit.
+		 */
+		block_length = in_block_end - in_next + DEFLATE_MAX_MATCH_LEN;
+		if (out_end - out_begin <
+		    DIV_ROUND_UP(bitcount + 3 + 9 * (size_t)block_length + 7,
+				 8) + WORDBYTES) {
+			out_begin = c->p.u.block_buf;
+			out_end = &c->p.u.block_buf[sizeof(c->p.u.block_buf)];
+		}
+		out_next = out_begin;
+		out_fast_end = out_end - MIN(WORDBYTES - 1, out_end - out_next);
+
+		ADD_BITS(is_final_block, 1);
+		ADD_BITS(DEFLATE_BLOCKTYPE_STATIC_HUFFMAN, 2);
+		FLUSH_BITS();
+
+		while (in_next < in_search_end) {
+			u32 cur_pos = in_next - in_cur_base;
+			u32 seq = get_unaligned_le32(in_next);
+			u32 hash = lz_hash(seq, hash_order);
+			mf_pos_t cur_node;
+			const u8 *matchptr;
+			u32 length;
+			u32 offset;
+
+			if (cur_pos >= MATCHFINDER_WINDOW_SIZE) {
+				ht_matchfinder_slide_window(mf);
+				in_cur_base += MATCHFINDER_WINDOW_SIZE;
+				cur_pos -= MATCHFINDER_WINDOW_SIZE;
+			}
+			cur_node = mf->hash_tab[hash][0];
+			mf->hash_tab[hash][0] = cur_pos;
+			if (cur_node > (mf_pos_t)(cur_pos - window_size)) {
+				matchptr = &in_cur_base[cur_node];
+				if (get_unaligned_le32(matchptr) == seq) {
+					/*
+					 * Match found.  Output the literals
+					 * before it, then the match.
+					 */
+					length = lz_extend(
+						in_next, matchptr, 4,
+						MIN(in_end - in_next,
+						    DEFLATE_MAX_MATCH_LEN));
+					offset = in_next - matchptr;
+					num_literals += in_next - lit_next;
+					WRITE_LITERALS(codes, lit_next,
+						       in_next - lit_next);
+					WRITE_MATCH(c, codes, length, offset,
+						    deflate_get_offset_slot(
+								offset));
+					in_next += length;
+					lit_next = in_next;
+					num_matches++;
+					num_misses = 0;
+					continue;
+				}
+			}
+			/*
+			 * No match found.  Move on to the next position, or
+			 * further if no matches have been found for a while.
+			 */
+			in_next += MIN(1 + (num_misses++ >> 6),
+				       in_search_end - in_next);
+		}
+		/* Output the literals after the last match, if any. */
+		if (in_next < in_block_end)
+			in_next = in_block_end;
+		num_literals += in_next - lit_next;
+		WRITE_LITERALS(codes, lit_next, in_next - lit_next);
+		ADD_BITS(codes->codewords.litlen[DEFLATE_END_OF_BLOCK],
+			 codes->lens.litlen[DEFLATE_END_OF_BLOCK]);
+		FLUSH_BITS();
+
+		block_length = in_next - in_block_begin;
+		deflate_checksum_block(c, in_block_begin, block_length);
+		c->stats.in_nbytes += block_length;
+		c->stats.num_blocks++;
+		c->stats.num_literals += num_literals;
+		c->stats.num_matches += num_matches;
+		c->stats.total_match_length += block_length - num_literals;
+
+		/* Use uncompressed blocks instead if they're smaller. */
+		static_cost = 8 * (out_next - out_begin) + bitcount -
+			      os->bitcount;
+		uncompressed_cost = 3 + (-(os->bitcount + 3) & 7) + 32 +
+				    (40 * (DIV_ROUND_UP(block_length,
+							UINT16_MAX) - 1)) +
+				    (8 * block_length);
+		if (static_cost >= uncompressed_cost) {
+			c->stats.num_uncompressed_blocks++;
+			deflate_write_uncompressed_blocks(os, in_block_begin,
+							  block_length,
+							  is_final_block);
+			continue;
+		}
+		c->stats.num_static_blocks++;
+		if (out_begin != os->next) {
+			/*
+			 * The partial byte must fit too.  If the output is
+			 * being fit into a buffer, end the stream with as much
+			 * of the block as fits; the individual matches aren't
+			 * kept, so that is done with uncompressed blocks.
+			 */
+			if (os->end - os->next <
+			    DIV_ROUND_UP(static_cost + os->bitcount, 8)) {
+				if (os->fit_end != NULL)
+					deflate_write_uncompressed_blocks(
+						os, in_block_begin,
+						block_length, true);
+				else
+					os->overflow = true;
+				break;
+			}
+			memcpy(os->next, out_begin, out_next - out_begin);
+		}
+		os->bitbuf = bitbuf;
+		os->bitcount = bitcount;
+		os->next += out_next - out_begin;
+	} while (in_next != in_end && !os->overflow);
+
+	deflate_save_matchfinder(c, (mf_pos_t *)mf, sizeof(*mf), in_end,
+				 in_cur_base, next_hashes);
+}
+
+/*
+ * Add the number of occurrences of each byte value in @p[0..@n-1] to @freqs.
+ * Incrementing a single array causes a store-to-load dependency whenever the
+ * same byte occurs twice in a row, which is slow; so count into several arrays
+ * in an interleaved fashion, then merge them.
+ */
+static void
+deflate_count_literals(u32 freqs[DEFLATE_NUM_LITERALS], const u8 *p,
+		       size_t n)
+{
+	u32 counts[4][DEFLATE_NUM_LITERALS];
+	const u8 * const end = p + n;
+	unsigned i;
+
+	memset(counts, 0, sizeof(counts));
+	for (; end - p >= 4; p += 4) {
+		u32 v = get_unaligned_le32(p);
+
+		counts[0][(u8)v]++;
+		counts[1][(u8)(v >> 8)]++;
+		counts[2][(u8)(v >> 16)]++;
+		counts[3][v >> 24]++;
+	}
+	for (; p != end; p++)
+		counts[0][*p]++;
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
+		freqs[i] += counts[0][i] + counts[1][i] +
+			    counts[2][i] + counts[3][i];
+}
+
+/*
+ * This is the Huffman-only compressor.  It doesn't search for matches at all,
+ * but rather just Huffman-codes the literals using fixed length blocks.  Since
+ * all symbols in each block are literals, a block can be described by a single
+ * sequence, and its symbol frequencies can be gathered in one pass.
+ */
+static void
+deflate_compress_huffman_only(struct libdeflate_compressor * restrict c,
+			      const u8 *in, size_t in_nbytes, bool is_final,
+			      struct deflate_output_bitstream *os)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+
+	do {
+		/* Starting a new DEFLATE block */
+
+		const u8 * const in_block_begin = in_next;
+		const u8 * const in_block_end = choose_max_block_end(
+				in_next, in_end, c->soft_max_block_length);
+		struct deflate_sequence *seq = c->p.r.sequences;
+
+		deflate_begin_sequences(c, seq);
+		deflate_count_literals(c->freqs.litlen, in_block_begin,
+				       in_block_end - in_block_begin);
+		STATIC_ASSERT(MAX_BLOCK_LENGTH <= SEQ_LITRUNLEN_MASK);
+		seq->litrunlen_and_length = in_block_end - in_block_begin;
+		in_next = in_block_end;
+
+		deflate_finish_block(c, os, in_block_begin,
+				     in_next - in_block_begin,
+				     c->p.r.sequences,
+				     is_final && in_next == in_end);
+	} while (in_next != in_end && !os->overflow);
+}
+
+/*
+ * This is the run-length encoding compressor.  It only considers matches at
+ * distance 1, i.e. runs of the same byte, so it needs no matchfinder; instead,
+ * it just checks whether the next 3 bytes repeat the previous one, then extends
+ * the match a word at a time.  Like deflate_compress_fastest(), it uses fixed
+ * length blocks.  Data that precedes @in can be matched only if c->mf_resume
+ * is set, which in this case just means that there is such data.
+ */
+static void
+deflate_compress_rle(struct libdeflate_compressor * restrict c,
+		     const u8 *in, size_t in_nbytes, bool is_final,
+		     struct deflate_output_bitstream *os)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	/* The first position that has a preceding byte which can be matched */
+	const u8 * const in_min_match_pos = c->mf_resume ? in : in + 1;
+
+	do {
+		/* Starting a new DEFLATE block */
+
+		const u8 * const in_block_begin = in_next;
+		const u8 * const in_max_block_end = choose_max_block_end(
+				in_next, in_end, c->soft_max_block_length);
+		struct deflate_sequence *seq = c->p.r.sequences;
+
+		deflate_begin_sequences(c, seq);
+
+		do {
+			size_t remaining = in_end - in_next;
+
+			if (remaining >= DEFLATE_MIN_MATCH_LEN &&
+			    in_next >= in_min_match_pos &&
+			    in_next[0] == in_next[-1] &&
+			    in_next[1] == in_next[-1] &&
+			    in_next[2] == in_next[-1]) {
+				/* Run found */
+				u32 length = lz_extend(in_next, in_next - 1,
+						       DEFLATE_MIN_MATCH_LEN,
+						       MIN(remaining,
+							   DEFLATE_MAX_MATCH_LEN));
+
+				deflate_choose_match(c, length, 1, false, &seq);
+				in_next += length;
+			} else {
+				/*
+				 * Literal.  Also take any following literals
+				 * that can't start a run, since they don't
+				 * even repeat the byte before them.
+				 */
+				const u8 *lit_end = in_next + 1;
+
+				while (lit_end < in_max_block_end &&
+				       lit_end[0] != lit_end[-1])
+					lit_end++;
+				seq->litrunlen_and_length += lit_end - in_next;
+				do {
+					c->freqs.litlen[*in_next++]++;
+				} while (in_next != lit_end);
+			}
+
+			/* Check if it's time to output another block. */
+		} while (in_next < in_max_block_end &&
+			 seq < &c->p.r.sequences[FAST_SEQ_STORE_LENGTH]);
+
+		deflate_finish_block(c, os, in_block_begin,
+				     in_next - in_block_begin,
+				     c->p.r.sequences,
+				     is_final && in_next == in_end);
+	} while (in_next != in_end && !os->overflow);
+}
+
+/*
+ * Amount of data that deflate_skip_incompressible() tests at a time, and the
+ * least it will test.  The minimum keeps the statistical tests meaningful and
+ * the uncompressed blocks from being tiny.
+ */
+#define INCOMPRESSIBLE_REGION_LENGTH		65536
+#define MIN_INCOMPRESSIBLE_REGION_LENGTH	16384
+
+/*
+ * Quickly guess whether @p[0..@n-1] is incompressible, i.e. whether it would
+ * end up being output as uncompressed blocks anyway.  Data before @p, going
+ * back to @history, is taken into account as a source of matches.
+ *
+ * This must rarely be wrong when it says "yes", since the cost of being wrong
+ * is losing all the compression of the data; whereas when it says "no", the
+ * data just gets compressed normally.  So it checks two things, and answers
+ * "yes" only if both make the data look random:
+ *
+ * - The byte values must be almost uniformly distributed, or else Huffman
+ *   coding of the literals would help.  This is checked on evenly spaced
+ *   samples totalling 4096 bytes, which should have a chi-squared statistic
+ *   around 255 if the bytes are random.  Anything above 384 fails the test.
+ *
+ * - There must be almost no matches.  Checking every position would be as slow
+ *   as actually compressing the data, so this uses only "anchor" positions
+ *   whose 4-byte sequence has a hash code with its top bits all 0.  Since that
+ *   is decided by the content alone, both occurrences of a repeated string
+ *   contain the same anchors, so a single small table of the sequences at
+ *   recent anchors finds most repeats that are long enough to be worthwhile.
+ */
+static bool
+deflate_looks_incompressible(const u8 *history, const u8 *p, size_t n)
+{
+	const size_t stride = (n - 256) / 15;
+	u32 freqs[DEFLATE_NUM_LITERALS];
+	u32 anchor_seqs[2048];
+	const u8 *q, *end;
+	u32 num_anchors = 0;
+	u32 num_hits = 0;
+	u32 sum = 0;
+	unsigned i;
+
+	STATIC_ASSERT(MIN_INCOMPRESSIBLE_REGION_LENGTH >= 16 * 256);
+
+	memset(freqs, 0, sizeof(freqs));
+	for (i = 0; i < 16; i++)
+		deflate_count_literals(freqs, &p[i * stride], 256);
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
+		s32 d = (s32)freqs[i] - 16;
+
+		sum += d * d;
+	}
+	if (sum > 384 * 16)
+		return false;
+
+	memset(anchor_seqs, 0, sizeof(anchor_seqs));
+	q = p - MIN(p - history, MATCHFINDER_WINDOW_SIZE);
+	end = p + n - 3;
+	for (; q < end; q++) {
+		u32 seq = get_unaligned_le32(q);
+		u32 h = seq * 0x1E35A7BD;
+		u32 *slot;
+
+		if (h >> 28)
+			continue;
+		slot = &anchor_seqs[(h >> 17) & 2047];
+		if (q >= p) {
+			num_anchors++;
+			num_hits += (*slot == seq);
+		}
+		*slot = seq;
+	}
+	return num_hits * 128 <= num_anchors;
+}
+
+/*
+ * If the data at @in_next looks incompressible, return the length of the region
+ * of it that was tested, else return 0.  @in is the start of the input buffer
+ * and @in_end is its end.
+ */
+static forceinline size_t
+deflate_incompressible_region(const struct libdeflate_compressor *c,
+			      const u8 *in, const u8 *in_next, const u8 *in_end)
+{
+	size_t n = in_end - in_next;
+
+	/*
+	 * If there is history before the buffer, then the data near its start
+	 * may match the history, which this doesn't know how to check.
+	 */
+	if (c->mf_resume && in_next - in < MATCHFINDER_WINDOW_SIZE)
+		return 0;
+
+	if (n < MIN_INCOMPRESSIBLE_REGION_LENGTH)
+		return 0;
+	/* Don't leave a remainder too short to test on its own. */
+	if (n >= INCOMPRESSIBLE_REGION_LENGTH + MIN_INCOMPRESSIBLE_REGION_LENGTH)
+		n = INCOMPRESSIBLE_REGION_LENGTH;
+	return deflate_looks_incompressible(in, in_next, n) ? n : 0;
+}
+
+/*
+ * If the data at *@in_next_p looks incompressible, output it as uncompressed
+ * blocks without searching for matches in it, advance *@in_next_p past it,
+ * and return true.  Repeat for as long as the data continues to look
+ * incompressible.  @in is the start of the input buffer and @in_end is its end.
+ *
+ * The matchfinder @mf of size @mf_size, whose base is *@in_cur_base_p and whose
+ * precomputed hash codes are @next_hashes, is then updated to continue at the
+ * new *@in_next_p.  It loses track of all sequences in the skipped data, but
+ * by definition those weren't useful anyway.  The hash codes are computed for
+ * @hash3_order and @hash4_order bits.
+ */
+static forceinline bool
+deflate_skip_incompressible(struct libdeflate_compressor *c,
+			    struct deflate_output_bitstream *os,
+			    const u8 *in, const u8 **in_next_p,
+			    const u8 *in_end, bool is_final,
+			    mf_pos_t *mf, size_t mf_size,
+			    const u8 **in_cur_base_p, u32 next_hashes[2],
+			    unsigned hash3_order, unsigned hash4_order)
+{
+	const u8 * const in_begin = *in_next_p;
+	const u8 *in_next = in_begin;
+	unsigned num_rebases = 0;
+	size_t n;
+
+	while ((n = deflate_incompressible_region(c, in, in_next, in_end)) != 0)
+		in_next += n;
+	if (in_next == in_begin)
+		return false;
+
+	deflate_count_passthrough(c, in_next - in_begin);
+	deflate_write_uncompressed_blocks(os, in_begin, in_next - in_begin,
+					  is_final && in_next == in_end);
+
+	/*
+	 * Slide the matchfinder's window forward until the new position is in
+	 * it.  After two slides nothing is left in the matchfinder, so any
+	 * further slides can just move the base.
+	 */
+	while (in_next - *in_cur_base_p > MATCHFINDER_WINDOW_SIZE) {
+		if (num_rebases++ < 2)
+			matchfinder_rebase(mf, mf_size);
+		*in_cur_base_p += MATCHFINDER_WINDOW_SIZE;
+	}
+	if (in_end - in_next >= 4) {
+		u32 seq = get_unaligned_le32(in_next);
+
+		next_hashes[0] = lz_hash(seq & 0xFFFFFF, hash3_order);
+		next_hashes[1] = lz_hash(seq, hash4_order);
+	}
+	*in_next_p = in_next;
+	return true;
+}
+
+static forceinline void
+deflate_compress_greedy_generic(struct libdeflate_compressor * restrict c,
+				const u8 *in, size_t in_nbytes, bool is_final,
+				struct deflate_output_bitstream *os,
+				const u32 window_size)
+{
+	const u8 *in_next = in;
+	const u8 *in_end = in_next + in_nbytes;
+	const u8 *in_cur_base;
+	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
+	unsigned nice_len = MIN(c->nice_match_length, max_len);
+	u32 next_hashes[2] = {0, 0};
+	unsigned order_reduction;
+
+	if (!deflate_resume_matchfinder(c, in, in_nbytes, is_final,
+					&in_cur_base, next_hashes))
+		hc_matchfinder_init(&c->p.g.hc_mf, c->mf_order_reduction);
+	order_reduction = c->mf_order_reduction;
+
+	do {
+		/* Starting a new DEFLATE block */
+
+		const u8 * const in_block_begin = in_next;
+		const u8 * const in_max_block_end = choose_max_block_end(
+				in_next, in_end, c->soft_max_block_length);
+		struct deflate_sequence *seq = c->p.g.sequences;
+		unsigned min_len;
+
+		if (deflate_skip_incompressible(
+				c, os, in, &in_next, in_end, is_final,
+				(mf_pos_t *)&c->p.g.hc_mf,
+				hc_matchfinder_size(window_size),
+				&in_cur_base,
+				next_hashes,
+				HC_MATCHFINDER_HASH3_ORDER - order_reduction,
+				HC_MATCHFINDER_HASH4_ORDER - order_reduction))
+			continue;
+
+		init_block_split_stats(&c->split_stats);
+		deflate_begin_sequences(c, seq);
+		min_len = calculate_min_match_len(in_next,
+						  in_max_block_end - in_next,
+						  c->max_search_depth);
+		do {
+			u32 length;
+			u32 offset;
+
+			adjust_max_and_nice_len(&max_len, &nice_len,
+						in_end - in_next);
+			length = hc_matchfinder_longest_match(
+						&c->p.g.hc_mf,
+						&in_cur_base,
+						in_next,
+						min_len - 1,
+						max_len,
+						nice_len,
+						c->max_search_depth,
+						order_reduction,
+						window_size,
+						next_hashes,
+						&offset,
+						&c->mf_counters);
+
+			if (length >= min_len &&
+			    (length > DEFLATE_MIN_MATCH_LEN ||
+			     offset <= 4096)) {
+				/* Match found */
+				deflate_choose_match(c, length, offset, true,
+						     &seq);
+				hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
+							  &in_cur_base,
+							  in_next + 1,
+							  in_end,
+							  length - 1,
+							  order_reduction,
+							  window_size,
+							  next_hashes);
+				in_next += length;
+			} else {
+				/* No match found */
+				deflate_choose_literal(c, *in_next++, true,
+						       seq);
+			}
+
+			/* Check if it's time to output another block. */
+		} while (in_next < in_max_block_end &&
+			 seq < &c->p.g.sequences[SEQ_STORE_LENGTH] &&
+			 !should_end_block(c, in_block_begin, in_next,
+					   in_end));
+
+		deflate_finish_block(c, os, in_block_begin,
+				     in_next - in_block_begin,
+				     c->p.g.sequences,
+				     is_final && in_next == in_end);
+	} while (in_next != in_end && !os->overflow);
+
+	deflate_save_matchfinder(c, (mf_pos_t *)&c->p.g.hc_mf,
+				 hc_matchfinder_size(window_size),
+				 in_end, in_cur_base,
+				 next_hashes);
+}
+
+/*
+ * This is the "greedy" DEFLATE compressor. It always chooses the longest match.
+ * It is instantiated separately for the default window size, so that the hash
+ * chain lookups use it as a constant.
+ */
+static void
+deflate_compress_greedy(struct libdeflate_compressor * restrict c,
+			const u8 *in, size_t in_nbytes, bool is_final,
+			struct deflate_output_bitstream *os)
+{
+	if (c->mf_window_size == MATCHFINDER_WINDOW_SIZE)
+		deflate_compress_greedy_generic(c, in, in_nbytes, is_final, os,
+						MATCHFINDER_WINDOW_SIZE);
+	else
+		deflate_compress_greedy_generic(c, in, in_nbytes, is_final, os,
+						c->mf_window_size);
+}
+
+static forceinline void
+deflate_compress_lazy_generic(struct libdeflate_compressor * restrict c,
+			      const u8 *in, size_t in_nbytes, bool is_final,
+			      struct deflate_output_bitstream *os, bool lazy2,
+			      const u32 window_size)
+{
+	const u8 *in_next = in;
+	const u8 *in_end = in_next + in_nbytes;
+	const u8 *in_cur_base;
+	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
+	unsigned nice_len = MIN(c->nice_match_length, max_len);
+	u32 next_hashes[2] = {0, 0};
+	unsigned order_reduction;
+
+	if (!deflate_resume_matchfinder(c, in, in_nbytes, is_final,
+					&in_cur_base, next_hashes))
+		hc_matchfinder_init(&c->p.g.hc_mf, c->mf_order_reduction);
+	order_reduction = c->mf_order_reduction;
+
+	do {
+		/* Starting a new DEFLATE block */
+
+		const u8 * const in_block_begin = in_next;
+		const u8 * const in_max_block_end = choose_max_block_end(
+				in_next, in_end, c->soft_max_block_length);
+		const u8 *next_recalc_min_len =
+			in_next + MIN(in_end - in_next, 10000);
+		struct deflate_sequence *seq = c->p.g.sequences;
+		unsigned min_len;
+
+		if (deflate_skip_incompressible(
+				c, os, in, &in_next, in_end, is_final,
+				(mf_pos_t *)&c->p.g.hc_mf,
+				hc_matchfinder_size(window_size),
+				&in_cur_base,
+				next_hashes,
+				HC_MATCHFINDER_HASH3_ORDER - order_reduction,
+				HC_MATCHFINDER_HASH4_ORDER - order_reduction))
+			continue;
+
+		init_block_split_stats(&c->split_stats);
+		deflate_begin_sequences(c, seq);
+		min_len = calculate_min_match_len(in_next,
+						  in_max_block_end - in_next,
+						  c->max_search_depth);
+		do {
+			unsigned cur_len;
+			unsigned cur_offset;
+			unsigned next_len;
+			unsigned next_offset;
+
+			/*
+			 * Recalculate the minimum match length if it hasn't
+			 * been done recently.
+			 */
+			if (in_next >= next_recalc_min_len) {
+				min_len = recalculate_min_match_len(
+						&c->freqs,
+						c->max_search_depth);
+				next_recalc_min_len +=
+					MIN(in_end - next_recalc_min_len,
+					    in_next - in_block_begin);
+			}
+
+			/* Find the longest match at the current position. */
+			adjust_max_and_nice_len(&max_len, &nice_len,
+						in_end - in_next);
+			cur_len = hc_matchfinder_longest_match(
+						&c->p.g.hc_mf,
+						&in_cur_base,
+						in_next,
+						min_len - 1,
+						max_len,
+						nice_len,
+						c->max_search_depth,
+						order_reduction,
+						window_size,
+						next_hashes,
+						&cur_offset,
+						&c->mf_counters);
+			if (cur_len < min_len ||
+			    (cur_len == DEFLATE_MIN_MATCH_LEN &&
+			     cur_offset > 8192)) {
+				/* No match found.  Choose a literal. */
+				deflate_choose_literal(c, *in_next++, true,
+						       seq);
+				continue;
+			}
+			in_next++;
+
+have_cur_match:
+			/*
+			 * We have a match at the current position.
+			 * If it's very long, choose it immediately.
+			 */
+			if (cur_len >= nice_len) {
+				deflate_choose_match(c, cur_len, cur_offset,
+						     true, &seq);
+				hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
+							  &in_cur_base,
+							  in_next,
+							  in_end,
+							  cur_len - 1,
+							  order_reduction,
+							  window_size,
+							  next_hashes);
+				in_next += cur_len - 1;
+				continue;
+			}
+
+			/*
+			 * Try to find a better match at the next position.
+			 *
+			 * Note: since we already have a match at the *current*
+			 * position, we use only half the 'max_search_depth'
+			 * when checking the *next* position.  This is a useful
+			 * trade-off because it's more worthwhile to use a
+			 * greater search depth on the initial match.
+			 *
+			 * Note: it's possible to structure the code such that
+			 * there's only one call to longest_match(), which
+			 * handles both the "find the initial match" and "try to
+			 * find a better match" cases.  However, it is faster to
+			 * have two call sites, with longest_match() inlined at
+			 * each.
+			 */
+			adjust_max_and_nice_len(&max_len, &nice_len,
+						in_end - in_next);
+			next_len = hc_matchfinder_longest_match(
+						&c->p.g.hc_mf,
+						&in_cur_base,
+						in_next++,
+						cur_len - 1,
+						max_len,
+						nice_len,
+						c->max_search_depth >> 1,
+						order_reduction,
+						window_size,
+						next_hashes,
+						&next_offset,
+						&c->mf_counters);
+			if (next_len >= cur_len &&
+			    4 * (int)(next_len - cur_len) +
+			    ((int)bsr32(cur_offset) -
+			     (int)bsr32(next_offset)) > 2) {
+				/*
+				 * Found a better match at the next position.
+				 * Output a literal.  Then the next match
+				 * becomes the current match.
+				 */
+				deflate_choose_literal(c, *(in_next - 2), true,
+						       seq);
+				cur_len = next_len;
+				cur_offset = next_offset;
+				goto have_cur_match;
+			}
+
+			if (lazy2) {
+				/* In lazy2 mode, look ahead another position */
+				adjust_max_and_nice_len(&max_len, &nice_len,
+							in_end - in_next);
+				next_len = hc_matchfinder_longest_match(
+						&c->p.g.hc_mf,
+						&in_cur_base,
+						in_next++,
+						cur_len - 1,
+						max_len,
+						nice_len,
+						c->max_search_depth >> 2,
+						order_reduction,
+						window_size,
+						next_hashes,
+						&next_offset,
+						&c->mf_counters);
+				if (next_len >= cur_len &&
+				    4 * (int)(next_len - cur_len) +
+				    ((int)bsr32(cur_offset) -
+				     (int)bsr32(next_offset)) > 6) {
+					/*
+					 * There's a much better match two
+					 * positions ahead, so use two literals.
+					 */
+					deflate_choose_literal(
+						c, *(in_next - 3), true, seq);
+					deflate_choose_literal(
+						c, *(in_next - 2), true, seq);
+					cur_len = next_len;
+					cur_offset = next_offset;
+					goto have_cur_match;
+				}
+				/*
+				 * No better match at either of the next 2
+				 * positions.  Output the current match.
+				 */
+				deflate_choose_match(c, cur_len, cur_offset,
+						     true, &seq);
+				if (cur_len > 3) {
+					hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
+								  &in_cur_base,
+								  in_next,
+								  in_end,
+								  cur_len - 3,
+								  order_reduction,
+								  window_size,
+								  next_hashes);
+					in_next += cur_len - 3;
+				}
+			} else { /* !lazy2 */
+				/*
+				 * No better match at the next position.  Output
+				 * the current match.
+				 */
+				deflate_choose_match(c, cur_len, cur_offset,
+						     true, &seq);
+				hc_matchfinder_skip_bytes(&c->p.g.hc_mf,
+							  &in_cur_base,
+							  in_next,
+							  in_end,
+							  cur_len - 2,
+							  order_reduction,
+							  window_size,
+							  next_hashes);
+				in_next += cur_len - 2;
+			}
+			/* Check if it's time to output another block. */
+		} while (in_next < in_max_block_end &&
+			 seq < &c->p.g.sequences[SEQ_STORE_LENGTH] &&
+			 !should_end_block(c, in_block_begin, in_next,
+					   in_end));
+
+		deflate_finish_block(c, os, in_block_begin,
+				     in_next - in_block_begin,
+				     c->p.g.sequences,
+				     is_final && in_next == in_end);
+	} while (in_next != in_end && !os->overflow);
+
+	deflate_save_matchfinder(c, (mf_pos_t *)&c->p.g.hc_mf,
+				 hc_matchfinder_size(window_size),
+				 in_end, in_cur_base,
+				 next_hashes);
+}
+
+/*
+ * This is the "lazy" DEFLATE compressor.  Before choosing a match, it checks to
+ * see if there's a better match at the next position.  If yes, it outputs a
+ * literal and continues to the next position.  If no, it outputs the match.
+ * Like the greedy compressor, it is instantiated separately for the default
+ * window size.
+ */
+static void
+deflate_compress_lazy(struct libdeflate_compressor * restrict c,
+		      const u8 *in, size_t in_nbytes, bool is_final,
+		      struct deflate_output_bitstream *os)
+{
+	if (c->mf_window_size == MATCHFINDER_WINDOW_SIZE)
+		deflate_compress_lazy_generic(c, in, in_nbytes, is_final, os,
+					      false, MATCHFINDER_WINDOW_SIZE);
+	else
+		deflate_compress_lazy_generic(c, in, in_nbytes, is_final, os,
+					      false, c->mf_window_size);
+}
+
+/*
+ * The lazy2 compressor.  This is similar to the regular lazy one, but it looks
+ * for a better match at the next 2 positions rather than the next 1.  This
+ * makes it take slightly more time, but compress some inputs slightly more.
+ */
+static void
+deflate_compress_lazy2(struct libdeflate_compressor * restrict c,
+		       const u8 *in, size_t in_nbytes, bool is_final,
+		       struct deflate_output_bitstream *os)
+{
+	if (c->mf_window_size == MATCHFINDER_WINDOW_SIZE)
+		deflate_compress_lazy_generic(c, in, in_nbytes, is_final, os,
+					      true, MATCHFINDER_WINDOW_SIZE);
+	else
+		deflate_compress_lazy_generic(c, in, in_nbytes, is_final, os,
+					      true, c->mf_window_size);
+}
+
+/*
+ * The parameters of compression levels 2-9.  These all use the hash chains
+ * matchfinder, so a compressor can switch between them at any block boundary.
+ */
+static const struct {
+	void (*impl)(struct libdeflate_compressor *restrict c, const u8 *in,
+		     size_t in_nbytes, bool is_final,
+		     struct deflate_output_bitstream *os);
+	u16 max_search_depth;
+	u16 nice_match_length;
+} deflate_hc_levels[MAX_RATE_RUNGS] = {
+	/* Indexed by the compression level minus 2 */
+	{ deflate_compress_greedy,	6,	10 },
+	{ deflate_compress_greedy,	12,	14 },
+	{ deflate_compress_greedy,	16,	30 },
+	{ deflate_compress_lazy,	16,	30 },
+	{ deflate_compress_lazy,	35,	65 },
+	{ deflate_compress_lazy,	100,	130 },
+	{ deflate_compress_lazy2,	300,	DEFLATE_MAX_MATCH_LEN },
+	{ deflate_compress_lazy2,	600,	DEFLATE_MAX_MATCH_LEN },
+};
+
+/*
+ * Return the time in nanoseconds per KiB of input that meets the target of a
+ * compressor with a target speed, when @elapsed_ns have passed in the current
+ * call and @in_nbytes bytes are left to compress in it.  UINT64_MAX means that
+ * there is no target.
+ */
+static u64
+deflate_rate_target(const struct deflate_rate_state *rs, u64 elapsed_ns,
+		    size_t in_nbytes)
+{
+	u64 target = UINT64_MAX;
+
+	if (rs->control.target_bytes_per_sec != 0)
+		target = (u64)1000000000 * 1024 /
+			 rs->control.target_bytes_per_sec;
+	if (rs->control.time_budget_ns != 0) {
+		u64 left = 0;
+
+		if (elapsed_ns < rs->control.time_budget_ns)
+			left = rs->control.time_budget_ns - elapsed_ns;
+		target = MIN(target, left / (in_nbytes / 1024 + 1));
+	}
+	return target;
+}
+
+/*
+ * Choose the rung to compress the next data on, given the target time per KiB
+ * from deflate_rate_target().  The current rung is kept unless it is estimated
+ * to miss the target, in which case the compressor steps down until it reaches
+ * a rung estimated to meet it or one not measured yet.  If @measured, the
+ * current rung has just been measured, and the compressor may also step up
+ * one rung if that rung is estimated to meet the target, taking an unmeasured
+ * rung to be twice as slow.  So the compressor backs off quickly but climbs
+ * back one rung per measurement.
+ */
+static void
+deflate_choose_rung(struct deflate_rate_state *rs, u64 target, bool measured)
+{
+	unsigned rung = rs->rung;
+
+	if (rs->ns_per_kib[rung] > target) {
+		while (rung > 0 && rs->ns_per_kib[rung] > target)
+			rung--;
+	} else if (measured && rung + 1 < rs->num_rungs) {
+		u64 up = rs->ns_per_kib[rung + 1];
+
+		if (up == 0 ? rs->ns_per_kib[rung] <= target / 2 :
+			      up <= target)
+			rung++;
+	}
+	if (rung != rs->rung) {
+		rs->rung = rung;
+		rs->sample_ns = 0;
+		rs->sample_nbytes = 0;
+	}
+}
+
+/*
+ * Update the estimated speed of the current rung from the time it took to
+ * compress the data since it was last measured.  That time depends mostly on
+ * how busy the machine is and on the data, both of which affect the other
+ * rungs alike, so their estimates are scaled by the same factor.  That way a
+ * rung measured long ago, e.g. when the machine was busier, isn't trusted as
+ * is.
+ */
+static void
+deflate_update_rate_estimates(struct deflate_rate_state *rs)
+{
+	/* Capped so that the products below can't overflow */
+	u64 ns_per_kib = MIN(rs->sample_ns * 1024 / rs->sample_nbytes,
+			     UINT32_MAX);
+	u64 old = rs->ns_per_kib[rs->rung];
+	u64 new;
+	unsigned i;
+
+	rs->sample_ns = 0;
+	rs->sample_nbytes = 0;
+	if (old == 0) {
+		rs->ns_per_kib[rs->rung] = MAX(ns_per_kib, 1);
+		return;
+	}
+	/* Average with the old estimate, to smooth out noise. */
+	new = MAX((old + ns_per_kib) / 2, 1);
+	for (i = 0; i < rs->num_rungs; i++) {
+		if (i != rs->rung && rs->ns_per_kib[i] != 0)
+			rs->ns_per_kib[i] = MIN(MAX(rs->ns_per_kib[i] * new /
+						    old, 1), UINT32_MAX);
+	}
+	rs->ns_per_kib[rs->rung] = new;
+}
+
+/* Set the compressor's search parameters to those of the current rung. */
+static void
+deflate_set_rung(struct libdeflate_compressor *c)
+{
+	const struct deflate_rate_state *rs = &c->rate;
+
+	if (rs->rung == rs->num_rungs - 1) {
+		c->max_search_depth = rs->top_max_search_depth;
+		c->nice_match_length = rs->top_nice_match_length;
+	} else {
+		c->max_search_depth =
+			deflate_hc_levels[rs->rung].max_search_depth;
+		c->nice_match_length =
+			deflate_hc_levels[rs->rung].nice_match_length;
+	}
+}
+
+/*
+ * This is the compressor with a target speed.  It compresses the input in
+ * pieces that end where choose_max_block_end() would end a block, each with the
+ * parameters of one of compression levels 2 up to the compressor's level,
+ * timing each piece with the caller's clock to decide which level the next
+ * piece can afford.  The estimates carry over from call to call.
+ */
+static void
+deflate_compress_adaptive(struct libdeflate_compressor * restrict c,
+			  const u8 *in, size_t in_nbytes, bool is_final,
+			  struct deflate_output_bitstream *os)
+{
+	struct deflate_rate_state *rs = &c->rate;
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	const u64 call_start = (*rs->control.get_time_ns)(rs->control.ctx);
+	u64 now = call_start;
+
+	do {
+		const u8 * const in_piece_end = choose_max_block_end(
+				in_next, in_end, c->soft_max_block_length);
+		u64 target = deflate_rate_target(rs, now - call_start,
+						 in_end - in_next);
+		u64 piece_start = now;
+
+		deflate_choose_rung(rs, target, false);
+		deflate_set_rung(c);
+		if (rs->rung == rs->num_rungs - 1)
+			(*rs->top_impl)(c, in_next, in_piece_end - in_next,
+					is_final && in_piece_end == in_end, os);
+		else
+			(*deflate_hc_levels[rs->rung].impl)(
+					c, in_next, in_piece_end - in_next,
+					is_final && in_piece_end == in_end, os);
+		/* The next piece continues from this one. */
+		c->mf_resume = true;
+
+		now = (*rs->control.get_time_ns)(rs->control.ctx);
+		rs->sample_ns += now - piece_start;
+		rs->sample_nbytes += in_piece_end - in_next;
+		if (rs->sample_nbytes >= RATE_SAMPLE_NBYTES) {
+			deflate_update_rate_estimates(rs);
+			deflate_choose_rung(rs, target, true);
+		}
+		in_next = in_piece_end;
+	} while (in_next != in_end && !os->overflow);
+
+	/*
+	 * Leave the compressor's own parameters in place between calls, as
+	 * e.g. prepared dictionaries are matched against them.
+	 */
+	c->max_search_depth = rs->top_max_search_depth;
+	c->nice_match_length = rs->top_nice_match_length;
+}
+
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+
+/*
+ * Follow the minimum-cost path in the graph of possible match/literal choices
+ * for the current block and compute the frequencies of the Huffman symbols that
+ * would be needed to output those matches and literals.
+ */
+static void
+deflate_tally_item_list(struct libdeflate_compressor *c, u32 block_length)
+{
+	struct deflate_optimum_node *cur_node = &c->p.n.optimum_nodes[0];
+	struct deflate_optimum_node *end_node =
+		&c->p.n.optimum_nodes[block_length];
+
+	do {
+		unsigned length = cur_node->item & OPTIMUM_LEN_MASK;
+		unsigned offset = cur_node->item >> OPTIMUM_OFFSET_SHIFT;
+
+		if (length == 1) {
+			/* Literal */
+			c->freqs.litlen[offset]++;
+		} else {
+			/* Match */
+			c->freqs.litlen[DEFLATE_FIRST_LEN_SYM +
+					deflate_length_slot[length]]++;
+			c->freqs.offset[deflate_offset_slot_full[offset]]++;
+		}
+		cur_node += length;
+	} while (cur_node != end_node);
+
+	/* Tally the end-of-block symbol. */
+	c->freqs.litlen[DEFLATE_END_OF_BLOCK]++;
+}
+
+static void
+deflate_choose_all_literals(struct libdeflate_compressor *c,
+			    const u8 *block, u32 block_length)
+{
+	deflate_reset_symbol_frequencies(c);
+	deflate_count_literals(c->freqs.litlen, block, block_length);
+	c->freqs.litlen[DEFLATE_END_OF_BLOCK]++;
+
+	deflate_make_huffman_codes(&c->freqs, &c->codes);
+}
+
+/*
+ * Compute the exact cost, in bits, that would be required to output the matches
+ * and literals described by @c->freqs as a dynamic Huffman block.  The litlen
+ * and offset codes are assumed to have already been built in @c->codes.
+ */
+static u32
+deflate_compute_true_cost(struct libdeflate_compressor *c)
+{
+	u32 cost = 0;
+	unsigned sym;
+
+	deflate_precompute_huffman_header(c);
+
+	memset(&c->codes.lens.litlen[c->o.precode.num_litlen_syms], 0,
+	       DEFLATE_NUM_LITLEN_SYMS - c->o.precode.num_litlen_syms);
+
+	cost += 5 + 5 + 4 + (3 * c->o.precode.num_explicit_lens);
+	for (sym = 0; sym < DEFLATE_NUM_PRECODE_SYMS; sym++) {
+		cost += c->o.precode.freqs[sym] *
+			(c->o.precode.lens[sym] +
+			 deflate_extra_precode_bits[sym]);
+	}
+
+	for (sym = 0; sym < DEFLATE_FIRST_LEN_SYM; sym++)
+		cost += c->freqs.litlen[sym] * c->codes.lens.litlen[sym];
+
+	for (; sym < DEFLATE_FIRST_LEN_SYM +
+	       ARRAY_LEN(deflate_extra_length_bits); sym++)
+		cost += c->freqs.litlen[sym] *
+			(c->codes.lens.litlen[sym] +
+			 deflate_extra_length_bits[sym - DEFLATE_FIRST_LEN_SYM]);
+
+	for (sym = 0; sym < ARRAY_LEN(deflate_extra_offset_bits); sym++)
+		cost += c->freqs.offset[sym] *
+			(c->codes.lens.offset[sym] +
+			 deflate_extra_offset_bits[sym]);
+	return cost;
+}
+
+/* Set the current cost model from the codeword lengths specified in @lens. */
+static void
+deflate_set_costs_from_codes(struct libdeflate_compressor *c,
+			     const struct deflate_lens *lens)
+{
+	unsigned i;
+
+	/* Literals */
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
+		u32 bits = (lens->litlen[i] ?
+			    lens->litlen[i] : LITERAL_NOSTAT_BITS);
+
+		c->p.n.costs.literal[i] = bits * BIT_COST;
+	}
+
+	/* Lengths */
+	for (i = DEFLATE_MIN_MATCH_LEN; i <= DEFLATE_MAX_MATCH_LEN; i++) {
+		unsigned length_slot = deflate_length_slot[i];
+		unsigned litlen_sym = DEFLATE_FIRST_LEN_SYM + length_slot;
+		u32 bits = (lens->litlen[litlen_sym] ?
+			    lens->litlen[litlen_sym] : LENGTH_NOSTAT_BITS);
+
+		bits += deflate_extra_length_bits[length_slot];
+		c->p.n.costs.length[i] = bits * BIT_COST;
+	}
+
+	/* Offset slots */
+	for (i = 0; i < ARRAY_LEN(deflate_offset_slot_base); i++) {
+		u32 bits = (lens->offset[i] ?
+			    lens->offset[i] : OFFSET_NOSTAT_BITS);
+
+		bits += deflate_extra_offset_bits[i];
+		c->p.n.costs.offset_slot[i] = bits * BIT_COST;
+	}
+}
+
+/*
+ * This lookup table gives the default cost of a literal symbol and of a length
+ * symbol, depending on the characteristics of the input data.  It was generated
+ * by scripts/gen_default_litlen_costs.py.
+ *
+ * This table is indexed first by the estimated match probability:
+ *
+ *	i=0: data doesn't contain many matches	[match_prob=0.25]
+ *	i=1: neutral				[match_prob=0.50]
+ *	i=2: data contains lots of matches	[match_prob=0.75]
+ *
+ * This lookup produces a subtable which maps the number of distinct used
+ * literals to the default cost of a literal symbol, i.e.:
+ *
+ *	int(-log2((1 - match_prob) / num_used_literals) * BIT_COST)
+ *
+ * ... for num_used_literals in [1, 256] (and 0, which is copied from 1).  This
+ * accounts for literals usually getting cheaper as the number of distinct
+ * literals decreases, and as the proportion of literals to matches increases.
+ *
+ * The lookup also produces the cost of a length symbol, which is:
+ *
+ *	int(-log2(match_prob/NUM_LEN_SLOTS) * BIT_COST)
+ *
+ * Note: we don't currently assign different costs to different literal symbols,
+ * or to different length symbols, as this is hard to do in a useful way.
+ */
+static const struct {
+	u8 used_lits_to_lit_cost[257];
+	u8 len_sym_cost;
+} default_litlen_costs[] = {
+	{ /* match_prob = 0.25 */
+		.used_lits_to_lit_cost = {
+			6, 6, 22, 32, 38, 43, 48, 51,
+			54, 57, 59, 61, 64, 65, 67, 69,
+			70, 72, 73, 74, 75, 76, 77, 79,
+			80, 80, 81, 82, 83, 84, 85, 85,
+			86, 87, 88, 88, 89, 89, 90, 91,
+			91, 92, 92, 93, 93, 94, 95, 95,
 			96, 96, 96, 97, 97, 98, 98, 99,
 			99, 99, 100, 100, 101, 101, 101, 102,
 			102, 102, 103, 103, 104, 104, 104, 105,
@@ -3103,973 +5075,3028 @@ static const struct {
 };
 
 /*
- * Choose the default costs for literal and length symbols.  These symbols are
- * both part of the litlen alphabet.
+ * Choose the default costs for literal and length symbols.  These symbols are
+ * both part of the litlen alphabet.
+ */
+static void
+deflate_choose_default_litlen_costs(struct libdeflate_compressor *c,
+				    const u8 *block_begin, u32 block_length,
+				    u32 *lit_cost, u32 *len_sym_cost)
+{
+	unsigned num_used_literals = 0;
+	u32 literal_freq = block_length;
+	u32 match_freq = 0;
+	u32 cutoff;
+	u32 i;
+
+	/* Calculate the number of distinct literals that exist in the data. */
+	memset(c->freqs.litlen, 0,
+	       DEFLATE_NUM_LITERALS * sizeof(c->freqs.litlen[0]));
+	cutoff = literal_freq >> 11; /* Ignore literals used very rarely. */
+	deflate_count_literals(c->freqs.litlen, block_begin, block_length);
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
+		if (c->freqs.litlen[i] > cutoff)
+			num_used_literals++;
+	}
+	if (num_used_literals == 0)
+		num_used_literals = 1;
+
+	/*
+	 * Estimate the relative frequency of literals and matches in the
+	 * optimal parsing solution.  We don't know the optimal solution, so
+	 * this can only be a very rough estimate.  Therefore, we basically use
+	 * the match frequency from a greedy parse.  We also apply the min_len
+	 * heuristic used by the greedy and lazy parsers, to avoid counting too
+	 * many matches when literals are cheaper than short matches.
+	 */
+	match_freq = 0;
+	i = choose_min_match_len(num_used_literals, c->max_search_depth);
+	for (; i < ARRAY_LEN(c->p.n.match_len_freqs); i++) {
+		match_freq += c->p.n.match_len_freqs[i];
+		literal_freq -= i * c->p.n.match_len_freqs[i];
+	}
+	if ((s32)literal_freq < 0) /* shouldn't happen */
+		literal_freq = 0;
+
+	if (match_freq > literal_freq)
+		i = 2; /* many matches */
+	else if (match_freq * 4 > literal_freq)
+		i = 1; /* neutral */
+	else
+		i = 0; /* few matches */
+
+	STATIC_ASSERT(BIT_COST == 16);
+	*lit_cost = default_litlen_costs[i].used_lits_to_lit_cost[
+							num_used_literals];
+	*len_sym_cost = default_litlen_costs[i].len_sym_cost;
+}
+
+static forceinline u32
+deflate_default_length_cost(unsigned len, u32 len_sym_cost)
+{
+	unsigned slot = deflate_length_slot[len];
+	u32 num_extra_bits = deflate_extra_length_bits[slot];
+
+	return len_sym_cost + (num_extra_bits * BIT_COST);
+}
+
+static forceinline u32
+deflate_default_offset_slot_cost(unsigned slot)
+{
+	u32 num_extra_bits = deflate_extra_offset_bits[slot];
+	/*
+	 * Assume that all offset symbols are equally probable.
+	 * The resulting cost is 'int(-log2(1/30) * BIT_COST)',
+	 * where 30 is the number of potentially-used offset symbols.
+	 */
+	u32 offset_sym_cost = 4*BIT_COST + (907*BIT_COST)/1000;
+
+	return offset_sym_cost + (num_extra_bits * BIT_COST);
+}
+
+/* Set default symbol costs for the first block's first optimization pass. */
+static void
+deflate_set_default_costs(struct libdeflate_compressor *c,
+			  u32 lit_cost, u32 len_sym_cost)
+{
+	unsigned i;
+
+	/* Literals */
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
+		c->p.n.costs.literal[i] = lit_cost;
+
+	/* Lengths */
+	for (i = DEFLATE_MIN_MATCH_LEN; i <= DEFLATE_MAX_MATCH_LEN; i++)
+		c->p.n.costs.length[i] =
+			deflate_default_length_cost(i, len_sym_cost);
+
+	/* Offset slots */
+	for (i = 0; i < ARRAY_LEN(deflate_offset_slot_base); i++)
+		c->p.n.costs.offset_slot[i] =
+			deflate_default_offset_slot_cost(i);
+}
+
+static forceinline void
+deflate_adjust_cost(u32 *cost_p, u32 default_cost, int change_amount)
+{
+	if (change_amount == 0)
+		/* Block is very similar to previous; prefer previous costs. */
+		*cost_p = (default_cost + 3 * *cost_p) / 4;
+	else if (change_amount == 1)
+		*cost_p = (default_cost + *cost_p) / 2;
+	else if (change_amount == 2)
+		*cost_p = (5 * default_cost + 3 * *cost_p) / 8;
+	else
+		/* Block differs greatly from previous; prefer default costs. */
+		*cost_p = (3 * default_cost + *cost_p) / 4;
+}
+
+static forceinline void
+deflate_adjust_costs_impl(struct libdeflate_compressor *c,
+			  u32 lit_cost, u32 len_sym_cost, int change_amount)
+{
+	unsigned i;
+
+	/* Literals */
+	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
+		deflate_adjust_cost(&c->p.n.costs.literal[i], lit_cost,
+				    change_amount);
+
+	/* Lengths */
+	for (i = DEFLATE_MIN_MATCH_LEN; i <= DEFLATE_MAX_MATCH_LEN; i++)
+		deflate_adjust_cost(&c->p.n.costs.length[i],
+				    deflate_default_length_cost(i,
+								len_sym_cost),
+				    change_amount);
+
+	/* Offset slots */
+	for (i = 0; i < ARRAY_LEN(deflate_offset_slot_base); i++)
+		deflate_adjust_cost(&c->p.n.costs.offset_slot[i],
+				    deflate_default_offset_slot_cost(i),
+				    change_amount);
+}
+
+/*
+ * Adjust the costs when beginning a new block.
+ *
+ * Since the current costs are optimized for the data already, it can be helpful
+ * to reuse them instead of starting over with the default costs.  However, this
+ * depends on how similar the new block is to the previous block.  Therefore,
+ * use a heuristic to decide how similar the blocks are, and mix together the
+ * current costs and the default costs accordingly.
+ */
+static void
+deflate_adjust_costs(struct libdeflate_compressor *c,
+		     u32 lit_cost, u32 len_sym_cost)
+{
+	u64 total_delta = 0;
+	u64 cutoff;
+	int i;
+
+	/*
+	 * Decide how different the current block is from the previous block,
+	 * using the block splitting statistics from the current and previous
+	 * blocks.  The more different the current block is, the more we prefer
+	 * the default costs rather than the previous block's costs.
+	 *
+	 * The algorithm here is similar to the end-of-block check one, but here
+	 * we compare two entire blocks rather than a partial block with a small
+	 * extra part, and therefore we need 64-bit numbers in some places.
+	 */
+	for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
+		u64 prev = (u64)c->p.n.prev_observations[i] *
+			    c->split_stats.num_observations;
+		u64 cur = (u64)c->split_stats.observations[i] *
+			  c->p.n.prev_num_observations;
+
+		total_delta += prev > cur ? prev - cur : cur - prev;
+	}
+	cutoff = ((u64)c->p.n.prev_num_observations *
+		  c->split_stats.num_observations * 200) / 512;
+
+	if (total_delta > 3 * cutoff)
+		/* Big change in the data; just use the default costs. */
+		deflate_set_default_costs(c, lit_cost, len_sym_cost);
+	else if (4 * total_delta > 9 * cutoff)
+		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 3);
+	else if (2 * total_delta > 3 * cutoff)
+		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 2);
+	else if (2 * total_delta > cutoff)
+		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 1);
+	else
+		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 0);
+}
+
+static void
+deflate_set_initial_costs(struct libdeflate_compressor *c,
+			  const u8 *block_begin, u32 block_length,
+			  bool is_first_block)
+{
+	u32 lit_cost, len_sym_cost;
+
+	deflate_choose_default_litlen_costs(c, block_begin, block_length,
+					    &lit_cost, &len_sym_cost);
+	if (is_first_block && c->cost_model != NULL) {
+		/*
+		 * Start from the saved cost model as if it were the previous
+		 * block's.
+		 */
+		c->p.n.costs = c->cost_model->costs;
+		memcpy(c->p.n.prev_observations, c->cost_model->observations,
+		       sizeof(c->p.n.prev_observations));
+		c->p.n.prev_num_observations =
+			c->cost_model->num_observations;
+		is_first_block = false;
+	}
+	if (is_first_block)
+		deflate_set_default_costs(c, lit_cost, len_sym_cost);
+	else
+		deflate_adjust_costs(c, lit_cost, len_sym_cost);
+}
+
+/*
+ * Find the minimum-cost path through the graph of possible match/literal
+ * choices for this block.
+ *
+ * We find the minimum cost path from 'c->p.n.optimum_nodes[0]', which
+ * represents the node at the beginning of the block, to
+ * 'c->p.n.optimum_nodes[block_length]', which represents the node at the end of
+ * the block.  Edge costs are evaluated using the cost model 'c->p.n.costs'.
+ *
+ * The algorithm works backwards, starting at the end node and proceeding
+ * backwards one node at a time.  At each node, the minimum cost to reach the
+ * end node is computed and the match/literal choice that begins that path is
+ * saved.
+ */
+static void
+deflate_find_min_cost_path(struct libdeflate_compressor *c,
+			   const u32 block_length,
+			   const struct lz_match *cache_ptr)
+{
+	struct deflate_optimum_node *end_node =
+		&c->p.n.optimum_nodes[block_length];
+	struct deflate_optimum_node *cur_node = end_node;
+
+	cur_node->cost_to_end = 0;
+	do {
+		unsigned num_matches;
+		unsigned literal;
+		u32 best_cost_to_end;
+
+		cur_node--;
+		cache_ptr--;
+
+		num_matches = cache_ptr->length;
+		literal = cache_ptr->offset;
+
+		/* It's always possible to choose a literal. */
+		best_cost_to_end = c->p.n.costs.literal[literal] +
+				   (cur_node + 1)->cost_to_end;
+		cur_node->item = ((u32)literal << OPTIMUM_OFFSET_SHIFT) | 1;
+
+		/* Also consider matches if there are any. */
+		if (num_matches) {
+			const struct lz_match *match;
+			unsigned len;
+			unsigned offset;
+			unsigned offset_slot;
+			u32 offset_cost;
+			u32 cost_to_end;
+
+			/*
+			 * Consider each length from the minimum
+			 * (DEFLATE_MIN_MATCH_LEN) to the length of the longest
+			 * match found at this position.  For each length, we
+			 * consider only the smallest offset for which that
+			 * length is available.  Although this is not guaranteed
+			 * to be optimal due to the possibility of a larger
+			 * offset costing less than a smaller offset to code,
+			 * this is a very useful heuristic.
+			 */
+			match = cache_ptr - num_matches;
+			len = DEFLATE_MIN_MATCH_LEN;
+			do {
+				offset = match->offset;
+				offset_slot = deflate_offset_slot_full[offset];
+				offset_cost =
+					c->p.n.costs.offset_slot[offset_slot];
+				do {
+					cost_to_end = offset_cost +
+						c->p.n.costs.length[len] +
+						(cur_node + len)->cost_to_end;
+					if (cost_to_end < best_cost_to_end) {
+						best_cost_to_end = cost_to_end;
+						cur_node->item = len |
+							((u32)offset <<
+							 OPTIMUM_OFFSET_SHIFT);
+					}
+				} while (++len <= match->length);
+			} while (++match != cache_ptr);
+			cache_ptr -= num_matches;
+		}
+		cur_node->cost_to_end = best_cost_to_end;
+	} while (cur_node != &c->p.n.optimum_nodes[0]);
+
+	deflate_reset_symbol_frequencies(c);
+	deflate_tally_item_list(c, block_length);
+	deflate_make_huffman_codes(&c->freqs, &c->codes);
+}
+
+/*
+ * Choose the literals and matches for a block, leaving @c->freqs and @c->codes
+ * set for them, and return the cost in bits of the block after its 3-bit block
+ * header.  The matches found in the block are cached up to @cache_ptr.
+ *
+ * To choose the literal/match sequence, we find the minimum-cost path through
+ * the block's graph of literal/match choices, given a cost model.  However, the
+ * true cost of each symbol is unknown until the Huffman codes have been built,
+ * but at the same time the Huffman codes depend on the frequencies of chosen
+ * symbols.  Consequently, multiple passes must be used to try to approximate an
+ * optimal solution.  The first pass uses the costs that @c->p.n.costs has been
+ * initialized to.  Later passes use the Huffman codeword lengths from the
+ * previous pass as the costs.
+ *
+ * As an alternate strategy, also consider using only literals.  The boolean
+ * returned in *used_only_literals indicates whether that strategy was best.
+ * Otherwise the items chosen are in @c->p.n.optimum_nodes.
+ */
+static u32
+deflate_optimize_block(struct libdeflate_compressor *c,
+		       const u8 *block_begin, u32 block_length,
+		       const struct lz_match *cache_ptr,
+		       bool *used_only_literals)
+{
+	unsigned num_passes_remaining = c->p.n.max_optim_passes;
+	u32 best_true_cost = UINT32_MAX;
+	u32 true_cost;
+	u32 only_lits_cost;
+	u32 static_cost = UINT32_MAX;
+	u32 i;
+
+	/*
+	 * On some data, using only literals (no matches) ends up being better
+	 * than what the iterative optimization algorithm produces.  Therefore,
+	 * consider using only literals.
+	 */
+	deflate_choose_all_literals(c, block_begin, block_length);
+	only_lits_cost = deflate_compute_true_cost(c);
+
+	/*
+	 * Force the block to really end at the desired length, even if some
+	 * matches extend beyond it.
+	 */
+	for (i = block_length;
+	     i <= MIN(block_length - 1 + DEFLATE_MAX_MATCH_LEN,
+		      c->p.n.num_optimum_nodes - 1); i++)
+		c->p.n.optimum_nodes[i].cost_to_end = 0x80000000;
+
+	/*
+	 * Sometimes a static Huffman block ends up being cheapest, particularly
+	 * if the block is small.  So, if the block is sufficiently small, find
+	 * the optimal static block solution and remember its cost.
+	 */
+	if (block_length <= c->p.n.max_len_to_optimize_static_block) {
+		/* Save c->p.n.costs temporarily. */
+		c->p.n.costs_saved = c->p.n.costs;
+
+		deflate_set_costs_from_codes(c, &deflate_static_codes.lens);
+		deflate_find_min_cost_path(c, block_length, cache_ptr);
+		static_cost = c->p.n.optimum_nodes[0].cost_to_end / BIT_COST;
+		static_cost += 7; /* for the end-of-block symbol */
+
+		/* Restore c->p.n.costs. */
+		c->p.n.costs = c->p.n.costs_saved;
+	}
+
+	do {
+		/*
+		 * Find the minimum-cost path for this pass.
+		 * Also set c->freqs and c->codes to match the path.
+		 */
+		deflate_find_min_cost_path(c, block_length, cache_ptr);
+		c->stats.num_optim_passes++;
+
+		/*
+		 * Compute the exact cost of the block if the path were to be
+		 * used.  Note that this differs from
+		 * c->p.n.optimum_nodes[0].cost_to_end in that true_cost uses
+		 * the actual Huffman codes instead of c->p.n.costs.
+		 */
+		true_cost = deflate_compute_true_cost(c);
+
+		/*
+		 * If the cost didn't improve much from the previous pass, then
+		 * doing more passes probably won't be helpful, so stop early.
+		 */
+		if (true_cost + c->p.n.min_improvement_to_continue >
+		    best_true_cost)
+			break;
+
+		best_true_cost = true_cost;
+
+		/* Save the cost model that gave 'best_true_cost'. */
+		c->p.n.costs_saved = c->p.n.costs;
+
+		/* Update the cost model from the Huffman codes. */
+		deflate_set_costs_from_codes(c, &c->codes.lens);
+
+	} while (--num_passes_remaining);
+
+	*used_only_literals = false;
+	if (MIN(only_lits_cost, static_cost) < best_true_cost) {
+		if (only_lits_cost < static_cost) {
+			/* Using only literals ended up being best! */
+			deflate_choose_all_literals(c, block_begin, block_length);
+			deflate_set_costs_from_codes(c, &c->codes.lens);
+			*used_only_literals = true;
+			return only_lits_cost;
+		}
+		/* Static block ended up being best! */
+		deflate_set_costs_from_codes(c, &deflate_static_codes.lens);
+		deflate_find_min_cost_path(c, block_length, cache_ptr);
+		return static_cost;
+	}
+	if (true_cost >=
+	    best_true_cost + c->p.n.min_bits_to_use_nonfinal_path) {
+		/*
+		 * The best solution was actually from a non-final optimization
+		 * pass, so recover and use the min-cost path from that pass.
+		 */
+		c->p.n.costs = c->p.n.costs_saved;
+		deflate_find_min_cost_path(c, block_length, cache_ptr);
+		deflate_set_costs_from_codes(c, &c->codes.lens);
+		return best_true_cost;
+	}
+	return true_cost;
+}
+
+/* Output a block whose items were chosen by deflate_optimize_block(). */
+static void
+deflate_flush_optimized_block(struct libdeflate_compressor *c,
+			      struct deflate_output_bitstream *os,
+			      const u8 *block_begin, u32 block_length,
+			      bool used_only_literals, bool is_final_block)
+{
+	struct deflate_sequence seq;
+
+	seq.litrunlen_and_length = block_length;
+	deflate_flush_block(c, os, block_begin, block_length,
+			    used_only_literals ? &seq : NULL, false,
+			    is_final_block);
+	c->p.n.have_costs = true;
+}
+
+/*
+ * Choose the literals and matches for the current block, then output the block.
+ * The first optimization pass uses default costs, mixed with the costs from the
+ * previous block when it seems appropriate.
+ */
+static void
+deflate_optimize_and_flush_block(struct libdeflate_compressor *c,
+				 struct deflate_output_bitstream *os,
+				 const u8 *block_begin, u32 block_length,
+				 const struct lz_match *cache_ptr,
+				 bool is_first_block, bool is_final_block,
+				 bool *used_only_literals)
+{
+	deflate_set_initial_costs(c, block_begin, block_length, is_first_block);
+	deflate_optimize_block(c, block_begin, block_length, cache_ptr,
+			       used_only_literals);
+	deflate_flush_optimized_block(c, os, block_begin, block_length,
+				      *used_only_literals, is_final_block);
+}
+
+/*
+ * Set up the split points for the data being split, @data of @length bytes
+ * whose matches are cached up to @cache_end: one every 'split_granularity'
+ * bytes, one at each of the @num_hints block ends in @hints that the block
+ * split heuristic suggested, and one at the end.  Also record the blocks that
+ * the hints give in the points' 'next[0]', leaving out any hint that would make
+ * a block shorter than MIN_BLOCK_LENGTH, other than the last block if
+ * @short_last.  Return the number of points.
+ */
+static u32
+deflate_init_split_points(struct libdeflate_compressor *c, const u8 *data,
+			  u32 length, struct lz_match *cache_end,
+			  const u8 * const *hints, u32 num_hints,
+			  bool short_last)
+{
+	struct deflate_split_point *points = c->p.n.split_points;
+	struct lz_match *cache_ptr = cache_end;
+	u32 num_points = 0;
+	u32 grid_pos = 0;
+	u32 block_begin = 0;
+	u32 pos;
+	u32 i;
+
+	do {
+		pos = MIN(grid_pos, length);
+		if (num_hints != 0 && (u32)(*hints - data) <= pos) {
+			pos = (u32)(*hints++ - data);
+			num_hints--;
+			if (pos - points[block_begin].pos >= MIN_BLOCK_LENGTH &&
+			    (short_last || length - pos >= MIN_BLOCK_LENGTH)) {
+				points[block_begin].next[0] = num_points;
+				block_begin = num_points;
+			}
+		}
+		if (pos == grid_pos)
+			grid_pos += c->p.n.split_granularity;
+		points[num_points++].pos = pos;
+	} while (pos != length);
+	points[block_begin].next[0] = num_points - 1;
+
+	/* Find the end of the cached matches before each point. */
+	for (i = num_points; i-- > 0; ) {
+		for (; pos > points[i].pos; pos--) {
+			cache_ptr--;
+			cache_ptr -= cache_ptr->length;
+		}
+		points[i].cache_ptr = cache_ptr;
+	}
+	return num_points;
+}
+
+/*
+ * Add the items chosen for the block from split point @i to split point @j of
+ * the data being split, @data, to the symbol counts 'freqs[@parse]' of the
+ * segments that they begin in.  The block is all literals if @only_literals, or
+ * else its items are in @c->p.n.optimum_nodes.
+ */
+static void
+deflate_tally_split_segments(struct libdeflate_compressor *c, unsigned parse,
+			     const u8 *data, u32 i, u32 j, bool only_literals)
+{
+	struct deflate_split_point *point = &c->p.n.split_points[i];
+	const u32 begin = point->pos;
+	const u32 block_length = c->p.n.split_points[j].pos - begin;
+	u32 k = 0;
+
+	while (k < block_length) {
+		struct deflate_freqs *freqs;
+		unsigned length;
+		unsigned offset;
+
+		while (k >= point[1].pos - begin)
+			point++;
+		freqs = &point->freqs[parse];
+		if (only_literals) {
+			freqs->litlen[data[begin + k++]]++;
+			continue;
+		}
+		length = c->p.n.optimum_nodes[k].item & OPTIMUM_LEN_MASK;
+		offset = c->p.n.optimum_nodes[k].item >> OPTIMUM_OFFSET_SHIFT;
+		if (length == 1) {
+			freqs->litlen[offset]++;
+		} else {
+			freqs->litlen[DEFLATE_FIRST_LEN_SYM +
+				      deflate_length_slot[length]]++;
+			freqs->offset[deflate_offset_slot_full[offset]]++;
+		}
+		k += length;
+	}
+}
+
+/*
+ * Set @c->freqs to the symbol counts 'freqs[@parse]' of the split search
+ * segments from @begin to @end, plus an end-of-block symbol.
+ */
+static void
+deflate_sum_split_segments(struct libdeflate_compressor *c, unsigned parse,
+			   u32 begin, u32 end)
+{
+	unsigned sym;
+
+	deflate_reset_symbol_frequencies(c);
+	c->freqs.litlen[DEFLATE_END_OF_BLOCK] = 1;
+	for (; begin < end; begin++) {
+		const struct deflate_freqs *freqs =
+			&c->p.n.split_points[begin].freqs[parse];
+
+		for (sym = 0; sym < DEFLATE_NUM_LITLEN_SYMS; sym++)
+			c->freqs.litlen[sym] += freqs->litlen[sym];
+		for (sym = 0; sym < DEFLATE_NUM_OFFSET_SYMS; sym++)
+			c->freqs.offset[sym] += freqs->offset[sym];
+	}
+}
+
+/*
+ * Return the cost in bits of the cheapest type of block (dynamic Huffman,
+ * static Huffman, or uncompressed) that outputs @block_length bytes as the
+ * items whose symbols are counted in @c->freqs, including the block header.
+ * This builds Huffman codes in @c->codes.
+ */
+static u32
+deflate_compute_block_cost(struct libdeflate_compressor *c, u32 block_length)
+{
+	u32 static_cost = 3;
+	u32 uncompressed_cost;
+	unsigned sym;
+
+	deflate_make_huffman_codes(&c->freqs, &c->codes);
+
+	for (sym = 0; sym < DEFLATE_FIRST_LEN_SYM; sym++)
+		static_cost += c->freqs.litlen[sym] *
+			       deflate_static_codes.lens.litlen[sym];
+	for (; sym < DEFLATE_FIRST_LEN_SYM +
+	       ARRAY_LEN(deflate_extra_length_bits); sym++)
+		static_cost += c->freqs.litlen[sym] *
+			(deflate_static_codes.lens.litlen[sym] +
+			 deflate_extra_length_bits[sym - DEFLATE_FIRST_LEN_SYM]);
+	for (sym = 0; sym < ARRAY_LEN(deflate_extra_offset_bits); sym++)
+		static_cost += c->freqs.offset[sym] *
+			       (5 + deflate_extra_offset_bits[sym]);
+
+	/* Assume the worst case alignment for uncompressed blocks. */
+	uncompressed_cost = 3 + 7 + 32 +
+			    (40 * (DIV_ROUND_UP(block_length, UINT16_MAX) - 1)) +
+			    (8 * block_length);
+
+	return MIN(3 + deflate_compute_true_cost(c),
+		   MIN(static_cost, uncompressed_cost));
+}
+
+/*
+ * Find the cheapest way to split the data being split, which @num_points split
+ * points cover, into blocks that begin and end at the points, given the items
+ * of parse @parse.  This is a minimum-cost path search like the one for the
+ * items themselves, using deflate_compute_block_cost() as the cost of each
+ * block.  Record the blocks in the points' 'next[@split]'.
+ *
+ * Blocks must be at least MIN_BLOCK_LENGTH bytes long, except for the last if
+ * @short_last.  It ends wherever the data being split happened to end, and it
+ * is either the final block or split again with the data that follows it.
+ */
+static void
+deflate_choose_block_split(struct libdeflate_compressor *c, u32 num_points,
+			   bool short_last, unsigned parse, unsigned split)
+{
+	struct deflate_split_point *points = c->p.n.split_points;
+	u32 i, j;
+
+	points[0].cost = 0;
+	for (j = 1; j < num_points; j++) {
+		const u32 end = points[j].pos;
+
+		points[j].cost = UINT32_MAX;
+		deflate_reset_symbol_frequencies(c);
+		c->freqs.litlen[DEFLATE_END_OF_BLOCK] = 1;
+		/*
+		 * Consider each block that ends here, from the shortest, adding
+		 * the symbol counts of each segment it grows by.
+		 */
+		for (i = j; i-- > 0; ) {
+			const struct deflate_freqs *freqs =
+				&points[i].freqs[parse];
+			unsigned sym;
+			u32 cost;
+
+			for (sym = 0; sym < DEFLATE_NUM_LITLEN_SYMS; sym++)
+				c->freqs.litlen[sym] += freqs->litlen[sym];
+			for (sym = 0; sym < DEFLATE_NUM_OFFSET_SYMS; sym++)
+				c->freqs.offset[sym] += freqs->offset[sym];
+			if ((end - points[i].pos < MIN_BLOCK_LENGTH &&
+			     !(short_last && j == num_points - 1)) ||
+			    points[i].cost == UINT32_MAX)
+				continue;
+			cost = points[i].cost +
+			       deflate_compute_block_cost(c,
+							  end - points[i].pos);
+			if (cost < points[j].cost) {
+				points[j].cost = cost;
+				points[j].prev = i;
+			}
+		}
+	}
+	for (j = num_points - 1; j != 0; j = i) {
+		i = points[j].prev;
+		points[i].next[split] = j;
+	}
+}
+
+/*
+ * Set the costs to start parsing a block of the data being split from without
+ * knowing anything about its items: the default costs, or the saved cost model
+ * if it's the first block.
+ */
+static void
+deflate_set_split_block_default_costs(struct libdeflate_compressor *c,
+				      const u8 *block_begin, u32 block_length,
+				      bool is_first_block)
+{
+	u32 lit_cost, len_sym_cost;
+
+	if (is_first_block) {
+		deflate_set_initial_costs(c, block_begin, block_length, true);
+		return;
+	}
+	deflate_choose_default_litlen_costs(c, block_begin, block_length,
+					    &lit_cost, &len_sym_cost);
+	deflate_set_default_costs(c, lit_cost, len_sym_cost);
+}
+
+/*
+ * Choose the literals and matches for the block from split point @i to split
+ * point @j of the data being split, @data.  Return its cost in bits, including
+ * the block header.
+ *
+ * The block is parsed starting from the default costs if @from_defaults, and
+ * starting from the costs given by the block's items in parse @parse if @seed,
+ * and if both then the cheaper result is kept.  Neither start is always better:
+ * the items that a block had as part of a different block can lead to a worse
+ * local optimum.
+ */
+static u32
+deflate_optimize_split_block(struct libdeflate_compressor *c, const u8 *data,
+			     u32 i, u32 j, bool is_first_block,
+			     bool from_defaults, bool seed, unsigned parse,
+			     bool *used_only_literals)
+{
+	const struct deflate_split_point *points = c->p.n.split_points;
+	const u8 *block_begin = &data[points[i].pos];
+	const u32 block_length = points[j].pos - points[i].pos;
+	u32 default_cost = UINT32_MAX;
+	u32 cost;
+
+	if (from_defaults) {
+		deflate_set_split_block_default_costs(c, block_begin,
+						      block_length,
+						      is_first_block);
+		default_cost = deflate_optimize_block(c, block_begin,
+						      block_length,
+						      points[j].cache_ptr,
+						      used_only_literals);
+		if (!seed)
+			return 3 + default_cost;
+	}
+
+	deflate_sum_split_segments(c, parse, i, j);
+	deflate_make_huffman_codes(&c->freqs, &c->codes);
+	deflate_set_costs_from_codes(c, &c->codes.lens);
+	cost = deflate_optimize_block(c, block_begin, block_length,
+				      points[j].cache_ptr, used_only_literals);
+	if (default_cost < cost) {
+		deflate_set_split_block_default_costs(c, block_begin,
+						      block_length,
+						      is_first_block);
+		cost = deflate_optimize_block(c, block_begin, block_length,
+					      points[j].cache_ptr,
+					      used_only_literals);
+	}
+	return 3 + cost;
+}
+
+/*
+ * Split the data @data of @length bytes, whose matches are cached up to
+ * @cache_end, into blocks.  This is how levels 13 and 14 end blocks.  @hints
+ * are the @num_hints block ends within the data that the block split heuristic
+ * suggested.  @length must be at least 2 * MIN_BLOCK_LENGTH, or else the data
+ * can't be split.  The last block may be shorter than MIN_BLOCK_LENGTH only if
+ * @short_last.
+ *
+ * The search starts from the blocks that the heuristic suggested, each parsed
+ * from the default costs.  That split is usually about as good as the one
+ * levels 10-12 would make, and it is kept unless something cheaper is found.
+ * Given the items of the current parse, the cheapest split into blocks is found
+ * by deflate_choose_block_split() with the true cost of each possible block.
+ * But each block would be parsed differently on its own, so then each block of
+ * the split is reparsed, and the split is chosen again from the new items.
+ * This repeats until the split stops changing or the reparsed blocks stop
+ * getting cheaper, and the last split that made them cheaper is chosen.  It is
+ * recorded in the split points' 'next[*parse_ret]', with the items its blocks
+ * start from in their 'freqs[*parse_ret]'.
+ *
+ * Return the split point up to which the blocks should be output.  That is the
+ * end of the data, unless @keep_last and there are several blocks, when the
+ * last block is left to be split again together with the data that follows it.
+ */
+static u32
+deflate_search_block_split(struct libdeflate_compressor *c, const u8 *data,
+			   u32 length, struct lz_match *cache_end,
+			   const u8 * const *hints, u32 num_hints,
+			   bool is_first_block, bool keep_last, bool short_last,
+			   unsigned *parse_ret)
+{
+	struct deflate_split_point *points = c->p.n.split_points;
+	const u32 num_points = deflate_init_split_points(c, data, length,
+							 cache_end, hints,
+							 num_hints, short_last);
+	unsigned parse = 0;
+	unsigned round;
+	bool used_only_literals;
+	u32 best_cost, cost;
+	u32 i, j, k;
+
+	/* Parse the blocks that the heuristic suggested. */
+	for (i = 0; i < num_points - 1; i++)
+		memset(&points[i].freqs[0], 0, sizeof(points[i].freqs[0]));
+	best_cost = 0;
+	for (i = 0; i != num_points - 1; i = j) {
+		j = points[i].next[0];
+		best_cost += deflate_optimize_split_block(
+				c, data, i, j, is_first_block && i == 0,
+				true, false, 0, &used_only_literals);
+		deflate_tally_split_segments(c, 0, data, i, j,
+					     used_only_literals);
+	}
+
+	for (round = 0; round < MAX_SPLIT_SEARCH_ROUNDS; round++) {
+		/* Split the current parse, and stop if that changes nothing. */
+		deflate_choose_block_split(c, num_points, short_last, parse,
+					   !parse);
+		for (i = 0; i != num_points - 1 &&
+			    points[i].next[0] == points[i].next[1];
+		     i = points[i].next[0])
+			;
+		if (i == num_points - 1)
+			break;
+
+		/*
+		 * Reparse the blocks of the new split.  Those that weren't
+		 * blocks of the current split are also parsed from scratch.
+		 */
+		for (i = 0; i < num_points - 1; i++)
+			memset(&points[i].freqs[!parse], 0,
+			       sizeof(points[i].freqs[!parse]));
+		cost = 0;
+		k = 0;
+		for (i = 0; i != num_points - 1; i = j) {
+			j = points[i].next[!parse];
+			while (k < i)
+				k = points[k].next[parse];
+			cost += deflate_optimize_split_block(
+					c, data, i, j, is_first_block && i == 0,
+					k != i || points[k].next[parse] != j,
+					true, parse, &used_only_literals);
+			deflate_tally_split_segments(c, !parse, data, i, j,
+						     used_only_literals);
+		}
+		if (cost >= best_cost)
+			break;
+		best_cost = cost;
+		parse = !parse;
+	}
+	*parse_ret = parse;
+
+	/* Find where the last block begins, if it is to be kept. */
+	j = num_points - 1;
+	if (keep_last) {
+		for (i = 0; points[i].next[parse] != num_points - 1;
+		     i = points[i].next[parse])
+			;
+		if (i != 0)
+			j = i;
+	}
+	return j;
+}
+
+/*
+ * Output the blocks of the split chosen by deflate_search_block_split() for the
+ * data @data, up to split point @end, reparsing each of them again starting
+ * from the costs of its items in parse @parse.
+ */
+static void
+deflate_flush_split_blocks(struct libdeflate_compressor *c,
+			   struct deflate_output_bitstream *os,
+			   const u8 *data, u32 end, unsigned parse,
+			   bool is_first_block, bool is_final,
+			   bool *used_only_literals)
+{
+	const struct deflate_split_point *points = c->p.n.split_points;
+	u32 i, j;
+
+	for (i = 0; i != end && !os->overflow; i = j) {
+		j = points[i].next[parse];
+		deflate_optimize_split_block(c, data, i, j,
+					     is_first_block && i == 0, false,
+					     true, parse, used_only_literals);
+		deflate_flush_optimized_block(c, os, &data[points[i].pos],
+					      points[j].pos - points[i].pos,
+					      *used_only_literals,
+					      is_final && j == end);
+	}
+}
+
+static void
+deflate_near_optimal_init_stats(struct libdeflate_compressor *c)
+{
+	init_block_split_stats(&c->split_stats);
+	memset(c->p.n.new_match_len_freqs, 0,
+	       sizeof(c->p.n.new_match_len_freqs));
+	memset(c->p.n.match_len_freqs, 0, sizeof(c->p.n.match_len_freqs));
+}
+
+static void
+deflate_near_optimal_merge_stats(struct libdeflate_compressor *c)
+{
+	unsigned i;
+
+	merge_new_observations(&c->split_stats);
+	for (i = 0; i < ARRAY_LEN(c->p.n.match_len_freqs); i++) {
+		c->p.n.match_len_freqs[i] += c->p.n.new_match_len_freqs[i];
+		c->p.n.new_match_len_freqs[i] = 0;
+	}
+}
+
+/*
+ * Save some literal/match statistics from the previous block so that
+ * deflate_adjust_costs() will be able to decide how much the current block
+ * differs from the previous one.
+ */
+static void
+deflate_near_optimal_save_stats(struct libdeflate_compressor *c)
+{
+	int i;
+
+	for (i = 0; i < NUM_OBSERVATION_TYPES; i++)
+		c->p.n.prev_observations[i] = c->split_stats.observations[i];
+	c->p.n.prev_num_observations = c->split_stats.num_observations;
+}
+
+static void
+deflate_near_optimal_clear_old_stats(struct libdeflate_compressor *c)
+{
+	int i;
+
+	for (i = 0; i < NUM_OBSERVATION_TYPES; i++)
+		c->split_stats.observations[i] = 0;
+	c->split_stats.num_observations = 0;
+	memset(c->p.n.match_len_freqs, 0, sizeof(c->p.n.match_len_freqs));
+}
+
+/*
+ * Return the end of the positions in the data from @in_begin to @in_end that
+ * the binary tree matchfinder can insert.  Each binary tree is sorted by the
+ * first nice_match_length bytes of its sequences, so unless @is_final says that
+ * no more data follows, a position can be inserted only if that many bytes
+ * follow it; see bt_matchfinder_search().  The rest are held back, searched
+ * without being inserted, and inserted by the call that continues the data.
+ */
+static forceinline const u8 *
+deflate_bt_insert_end(const struct libdeflate_compressor *c,
+		      const u8 *in_begin, const u8 *in_end, bool is_final)
+{
+	const size_t lookahead = MAX(MIN(c->nice_match_length,
+					 DEFLATE_MAX_MATCH_LEN),
+				     BT_MATCHFINDER_REQUIRED_NBYTES);
+
+	if (is_final)
+		return in_end;
+	if (in_end - in_begin < lookahead)
+		return in_begin;
+	return in_end - lookahead + 1;
+}
+
+/*
+ * The state of the near-optimal compressor's matchfinding.  It is kept apart
+ * from the rest of the compressor's state so that, if the compressor has a task
+ * submitter, a task can find the matches for the next block while the current
+ * block is being optimized.
+ */
+struct deflate_near_optimal_mf {
+	struct libdeflate_compressor *c;
+	const u8 *in_next;	/* The next position to find matches at */
+	const u8 *in_end;
+	const u8 *in_insert_end; /* See deflate_bt_insert_end() */
+	const u8 *in_cur_base;
+	const u8 *in_next_slide;
+	unsigned max_len;
+	unsigned nice_len;
+	unsigned order_reduction;
+	u32 next_hashes[2];
+
+	/* Where the next matches are cached, and the overflow limit */
+	struct lz_match *cache_ptr;
+	struct lz_match *cache_end;
+
+	/*
+	 * Used only by the task: the start of the block being searched, the
+	 * position at which the block must end, and where to record the number
+	 * of matches found at in_next
+	 */
+	const u8 *block_begin;
+	const u8 *stop;
+	u16 *counts;
+};
+
+/*
+ * The match count recorded for a position covered by a very long match, at
+ * which no matches were searched for
  */
-static void
-deflate_choose_default_litlen_costs(struct libdeflate_compressor *c,
-				    const u8 *block_begin, u32 block_length,
-				    u32 *lit_cost, u32 *len_sym_cost)
+#define SKIPPED_POS_COUNT	0xFFFF
+
+/*
+ * Find the matches at the next position of @s using the binary tree matchfinder
+ * and save them in the match cache, followed by their count and the literal.
+ * Return the length of the longest match, or 0 if there are none.  If
+ * @record_counts, also record the match count in @s->counts.
+ *
+ * Note: the binary tree matchfinder is more suited for optimal parsing than the
+ * hash chain matchfinder.  The reasons for this include:
+ *
+ * - The binary tree matchfinder can find more matches in the same number of
+ *   steps.
+ * - One of the major advantages of hash chains is that skipping positions (not
+ *   searching for matches at them) is faster; however, with optimal parsing we
+ *   search for matches at almost all positions, so this advantage of hash
+ *   chains is negated.
+ */
+static forceinline unsigned
+deflate_near_optimal_find_matches(struct deflate_near_optimal_mf *s,
+				  bool record_counts)
 {
-	unsigned num_used_literals = 0;
-	u32 literal_freq = block_length;
-	u32 match_freq = 0;
-	u32 cutoff;
-	u32 i;
+	struct libdeflate_compressor *c = s->c;
+	const u32 window_size = c->mf_window_size;
+	const u8 *in_next = s->in_next;
+	struct lz_match *cache_ptr = s->cache_ptr;
+	struct lz_match * const matches = cache_ptr;
+	unsigned best_len = 0;
+	unsigned n;
+	size_t remaining = s->in_end - in_next;
+	const bool insert = in_next < s->in_insert_end;
+
+	/* Slide the window forward if needed. */
+	if (in_next == s->in_next_slide && insert) {
+		bt_matchfinder_slide_window(&c->p.n.bt_mf, window_size);
+		s->in_cur_base = in_next;
+		s->in_next_slide = in_next +
+			MIN(remaining, MATCHFINDER_WINDOW_SIZE);
+	}
 
-	/* Calculate the number of distinct literals that exist in the data. */
-	memset(c->freqs.litlen, 0,
-	       DEFLATE_NUM_LITERALS * sizeof(c->freqs.litlen[0]));
-	cutoff = literal_freq >> 11; /* Ignore literals used very rarely. */
-	for (i = 0; i < block_length; i++)
-		c->freqs.litlen[block_begin[i]]++;
-	for (i = 0; i < DEFLATE_NUM_LITERALS; i++) {
-		if (c->freqs.litlen[i] > cutoff)
-			num_used_literals++;
+	adjust_max_and_nice_len(&s->max_len, &s->nice_len, remaining);
+	if (unlikely(cache_ptr >= s->cache_end)) {
+		/*
+		 * The match cache is full, but the block is too short to end
+		 * yet.  This can happen only with a small soft maximum block
+		 * length.  Just record the literal until the block is long
+		 * enough.
+		 */
+		if (s->max_len >= BT_MATCHFINDER_REQUIRED_NBYTES && insert)
+			bt_matchfinder_skip_byte(&c->p.n.bt_mf, s->in_cur_base,
+						 in_next - s->in_cur_base,
+						 s->nice_len,
+						 c->max_search_depth,
+						 s->order_reduction,
+						 window_size,
+						 s->next_hashes,
+						 &c->mf_counters);
+	} else if (unlikely(!insert)) {
+		/*
+		 * Not enough of the data that follows is known to insert this
+		 * position yet.  It can still be searched.
+		 */
+		if (s->max_len >= BT_MATCHFINDER_REQUIRED_NBYTES)
+			cache_ptr = bt_matchfinder_search(&c->p.n.bt_mf,
+							  s->in_cur_base,
+							  in_next -
+							  s->in_cur_base,
+							  s->max_len,
+							  s->nice_len,
+							  c->max_search_depth,
+							  s->order_reduction,
+							  window_size,
+							  matches,
+							  &c->mf_counters);
+	} else if (likely(s->max_len >= BT_MATCHFINDER_REQUIRED_NBYTES)) {
+		cache_ptr = bt_matchfinder_get_matches(&c->p.n.bt_mf,
+						       s->in_cur_base,
+						       in_next - s->in_cur_base,
+						       s->max_len,
+						       s->nice_len,
+						       c->max_search_depth,
+						       s->order_reduction,
+						       window_size,
+						       s->next_hashes,
+						       matches,
+						       &c->mf_counters);
 	}
-	if (num_used_literals == 0)
-		num_used_literals = 1;
+	if (cache_ptr > matches)
+		best_len = cache_ptr[-1].length;
+	cache_ptr->length = cache_ptr - matches;
+	cache_ptr->offset = *in_next;
+	if (record_counts)
+		*s->counts++ = cache_ptr->length;
+	in_next++;
+	cache_ptr++;
 
 	/*
-	 * Estimate the relative frequency of literals and matches in the
-	 * optimal parsing solution.  We don't know the optimal solution, so
-	 * this can only be a very rough estimate.  Therefore, we basically use
-	 * the match frequency from a greedy parse.  We also apply the min_len
-	 * heuristic used by the greedy and lazy parsers, to avoid counting too
-	 * many matches when literals are cheaper than short matches.
+	 * If there was a very long match found, don't cache any matches for the
+	 * bytes covered by that match.  This avoids degenerate behavior when
+	 * compressing highly redundant data, where the number of matches can be
+	 * very large.
+	 *
+	 * This heuristic doesn't actually hurt the compression ratio very much.
+	 * If there's a long match, then the data must be highly compressible,
+	 * so it doesn't matter much what we do.
 	 */
-	match_freq = 0;
-	i = choose_min_match_len(num_used_literals, c->max_search_depth);
-	for (; i < ARRAY_LEN(c->p.n.match_len_freqs); i++) {
-		match_freq += c->p.n.match_len_freqs[i];
-		literal_freq -= i * c->p.n.match_len_freqs[i];
+	if (best_len >= DEFLATE_MIN_MATCH_LEN && best_len >= s->nice_len) {
+		n = best_len - 1;
+		do {
+			remaining = s->in_end - in_next;
+			if (in_next == s->in_next_slide &&
+			    in_next < s->in_insert_end) {
+				bt_matchfinder_slide_window(&c->p.n.bt_mf, window_size);
+				s->in_cur_base = in_next;
+				s->in_next_slide = in_next +
+					MIN(remaining, MATCHFINDER_WINDOW_SIZE);
+			}
+			adjust_max_and_nice_len(&s->max_len, &s->nice_len,
+						remaining);
+			if (s->max_len >= BT_MATCHFINDER_REQUIRED_NBYTES &&
+			    in_next < s->in_insert_end) {
+				bt_matchfinder_skip_byte(
+					&c->p.n.bt_mf,
+					s->in_cur_base,
+					in_next - s->in_cur_base,
+					s->nice_len,
+					c->max_search_depth,
+					s->order_reduction,
+					window_size,
+					s->next_hashes,
+					&c->mf_counters);
+			}
+			cache_ptr->length = 0;
+			cache_ptr->offset = *in_next;
+			if (record_counts)
+				*s->counts++ = SKIPPED_POS_COUNT;
+			in_next++;
+			cache_ptr++;
+		} while (--n);
+	}
+	s->in_next = in_next;
+	s->cache_ptr = cache_ptr;
+	return best_len;
+}
+
+/*
+ * Find the matches for the block that begins at @s->block_begin, from
+ * @s->in_next to as far as the block can go: until @s->stop, or until the match
+ * cache overflows once the block has reached MIN_BLOCK_LENGTH.  The ends of the
+ * steps are the same as deflate_compress_near_optimal() would use, so it can
+ * replay them to decide where to end the block.  This is run as a task.
+ */
+static void
+deflate_near_optimal_find_block_matches(void *arg)
+{
+	struct deflate_near_optimal_mf *s = arg;
+
+	while (s->in_next < s->stop &&
+	       !(s->cache_ptr >= s->cache_end &&
+		 s->in_next - s->block_begin >= MIN_BLOCK_LENGTH))
+		deflate_near_optimal_find_matches(s, true);
+}
+
+/*
+ * Choose how far to find matches for the block that begins at @in_block_begin.
+ * A match may extend past this point, leaving less than MIN_BLOCK_LENGTH bytes
+ * after it.  Levels 10-12 then usually end the block where the data changes
+ * anyway, but the block split search doesn't, and the rest of the data would
+ * have to be a short block of its own.  So when that could happen, it stops
+ * early enough that even the longest match leaves enough data.
+ */
+static forceinline const u8 *
+deflate_near_optimal_max_block_end(const struct libdeflate_compressor *c,
+				   const u8 *in_block_begin, const u8 *in_end)
+{
+	const u8 *in_max_block_end =
+		choose_max_block_end(in_block_begin, in_end,
+				     c->soft_max_block_length);
+
+	if (c->p.n.split_granularity != 0 && in_max_block_end != in_end &&
+	    in_end - in_max_block_end <
+	    MIN_BLOCK_LENGTH + DEFLATE_MAX_MATCH_LEN - 1)
+		in_max_block_end -= DEFLATE_MAX_MATCH_LEN - 1;
+	return in_max_block_end;
+}
+
+/*
+ * This is the "near-optimal" DEFLATE compressor.  It computes the optimal
+ * representation of each DEFLATE block using a minimum-cost path search over
+ * the graph of possible match/literal choices for that block, assuming a
+ * certain cost for each Huffman symbol.
+ *
+ * For several reasons, the end result is not guaranteed to be optimal:
+ *
+ * - Nonoptimal choice of blocks
+ * - Heuristic limitations on which matches are actually considered
+ * - Symbol costs are unknown until the symbols have already been chosen
+ *   (so iterative optimization must be used)
+ *
+ * If the compressor has a task submitter, then once the end of a block has been
+ * chosen, the matches for as far as the next block can go are found by a task
+ * while the block is being optimized.  Then the next block's end is chosen by
+ * replaying the steps that the task took, so the output is the same as without
+ * a task submitter.  The task can't search past the point where the next block
+ * would start with a test for incompressible data, since that test can skip
+ * inserting the data into the matchfinder; but that happens only where a block
+ * was ended by its maximum length or by the match cache overflowing, which are
+ * where the task stops anyway.  A block ended by the block split heuristic is
+ * always rewound, leaving matches already found for the next block.
+ */
+static void
+deflate_compress_near_optimal(struct libdeflate_compressor * restrict c,
+			      const u8 *in, size_t in_nbytes, bool is_final,
+			      struct deflate_output_bitstream *os)
+{
+	const u8 *in_next = in;
+	const u8 *in_block_begin = in_next;
+	const u8 *in_end = in_next + in_nbytes;
+	struct lz_match *cache = c->p.n.match_cache;
+	struct lz_match *next_cache = c->p.n.next_match_cache;
+	struct lz_match *cache_ptr = cache;
+	struct deflate_near_optimal_mf mf;
+	const u8 *in_insert_next = in;
+	const u8 **split_hints = c->p.n.split_hints;
+	u32 num_split_hints = 0;
+	bool prev_block_used_only_literals = false;
+	bool may_skip_incompressible = true;
+
+	mf.c = c;
+	mf.in_next = in_next;
+	mf.in_end = in_end;
+	mf.max_len = DEFLATE_MAX_MATCH_LEN;
+	mf.nice_len = MIN(c->nice_match_length, mf.max_len);
+	mf.next_hashes[0] = 0;
+	mf.next_hashes[1] = 0;
+	mf.cache_ptr = cache;
+	mf.cache_end = c->p.n.match_cache_end;
+	if (deflate_resume_matchfinder(c, in, in_nbytes, is_final,
+				       &mf.in_cur_base, mf.next_hashes))
+		in_insert_next -= c->mf_pending;
+	else
+		bt_matchfinder_init(&c->p.n.bt_mf, c->mf_order_reduction);
+	mf.order_reduction = c->mf_order_reduction;
+	mf.in_next_slide = mf.in_cur_base +
+		MIN(in_end - mf.in_cur_base, MATCHFINDER_WINDOW_SIZE);
+	mf.in_insert_end = deflate_bt_insert_end(c, in_insert_next, in_end,
+						 is_final);
+	deflate_near_optimal_init_stats(c);
+
+	/*
+	 * Insert the positions at the end of the previous data that the
+	 * previous call held back, as far as the data that is now known allows.
+	 */
+	for (; in_insert_next < in && in_insert_next < mf.in_insert_end;
+	     in_insert_next++) {
+		if (in_insert_next == mf.in_next_slide) {
+			bt_matchfinder_slide_window(&c->p.n.bt_mf,
+						    c->mf_window_size);
+			mf.in_cur_base = in_insert_next;
+			mf.in_next_slide = in_insert_next +
+				MIN(in_end - in_insert_next,
+				    MATCHFINDER_WINDOW_SIZE);
+		}
+		adjust_max_and_nice_len(&mf.max_len, &mf.nice_len,
+					in_end - in_insert_next);
+		if (mf.max_len < BT_MATCHFINDER_REQUIRED_NBYTES)
+			break;
+		bt_matchfinder_skip_byte(&c->p.n.bt_mf, mf.in_cur_base,
+					 in_insert_next - mf.in_cur_base,
+					 mf.nice_len,
+					 c->max_search_depth,
+					 mf.order_reduction,
+					 c->mf_window_size,
+					 mf.next_hashes,
+					 &c->mf_counters);
+	}
+
+	do {
+		/* Starting a new DEFLATE block */
+		const u8 * const in_max_block_end =
+			deflate_near_optimal_max_block_end(c, in_block_begin,
+							   in_end);
+		const u8 *prev_end_block_check = NULL;
+		const u8 *in_check_begin = in_block_begin;
+		bool change_detected = false;
+		const u8 *next_observation = in_next;
+		const u8 *in_block_end;
+		struct lz_match *block_cache_end;
+		bool pipelined;
+		bool split;
+		u32 split_end;
+		unsigned split_parse;
+		unsigned min_len;
+		u32 i;
+
+		/* Forget the suggested block ends that have been passed. */
+		for (i = 0; i < num_split_hints &&
+			    split_hints[i] <= in_block_begin; i++)
+			;
+		num_split_hints -= i;
+		memmove(split_hints, &split_hints[i],
+			num_split_hints * sizeof(split_hints[0]));
+
+		/*
+		 * Output incompressible data directly, unless some matches for
+		 * this block have already been found and cached.
+		 */
+		if (may_skip_incompressible &&
+		    deflate_skip_incompressible(
+				c, os, in, &in_next, in_end, is_final,
+				(mf_pos_t *)&c->p.n.bt_mf,
+				bt_matchfinder_size(c->mf_window_size),
+				&mf.in_cur_base,
+				mf.next_hashes,
+				BT_MATCHFINDER_HASH3_ORDER -
+				mf.order_reduction,
+				BT_MATCHFINDER_HASH4_ORDER -
+				mf.order_reduction)) {
+			in_block_begin = in_next;
+			mf.in_next = in_next;
+			mf.in_next_slide = mf.in_cur_base +
+				MIN(in_end - mf.in_cur_base,
+				    MATCHFINDER_WINDOW_SIZE);
+			/* The skipped positions are never inserted. */
+			mf.in_insert_end = MAX(mf.in_insert_end, in_next);
+			continue;
+		}
+
+		/*
+		 * Use the minimum match length heuristic to improve the
+		 * literal/match statistics gathered during matchfinding.
+		 * However, the actual near-optimal parse won't respect min_len,
+		 * as it can accurately assess the costs of different matches.
+		 *
+		 * If the "use only literals" strategy happened to be the best
+		 * strategy on the previous block, then probably the
+		 * min_match_len heuristic is still not aggressive enough for
+		 * the data, so force gathering literal stats only.
+		 */
+		if (prev_block_used_only_literals)
+			min_len = DEFLATE_MAX_MATCH_LEN + 1;
+		else
+			min_len = calculate_min_match_len(
+					in_block_begin,
+					in_max_block_end - in_block_begin,
+					c->max_search_depth);
+
+		/*
+		 * Find matches until we decide to end the block.  We end the
+		 * block if any of the following is true:
+		 *
+		 * (1) Maximum block length has been reached
+		 * (2) Match catch may overflow.
+		 * (3) Block split heuristic says to split now.
+		 *
+		 * With the block split search, (3) only suggests where a block
+		 * could end, and the block is ended by (1) or (2); the data is
+		 * split into blocks afterwards.
+		 */
+		for (;;) {
+			const u8 * const in_step = in_next;
+			unsigned best_len;
+
+			if (in_next == mf.in_next) {
+				best_len = deflate_near_optimal_find_matches(
+							&mf, false);
+				in_next = mf.in_next;
+				cache_ptr = mf.cache_ptr;
+			} else {
+				/*
+				 * A task already found the matches.  Take the
+				 * same step as it did.
+				 */
+				const u16 *counts = &c->p.n.match_counts[
+						in_next - in_block_begin];
+				unsigned count = *counts++;
+
+				best_len = count ? cache_ptr[count - 1].length
+						 : 0;
+				cache_ptr += count + 1;
+				in_next++;
+				while (in_next != mf.in_next &&
+				       *counts == SKIPPED_POS_COUNT) {
+					counts++;
+					cache_ptr++;
+					in_next++;
+				}
+			}
+			if (in_step >= next_observation) {
+				if (best_len >= min_len) {
+					observe_match(&c->split_stats,
+						      best_len);
+					next_observation = in_step + best_len;
+					c->p.n.new_match_len_freqs[best_len]++;
+				} else {
+					observe_literal(&c->split_stats,
+							*in_step);
+					next_observation = in_step + 1;
+				}
+			}
+
+			/* Maximum block length or end of input reached? */
+			if (in_next >= in_max_block_end)
+				break;
+			/* Match cache overflowed? */
+			if (cache_ptr >= mf.cache_end &&
+			    in_next - in_block_begin >= MIN_BLOCK_LENGTH)
+				break;
+			/* Not ready to try to end the block (again)? */
+			if (!ready_to_check_block(&c->split_stats,
+						  in_check_begin, in_next,
+						  in_end))
+				continue;
+			/* Check if it would be worthwhile to end the block. */
+			if (do_end_block_check(c, in_next - in_check_begin)) {
+				if (c->p.n.split_granularity == 0) {
+					change_detected = true;
+					break;
+				}
+				/*
+				 * Suggest ending a block where it would be
+				 * ended without the block split search, then
+				 * carry on as if a new block began there.
+				 */
+				if (prev_end_block_check != NULL) {
+					in_check_begin = prev_end_block_check;
+					deflate_near_optimal_clear_old_stats(c);
+				} else {
+					in_check_begin = in_next;
+					deflate_near_optimal_init_stats(c);
+				}
+				if (num_split_hints == 0 ||
+				    in_check_begin -
+				    split_hints[num_split_hints - 1] >=
+				    MIN_BLOCK_LENGTH)
+					split_hints[num_split_hints++] =
+						in_check_begin;
+				prev_end_block_check = NULL;
+				continue;
+			}
+			/* Ending the block doesn't seem worthwhile here. */
+			deflate_near_optimal_merge_stats(c);
+			prev_end_block_check = in_next;
+		}
+		/*
+		 * All the matches for this block have been cached.  Now choose
+		 * the precise end of the block and the sequence of items to
+		 * output to represent it, then flush the block.
+		 */
+		block_cache_end = cache_ptr;
+		split = c->p.n.split_granularity != 0 &&
+			in_next - in_block_begin >= 2 * MIN_BLOCK_LENGTH;
+		if (split) {
+			/*
+			 * Split the data into blocks.  Unless this is the end
+			 * of the input, the last block is left to be split
+			 * again along with the data that follows it, like the
+			 * chunk that differs is above, so that blocks don't
+			 * have to end where the data to split happened to.
+			 * So the last block may be short if it's the final
+			 * block, or if enough data follows it that it won't
+			 * be left as a short block on its own.
+			 */
+			split_end = deflate_search_block_split(
+					c, in_block_begin,
+					in_next - in_block_begin, cache_ptr,
+					split_hints, num_split_hints,
+					in_block_begin == in, in_next != in_end,
+					(is_final && in_next == in_end) ||
+					in_end - in_next >= MIN_BLOCK_LENGTH,
+					&split_parse);
+			deflate_near_optimal_merge_stats(c);
+			in_block_end = in_block_begin +
+				c->p.n.split_points[split_end].pos;
+			block_cache_end =
+				c->p.n.split_points[split_end].cache_ptr;
+		} else if (change_detected && prev_end_block_check != NULL) {
+			/*
+			 * The block is being ended because a recent chunk of
+			 * data differs from the rest of the block.  We could
+			 * end the block at 'in_next' like the greedy and lazy
+			 * compressors do, but that's not ideal since it would
+			 * include the differing chunk in the block.  The
+			 * near-optimal compressor has time to do a better job.
+			 * Therefore, we rewind to just before the chunk, and
+			 * output a block that only goes up to there.
+			 *
+			 * We then set things up to correctly start the next
+			 * block, considering that some work has already been
+			 * done on it (some matches found and stats gathered).
+			 */
+			u32 num_bytes_to_rewind = in_next - prev_end_block_check;
+
+			/* Rewind the match cache. */
+			do {
+				block_cache_end--;
+				block_cache_end -= block_cache_end->length;
+			} while (--num_bytes_to_rewind);
+			in_block_end = prev_end_block_check;
+		} else {
+			/*
+			 * The block is being ended for a reason other than a
+			 * differing data chunk being detected.  Don't rewind at
+			 * all; just end the block at the current position.
+			 */
+			deflate_near_optimal_merge_stats(c);
+			in_block_end = in_next;
+		}
+
+		/*
+		 * If there's a task submitter, start the task that finds the
+		 * matches for the next block, giving it the matches already
+		 * found for it.  But if the next block would start with
+		 * incompressible data, then that has to be output after this
+		 * block, before finding any more matches.
+		 */
+		may_skip_incompressible = !change_detected &&
+					  in_block_end == in_next;
+		pipelined = next_cache != NULL && in_block_end != in_end &&
+			    !(may_skip_incompressible &&
+			      deflate_incompressible_region(c, in, in_block_end,
+							    in_end) != 0);
+		if (pipelined) {
+			struct lz_match *prev_cache = cache;
+
+			cache = next_cache;
+			next_cache = prev_cache;
+			memcpy(cache, block_cache_end,
+			       (mf.cache_ptr - block_cache_end) *
+			       sizeof(*cache));
+			memmove(c->p.n.match_counts,
+				&c->p.n.match_counts[in_block_end -
+						     in_block_begin],
+				(mf.in_next - in_block_end) *
+				sizeof(c->p.n.match_counts[0]));
+			cache_ptr = &cache[cache_ptr - block_cache_end];
+			mf.cache_ptr = &cache[mf.cache_ptr - block_cache_end];
+			mf.cache_end = &cache[c->p.n.match_cache_end -
+					      c->p.n.match_cache];
+			mf.counts = &c->p.n.match_counts[mf.in_next -
+							 in_block_end];
+			mf.block_begin = in_block_end;
+			mf.stop = deflate_near_optimal_max_block_end(
+					c, in_block_end, in_end);
+			(*c->p.n.submitter.submit)(
+					c->p.n.submitter.ctx,
+					deflate_near_optimal_find_block_matches,
+					&mf);
+			may_skip_incompressible = false;
+		}
+		if (split)
+			deflate_flush_split_blocks(
+					c, os, in_block_begin, split_end,
+					split_parse, in_block_begin == in,
+					is_final && in_block_end == in_end,
+					&prev_block_used_only_literals);
+		else
+			deflate_optimize_and_flush_block(
+					c, os, in_block_begin,
+					in_block_end - in_block_begin,
+					block_cache_end,
+					in_block_begin == in,
+					is_final && in_block_end == in_end,
+					&prev_block_used_only_literals);
+		if (pipelined) {
+			(*c->p.n.submitter.wait)(c->p.n.submitter.ctx);
+		} else {
+			memmove(cache, block_cache_end,
+				(mf.cache_ptr - block_cache_end) *
+				sizeof(*cache));
+			cache_ptr = &cache[cache_ptr - block_cache_end];
+			mf.cache_ptr = &cache[mf.cache_ptr - block_cache_end];
+		}
+		deflate_near_optimal_save_stats(c);
+		if (in_block_end != in_next) {
+			/*
+			 * Clear the stats for the just-flushed block, leaving
+			 * just the stats for the beginning of the next block.
+			 */
+			deflate_near_optimal_clear_old_stats(c);
+		} else {
+			deflate_near_optimal_init_stats(c);
+		}
+		in_block_begin = in_block_end;
+	} while (in_next != in_end && !os->overflow);
+
+	deflate_save_matchfinder(c, (mf_pos_t *)&c->p.n.bt_mf,
+				 bt_matchfinder_size(c->mf_window_size),
+				 mf.in_insert_end, mf.in_cur_base,
+				 mf.next_hashes);
+	c->mf_pending = in_end - mf.in_insert_end;
+}
+
+#endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
+
+/*
+ * Insert the data from @in_next up to @in into the matchfinder, and set up the
+ * next compression call to resume from it, so that matches in @in can refer to
+ * it.  If c->mf_resume is set, then the matchfinder continues from where it
+ * left off at @in_next; otherwise it starts out empty.  @in_end is the end of
+ * the data that follows, which the matchfinder may read ahead into.
+ */
+static void
+deflate_insert_history(struct libdeflate_compressor *c, const u8 *in_next,
+		       const u8 *in, const u8 *in_end)
+{
+	const u8 *in_cur_base;
+	u32 count = in - in_next;
+	u32 next_hashes[2] = {0, 0};
+	const u32 window_size = c->mf_window_size;
+	unsigned order_reduction;
+
+	if (c->impl == deflate_compress_huffman_only ||
+	    c->impl == deflate_compress_rle) {
+		/* There's no matchfinder; the data just needs to be there. */
+	} else if (c->impl == deflate_compress_fastest ||
+		   c->impl == deflate_compress_ultrafast) {
+		struct ht_matchfinder *ht_mf =
+			(c->impl == deflate_compress_fastest) ?
+			&c->p.f.ht_mf : &c->p.u.ht_mf;
+
+		if (!deflate_resume_matchfinder(c, in_next, 0, false,
+						&in_cur_base, next_hashes))
+			ht_matchfinder_init(ht_mf, 0);
+		order_reduction = c->mf_order_reduction;
+		if (count)
+			ht_matchfinder_skip_bytes(ht_mf, &in_cur_base,
+						  in_next, in_end, count,
+						  order_reduction,
+						  &next_hashes[0]);
+		deflate_save_matchfinder(c, (mf_pos_t *)ht_mf,
+					 sizeof(*ht_mf), in, in_cur_base,
+					 next_hashes);
+	}
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	else if (c->impl == deflate_compress_near_optimal) {
+		const u8 *in_insert_end;
+
+		/* Start with what the previous call held back, if anything. */
+		if (deflate_resume_matchfinder(c, in_next, 0, false,
+					       &in_cur_base, next_hashes))
+			in_next -= c->mf_pending;
+		else
+			bt_matchfinder_init(&c->p.n.bt_mf, 0);
+		order_reduction = c->mf_order_reduction;
+		in_insert_end = deflate_bt_insert_end(c, in_next, in_end,
+						      false);
+		in_insert_end = MIN(in_insert_end, in);
+		for (; in_next < in_insert_end; in_next++) {
+			bt_matchfinder_skip_byte(&c->p.n.bt_mf, in_cur_base,
+						 in_next - in_cur_base,
+						 MIN(c->nice_match_length,
+						     DEFLATE_MAX_MATCH_LEN),
+						 c->max_search_depth,
+						 order_reduction,
+						 window_size,
+						 next_hashes,
+						 &c->mf_counters);
+		}
+		deflate_save_matchfinder(c, (mf_pos_t *)&c->p.n.bt_mf,
+					 bt_matchfinder_size(window_size),
+					 in_next, in_cur_base,
+					 next_hashes);
+		c->mf_pending = in - in_next;
+	}
+#endif
+	else {
+		if (!deflate_resume_matchfinder(c, in_next, 0, false,
+						&in_cur_base, next_hashes))
+			hc_matchfinder_init(&c->p.g.hc_mf, 0);
+		order_reduction = c->mf_order_reduction;
+		if (count)
+			hc_matchfinder_skip_bytes(&c->p.g.hc_mf, &in_cur_base,
+						  in_next, in_end, count,
+						  order_reduction,
+						  window_size,
+						  next_hashes);
+		deflate_save_matchfinder(c, (mf_pos_t *)&c->p.g.hc_mf,
+					 hc_matchfinder_size(window_size),
+					 in, in_cur_base,
+					 next_hashes);
 	}
-	if ((s32)literal_freq < 0) /* shouldn't happen */
-		literal_freq = 0;
+	c->mf_resume = true;
+}
 
-	if (match_freq > literal_freq)
-		i = 2; /* many matches */
-	else if (match_freq * 4 > literal_freq)
-		i = 1; /* neutral */
-	else
-		i = 0; /* few matches */
+/*
+ * Insert the @history_nbytes bytes that immediately precede @in into the
+ * matchfinder, like deflate_insert_history().  Only the last
+ * MATCHFINDER_WINDOW_SIZE bytes of history can be referenced.
+ */
+static void
+deflate_load_history(struct libdeflate_compressor *c, const u8 *in,
+		     size_t history_nbytes, const u8 *in_end)
+{
+	c->mf_resume = false;
+	history_nbytes = MIN(history_nbytes, MATCHFINDER_WINDOW_SIZE);
+	if (c->impl != NULL && history_nbytes != 0)
+		deflate_insert_history(c, in - history_nbytes, in, in_end);
+}
 
-	STATIC_ASSERT(BIT_COST == 16);
-	*lit_cost = default_litlen_costs[i].used_lits_to_lit_cost[
-							num_used_literals];
-	*len_sym_cost = default_litlen_costs[i].len_sym_cost;
+/*
+ * Return the compressor's matchfinder and its size, or NULL and 0 if it doesn't
+ * have one.
+ */
+static mf_pos_t *
+deflate_get_matchfinder(struct libdeflate_compressor *c, size_t *size_ret)
+{
+	if (c->impl == deflate_compress_huffman_only ||
+	    c->impl == deflate_compress_rle) {
+		*size_ret = 0;
+		return NULL;
+	}
+	if (c->impl == deflate_compress_fastest) {
+		*size_ret = sizeof(c->p.f.ht_mf);
+		return (mf_pos_t *)&c->p.f.ht_mf;
+	}
+	if (c->impl == deflate_compress_ultrafast) {
+		*size_ret = sizeof(c->p.u.ht_mf);
+		return (mf_pos_t *)&c->p.u.ht_mf;
+	}
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	if (c->impl == deflate_compress_near_optimal) {
+		*size_ret = bt_matchfinder_size(c->mf_window_size);
+		return (mf_pos_t *)&c->p.n.bt_mf;
+	}
+#endif
+	*size_ret = hc_matchfinder_size(c->mf_window_size);
+	return (mf_pos_t *)&c->p.g.hc_mf;
 }
 
-static forceinline u32
-deflate_default_length_cost(unsigned len, u32 len_sym_cost)
+/*
+ * Return the compression level whose parameters are the defaults for the given
+ * compression level and strategy: the nearest level that uses the strategy.
+ * Return -1 if the strategy is invalid.
+ */
+static int
+deflate_get_defaults_level(int compression_level,
+			   enum libdeflate_strategy strategy)
 {
-	unsigned slot = deflate_length_slot[len];
-	u32 num_extra_bits = deflate_extra_length_bits[slot];
+	static const struct {
+		u8 min_level;
+		u8 max_level;
+	} strategy_levels[] = {
+		[LIBDEFLATE_STRATEGY_FASTEST]		= { 1, 1 },
+		[LIBDEFLATE_STRATEGY_GREEDY]		= { 2, 4 },
+		[LIBDEFLATE_STRATEGY_LAZY]		= { 5, 7 },
+		[LIBDEFLATE_STRATEGY_LAZY2]		= { 8, 9 },
+		[LIBDEFLATE_STRATEGY_NEAR_OPTIMAL]	= { 10, 14 },
+		[LIBDEFLATE_STRATEGY_HUFFMAN_ONLY]	= { 1, 1 },
+		[LIBDEFLATE_STRATEGY_RLE]		= { 1, 1 },
+		[LIBDEFLATE_STRATEGY_ULTRAFAST]		= { 1, 1 },
+	};
 
-	return len_sym_cost + (num_extra_bits * BIT_COST);
+	if (compression_level == 0 || strategy == LIBDEFLATE_STRATEGY_DEFAULT)
+		return compression_level;
+	if ((unsigned)strategy >= ARRAY_LEN(strategy_levels))
+		return -1;
+	return MAX(MIN(compression_level,
+		       strategy_levels[strategy].max_level),
+		   strategy_levels[strategy].min_level);
 }
 
-static forceinline u32
-deflate_default_offset_slot_cost(unsigned slot)
+/*
+ * Validate the compression parameters in 'options', given the level whose
+ * defaults are being overridden.  0 means "use the default" for all of them.
+ */
+static bool
+deflate_check_options(int defaults_level,
+		      const struct libdeflate_options *options)
 {
-	u32 num_extra_bits = deflate_extra_offset_bits[slot];
+	unsigned max_block_length = (defaults_level == 1) ?
+				    FAST_SOFT_MAX_BLOCK_LENGTH :
+				    SOFT_MAX_BLOCK_LENGTH;
+	bool lazy = (defaults_level >= 5);
+
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	if (defaults_level >= 10)
+		lazy = false;
+#endif
 	/*
-	 * Assume that all offset symbols are equally probable.
-	 * The resulting cost is 'int(-log2(1/30) * BIT_COST)',
-	 * where 30 is the number of potentially-used offset symbols.
+	 * The lazy compressors search the following position(s) with a
+	 * quarter of the search depth, which must not round down to 0.
 	 */
-	u32 offset_sym_cost = 4*BIT_COST + (907*BIT_COST)/1000;
-
-	return offset_sym_cost + (num_extra_bits * BIT_COST);
+	if (lazy && options->max_search_depth != 0 &&
+	    options->max_search_depth < 4)
+		return false;
+	if (options->nice_match_length != 0 &&
+	    (options->nice_match_length < DEFLATE_MIN_MATCH_LEN ||
+	     options->nice_match_length > DEFLATE_MAX_MATCH_LEN))
+		return false;
+	if (options->soft_max_block_length != 0 &&
+	    (options->soft_max_block_length < MIN_BLOCK_LENGTH ||
+	     options->soft_max_block_length > max_block_length))
+		return false;
+	return true;
 }
 
-/* Set default symbol costs for the first block's first optimization pass. */
-static void
-deflate_set_default_costs(struct libdeflate_compressor *c,
-			  u32 lit_cost, u32 len_sym_cost)
-{
-	unsigned i;
+/* The layout of a compressor's memory; see deflate_get_layout() */
+struct deflate_layout {
+	int level;
+	unsigned soft_max_block_length;
+	unsigned window_order;
+	size_t alignment;
+	size_t size;
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	size_t nodes_offset;
+	size_t cache_offset;
+	size_t next_cache_offset;
+	size_t counts_offset;
+	size_t split_points_offset;
+	size_t split_hints_offset;
+	u32 num_nodes;
+	u32 cache_length;
+	u32 split_granularity;
+#endif
+};
 
-	/* Literals */
-	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
-		c->p.n.costs.literal[i] = lit_cost;
+/*
+ * Decide the parameters that determine the size of a compressor with the given
+ * compression level and options, and lay out its memory: the compressor struct
+ * with the part of the union that it uses, then any arrays that follow it.
+ * Return false if the level or options are invalid.
+ */
+static bool
+deflate_get_layout(int compression_level,
+		   const struct libdeflate_options *options,
+		   struct deflate_layout *l)
+{
+	struct libdeflate_compressor *c;
+	size_t size = offsetof(struct libdeflate_compressor, p);
+	unsigned soft_max_block_length;
+	unsigned window_order;
+	int level;
 
-	/* Lengths */
-	for (i = DEFLATE_MIN_MATCH_LEN; i <= DEFLATE_MAX_MATCH_LEN; i++)
-		c->p.n.costs.length[i] =
-			deflate_default_length_cost(i, len_sym_cost);
+	if (compression_level < 0 || compression_level > 14)
+		return false;
+	if (options->alloc_alignment & (options->alloc_alignment - 1))
+		return false;
+	if (options->window_bits != 0 &&
+	    (options->window_bits < MATCHFINDER_MIN_WINDOW_ORDER ||
+	     options->window_bits > MATCHFINDER_WINDOW_ORDER))
+		return false;
+	window_order = options->window_bits ? options->window_bits :
+					      MATCHFINDER_WINDOW_ORDER;
 
-	/* Offset slots */
-	for (i = 0; i < ARRAY_LEN(deflate_offset_slot_base); i++)
-		c->p.n.costs.offset_slot[i] =
-			deflate_default_offset_slot_cost(i);
-}
+	/*
+	 * 'level' is the level whose parameters are used, before applying any
+	 * overrides from the options.  It differs from compression_level only
+	 * if a strategy was requested.
+	 */
+	level = deflate_get_defaults_level(compression_level,
+					   options->strategy);
+	if (level < 0)
+		return false;
+	if (level != 0 && !deflate_check_options(level, options))
+		return false;
+	/*
+	 * A target speed is met by switching between the parameters of the
+	 * levels that use hash chains, from level 2 up to this level.
+	 */
+	if (options->rate_control != NULL &&
+	    (level < 2 || level > 9 ||
+	     options->rate_control->get_time_ns == NULL))
+		return false;
 
-static forceinline void
-deflate_adjust_cost(u32 *cost_p, u32 default_cost, int change_amount)
-{
-	if (change_amount == 0)
-		/* Block is very similar to previous; prefer previous costs. */
-		*cost_p = (default_cost + 3 * *cost_p) / 4;
-	else if (change_amount == 1)
-		*cost_p = (default_cost + *cost_p) / 2;
-	else if (change_amount == 2)
-		*cost_p = (5 * default_cost + 3 * *cost_p) / 8;
+	soft_max_block_length = (level == 1) ? FAST_SOFT_MAX_BLOCK_LENGTH :
+					       SOFT_MAX_BLOCK_LENGTH;
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	if (level >= 10 && options->low_memory)
+		soft_max_block_length = LOW_MEMORY_SOFT_MAX_BLOCK_LENGTH;
+#endif
+	if (level != 0 && options->soft_max_block_length != 0)
+		soft_max_block_length = options->soft_max_block_length;
+
+	if (level != 0 &&
+	    (options->strategy == LIBDEFLATE_STRATEGY_HUFFMAN_ONLY ||
+	     options->strategy == LIBDEFLATE_STRATEGY_RLE))
+		size += sizeof(c->p.r);
+	else if (level != 0 &&
+		 options->strategy == LIBDEFLATE_STRATEGY_ULTRAFAST)
+		size += sizeof(c->p.u);
 	else
-		/* Block differs greatly from previous; prefer default costs. */
-		*cost_p = (3 * default_cost + *cost_p) / 4;
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	if (level >= 10) {
+		/*
+		 * The optimum nodes and the match cache follow the compressor,
+		 * sized for its soft maximum block length.
+		 */
+		l->num_nodes = MAX_BLOCK_LENGTH_FOR(soft_max_block_length) + 1;
+		l->cache_length = MATCH_CACHE_LENGTH(soft_max_block_length);
+		size = offsetof(struct libdeflate_compressor, p.n.bt_mf) +
+		       bt_matchfinder_size(1U << window_order);
+		l->nodes_offset = size;
+		size += l->num_nodes * sizeof(struct deflate_optimum_node);
+		l->cache_offset = size;
+		size += (l->cache_length + MATCH_CACHE_SLACK) *
+			sizeof(struct lz_match);
+		/*
+		 * With a task submitter, the next block's match cache and match
+		 * counts follow too.
+		 */
+		if (options->task_submitter != NULL) {
+			l->next_cache_offset = size;
+			size += (l->cache_length + MATCH_CACHE_SLACK) *
+				sizeof(struct lz_match);
+			l->counts_offset = size;
+			size += l->num_nodes * sizeof(u16);
+		}
+		/* At levels 13 and 14, so do the block split candidates. */
+		l->split_granularity = 0;
+		if (level >= 13) {
+			/* The hints are at least MIN_BLOCK_LENGTH apart. */
+			u32 max_hints = DIV_ROUND_UP(l->num_nodes - 1,
+						     MIN_BLOCK_LENGTH);
+
+			l->split_granularity = SPLIT_GRANULARITY(level);
+			size = ALIGN(size, sizeof(void *));
+			l->split_points_offset = size;
+			size += (DIV_ROUND_UP(l->num_nodes - 1,
+					      l->split_granularity) + 1 +
+				 max_hints) * sizeof(struct deflate_split_point);
+			l->split_hints_offset = size;
+			size += max_hints * sizeof(const u8 *);
+		}
+	} else
+#endif
+	{
+		if (level >= 2)
+			size = offsetof(struct libdeflate_compressor,
+					p.g.hc_mf) +
+			       hc_matchfinder_size(1U << window_order);
+		else if (level == 1)
+			size += sizeof(c->p.f);
+	}
+
+	l->alignment = MAX(MATCHFINDER_MEM_ALIGNMENT, options->alloc_alignment);
+	/*
+	 * For huge pages, cover whole huge pages so that none of them is shared
+	 * with other allocations.  Compressors too small to fill one aren't
+	 * worth it.
+	 */
+	if (SUPPORT_HUGE_PAGES && options->huge_pages &&
+	    size >= HUGE_PAGE_SIZE) {
+		l->alignment = MAX(l->alignment, HUGE_PAGE_SIZE);
+		size = ALIGN(size, HUGE_PAGE_SIZE);
+	}
+	l->level = level;
+	l->soft_max_block_length = soft_max_block_length;
+	l->window_order = window_order;
+	l->size = size;
+	return true;
 }
 
-static forceinline void
-deflate_adjust_costs_impl(struct libdeflate_compressor *c,
-			  u32 lit_cost, u32 len_sym_cost, int change_amount)
+LIBDEFLATEAPI struct libdeflate_compressor *
+libdeflate_alloc_compressor_ex(int compression_level,
+			       const struct libdeflate_options *options)
 {
-	unsigned i;
+	struct libdeflate_compressor *c;
+	struct libdeflate_options opts;
+	struct libdeflate_backend backend;
+	struct deflate_layout layout;
+	int level;
 
-	/* Literals */
-	for (i = 0; i < DEFLATE_NUM_LITERALS; i++)
-		deflate_adjust_cost(&c->p.n.costs.literal[i], lit_cost,
-				    change_amount);
+	check_buildtime_parameters();
 
-	/* Lengths */
-	for (i = DEFLATE_MIN_MATCH_LEN; i <= DEFLATE_MAX_MATCH_LEN; i++)
-		deflate_adjust_cost(&c->p.n.costs.length[i],
-				    deflate_default_length_cost(i,
-								len_sym_cost),
-				    change_amount);
+	if (!libdeflate_get_options(options, &opts))
+		return NULL;
+	options = &opts;
+	if (!libdeflate_get_backend(options->backend, &backend))
+		return NULL;
+	if (!deflate_get_layout(compression_level, options, &layout))
+		return NULL;
+	level = layout.level;
 
-	/* Offset slots */
-	for (i = 0; i < ARRAY_LEN(deflate_offset_slot_base); i++)
-		deflate_adjust_cost(&c->p.n.costs.offset_slot[i],
-				    deflate_default_offset_slot_cost(i),
-				    change_amount);
-}
+	c = libdeflate_aligned_malloc(options->malloc_func ?
+				      options->malloc_func :
+				      libdeflate_default_malloc_func,
+				      layout.alignment, layout.size);
+	if (!c)
+		return NULL;
+	if (options->huge_pages && layout.size >= HUGE_PAGE_SIZE)
+		libdeflate_advise_huge_pages(c, layout.size);
+	c->malloc_func = options->malloc_func ?
+			 options->malloc_func : libdeflate_default_malloc_func;
+	c->free_func = options->free_func ?
+		       options->free_func : libdeflate_default_free_func;
+	c->stream = NULL;
+	c->dict_buf = NULL;
+	c->huffman_table = NULL;
+	c->cost_model = NULL;
+	c->train_freqs = NULL;
+	c->checksum_func = NULL;
+	c->checksum_next = NULL;
+	c->backend = backend;
+	libdeflate_reset_compress_stats(c);
 
-/*
- * Adjust the costs when beginning a new block.
- *
- * Since the current costs are optimized for the data already, it can be helpful
- * to reuse them instead of starting over with the default costs.  However, this
- * depends on how similar the new block is to the previous block.  Therefore,
- * use a heuristic to decide how similar the blocks are, and mix together the
- * current costs and the default costs accordingly.
- */
-static void
-deflate_adjust_costs(struct libdeflate_compressor *c,
-		     u32 lit_cost, u32 len_sym_cost)
-{
-	u64 total_delta = 0;
-	u64 cutoff;
-	int i;
+	c->compression_level = compression_level;
 
 	/*
-	 * Decide how different the current block is from the previous block,
-	 * using the block splitting statistics from the current and previous
-	 * blocks.  The more different the current block is, the more we prefer
-	 * the default costs rather than the previous block's costs.
-	 *
-	 * The algorithm here is similar to the end-of-block check one, but here
-	 * we compare two entire blocks rather than a partial block with a small
-	 * extra part, and therefore we need 64-bit numbers in some places.
+	 * The higher the compression level, the more we should bother trying to
+	 * compress very small inputs.
 	 */
-	for (i = 0; i < NUM_OBSERVATION_TYPES; i++) {
-		u64 prev = (u64)c->p.n.prev_observations[i] *
-			    c->split_stats.num_observations;
-		u64 cur = (u64)c->split_stats.observations[i] *
-			  c->p.n.prev_num_observations;
+	c->max_passthrough_size = 55 - (MIN(compression_level, 12) * 4);
 
-		total_delta += prev > cur ? prev - cur : cur - prev;
+	c->soft_max_block_length = layout.soft_max_block_length;
+	c->mf_window_size = 1U << layout.window_order;
+
+	switch (level) {
+	case 0:
+		c->max_passthrough_size = SIZE_MAX;
+		c->impl = NULL; /* not used */
+		c->max_search_depth = 0; /* not used */
+		c->nice_match_length = 0; /* not used */
+		break;
+	case 1:
+		c->impl = deflate_compress_fastest;
+		c->max_search_depth = 0; /* not used */
+		c->nice_match_length = 32;
+		break;
+	case 2:
+	case 3:
+	case 4:
+	case 5:
+	case 6:
+	case 7:
+	case 8:
+	case 9:
+#if !SUPPORT_NEAR_OPTIMAL_PARSING
+	default:
+#endif
+		c->impl = deflate_hc_levels[MIN(level, 9) - 2].impl;
+		c->max_search_depth =
+			deflate_hc_levels[MIN(level, 9) - 2].max_search_depth;
+		c->nice_match_length =
+			deflate_hc_levels[MIN(level, 9) - 2].nice_match_length;
+		break;
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	case 10:
+		c->impl = deflate_compress_near_optimal;
+		c->max_search_depth = 35;
+		c->nice_match_length = 75;
+		c->p.n.max_optim_passes = 2;
+		c->p.n.min_improvement_to_continue = 32;
+		c->p.n.min_bits_to_use_nonfinal_path = 32;
+		c->p.n.max_len_to_optimize_static_block = 0;
+		break;
+	case 11:
+		c->impl = deflate_compress_near_optimal;
+		c->max_search_depth = 100;
+		c->nice_match_length = 150;
+		c->p.n.max_optim_passes = 4;
+		c->p.n.min_improvement_to_continue = 16;
+		c->p.n.min_bits_to_use_nonfinal_path = 16;
+		c->p.n.max_len_to_optimize_static_block = 1000;
+		break;
+	case 12:
+		c->impl = deflate_compress_near_optimal;
+		c->max_search_depth = 300;
+		c->nice_match_length = DEFLATE_MAX_MATCH_LEN;
+		c->p.n.max_optim_passes = 10;
+		c->p.n.min_improvement_to_continue = 1;
+		c->p.n.min_bits_to_use_nonfinal_path = 1;
+		c->p.n.max_len_to_optimize_static_block = 10000;
+		break;
+	case 13:
+	case 14:
+	default:
+		/*
+		 * Optimize until the cost stops improving; the limit on the
+		 * number of passes only guards against the costs oscillating.
+		 */
+		c->impl = deflate_compress_near_optimal;
+		c->max_search_depth = (level == 13) ? 300 : 1000;
+		c->nice_match_length = DEFLATE_MAX_MATCH_LEN;
+		c->p.n.max_optim_passes = 50;
+		c->p.n.min_improvement_to_continue = 1;
+		c->p.n.min_bits_to_use_nonfinal_path = 1;
+		c->p.n.max_len_to_optimize_static_block = 10000;
+		break;
+#endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
+	}
+
+	if (level != 0) {
+		if (options->strategy == LIBDEFLATE_STRATEGY_HUFFMAN_ONLY)
+			c->impl = deflate_compress_huffman_only;
+		else if (options->strategy == LIBDEFLATE_STRATEGY_RLE)
+			c->impl = deflate_compress_rle;
+		else if (options->strategy == LIBDEFLATE_STRATEGY_ULTRAFAST)
+			c->impl = deflate_compress_ultrafast;
+		if (options->max_search_depth != 0)
+			c->max_search_depth = options->max_search_depth;
+		if (options->nice_match_length != 0)
+			c->nice_match_length = options->nice_match_length;
+	#if SUPPORT_NEAR_OPTIMAL_PARSING
+		if (c->impl == deflate_compress_near_optimal &&
+		    options->max_optim_passes != 0)
+			c->p.n.max_optim_passes = options->max_optim_passes;
+	#endif
+	}
+#if SUPPORT_NEAR_OPTIMAL_PARSING
+	if (c->impl == deflate_compress_near_optimal) {
+		c->p.n.optimum_nodes = (struct deflate_optimum_node *)
+				       ((u8 *)c + layout.nodes_offset);
+		c->p.n.num_optimum_nodes = layout.num_nodes;
+		c->p.n.match_cache = (struct lz_match *)
+				     ((u8 *)c + layout.cache_offset);
+		c->p.n.match_cache_end =
+			&c->p.n.match_cache[layout.cache_length];
+		c->p.n.have_costs = false;
+		c->p.n.split_granularity = layout.split_granularity;
+		c->p.n.split_points = (struct deflate_split_point *)
+				      ((u8 *)c + layout.split_points_offset);
+		c->p.n.split_hints = (const u8 **)
+				     ((u8 *)c + layout.split_hints_offset);
+		c->p.n.next_match_cache = NULL;
+		c->p.n.match_counts = NULL;
+		if (options->task_submitter != NULL) {
+			c->p.n.next_match_cache = (struct lz_match *)
+				((u8 *)c + layout.next_cache_offset);
+			c->p.n.match_counts = (u16 *)
+				((u8 *)c + layout.counts_offset);
+			c->p.n.submitter = *options->task_submitter;
+		}
+	}
+#endif
+	if (options->rate_control != NULL) {
+		struct deflate_rate_state *rs = &c->rate;
+
+		memset(rs, 0, sizeof(*rs));
+		rs->control = *options->rate_control;
+		rs->num_rungs = level - 1;
+		rs->rung = rs->num_rungs - 1;
+		rs->top_impl = c->impl;
+		rs->top_max_search_depth = c->max_search_depth;
+		rs->top_nice_match_length = c->nice_match_length;
+		c->impl = deflate_compress_adaptive;
 	}
-	cutoff = ((u64)c->p.n.prev_num_observations *
-		  c->split_stats.num_observations * 200) / 512;
 
-	if (total_delta > 3 * cutoff)
-		/* Big change in the data; just use the default costs. */
-		deflate_set_default_costs(c, lit_cost, len_sym_cost);
-	else if (4 * total_delta > 9 * cutoff)
-		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 3);
-	else if (2 * total_delta > 3 * cutoff)
-		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 2);
-	else if (2 * total_delta > cutoff)
-		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 1);
-	else
-		deflate_adjust_costs_impl(c, lit_cost, len_sym_cost, 0);
+	return c;
 }
 
-static void
-deflate_set_initial_costs(struct libdeflate_compressor *c,
-			  const u8 *block_begin, u32 block_length,
-			  bool is_first_block)
-{
-	u32 lit_cost, len_sym_cost;
 
-	deflate_choose_default_litlen_costs(c, block_begin, block_length,
-					    &lit_cost, &len_sym_cost);
-	if (is_first_block)
-		deflate_set_default_costs(c, lit_cost, len_sym_cost);
-	else
-		deflate_adjust_costs(c, lit_cost, len_sym_cost);
+LIBDEFLATEAPI struct libdeflate_compressor *
+libdeflate_alloc_compressor(int compression_level)
+{
+	static const struct libdeflate_options defaults = {
+		.sizeof_options = sizeof(defaults),
+	};
+	return libdeflate_alloc_compressor_ex(compression_level, &defaults);
 }
 
-/*
- * Find the minimum-cost path through the graph of possible match/literal
- * choices for this block.
- *
- * We find the minimum cost path from 'c->p.n.optimum_nodes[0]', which
- * represents the node at the beginning of the block, to
- * 'c->p.n.optimum_nodes[block_length]', which represents the node at the end of
- * the block.  Edge costs are evaluated using the cost model 'c->p.n.costs'.
- *
- * The algorithm works backwards, starting at the end node and proceeding
- * backwards one node at a time.  At each node, the minimum cost to reach the
- * end node is computed and the match/literal choice that begins that path is
- * saved.
- */
-static void
-deflate_find_min_cost_path(struct libdeflate_compressor *c,
-			   const u32 block_length,
-			   const struct lz_match *cache_ptr)
+LIBDEFLATEAPI size_t
+libdeflate_compressor_memory_size(int compression_level,
+				  const struct libdeflate_options *options)
 {
-	struct deflate_optimum_node *end_node =
-		&c->p.n.optimum_nodes[block_length];
-	struct deflate_optimum_node *cur_node = end_node;
-
-	cur_node->cost_to_end = 0;
-	do {
-		unsigned num_matches;
-		unsigned literal;
-		u32 best_cost_to_end;
-
-		cur_node--;
-		cache_ptr--;
-
-		num_matches = cache_ptr->length;
-		literal = cache_ptr->offset;
-
-		/* It's always possible to choose a literal. */
-		best_cost_to_end = c->p.n.costs.literal[literal] +
-				   (cur_node + 1)->cost_to_end;
-		cur_node->item = ((u32)literal << OPTIMUM_OFFSET_SHIFT) | 1;
-
-		/* Also consider matches if there are any. */
-		if (num_matches) {
-			const struct lz_match *match;
-			unsigned len;
-			unsigned offset;
-			unsigned offset_slot;
-			u32 offset_cost;
-			u32 cost_to_end;
-
-			/*
-			 * Consider each length from the minimum
-			 * (DEFLATE_MIN_MATCH_LEN) to the length of the longest
-			 * match found at this position.  For each length, we
-			 * consider only the smallest offset for which that
-			 * length is available.  Although this is not guaranteed
-			 * to be optimal due to the possibility of a larger
-			 * offset costing less than a smaller offset to code,
-			 * this is a very useful heuristic.
-			 */
-			match = cache_ptr - num_matches;
-			len = DEFLATE_MIN_MATCH_LEN;
-			do {
-				offset = match->offset;
-				offset_slot = c->p.n.offset_slot_full[offset];
-				offset_cost =
-					c->p.n.costs.offset_slot[offset_slot];
-				do {
-					cost_to_end = offset_cost +
-						c->p.n.costs.length[len] +
-						(cur_node + len)->cost_to_end;
-					if (cost_to_end < best_cost_to_end) {
-						best_cost_to_end = cost_to_end;
-						cur_node->item = len |
-							((u32)offset <<
-							 OPTIMUM_OFFSET_SHIFT);
-					}
-				} while (++len <= match->length);
-			} while (++match != cache_ptr);
-			cache_ptr -= num_matches;
-		}
-		cur_node->cost_to_end = best_cost_to_end;
-	} while (cur_node != &c->p.n.optimum_nodes[0]);
+	static const struct libdeflate_options defaults = {
+		.sizeof_options = sizeof(defaults),
+	};
+	struct libdeflate_options opts;
+	struct libdeflate_backend backend;
+	struct deflate_layout layout;
 
-	deflate_reset_symbol_frequencies(c);
-	deflate_tally_item_list(c, block_length);
-	deflate_make_huffman_codes(&c->freqs, &c->codes);
+	if (!libdeflate_get_options(options ? options : &defaults, &opts) ||
+	    !libdeflate_get_backend(opts.backend, &backend) ||
+	    !deflate_get_layout(compression_level, &opts, &layout))
+		return 0;
+	return ALIGNED_MALLOC_SIZE(layout.alignment, layout.size);
 }
 
-/*
- * Choose the literals and matches for the current block, then output the block.
- *
- * To choose the literal/match sequence, we find the minimum-cost path through
- * the block's graph of literal/match choices, given a cost model.  However, the
- * true cost of each symbol is unknown until the Huffman codes have been built,
- * but at the same time the Huffman codes depend on the frequencies of chosen
- * symbols.  Consequently, multiple passes must be used to try to approximate an
- * optimal solution.  The first pass uses default costs, mixed with the costs
- * from the previous block when it seems appropriate.  Later passes use the
- * Huffman codeword lengths from the previous pass as the costs.
- *
- * As an alternate strategy, also consider using only literals.  The boolean
- * returned in *used_only_literals indicates whether that strategy was best.
- */
-static void
-deflate_optimize_and_flush_block(struct libdeflate_compressor *c,
-				 struct deflate_output_bitstream *os,
-				 const u8 *block_begin, u32 block_length,
-				 const struct lz_match *cache_ptr,
-				 bool is_first_block, bool is_final_block,
-				 bool *used_only_literals)
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress(struct libdeflate_compressor *c,
+			    const void *in, size_t in_nbytes,
+			    void *out, size_t out_nbytes_avail)
 {
-	unsigned num_passes_remaining = c->p.n.max_optim_passes;
-	u32 best_true_cost = UINT32_MAX;
-	u32 true_cost;
-	u32 only_lits_cost;
-	u32 static_cost = UINT32_MAX;
-	struct deflate_sequence seq_;
-	struct deflate_sequence *seq = NULL;
-	u32 i;
-
-	/*
-	 * On some data, using only literals (no matches) ends up being better
-	 * than what the iterative optimization algorithm produces.  Therefore,
-	 * consider using only literals.
-	 */
-	deflate_choose_all_literals(c, block_begin, block_length);
-	only_lits_cost = deflate_compute_true_cost(c);
+	struct deflate_output_bitstream os;
 
 	/*
-	 * Force the block to really end at the desired length, even if some
-	 * matches extend beyond it.
+	 * For extremely short inputs, or for compression level 0, just output
+	 * uncompressed blocks.
 	 */
-	for (i = block_length;
-	     i <= MIN(block_length - 1 + DEFLATE_MAX_MATCH_LEN,
-		      ARRAY_LEN(c->p.n.optimum_nodes) - 1); i++)
-		c->p.n.optimum_nodes[i].cost_to_end = 0x80000000;
+	if (unlikely(in_nbytes <= c->max_passthrough_size)) {
+		deflate_count_passthrough(c, in_nbytes);
+		return deflate_compress_none(in, in_nbytes,
+					     out, out_nbytes_avail);
+	}
 
 	/*
-	 * Sometimes a static Huffman block ends up being cheapest, particularly
-	 * if the block is small.  So, if the block is sufficiently small, find
-	 * the optimal static block solution and remember its cost.
+	 * Try the offload backend if there is one, unless the input is too
+	 * small for it or the Huffman codes are being trained or are fixed by a
+	 * trained table, or the window is smaller than the full 32768 bytes,
+	 * which the backend doesn't know about.  Fall back to software if the
+	 * backend fails.
 	 */
-	if (block_length <= c->p.n.max_len_to_optimize_static_block) {
-		/* Save c->p.n.costs temporarily. */
-		c->p.n.costs_saved = c->p.n.costs;
-
-		deflate_set_costs_from_codes(c, &c->static_codes.lens);
-		deflate_find_min_cost_path(c, block_length, cache_ptr);
-		static_cost = c->p.n.optimum_nodes[0].cost_to_end / BIT_COST;
-		static_cost += 7; /* for the end-of-block symbol */
-
-		/* Restore c->p.n.costs. */
-		c->p.n.costs = c->p.n.costs_saved;
+	if (c->backend.deflate_compress != NULL &&
+	    in_nbytes >= c->backend.min_compress_nbytes &&
+	    c->train_freqs == NULL && c->huffman_table == NULL &&
+	    c->mf_window_size == MATCHFINDER_WINDOW_SIZE) {
+		size_t out_nbytes = (*c->backend.deflate_compress)(
+					c->backend.ctx, c->compression_level,
+					in, in_nbytes, out, out_nbytes_avail);
+		if (out_nbytes != 0)
+			return out_nbytes;
 	}
 
-	/* Initialize c->p.n.costs with default costs. */
-	deflate_set_initial_costs(c, block_begin, block_length, is_first_block);
+	/* Initialize the output bitstream structure. */
+	os.bitbuf = 0;
+	os.bitcount = 0;
+	os.next = out;
+	os.end = os.next + out_nbytes_avail;
+	os.overflow = false;
+	os.fit_end = NULL;
 
-	do {
-		/*
-		 * Find the minimum-cost path for this pass.
-		 * Also set c->freqs and c->codes to match the path.
-		 */
-		deflate_find_min_cost_path(c, block_length, cache_ptr);
+	/* Call the actual compression function. */
+	c->mf_resume = false;
+	(*c->impl)(c, in, in_nbytes, true, &os);
 
-		/*
-		 * Compute the exact cost of the block if the path were to be
-		 * used.  Note that this differs from
-		 * c->p.n.optimum_nodes[0].cost_to_end in that true_cost uses
-		 * the actual Huffman codes instead of c->p.n.costs.
-		 */
-		true_cost = deflate_compute_true_cost(c);
+	/* Return 0 if the output buffer is too small. */
+	if (os.overflow)
+		return 0;
 
-		/*
-		 * If the cost didn't improve much from the previous pass, then
-		 * doing more passes probably won't be helpful, so stop early.
-		 */
-		if (true_cost + c->p.n.min_improvement_to_continue >
-		    best_true_cost)
-			break;
+	/*
+	 * Write the final byte if needed.  This can't overflow the output
+	 * buffer because deflate_flush_block() would have set the overflow flag
+	 * if there wasn't enough space remaining for the full final block.
+	 */
+	ASSERT(os.bitcount <= 7);
+	if (os.bitcount) {
+		ASSERT(os.next < os.end);
+		*os.next++ = os.bitbuf;
+	}
 
-		best_true_cost = true_cost;
+	/* Return the compressed size in bytes. */
+	return os.next - (u8 *)out;
+}
 
-		/* Save the cost model that gave 'best_true_cost'. */
-		c->p.n.costs_saved = c->p.n.costs;
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_fit(struct libdeflate_compressor *c,
+				const void *in, size_t in_nbytes,
+				void *out, size_t out_nbytes_avail,
+				size_t *actual_in_nbytes_ret)
+{
+	struct deflate_output_bitstream os;
 
-		/* Update the cost model from the Huffman codes. */
-		deflate_set_costs_from_codes(c, &c->codes.lens);
+	*actual_in_nbytes_ret = 0;
+	if (out_nbytes_avail < FIT_RESERVE_NBYTES)
+		return 0;
 
-	} while (--num_passes_remaining);
+	/*
+	 * Initialize the output bitstream structure, holding back enough space
+	 * to end the stream.  The offload backend isn't used, as it can't stop
+	 * partway through the input.
+	 */
+	os.bitbuf = 0;
+	os.bitcount = 0;
+	os.next = out;
+	os.fit_end = os.next + out_nbytes_avail;
+	os.end = os.fit_end - FIT_RESERVE_NBYTES;
+	os.fit_in_end = (const u8 *)in + in_nbytes;
+	os.overflow = false;
 
-	*used_only_literals = false;
-	if (MIN(only_lits_cost, static_cost) < best_true_cost) {
-		if (only_lits_cost < static_cost) {
-			/* Using only literals ended up being best! */
-			deflate_choose_all_literals(c, block_begin, block_length);
-			deflate_set_costs_from_codes(c, &c->codes.lens);
-			seq_.litrunlen_and_length = block_length;
-			seq = &seq_;
-			*used_only_literals = true;
-		} else {
-			/* Static block ended up being best! */
-			deflate_set_costs_from_codes(c, &c->static_codes.lens);
-			deflate_find_min_cost_path(c, block_length, cache_ptr);
-		}
-	} else if (true_cost >=
-		   best_true_cost + c->p.n.min_bits_to_use_nonfinal_path) {
-		/*
-		 * The best solution was actually from a non-final optimization
-		 * pass, so recover and use the min-cost path from that pass.
+	if (in_nbytes <= c->max_passthrough_size) {
+		deflate_count_passthrough(c, in_nbytes);
+		deflate_write_uncompressed_blocks(&os, in, in_nbytes, true);
+	} else {
+		const u8 *in_next = in;
+		const u8 * const in_end = in_next + in_nbytes;
+
+		/*
+		 * Compress the input in pieces, resuming the matchfinder for
+		 * each one as streaming compression does, until one doesn't
+		 * fit.  Only the last piece can be the final one.
 		 */
-		c->p.n.costs = c->p.n.costs_saved;
-		deflate_find_min_cost_path(c, block_length, cache_ptr);
-		deflate_set_costs_from_codes(c, &c->codes.lens);
+		c->mf_resume = false;
+		do {
+			size_t avail = os.fit_end - os.next;
+			size_t out_used = os.next - (u8 *)out;
+			size_t piece_nbytes = avail * FIT_PIECE_RATIO;
+
+			if (out_used != 0)
+				piece_nbytes = (u64)avail * 3 *
+					       (in_next - (const u8 *)in) /
+					       (2 * out_used);
+			piece_nbytes = MAX(piece_nbytes, MIN_BLOCK_LENGTH);
+			if (in_end - in_next < piece_nbytes + MIN_BLOCK_LENGTH)
+				piece_nbytes = in_end - in_next;
+			(*c->impl)(c, in_next, piece_nbytes,
+				   piece_nbytes == in_end - in_next, &os);
+			in_next += piece_nbytes;
+			c->mf_resume = true;
+		} while (in_next != in_end && !os.overflow);
 	}
-	deflate_flush_block(c, os, block_begin, block_length, seq,
-			    is_final_block);
-}
 
-static void
-deflate_near_optimal_init_stats(struct libdeflate_compressor *c)
-{
-	init_block_split_stats(&c->split_stats);
-	memset(c->p.n.new_match_len_freqs, 0,
-	       sizeof(c->p.n.new_match_len_freqs));
-	memset(c->p.n.match_len_freqs, 0, sizeof(c->p.n.match_len_freqs));
+	/*
+	 * Either all the input was compressed, or the stream was ended early.
+	 * The final byte fits either way.
+	 */
+	ASSERT(os.bitcount <= 7);
+	if (os.bitcount) {
+		ASSERT(os.next < os.fit_end);
+		*os.next++ = os.bitbuf;
+	}
+	*actual_in_nbytes_ret = os.fit_in_end - (const u8 *)in;
+	return os.next - (u8 *)out;
 }
 
-static void
-deflate_near_optimal_merge_stats(struct libdeflate_compressor *c)
+LIBDEFLATEAPI void
+libdeflate_deflate_compress_batch(struct libdeflate_compressor *c,
+				  struct libdeflate_compress_batch_item *items,
+				  size_t num_items)
 {
-	unsigned i;
+	size_t i;
 
-	merge_new_observations(&c->split_stats);
-	for (i = 0; i < ARRAY_LEN(c->p.n.match_len_freqs); i++) {
-		c->p.n.match_len_freqs[i] += c->p.n.new_match_len_freqs[i];
-		c->p.n.new_match_len_freqs[i] = 0;
+	/*
+	 * The per-buffer setup cost is already proportional to the buffer size,
+	 * since deflate_resume_matchfinder() shrinks the hash tables for small
+	 * buffers, so just compress the buffers one by one.
+	 */
+	for (i = 0; i < num_items; i++) {
+		struct libdeflate_compress_batch_item *item = &items[i];
+
+		item->out_nbytes = libdeflate_deflate_compress(
+					c, item->in, item->in_nbytes,
+					item->out, item->out_nbytes_avail);
 	}
 }
 
-/*
- * Save some literal/match statistics from the previous block so that
- * deflate_adjust_costs() will be able to decide how much the current block
- * differs from the previous one.
- */
-static void
-deflate_near_optimal_save_stats(struct libdeflate_compressor *c)
+size_t
+libdeflate_deflate_compress_piece(struct libdeflate_compressor *c,
+				  const u8 *in, size_t in_nbytes,
+				  size_t history_nbytes, bool is_final,
+				  u8 *out, size_t out_nbytes_avail)
 {
-	int i;
-
-	for (i = 0; i < NUM_OBSERVATION_TYPES; i++)
-		c->p.n.prev_observations[i] = c->split_stats.observations[i];
-	c->p.n.prev_num_observations = c->split_stats.num_observations;
-}
+	struct deflate_output_bitstream os;
 
-static void
-deflate_near_optimal_clear_old_stats(struct libdeflate_compressor *c)
-{
-	int i;
+	os.bitbuf = 0;
+	os.bitcount = 0;
+	os.next = out;
+	os.end = os.next + out_nbytes_avail;
+	os.overflow = false;
+	os.fit_end = NULL;
 
-	for (i = 0; i < NUM_OBSERVATION_TYPES; i++)
-		c->split_stats.observations[i] = 0;
-	c->split_stats.num_observations = 0;
-	memset(c->p.n.match_len_freqs, 0, sizeof(c->p.n.match_len_freqs));
+	if (in_nbytes <= c->max_passthrough_size) {
+		deflate_count_passthrough(c, in_nbytes);
+		deflate_write_uncompressed_blocks(&os, in, in_nbytes, is_final);
+	} else {
+		deflate_load_history(c, in, history_nbytes, in + in_nbytes);
+		(*c->impl)(c, in, in_nbytes, is_final, &os);
+		/*
+		 * A non-final piece ends with an empty uncompressed block, which
+		 * aligns the output to a byte boundary, like a zlib sync flush.
+		 */
+		if (!is_final && !os.overflow)
+			deflate_write_uncompressed_blocks(&os, in + in_nbytes,
+							  0, false);
+	}
+	if (os.overflow)
+		return 0;
+	ASSERT(os.bitcount <= 7);
+	if (os.bitcount) {
+		ASSERT(os.next < os.end);
+		*os.next++ = os.bitbuf;
+	}
+	return os.next - out;
 }
 
 /*
- * This is the "near-optimal" DEFLATE compressor.  It computes the optimal
- * representation of each DEFLATE block using a minimum-cost path search over
- * the graph of possible match/literal choices for that block, assuming a
- * certain cost for each Huffman symbol.
- *
- * For several reasons, the end result is not guaranteed to be optimal:
- *
- * - Nonoptimal choice of blocks
- * - Heuristic limitations on which matches are actually considered
- * - Symbol costs are unknown until the symbols have already been chosen
- *   (so iterative optimization must be used)
+ * Compress @in with the preset dictionary @dict, whose matchfinder state has
+ * been precomputed in @pd if it isn't NULL.
  */
-static void
-deflate_compress_near_optimal(struct libdeflate_compressor * restrict c,
-			      const u8 *in, size_t in_nbytes,
-			      struct deflate_output_bitstream *os)
+static size_t
+deflate_compress_with_dict(struct libdeflate_compressor *c,
+			   const u8 *dict, size_t dict_nbytes,
+			   const struct libdeflate_compression_dict *pd,
+			   const u8 *in, size_t in_nbytes,
+			   u8 *out, size_t out_nbytes_avail)
 {
-	const u8 *in_next = in;
-	const u8 *in_block_begin = in_next;
-	const u8 *in_end = in_next + in_nbytes;
-	const u8 *in_cur_base = in_next;
-	const u8 *in_next_slide =
-		in_next + MIN(in_end - in_next, MATCHFINDER_WINDOW_SIZE);
-	unsigned max_len = DEFLATE_MAX_MATCH_LEN;
-	unsigned nice_len = MIN(c->nice_match_length, max_len);
-	struct lz_match *cache_ptr = c->p.n.match_cache;
-	u32 next_hashes[2] = {0, 0};
-	bool prev_block_used_only_literals = false;
+	struct deflate_output_bitstream os;
+	size_t head_nbytes = MIN(in_nbytes, DICT_HEAD_LENGTH);
+	size_t tail_nbytes;
+	u8 *buf_in;
 
-	bt_matchfinder_init(&c->p.n.bt_mf);
-	deflate_near_optimal_init_stats(c);
+	STATIC_ASSERT(DICT_HEAD_LENGTH >= MATCHFINDER_WINDOW_SIZE);
 
-	do {
-		/* Starting a new DEFLATE block */
-		const u8 * const in_max_block_end = choose_max_block_end(
-				in_block_begin, in_end, SOFT_MAX_BLOCK_LENGTH);
-		const u8 *prev_end_block_check = NULL;
-		bool change_detected = false;
-		const u8 *next_observation = in_next;
-		unsigned min_len;
+	/* Only the last window of the dictionary can be referenced. */
+	if (dict_nbytes > MATCHFINDER_WINDOW_SIZE) {
+		dict += dict_nbytes - MATCHFINDER_WINDOW_SIZE;
+		dict_nbytes = MATCHFINDER_WINDOW_SIZE;
+	}
+	if (c->impl == NULL || in_nbytes == 0 || dict_nbytes == 0)
+		return libdeflate_deflate_compress(c, in, in_nbytes,
+						   out, out_nbytes_avail);
+	if (c->dict_buf == NULL) {
+		c->dict_buf = (*c->malloc_func)(MATCHFINDER_WINDOW_SIZE +
+						DICT_HEAD_LENGTH);
+		if (c->dict_buf == NULL)
+			return 0;
+	}
 
-		/*
-		 * Use the minimum match length heuristic to improve the
-		 * literal/match statistics gathered during matchfinding.
-		 * However, the actual near-optimal parse won't respect min_len,
-		 * as it can accurately assess the costs of different matches.
-		 *
-		 * If the "use only literals" strategy happened to be the best
-		 * strategy on the previous block, then probably the
-		 * min_match_len heuristic is still not aggressive enough for
-		 * the data, so force gathering literal stats only.
-		 */
-		if (prev_block_used_only_literals)
-			min_len = DEFLATE_MAX_MATCH_LEN + 1;
-		else
-			min_len = calculate_min_match_len(
-					in_block_begin,
-					in_max_block_end - in_block_begin,
-					c->max_search_depth);
+	/* Make the dictionary and the start of the input contiguous. */
+	memcpy(c->dict_buf, dict, dict_nbytes);
+	buf_in = &c->dict_buf[dict_nbytes];
+	memcpy(buf_in, in, head_nbytes);
 
-		/*
-		 * Find matches until we decide to end the block.  We end the
-		 * block if any of the following is true:
-		 *
-		 * (1) Maximum block length has been reached
-		 * (2) Match catch may overflow.
-		 * (3) Block split heuristic says to split now.
-		 */
-		for (;;) {
-			struct lz_match *matches;
-			unsigned best_len;
-			size_t remaining = in_end - in_next;
+	/*
+	 * Insert the dictionary into the matchfinder, except for the last few
+	 * bytes, using the precomputed state if possible.  This doesn't depend
+	 * on the input, so it's the same as what was precomputed.
+	 */
+	tail_nbytes = MIN(dict_nbytes, DICT_TAIL_LENGTH);
+	if (pd != NULL && pd->mf_size != 0 && pd->impl == c->impl &&
+	    pd->max_search_depth == c->max_search_depth &&
+	    pd->nice_match_length == c->nice_match_length &&
+	    pd->window_size == c->mf_window_size) {
+		size_t mf_size;
+		mf_pos_t *mf = deflate_get_matchfinder(c, &mf_size);
+
+		memcpy(mf, pd->mf, mf_size);
+		c->mf_pending = pd->mf_pending;
+		c->mf_pos = pd->mf_pos;
+		c->mf_next_hashes[0] = pd->mf_next_hashes[0];
+		c->mf_next_hashes[1] = pd->mf_next_hashes[1];
+		c->mf_order_reduction = 0;
+		c->mf_resume = true;
+	} else {
+		c->mf_resume = false;
+		deflate_insert_history(c, c->dict_buf, buf_in - tail_nbytes,
+				       buf_in);
+	}
+	/* Insert the rest, now that it's known what follows. */
+	deflate_insert_history(c, buf_in - tail_nbytes, buf_in,
+			       buf_in + head_nbytes);
 
-			/* Slide the window forward if needed. */
-			if (in_next == in_next_slide) {
-				bt_matchfinder_slide_window(&c->p.n.bt_mf);
-				in_cur_base = in_next;
-				in_next_slide = in_next +
-					MIN(remaining, MATCHFINDER_WINDOW_SIZE);
-			}
+	os.bitbuf = 0;
+	os.bitcount = 0;
+	os.next = out;
+	os.end = os.next + out_nbytes_avail;
+	os.overflow = false;
+	os.fit_end = NULL;
+
+	(*c->impl)(c, buf_in, head_nbytes, head_nbytes == in_nbytes, &os);
+	if (head_nbytes != in_nbytes && !os.overflow) {
+		deflate_load_history(c, in + head_nbytes, head_nbytes,
+				     in + in_nbytes);
+		(*c->impl)(c, in + head_nbytes, in_nbytes - head_nbytes, true,
+			   &os);
+	}
+	if (os.overflow)
+		return 0;
+	ASSERT(os.bitcount <= 7);
+	if (os.bitcount) {
+		ASSERT(os.next < os.end);
+		*os.next++ = os.bitbuf;
+	}
+	return os.next - out;
+}
 
-			/*
-			 * Find matches with the current position using the
-			 * binary tree matchfinder and save them in match_cache.
-			 *
-			 * Note: the binary tree matchfinder is more suited for
-			 * optimal parsing than the hash chain matchfinder.  The
-			 * reasons for this include:
-			 *
-			 * - The binary tree matchfinder can find more matches
-			 *   in the same number of steps.
-			 * - One of the major advantages of hash chains is that
-			 *   skipping positions (not searching for matches at
-			 *   them) is faster; however, with optimal parsing we
-			 *   search for matches at almost all positions, so this
-			 *   advantage of hash chains is negated.
-			 */
-			matches = cache_ptr;
-			best_len = 0;
-			adjust_max_and_nice_len(&max_len, &nice_len, remaining);
-			if (likely(max_len >= BT_MATCHFINDER_REQUIRED_NBYTES)) {
-				cache_ptr = bt_matchfinder_get_matches(
-						&c->p.n.bt_mf,
-						in_cur_base,
-						in_next - in_cur_base,
-						max_len,
-						nice_len,
-						c->max_search_depth,
-						next_hashes,
-						matches);
-				if (cache_ptr > matches)
-					best_len = cache_ptr[-1].length;
-			}
-			if (in_next >= next_observation) {
-				if (best_len >= min_len) {
-					observe_match(&c->split_stats,
-						      best_len);
-					next_observation = in_next + best_len;
-					c->p.n.new_match_len_freqs[best_len]++;
-				} else {
-					observe_literal(&c->split_stats,
-							*in_next);
-					next_observation = in_next + 1;
-				}
-			}
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_with_dict(struct libdeflate_compressor *c,
+				      const void *dict, size_t dict_nbytes,
+				      const void *in, size_t in_nbytes,
+				      void *out, size_t out_nbytes_avail)
+{
+	return deflate_compress_with_dict(c, dict, dict_nbytes, NULL,
+					  in, in_nbytes, out, out_nbytes_avail);
+}
 
-			cache_ptr->length = cache_ptr - matches;
-			cache_ptr->offset = *in_next;
-			in_next++;
-			cache_ptr++;
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_with_prepared_dict(
+			struct libdeflate_compressor *c,
+			const struct libdeflate_compression_dict *pd,
+			const void *in, size_t in_nbytes,
+			void *out, size_t out_nbytes_avail)
+{
+	return deflate_compress_with_dict(c, pd->window, pd->window_nbytes, pd,
+					  in, in_nbytes, out, out_nbytes_avail);
+}
 
-			/*
-			 * If there was a very long match found, don't cache any
-			 * matches for the bytes covered by that match.  This
-			 * avoids degenerate behavior when compressing highly
-			 * redundant data, where the number of matches can be
-			 * very large.
-			 *
-			 * This heuristic doesn't actually hurt the compression
-			 * ratio very much.  If there's a long match, then the
-			 * data must be highly compressible, so it doesn't
-			 * matter much what we do.
-			 */
-			if (best_len >= DEFLATE_MIN_MATCH_LEN &&
-			    best_len >= nice_len) {
-				--best_len;
-				do {
-					remaining = in_end - in_next;
-					if (in_next == in_next_slide) {
-						bt_matchfinder_slide_window(
-							&c->p.n.bt_mf);
-						in_cur_base = in_next;
-						in_next_slide = in_next +
-							MIN(remaining,
-							    MATCHFINDER_WINDOW_SIZE);
-					}
-					adjust_max_and_nice_len(&max_len,
-								&nice_len,
-								remaining);
-					if (max_len >=
-					    BT_MATCHFINDER_REQUIRED_NBYTES) {
-						bt_matchfinder_skip_byte(
-							&c->p.n.bt_mf,
-							in_cur_base,
-							in_next - in_cur_base,
-							nice_len,
-							c->max_search_depth,
-							next_hashes);
-					}
-					cache_ptr->length = 0;
-					cache_ptr->offset = *in_next;
-					in_next++;
-					cache_ptr++;
-				} while (--best_len);
-			}
-			/* Maximum block length or end of input reached? */
-			if (in_next >= in_max_block_end)
-				break;
-			/* Match cache overflowed? */
-			if (cache_ptr >=
-			    &c->p.n.match_cache[MATCH_CACHE_LENGTH])
-				break;
-			/* Not ready to try to end the block (again)? */
-			if (!ready_to_check_block(&c->split_stats,
-						  in_block_begin, in_next,
-						  in_end))
-				continue;
-			/* Check if it would be worthwhile to end the block. */
-			if (do_end_block_check(&c->split_stats,
-					       in_next - in_block_begin)) {
-				change_detected = true;
-				break;
-			}
-			/* Ending the block doesn't seem worthwhile here. */
-			deflate_near_optimal_merge_stats(c);
-			prev_end_block_check = in_next;
-		}
-		/*
-		 * All the matches for this block have been cached.  Now choose
-		 * the precise end of the block and the sequence of items to
-		 * output to represent it, then flush the block.
-		 */
-		if (change_detected && prev_end_block_check != NULL) {
-			/*
-			 * The block is being ended because a recent chunk of
-			 * data differs from the rest of the block.  We could
-			 * end the block at 'in_next' like the greedy and lazy
-			 * compressors do, but that's not ideal since it would
-			 * include the differing chunk in the block.  The
-			 * near-optimal compressor has time to do a better job.
-			 * Therefore, we rewind to just before the chunk, and
-			 * output a block that only goes up to there.
-			 *
-			 * We then set things up to correctly start the next
-			 * block, considering that some work has already been
-			 * done on it (some matches found and stats gathered).
-			 */
-			struct lz_match *orig_cache_ptr = cache_ptr;
-			const u8 *in_block_end = prev_end_block_check;
-			u32 block_length = in_block_end - in_block_begin;
-			bool is_first = (in_block_begin == in);
-			bool is_final = false;
-			u32 num_bytes_to_rewind = in_next - in_block_end;
-			size_t cache_len_rewound;
+LIBDEFLATEAPI struct libdeflate_compression_dict *
+libdeflate_prepare_compression_dict(struct libdeflate_compressor *c,
+				    const void *dict, size_t dict_nbytes)
+{
+	struct libdeflate_compression_dict *pd;
+	size_t window_nbytes = MIN(dict_nbytes, MATCHFINDER_WINDOW_SIZE);
+	size_t tail_nbytes = MIN(window_nbytes, DICT_TAIL_LENGTH);
+	size_t mf_size = 0;
+	mf_pos_t *mf = NULL;
+	u8 *p;
+
+	if (c->impl != NULL)
+		mf = deflate_get_matchfinder(c, &mf_size);
+	if (dict_nbytes > SIZE_MAX - sizeof(*pd) - mf_size)
+		return NULL;
+	pd = (*c->malloc_func)(sizeof(*pd) + mf_size + dict_nbytes);
+	if (pd == NULL)
+		return NULL;
+	p = &pd->mf[mf_size];
+	if (dict_nbytes)
+		memcpy(p, dict, dict_nbytes);
+	pd->impl = c->impl;
+	pd->max_search_depth = c->max_search_depth;
+	pd->nice_match_length = c->nice_match_length;
+	pd->window_size = c->mf_window_size;
+	pd->free_func = c->free_func;
+	pd->dict = p;
+	pd->dict_nbytes = dict_nbytes;
+	pd->window = p + dict_nbytes - window_nbytes;
+	pd->window_nbytes = window_nbytes;
+	pd->mf_size = mf_size;
 
-			/* Rewind the match cache. */
-			do {
-				cache_ptr--;
-				cache_ptr -= cache_ptr->length;
-			} while (--num_bytes_to_rewind);
-			cache_len_rewound = orig_cache_ptr - cache_ptr;
+	/*
+	 * Use the compressor to compute the matchfinder state, then save it.
+	 * This is like what deflate_compress_with_dict() does.
+	 */
+	if (mf != NULL) {
+		c->mf_resume = false;
+		deflate_insert_history(c, pd->window,
+				       pd->window + window_nbytes - tail_nbytes,
+				       pd->window + window_nbytes);
+		memcpy(pd->mf, mf, mf_size);
+		pd->mf_pending = c->mf_pending;
+		pd->mf_pos = c->mf_pos;
+		pd->mf_next_hashes[0] = c->mf_next_hashes[0];
+		pd->mf_next_hashes[1] = c->mf_next_hashes[1];
+	}
+	return pd;
+}
 
-			deflate_optimize_and_flush_block(
-						c, os, in_block_begin,
-						block_length, cache_ptr,
-						is_first, is_final,
-						&prev_block_used_only_literals);
-			memmove(c->p.n.match_cache, cache_ptr,
-				cache_len_rewound * sizeof(*cache_ptr));
-			cache_ptr = &c->p.n.match_cache[cache_len_rewound];
-			deflate_near_optimal_save_stats(c);
-			/*
-			 * Clear the stats for the just-flushed block, leaving
-			 * just the stats for the beginning of the next block.
-			 */
-			deflate_near_optimal_clear_old_stats(c);
-			in_block_begin = in_block_end;
-		} else {
-			/*
-			 * The block is being ended for a reason other than a
-			 * differing data chunk being detected.  Don't rewind at
-			 * all; just end the block at the current position.
-			 */
-			u32 block_length = in_next - in_block_begin;
-			bool is_first = (in_block_begin == in);
-			bool is_final = (in_next == in_end);
+LIBDEFLATEAPI void
+libdeflate_free_compression_dict(struct libdeflate_compression_dict *pd)
+{
+	if (pd)
+		(*pd->free_func)(pd);
+}
 
-			deflate_near_optimal_merge_stats(c);
-			deflate_optimize_and_flush_block(
-						c, os, in_block_begin,
-						block_length, cache_ptr,
-						is_first, is_final,
-						&prev_block_used_only_literals);
-			cache_ptr = &c->p.n.match_cache[0];
-			deflate_near_optimal_save_stats(c);
-			deflate_near_optimal_init_stats(c);
-			in_block_begin = in_next;
-		}
-	} while (in_next != in_end && !os->overflow);
+void
+libdeflate_get_compression_dict(const struct libdeflate_compression_dict *pd,
+				const void **dict_ret, size_t *dict_nbytes_ret)
+{
+	*dict_ret = pd->dict;
+	*dict_nbytes_ret = pd->dict_nbytes;
 }
 
-/* Initialize c->p.n.offset_slot_full. */
+/*
+ * Scale down the @num_syms symbol frequencies in @freqs if needed so that they
+ * sum to about MAX_BLOCK_LENGTH at most, like the frequencies of a block do.
+ * Frequencies that are nonzero stay nonzero.
+ */
 static void
-deflate_init_offset_slot_full(struct libdeflate_compressor *c)
+deflate_scale_freqs(u32 freqs[], unsigned num_syms)
 {
-	unsigned offset_slot;
-	unsigned offset;
-	unsigned offset_end;
+	u64 total = 0;
+	unsigned sym;
 
-	for (offset_slot = 0; offset_slot < ARRAY_LEN(deflate_offset_slot_base);
-	     offset_slot++) {
-		offset = deflate_offset_slot_base[offset_slot];
-		offset_end = offset +
-			     (1 << deflate_extra_offset_bits[offset_slot]);
-		do {
-			c->p.n.offset_slot_full[offset] = offset_slot;
-		} while (++offset != offset_end);
+	for (sym = 0; sym < num_syms; sym++)
+		total += freqs[sym];
+	if (total <= MAX_BLOCK_LENGTH)
+		return;
+	for (sym = 0; sym < num_syms; sym++) {
+		if (freqs[sym] != 0)
+			freqs[sym] = MAX(1, (u64)freqs[sym] *
+					    MAX_BLOCK_LENGTH / total);
 	}
 }
 
-#endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
+/*
+ * Generate the dynamic Huffman block header for the codes in @table into
+ * @table->header, using @c's scratch space.
+ */
+static void
+deflate_generate_huffman_table_header(struct libdeflate_compressor *c,
+				      struct libdeflate_huffman_table *table)
+{
+	struct deflate_output_bitstream header_os;
+	const struct deflate_output_bitstream *os = &header_os;
+	bitbuf_t bitbuf = 0;
+	unsigned bitcount = 0;
+	u8 *out_next = table->header;
+	u8 * const out_fast_end = table->header + sizeof(table->header) -
+				  (WORDBYTES - 1);
+	const bool out_unchecked = false;
+
+	header_os.end = table->header + sizeof(table->header);
+	memset(table->header, 0, sizeof(table->header));
+
+	c->codes = table->codes;
+	deflate_precompute_huffman_header(c);
+	WRITE_HUFFMAN_HEADER(c);
 
-LIBDEFLATEAPI struct libdeflate_compressor *
-libdeflate_alloc_compressor_ex(int compression_level,
-			       const struct libdeflate_options *options)
+	ASSERT(bitcount <= 7);
+	table->header_nbits = 8 * (out_next - table->header) + bitcount;
+	ASSERT(table->header_nbits <= MAX_HUFFMAN_HEADER_NBITS);
+	*out_next = bitbuf;
+}
+
+LIBDEFLATEAPI struct libdeflate_huffman_table *
+libdeflate_train_huffman_table(struct libdeflate_compressor *c,
+			       const void * const samples[],
+			       const size_t sample_nbytes[],
+			       size_t num_samples)
 {
-	struct libdeflate_compressor *c;
-	size_t size = offsetof(struct libdeflate_compressor, p);
+	struct libdeflate_huffman_table *table;
+	struct deflate_freqs freqs;
+	struct libdeflate_compress_stats saved_stats;
+	size_t max_nbytes = 0;
+	size_t out_nbytes_avail;
+	u8 *out;
+	size_t i;
 
-	check_buildtime_parameters();
+	/* The ultrafast compressor only ever uses the static codes. */
+	if (c->impl == NULL || c->impl == deflate_compress_ultrafast)
+		return NULL;
+	for (i = 0; i < num_samples; i++)
+		max_nbytes = MAX(max_nbytes, sample_nbytes[i]);
+	table = (*c->malloc_func)(sizeof(*table));
+	if (table == NULL)
+		return NULL;
+	out_nbytes_avail = libdeflate_deflate_compress_bound(c, max_nbytes);
+	out = (*c->malloc_func)(out_nbytes_avail);
+	if (out == NULL) {
+		(*c->free_func)(table);
+		return NULL;
+	}
 
 	/*
-	 * Note: if more fields are added to libdeflate_options, this code will
-	 * need to be updated to support both the old and new structs.
+	 * Compress each sample, collecting the frequencies of the symbols that
+	 * the compressor chooses.  Samples too short to be compressed at all
+	 * are counted as literals.
 	 */
-	if (options->sizeof_options != sizeof(*options))
-		return NULL;
+	memset(&freqs, 0, sizeof(freqs));
+	saved_stats = c->stats;
+	c->train_freqs = &freqs;
+	for (i = 0; i < num_samples; i++) {
+		const u8 *sample = samples[i];
+
+		if (sample_nbytes[i] <= c->max_passthrough_size) {
+			deflate_count_literals(freqs.litlen, sample,
+					       sample_nbytes[i]);
+		} else {
+			libdeflate_deflate_compress(c, sample, sample_nbytes[i],
+						    out, out_nbytes_avail);
+		}
+	}
+	c->train_freqs = NULL;
+	/* Training isn't compression as far as the statistics are concerned. */
+	c->stats = saved_stats;
+	(*c->free_func)(out);
+
+	freqs.litlen[DEFLATE_END_OF_BLOCK] =
+		MAX(freqs.litlen[DEFLATE_END_OF_BLOCK], 1);
+	deflate_scale_freqs(freqs.litlen, DEFLATE_NUM_LITLEN_SYMS);
+	deflate_scale_freqs(freqs.offset, DEFLATE_NUM_OFFSET_SYMS);
+	deflate_make_huffman_codes(&freqs, &table->codes);
+	deflate_generate_huffman_table_header(c, table);
+	table->free_func = c->free_func;
+	return table;
+}
 
-	if (compression_level < 0 || compression_level > 12)
-		return NULL;
+LIBDEFLATEAPI void
+libdeflate_set_huffman_table(struct libdeflate_compressor *c,
+			     const struct libdeflate_huffman_table *table)
+{
+	c->huffman_table = table;
+}
+
+LIBDEFLATEAPI void
+libdeflate_free_huffman_table(struct libdeflate_huffman_table *table)
+{
+	if (table)
+		(*table->free_func)(table);
+}
 
+LIBDEFLATEAPI struct libdeflate_cost_model *
+libdeflate_save_cost_model(struct libdeflate_compressor *c)
+{
 #if SUPPORT_NEAR_OPTIMAL_PARSING
-	if (compression_level >= 10)
-		size += sizeof(c->p.n);
-	else
-#endif
-	{
-		if (compression_level >= 2)
-			size += sizeof(c->p.g);
-		else if (compression_level == 1)
-			size += sizeof(c->p.f);
-	}
+	struct libdeflate_cost_model *model;
 
-	c = libdeflate_aligned_malloc(options->malloc_func ?
-				      options->malloc_func :
-				      libdeflate_default_malloc_func,
-				      MATCHFINDER_MEM_ALIGNMENT, size);
-	if (!c)
+	if (c->impl != deflate_compress_near_optimal || !c->p.n.have_costs)
 		return NULL;
-	c->free_func = options->free_func ?
-		       options->free_func : libdeflate_default_free_func;
-
-	c->compression_level = compression_level;
+	model = (*c->malloc_func)(sizeof(*model));
+	if (model == NULL)
+		return NULL;
+	model->free_func = c->free_func;
+	model->costs = c->p.n.costs;
+	memcpy(model->observations, c->p.n.prev_observations,
+	       sizeof(model->observations));
+	model->num_observations = c->p.n.prev_num_observations;
+	return model;
+#else
+	return NULL;
+#endif
+}
 
-	/*
-	 * The higher the compression level, the more we should bother trying to
-	 * compress very small inputs.
-	 */
-	c->max_passthrough_size = 55 - (compression_level * 4);
+LIBDEFLATEAPI void
+libdeflate_set_cost_model(struct libdeflate_compressor *c,
+			  const struct libdeflate_cost_model *model)
+{
+	c->cost_model = model;
+}
 
-	switch (compression_level) {
-	case 0:
-		c->max_passthrough_size = SIZE_MAX;
-		c->impl = NULL; /* not used */
-		break;
-	case 1:
-		c->impl = deflate_compress_fastest;
-		/* max_search_depth is unused. */
-		c->nice_match_length = 32;
-		break;
-	case 2:
-		c->impl = deflate_compress_greedy;
-		c->max_search_depth = 6;
-		c->nice_match_length = 10;
-		break;
-	case 3:
-		c->impl = deflate_compress_greedy;
-		c->max_search_depth = 12;
-		c->nice_match_length = 14;
-		break;
-	case 4:
-		c->impl = deflate_compress_greedy;
-		c->max_search_depth = 16;
-		c->nice_match_length = 30;
-		break;
-	case 5:
-		c->impl = deflate_compress_lazy;
-		c->max_search_depth = 16;
-		c->nice_match_length = 30;
-		break;
-	case 6:
-		c->impl = deflate_compress_lazy;
-		c->max_search_depth = 35;
-		c->nice_match_length = 65;
-		break;
-	case 7:
-		c->impl = deflate_compress_lazy;
-		c->max_search_depth = 100;
-		c->nice_match_length = 130;
-		break;
-	case 8:
-		c->impl = deflate_compress_lazy2;
-		c->max_search_depth = 300;
-		c->nice_match_length = DEFLATE_MAX_MATCH_LEN;
-		break;
-	case 9:
-#if !SUPPORT_NEAR_OPTIMAL_PARSING
-	default:
-#endif
-		c->impl = deflate_compress_lazy2;
-		c->max_search_depth = 600;
-		c->nice_match_length = DEFLATE_MAX_MATCH_LEN;
-		break;
+LIBDEFLATEAPI void
+libdeflate_free_cost_model(struct libdeflate_cost_model *model)
+{
 #if SUPPORT_NEAR_OPTIMAL_PARSING
-	case 10:
-		c->impl = deflate_compress_near_optimal;
-		c->max_search_depth = 35;
-		c->nice_match_length = 75;
-		c->p.n.max_optim_passes = 2;
-		c->p.n.min_improvement_to_continue = 32;
-		c->p.n.min_bits_to_use_nonfinal_path = 32;
-		c->p.n.max_len_to_optimize_static_block = 0;
-		deflate_init_offset_slot_full(c);
-		break;
-	case 11:
-		c->impl = deflate_compress_near_optimal;
-		c->max_search_depth = 100;
-		c->nice_match_length = 150;
-		c->p.n.max_optim_passes = 4;
-		c->p.n.min_improvement_to_continue = 16;
-		c->p.n.min_bits_to_use_nonfinal_path = 16;
-		c->p.n.max_len_to_optimize_static_block = 1000;
-		deflate_init_offset_slot_full(c);
-		break;
-	case 12:
-	default:
-		c->impl = deflate_compress_near_optimal;
-		c->max_search_depth = 300;
-		c->nice_match_length = DEFLATE_MAX_MATCH_LEN;
-		c->p.n.max_optim_passes = 10;
-		c->p.n.min_improvement_to_continue = 1;
-		c->p.n.min_bits_to_use_nonfinal_path = 1;
-		c->p.n.max_len_to_optimize_static_block = 10000;
-		deflate_init_offset_slot_full(c);
-		break;
-#endif /* SUPPORT_NEAR_OPTIMAL_PARSING */
+	if (model)
+		(*model->free_func)(model);
+#endif
+}
+
+/*
+ * Compress the data in the stream buffer that hasn't been compressed yet,
+ * continuing the output bitstream @os.  Afterwards, keep only the last
+ * STREAM_HISTORY_LENGTH bytes in the buffer, as history for the next piece.
+ */
+static void
+deflate_compress_stream_piece(struct libdeflate_compressor *c,
+			      struct deflate_stream *s,
+			      struct deflate_output_bitstream *os,
+			      bool is_final)
+{
+	const u8 *in = &s->buf[s->history_nbytes];
+	size_t in_nbytes = s->buf_nbytes - s->history_nbytes;
+
+	if (in_nbytes <= c->max_passthrough_size) {
+		deflate_count_passthrough(c, in_nbytes);
+		deflate_write_uncompressed_blocks(os, in, in_nbytes, is_final);
+		c->mf_resume = false;
+	} else {
+		(*c->impl)(c, in, in_nbytes, is_final, os);
+		c->mf_resume = true;
+	}
+	if (os->overflow) {
+		s->failed = true;
+		return;
 	}
+	if (s->buf_nbytes > STREAM_HISTORY_LENGTH) {
+		memmove(s->buf, &s->buf[s->buf_nbytes - STREAM_HISTORY_LENGTH],
+			STREAM_HISTORY_LENGTH);
+		s->buf_nbytes = STREAM_HISTORY_LENGTH;
+	}
+	s->history_nbytes = s->buf_nbytes;
+}
+
+static void
+deflate_begin_stream_output(const struct deflate_stream *s,
+			    struct deflate_output_bitstream *os,
+			    void *out, size_t out_nbytes_avail)
+{
+	os->bitbuf = s->bitbuf;
+	os->bitcount = s->bitcount;
+	os->next = out;
+	os->end = os->next + out_nbytes_avail;
+	os->overflow = false;
+	os->fit_end = NULL;
+}
 
-	deflate_init_static_codes(c);
+/*
+ * Get the compressor's stream state, allocating it if needed, and reset it.
+ * This abandons any stream in progress.  Return NULL if out of memory.
+ */
+static struct deflate_stream *
+deflate_reset_stream(struct libdeflate_compressor *c)
+{
+	struct deflate_stream *s = c->stream;
 
-	return c;
+	if (s == NULL) {
+		s = (*c->malloc_func)(sizeof(*s));
+		if (s == NULL)
+			return NULL;
+		c->stream = s;
+	}
+	s->bitbuf = 0;
+	s->bitcount = 0;
+	s->history_nbytes = 0;
+	s->buf_nbytes = 0;
+	s->failed = false;
+	c->mf_resume = false;
+	return s;
 }
 
+LIBDEFLATEAPI int
+libdeflate_deflate_compress_stream_begin(struct libdeflate_compressor *c)
+{
+	return deflate_reset_stream(c) != NULL ? 0 : -1;
+}
 
-LIBDEFLATEAPI struct libdeflate_compressor *
-libdeflate_alloc_compressor(int compression_level)
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_compress_stream_update(struct libdeflate_compressor *c,
+					  const void *in, size_t in_nbytes,
+					  void *out, size_t out_nbytes_avail,
+					  size_t *actual_out_nbytes_ret)
 {
-	static const struct libdeflate_options defaults = {
-		.sizeof_options = sizeof(defaults),
-	};
-	return libdeflate_alloc_compressor_ex(compression_level, &defaults);
+	struct deflate_stream *s = c->stream;
+	const u8 *in_next = in;
+	struct deflate_output_bitstream os;
+
+	*actual_out_nbytes_ret = 0;
+	if (s == NULL || s->failed)
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+
+	deflate_begin_stream_output(s, &os, out, out_nbytes_avail);
+	while (in_nbytes) {
+		size_t n = MIN(in_nbytes, sizeof(s->buf) - s->buf_nbytes);
+
+		memcpy(&s->buf[s->buf_nbytes], in_next, n);
+		s->buf_nbytes += n;
+		in_next += n;
+		in_nbytes -= n;
+		if (s->buf_nbytes == sizeof(s->buf)) {
+			deflate_compress_stream_piece(c, s, &os, false);
+			if (s->failed)
+				return LIBDEFLATE_INSUFFICIENT_SPACE;
+		}
+	}
+	/* Keep any partial byte until more bits have been added to it. */
+	ASSERT(os.bitcount <= 7);
+	s->bitbuf = os.bitbuf;
+	s->bitcount = os.bitcount;
+	*actual_out_nbytes_ret = os.next - (u8 *)out;
+	return LIBDEFLATE_SUCCESS;
 }
 
-LIBDEFLATEAPI size_t
-libdeflate_deflate_compress(struct libdeflate_compressor *c,
-			    const void *in, size_t in_nbytes,
-			    void *out, size_t out_nbytes_avail)
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_compress_stream_finish(struct libdeflate_compressor *c,
+					  void *out, size_t out_nbytes_avail,
+					  size_t *actual_out_nbytes_ret)
+{
+	struct deflate_stream *s = c->stream;
+	struct deflate_output_bitstream os;
+
+	*actual_out_nbytes_ret = 0;
+	if (s == NULL || s->failed)
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+
+	deflate_begin_stream_output(s, &os, out, out_nbytes_avail);
+	deflate_compress_stream_piece(c, s, &os, true);
+	if (s->failed)
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+
+	/* Write the final byte if needed. */
+	ASSERT(os.bitcount <= 7);
+	if (os.bitcount) {
+		if (os.next == os.end) {
+			s->failed = true;
+			return LIBDEFLATE_INSUFFICIENT_SPACE;
+		}
+		*os.next++ = os.bitbuf;
+	}
+	/* The stream is complete; another one must be begun explicitly. */
+	s->failed = true;
+	*actual_out_nbytes_ret = os.next - (u8 *)out;
+	return LIBDEFLATE_SUCCESS;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_compress_stream_flush(struct libdeflate_compressor *c,
+					 int full_flush,
+					 void *out, size_t out_nbytes_avail,
+					 size_t *actual_out_nbytes_ret)
 {
+	struct deflate_stream *s = c->stream;
 	struct deflate_output_bitstream os;
 
+	*actual_out_nbytes_ret = 0;
+	if (s == NULL || s->failed)
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+
+	deflate_begin_stream_output(s, &os, out, out_nbytes_avail);
+	if (s->buf_nbytes > s->history_nbytes) {
+		deflate_compress_stream_piece(c, s, &os, false);
+		if (s->failed)
+			return LIBDEFLATE_INSUFFICIENT_SPACE;
+	}
 	/*
-	 * For extremely short inputs, or for compression level 0, just output
-	 * uncompressed blocks.
+	 * End with an empty uncompressed block, which aligns the output to a
+	 * byte boundary and makes all the data so far decodable.
 	 */
-	if (unlikely(in_nbytes <= c->max_passthrough_size))
-		return deflate_compress_none(in, in_nbytes,
-					     out, out_nbytes_avail);
+	deflate_write_uncompressed_blocks(&os, s->buf, 0, false);
+	if (os.overflow) {
+		s->failed = true;
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+	}
+	s->bitbuf = 0;
+	s->bitcount = 0;
+	if (full_flush) {
+		/* Later matches mustn't refer to the data so far. */
+		s->history_nbytes = 0;
+		s->buf_nbytes = 0;
+		c->mf_resume = false;
+	}
+	*actual_out_nbytes_ret = os.next - (u8 *)out;
+	return LIBDEFLATE_SUCCESS;
+}
 
-	/* Initialize the output bitstream structure. */
-	os.bitbuf = 0;
-	os.bitcount = 0;
-	os.next = out;
-	os.end = os.next + out_nbytes_avail;
-	os.overflow = false;
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_stream_bound(struct libdeflate_compressor *c,
+					 size_t in_nbytes)
+{
+	/*
+	 * A call may compress everything that was buffered by previous calls,
+	 * plus the new data.  The reasoning in
+	 * libdeflate_deflate_compress_bound() applies to each piece, except
+	 * that each piece may end with a short block, and a block may need one
+	 * more byte for the bits left over from the previous call.  A flush
+	 * adds an empty block.
+	 */
+	size_t max_nbytes = in_nbytes + MATCHFINDER_WINDOW_SIZE +
+			    STREAM_CHUNK_LENGTH;
+	size_t max_blocks = DIV_ROUND_UP(max_nbytes, MIN_BLOCK_LENGTH) +
+			    DIV_ROUND_UP(max_nbytes, STREAM_CHUNK_LENGTH) + 2;
 
-	/* Call the actual compression function. */
-	(*c->impl)(c, in, in_nbytes, &os);
+	return (6 * max_blocks) + max_nbytes;
+}
 
-	/* Return 0 if the output buffer is too small. */
-	if (os.overflow)
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_iov(struct libdeflate_compressor *c,
+				const struct libdeflate_iovec *iov,
+				size_t iovcnt,
+				void *out, size_t out_nbytes_avail)
+{
+	const struct libdeflate_iovec *last = NULL;
+	size_t num_segments = 0;
+	size_t in_nbytes = 0;
+	struct deflate_stream *s;
+	struct deflate_output_bitstream os;
+	size_t i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].nbytes) {
+			last = &iov[i];
+			num_segments++;
+			in_nbytes += iov[i].nbytes;
+		}
+	}
+
+	/* A single segment can be compressed in place. */
+	if (num_segments <= 1)
+		return libdeflate_deflate_compress(c, last ? last->data : NULL,
+						   in_nbytes,
+						   out, out_nbytes_avail);
+
+	s = deflate_reset_stream(c);
+	if (s == NULL)
 		return 0;
+	/* The stream buffer is being borrowed; no stream is in progress. */
+	s->failed = true;
 
 	/*
-	 * Write the final byte if needed.  This can't overflow the output
-	 * buffer because deflate_flush_block() would have set the overflow flag
-	 * if there wasn't enough space remaining for the full final block.
+	 * If all the data fits in the stream buffer, gather it there and
+	 * compress it normally.  This also lets small inputs use the reduced
+	 * hash table sizes.
+	 */
+	if (in_nbytes <= sizeof(s->buf)) {
+		for (i = 0; i < iovcnt; i++) {
+			if (iov[i].nbytes == 0)
+				continue;
+			memcpy(&s->buf[s->buf_nbytes], iov[i].data,
+			       iov[i].nbytes);
+			s->buf_nbytes += iov[i].nbytes;
+		}
+		return libdeflate_deflate_compress(c, s->buf, in_nbytes,
+						   out, out_nbytes_avail);
+	}
+
+	/*
+	 * Otherwise, compress the data in pieces like the streaming interface
+	 * does.  A piece is compressed only once the buffer is full and more
+	 * data follows, so that only the last piece can be short.  This is
+	 * what libdeflate_deflate_compress_bound() assumes.
 	 */
+	deflate_begin_stream_output(s, &os, out, out_nbytes_avail);
+	for (i = 0; i < iovcnt; i++) {
+		const u8 *in_next = iov[i].data;
+		size_t n = iov[i].nbytes;
+
+		while (n) {
+			size_t len;
+
+			if (s->buf_nbytes == sizeof(s->buf)) {
+				deflate_compress_stream_piece(c, s, &os, false);
+				if (os.overflow)
+					return 0;
+			}
+			len = MIN(n, sizeof(s->buf) - s->buf_nbytes);
+			memcpy(&s->buf[s->buf_nbytes], in_next, len);
+			s->buf_nbytes += len;
+			in_next += len;
+			n -= len;
+		}
+	}
+	deflate_compress_stream_piece(c, s, &os, true);
+	if (os.overflow)
+		return 0;
+
+	/* Write the final byte if needed, as in libdeflate_deflate_compress(). */
 	ASSERT(os.bitcount <= 7);
 	if (os.bitcount) {
 		ASSERT(os.next < os.end);
 		*os.next++ = os.bitbuf;
 	}
-
-	/* Return the compressed size in bytes. */
 	return os.next - (u8 *)out;
 }
 
+LIBDEFLATEAPI void
+libdeflate_get_compress_stats(struct libdeflate_compressor *c,
+			      struct libdeflate_compress_stats *stats)
+{
+	size_t sizeof_stats = stats->sizeof_stats;
+
+	c->stats.num_match_searches = c->mf_counters.num_searches;
+	c->stats.num_match_candidates = c->mf_counters.num_candidates;
+
+	/* Copy only the fields the caller's version of the struct has. */
+	c->stats.sizeof_stats = sizeof_stats;
+	memcpy(stats, &c->stats, MIN(sizeof_stats, sizeof(c->stats)));
+}
+
+LIBDEFLATEAPI void
+libdeflate_reset_compress_stats(struct libdeflate_compressor *c)
+{
+	memset(&c->stats, 0, sizeof(c->stats));
+	memset(&c->mf_counters, 0, sizeof(c->mf_counters));
+}
+
 LIBDEFLATEAPI void
 libdeflate_free_compressor(struct libdeflate_compressor *c)
 {
-	if (c)
+	if (c) {
+		if (c->stream)
+			(*c->free_func)(c->stream);
+		if (c->dict_buf)
+			(*c->free_func)(c->dict_buf);
 		libdeflate_aligned_free(c->free_func, c);
+	}
 }
 
 unsigned int
@@ -4078,6 +8105,37 @@ libdeflate_get_compression_level(struct libdeflate_compressor *c)
 	return c->compression_level;
 }
 
+unsigned int
+libdeflate_get_compression_window_order(struct libdeflate_compressor *c)
+{
+	return bsr32(c->mf_window_size);
+}
+
+void
+libdeflate_begin_input_checksum(struct libdeflate_compressor *c,
+				checksum_func_t func, u32 checksum,
+				const void *in)
+{
+	c->checksum_func = func;
+	c->checksum = checksum;
+	c->checksum_next = in;
+}
+
+u32
+libdeflate_end_input_checksum(struct libdeflate_compressor *c,
+			      const void *in, size_t in_nbytes)
+{
+	size_t done = c->checksum_next - (const u8 *)in;
+	u32 checksum = c->checksum;
+
+	if (in_nbytes > done)
+		checksum = (*c->checksum_func)(checksum,
+					       (const u8 *)in + done,
+					       in_nbytes - done);
+	c->checksum_func = NULL;
+	return checksum;
+}
+
 LIBDEFLATEAPI size_t
 libdeflate_deflate_compress_bound(struct libdeflate_compressor *c,
 				  size_t in_nbytes)
@@ -4117,6 +8175,13 @@ libdeflate_deflate_compress_bound(struct libdeflate_compressor *c,
 	STATIC_ASSERT(2 * MIN_BLOCK_LENGTH <= UINT16_MAX);
 	max_blocks = MAX(DIV_ROUND_UP(in_nbytes, MIN_BLOCK_LENGTH), 1);
 
+	/*
+	 * libdeflate_deflate_compress_iov() may split large inputs into pieces
+	 * of at least STREAM_CHUNK_LENGTH bytes, each of which can end with a
+	 * short block.  Allow one more block for each such piece.
+	 */
+	max_blocks += in_nbytes / STREAM_CHUNK_LENGTH;
+
 	/*
 	 * Each uncompressed block has 5 bytes of overhead, for the BFINAL,
 	 * BTYPE, LEN, and NLEN fields.  (For the reason explained earlier, the
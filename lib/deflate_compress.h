@@ -5,11 +5,51 @@
 
 /*
  * DEFLATE compression is private to deflate_compress.c, but we do need to be
- * able to query the compression level for zlib and gzip header generation.
+ * able to query the compression level, window size, and dictionary for zlib and
+ * gzip header generation, to compute the zlib and gzip checksums while
+ * compressing, and to compress the pieces of a stream that is compressed in
+ * parallel.
  */
 
 struct libdeflate_compressor;
+struct libdeflate_compression_dict;
 
 unsigned int libdeflate_get_compression_level(struct libdeflate_compressor *c);
 
+/* Get the base 2 logarithm of the compressor's window size, from 9 to 15. */
+unsigned int libdeflate_get_compression_window_order(
+					struct libdeflate_compressor *c);
+
+/*
+ * Make the next compression with @c of the input at @in also compute @func,
+ * starting from @checksum, over the input as each block of it is compressed.
+ * Then libdeflate_end_input_checksum() returns the checksum of the first
+ * @in_nbytes bytes of the input (0 if compression failed), computing it over
+ * any part that wasn't covered during compression, and stops computing it.
+ */
+void libdeflate_begin_input_checksum(struct libdeflate_compressor *c,
+				     checksum_func_t func, u32 checksum,
+				     const void *in);
+u32 libdeflate_end_input_checksum(struct libdeflate_compressor *c,
+				  const void *in, size_t in_nbytes);
+
+/* Get the full dictionary that a prepared dictionary was made from. */
+void libdeflate_get_compression_dict(
+			const struct libdeflate_compression_dict *pd,
+			const void **dict_ret, size_t *dict_nbytes_ret);
+
+/*
+ * Compress @in[0..@in_nbytes-1] as one piece of a larger DEFLATE stream,
+ * allowing matches to refer to the @history_nbytes bytes that precede @in in
+ * memory.  The output begins on a byte boundary, and unless @is_final is true
+ * it ends with an empty uncompressed block so that it ends on one too.  So the
+ * pieces can simply be concatenated.  Return the output size, or 0 if it
+ * doesn't fit in @out_nbytes_avail bytes, which it always does when that is at
+ * least libdeflate_deflate_compress_bound(c, in_nbytes) + 5.
+ */
+size_t libdeflate_deflate_compress_piece(struct libdeflate_compressor *c,
+					 const u8 *in, size_t in_nbytes,
+					 size_t history_nbytes, bool is_final,
+					 u8 *out, size_t out_nbytes_avail);
+
 #endif /* LIB_DEFLATE_COMPRESS_H */
@@ -36,13 +36,14 @@
  * - Faster Huffman decoding combined with various DEFLATE-specific tricks
  * - Larger bitbuffer variable that doesn't need to be refilled as often
  * - Other optimizations to remove unnecessary branches
- * - Only full-buffer decompression is supported, so the code doesn't need to
- *   support stopping and resuming decompression.
+ * - The main decompression routine only supports full-buffer decompression,
+ *   so it doesn't need to support stopping and resuming decompression.  The
+ *   streaming interface is implemented separately, on top of the same fastloop.
  * - On x86_64, a version of the decompression routine is compiled with BMI2
  *   instructions enabled and is used automatically at runtime when supported.
  */
 
-#include "lib_common.h"
+#include "deflate_decompress.h"
 #include "deflate_constants.h"
 
 /*
@@ -259,6 +260,7 @@ do {									\
  */
 #define REFILL_BITS_IN_FASTLOOP()					\
 do {									\
+	COUNTER_INC(d->stats.num_fastloop_refills);			\
 	STATIC_ASSERT(UNALIGNED_ACCESS_IS_FAST ||			\
 		      FASTLOOP_PRELOADABLE_NBITS == CONSUMABLE_NBITS);	\
 	if (UNALIGNED_ACCESS_IS_FAST) {					\
@@ -273,12 +275,15 @@ do {									\
 
 /*
  * This is the worst-case maximum number of output bytes that are written to
- * during each iteration of the fastloop.  The worst case is 2 literals, then a
- * match of length DEFLATE_MAX_MATCH_LEN.  Additionally, some slack space must
- * be included for the intentional overrun in the match copy implementation.
+ * during each iteration of the fastloop.  The worst case is 2 literal pair
+ * entries, then a match of length DEFLATE_MAX_MATCH_LEN.  Additionally, some
+ * slack space must be included for the intentional overrun in the match copy
+ * implementation, which also covers the overrun of WRITE_LITERALS().  The
+ * architecture-specific match copy routines (COPY_MATCH) use vectors of up to
+ * 32 bytes, so they may overrun by up to 31 bytes.
  */
 #define FASTLOOP_MAX_BYTES_WRITTEN	\
-	(2 + DEFLATE_MAX_MATCH_LEN + (5 * WORDBYTES) - 1)
+	((2 * 2) + DEFLATE_MAX_MATCH_LEN + MAX(5 * WORDBYTES, 32) - 1)
 
 /*
  * This is the worst-case maximum number of input bytes that are read during
@@ -296,6 +301,28 @@ do {									\
 		      LENGTH_MAXBITS + OFFSET_MAXBITS, 8) +	\
 	 sizeof(bitbuf_t))
 
+/*
+ * With libdeflate_deflate_decompress_padded(), the fastloop runs up to the very
+ * ends of the buffers, so when it stops it may have written past the end of the
+ * output and refilled bits from past the end of the input.  The former means
+ * the output didn't fit.  The latter is undone, unless some of those bits were
+ * consumed, which means the input was truncated.
+ */
+#define LEAVE_FASTLOOP_PADDING()					\
+do {									\
+	if (unlikely(in_next > in_end)) {				\
+		size_t excess = in_next - in_end;			\
+									\
+		bitsleft = (u8)bitsleft;				\
+		SAFETY_CHECK(excess <= (bitsleft >> 3));		\
+		bitsleft -= excess * 8;					\
+		bitbuf &= BITMASK(bitsleft);				\
+		in_next = in_end;					\
+	}								\
+	if (unlikely(out_next > out_end))				\
+		return LIBDEFLATE_INSUFFICIENT_SPACE;			\
+} while (0)
+
 /*****************************************************************************
  *                              Huffman decoding                             *
  *****************************************************************************/
@@ -428,6 +455,9 @@ static const u32 precode_decode_results[] = {
 /* Indicates an end-of-block entry in the litlen decode table */
 #define HUFFDEC_END_OF_BLOCK		0x00002000
 
+/* Indicates a literal entry in the litlen decode table that has 2 literals */
+#define HUFFDEC_2LITERALS		0x00001000
+
 /* Maximum number of bits that can be consumed by decoding a match length */
 #define LENGTH_MAXBITS		(DEFLATE_MAX_LITLEN_CODEWORD_LEN + \
 				 DEFLATE_MAX_EXTRA_LENGTH_BITS)
@@ -444,8 +474,19 @@ static const u32 precode_decode_results[] = {
  *		Bit 15:     0 (!HUFFDEC_EXCEPTIONAL)
  *		Bit 14:     0 (!HUFFDEC_SUBTABLE_POINTER)
  *		Bit 13:     0 (!HUFFDEC_END_OF_BLOCK)
+ *		Bit 12:     0 (!HUFFDEC_2LITERALS)
  *		Bit 11-8:   remaining codeword length [not used]
  *		Bit 3-0:    remaining codeword length
+ *	Literal pairs (main table only):
+ *		Bit 31:     1 (HUFFDEC_LITERAL)
+ *		Bit 30-24:  second literal value, which must be < 128
+ *		Bit 23-16:  first literal value
+ *		Bit 15:     0 (!HUFFDEC_EXCEPTIONAL)
+ *		Bit 14:     0 (!HUFFDEC_SUBTABLE_POINTER)
+ *		Bit 13:     0 (!HUFFDEC_END_OF_BLOCK)
+ *		Bit 12:     1 (HUFFDEC_2LITERALS)
+ *		Bit 11-8:   first codeword length [not used]
+ *		Bit 3-0:    total length of both codewords
  *	Lengths:
  *		Bit 31:     0 (!HUFFDEC_LITERAL)
  *		Bit 24-16:  length base value
@@ -498,6 +539,13 @@ static const u32 precode_decode_results[] = {
  *	  than '& 0xF'.  This value is only used as a shift amount, so this can
  *	  save an 'and' instruction as the masking by 0x3F happens implicitly.
  *
+ *	- A literal pair entry decodes two short literal codewords with one
+ *	  table lookup while still looking like a literal entry, so each lookup
+ *	  in the fastloop's literal path can output two literals.  Bits 31-16 of
+ *	  the entry contain the literals in output order, apart from the
+ *	  HUFFDEC_LITERAL flag.  Pairs are limited to a second literal < 128 so
+ *	  that they fit, which covers text; see build_literal_pairs().
+ *
  * litlen_decode_results[] contains the static part of the entry for each
  * symbol.  make_decode_table_entry() produces the final entries.
  */
@@ -588,6 +636,17 @@ static const u32 litlen_decode_results[] = {
 #undef ENTRY
 };
 
+/*
+ * Output the literal, or the two literals, of the literal or literal pair entry
+ * 'entry'.  This may write to the byte after the literals, so the caller must
+ * have space for that.
+ */
+#define WRITE_LITERALS(entry)						\
+do {									\
+	put_unaligned_le16(((entry) >> 16) & 0x7FFF, out_next);		\
+	out_next += 1 + (((entry) >> 12) & 1);				\
+} while (0)
+
 /* Maximum number of bits that can be consumed by decoding a match offset */
 #define OFFSET_MAXBITS		(DEFLATE_MAX_OFFSET_CODEWORD_LEN + \
 				 DEFLATE_MAX_EXTRA_OFFSET_BITS)
@@ -629,11 +688,174 @@ static const u32 offset_decode_results[] = {
 };
 
 /*
- * The main DEFLATE decompressor structure.  Since libdeflate only supports
- * full-buffer decompression, this structure doesn't store the entire
- * decompression state, most of which is in stack variables.  Instead, this
- * struct just contains the decode tables and some temporary arrays used for
- * building them, as these are too large to comfortably allocate on the stack.
+ * The decode tables for the static Huffman codes, which are the same for every
+ * decompressor.  Decompressing a static Huffman block copies them into the
+ * decompressor rather than building them from the codeword lengths.  The litlen
+ * code's longest codeword is 9 bits, so that is the litlen table's size in
+ * bits.  Generated by scripts/gen_static_decode_tables.py.
+ */
+#define STATIC_LITLEN_TABLEBITS		9
+
+static const u32 static_litlen_decode_table[512] = {
+	0x0000a707, 0x80500808, 0x80100808, 0x0073080c, 0x001f0709, 0x80700808,
+	0x80300808, 0x80c00909, 0x000a0707, 0x80600808, 0x80200808, 0x80a00909,
+	0x80000808, 0x80800808, 0x80400808, 0x80e00909, 0x00060707, 0x80580808,
+	0x80180808, 0x80900909, 0x003b070a, 0x80780808, 0x80380808, 0x80d00909,
+	0x00110708, 0x80680808, 0x80280808, 0x80b00909, 0x80080808, 0x80880808,
+	0x80480808, 0x80f00909, 0x00040707, 0x80540808, 0x80140808, 0x00e3080d,
+	0x002b070a, 0x80740808, 0x80340808, 0x80c80909, 0x000d0708, 0x80640808,
+	0x80240808, 0x80a80909, 0x80040808, 0x80840808, 0x80440808, 0x80e80909,
+	0x00080707, 0x805c0808, 0x801c0808, 0x80980909, 0x0053070b, 0x807c0808,
+	0x803c0808, 0x80d80909, 0x00170709, 0x806c0808, 0x802c0808, 0x80b80909,
+	0x800c0808, 0x808c0808, 0x804c0808, 0x80f80909, 0x00030707, 0x80520808,
+	0x80120808, 0x00a3080d, 0x0023070a, 0x80720808, 0x80320808, 0x80c40909,
+	0x000b0708, 0x80620808, 0x80220808, 0x80a40909, 0x80020808, 0x80820808,
+	0x80420808, 0x80e40909, 0x00070707, 0x805a0808, 0x801a0808, 0x80940909,
+	0x0043070b, 0x807a0808, 0x803a0808, 0x80d40909, 0x00130709, 0x806a0808,
+	0x802a0808, 0x80b40909, 0x800a0808, 0x808a0808, 0x804a0808, 0x80f40909,
+	0x00050707, 0x80560808, 0x80160808, 0x01020808, 0x0033070a, 0x80760808,
+	0x80360808, 0x80cc0909, 0x000f0708, 0x80660808, 0x80260808, 0x80ac0909,
+	0x80060808, 0x80860808, 0x80460808, 0x80ec0909, 0x00090707, 0x805e0808,
+	0x801e0808, 0x809c0909, 0x0063070b, 0x807e0808, 0x803e0808, 0x80dc0909,
+	0x001b0709, 0x806e0808, 0x802e0808, 0x80bc0909, 0x800e0808, 0x808e0808,
+	0x804e0808, 0x80fc0909, 0x0000a707, 0x80510808, 0x80110808, 0x0083080d,
+	0x001f0709, 0x80710808, 0x80310808, 0x80c20909, 0x000a0707, 0x80610808,
+	0x80210808, 0x80a20909, 0x80010808, 0x80810808, 0x80410808, 0x80e20909,
+	0x00060707, 0x80590808, 0x80190808, 0x80920909, 0x003b070a, 0x80790808,
+	0x80390808, 0x80d20909, 0x00110708, 0x80690808, 0x80290808, 0x80b20909,
+	0x80090808, 0x80890808, 0x80490808, 0x80f20909, 0x00040707, 0x80550808,
+	0x80150808, 0x01020808, 0x002b070a, 0x80750808, 0x80350808, 0x80ca0909,
+	0x000d0708, 0x80650808, 0x80250808, 0x80aa0909, 0x80050808, 0x80850808,
+	0x80450808, 0x80ea0909, 0x00080707, 0x805d0808, 0x801d0808, 0x809a0909,
+	0x0053070b, 0x807d0808, 0x803d0808, 0x80da0909, 0x00170709, 0x806d0808,
+	0x802d0808, 0x80ba0909, 0x800d0808, 0x808d0808, 0x804d0808, 0x80fa0909,
+	0x00030707, 0x80530808, 0x80130808, 0x00c3080d, 0x0023070a, 0x80730808,
+	0x80330808, 0x80c60909, 0x000b0708, 0x80630808, 0x80230808, 0x80a60909,
+	0x80030808, 0x80830808, 0x80430808, 0x80e60909, 0x00070707, 0x805b0808,
+	0x801b0808, 0x80960909, 0x0043070b, 0x807b0808, 0x803b0808, 0x80d60909,
+	0x00130709, 0x806b0808, 0x802b0808, 0x80b60909, 0x800b0808, 0x808b0808,
+	0x804b0808, 0x80f60909, 0x00050707, 0x80570808, 0x80170808, 0x01020808,
+	0x0033070a, 0x80770808, 0x80370808, 0x80ce0909, 0x000f0708, 0x80670808,
+	0x80270808, 0x80ae0909, 0x80070808, 0x80870808, 0x80470808, 0x80ee0909,
+	0x00090707, 0x805f0808, 0x801f0808, 0x809e0909, 0x0063070b, 0x807f0808,
+	0x803f0808, 0x80de0909, 0x001b0709, 0x806f0808, 0x802f0808, 0x80be0909,
+	0x800f0808, 0x808f0808, 0x804f0808, 0x80fe0909, 0x0000a707, 0x80500808,
+	0x80100808, 0x0073080c, 0x001f0709, 0x80700808, 0x80300808, 0x80c10909,
+	0x000a0707, 0x80600808, 0x80200808, 0x80a10909, 0x80000808, 0x80800808,
+	0x80400808, 0x80e10909, 0x00060707, 0x80580808, 0x80180808, 0x80910909,
+	0x003b070a, 0x80780808, 0x80380808, 0x80d10909, 0x00110708, 0x80680808,
+	0x80280808, 0x80b10909, 0x80080808, 0x80880808, 0x80480808, 0x80f10909,
+	0x00040707, 0x80540808, 0x80140808, 0x00e3080d, 0x002b070a, 0x80740808,
+	0x80340808, 0x80c90909, 0x000d0708, 0x80640808, 0x80240808, 0x80a90909,
+	0x80040808, 0x80840808, 0x80440808, 0x80e90909, 0x00080707, 0x805c0808,
+	0x801c0808, 0x80990909, 0x0053070b, 0x807c0808, 0x803c0808, 0x80d90909,
+	0x00170709, 0x806c0808, 0x802c0808, 0x80b90909, 0x800c0808, 0x808c0808,
+	0x804c0808, 0x80f90909, 0x00030707, 0x80520808, 0x80120808, 0x00a3080d,
+	0x0023070a, 0x80720808, 0x80320808, 0x80c50909, 0x000b0708, 0x80620808,
+	0x80220808, 0x80a50909, 0x80020808, 0x80820808, 0x80420808, 0x80e50909,
+	0x00070707, 0x805a0808, 0x801a0808, 0x80950909, 0x0043070b, 0x807a0808,
+	0x803a0808, 0x80d50909, 0x00130709, 0x806a0808, 0x802a0808, 0x80b50909,
+	0x800a0808, 0x808a0808, 0x804a0808, 0x80f50909, 0x00050707, 0x80560808,
+	0x80160808, 0x01020808, 0x0033070a, 0x80760808, 0x80360808, 0x80cd0909,
+	0x000f0708, 0x80660808, 0x80260808, 0x80ad0909, 0x80060808, 0x80860808,
+	0x80460808, 0x80ed0909, 0x00090707, 0x805e0808, 0x801e0808, 0x809d0909,
+	0x0063070b, 0x807e0808, 0x803e0808, 0x80dd0909, 0x001b0709, 0x806e0808,
+	0x802e0808, 0x80bd0909, 0x800e0808, 0x808e0808, 0x804e0808, 0x80fd0909,
+	0x0000a707, 0x80510808, 0x80110808, 0x0083080d, 0x001f0709, 0x80710808,
+	0x80310808, 0x80c30909, 0x000a0707, 0x80610808, 0x80210808, 0x80a30909,
+	0x80010808, 0x80810808, 0x80410808, 0x80e30909, 0x00060707, 0x80590808,
+	0x80190808, 0x80930909, 0x003b070a, 0x80790808, 0x80390808, 0x80d30909,
+	0x00110708, 0x80690808, 0x80290808, 0x80b30909, 0x80090808, 0x80890808,
+	0x80490808, 0x80f30909, 0x00040707, 0x80550808, 0x80150808, 0x01020808,
+	0x002b070a, 0x80750808, 0x80350808, 0x80cb0909, 0x000d0708, 0x80650808,
+	0x80250808, 0x80ab0909, 0x80050808, 0x80850808, 0x80450808, 0x80eb0909,
+	0x00080707, 0x805d0808, 0x801d0808, 0x809b0909, 0x0053070b, 0x807d0808,
+	0x803d0808, 0x80db0909, 0x00170709, 0x806d0808, 0x802d0808, 0x80bb0909,
+	0x800d0808, 0x808d0808, 0x804d0808, 0x80fb0909, 0x00030707, 0x80530808,
+	0x80130808, 0x00c3080d, 0x0023070a, 0x80730808, 0x80330808, 0x80c70909,
+	0x000b0708, 0x80630808, 0x80230808, 0x80a70909, 0x80030808, 0x80830808,
+	0x80430808, 0x80e70909, 0x00070707, 0x805b0808, 0x801b0808, 0x80970909,
+	0x0043070b, 0x807b0808, 0x803b0808, 0x80d70909, 0x00130709, 0x806b0808,
+	0x802b0808, 0x80b70909, 0x800b0808, 0x808b0808, 0x804b0808, 0x80f70909,
+	0x00050707, 0x80570808, 0x80170808, 0x01020808, 0x0033070a, 0x80770808,
+	0x80370808, 0x80cf0909, 0x000f0708, 0x80670808, 0x80270808, 0x80af0909,
+	0x80070808, 0x80870808, 0x80470808, 0x80ef0909, 0x00090707, 0x805f0808,
+	0x801f0808, 0x809f0909, 0x0063070b, 0x807f0808, 0x803f0808, 0x80df0909,
+	0x001b0709, 0x806f0808, 0x802f0808, 0x80bf0909, 0x800f0808, 0x808f0808,
+	0x804f0808, 0x80ff0909,
+};
+
+static const u32 static_offset_decode_table[256] = {
+	0x00010505, 0x0101050c, 0x00110508, 0x10010510, 0x00050506, 0x0401050e,
+	0x0041050a, 0x40010512, 0x00030505, 0x0201050d, 0x00210509, 0x20010511,
+	0x00090507, 0x0801050f, 0x0081050b, 0x60010512, 0x00020505, 0x0181050c,
+	0x00190508, 0x18010510, 0x00070506, 0x0601050e, 0x0061050a, 0x60010512,
+	0x00040505, 0x0301050d, 0x00310509, 0x30010511, 0x000d0507, 0x0c01050f,
+	0x00c1050b, 0x60010512, 0x00010505, 0x0101050c, 0x00110508, 0x10010510,
+	0x00050506, 0x0401050e, 0x0041050a, 0x40010512, 0x00030505, 0x0201050d,
+	0x00210509, 0x20010511, 0x00090507, 0x0801050f, 0x0081050b, 0x60010512,
+	0x00020505, 0x0181050c, 0x00190508, 0x18010510, 0x00070506, 0x0601050e,
+	0x0061050a, 0x60010512, 0x00040505, 0x0301050d, 0x00310509, 0x30010511,
+	0x000d0507, 0x0c01050f, 0x00c1050b, 0x60010512, 0x00010505, 0x0101050c,
+	0x00110508, 0x10010510, 0x00050506, 0x0401050e, 0x0041050a, 0x40010512,
+	0x00030505, 0x0201050d, 0x00210509, 0x20010511, 0x00090507, 0x0801050f,
+	0x0081050b, 0x60010512, 0x00020505, 0x0181050c, 0x00190508, 0x18010510,
+	0x00070506, 0x0601050e, 0x0061050a, 0x60010512, 0x00040505, 0x0301050d,
+	0x00310509, 0x30010511, 0x000d0507, 0x0c01050f, 0x00c1050b, 0x60010512,
+	0x00010505, 0x0101050c, 0x00110508, 0x10010510, 0x00050506, 0x0401050e,
+	0x0041050a, 0x40010512, 0x00030505, 0x0201050d, 0x00210509, 0x20010511,
+	0x00090507, 0x0801050f, 0x0081050b, 0x60010512, 0x00020505, 0x0181050c,
+	0x00190508, 0x18010510, 0x00070506, 0x0601050e, 0x0061050a, 0x60010512,
+	0x00040505, 0x0301050d, 0x00310509, 0x30010511, 0x000d0507, 0x0c01050f,
+	0x00c1050b, 0x60010512, 0x00010505, 0x0101050c, 0x00110508, 0x10010510,
+	0x00050506, 0x0401050e, 0x0041050a, 0x40010512, 0x00030505, 0x0201050d,
+	0x00210509, 0x20010511, 0x00090507, 0x0801050f, 0x0081050b, 0x60010512,
+	0x00020505, 0x0181050c, 0x00190508, 0x18010510, 0x00070506, 0x0601050e,
+	0x0061050a, 0x60010512, 0x00040505, 0x0301050d, 0x00310509, 0x30010511,
+	0x000d0507, 0x0c01050f, 0x00c1050b, 0x60010512, 0x00010505, 0x0101050c,
+	0x00110508, 0x10010510, 0x00050506, 0x0401050e, 0x0041050a, 0x40010512,
+	0x00030505, 0x0201050d, 0x00210509, 0x20010511, 0x00090507, 0x0801050f,
+	0x0081050b, 0x60010512, 0x00020505, 0x0181050c, 0x00190508, 0x18010510,
+	0x00070506, 0x0601050e, 0x0061050a, 0x60010512, 0x00040505, 0x0301050d,
+	0x00310509, 0x30010511, 0x000d0507, 0x0c01050f, 0x00c1050b, 0x60010512,
+	0x00010505, 0x0101050c, 0x00110508, 0x10010510, 0x00050506, 0x0401050e,
+	0x0041050a, 0x40010512, 0x00030505, 0x0201050d, 0x00210509, 0x20010511,
+	0x00090507, 0x0801050f, 0x0081050b, 0x60010512, 0x00020505, 0x0181050c,
+	0x00190508, 0x18010510, 0x00070506, 0x0601050e, 0x0061050a, 0x60010512,
+	0x00040505, 0x0301050d, 0x00310509, 0x30010511, 0x000d0507, 0x0c01050f,
+	0x00c1050b, 0x60010512, 0x00010505, 0x0101050c, 0x00110508, 0x10010510,
+	0x00050506, 0x0401050e, 0x0041050a, 0x40010512, 0x00030505, 0x0201050d,
+	0x00210509, 0x20010511, 0x00090507, 0x0801050f, 0x0081050b, 0x60010512,
+	0x00020505, 0x0181050c, 0x00190508, 0x18010510, 0x00070506, 0x0601050e,
+	0x0061050a, 0x60010512, 0x00040505, 0x0301050d, 0x00310509, 0x30010511,
+	0x000d0507, 0x0c01050f, 0x00c1050b, 0x60010512,
+};
+
+/*
+ * A checkpoint index being recorded by the decompressor.  See libdeflate.h.
+ */
+struct libdeflate_index {
+	/* Desired number of uncompressed bytes between checkpoints */
+	size_t spacing;
+
+	/* Output position at or after which the next checkpoint is recorded */
+	size_t next_out_pos;
+
+	struct libdeflate_checkpoint *checkpoints;
+	size_t num_checkpoints;
+	size_t capacity;
+
+	malloc_func_t malloc_func;
+	free_func_t free_func;
+};
+
+/*
+ * The main DEFLATE decompressor structure.  Since full-buffer decompression
+ * is the main use case, this structure doesn't store the entire decompression
+ * state, most of which is in stack variables.  Instead, this struct just
+ * contains the decode tables and some temporary arrays used for building them,
+ * as these are too large to comfortably allocate on the stack.  The extra state
+ * needed by the streaming decompressor is allocated separately, on demand.
  *
  * Storing the decode tables in the decompressor struct also allows the decode
  * tables for the static codes to be reused whenever two static Huffman blocks
@@ -644,10 +866,8 @@ struct libdeflate_decompressor {
 	/*
 	 * The arrays aren't all needed at the same time.  'precode_lens' and
 	 * 'precode_decode_table' are unneeded after 'lens' has been filled.
-	 * Furthermore, 'lens' need not be retained after building the litlen
-	 * and offset decode tables.  In fact, 'lens' can be in union with
-	 * 'litlen_decode_table' provided that 'offset_decode_table' is separate
-	 * and is built first.
+	 * 'lens' isn't in union with the litlen and offset decode tables, so
+	 * that reading the next block's header leaves them intact for reuse.
 	 */
 
 	union {
@@ -660,22 +880,126 @@ struct libdeflate_decompressor {
 
 			u32 precode_decode_table[PRECODE_ENOUGH];
 		} l;
-
-		u32 litlen_decode_table[LITLEN_ENOUGH];
 	} u;
 
+	u32 litlen_decode_table[LITLEN_ENOUGH];
+
 	u32 offset_decode_table[OFFSET_ENOUGH];
 
+	/*
+	 * The codeword lengths that the decode tables were last built from, if
+	 * 'dynamic_codes_loaded'.  A dynamic Huffman block whose lengths are
+	 * the same as the previous one's can reuse its decode tables.
+	 */
+	u8 dynamic_lens[DEFLATE_NUM_LITLEN_SYMS + DEFLATE_NUM_OFFSET_SYMS];
+	unsigned dynamic_num_litlen_syms;
+	unsigned dynamic_num_offset_syms;
+	bool dynamic_codes_loaded;
+
+	/* Whether the last dynamic Huffman block reused the decode tables */
+	bool dynamic_codes_reused;
+
 	/* used only during build_decode_table() */
 	u16 sorted_syms[DEFLATE_MAX_NUM_SYMS];
 
 	bool static_codes_loaded;
 	unsigned litlen_tablebits;
 
-	/* The free() function for this struct, chosen at allocation time */
+	/* The number of litlen codewords longer than 'litlen_tablebits' */
+	unsigned litlen_subtable_syms;
+
+	/* The malloc() and free() functions, chosen at allocation time */
+	malloc_func_t malloc_func;
 	free_func_t free_func;
+
+	/* State of the streaming decompressor, allocated on first use */
+	struct deflate_decompress_stream *stream;
+
+	/*
+	 * The preset dictionary for the current call, or 'dict_nbytes' == 0 if
+	 * none.  Matches can refer to it as if it preceded the output buffer.
+	 */
+	const u8 *dict;
+	size_t dict_nbytes;
+
+	/*
+	 * The checkpoint index to record into, or NULL if none, and the offset
+	 * of the DEFLATE stream in the caller's buffer, so that the recorded
+	 * positions are relative to the start of a zlib or gzip wrapper.
+	 */
+	struct libdeflate_index *index;
+	size_t index_in_offset;
+
+	/*
+	 * Settings for libdeflate_deflate_decompress_from_checkpoint(): the
+	 * number of bits to skip at the start of the input, and whether to stop
+	 * successfully once the output buffer is full rather than failing.
+	 */
+	unsigned start_bits;
+	bool partial_output;
+
+	/*
+	 * Set by libdeflate_deflate_decompress_padded(): whether the fastloop
+	 * may read and write up to the padding past the ends of the buffers
+	 */
+	bool padded;
+
+	/*
+	 * The checksum that libdeflate_begin_checksum() asked to compute over
+	 * the output, if any, and the number of output bytes it covers so far
+	 */
+	checksum_func_t checksum_func;
+	u32 checksum;
+	size_t checksum_nbytes;
+
+	/* The offload backend; its functions are NULL if there is none */
+	struct libdeflate_backend backend;
+
+	/* The callback set by libdeflate_set_block_callback(), or NULL */
+	void (*block_callback)(void *ctx,
+			       const struct libdeflate_block_info *info);
+	void *block_callback_ctx;
+
+	/* Statistics since allocation or libdeflate_reset_decompress_stats() */
+	struct libdeflate_decompress_stats stats;
 };
 
+/*
+ * Count how many codewords have each length in @lens, including 0, and sort the
+ * symbols primarily by increasing codeword length and secondarily by increasing
+ * symbol value; or equivalently by their codewords in lexicographic order,
+ * since a canonical code is assumed.  Return a pointer to the first symbol in
+ * @sorted_syms that has a codeword, i.e. skip the unused symbols.
+ */
+static u16 *
+sort_syms(const u8 lens[], unsigned num_syms, unsigned len_counts[],
+	  u16 sorted_syms[])
+{
+	unsigned offsets[DEFLATE_MAX_CODEWORD_LEN + 1];
+	unsigned len, sym;
+
+	for (len = 0; len <= DEFLATE_MAX_CODEWORD_LEN; len++)
+		len_counts[len] = 0;
+	for (sym = 0; sym < num_syms; sym++)
+		len_counts[lens[sym]]++;
+
+	offsets[0] = 0;
+	for (len = 0; len < DEFLATE_MAX_CODEWORD_LEN; len++)
+		offsets[len + 1] = offsets[len] + len_counts[len];
+
+	for (sym = 0; sym < num_syms; sym++)
+		sorted_syms[offsets[lens[sym]]++] = sym;
+
+	return sorted_syms + len_counts[0];
+}
+
+/*
+ * A function that does the job of sort_syms(), so that each decompression
+ * function can use a version that takes advantage of its instruction set
+ */
+typedef u16 *(*sort_syms_func_t)(const u8 lens[], unsigned num_syms,
+				 unsigned len_counts[], u16 sorted_syms[]);
+
 /*
  * Build a table for fast decoding of symbols from a Huffman code.  As input,
  * this function takes the codeword length of each symbol which may be used in
@@ -711,6 +1035,9 @@ struct libdeflate_decompressor {
  *	Must be <= DEFLATE_MAX_CODEWORD_LEN.
  * @sorted_syms
  *	A temporary array of length @num_syms.
+ * @sort
+ *	sort_syms() or a faster version of it, which may impose requirements on
+ *	the length of @lens.
  * @table_bits_ret
  *	If non-NULL, then the dynamic table_bits is enabled, and the actual
  *	table_bits value will be returned here.
@@ -726,10 +1053,10 @@ build_decode_table(u32 decode_table[],
 		   unsigned table_bits,
 		   unsigned max_codeword_len,
 		   u16 *sorted_syms,
+		   sort_syms_func_t sort,
 		   unsigned *table_bits_ret)
 {
 	unsigned len_counts[DEFLATE_MAX_CODEWORD_LEN + 1];
-	unsigned offsets[DEFLATE_MAX_CODEWORD_LEN + 1];
 	unsigned sym;		/* current symbol */
 	unsigned codeword;	/* current codeword, bit-reversed */
 	unsigned len;		/* current codeword length in bits */
@@ -740,11 +1067,13 @@ build_decode_table(u32 decode_table[],
 	unsigned subtable_start;  /* start index of current subtable */
 	unsigned subtable_bits;   /* log2 of current subtable length */
 
-	/* Count how many codewords have each length, including 0. */
-	for (len = 0; len <= max_codeword_len; len++)
-		len_counts[len] = 0;
-	for (sym = 0; sym < num_syms; sym++)
-		len_counts[lens[sym]]++;
+	/*
+	 * Count how many codewords have each length, and sort the symbols by
+	 * codeword.
+	 */
+	sorted_syms = (*sort)(lens, num_syms, len_counts, sorted_syms);
+
+	/* lens[] is done being used, so we can write to decode_table[] now. */
 
 	/*
 	 * Determine the actual maximum codeword length that was used, and
@@ -757,35 +1086,14 @@ build_decode_table(u32 decode_table[],
 		*table_bits_ret = table_bits;
 	}
 
-	/*
-	 * Sort the symbols primarily by increasing codeword length and
-	 * secondarily by increasing symbol value; or equivalently by their
-	 * codewords in lexicographic order, since a canonical code is assumed.
-	 *
-	 * For efficiency, also compute 'codespace_used' in the same pass over
-	 * 'len_counts[]' used to build 'offsets[]' for sorting.
-	 */
-
 	/* Ensure that 'codespace_used' cannot overflow. */
 	STATIC_ASSERT(sizeof(codespace_used) == 4);
 	STATIC_ASSERT(UINT32_MAX / (1U << (DEFLATE_MAX_CODEWORD_LEN - 1)) >=
 		      DEFLATE_MAX_NUM_SYMS);
 
-	offsets[0] = 0;
-	offsets[1] = len_counts[0];
 	codespace_used = 0;
-	for (len = 1; len < max_codeword_len; len++) {
-		offsets[len + 1] = offsets[len] + len_counts[len];
+	for (len = 1; len <= max_codeword_len; len++)
 		codespace_used = (codespace_used << 1) + len_counts[len];
-	}
-	codespace_used = (codespace_used << 1) + len_counts[len];
-
-	for (sym = 0; sym < num_syms; sym++)
-		sorted_syms[offsets[lens[sym]]++] = sym;
-
-	sorted_syms += offsets[0]; /* Skip unused symbols */
-
-	/* lens[] is done being used, so we can write to decode_table[] now. */
 
 	/*
 	 * Check whether the lengths form a complete code (exactly fills the
@@ -1020,28 +1328,156 @@ build_precode_decode_table(struct libdeflate_decompressor *d)
 				  PRECODE_TABLEBITS,
 				  DEFLATE_MAX_PRE_CODEWORD_LEN,
 				  d->sorted_syms,
+				  sort_syms,
 				  NULL);
 }
 
+/*
+ * Count the literal codewords of each length in @lens, and separately those of
+ * literals < 128, which are the ones that can be the second literal of a pair.
+ */
+static void
+count_literal_lens(const u8 lens[], unsigned counts[],
+		   unsigned ascii_counts[])
+{
+	unsigned len, sym;
+
+	for (len = 0; len <= DEFLATE_MAX_LITLEN_CODEWORD_LEN; len++)
+		ascii_counts[len] = 0;
+	for (sym = 0; sym < 128; sym++)
+		ascii_counts[lens[sym]]++;
+	for (len = 0; len <= DEFLATE_MAX_LITLEN_CODEWORD_LEN; len++)
+		counts[len] = ascii_counts[len];
+	for (; sym < DEFLATE_NUM_LITERALS; sym++)
+		counts[lens[sym]]++;
+}
+
+/*
+ * Return true if enough of the main litlen decode table would consist of
+ * literal pair entries to make building them worthwhile.  Building them takes a
+ * pass over the main table, which for small blocks whose codes allow few pairs
+ * costs more than the pairs save.  The number of pair entries is computed
+ * exactly from the codeword length counts: each pair of codewords whose lengths
+ * sum to at most @table_bits fills '2^(table_bits - len1 - len2)' entries.
+ */
+static bool
+literal_pairs_worthwhile(const unsigned counts[], const unsigned ascii_counts[],
+			 unsigned table_bits)
+{
+	u32 num_pair_entries = 0;
+	unsigned len1, len2;
+
+	for (len1 = 1; len1 < table_bits; len1++) {
+		if (counts[len1] == 0)
+			continue;
+		for (len2 = 1; len1 + len2 <= table_bits; len2++) {
+			num_pair_entries +=
+				(counts[len1] * ascii_counts[len2]) <<
+				(table_bits - len1 - len2);
+		}
+	}
+	return num_pair_entries >= (1U << table_bits) / 4;
+}
+
+/*
+ * Turn each literal entry in the main litlen decode table into a literal pair
+ * entry if the bits that remain in the entry's index are enough to decode the
+ * next codeword too, and it is a literal < 128.  So the number of pairs depends
+ * on d->litlen_tablebits, which is set per block; with a code whose literal
+ * codewords are mostly 5 bits or shorter, most literals get decoded in pairs.
+ *
+ * The entries are processed in descending order of index, since the entry for
+ * the second codeword, at index 'i >> len', must not have been changed yet.
+ * This does the entries below index @end; the vectorized versions do the rest
+ * of the table themselves and leave the lowest entries to this.
+ */
+static forceinline void
+build_literal_pairs_below(u32 decode_table[], unsigned table_bits, unsigned end)
+{
+	unsigned i = end;
+
+	do {
+		u32 entry = decode_table[--i];
+		u32 len = entry & 0xF;
+		u32 entry2 = decode_table[i >> len];
+		u32 len2 = entry2 & 0xF;
+		u32 mask;
+
+		/*
+		 * Both entries must be literals, and the second literal must be
+		 * < 128.  This is branchless, as the outcome is unpredictable.
+		 */
+		mask = -(u32)((entry & entry2 & ~(entry2 << 8) &
+			       HUFFDEC_LITERAL) != 0 &&
+			      len + len2 <= table_bits);
+		decode_table[i] = entry +
+				  (mask & (len2 + ((entry2 & 0x007F0000) << 8) +
+					   HUFFDEC_2LITERALS));
+	} while (i != 0);
+}
+
+static void
+build_literal_pairs(u32 decode_table[], unsigned table_bits)
+{
+	build_literal_pairs_below(decode_table, table_bits, 1U << table_bits);
+}
+
+/*
+ * The parts of building the litlen decode table that have vectorized versions,
+ * so that each decompression function can use the ones for its instruction set.
+ * Only the litlen code is large enough for them to matter.
+ */
+struct litlen_table_funcs {
+	sort_syms_func_t sort_syms;
+	void (*build_literal_pairs)(u32 decode_table[], unsigned table_bits);
+};
+
+static const struct litlen_table_funcs default_litlen_table_funcs = {
+	.sort_syms = sort_syms,
+	.build_literal_pairs = build_literal_pairs,
+};
+
 /* Build the decode table for the literal/length code.  */
 static bool
 build_litlen_decode_table(struct libdeflate_decompressor *d,
-			  unsigned num_litlen_syms, unsigned num_offset_syms)
+			  unsigned num_litlen_syms, unsigned num_offset_syms,
+			  const struct litlen_table_funcs *funcs)
 {
+	unsigned counts[DEFLATE_MAX_LITLEN_CODEWORD_LEN + 1];
+	unsigned ascii_counts[DEFLATE_MAX_LITLEN_CODEWORD_LEN + 1];
+	unsigned len_counts[DEFLATE_MAX_LITLEN_CODEWORD_LEN + 1];
+	unsigned len, sym;
+
 	/* When you change TABLEBITS, you must change ENOUGH, and vice versa! */
 	STATIC_ASSERT(LITLEN_TABLEBITS == 11 && LITLEN_ENOUGH == 2342);
 
 	STATIC_ASSERT(ARRAY_LEN(litlen_decode_results) ==
 		      DEFLATE_NUM_LITLEN_SYMS);
 
-	return build_decode_table(d->u.litlen_decode_table,
-				  d->u.l.lens,
-				  num_litlen_syms,
-				  litlen_decode_results,
-				  LITLEN_TABLEBITS,
-				  DEFLATE_MAX_LITLEN_CODEWORD_LEN,
-				  d->sorted_syms,
-				  &d->litlen_tablebits);
+	count_literal_lens(d->u.l.lens, counts, ascii_counts);
+	for (len = 0; len <= DEFLATE_MAX_LITLEN_CODEWORD_LEN; len++)
+		len_counts[len] = counts[len];
+	for (sym = DEFLATE_NUM_LITERALS; sym < num_litlen_syms; sym++)
+		len_counts[d->u.l.lens[sym]]++;
+
+	if (!build_decode_table(d->litlen_decode_table,
+				d->u.l.lens,
+				num_litlen_syms,
+				litlen_decode_results,
+				LITLEN_TABLEBITS,
+				DEFLATE_MAX_LITLEN_CODEWORD_LEN,
+				d->sorted_syms,
+				funcs->sort_syms,
+				&d->litlen_tablebits))
+		return false;
+	d->litlen_subtable_syms = 0;
+	for (len = d->litlen_tablebits + 1;
+	     len <= DEFLATE_MAX_LITLEN_CODEWORD_LEN; len++)
+		d->litlen_subtable_syms += len_counts[len];
+	if (literal_pairs_worthwhile(counts, ascii_counts, d->litlen_tablebits))
+		(*funcs->build_literal_pairs)(d->litlen_decode_table,
+					      d->litlen_tablebits);
+	return true;
 }
 
 /* Build the decode table for the offset code.  */
@@ -1062,9 +1498,299 @@ build_offset_decode_table(struct libdeflate_decompressor *d,
 				  OFFSET_TABLEBITS,
 				  DEFLATE_MAX_OFFSET_CODEWORD_LEN,
 				  d->sorted_syms,
+				  sort_syms,
 				  NULL);
 }
 
+/* Load the decode tables for the static Huffman codes. */
+static void
+load_static_decode_tables(struct libdeflate_decompressor *d)
+{
+	STATIC_ASSERT(ARRAY_LEN(static_litlen_decode_table) ==
+		      1U << STATIC_LITLEN_TABLEBITS);
+	STATIC_ASSERT(ARRAY_LEN(static_offset_decode_table) ==
+		      1U << OFFSET_TABLEBITS);
+
+	memcpy(d->litlen_decode_table, static_litlen_decode_table,
+	       sizeof(static_litlen_decode_table));
+	memcpy(d->offset_decode_table, static_offset_decode_table,
+	       sizeof(static_offset_decode_table));
+	d->litlen_tablebits = STATIC_LITLEN_TABLEBITS;
+	d->litlen_subtable_syms = 0;
+	d->static_codes_loaded = true;
+	d->dynamic_codes_loaded = false;
+}
+
+/*
+ * Build the decode tables for a dynamic Huffman block from the codeword lengths
+ * in d->u.l.lens, unless they're the same as those the current tables were
+ * built from.  Some compressors emit many blocks with the same codes, e.g. when
+ * they flush often or split the input into fixed-size blocks.
+ */
+static bool
+build_dynamic_decode_tables(struct libdeflate_decompressor *d,
+			    unsigned num_litlen_syms, unsigned num_offset_syms,
+			    const struct litlen_table_funcs *funcs)
+{
+	if (d->dynamic_codes_loaded &&
+	    d->dynamic_num_litlen_syms == num_litlen_syms &&
+	    d->dynamic_num_offset_syms == num_offset_syms &&
+	    memcmp(d->dynamic_lens, d->u.l.lens,
+		   num_litlen_syms + num_offset_syms) == 0) {
+		d->dynamic_codes_reused = true;
+		return true;
+	}
+
+	d->dynamic_codes_reused = false;
+	d->dynamic_codes_loaded = false;
+	if (!build_offset_decode_table(d, num_litlen_syms, num_offset_syms) ||
+	    !build_litlen_decode_table(d, num_litlen_syms, num_offset_syms,
+				       funcs))
+		return false;
+	memcpy(d->dynamic_lens, d->u.l.lens, num_litlen_syms + num_offset_syms);
+	d->dynamic_num_litlen_syms = num_litlen_syms;
+	d->dynamic_num_offset_syms = num_offset_syms;
+	d->dynamic_codes_loaded = true;
+	return true;
+}
+
+/*****************************************************************************
+ *                         Streaming decompression
+ *****************************************************************************/
+
+/*
+ * The streaming decompressor decodes into an internal window buffer, from which
+ * the data is then copied to the caller's buffer.  The window holds the last
+ * DEFLATE_MAX_MATCH_OFFSET bytes of history followed by up to
+ * STREAM_CHUNK_LENGTH bytes of newly decoded data.  A larger chunk means the
+ * history has to be moved less often and the fastloop can be used more often.
+ */
+#define STREAM_CHUNK_LENGTH	65536
+#define STREAM_WINDOW_SIZE	(DEFLATE_MAX_MATCH_OFFSET + STREAM_CHUNK_LENGTH)
+
+/*
+ * Size of the buffer for input that had to be kept between calls because it
+ * ended partway through a block header or symbol.  A dynamic Huffman block
+ * header is the largest such unit: it can be up to about 570 bytes long.  Using
+ * at least twice that guarantees that decoding from this buffer, once it has
+ * been topped up with new input, always gets past the bytes that were kept.
+ */
+#define STREAM_CARRY_SIZE	2048
+
+enum deflate_stream_state {
+	STREAM_STATE_BLOCK_HEADER,
+	STREAM_STATE_HUFFMAN_BLOCK,
+	STREAM_STATE_STORED_BLOCK,
+	STREAM_STATE_DONE,
+};
+
+/* Why the stream decompression routine stopped */
+enum deflate_stream_status {
+	STREAM_NEED_INPUT,
+	STREAM_NEED_OUTPUT,
+	STREAM_END,
+	STREAM_BAD_DATA,
+};
+
+struct deflate_decompress_stream {
+
+	/*
+	 * The bitbuffer and the number of bits in it.  Between calls this
+	 * contains only the unconsumed bits of a partially consumed byte, so
+	 * 'bitsleft' is always less than 8 and no input bytes are held here.
+	 */
+	bitbuf_t bitbuf;
+	u32 bitsleft;
+
+	enum deflate_stream_state state;
+	bool is_final_block;
+	bool failed;
+
+	/* Bytes of the current uncompressed block not yet copied */
+	u32 stored_len_remaining;
+
+	/* End of the decoded data in 'window' */
+	size_t out_pos;
+
+	/* End of the data in 'window' that has been copied to the caller */
+	size_t flush_pos;
+
+	size_t carry_nbytes;
+	u8 carry[STREAM_CARRY_SIZE];
+
+	u8 window[STREAM_WINDOW_SIZE];
+};
+
+/* Fail with STREAM_NEED_INPUT if any appended zero bytes were consumed. */
+#define CHECK_NOT_OVERREAD()						\
+do {									\
+	if (unlikely(overread_count > ((u8)bitsleft >> 3)))		\
+		goto need_input;					\
+} while (0)
+
+/*
+ * Remember the current bitstream state as a point to resume from if the next
+ * block header or symbol can't be fully decoded.  Any appended zero bytes,
+ * which have been verified to be unconsumed, are dropped from the bitbuffer.
+ */
+#define SET_CHECKPOINT()						\
+do {									\
+	bitsleft = (u8)bitsleft - (8 * (u32)overread_count);		\
+	overread_count = 0;						\
+	checkpoint_bitbuf = bitbuf;					\
+	checkpoint_bitsleft = bitsleft;					\
+	checkpoint_in_next = in_next;					\
+} while (0)
+
+/*****************************************************************************
+ *                            Preset dictionaries
+ *****************************************************************************/
+
+/*
+ * Copy a match of @length bytes at @offset bytes before @out_next that starts
+ * before the output buffer @out, in the preset dictionary.  @offset must have
+ * been validated.  The match may continue into the output buffer.
+ */
+static void
+copy_match_from_dict(const struct libdeflate_decompressor *d,
+		     const u8 *out, u8 *out_next, u32 offset, u32 length)
+{
+	size_t dict_offset = offset - (out_next - out);
+	const u8 *src = &d->dict[d->dict_nbytes - dict_offset];
+	size_t n = MIN(length, dict_offset);
+
+	memcpy(out_next, src, n);
+	out_next += n;
+	length -= n;
+	for (src = out; length != 0; length--)
+		*out_next++ = *src++;
+}
+
+/*
+ * Record a checkpoint in d->index at the start of a block, which begins at bit
+ * 'in_bitpos' of the DEFLATE stream and at 'out_next' in the output buffer.
+ * The window is the last 32768 bytes of output, preceded by the end of the
+ * preset dictionary if there isn't that much output yet.  If out of memory,
+ * the checkpoint is just left out, which makes the index sparser but still
+ * valid.
+ */
+static void
+add_checkpoint(struct libdeflate_decompressor *d, u64 in_bitpos,
+	       const u8 *out, const u8 *out_next)
+{
+	struct libdeflate_index *index = d->index;
+	size_t out_pos = out_next - out;
+	struct libdeflate_checkpoint *cp;
+	size_t n, dict_n;
+
+	index->next_out_pos = out_pos + MAX(index->spacing, 1);
+
+	if (index->num_checkpoints == index->capacity) {
+		size_t new_capacity = MAX(16, 2 * index->capacity);
+		struct libdeflate_checkpoint *new_checkpoints;
+
+		new_checkpoints = (*index->malloc_func)(new_capacity *
+							sizeof(*cp));
+		if (new_checkpoints == NULL)
+			return;
+		if (index->num_checkpoints)
+			memcpy(new_checkpoints, index->checkpoints,
+			       index->num_checkpoints * sizeof(*cp));
+		(*index->free_func)(index->checkpoints);
+		index->checkpoints = new_checkpoints;
+		index->capacity = new_capacity;
+	}
+	cp = &index->checkpoints[index->num_checkpoints++];
+	cp->in_bitpos = ((u64)d->index_in_offset * 8) + in_bitpos;
+	cp->out_pos = out_pos;
+
+	n = MIN(out_pos, DEFLATE_MAX_MATCH_OFFSET);
+	dict_n = MIN(DEFLATE_MAX_MATCH_OFFSET - n, d->dict_nbytes);
+	if (dict_n)
+		memcpy(cp->window, &d->dict[d->dict_nbytes - dict_n], dict_n);
+	memcpy(&cp->window[dict_n], out_next - n, n);
+	cp->window_nbytes = dict_n + n;
+}
+
+/*****************************************************************************
+ *                               Introspection
+ *****************************************************************************/
+
+/*
+ * Report a block to the block callback and statistics, if any.  The block's
+ * header starts at bit @in_bitpos and ends at bit @data_bitpos of the input,
+ * and its data starts at @out_pos in the output.
+ */
+static void
+report_block(struct libdeflate_decompressor *d, unsigned block_type,
+	     bool is_final_block, u64 in_bitpos, u64 data_bitpos, size_t out_pos)
+{
+	struct libdeflate_block_info info;
+
+	d->stats.num_blocks++;
+	if (block_type == DEFLATE_BLOCKTYPE_UNCOMPRESSED)
+		d->stats.num_uncompressed_blocks++;
+	else if (block_type == DEFLATE_BLOCKTYPE_STATIC_HUFFMAN)
+		d->stats.num_static_blocks++;
+	else
+		d->stats.num_dynamic_blocks++;
+	if (block_type == DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN &&
+	    d->dynamic_codes_reused)
+		d->stats.num_reused_dynamic_codes++;
+
+	if (d->block_callback == NULL)
+		return;
+	info.block_type = block_type;
+	info.is_final = is_final_block;
+	info.in_bitpos = ((u64)d->index_in_offset * 8) + in_bitpos;
+	info.header_nbits = data_bitpos - in_bitpos;
+	info.out_pos = out_pos;
+	if (block_type == DEFLATE_BLOCKTYPE_UNCOMPRESSED) {
+		info.litlen_tablebits = 0;
+		info.litlen_subtable_syms = 0;
+	} else {
+		info.litlen_tablebits = d->litlen_tablebits;
+		info.litlen_subtable_syms = d->litlen_subtable_syms;
+	}
+	(*d->block_callback)(d->block_callback_ctx, &info);
+}
+
+/*
+ * Add the bytes of a Huffman block that were decoded in the fastloop and in the
+ * generic loop to the statistics.  The block's data starts at @block_begin, the
+ * generic loop was entered at @generic_begin, or NULL if it wasn't, and the
+ * block ends at @block_end.
+ */
+static void
+count_block_bytes(struct libdeflate_decompressor *d, const u8 *block_begin,
+		  const u8 *generic_begin, const u8 *block_end)
+{
+	if (generic_begin == NULL)
+		generic_begin = block_end;
+	d->stats.num_fastloop_bytes += generic_begin - block_begin;
+	d->stats.num_generic_loop_bytes += block_end - generic_begin;
+}
+
+/*
+ * If a checksum of the output was requested, extend it over the output up to
+ * @block_end, which has just been finalized.  Doing this one block at a time
+ * rather than after decompressing everything means the data is usually still
+ * in the CPU cache.
+ */
+static forceinline void
+checksum_block_output(struct libdeflate_decompressor *d, const u8 *out,
+		      const u8 *block_end)
+{
+	if (d->checksum_func != NULL) {
+		size_t end = block_end - out;
+
+		d->checksum = (*d->checksum_func)(d->checksum,
+						  &out[d->checksum_nbytes],
+						  end - d->checksum_nbytes);
+		d->checksum_nbytes = end;
+	}
+}
+
 /*****************************************************************************
  *                         Main decompression routine
  *****************************************************************************/
@@ -1075,17 +1801,29 @@ typedef enum libdeflate_result (*decompress_func_t)
 	 void * restrict out, size_t out_nbytes_avail,
 	 size_t *actual_in_nbytes_ret, size_t *actual_out_nbytes_ret);
 
+typedef enum deflate_stream_status (*decompress_stream_func_t)
+	(struct libdeflate_decompressor * restrict d,
+	 struct deflate_decompress_stream * restrict s,
+	 const u8 *in, size_t in_nbytes, size_t *in_used_ret);
+
 #define FUNCNAME deflate_decompress_default
+#define STREAM_FUNCNAME deflate_decompress_stream_default
 #undef ATTRIBUTES
 #undef EXTRACT_VARBITS
 #undef EXTRACT_VARBITS8
+#undef COPY_MATCH
+#undef LITLEN_TABLE_FUNCS
 #include "decompress_template.h"
 
 /* Include architecture-specific implementation(s) if available. */
 #undef DEFAULT_IMPL
+#undef DEFAULT_STREAM_IMPL
 #undef arch_select_decompress_func
+#undef arch_select_decompress_stream_func
 #if defined(ARCH_X86_32) || defined(ARCH_X86_64)
 #  include "x86/decompress_impl.h"
+#elif defined(ARCH_ARM64)
+#  include "arm/decompress_impl.h"
 #endif
 
 #ifndef DEFAULT_IMPL
@@ -1122,6 +1860,38 @@ dispatch_decomp(struct libdeflate_decompressor *d,
 #  define decompress_impl DEFAULT_IMPL
 #endif
 
+#ifndef DEFAULT_STREAM_IMPL
+#  define DEFAULT_STREAM_IMPL deflate_decompress_stream_default
+#endif
+
+#ifdef arch_select_decompress_stream_func
+static enum deflate_stream_status
+dispatch_decomp_stream(struct libdeflate_decompressor *d,
+		       struct deflate_decompress_stream *s,
+		       const u8 *in, size_t in_nbytes, size_t *in_used_ret);
+
+static volatile decompress_stream_func_t decompress_stream_impl =
+	dispatch_decomp_stream;
+
+/* Choose the best implementation at runtime. */
+static enum deflate_stream_status
+dispatch_decomp_stream(struct libdeflate_decompressor *d,
+		       struct deflate_decompress_stream *s,
+		       const u8 *in, size_t in_nbytes, size_t *in_used_ret)
+{
+	decompress_stream_func_t f = arch_select_decompress_stream_func();
+
+	if (f == NULL)
+		f = DEFAULT_STREAM_IMPL;
+
+	decompress_stream_impl = f;
+	return f(d, s, in, in_nbytes, in_used_ret);
+}
+#else
+/* The best implementation is statically known, so call it directly. */
+#  define decompress_stream_impl DEFAULT_STREAM_IMPL
+#endif
+
 /*
  * This is the main DEFLATE decompression routine.  See libdeflate.h for the
  * documentation.
@@ -1130,6 +1900,16 @@ dispatch_decomp(struct libdeflate_decompressor *d,
  * handles calling the appropriate implementation depending on the CPU features
  * at runtime.
  */
+/* Clear the checkpoint index, if any, before decompressing a new stream. */
+static void
+reset_index(struct libdeflate_decompressor *d)
+{
+	if (d->index) {
+		d->index->num_checkpoints = 0;
+		d->index->next_out_pos = d->index->spacing;
+	}
+}
+
 LIBDEFLATEAPI enum libdeflate_result
 libdeflate_deflate_decompress_ex(struct libdeflate_decompressor *d,
 				 const void *in, size_t in_nbytes,
@@ -1137,10 +1917,252 @@ libdeflate_deflate_decompress_ex(struct libdeflate_decompressor *d,
 				 size_t *actual_in_nbytes_ret,
 				 size_t *actual_out_nbytes_ret)
 {
+	/*
+	 * Try the offload backend if there is one, unless the input is too
+	 * small for it or the call needs something that only the software
+	 * decompressor provides.  Anything but success falls back to software,
+	 * which then decides the result code.
+	 */
+	if (d->backend.deflate_decompress != NULL &&
+	    in_nbytes >= d->backend.min_decompress_nbytes &&
+	    d->index == NULL && d->block_callback == NULL) {
+		size_t in_ret, out_ret;
+
+		if ((*d->backend.deflate_decompress)(d->backend.ctx,
+						     in, in_nbytes,
+						     out, out_nbytes_avail,
+						     &in_ret, &out_ret) ==
+		    LIBDEFLATE_SUCCESS) {
+			if (actual_in_nbytes_ret)
+				*actual_in_nbytes_ret = in_ret;
+			if (actual_out_nbytes_ret)
+				*actual_out_nbytes_ret = out_ret;
+			else if (out_ret != out_nbytes_avail)
+				return LIBDEFLATE_SHORT_OUTPUT;
+			return LIBDEFLATE_SUCCESS;
+		}
+	}
+	reset_index(d);
 	return decompress_impl(d, in, in_nbytes, out, out_nbytes_avail,
 			       actual_in_nbytes_ret, actual_out_nbytes_ret);
 }
 
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_padded(struct libdeflate_decompressor *d,
+				     const void *in, size_t in_nbytes,
+				     void *out, size_t out_nbytes_avail,
+				     size_t *actual_in_nbytes_ret,
+				     size_t *actual_out_nbytes_ret)
+{
+	enum libdeflate_result result;
+
+	STATIC_ASSERT(FASTLOOP_MAX_BYTES_READ <=
+		      LIBDEFLATE_DECOMPRESS_IN_PADDING);
+	STATIC_ASSERT(FASTLOOP_MAX_BYTES_WRITTEN <=
+		      LIBDEFLATE_DECOMPRESS_OUT_PADDING);
+
+	d->padded = true;
+	result = libdeflate_deflate_decompress_ex(d, in, in_nbytes,
+						  out, out_nbytes_avail,
+						  actual_in_nbytes_ret,
+						  actual_out_nbytes_ret);
+	d->padded = false;
+	return result;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_with_dict(struct libdeflate_decompressor *d,
+					const void *dict, size_t dict_nbytes,
+					const void *in, size_t in_nbytes,
+					void *out, size_t out_nbytes_avail,
+					size_t *actual_in_nbytes_ret,
+					size_t *actual_out_nbytes_ret)
+{
+	enum libdeflate_result result;
+
+	/* Matches can't reach back further than one window. */
+	if (dict_nbytes > DEFLATE_MAX_MATCH_OFFSET) {
+		dict = (const u8 *)dict + dict_nbytes - DEFLATE_MAX_MATCH_OFFSET;
+		dict_nbytes = DEFLATE_MAX_MATCH_OFFSET;
+	}
+	d->dict = dict;
+	d->dict_nbytes = dict_nbytes;
+	reset_index(d);
+	result = decompress_impl(d, in, in_nbytes, out, out_nbytes_avail,
+				 actual_in_nbytes_ret, actual_out_nbytes_ret);
+	d->dict_nbytes = 0;
+	return result;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_from_checkpoint(
+			struct libdeflate_decompressor *d,
+			const struct libdeflate_checkpoint *checkpoint,
+			const void *in, size_t in_nbytes,
+			void *out, size_t out_nbytes_avail,
+			size_t *actual_in_nbytes_ret,
+			size_t *actual_out_nbytes_ret)
+{
+	struct libdeflate_index *index = d->index;
+	enum libdeflate_result result;
+
+	if (checkpoint != NULL) {
+		if (checkpoint->window_nbytes > DEFLATE_MAX_MATCH_OFFSET)
+			return LIBDEFLATE_BAD_DATA;
+		d->dict = checkpoint->window;
+		d->dict_nbytes = checkpoint->window_nbytes;
+		d->start_bits = checkpoint->in_bitpos & 7;
+	}
+	d->index = NULL;
+	d->partial_output = true;
+	result = decompress_impl(d, in, in_nbytes, out, out_nbytes_avail,
+				 actual_in_nbytes_ret, actual_out_nbytes_ret);
+	d->partial_output = false;
+	d->start_bits = 0;
+	d->dict_nbytes = 0;
+	d->index = index;
+	return result;
+}
+
+/*
+ * Set the offset of the DEFLATE stream in the buffer given to
+ * libdeflate_zlib_decompress*() or libdeflate_gzip_decompress*(), which is
+ * added to the input positions of any checkpoints recorded.
+ */
+void
+libdeflate_set_index_in_offset(struct libdeflate_decompressor *d,
+			       size_t offset)
+{
+	d->index_in_offset = offset;
+}
+
+/*
+ * Make the next decompression with @d also compute @func, starting from
+ * @checksum, over the output as it is produced.  This is used for the zlib and
+ * gzip checksums.
+ */
+void
+libdeflate_begin_checksum(struct libdeflate_decompressor *d,
+			  checksum_func_t func, u32 checksum)
+{
+	d->checksum_func = func;
+	d->checksum = checksum;
+	d->checksum_nbytes = 0;
+}
+
+/*
+ * Return the checksum of the @out_nbytes bytes of output at @out, given after
+ * a successful decompression (or 0 after a failed one), and stop computing
+ * checksums.  Any output that wasn't checksummed during decompression, e.g.
+ * because the offload backend did it, is checksummed now.
+ */
+u32
+libdeflate_end_checksum(struct libdeflate_decompressor *d,
+			const void *out, size_t out_nbytes)
+{
+	u32 checksum = d->checksum;
+
+	if (out_nbytes > d->checksum_nbytes)
+		checksum = (*d->checksum_func)(checksum,
+					       (const u8 *)out +
+					       d->checksum_nbytes,
+					       out_nbytes - d->checksum_nbytes);
+	d->checksum_func = NULL;
+	return checksum;
+}
+
+LIBDEFLATEAPI struct libdeflate_index *
+libdeflate_alloc_index(struct libdeflate_decompressor *d, size_t spacing)
+{
+	struct libdeflate_index *index = (*d->malloc_func)(sizeof(*index));
+
+	if (index == NULL)
+		return NULL;
+	index->spacing = spacing;
+	index->next_out_pos = spacing;
+	index->checkpoints = NULL;
+	index->num_checkpoints = 0;
+	index->capacity = 0;
+	index->malloc_func = d->malloc_func;
+	index->free_func = d->free_func;
+	return index;
+}
+
+LIBDEFLATEAPI void
+libdeflate_set_index(struct libdeflate_decompressor *d,
+		     struct libdeflate_index *index)
+{
+	d->index = index;
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_index_num_checkpoints(const struct libdeflate_index *index)
+{
+	return index->num_checkpoints;
+}
+
+LIBDEFLATEAPI const struct libdeflate_checkpoint *
+libdeflate_index_get_checkpoint(const struct libdeflate_index *index, size_t i)
+{
+	if (i >= index->num_checkpoints)
+		return NULL;
+	return &index->checkpoints[i];
+}
+
+LIBDEFLATEAPI const struct libdeflate_checkpoint *
+libdeflate_index_find_checkpoint(const struct libdeflate_index *index,
+				 uint64_t out_pos)
+{
+	size_t lo = 0, hi = index->num_checkpoints;
+
+	/* Binary search for the last checkpoint with out_pos <= 'out_pos'. */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (index->checkpoints[mid].out_pos <= out_pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &index->checkpoints[lo - 1] : NULL;
+}
+
+LIBDEFLATEAPI void
+libdeflate_free_index(struct libdeflate_index *index)
+{
+	if (index) {
+		(*index->free_func)(index->checkpoints);
+		(*index->free_func)(index);
+	}
+}
+
+LIBDEFLATEAPI void
+libdeflate_set_block_callback(struct libdeflate_decompressor *d,
+			      void (*callback)(void *ctx,
+					       const struct libdeflate_block_info *info),
+			      void *ctx)
+{
+	d->block_callback = callback;
+	d->block_callback_ctx = ctx;
+}
+
+LIBDEFLATEAPI void
+libdeflate_get_decompress_stats(struct libdeflate_decompressor *d,
+				struct libdeflate_decompress_stats *stats)
+{
+	size_t sizeof_stats = stats->sizeof_stats;
+
+	/* Copy only the fields the caller's version of the struct has. */
+	d->stats.sizeof_stats = sizeof_stats;
+	memcpy(stats, &d->stats, MIN(sizeof_stats, sizeof(d->stats)));
+}
+
+LIBDEFLATEAPI void
+libdeflate_reset_decompress_stats(struct libdeflate_decompressor *d)
+{
+	memset(&d->stats, 0, sizeof(d->stats));
+}
+
 LIBDEFLATEAPI enum libdeflate_result
 libdeflate_deflate_decompress(struct libdeflate_decompressor *d,
 			      const void *in, size_t in_nbytes,
@@ -1152,16 +2174,24 @@ libdeflate_deflate_decompress(struct libdeflate_decompressor *d,
 						NULL, actual_out_nbytes_ret);
 }
 
+/* The size of the memory that libdeflate_alloc_decompressor() allocates */
+size_t
+libdeflate_decompressor_alloc_size(void)
+{
+	return sizeof(struct libdeflate_decompressor);
+}
+
 LIBDEFLATEAPI struct libdeflate_decompressor *
 libdeflate_alloc_decompressor_ex(const struct libdeflate_options *options)
 {
 	struct libdeflate_decompressor *d;
+	struct libdeflate_options opts;
+	struct libdeflate_backend backend;
 
-	/*
-	 * Note: if more fields are added to libdeflate_options, this code will
-	 * need to be updated to support both the old and new structs.
-	 */
-	if (options->sizeof_options != sizeof(*options))
+	if (!libdeflate_get_options(options, &opts))
+		return NULL;
+	options = &opts;
+	if (!libdeflate_get_backend(options->backend, &backend))
 		return NULL;
 
 	d = (options->malloc_func ? options->malloc_func :
@@ -1172,7 +2202,8 @@ libdeflate_alloc_decompressor_ex(const struct libdeflate_options *options)
 	 * Note that only certain parts of the decompressor actually must be
 	 * initialized here:
 	 *
-	 * - 'static_codes_loaded' must be initialized to false.
+	 * - 'static_codes_loaded' and 'dynamic_codes_loaded' must be initialized
+	 *   to false.
 	 *
 	 * - The first half of the main portion of each decode table must be
 	 *   initialized to any value, to avoid reading from uninitialized
@@ -1186,8 +2217,11 @@ libdeflate_alloc_decompressor_ex(const struct libdeflate_options *options)
 	 * But for simplicity, we currently just zero the whole decompressor.
 	 */
 	memset(d, 0, sizeof(*d));
+	d->malloc_func = options->malloc_func ?
+			 options->malloc_func : libdeflate_default_malloc_func;
 	d->free_func = options->free_func ?
 		       options->free_func : libdeflate_default_free_func;
+	d->backend = backend;
 	return d;
 }
 
@@ -1203,6 +2237,613 @@ libdeflate_alloc_decompressor(void)
 LIBDEFLATEAPI void
 libdeflate_free_decompressor(struct libdeflate_decompressor *d)
 {
-	if (d)
+	if (d) {
+		if (d->stream)
+			d->free_func(d->stream);
 		d->free_func(d);
+	}
+}
+
+LIBDEFLATEAPI int
+libdeflate_deflate_decompress_stream_begin(struct libdeflate_decompressor *d)
+{
+	struct deflate_decompress_stream *s = d->stream;
+
+	if (s == NULL) {
+		s = d->malloc_func(sizeof(*s));
+		if (s == NULL)
+			return -1;
+		d->stream = s;
+	}
+	s->bitbuf = 0;
+	s->bitsleft = 0;
+	s->state = STREAM_STATE_BLOCK_HEADER;
+	s->is_final_block = false;
+	s->failed = false;
+	s->stored_len_remaining = 0;
+	s->out_pos = 0;
+	s->flush_pos = 0;
+	s->carry_nbytes = 0;
+	return 0;
+}
+
+/*
+ * Decode more of the stream into s->window, consuming input from *in_next_p.
+ * First, if the window doesn't have room for another match, discard all but
+ * the history that future matches can refer to; so all decoded data must have
+ * been flushed.  Input that ends partway through a block header or symbol is
+ * kept in s->carry and counts as consumed.  If the data is invalid, *in_next_p
+ * is left unchanged.
+ */
+static enum deflate_stream_status
+deflate_decompress_stream_step(struct libdeflate_decompressor *d,
+			       struct deflate_decompress_stream *s,
+			       const u8 **in_next_p, const u8 *in_end)
+{
+	const u8 *in_next = *in_next_p;
+	enum deflate_stream_status status;
+	size_t used;
+	size_t n;
+
+	ASSERT(s->flush_pos == s->out_pos);
+	if (STREAM_WINDOW_SIZE - s->out_pos < DEFLATE_MAX_MATCH_LEN) {
+		memmove(s->window,
+			&s->window[s->out_pos - DEFLATE_MAX_MATCH_OFFSET],
+			DEFLATE_MAX_MATCH_OFFSET);
+		s->out_pos = DEFLATE_MAX_MATCH_OFFSET;
+		s->flush_pos = DEFLATE_MAX_MATCH_OFFSET;
+	}
+
+	if (s->carry_nbytes) {
+		/*
+		 * Input was kept from an earlier call.  Top it up with new
+		 * input and decode from the carry buffer, until the decoder has
+		 * gotten past the kept bytes.
+		 */
+		size_t kept = s->carry_nbytes;
+		size_t total;
+
+		n = MIN(in_end - in_next, STREAM_CARRY_SIZE - kept);
+		if (n)
+			memcpy(&s->carry[kept], in_next, n);
+		total = kept + n;
+		status = decompress_stream_impl(d, s, s->carry, total, &used);
+		if (status == STREAM_BAD_DATA)
+			goto bad_data;
+		if (used >= kept) {
+			in_next += used - kept;
+			s->carry_nbytes = 0;
+		} else {
+			in_next += n;
+			memmove(s->carry, &s->carry[used], total - used);
+			s->carry_nbytes = total - used;
+		}
+	} else {
+		status = decompress_stream_impl(d, s, in_next,
+						in_end - in_next, &used);
+		if (status == STREAM_BAD_DATA)
+			goto bad_data;
+		in_next += used;
+		if (status == STREAM_NEED_INPUT && in_next != in_end) {
+			/* Keep the incomplete block header or symbol. */
+			n = in_end - in_next;
+			ASSERT(n <= STREAM_CARRY_SIZE);
+			memcpy(s->carry, in_next, n);
+			s->carry_nbytes = n;
+			in_next = in_end;
+		}
+	}
+	*in_next_p = in_next;
+	return status;
+
+bad_data:
+	/* Consume nothing from a step that failed. */
+	s->failed = true;
+	return STREAM_BAD_DATA;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_stream_update(struct libdeflate_decompressor *d,
+					    const void *in, size_t in_nbytes,
+					    void *out, size_t out_nbytes_avail,
+					    size_t *actual_in_nbytes_ret,
+					    size_t *actual_out_nbytes_ret)
+{
+	struct deflate_decompress_stream *s = d->stream;
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	u8 *out_next = out;
+	u8 * const out_end = out_next + out_nbytes_avail;
+	enum deflate_stream_status status = STREAM_NEED_OUTPUT;
+	enum libdeflate_result result = LIBDEFLATE_IN_PROGRESS;
+
+	*actual_in_nbytes_ret = 0;
+	*actual_out_nbytes_ret = 0;
+	if (s == NULL || s->failed)
+		return LIBDEFLATE_BAD_DATA;
+
+	for (;;) {
+		size_t n = MIN(s->out_pos - s->flush_pos, out_end - out_next);
+
+		/* Copy out the data decoded so far. */
+		if (n) {
+			memcpy(out_next, &s->window[s->flush_pos], n);
+			out_next += n;
+			s->flush_pos += n;
+		}
+		if (s->flush_pos != s->out_pos)
+			break;
+		if (s->state == STREAM_STATE_DONE) {
+			result = LIBDEFLATE_SUCCESS;
+			break;
+		}
+		if (status == STREAM_NEED_INPUT && in_next == in_end)
+			break;
+		status = deflate_decompress_stream_step(d, s, &in_next, in_end);
+		if (status == STREAM_BAD_DATA) {
+			result = LIBDEFLATE_BAD_DATA;
+			break;
+		}
+	}
+	*actual_in_nbytes_ret = in_next - (const u8 *)in;
+	*actual_out_nbytes_ret = out_next - (u8 *)out;
+	return result;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_to_sink(struct libdeflate_decompressor *d,
+				      const void *in, size_t in_nbytes,
+				      int (*sink)(void *ctx, const void *data,
+						  size_t nbytes),
+				      void *ctx,
+				      size_t *actual_in_nbytes_ret,
+				      size_t *actual_out_nbytes_ret)
+{
+	struct deflate_decompress_stream *s;
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	enum deflate_stream_status status;
+	enum libdeflate_result result;
+	size_t out_nbytes = 0;
+
+	if (libdeflate_deflate_decompress_stream_begin(d) != 0)
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+	s = d->stream;
+
+	for (;;) {
+		status = deflate_decompress_stream_step(d, s, &in_next, in_end);
+		if (status == STREAM_BAD_DATA ||
+		    (status == STREAM_NEED_INPUT && in_next == in_end)) {
+			/* The data is invalid or truncated. */
+			result = LIBDEFLATE_BAD_DATA;
+			break;
+		}
+		/* Pass the newly decoded data to the sink, from the window. */
+		if (s->out_pos != s->flush_pos) {
+			size_t n = s->out_pos - s->flush_pos;
+
+			if ((*sink)(ctx, &s->window[s->flush_pos], n) != 0) {
+				result = LIBDEFLATE_INSUFFICIENT_SPACE;
+				break;
+			}
+			out_nbytes += n;
+			s->flush_pos = s->out_pos;
+		}
+		if (s->state == STREAM_STATE_DONE) {
+			result = LIBDEFLATE_SUCCESS;
+			break;
+		}
+	}
+	/* The decompressor's stream state was borrowed; leave it unusable. */
+	s->failed = true;
+	if (actual_in_nbytes_ret)
+		*actual_in_nbytes_ret = in_next - (const u8 *)in;
+	if (actual_out_nbytes_ret)
+		*actual_out_nbytes_ret = out_nbytes;
+	return result;
+}
+
+/* State of the sink used by libdeflate_deflate_decompress_iov() */
+struct out_iovec_sink {
+	const struct libdeflate_out_iovec *iov;
+	size_t iovcnt;
+	size_t pos;	/* position in iov[0] */
+};
+
+static int
+out_iovec_sink(void *ctx, const void *data, size_t nbytes)
+{
+	struct out_iovec_sink *sink = ctx;
+	const u8 *src = data;
+
+	while (nbytes) {
+		size_t n;
+
+		if (sink->iovcnt == 0)
+			return -1;
+		n = MIN(nbytes, sink->iov->nbytes - sink->pos);
+		if (n)
+			memcpy((u8 *)sink->iov->data + sink->pos, src, n);
+		src += n;
+		nbytes -= n;
+		sink->pos += n;
+		if (sink->pos == sink->iov->nbytes) {
+			sink->iov++;
+			sink->iovcnt--;
+			sink->pos = 0;
+		}
+	}
+	return 0;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_iov(struct libdeflate_decompressor *d,
+				  const void *in, size_t in_nbytes,
+				  const struct libdeflate_out_iovec *iov,
+				  size_t iovcnt,
+				  size_t *actual_in_nbytes_ret,
+				  size_t *actual_out_nbytes_ret)
+{
+	struct out_iovec_sink sink = { iov, iovcnt, 0 };
+	enum libdeflate_result result;
+	size_t out_nbytes;
+
+	result = libdeflate_deflate_decompress_to_sink(d, in, in_nbytes,
+						       out_iovec_sink, &sink,
+						       actual_in_nbytes_ret,
+						       &out_nbytes);
+	if (result != LIBDEFLATE_SUCCESS)
+		return result;
+
+	if (actual_out_nbytes_ret) {
+		*actual_out_nbytes_ret = out_nbytes;
+	} else {
+		/* All the output space must have been filled. */
+		while (sink.iovcnt && sink.pos == sink.iov->nbytes) {
+			sink.iov++;
+			sink.iovcnt--;
+			sink.pos = 0;
+		}
+		if (sink.iovcnt != 0)
+			return LIBDEFLATE_SHORT_OUTPUT;
+	}
+	return LIBDEFLATE_SUCCESS;
+}
+
+/*****************************************************************************
+ *                         Speculative decompression
+ *****************************************************************************/
+
+/*
+ * Read the header of the dynamic Huffman block that may begin at bit @bitpos of
+ * @in, and build its decode tables.  Besides being valid, the header must
+ * allow the block to end, i.e. the end-of-block symbol must have a codeword.
+ */
+static enum libdeflate_result
+read_dynamic_header_at(struct libdeflate_decompressor *d,
+		       const u8 *in, size_t in_nbytes, u64 bitpos)
+{
+	const u8 *in_next = &in[bitpos / 8];
+	const u8 * const in_end = &in[in_nbytes];
+	bitbuf_t bitbuf = 0;
+	u32 bitsleft = 0;
+	size_t overread_count = 0;
+	unsigned num_litlen_syms;
+	unsigned num_offset_syms;
+	u32 entry;
+
+	REFILL_BITS();
+	bitbuf >>= bitpos % 8;
+	bitsleft -= bitpos % 8;
+	REFILL_BITS();
+	{
+#include "decompress_dynamic_header.h"
+	}
+	SAFETY_CHECK(d->u.l.lens[DEFLATE_END_OF_BLOCK] != 0);
+	SAFETY_CHECK(build_dynamic_decode_tables(d, num_litlen_syms,
+						 num_offset_syms,
+						 &default_litlen_table_funcs));
+	return LIBDEFLATE_SUCCESS;
+}
+
+bool
+libdeflate_deflate_find_block(struct libdeflate_decompressor *d,
+			      const u8 *in, size_t in_nbytes,
+			      u64 start_bitpos, u64 end_bitpos,
+			      u64 *bitpos_ret)
+{
+	u64 bitpos;
+
+	/*
+	 * Stop a few bytes before the end, so that the fixed-length fields can
+	 * be read with word accesses.  A real dynamic block header is longer.
+	 */
+	end_bitpos = MIN(end_bitpos, (u64)MAX(in_nbytes, 16) * 8 - 16 * 8);
+
+	for (bitpos = start_bitpos; bitpos < end_bitpos; bitpos++) {
+		const u8 *p = &in[bitpos / 8];
+		u64 bits = get_unaligned_le64(p) >> (bitpos % 8);
+		unsigned num_precode_lens;
+		u32 codespace_used = 0;
+		unsigned i;
+
+		/*
+		 * Most positions are rejected by the first 17 bits: BFINAL must
+		 * be 0, BTYPE must be dynamic, and HLIT and HDIST must be in
+		 * range.
+		 */
+		if ((bits & BITMASK(3)) != (DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN << 1) ||
+		    ((bits >> 3) & BITMASK(5)) > 29 ||
+		    ((bits >> 8) & BITMASK(5)) > 29)
+			continue;
+
+		/*
+		 * Then the precode must be complete.  Real compressors always
+		 * use at least two precode symbols, so this doesn't reject any
+		 * real blocks.
+		 */
+		num_precode_lens = 4 + ((bits >> 13) & BITMASK(4));
+		for (i = 0; i < num_precode_lens; i++) {
+			u64 len_bitpos = bitpos + 17 + 3 * i;
+			unsigned len = (get_unaligned_le16(&in[len_bitpos / 8]) >>
+					(len_bitpos % 8)) & BITMASK(3);
+
+			if (len)
+				codespace_used += 1U << (DEFLATE_MAX_PRE_CODEWORD_LEN -
+							 len);
+		}
+		if (codespace_used != 1U << DEFLATE_MAX_PRE_CODEWORD_LEN)
+			continue;
+
+		/* Finally, the rest of the header must be valid too. */
+		if (read_dynamic_header_at(d, in, in_nbytes, bitpos) ==
+		    LIBDEFLATE_SUCCESS) {
+			*bitpos_ret = bitpos;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Make room for at least @n more symbols in @buf. */
+static bool
+grow_marker_buf(struct libdeflate_decompressor *d,
+		struct deflate_marker_buf *buf, size_t n)
+{
+	size_t capacity = MAX(buf->capacity, 65536);
+	u16 *syms;
+
+	while (capacity - buf->num_syms < n)
+		capacity *= 2;
+	syms = (*d->malloc_func)(capacity * sizeof(syms[0]));
+	if (syms == NULL)
+		return false;
+	if (buf->syms != NULL) {
+		memcpy(syms, buf->syms, buf->num_syms * sizeof(syms[0]));
+		(*d->free_func)(buf->syms);
+	}
+	buf->syms = syms;
+	buf->capacity = capacity;
+	return true;
+}
+
+void
+libdeflate_free_marker_buf(struct libdeflate_decompressor *d,
+			   struct deflate_marker_buf *buf)
+{
+	if (buf->syms != NULL)
+		(*d->free_func)(buf->syms);
+	buf->syms = NULL;
+	buf->num_syms = 0;
+	buf->capacity = 0;
+}
+
+/*
+ * This is like the generic loop of decompress_template.h, except that it
+ * decodes into 16-bit symbols and turns references to before the start of the
+ * output into markers.  It's slower than the regular decompressor, but the
+ * point is that many instances of it can run at once.
+ */
+enum libdeflate_result
+libdeflate_deflate_decompress_markers(struct libdeflate_decompressor *d,
+				      const u8 *in, size_t in_nbytes,
+				      u64 start_bitpos, u64 stop_bitpos,
+				      size_t max_syms,
+				      struct deflate_marker_buf *buf,
+				      u64 *end_bitpos_ret, bool *is_final_ret)
+{
+	const u8 * const in_begin = &in[start_bitpos / 8];
+	const u8 *in_next = in_begin;
+	const u8 * const in_end = &in[in_nbytes];
+	bitbuf_t bitbuf = 0;
+	bitbuf_t saved_bitbuf;
+	u32 bitsleft = 0;
+	size_t overread_count = 0;
+	size_t pos = 0;
+
+	bool is_final_block;
+	unsigned block_type;
+	unsigned num_litlen_syms;
+	unsigned num_offset_syms;
+	bitbuf_t litlen_tablemask;
+	u32 entry;
+	u64 block_bitpos;
+
+	buf->num_syms = 0;
+	REFILL_BITS();
+	bitbuf >>= start_bitpos % 8;
+	bitsleft -= start_bitpos % 8;
+
+next_block:
+	block_bitpos = (start_bitpos - start_bitpos % 8) +
+		       ((u64)(in_next - in_begin + overread_count) * 8) -
+		       (u8)bitsleft;
+	if (block_bitpos >= stop_bitpos) {
+		SAFETY_CHECK(overread_count <= ((u8)bitsleft >> 3));
+		is_final_block = false;
+		goto done;
+	}
+
+	STATIC_ASSERT(CAN_CONSUME(1 + 2 + 5 + 5 + 4 + 3));
+	REFILL_BITS();
+
+	is_final_block = bitbuf & BITMASK(1);
+	block_type = (bitbuf >> 1) & BITMASK(2);
+
+	if (block_type == DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN) {
+#include "decompress_dynamic_header.h"
+	} else if (block_type == DEFLATE_BLOCKTYPE_UNCOMPRESSED) {
+		u16 len, nlen;
+		u16 i;
+
+		/* Align to the next byte boundary, as in the template. */
+		bitsleft -= 3;
+		bitsleft = (u8)bitsleft;
+		SAFETY_CHECK(overread_count <= (bitsleft >> 3));
+		in_next -= (bitsleft >> 3) - overread_count;
+		overread_count = 0;
+		bitbuf = 0;
+		bitsleft = 0;
+
+		SAFETY_CHECK(in_end - in_next >= 4);
+		len = get_unaligned_le16(in_next);
+		nlen = get_unaligned_le16(in_next + 2);
+		in_next += 4;
+
+		SAFETY_CHECK(len == (u16)~nlen);
+		SAFETY_CHECK(len <= in_end - in_next);
+		if (len > max_syms - pos)
+			return LIBDEFLATE_INSUFFICIENT_SPACE;
+		buf->num_syms = pos;
+		if (buf->capacity - pos < len && !grow_marker_buf(d, buf, len))
+			return LIBDEFLATE_INSUFFICIENT_SPACE;
+		for (i = 0; i < len; i++)
+			buf->syms[pos++] = *in_next++;
+		goto block_done;
+	} else {
+		SAFETY_CHECK(block_type == DEFLATE_BLOCKTYPE_STATIC_HUFFMAN);
+		bitbuf >>= 3;
+		bitsleft -= 3;
+		if (!d->static_codes_loaded)
+			load_static_decode_tables(d);
+		goto have_decode_tables;
+	}
+
+	SAFETY_CHECK(build_dynamic_decode_tables(d, num_litlen_syms,
+						 num_offset_syms,
+						 &default_litlen_table_funcs));
+have_decode_tables:
+	litlen_tablemask = BITMASK(d->litlen_tablebits);
+
+	for (;;) {
+		u32 length, offset;
+		u16 *syms;
+
+		if (unlikely(buf->capacity - pos < DEFLATE_MAX_MATCH_LEN)) {
+			if (pos > max_syms)
+				return LIBDEFLATE_INSUFFICIENT_SPACE;
+			buf->num_syms = pos;
+			if (!grow_marker_buf(d, buf, DEFLATE_MAX_MATCH_LEN))
+				return LIBDEFLATE_INSUFFICIENT_SPACE;
+		}
+		syms = buf->syms;
+
+		REFILL_BITS();
+		entry = d->litlen_decode_table[bitbuf & litlen_tablemask];
+		saved_bitbuf = bitbuf;
+		bitbuf >>= (u8)entry;
+		bitsleft -= entry;
+		if (unlikely(entry & HUFFDEC_SUBTABLE_POINTER)) {
+			entry = d->litlen_decode_table[(entry >> 16) +
+					(bitbuf & BITMASK((entry >> 8) & 0x3F))];
+			saved_bitbuf = bitbuf;
+			bitbuf >>= (u8)entry;
+			bitsleft -= entry;
+		}
+		length = entry >> 16;
+		if (entry & HUFFDEC_LITERAL) {
+			syms[pos++] = length & 0xFF;
+			if (entry & HUFFDEC_2LITERALS)
+				syms[pos++] = (length >> 8) & 0x7F;
+			continue;
+		}
+		if (unlikely(entry & HUFFDEC_END_OF_BLOCK))
+			goto block_done;
+		length += (saved_bitbuf & BITMASK((u8)entry)) >> (u8)(entry >> 8);
+
+		if (!CAN_CONSUME(LENGTH_MAXBITS + OFFSET_MAXBITS))
+			REFILL_BITS();
+		entry = d->offset_decode_table[bitbuf & BITMASK(OFFSET_TABLEBITS)];
+		if (unlikely(entry & HUFFDEC_EXCEPTIONAL)) {
+			bitbuf >>= OFFSET_TABLEBITS;
+			bitsleft -= OFFSET_TABLEBITS;
+			entry = d->offset_decode_table[(entry >> 16) +
+					(bitbuf & BITMASK((entry >> 8) & 0x3F))];
+			if (!CAN_CONSUME(OFFSET_MAXBITS))
+				REFILL_BITS();
+		}
+		offset = entry >> 16;
+		offset += (bitbuf & BITMASK((u8)entry)) >> (u8)(entry >> 8);
+		bitbuf >>= (u8)entry;
+		bitsleft -= entry;
+
+		if (likely(offset <= pos)) {
+			const u16 *src = &syms[pos - offset];
+			u16 *dst = &syms[pos];
+
+			pos += length;
+			do {
+				*dst++ = *src++;
+			} while (dst < &syms[pos]);
+		} else {
+			/* The match starts before the output: emit markers. */
+			do {
+				syms[pos] = (offset <= pos) ?
+					    syms[pos - offset] :
+					    DEFLATE_MARKER_BASE +
+					    (offset - pos) - 1;
+				pos++;
+			} while (--length);
+		}
+	}
+
+block_done:
+	if (!is_final_block)
+		goto next_block;
+
+	/* That was the last block. */
+	bitsleft = (u8)bitsleft;
+	SAFETY_CHECK(overread_count <= (bitsleft >> 3));
+	block_bitpos = (start_bitpos - start_bitpos % 8) +
+		       ((u64)(in_next - in_begin + overread_count) * 8) -
+		       bitsleft;
+done:
+	if (pos > max_syms)
+		return LIBDEFLATE_INSUFFICIENT_SPACE;
+	buf->num_syms = pos;
+	*end_bitpos_ret = block_bitpos;
+	*is_final_ret = is_final_block;
+	return LIBDEFLATE_SUCCESS;
+}
+
+enum libdeflate_result
+libdeflate_deflate_decompress_at(struct libdeflate_decompressor *d,
+				 const u8 *in, size_t in_nbytes, u64 bitpos,
+				 const u8 *dict, size_t dict_nbytes,
+				 u8 *out, size_t out_nbytes_avail,
+				 size_t *actual_in_nbytes_ret,
+				 size_t *actual_out_nbytes_ret)
+{
+	enum libdeflate_result result;
+
+	d->dict = dict;
+	d->dict_nbytes = MIN(dict_nbytes, DEFLATE_MAX_MATCH_OFFSET);
+	d->dict += dict_nbytes - d->dict_nbytes;
+	d->start_bits = bitpos % 8;
+	result = decompress_impl(d, &in[bitpos / 8], in_nbytes - bitpos / 8,
+				 out, out_nbytes_avail,
+				 actual_in_nbytes_ret, actual_out_nbytes_ret);
+	d->start_bits = 0;
+	d->dict_nbytes = 0;
+	return result;
 }
@@ -0,0 +1,74 @@
+#ifndef LIB_DEFLATE_DECOMPRESS_H
+#define LIB_DEFLATE_DECOMPRESS_H
+
+#include "lib_common.h"
+
+/*
+ * DEFLATE decompression is private to deflate_decompress.c, but to decompress
+ * a single stream in parallel we do need to be able to find block boundaries
+ * in it, to decompress from a block boundary without knowing the data that
+ * precedes it, and to decompress from a bit position with a known window.
+ */
+
+struct libdeflate_decompressor;
+
+/*
+ * A symbol decoded by libdeflate_deflate_decompress_markers() that is at least
+ * DEFLATE_MARKER_BASE is a marker for the byte 'sym - DEFLATE_MARKER_BASE + 1'
+ * bytes before the start of the output, which wasn't known when decoding.
+ * Symbols below DEFLATE_MARKER_BASE are the bytes themselves.
+ */
+#define DEFLATE_MARKER_BASE	256
+
+/* A buffer of decoded symbols, grown as needed */
+struct deflate_marker_buf {
+	u16 *syms;
+	size_t num_syms;
+	size_t capacity;
+};
+
+/*
+ * Find the first bit position in [@start_bitpos, @end_bitpos) of @in at which a
+ * plausible non-final dynamic Huffman block begins.  This is a guess: a
+ * position that passes all the checks can still be in the middle of a block.
+ */
+bool libdeflate_deflate_find_block(struct libdeflate_decompressor *d,
+				   const u8 *in, size_t in_nbytes,
+				   u64 start_bitpos, u64 end_bitpos,
+				   u64 *bitpos_ret);
+
+/*
+ * Decompress the blocks that begin at bit @start_bitpos of @in into @buf, as
+ * symbols which are either bytes or markers for the unknown bytes that precede
+ * the output.  Stop at the final block's end, or at the first block that begins
+ * at or after bit @stop_bitpos (which must be greater than @start_bitpos), and
+ * return where that was and whether it was the end of the final block.  Return
+ * LIBDEFLATE_INSUFFICIENT_SPACE if more than @max_syms symbols would be decoded
+ * or if the buffer couldn't be grown.
+ */
+enum libdeflate_result
+libdeflate_deflate_decompress_markers(struct libdeflate_decompressor *d,
+				      const u8 *in, size_t in_nbytes,
+				      u64 start_bitpos, u64 stop_bitpos,
+				      size_t max_syms,
+				      struct deflate_marker_buf *buf,
+				      u64 *end_bitpos_ret, bool *is_final_ret);
+
+/* Free the symbols of @buf, which were allocated by @d's allocator. */
+void libdeflate_free_marker_buf(struct libdeflate_decompressor *d,
+				struct deflate_marker_buf *buf);
+
+/*
+ * Like libdeflate_deflate_decompress_ex(), but start at bit @bitpos of @in,
+ * with the @dict_nbytes bytes at @dict preceding the output.  The returned
+ * input size counts from the byte that contains bit @bitpos.
+ */
+enum libdeflate_result
+libdeflate_deflate_decompress_at(struct libdeflate_decompressor *d,
+				 const u8 *in, size_t in_nbytes, u64 bitpos,
+				 const u8 *dict, size_t dict_nbytes,
+				 u8 *out, size_t out_nbytes_avail,
+				 size_t *actual_in_nbytes_ret,
+				 size_t *actual_out_nbytes_ret);
+
+#endif /* LIB_DEFLATE_DECOMPRESS_H */
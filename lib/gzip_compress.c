@@ -28,15 +28,21 @@
 #include "deflate_compress.h"
 #include "gzip_constants.h"
 
-LIBDEFLATEAPI size_t
-libdeflate_gzip_compress(struct libdeflate_compressor *c,
-			 const void *in, size_t in_nbytes,
-			 void *out, size_t out_nbytes_avail)
+/*
+ * Compress the concatenation of the @iovcnt segments @iov to the gzip format.
+ */
+static size_t
+gzip_compress(struct libdeflate_compressor *c,
+	      const struct libdeflate_iovec *iov, size_t iovcnt,
+	      void *out, size_t out_nbytes_avail)
 {
 	u8 *out_next = out;
 	unsigned compression_level;
 	u8 xfl;
 	size_t deflate_size;
+	u32 crc = 0;
+	size_t in_nbytes = 0;
+	size_t i;
 
 	if (out_nbytes_avail <= GZIP_MIN_OVERHEAD)
 		return 0;
@@ -63,15 +69,30 @@ libdeflate_gzip_compress(struct libdeflate_compressor *c,
 	/* OS */
 	*out_next++ = GZIP_OS_UNKNOWN;	/* OS  */
 
-	/* Compressed data  */
-	deflate_size = libdeflate_deflate_compress(c, in, in_nbytes, out_next,
+	/*
+	 * Compressed data.  With a single segment, its CRC32 is computed along
+	 * the way, on each block while it is still in the cache.
+	 */
+	if (iovcnt == 1)
+		libdeflate_begin_input_checksum(c, libdeflate_crc32, 0,
+						iov->data);
+	deflate_size = libdeflate_deflate_compress_iov(c, iov, iovcnt, out_next,
 					out_nbytes_avail - GZIP_MIN_OVERHEAD);
+	if (iovcnt == 1)
+		crc = libdeflate_end_input_checksum(c, iov->data,
+						    deflate_size ?
+						    iov->nbytes : 0);
 	if (deflate_size == 0)
 		return 0;
 	out_next += deflate_size;
 
 	/* CRC32 */
-	put_unaligned_le32(libdeflate_crc32(0, in, in_nbytes), out_next);
+	for (i = 0; i < iovcnt; i++) {
+		if (iovcnt != 1)
+			crc = libdeflate_crc32(crc, iov[i].data, iov[i].nbytes);
+		in_nbytes += iov[i].nbytes;
+	}
+	put_unaligned_le32(crc, out_next);
 	out_next += 4;
 
 	/* ISIZE */
@@ -81,6 +102,24 @@ libdeflate_gzip_compress(struct libdeflate_compressor *c,
 	return out_next - (u8 *)out;
 }
 
+LIBDEFLATEAPI size_t
+libdeflate_gzip_compress(struct libdeflate_compressor *c,
+			 const void *in, size_t in_nbytes,
+			 void *out, size_t out_nbytes_avail)
+{
+	struct libdeflate_iovec iov = { in, in_nbytes };
+
+	return gzip_compress(c, &iov, 1, out, out_nbytes_avail);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_gzip_compress_iov(struct libdeflate_compressor *c,
+			     const struct libdeflate_iovec *iov, size_t iovcnt,
+			     void *out, size_t out_nbytes_avail)
+{
+	return gzip_compress(c, iov, iovcnt, out, out_nbytes_avail);
+}
+
 LIBDEFLATEAPI size_t
 libdeflate_gzip_compress_bound(struct libdeflate_compressor *c,
 			       size_t in_nbytes)
@@ -42,4 +42,21 @@
 #define GZIP_OS_RISCOS		13
 #define GZIP_OS_UNKNOWN		255
 
+/*
+ * BGZF ("blocked gzip"), used for genomics data, is a series of gzip members
+ * that each hold at most 64 KiB of compressed data and have an extra field with
+ * subfield "BC" holding BSIZE, the size of the member minus 1.  It ends with an
+ * empty member, the EOF marker.
+ */
+#define BGZF_SI1		'B'
+#define BGZF_SI2		'C'
+#define BGZF_SLEN		2
+#define BGZF_XLEN		(4 + BGZF_SLEN)
+#define BGZF_HEADER_SIZE	(GZIP_MIN_HEADER_SIZE + 2 + BGZF_XLEN)
+#define BGZF_MEMBER_OVERHEAD	(BGZF_HEADER_SIZE + GZIP_FOOTER_SIZE)
+#define BGZF_MAX_MEMBER_SIZE	65536
+
+/* The most data written to one member, as by other BGZF writers */
+#define BGZF_MAX_MEMBER_INPUT	65280
+
 #endif /* LIB_GZIP_CONSTANTS_H */
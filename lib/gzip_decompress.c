@@ -28,85 +28,162 @@
 #include "lib_common.h"
 #include "gzip_constants.h"
 
-LIBDEFLATEAPI enum libdeflate_result
-libdeflate_gzip_decompress_ex(struct libdeflate_decompressor *d,
-			      const void *in, size_t in_nbytes,
-			      void *out, size_t out_nbytes_avail,
-			      size_t *actual_in_nbytes_ret,
-			      size_t *actual_out_nbytes_ret)
+/*
+ * Parse the gzip header at the start of @in into @header.  Return its size, or
+ * 0 if it is invalid or isn't followed by room for the footer.
+ */
+static size_t
+gzip_parse_header(const u8 *in, size_t in_nbytes,
+		  struct libdeflate_gzip_header *header)
 {
 	const u8 *in_next = in;
 	const u8 * const in_end = in_next + in_nbytes;
 	u8 flg;
-	size_t actual_in_nbytes;
-	size_t actual_out_nbytes;
-	enum libdeflate_result result;
 
 	if (in_nbytes < GZIP_MIN_OVERHEAD)
-		return LIBDEFLATE_BAD_DATA;
+		return 0;
 
 	/* ID1 */
 	if (*in_next++ != GZIP_ID1)
-		return LIBDEFLATE_BAD_DATA;
+		return 0;
 	/* ID2 */
 	if (*in_next++ != GZIP_ID2)
-		return LIBDEFLATE_BAD_DATA;
+		return 0;
 	/* CM */
 	if (*in_next++ != GZIP_CM_DEFLATE)
-		return LIBDEFLATE_BAD_DATA;
+		return 0;
 	flg = *in_next++;
+	header->flags = flg;
 	/* MTIME */
+	header->mtime = get_unaligned_le32(in_next);
 	in_next += 4;
 	/* XFL */
-	in_next += 1;
+	header->xfl = *in_next++;
 	/* OS */
-	in_next += 1;
+	header->os = *in_next++;
 
 	if (flg & GZIP_FRESERVED)
-		return LIBDEFLATE_BAD_DATA;
+		return 0;
+
+	header->extra = NULL;
+	header->extra_nbytes = 0;
+	header->name = NULL;
+	header->comment = NULL;
+	header->member_nbytes = 0;
 
 	/* Extra field */
 	if (flg & GZIP_FEXTRA) {
 		u16 xlen = get_unaligned_le16(in_next);
+		size_t i;
+
 		in_next += 2;
 
 		if (in_end - in_next < (u32)xlen + GZIP_FOOTER_SIZE)
-			return LIBDEFLATE_BAD_DATA;
+			return 0;
+
+		header->extra = in_next;
+		header->extra_nbytes = xlen;
 
+		/* A BGZF member gives its size in the "BC" subfield. */
+		for (i = 0; xlen - i >= 4;
+		     i += 4 + get_unaligned_le16(&in_next[i + 2])) {
+			size_t slen = get_unaligned_le16(&in_next[i + 2]);
+
+			if (slen > xlen - i - 4)
+				break;
+			if (in_next[i] == BGZF_SI1 &&
+			    in_next[i + 1] == BGZF_SI2 && slen == BGZF_SLEN) {
+				header->member_nbytes =
+					get_unaligned_le16(&in_next[i + 4]) + 1;
+				break;
+			}
+		}
 		in_next += xlen;
 	}
 
 	/* Original file name (zero terminated) */
 	if (flg & GZIP_FNAME) {
+		header->name = (const char *)in_next;
 		while (*in_next++ != 0 && in_next != in_end)
 			;
 		if (in_end - in_next < GZIP_FOOTER_SIZE)
-			return LIBDEFLATE_BAD_DATA;
+			return 0;
 	}
 
 	/* File comment (zero terminated) */
 	if (flg & GZIP_FCOMMENT) {
+		header->comment = (const char *)in_next;
 		while (*in_next++ != 0 && in_next != in_end)
 			;
 		if (in_end - in_next < GZIP_FOOTER_SIZE)
-			return LIBDEFLATE_BAD_DATA;
+			return 0;
 	}
 
 	/* CRC16 for gzip header */
 	if (flg & GZIP_FHCRC) {
 		in_next += 2;
 		if (in_end - in_next < GZIP_FOOTER_SIZE)
-			return LIBDEFLATE_BAD_DATA;
+			return 0;
 	}
 
-	/* Compressed data  */
+	header->header_nbytes = in_next - in;
+
+	/* Ignore a member size that can't be right. */
+	if (header->member_nbytes < header->header_nbytes + GZIP_FOOTER_SIZE)
+		header->member_nbytes = 0;
+
+	return header->header_nbytes;
+}
+
+size_t
+libdeflate_gzip_parse_header(const u8 *in, size_t in_nbytes)
+{
+	struct libdeflate_gzip_header header;
+
+	return gzip_parse_header(in, in_nbytes, &header);
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_gzip_parse_header_ex(const void *in, size_t in_nbytes,
+				struct libdeflate_gzip_header *header)
+{
+	if (gzip_parse_header(in, in_nbytes, header) == 0)
+		return LIBDEFLATE_BAD_DATA;
+	return LIBDEFLATE_SUCCESS;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_gzip_decompress_ex(struct libdeflate_decompressor *d,
+			      const void *in, size_t in_nbytes,
+			      void *out, size_t out_nbytes_avail,
+			      size_t *actual_in_nbytes_ret,
+			      size_t *actual_out_nbytes_ret)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	size_t header_nbytes;
+	size_t actual_in_nbytes;
+	size_t actual_out_nbytes;
+	enum libdeflate_result result;
+
+	header_nbytes = libdeflate_gzip_parse_header(in, in_nbytes);
+	if (header_nbytes == 0)
+		return LIBDEFLATE_BAD_DATA;
+	in_next += header_nbytes;
+
+	/* Compressed data, with the CRC32 computed along the way */
+	libdeflate_set_index_in_offset(d, in_next - (const u8 *)in);
+	libdeflate_begin_checksum(d, libdeflate_crc32, 0);
 	result = libdeflate_deflate_decompress_ex(d, in_next,
 					in_end - GZIP_FOOTER_SIZE - in_next,
 					out, out_nbytes_avail,
 					&actual_in_nbytes,
 					actual_out_nbytes_ret);
-	if (result != LIBDEFLATE_SUCCESS)
+	libdeflate_set_index_in_offset(d, 0);
+	if (result != LIBDEFLATE_SUCCESS) {
+		libdeflate_end_checksum(d, out, 0);
 		return result;
+	}
 
 	if (actual_out_nbytes_ret)
 		actual_out_nbytes = *actual_out_nbytes_ret;
@@ -116,7 +193,7 @@ libdeflate_gzip_decompress_ex(struct libdeflate_decompressor *d,
 	in_next += actual_in_nbytes;
 
 	/* CRC32 */
-	if (libdeflate_crc32(0, out, actual_out_nbytes) !=
+	if (libdeflate_end_checksum(d, out, actual_out_nbytes) !=
 	    get_unaligned_le32(in_next))
 		return LIBDEFLATE_BAD_DATA;
 	in_next += 4;
@@ -142,3 +219,58 @@ libdeflate_gzip_decompress(struct libdeflate_decompressor *d,
 					     out, out_nbytes_avail,
 					     NULL, actual_out_nbytes_ret);
 }
+
+/* Compute the CRC32 of the data passed to libdeflate_gzip_validate()'s sink */
+static int
+crc32_sink(void *ctx, const void *data, size_t nbytes)
+{
+	u32 *crc = ctx;
+
+	*crc = libdeflate_crc32(*crc, data, nbytes);
+	return 0;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_gzip_validate(struct libdeflate_decompressor *d,
+			 const void *in, size_t in_nbytes,
+			 size_t *actual_in_nbytes_ret,
+			 size_t *actual_out_nbytes_ret)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	size_t header_nbytes;
+	size_t actual_in_nbytes;
+	size_t actual_out_nbytes;
+	u32 crc = 0;
+	enum libdeflate_result result;
+
+	header_nbytes = libdeflate_gzip_parse_header(in, in_nbytes);
+	if (header_nbytes == 0)
+		return LIBDEFLATE_BAD_DATA;
+	in_next += header_nbytes;
+
+	/* Compressed data */
+	result = libdeflate_deflate_decompress_to_sink(d, in_next,
+					in_end - GZIP_FOOTER_SIZE - in_next,
+					crc32_sink, &crc,
+					&actual_in_nbytes, &actual_out_nbytes);
+	if (result != LIBDEFLATE_SUCCESS)
+		return result;
+	in_next += actual_in_nbytes;
+
+	/* CRC32 */
+	if (crc != get_unaligned_le32(in_next))
+		return LIBDEFLATE_BAD_DATA;
+	in_next += 4;
+
+	/* ISIZE */
+	if ((u32)actual_out_nbytes != get_unaligned_le32(in_next))
+		return LIBDEFLATE_BAD_DATA;
+	in_next += 4;
+
+	if (actual_in_nbytes_ret)
+		*actual_in_nbytes_ret = in_next - (const u8 *)in;
+	if (actual_out_nbytes_ret)
+		*actual_out_nbytes_ret = actual_out_nbytes;
+	return LIBDEFLATE_SUCCESS;
+}
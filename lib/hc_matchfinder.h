@@ -126,26 +126,53 @@ struct MATCHFINDER_ALIGNED hc_matchfinder  {
 	mf_pos_t hash4_tab[1UL << HC_MATCHFINDER_HASH4_ORDER];
 
 	/* The "next node" references for the linked lists.  The "next node" of
-	 * the node for the sequence with position 'pos' is 'next_tab[pos]'.  */
+	 * the node for the sequence with position 'pos' is
+	 * 'next_tab[pos % window_size]'.  Only the first 'window_size' entries
+	 * are used, so the rest needn't be allocated.  */
 	mf_pos_t next_tab[MATCHFINDER_WINDOW_SIZE];
 };
 
+/* The number of bytes of the matchfinder that are used with a window size of
+ * @window_size.  */
+static forceinline size_t
+hc_matchfinder_size(u32 window_size)
+{
+	return offsetof(struct hc_matchfinder, next_tab) +
+	       window_size * sizeof(mf_pos_t);
+}
+
 /* Prepare the matchfinder for a new input buffer.  */
 static forceinline void
-hc_matchfinder_init(struct hc_matchfinder *mf)
+hc_matchfinder_init(struct hc_matchfinder *mf, unsigned order_reduction)
 {
 	STATIC_ASSERT(HC_MATCHFINDER_TOTAL_HASH_SIZE %
 		      MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT((sizeof(mf->hash3_tab) >>
+		       MATCHFINDER_MAX_ORDER_REDUCTION) %
+		      MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT((sizeof(mf->hash4_tab) >>
+		       MATCHFINDER_MAX_ORDER_REDUCTION) %
+		      MATCHFINDER_SIZE_ALIGNMENT == 0);
 
-	matchfinder_init((mf_pos_t *)mf, HC_MATCHFINDER_TOTAL_HASH_SIZE);
+	if (order_reduction == 0) {
+		matchfinder_init((mf_pos_t *)mf,
+				 HC_MATCHFINDER_TOTAL_HASH_SIZE);
+	} else {
+		matchfinder_init(mf->hash3_tab,
+				 sizeof(mf->hash3_tab) >> order_reduction);
+		matchfinder_init(mf->hash4_tab,
+				 sizeof(mf->hash4_tab) >> order_reduction);
+	}
 }
 
 static forceinline void
-hc_matchfinder_slide_window(struct hc_matchfinder *mf)
+hc_matchfinder_slide_window(struct hc_matchfinder *mf, u32 window_size)
 {
 	STATIC_ASSERT(sizeof(*mf) % MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT(((1UL << MATCHFINDER_MIN_WINDOW_ORDER) *
+		       sizeof(mf_pos_t)) % MATCHFINDER_SIZE_ALIGNMENT == 0);
 
-	matchfinder_rebase((mf_pos_t *)mf, sizeof(*mf));
+	matchfinder_rebase((mf_pos_t *)mf, hc_matchfinder_size(window_size));
 }
 
 /*
@@ -169,12 +196,18 @@ hc_matchfinder_slide_window(struct hc_matchfinder *mf)
  *	Must be <= @max_len.
  * @max_search_depth
  *	Limit on the number of potential matches to consider.  Must be >= 1.
+ * @order_reduction
+ *	The value that was passed to hc_matchfinder_init().
+ * @window_size
+ *	The window size; see MATCHFINDER_MIN_WINDOW_ORDER.
  * @next_hashes
  *	The precomputed hash codes for the sequence beginning at @in_next.
  *	These will be used and then updated with the precomputed hashcodes for
  *	the sequence beginning at @in_next + 1.
  * @offset_ret
  *	If a match is found, its offset is returned in this location.
+ * @counters
+ *	The counters to update if LIBDEFLATE_ENABLE_COUNTERS is defined.
  *
  * Return the length of the match found, or 'best_len' if no match longer than
  * 'best_len' was found.
@@ -187,8 +220,11 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 			     const u32 max_len,
 			     const u32 nice_len,
 			     const u32 max_search_depth,
+			     const unsigned order_reduction,
+			     const u32 window_size,
 			     u32 * const next_hashes,
-			     u32 * const offset_ret)
+			     u32 * const offset_ret,
+			     struct matchfinder_counters * const counters)
 {
 	u32 depth_remaining = max_search_depth;
 	const u8 *best_matchptr = in_next;
@@ -203,13 +239,14 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 	mf_pos_t cutoff;
 
 	if (cur_pos == MATCHFINDER_WINDOW_SIZE) {
-		hc_matchfinder_slide_window(mf);
+		hc_matchfinder_slide_window(mf, window_size);
 		*in_base_p += MATCHFINDER_WINDOW_SIZE;
 		cur_pos = 0;
 	}
 
 	in_base = *in_base_p;
-	cutoff = cur_pos - MATCHFINDER_WINDOW_SIZE;
+	cutoff = cur_pos - window_size;
+	COUNTER_INC(counters->num_searches);
 
 	if (unlikely(max_len < 5)) /* can we read 4 bytes from 'in_next + 1'? */
 		goto out;
@@ -229,12 +266,14 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 	/* Update for length 4 matches.  This prepends the node for the current
 	 * sequence to the linked list in the 'hash4' bucket.  */
 	mf->hash4_tab[hash4] = cur_pos;
-	mf->next_tab[cur_pos] = cur_node4;
+	mf->next_tab[cur_pos & (window_size - 1)] = cur_node4;
 
 	/* Compute the next hash codes.  */
 	next_hashseq = get_unaligned_le32(in_next + 1);
-	next_hashes[0] = lz_hash(next_hashseq & 0xFFFFFF, HC_MATCHFINDER_HASH3_ORDER);
-	next_hashes[1] = lz_hash(next_hashseq, HC_MATCHFINDER_HASH4_ORDER);
+	next_hashes[0] = lz_hash(next_hashseq & 0xFFFFFF,
+				 HC_MATCHFINDER_HASH3_ORDER - order_reduction);
+	next_hashes[1] = lz_hash(next_hashseq,
+				 HC_MATCHFINDER_HASH4_ORDER - order_reduction);
 	prefetchw(&mf->hash3_tab[next_hashes[0]]);
 	prefetchw(&mf->hash4_tab[next_hashes[1]]);
 
@@ -248,6 +287,7 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 		seq4 = load_u32_unaligned(in_next);
 
 		if (best_len < 3) {
+			COUNTER_INC(counters->num_candidates);
 			matchptr = &in_base[cur_node3];
 			if (load_u24_unaligned(matchptr) == loaded_u32_to_u24(seq4)) {
 				best_len = 3;
@@ -262,13 +302,14 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 
 		for (;;) {
 			/* No length 4 match found yet.  Check the first 4 bytes.  */
+			COUNTER_INC(counters->num_candidates);
 			matchptr = &in_base[cur_node4];
 
 			if (load_u32_unaligned(matchptr) == seq4)
 				break;
 
 			/* The first 4 bytes did not match.  Keep trying.  */
-			cur_node4 = mf->next_tab[cur_node4 & (MATCHFINDER_WINDOW_SIZE - 1)];
+			cur_node4 = mf->next_tab[cur_node4 & (window_size - 1)];
 			if (cur_node4 <= cutoff || !--depth_remaining)
 				goto out;
 		}
@@ -278,7 +319,7 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 		best_len = lz_extend(in_next, best_matchptr, 4, max_len);
 		if (best_len >= nice_len)
 			goto out;
-		cur_node4 = mf->next_tab[cur_node4 & (MATCHFINDER_WINDOW_SIZE - 1)];
+		cur_node4 = mf->next_tab[cur_node4 & (window_size - 1)];
 		if (cur_node4 <= cutoff || !--depth_remaining)
 			goto out;
 	} else {
@@ -290,6 +331,7 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 
 	for (;;) {
 		for (;;) {
+			COUNTER_INC(counters->num_candidates);
 			matchptr = &in_base[cur_node4];
 
 			/* Already found a length 4 match.  Try for a longer
@@ -308,7 +350,7 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 				break;
 
 			/* Continue to the next node in the list.  */
-			cur_node4 = mf->next_tab[cur_node4 & (MATCHFINDER_WINDOW_SIZE - 1)];
+			cur_node4 = mf->next_tab[cur_node4 & (window_size - 1)];
 			if (cur_node4 <= cutoff || !--depth_remaining)
 				goto out;
 		}
@@ -328,7 +370,7 @@ hc_matchfinder_longest_match(struct hc_matchfinder * const mf,
 		}
 
 		/* Continue to the next node in the list.  */
-		cur_node4 = mf->next_tab[cur_node4 & (MATCHFINDER_WINDOW_SIZE - 1)];
+		cur_node4 = mf->next_tab[cur_node4 & (window_size - 1)];
 		if (cur_node4 <= cutoff || !--depth_remaining)
 			goto out;
 	}
@@ -352,6 +394,10 @@ out:
  *	Pointer to the end of the input buffer.
  * @count
  *	The number of bytes to advance.  Must be > 0.
+ * @order_reduction
+ *	The value that was passed to hc_matchfinder_init().
+ * @window_size
+ *	The window size; see MATCHFINDER_MIN_WINDOW_ORDER.
  * @next_hashes
  *	The precomputed hash codes for the sequence beginning at @in_next.
  *	These will be used and then updated with the precomputed hashcodes for
@@ -363,6 +409,8 @@ hc_matchfinder_skip_bytes(struct hc_matchfinder * const mf,
 			  const u8 *in_next,
 			  const u8 * const in_end,
 			  const u32 count,
+			  const unsigned order_reduction,
+			  const u32 window_size,
 			  u32 * const next_hashes)
 {
 	u32 cur_pos;
@@ -378,17 +426,20 @@ hc_matchfinder_skip_bytes(struct hc_matchfinder * const mf,
 	hash4 = next_hashes[1];
 	do {
 		if (cur_pos == MATCHFINDER_WINDOW_SIZE) {
-			hc_matchfinder_slide_window(mf);
+			hc_matchfinder_slide_window(mf, window_size);
 			*in_base_p += MATCHFINDER_WINDOW_SIZE;
 			cur_pos = 0;
 		}
 		mf->hash3_tab[hash3] = cur_pos;
-		mf->next_tab[cur_pos] = mf->hash4_tab[hash4];
+		mf->next_tab[cur_pos & (window_size - 1)] =
+			mf->hash4_tab[hash4];
 		mf->hash4_tab[hash4] = cur_pos;
 
 		next_hashseq = get_unaligned_le32(++in_next);
-		hash3 = lz_hash(next_hashseq & 0xFFFFFF, HC_MATCHFINDER_HASH3_ORDER);
-		hash4 = lz_hash(next_hashseq, HC_MATCHFINDER_HASH4_ORDER);
+		hash3 = lz_hash(next_hashseq & 0xFFFFFF,
+				HC_MATCHFINDER_HASH3_ORDER - order_reduction);
+		hash4 = lz_hash(next_hashseq,
+				HC_MATCHFINDER_HASH4_ORDER - order_reduction);
 		cur_pos++;
 	} while (--remaining);
 
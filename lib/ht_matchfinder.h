@@ -60,11 +60,12 @@ struct MATCHFINDER_ALIGNED ht_matchfinder {
 };
 
 static forceinline void
-ht_matchfinder_init(struct ht_matchfinder *mf)
+ht_matchfinder_init(struct ht_matchfinder *mf, unsigned order_reduction)
 {
-	STATIC_ASSERT(sizeof(*mf) % MATCHFINDER_SIZE_ALIGNMENT == 0);
+	STATIC_ASSERT((sizeof(*mf) >> MATCHFINDER_MAX_ORDER_REDUCTION) %
+		      MATCHFINDER_SIZE_ALIGNMENT == 0);
 
-	matchfinder_init((mf_pos_t *)mf, sizeof(*mf));
+	matchfinder_init((mf_pos_t *)mf, sizeof(*mf) >> order_reduction);
 }
 
 static forceinline void
@@ -73,15 +74,22 @@ ht_matchfinder_slide_window(struct ht_matchfinder *mf)
 	matchfinder_rebase((mf_pos_t *)mf, sizeof(*mf));
 }
 
-/* Note: max_len must be >= HT_MATCHFINDER_REQUIRED_NBYTES */
+/*
+ * Note: max_len must be >= HT_MATCHFINDER_REQUIRED_NBYTES.  Since the hash
+ * table holds no links between positions, the window size only limits the
+ * offsets of the matches found.
+ */
 static forceinline u32
 ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 			     const u8 ** const in_base_p,
 			     const u8 * const in_next,
 			     const u32 max_len,
 			     const u32 nice_len,
+			     const unsigned order_reduction,
+			     const u32 window_size,
 			     u32 * const next_hash,
-			     u32 * const offset_ret)
+			     u32 * const offset_ret,
+			     struct matchfinder_counters * const counters)
 {
 	u32 best_len = 0;
 	const u8 *best_matchptr = in_next;
@@ -109,12 +117,13 @@ ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 		cur_pos = 0;
 	}
 	in_base = *in_base_p;
-	cutoff = cur_pos - MATCHFINDER_WINDOW_SIZE;
+	cutoff = cur_pos - window_size;
+	COUNTER_INC(counters->num_searches);
 
 	hash = *next_hash;
 	STATIC_ASSERT(HT_MATCHFINDER_REQUIRED_NBYTES == 5);
 	*next_hash = lz_hash(get_unaligned_le32(in_next + 1),
-			     HT_MATCHFINDER_HASH_ORDER);
+			     HT_MATCHFINDER_HASH_ORDER - order_reduction);
 	seq = load_u32_unaligned(in_next);
 	prefetchw(&mf->hash_tab[*next_hash]);
 #if HT_MATCHFINDER_BUCKET_SIZE == 1
@@ -123,6 +132,7 @@ ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 	mf->hash_tab[hash][0] = cur_pos;
 	if (cur_node <= cutoff)
 		goto out;
+	COUNTER_INC(counters->num_candidates);
 	matchptr = &in_base[cur_node];
 	if (load_u32_unaligned(matchptr) == seq) {
 		best_len = lz_extend(in_next, matchptr, 4, max_len);
@@ -138,6 +148,7 @@ ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 	mf->hash_tab[hash][0] = cur_pos;
 	if (cur_node <= cutoff)
 		goto out;
+	COUNTER_INC(counters->num_candidates);
 	matchptr = &in_base[cur_node];
 
 	to_insert = cur_node;
@@ -149,6 +160,7 @@ ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 		best_matchptr = matchptr;
 		if (cur_node <= cutoff || best_len >= nice_len)
 			goto out;
+		COUNTER_INC(counters->num_candidates);
 		matchptr = &in_base[cur_node];
 		if (load_u32_unaligned(matchptr) == seq &&
 		    load_u32_unaligned(matchptr + best_len - 3) ==
@@ -162,6 +174,7 @@ ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 	} else {
 		if (cur_node <= cutoff)
 			goto out;
+		COUNTER_INC(counters->num_candidates);
 		matchptr = &in_base[cur_node];
 		if (load_u32_unaligned(matchptr) == seq) {
 			best_len = lz_extend(in_next, matchptr, 4, max_len);
@@ -176,6 +189,7 @@ ht_matchfinder_longest_match(struct ht_matchfinder * const mf,
 		mf->hash_tab[hash][i] = to_insert;
 		if (cur_node <= cutoff)
 			goto out;
+		COUNTER_INC(counters->num_candidates);
 		matchptr = &in_base[cur_node];
 		if (load_u32_unaligned(matchptr) == seq) {
 			len = lz_extend(in_next, matchptr, 4, max_len);
@@ -200,6 +214,7 @@ ht_matchfinder_skip_bytes(struct ht_matchfinder * const mf,
 			  const u8 *in_next,
 			  const u8 * const in_end,
 			  const u32 count,
+			  const unsigned order_reduction,
 			  u32 * const next_hash)
 {
 	s32 cur_pos = in_next - *in_base_p;
@@ -223,7 +238,7 @@ ht_matchfinder_skip_bytes(struct ht_matchfinder * const mf,
 		mf->hash_tab[hash][0] = cur_pos;
 
 		hash = lz_hash(get_unaligned_le32(++in_next),
-			       HT_MATCHFINDER_HASH_ORDER);
+			       HT_MATCHFINDER_HASH_ORDER - order_reduction);
 		cur_pos++;
 	} while (--remaining);
 
@@ -49,6 +49,46 @@ void *libdeflate_aligned_malloc(malloc_func_t malloc_func,
 				size_t alignment, size_t size);
 void libdeflate_aligned_free(free_func_t free_func, void *ptr);
 
+/* The size that libdeflate_aligned_malloc() requests from malloc_func */
+#define ALIGNED_MALLOC_SIZE(alignment, size)	\
+	(sizeof(void *) + (alignment) - 1 + (size))
+
+/*
+ * Whether libdeflate_advise_huge_pages() can do anything, and the huge page
+ * size that it assumes, which is that of x86_64 and of arm64 with 4 KiB pages
+ */
+#if defined(__linux__) && !defined(FREESTANDING)
+#  define SUPPORT_HUGE_PAGES	1
+#else
+#  define SUPPORT_HUGE_PAGES	0
+#endif
+#define HUGE_PAGE_SIZE		((size_t)2 << 20)
+
+void libdeflate_advise_huge_pages(void *ptr, size_t size);
+
+bool libdeflate_get_options(const struct libdeflate_options *options,
+			    struct libdeflate_options *out);
+size_t libdeflate_decompressor_alloc_size(void);
+bool libdeflate_get_backend(const struct libdeflate_backend *backend,
+			    struct libdeflate_backend *out);
+
+/*
+ * The size of the pieces in which libdeflate_adler32_copy() and
+ * libdeflate_crc32_copy() checksum and copy data: small enough that a piece is
+ * still in the L1 cache when it is read the second time
+ */
+#define CHECKSUM_COPY_PIECE_SIZE	8192
+
+struct libdeflate_decompressor;
+void libdeflate_set_index_in_offset(struct libdeflate_decompressor *d,
+				    size_t offset);
+typedef u32 (*checksum_func_t)(u32 checksum, const void *data, size_t len);
+void libdeflate_begin_checksum(struct libdeflate_decompressor *d,
+			       checksum_func_t func, u32 checksum);
+u32 libdeflate_end_checksum(struct libdeflate_decompressor *d,
+			    const void *out, size_t out_nbytes);
+size_t libdeflate_gzip_parse_header(const u8 *in, size_t in_nbytes);
+
 #ifdef FREESTANDING
 /*
  * With -ffreestanding, <string.h> may be missing, and we must provide
@@ -99,6 +139,18 @@ libdeflate_assertion_failed(const char *expr, const char *file, int line);
 #define ASSERT(expr) (void)(expr)
 #endif
 
+/*
+ * Hot-path event counters, for tuning.  These compile to nothing unless
+ * LIBDEFLATE_ENABLE_COUNTERS is defined, as even a memory increment is
+ * noticeable in the inner loops.
+ */
+#ifdef LIBDEFLATE_ENABLE_COUNTERS
+#define COUNTER_ADD(counter, n)	((counter) += (n))
+#else
+#define COUNTER_ADD(counter, n)	((void)0)
+#endif
+#define COUNTER_INC(counter)	COUNTER_ADD(counter, 1)
+
 #define CONCAT_IMPL(a, b)	a##b
 #define CONCAT(a, b)		CONCAT_IMPL(a, b)
 #define ADD_SUFFIX(name)	CONCAT(name, SUFFIX)
@@ -60,10 +60,10 @@ typedef s16 mf_pos_t;
  * This affects how the entire 'struct deflate_compressor' is allocated, since
  * the matchfinder structures are embedded inside it.
  *
- * Currently the maximum memory address alignment required is 32 bytes, needed
- * by the AVX-2 matchfinder functions.
+ * Currently the maximum memory address alignment required is 64 bytes, needed
+ * by the AVX-512 matchfinder functions.
  */
-#define MATCHFINDER_MEM_ALIGNMENT	32
+#define MATCHFINDER_MEM_ALIGNMENT	64
 
 /*
  * This declares a size, in bytes, that is guaranteed to divide the sizes of the
@@ -71,17 +71,18 @@ typedef s16 mf_pos_t;
  * MATCHFINDER_MEM_ALIGNMENT).  The architecture-specific implementations of
  * matchfinder_init() and matchfinder_rebase() take advantage of this value.
  *
- * Currently the maximum size alignment required is 128 bytes, needed by
- * the AVX-2 matchfinder functions.  However, the RISC-V Vector Extension
+ * Currently the maximum size alignment required is 256 bytes, needed by
+ * the AVX-512 matchfinder functions.  However, the RISC-V Vector Extension
  * matchfinder functions can, in principle, take advantage of a larger size
  * alignment.  Therefore, we set this to 1024, which still easily divides the
  * actual sizes that result from the current matchfinder struct definitions.
- * This value can safely be changed to any power of two that is >= 128.
+ * This value can safely be changed to any power of two that is >= 256.
  */
 #define MATCHFINDER_SIZE_ALIGNMENT	1024
 
 #undef matchfinder_init
 #undef matchfinder_rebase
+#undef lz_extend
 #ifdef _aligned_attribute
 #  define MATCHFINDER_ALIGNED _aligned_attribute(MATCHFINDER_MEM_ALIGNMENT)
 #  if defined(ARCH_ARM32) || defined(ARCH_ARM64)
@@ -171,10 +172,45 @@ lz_hash(u32 seq, unsigned num_bits)
 	return (u32)(seq * 0x1E35A7BD) >> (32 - num_bits);
 }
 
+/*
+ * The matchfinders can use just the first 1/2^order_reduction of each of their
+ * hash tables, by using hash codes with 'order_reduction' fewer bits.  For
+ * small inputs, this makes the hash tables much cheaper to initialize at little
+ * cost in compression ratio.  The same 'order_reduction' must be passed to all
+ * functions that operate on the matchfinder until it is initialized again.
+ */
+#define MATCHFINDER_MAX_ORDER_REDUCTION	6
+
+/*
+ * The matchfinders can use a smaller window than MATCHFINDER_WINDOW_SIZE: any
+ * power of 2 'window_size' of at least 1 << MATCHFINDER_MIN_WINDOW_ORDER.  They
+ * then only find matches with offsets less than 'window_size', and they index
+ * their hash chain or binary tree arrays by position modulo 'window_size', so
+ * only the first 'window_size' entries of those arrays are used.  Positions
+ * are still relative to a base that slides every MATCHFINDER_WINDOW_SIZE bytes,
+ * which is a multiple of 'window_size'.  The same 'window_size' must be passed
+ * to all functions that operate on the matchfinder until it is initialized
+ * again.
+ */
+#define MATCHFINDER_MIN_WINDOW_ORDER	9
+
+/*
+ * Counts of the matchfinders' work, which they update only if
+ * LIBDEFLATE_ENABLE_COUNTERS is defined: the number of positions searched for
+ * matches, and the number of earlier positions compared against them.  These
+ * are kept by the compressor rather than in the matchfinder structures, which
+ * are allocated in part for windows smaller than MATCHFINDER_WINDOW_SIZE.
+ */
+struct matchfinder_counters {
+	u64 num_searches;
+	u64 num_candidates;
+};
+
 /*
  * Return the number of bytes at @matchptr that match the bytes at @strptr, up
  * to a maximum of @max_len.  Initially, @start_len bytes are matched.
  */
+#ifndef lz_extend
 static forceinline unsigned
 lz_extend(const u8 * const strptr, const u8 * const matchptr,
 	  const unsigned start_len, const unsigned max_len)
@@ -220,5 +256,6 @@ word_differs:
 		len += (WORDBITS - 1 - bsrw(v_word)) >> 3;
 	return len;
 }
+#endif /* !lz_extend */
 
 #endif /* LIB_MATCHFINDER_COMMON_H */
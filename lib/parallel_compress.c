@@ -0,0 +1,592 @@
+/*
+ * parallel_compress.c - compress chunks of data in parallel, joining them into
+ *			 a single DEFLATE, zlib, or gzip stream
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "deflate_compress.h"
+#include "gzip_constants.h"
+#include "zlib_constants.h"
+
+/*
+ * The length of the chunks the input is divided into.  This must not depend on
+ * the number of threads, so that the output doesn't either.  Larger chunks
+ * compress slightly better, while smaller chunks allow more parallelism on
+ * smaller inputs.
+ */
+#define PARALLEL_CHUNK_LENGTH	262144
+
+/* The amount of preceding data each chunk can refer to */
+#define PARALLEL_HISTORY_LENGTH	32768
+
+/*
+ * The number of chunks each task compresses per batch at levels 10-14.  The
+ * time the near-optimal parser takes on a chunk varies a lot with the data, and
+ * each batch takes as long as its slowest task, so giving each task several
+ * chunks spread across the batch evens out the tasks' running times.  At the
+ * other levels the time per chunk is more uniform, so one chunk per task is
+ * enough and saves memory.
+ */
+#define PARALLEL_MAX_CHUNKS_PER_TASK	4
+
+/*
+ * The maximum size of a compressed chunk in addition to the bound for
+ * compressing it on its own, which is the empty uncompressed block that ends
+ * each non-final chunk
+ */
+#define PARALLEL_CHUNK_OVERHEAD	5
+
+/*
+ * The number of BGZF members per chunk.  The members are independent, so they
+ * are grouped only to give each task a useful amount of work.
+ */
+#define BGZF_MEMBERS_PER_CHUNK	4
+#define BGZF_CHUNK_LENGTH	(BGZF_MEMBERS_PER_CHUNK * BGZF_MAX_MEMBER_INPUT)
+
+/* The BGZF EOF marker: an empty member */
+static const u8 bgzf_eof_marker[] = {
+	0x1F, 0x8B, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x06, 0x00,
+	0x42, 0x43, 0x02, 0x00, 0x1B, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+enum parallel_checksum {
+	PARALLEL_CHECKSUM_NONE,
+	PARALLEL_CHECKSUM_ADLER32,
+	PARALLEL_CHECKSUM_CRC32,
+};
+
+/* One chunk of the input, and its compressed data once compressed */
+struct parallel_chunk {
+	const u8 *in;
+	size_t in_nbytes;
+	size_t history_nbytes;
+	bool is_final;
+	u32 checksum;
+	u8 *out;
+	size_t out_nbytes;
+};
+
+/* The work done by one task: compressing some chunks of a batch */
+struct parallel_task {
+	struct libdeflate_compressor *c;
+	unsigned compression_level;
+	enum parallel_checksum checksum_type;
+	bool bgzf;
+	size_t out_nbytes_avail;
+	unsigned num_chunks;
+	struct parallel_chunk chunks[PARALLEL_MAX_CHUNKS_PER_TASK];
+};
+
+struct libdeflate_parallel_compressor {
+	struct libdeflate_task_submitter submitter;
+	bool have_submitter;
+	unsigned compression_level;
+	unsigned chunks_per_task;
+	free_func_t free_func;
+	unsigned num_tasks;
+	struct parallel_task tasks[];
+};
+
+/*
+ * Write a gzip header for the given compression level.  If @bgzf, also write
+ * the BGZF extra field, with BSIZE left to be filled in.  Return its length.
+ */
+static size_t
+parallel_write_gzip_header(u8 *out, unsigned compression_level, bool bgzf)
+{
+	u8 *out_next = out;
+	u8 xfl;
+
+	/* ID1 */
+	*out_next++ = GZIP_ID1;
+	/* ID2 */
+	*out_next++ = GZIP_ID2;
+	/* CM */
+	*out_next++ = GZIP_CM_DEFLATE;
+	/* FLG */
+	*out_next++ = bgzf ? GZIP_FEXTRA : 0;
+	/* MTIME */
+	put_unaligned_le32(GZIP_MTIME_UNAVAILABLE, out_next);
+	out_next += 4;
+	/* XFL */
+	xfl = 0;
+	if (compression_level < 2)
+		xfl |= GZIP_XFL_FASTEST_COMPRESSION;
+	else if (compression_level >= 8)
+		xfl |= GZIP_XFL_SLOWEST_COMPRESSION;
+	*out_next++ = xfl;
+	/* OS */
+	*out_next++ = GZIP_OS_UNKNOWN;	/* OS  */
+
+	if (bgzf) {
+		/* XLEN */
+		put_unaligned_le16(BGZF_XLEN, out_next);
+		out_next += 2;
+		/* SI1, SI2, SLEN, BSIZE */
+		*out_next++ = BGZF_SI1;
+		*out_next++ = BGZF_SI2;
+		put_unaligned_le16(BGZF_SLEN, out_next);
+		out_next += 2;
+		put_unaligned_le16(0, out_next);
+		out_next += 2;
+	}
+	return out_next - out;
+}
+
+/*
+ * Compress a chunk as a series of BGZF members, each holding up to
+ * BGZF_MAX_MEMBER_INPUT bytes.  Return the compressed size, or 0 if a member
+ * didn't fit in BGZF_MAX_MEMBER_SIZE bytes, which the compression bound for
+ * BGZF_MAX_MEMBER_INPUT bytes rules out.
+ */
+static size_t
+parallel_compress_bgzf_chunk(struct parallel_task *task,
+			     const struct parallel_chunk *chunk)
+{
+	const u8 *in_next = chunk->in;
+	const u8 * const in_end = in_next + chunk->in_nbytes;
+	u8 *out_next = chunk->out;
+
+	while (in_next != in_end) {
+		size_t in_nbytes = MIN(in_end - in_next, BGZF_MAX_MEMBER_INPUT);
+		u8 *member = out_next;
+		size_t deflate_size;
+
+		out_next += parallel_write_gzip_header(out_next,
+						       task->compression_level,
+						       true);
+		deflate_size = libdeflate_deflate_compress(
+					task->c, in_next, in_nbytes, out_next,
+					BGZF_MAX_MEMBER_SIZE -
+					BGZF_MEMBER_OVERHEAD);
+		if (deflate_size == 0)
+			return 0;
+		out_next += deflate_size;
+		/* CRC32 */
+		put_unaligned_le32(libdeflate_crc32(0, in_next, in_nbytes),
+				   out_next);
+		out_next += 4;
+		/* ISIZE */
+		put_unaligned_le32(in_nbytes, out_next);
+		out_next += 4;
+		/* BSIZE */
+		put_unaligned_le16(out_next - member - 1,
+				   &member[BGZF_HEADER_SIZE - 2]);
+		in_next += in_nbytes;
+	}
+	return out_next - chunk->out;
+}
+
+static void
+parallel_compress_chunks(void *arg)
+{
+	struct parallel_task *task = arg;
+	unsigned i;
+
+	for (i = 0; i < task->num_chunks; i++) {
+		struct parallel_chunk *chunk = &task->chunks[i];
+
+		if (task->bgzf) {
+			chunk->out_nbytes = parallel_compress_bgzf_chunk(task,
+									 chunk);
+			continue;
+		}
+		chunk->out_nbytes = libdeflate_deflate_compress_piece(
+					task->c, chunk->in, chunk->in_nbytes,
+					chunk->history_nbytes, chunk->is_final,
+					chunk->out, task->out_nbytes_avail);
+		switch (task->checksum_type) {
+		case PARALLEL_CHECKSUM_ADLER32:
+			chunk->checksum = libdeflate_adler32(1, chunk->in,
+							     chunk->in_nbytes);
+			break;
+		case PARALLEL_CHECKSUM_CRC32:
+			chunk->checksum = libdeflate_crc32(0, chunk->in,
+							   chunk->in_nbytes);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+LIBDEFLATEAPI struct libdeflate_parallel_compressor *
+libdeflate_alloc_parallel_compressor_ex(int compression_level,
+					unsigned int num_threads,
+					const struct libdeflate_task_submitter *submitter,
+					const struct libdeflate_options *options)
+{
+	struct libdeflate_parallel_compressor *pc;
+	struct libdeflate_options opts;
+	malloc_func_t malloc_func;
+	unsigned i, j;
+
+	if (!libdeflate_get_options(options, &opts))
+		return NULL;
+	/*
+	 * The chunks are already compressed in parallel, and a target speed
+	 * for the whole input wouldn't mean the same for each chunk.
+	 */
+	opts.task_submitter = NULL;
+	opts.rate_control = NULL;
+	options = &opts;
+	if (compression_level < 0 || compression_level > 14)
+		return NULL;
+	if (num_threads == 0 ||
+	    num_threads > (SIZE_MAX - sizeof(*pc)) / sizeof(pc->tasks[0]))
+		return NULL;
+
+	malloc_func = options->malloc_func ?
+		      options->malloc_func : libdeflate_default_malloc_func;
+	pc = (*malloc_func)(sizeof(*pc) + num_threads * sizeof(pc->tasks[0]));
+	if (!pc)
+		return NULL;
+	pc->have_submitter = (submitter != NULL);
+	if (submitter)
+		pc->submitter = *submitter;
+	pc->compression_level = compression_level;
+	pc->chunks_per_task = (compression_level >= 10) ?
+			      PARALLEL_MAX_CHUNKS_PER_TASK : 1;
+	pc->free_func = options->free_func ?
+			options->free_func : libdeflate_default_free_func;
+	pc->num_tasks = 0;
+
+	for (i = 0; i < num_threads; i++) {
+		struct parallel_task *task = &pc->tasks[i];
+
+		task->c = libdeflate_alloc_compressor_ex(compression_level,
+							 options);
+		if (!task->c)
+			goto oom;
+		task->compression_level = compression_level;
+		task->out_nbytes_avail = MAX(
+			libdeflate_deflate_compress_bound(task->c,
+							  PARALLEL_CHUNK_LENGTH) +
+			PARALLEL_CHUNK_OVERHEAD,
+			BGZF_MEMBERS_PER_CHUNK * BGZF_MAX_MEMBER_SIZE);
+		task->chunks[0].out = (*malloc_func)(pc->chunks_per_task *
+						     task->out_nbytes_avail);
+		if (!task->chunks[0].out) {
+			libdeflate_free_compressor(task->c);
+			goto oom;
+		}
+		for (j = 1; j < pc->chunks_per_task; j++)
+			task->chunks[j].out = task->chunks[j - 1].out +
+					      task->out_nbytes_avail;
+		pc->num_tasks++;
+	}
+	return pc;
+
+oom:
+	libdeflate_free_parallel_compressor(pc);
+	return NULL;
+}
+
+LIBDEFLATEAPI struct libdeflate_parallel_compressor *
+libdeflate_alloc_parallel_compressor(int compression_level,
+				     unsigned int num_threads,
+				     const struct libdeflate_task_submitter *submitter)
+{
+	static const struct libdeflate_options defaults = {
+		.sizeof_options = sizeof(defaults),
+	};
+	return libdeflate_alloc_parallel_compressor_ex(compression_level,
+						       num_threads, submitter,
+						       &defaults);
+}
+
+/*
+ * Compress @in to raw DEFLATE in @out, one batch of chunks at a time.  Chunk i
+ * of a batch is compressed by task i % num_tasks, so each task's chunks are
+ * spread across the batch rather than being adjacent; that way a region of
+ * data that is slow to compress is shared among the tasks.  Also compute the
+ * checksum of @in, if requested, by combining the checksums of the chunks.
+ *
+ * If @bgzf, then instead compress @in to BGZF members, with no history.
+ */
+static size_t
+parallel_compress(struct libdeflate_parallel_compressor *pc,
+		  const u8 *in, size_t in_nbytes, u8 *out,
+		  size_t out_nbytes_avail, enum parallel_checksum checksum_type,
+		  u32 *checksum_ret, bool bgzf)
+{
+	const size_t chunk_length = bgzf ? BGZF_CHUNK_LENGTH :
+					   PARALLEL_CHUNK_LENGTH;
+	u8 *out_next = out;
+	u8 * const out_end = out + out_nbytes_avail;
+	size_t in_pos = 0;
+	u32 checksum = (checksum_type == PARALLEL_CHECKSUM_ADLER32) ? 1 : 0;
+
+	do {
+		const unsigned max_chunks = pc->num_tasks * pc->chunks_per_task;
+		unsigned num_chunks = 0;
+		unsigned num_tasks;
+		unsigned i;
+
+		/* Divide the next batch of chunks among the tasks. */
+		for (i = 0; i < pc->num_tasks; i++)
+			pc->tasks[i].num_chunks = 0;
+		do {
+			struct parallel_task *task =
+				&pc->tasks[num_chunks++ % pc->num_tasks];
+			struct parallel_chunk *chunk =
+				&task->chunks[task->num_chunks++];
+
+			chunk->in = &in[in_pos];
+			chunk->in_nbytes = MIN(in_nbytes - in_pos,
+					       chunk_length);
+			chunk->history_nbytes = bgzf ? 0 :
+						MIN(in_pos,
+						    PARALLEL_HISTORY_LENGTH);
+			in_pos += chunk->in_nbytes;
+			chunk->is_final = (in_pos == in_nbytes);
+		} while (in_pos != in_nbytes && num_chunks < max_chunks);
+
+		/* Compress them. */
+		num_tasks = MIN(num_chunks, pc->num_tasks);
+		for (i = 0; i < num_tasks; i++) {
+			struct parallel_task *task = &pc->tasks[i];
+
+			task->checksum_type = checksum_type;
+			task->bgzf = bgzf;
+			if (pc->have_submitter)
+				(*pc->submitter.submit)(pc->submitter.ctx,
+							parallel_compress_chunks,
+							task);
+			else
+				parallel_compress_chunks(task);
+		}
+		if (pc->have_submitter)
+			(*pc->submitter.wait)(pc->submitter.ctx);
+
+		/* Append the compressed chunks to the output, in order. */
+		for (i = 0; i < num_chunks; i++) {
+			const struct parallel_chunk *chunk =
+				&pc->tasks[i % pc->num_tasks].chunks[
+						i / pc->num_tasks];
+
+			if (chunk->out_nbytes == 0 ||
+			    chunk->out_nbytes > out_end - out_next)
+				return 0;
+			memcpy(out_next, chunk->out, chunk->out_nbytes);
+			out_next += chunk->out_nbytes;
+			switch (checksum_type) {
+			case PARALLEL_CHECKSUM_ADLER32:
+				checksum = libdeflate_adler32_combine(
+						checksum, chunk->checksum,
+						chunk->in_nbytes);
+				break;
+			case PARALLEL_CHECKSUM_CRC32:
+				checksum = libdeflate_crc32_combine(
+						checksum, chunk->checksum,
+						chunk->in_nbytes);
+				break;
+			default:
+				break;
+			}
+		}
+	} while (in_pos != in_nbytes);
+
+	*checksum_ret = checksum;
+	return out_next - out;
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_deflate_compress(struct libdeflate_parallel_compressor *pc,
+				     const void *in, size_t in_nbytes,
+				     void *out, size_t out_nbytes_avail)
+{
+	u32 checksum;
+
+	return parallel_compress(pc, in, in_nbytes, out, out_nbytes_avail,
+				 PARALLEL_CHECKSUM_NONE, &checksum, false);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_deflate_compress_bound(struct libdeflate_parallel_compressor *pc,
+					   size_t in_nbytes)
+{
+	struct libdeflate_compressor *c = pc->tasks[0].c;
+	size_t num_full_chunks = in_nbytes / PARALLEL_CHUNK_LENGTH;
+	size_t bound;
+
+	bound = num_full_chunks *
+		(libdeflate_deflate_compress_bound(c, PARALLEL_CHUNK_LENGTH) +
+		 PARALLEL_CHUNK_OVERHEAD);
+	return bound + libdeflate_deflate_compress_bound(
+			c, in_nbytes % PARALLEL_CHUNK_LENGTH);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_zlib_compress(struct libdeflate_parallel_compressor *pc,
+				  const void *in, size_t in_nbytes,
+				  void *out, size_t out_nbytes_avail)
+{
+	u8 *out_next = out;
+	u16 hdr;
+	unsigned level_hint;
+	size_t deflate_size;
+	u32 adler;
+
+	if (out_nbytes_avail <= ZLIB_MIN_OVERHEAD)
+		return 0;
+
+	/* 2 byte header: CMF and FLG  */
+	hdr = (ZLIB_CM_DEFLATE << 8) |
+	      (ZLIB_CINFO(libdeflate_get_compression_window_order(
+				pc->tasks[0].c)) << 12);
+	if (pc->compression_level < 2)
+		level_hint = ZLIB_FASTEST_COMPRESSION;
+	else if (pc->compression_level < 6)
+		level_hint = ZLIB_FAST_COMPRESSION;
+	else if (pc->compression_level < 8)
+		level_hint = ZLIB_DEFAULT_COMPRESSION;
+	else
+		level_hint = ZLIB_SLOWEST_COMPRESSION;
+	hdr |= level_hint << 6;
+	hdr |= 31 - (hdr % 31);
+
+	put_unaligned_be16(hdr, out_next);
+	out_next += 2;
+
+	/* Compressed data  */
+	deflate_size = parallel_compress(pc, in, in_nbytes, out_next,
+					 out_nbytes_avail - ZLIB_MIN_OVERHEAD,
+					 PARALLEL_CHECKSUM_ADLER32, &adler, false);
+	if (deflate_size == 0)
+		return 0;
+	out_next += deflate_size;
+
+	/* ADLER32  */
+	put_unaligned_be32(adler, out_next);
+	out_next += 4;
+
+	return out_next - (u8 *)out;
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_zlib_compress_bound(struct libdeflate_parallel_compressor *pc,
+					size_t in_nbytes)
+{
+	return ZLIB_MIN_OVERHEAD +
+	       libdeflate_parallel_deflate_compress_bound(pc, in_nbytes);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_gzip_compress(struct libdeflate_parallel_compressor *pc,
+				  const void *in, size_t in_nbytes,
+				  void *out, size_t out_nbytes_avail)
+{
+	u8 *out_next = out;
+	size_t deflate_size;
+	u32 crc;
+
+	if (out_nbytes_avail <= GZIP_MIN_OVERHEAD)
+		return 0;
+
+	out_next += parallel_write_gzip_header(out_next,
+					       pc->compression_level, false);
+
+	/* Compressed data  */
+	deflate_size = parallel_compress(pc, in, in_nbytes, out_next,
+					 out_nbytes_avail - GZIP_MIN_OVERHEAD,
+					 PARALLEL_CHECKSUM_CRC32, &crc, false);
+	if (deflate_size == 0)
+		return 0;
+	out_next += deflate_size;
+
+	/* CRC32 */
+	put_unaligned_le32(crc, out_next);
+	out_next += 4;
+
+	/* ISIZE */
+	put_unaligned_le32((u32)in_nbytes, out_next);
+	out_next += 4;
+
+	return out_next - (u8 *)out;
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_gzip_compress_bound(struct libdeflate_parallel_compressor *pc,
+					size_t in_nbytes)
+{
+	return GZIP_MIN_OVERHEAD +
+	       libdeflate_parallel_deflate_compress_bound(pc, in_nbytes);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_bgzf_compress(struct libdeflate_parallel_compressor *pc,
+				  const void *in, size_t in_nbytes,
+				  void *out, size_t out_nbytes_avail)
+{
+	u8 *out_next = out;
+	u32 checksum;
+
+	if (out_nbytes_avail < sizeof(bgzf_eof_marker))
+		return 0;
+	if (in_nbytes != 0) {
+		size_t members_size;
+
+		members_size = parallel_compress(pc, in, in_nbytes, out_next,
+						 out_nbytes_avail -
+						 sizeof(bgzf_eof_marker),
+						 PARALLEL_CHECKSUM_NONE,
+						 &checksum, true);
+		if (members_size == 0)
+			return 0;
+		out_next += members_size;
+	}
+	memcpy(out_next, bgzf_eof_marker, sizeof(bgzf_eof_marker));
+	out_next += sizeof(bgzf_eof_marker);
+	return out_next - (u8 *)out;
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_parallel_bgzf_compress_bound(struct libdeflate_parallel_compressor *pc,
+					size_t in_nbytes)
+{
+	size_t num_members = DIV_ROUND_UP(in_nbytes, BGZF_MAX_MEMBER_INPUT);
+	size_t member_bound =
+		libdeflate_deflate_compress_bound(pc->tasks[0].c,
+						  BGZF_MAX_MEMBER_INPUT) +
+		BGZF_MEMBER_OVERHEAD;
+
+	return num_members * member_bound + sizeof(bgzf_eof_marker);
+}
+
+LIBDEFLATEAPI void
+libdeflate_free_parallel_compressor(struct libdeflate_parallel_compressor *pc)
+{
+	unsigned i;
+
+	if (pc) {
+		for (i = 0; i < pc->num_tasks; i++) {
+			libdeflate_free_compressor(pc->tasks[i].c);
+			(*pc->free_func)(pc->tasks[i].chunks[0].out);
+		}
+		(*pc->free_func)(pc);
+	}
+}
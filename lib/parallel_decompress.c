@@ -0,0 +1,819 @@
+/*
+ * parallel_decompress.c - decompress a single DEFLATE, zlib, or gzip stream
+ *			   using several tasks at once
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ---------------------------------------------------------------------------
+ *
+ * The compressed data is processed in batches of one chunk per task.  The
+ * first chunk of a batch starts at a known block boundary, with the preceding
+ * output known.  Each other chunk starts at a guessed block boundary, the first
+ * position at or after its nominal start that looks like the start of a
+ * dynamic Huffman block.  All chunks are then decompressed at once into 16-bit
+ * symbols, where references to the unknown data before a chunk are markers.
+ * Each chunk stops at the first block that begins at or after the next guess.
+ *
+ * If a chunk stopped exactly at the next chunk's guess, then the guess was
+ * right, so the chains of right guesses from the start of the batch are kept.
+ * Their markers are then resolved: first the last window of each chunk, in
+ * order, then the rest of each chunk, at once.  The next batch starts where the
+ * last kept chunk stopped.  So a wrong guess only costs parallelism.
+ */
+
+#include "deflate_decompress.h"
+#include "deflate_constants.h"
+#include "gzip_constants.h"
+#include "zlib_constants.h"
+
+/*
+ * The nominal length of the compressed data of each chunk.  Larger chunks
+ * waste less work on finding blocks and on the first window of each chunk,
+ * whose markers have to be resolved in order, while smaller chunks allow more
+ * parallelism on smaller inputs and use less memory for the symbols.
+ */
+#define PARALLEL_DECOMPRESS_CHUNK_LENGTH	1048576
+
+/* The work done by one task: finding, decoding, and resolving one chunk */
+struct parallel_dtask {
+	struct libdeflate_decompressor *d;
+	const u8 *in;
+	size_t in_nbytes;
+
+	/* Where the chunk starts, or its nominal start before it's found */
+	u64 start_bitpos;
+	u64 search_end_bitpos;
+	bool found;
+
+	/* The result of decoding the chunk */
+	u64 stop_bitpos;
+	size_t max_syms;
+	struct deflate_marker_buf buf;
+	enum libdeflate_result result;
+	u64 end_bitpos;
+	bool is_final;
+
+	/* The chunk's place in the output, and how many symbols are left */
+	u8 *out_begin;
+	const u8 *out_base;
+	size_t num_unresolved;
+	bool resolve_ok;
+
+	/* The planned and actual sizes of the output of a run of gzip members */
+	size_t out_nbytes_avail;
+	size_t out_nbytes;
+
+	/* Whether the task takes part in the current step */
+	bool selected;
+};
+
+struct libdeflate_parallel_decompressor {
+	struct libdeflate_task_submitter submitter;
+	bool have_submitter;
+	free_func_t free_func;
+	unsigned num_tasks;
+	struct parallel_dtask tasks[];
+};
+
+static void
+parallel_find_block(void *arg)
+{
+	struct parallel_dtask *task = arg;
+
+	task->found = libdeflate_deflate_find_block(task->d, task->in,
+						    task->in_nbytes,
+						    task->start_bitpos,
+						    task->search_end_bitpos,
+						    &task->start_bitpos);
+}
+
+static void
+parallel_decode_chunk(void *arg)
+{
+	struct parallel_dtask *task = arg;
+
+	task->result = libdeflate_deflate_decompress_markers(
+				task->d, task->in, task->in_nbytes,
+				task->start_bitpos, task->stop_bitpos,
+				task->max_syms, &task->buf,
+				&task->end_bitpos, &task->is_final);
+}
+
+/*
+ * Write the symbols [@begin, @end) of a chunk to the output, replacing each
+ * marker with the byte it refers to.  Return false if a marker refers to before
+ * the start of the output.
+ */
+static bool
+resolve_markers(const u16 *syms, size_t begin, size_t end,
+		u8 *out_begin, const u8 *out_base)
+{
+	const size_t window_nbytes = out_begin - out_base;
+	size_t i;
+
+	for (i = begin; i < end; i++) {
+		u32 sym = syms[i];
+
+		if (sym < DEFLATE_MARKER_BASE) {
+			out_begin[i] = sym;
+		} else {
+			sym -= DEFLATE_MARKER_BASE - 1;
+			if (sym > window_nbytes)
+				return false;
+			out_begin[i] = out_begin[-(ptrdiff_t)sym];
+		}
+	}
+	return true;
+}
+
+static void
+parallel_resolve_chunk(void *arg)
+{
+	struct parallel_dtask *task = arg;
+
+	task->resolve_ok = resolve_markers(task->buf.syms, 0,
+					   task->num_unresolved,
+					   task->out_begin, task->out_base);
+}
+
+/* Run func() on the selected tasks among the first @n, and wait for them. */
+static void
+parallel_run(struct libdeflate_parallel_decompressor *pd,
+	     void (*func)(void *arg), unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if (!pd->tasks[i].selected)
+			continue;
+		if (pd->have_submitter)
+			(*pd->submitter.submit)(pd->submitter.ctx, func,
+						&pd->tasks[i]);
+		else
+			(*func)(&pd->tasks[i]);
+	}
+	if (pd->have_submitter)
+		(*pd->submitter.wait)(pd->submitter.ctx);
+}
+
+LIBDEFLATEAPI struct libdeflate_parallel_decompressor *
+libdeflate_alloc_parallel_decompressor_ex(unsigned int num_threads,
+					  const struct libdeflate_task_submitter *submitter,
+					  const struct libdeflate_options *options)
+{
+	struct libdeflate_parallel_decompressor *pd;
+	struct libdeflate_options opts;
+	malloc_func_t malloc_func;
+	unsigned i;
+
+	if (!libdeflate_get_options(options, &opts))
+		return NULL;
+	options = &opts;
+	if (num_threads == 0 ||
+	    num_threads > (SIZE_MAX - sizeof(*pd)) / sizeof(pd->tasks[0]))
+		return NULL;
+
+	malloc_func = options->malloc_func ?
+		      options->malloc_func : libdeflate_default_malloc_func;
+	pd = (*malloc_func)(sizeof(*pd) + num_threads * sizeof(pd->tasks[0]));
+	if (!pd)
+		return NULL;
+	pd->have_submitter = (submitter != NULL);
+	if (submitter)
+		pd->submitter = *submitter;
+	pd->free_func = options->free_func ?
+			options->free_func : libdeflate_default_free_func;
+	pd->num_tasks = 0;
+
+	for (i = 0; i < num_threads; i++) {
+		struct parallel_dtask *task = &pd->tasks[i];
+
+		task->d = libdeflate_alloc_decompressor_ex(options);
+		if (!task->d) {
+			libdeflate_free_parallel_decompressor(pd);
+			return NULL;
+		}
+		task->buf.syms = NULL;
+		task->buf.num_syms = 0;
+		task->buf.capacity = 0;
+		pd->num_tasks++;
+	}
+	return pd;
+}
+
+LIBDEFLATEAPI struct libdeflate_parallel_decompressor *
+libdeflate_alloc_parallel_decompressor(unsigned int num_threads,
+				       const struct libdeflate_task_submitter *submitter)
+{
+	static const struct libdeflate_options defaults = {
+		.sizeof_options = sizeof(defaults),
+	};
+	return libdeflate_alloc_parallel_decompressor_ex(num_threads,
+							 submitter, &defaults);
+}
+
+/*
+ * Decompress the raw DEFLATE stream at @in into @out, returning the sizes of
+ * the compressed and decompressed data.
+ */
+static enum libdeflate_result
+parallel_decompress(struct libdeflate_parallel_decompressor *pd,
+		    const u8 *in, size_t in_nbytes,
+		    u8 *out, size_t out_nbytes_avail,
+		    size_t *actual_in_nbytes_ret, size_t *actual_out_nbytes_ret)
+{
+	const u64 in_nbits = (u64)in_nbytes * 8;
+	const u64 chunk_nbits = (u64)PARALLEL_DECOMPRESS_CHUNK_LENGTH * 8;
+	u64 bitpos = 0;
+	size_t out_pos = 0;
+	bool done = false;
+
+	if (pd->num_tasks == 1 ||
+	    in_nbytes < 2 * PARALLEL_DECOMPRESS_CHUNK_LENGTH)
+		return libdeflate_deflate_decompress_ex(pd->tasks[0].d,
+							in, in_nbytes,
+							out, out_nbytes_avail,
+							actual_in_nbytes_ret,
+							actual_out_nbytes_ret);
+	do {
+		struct parallel_dtask *failed_task = NULL;
+		unsigned num_chunks = 1;
+		unsigned i, j;
+
+		/* Guess where the chunks after the first one start. */
+		pd->tasks[0].start_bitpos = bitpos;
+		pd->tasks[0].found = true;
+		pd->tasks[0].selected = false;
+		while (num_chunks < pd->num_tasks &&
+		       bitpos + num_chunks * chunk_nbits < in_nbits) {
+			struct parallel_dtask *task = &pd->tasks[num_chunks];
+
+			task->start_bitpos = bitpos + num_chunks * chunk_nbits;
+			task->search_end_bitpos = MIN(task->start_bitpos +
+						      chunk_nbits, in_nbits);
+			task->selected = true;
+			num_chunks++;
+		}
+		for (i = 0; i < num_chunks; i++) {
+			pd->tasks[i].in = in;
+			pd->tasks[i].in_nbytes = in_nbytes;
+		}
+		parallel_run(pd, parallel_find_block, num_chunks);
+
+		/* Decode each chunk up to the next guess. */
+		for (i = 0; i < num_chunks; i++) {
+			struct parallel_dtask *task = &pd->tasks[i];
+
+			task->selected = task->found;
+			if (!task->found)
+				continue;
+			task->stop_bitpos = bitpos + num_chunks * chunk_nbits;
+			for (j = i + 1; j < num_chunks; j++) {
+				if (pd->tasks[j].found) {
+					task->stop_bitpos =
+						pd->tasks[j].start_bitpos;
+					break;
+				}
+			}
+			task->max_syms = out_nbytes_avail - out_pos;
+		}
+		parallel_run(pd, parallel_decode_chunk, num_chunks);
+
+		/*
+		 * Keep the chunks that are chained from the first one, and
+		 * resolve the last window of each in order.
+		 */
+		i = 0;
+		for (;;) {
+			struct parallel_dtask *task = &pd->tasks[i];
+			size_t num_syms = task->buf.num_syms;
+			size_t num_tail;
+
+			task->selected = false;
+			if (task->result != LIBDEFLATE_SUCCESS ||
+			    num_syms > out_nbytes_avail - out_pos) {
+				failed_task = task;
+				break;
+			}
+			task->out_begin = &out[out_pos];
+			task->out_base = out;
+			num_tail = MIN(num_syms, DEFLATE_MAX_MATCH_OFFSET);
+			task->num_unresolved = num_syms - num_tail;
+			if (!resolve_markers(task->buf.syms,
+					     task->num_unresolved, num_syms,
+					     task->out_begin, out))
+				return LIBDEFLATE_BAD_DATA;
+			task->selected = (task->num_unresolved != 0);
+			out_pos += num_syms;
+			bitpos = task->end_bitpos;
+			if (task->is_final) {
+				done = true;
+				break;
+			}
+			for (j = i + 1; j < num_chunks; j++) {
+				pd->tasks[j].selected = false;
+				if (pd->tasks[j].found)
+					break;
+			}
+			if (j == num_chunks ||
+			    pd->tasks[j].start_bitpos != task->end_bitpos)
+				break;
+			i = j;
+		}
+		for (j = i + 1; j < num_chunks; j++)
+			pd->tasks[j].selected = false;
+
+		/*
+		 * Resolve the rest of the kept chunks at once.  Then if a kept
+		 * chunk failed, e.g. because it didn't fit in the output buffer
+		 * or the data is invalid, let the regular decompressor take
+		 * over from it, so that the result is exactly the same as if
+		 * that had been used all along.
+		 */
+		parallel_run(pd, parallel_resolve_chunk, num_chunks);
+		for (j = 0; j < num_chunks; j++) {
+			if (pd->tasks[j].selected && !pd->tasks[j].resolve_ok)
+				return LIBDEFLATE_BAD_DATA;
+		}
+
+		if (failed_task != NULL) {
+			size_t in_used, out_used;
+			enum libdeflate_result result;
+
+			result = libdeflate_deflate_decompress_at(
+					failed_task->d, in, in_nbytes,
+					failed_task->start_bitpos,
+					out, out_pos, &out[out_pos],
+					out_nbytes_avail - out_pos,
+					&in_used, &out_used);
+			if (result != LIBDEFLATE_SUCCESS)
+				return result;
+			bitpos = (failed_task->start_bitpos / 8 + in_used) * 8;
+			out_pos += out_used;
+			done = true;
+		}
+	} while (!done);
+
+	*actual_in_nbytes_ret = DIV_ROUND_UP(bitpos, 8);
+	*actual_out_nbytes_ret = out_pos;
+	return LIBDEFLATE_SUCCESS;
+}
+
+/*
+ * Finish a call that decompressed @out_nbytes bytes: return the output size if
+ * requested, otherwise require that the output buffer was filled.
+ */
+static enum libdeflate_result
+parallel_finish(size_t out_nbytes, size_t out_nbytes_avail,
+		size_t *actual_out_nbytes_ret)
+{
+	if (actual_out_nbytes_ret)
+		*actual_out_nbytes_ret = out_nbytes;
+	else if (out_nbytes != out_nbytes_avail)
+		return LIBDEFLATE_SHORT_OUTPUT;
+	return LIBDEFLATE_SUCCESS;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_deflate_decompress(struct libdeflate_parallel_decompressor *pd,
+				       const void *in, size_t in_nbytes,
+				       void *out, size_t out_nbytes_avail,
+				       size_t *actual_in_nbytes_ret,
+				       size_t *actual_out_nbytes_ret)
+{
+	size_t in_used, out_used;
+	enum libdeflate_result result;
+
+	result = parallel_decompress(pd, in, in_nbytes, out, out_nbytes_avail,
+				     &in_used, &out_used);
+	if (result != LIBDEFLATE_SUCCESS)
+		return result;
+	if (actual_in_nbytes_ret)
+		*actual_in_nbytes_ret = in_used;
+	return parallel_finish(out_used, out_nbytes_avail,
+			       actual_out_nbytes_ret);
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_zlib_decompress(struct libdeflate_parallel_decompressor *pd,
+				    const void *in, size_t in_nbytes,
+				    void *out, size_t out_nbytes_avail,
+				    size_t *actual_in_nbytes_ret,
+				    size_t *actual_out_nbytes_ret)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	u16 hdr;
+	size_t in_used, out_used;
+	enum libdeflate_result result;
+
+	if (in_nbytes < ZLIB_MIN_OVERHEAD)
+		return LIBDEFLATE_BAD_DATA;
+
+	/* 2 byte header: CMF and FLG  */
+	hdr = get_unaligned_be16(in_next);
+	in_next += 2;
+
+	/* FCHECK */
+	if ((hdr % 31) != 0)
+		return LIBDEFLATE_BAD_DATA;
+
+	/* CM */
+	if (((hdr >> 8) & 0xF) != ZLIB_CM_DEFLATE)
+		return LIBDEFLATE_BAD_DATA;
+
+	/* CINFO */
+	if ((hdr >> 12) > ZLIB_CINFO_32K_WINDOW)
+		return LIBDEFLATE_BAD_DATA;
+
+	/* FDICT: preset dictionaries aren't supported here. */
+	if (hdr & ZLIB_FDICT)
+		return LIBDEFLATE_BAD_DATA;
+
+	/* Compressed data  */
+	result = parallel_decompress(pd, in_next,
+				     in_end - ZLIB_FOOTER_SIZE - in_next,
+				     out, out_nbytes_avail,
+				     &in_used, &out_used);
+	if (result != LIBDEFLATE_SUCCESS)
+		return result;
+	in_next += in_used;
+
+	/* ADLER32  */
+	if (libdeflate_adler32(1, out, out_used) != get_unaligned_be32(in_next))
+		return LIBDEFLATE_BAD_DATA;
+	in_next += 4;
+
+	if (actual_in_nbytes_ret)
+		*actual_in_nbytes_ret = in_next - (u8 *)in;
+	return parallel_finish(out_used, out_nbytes_avail,
+			       actual_out_nbytes_ret);
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_gzip_decompress(struct libdeflate_parallel_decompressor *pd,
+				    const void *in, size_t in_nbytes,
+				    void *out, size_t out_nbytes_avail,
+				    size_t *actual_in_nbytes_ret,
+				    size_t *actual_out_nbytes_ret)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	size_t header_nbytes;
+	size_t in_used, out_used;
+	enum libdeflate_result result;
+
+	header_nbytes = libdeflate_gzip_parse_header(in, in_nbytes);
+	if (header_nbytes == 0)
+		return LIBDEFLATE_BAD_DATA;
+	in_next += header_nbytes;
+
+	/* Compressed data  */
+	result = parallel_decompress(pd, in_next,
+				     in_end - GZIP_FOOTER_SIZE - in_next,
+				     out, out_nbytes_avail,
+				     &in_used, &out_used);
+	if (result != LIBDEFLATE_SUCCESS)
+		return result;
+	in_next += in_used;
+
+	/* CRC32 */
+	if (libdeflate_crc32(0, out, out_used) != get_unaligned_le32(in_next))
+		return LIBDEFLATE_BAD_DATA;
+	in_next += 4;
+
+	/* ISIZE */
+	if ((u32)out_used != get_unaligned_le32(in_next))
+		return LIBDEFLATE_BAD_DATA;
+	in_next += 4;
+
+	if (actual_in_nbytes_ret)
+		*actual_in_nbytes_ret = in_next - (u8 *)in;
+	return parallel_finish(out_used, out_nbytes_avail,
+			       actual_out_nbytes_ret);
+}
+
+/*
+ * If a BGZF member begins at @in, return its size and set *isize_ret to its
+ * ISIZE field.  Otherwise return 0 and set *isize_ret to 0.
+ */
+static size_t
+bgzf_parse_member(const u8 *in, size_t in_nbytes, u32 *isize_ret)
+{
+	struct libdeflate_gzip_header header;
+
+	*isize_ret = 0;
+	if (libdeflate_gzip_parse_header_ex(in, in_nbytes, &header) !=
+	    LIBDEFLATE_SUCCESS ||
+	    header.member_nbytes == 0 || header.member_nbytes > in_nbytes)
+		return 0;
+	*isize_ret = get_unaligned_le32(&in[header.member_nbytes - 4]);
+	return header.member_nbytes;
+}
+
+/* Decompress and check the BGZF members of a task. */
+static void
+parallel_decompress_bgzf_members(void *arg)
+{
+	struct parallel_dtask *task = arg;
+	const u8 *in_next = task->in;
+	const u8 * const in_end = in_next + task->in_nbytes;
+	u8 *out_next = task->out_begin;
+
+	task->result = LIBDEFLATE_SUCCESS;
+	while (in_next != in_end) {
+		size_t header_nbytes =
+			libdeflate_gzip_parse_header(in_next, in_end - in_next);
+		u32 isize;
+		size_t member_nbytes = bgzf_parse_member(in_next,
+							 in_end - in_next,
+							 &isize);
+		const u8 *footer = &in_next[member_nbytes - GZIP_FOOTER_SIZE];
+
+		task->result = libdeflate_deflate_decompress(
+					task->d, &in_next[header_nbytes],
+					footer - &in_next[header_nbytes],
+					out_next, isize, NULL);
+		if (task->result != LIBDEFLATE_SUCCESS)
+			return;
+		if (libdeflate_crc32(0, out_next, isize) !=
+		    get_unaligned_le32(footer)) {
+			task->result = LIBDEFLATE_BAD_DATA;
+			return;
+		}
+		in_next += member_nbytes;
+		out_next += isize;
+	}
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_bgzf_decompress(struct libdeflate_parallel_decompressor *pd,
+				    const void *in, size_t in_nbytes,
+				    void *out, size_t out_nbytes_avail,
+				    size_t *actual_in_nbytes_ret,
+				    size_t *actual_out_nbytes_ret)
+{
+	const u8 *in_next = in;
+	const u8 *in_end;
+	size_t out_nbytes = 0;
+	size_t target;
+	unsigned num_tasks = 0;
+	unsigned i;
+	u32 isize;
+
+	/*
+	 * Find the run of BGZF members at the start of the input, and its
+	 * decompressed size, which the members' ISIZE fields give up front.
+	 */
+	while (in_next != (const u8 *)in + in_nbytes) {
+		size_t member_nbytes = bgzf_parse_member(
+				in_next, (const u8 *)in + in_nbytes - in_next,
+				&isize);
+
+		if (member_nbytes == 0)
+			break;
+		if (isize > out_nbytes_avail - out_nbytes)
+			return LIBDEFLATE_INSUFFICIENT_SPACE;
+		in_next += member_nbytes;
+		out_nbytes += isize;
+	}
+	if (in_next == in)
+		return LIBDEFLATE_BAD_DATA;
+	in_end = in_next;
+
+	/*
+	 * Give each task a contiguous run of members with about the same
+	 * amount of compressed data, and decompress them all at once.
+	 */
+	target = DIV_ROUND_UP(in_end - (const u8 *)in, pd->num_tasks);
+	in_next = in;
+	out_nbytes = 0;
+	while (in_next != in_end) {
+		struct parallel_dtask *task = &pd->tasks[num_tasks++];
+
+		task->in = in_next;
+		task->out_begin = (u8 *)out + out_nbytes;
+		task->selected = true;
+		do {
+			in_next += bgzf_parse_member(in_next, in_end - in_next,
+						     &isize);
+			out_nbytes += isize;
+		} while (in_next != in_end &&
+			 (in_next - task->in < target ||
+			  num_tasks == pd->num_tasks));
+		task->in_nbytes = in_next - task->in;
+	}
+	parallel_run(pd, parallel_decompress_bgzf_members, num_tasks);
+	for (i = 0; i < num_tasks; i++) {
+		if (pd->tasks[i].result != LIBDEFLATE_SUCCESS)
+			return LIBDEFLATE_BAD_DATA;
+	}
+
+	if (actual_in_nbytes_ret)
+		*actual_in_nbytes_ret = in_end - (const u8 *)in;
+	return parallel_finish(out_nbytes, out_nbytes_avail,
+			       actual_out_nbytes_ret);
+}
+
+/*
+ * Return whether a gzip member plausibly begins at @p, given that the previous
+ * one began at @prev: it must have a valid header with a known OS, and the
+ * previous member's ISIZE must be possible for its size.  This is only a guess,
+ * since @p might be in the middle of the previous member's compressed data.
+ */
+static bool
+gzip_member_plausible(const u8 *prev, const u8 *p, const u8 *in_end)
+{
+	struct libdeflate_gzip_header header;
+
+	if (libdeflate_gzip_parse_header_ex(p, in_end - p, &header) !=
+	    LIBDEFLATE_SUCCESS)
+		return false;
+	if (header.os > GZIP_OS_RISCOS && header.os != GZIP_OS_UNKNOWN)
+		return false;
+	return get_unaligned_le32(p - 4) <= (u64)(p - prev) * 1032;
+}
+
+/*
+ * Guess where the gzip member after the one at @member begins, or return
+ * @in_end if it seems to be the last one.  A BGZF member gives its size;
+ * otherwise, look for the next plausible gzip header after the shortest
+ * possible member.
+ */
+static const u8 *
+gzip_guess_next_member(const u8 *member, const u8 *in_end)
+{
+	struct libdeflate_gzip_header header;
+	const u8 *p;
+
+	if (libdeflate_gzip_parse_header_ex(member, in_end - member,
+					    &header) != LIBDEFLATE_SUCCESS)
+		return in_end;
+	if (header.member_nbytes != 0 &&
+	    header.member_nbytes <= in_end - member)
+		return member + header.member_nbytes;
+
+	p = member + header.header_nbytes + 1 + GZIP_FOOTER_SIZE;
+	for (; p < in_end; p++) {
+		if (*p == GZIP_ID1 && gzip_member_plausible(member, p, in_end))
+			return p;
+	}
+	return in_end;
+}
+
+/*
+ * Decompress the gzip members of a task, which must fill exactly its compressed
+ * data, into at most its planned amount of output.
+ */
+static void
+parallel_decompress_gzip_members(void *arg)
+{
+	struct parallel_dtask *task = arg;
+	const u8 *in_next = task->in;
+	const u8 * const in_end = in_next + task->in_nbytes;
+	size_t out_pos = 0;
+
+	task->result = LIBDEFLATE_SUCCESS;
+	while (in_next != in_end) {
+		size_t in_used, out_used;
+
+		task->result = libdeflate_gzip_decompress_ex(
+					task->d, in_next, in_end - in_next,
+					&task->out_begin[out_pos],
+					task->out_nbytes_avail - out_pos,
+					&in_used, &out_used);
+		if (task->result != LIBDEFLATE_SUCCESS)
+			return;
+		in_next += in_used;
+		out_pos += out_used;
+	}
+	task->out_nbytes = out_pos;
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_gzip_decompress_members(struct libdeflate_parallel_decompressor *pd,
+					    const void *in, size_t in_nbytes,
+					    void *out, size_t out_nbytes_avail,
+					    size_t *actual_out_nbytes_ret)
+{
+	const u8 *in_next = in;
+	const u8 * const in_end = in_next + in_nbytes;
+	const size_t target = DIV_ROUND_UP(in_nbytes, pd->num_tasks);
+	struct parallel_dtask *task = NULL;
+	unsigned num_tasks = 0;
+	u64 planned_out_nbytes = 0;
+	size_t out_nbytes = 0;
+	unsigned i;
+
+	if (libdeflate_gzip_parse_header(in, in_nbytes) == 0)
+		return LIBDEFLATE_BAD_DATA;
+
+	/*
+	 * Guess where the members are, and give each task a contiguous run of
+	 * them with about the same amount of compressed data.  Each member's
+	 * ISIZE gives where its output goes.
+	 */
+	while (in_next != in_end) {
+		const u8 *next = gzip_guess_next_member(in_next, in_end);
+
+		if (task == NULL ||
+		    (in_next - task->in >= target &&
+		     num_tasks < pd->num_tasks)) {
+			task = &pd->tasks[num_tasks++];
+			task->in = in_next;
+			task->out_begin = (u8 *)out + MIN(planned_out_nbytes,
+							  out_nbytes_avail);
+			task->selected = (planned_out_nbytes <=
+					  out_nbytes_avail);
+			task->out_nbytes_avail = 0;
+		}
+		planned_out_nbytes += get_unaligned_le32(next - 4);
+		if (planned_out_nbytes > out_nbytes_avail)
+			task->selected = false;
+		else
+			task->out_nbytes_avail = planned_out_nbytes -
+				(task->out_begin - (u8 *)out);
+		task->in_nbytes = next - task->in;
+		in_next = next;
+	}
+
+	/*
+	 * Decompress the runs at once, then keep the results of the tasks that
+	 * are chained from the first one: each must have started where the
+	 * previous one really stopped.  That's true for the input as long as
+	 * each task decompressed all of its input, and it's true for the output
+	 * as long as each task filled its planned output.
+	 */
+	in_next = in;
+	if (num_tasks > 1) {
+		parallel_run(pd, parallel_decompress_gzip_members, num_tasks);
+		for (i = 0; i < num_tasks; i++) {
+			task = &pd->tasks[i];
+			if (!task->selected ||
+			    task->result != LIBDEFLATE_SUCCESS ||
+			    task->out_nbytes != task->out_nbytes_avail)
+				break;
+			in_next += task->in_nbytes;
+			out_nbytes += task->out_nbytes;
+		}
+	}
+
+	/*
+	 * Decompress anything left one member at a time, which also handles
+	 * wrong guesses and errors.  A single large member still gets split
+	 * among the tasks.
+	 */
+	while (in_next != in_end) {
+		size_t in_used, out_used;
+		enum libdeflate_result result;
+
+		result = libdeflate_parallel_gzip_decompress(
+					pd, in_next, in_end - in_next,
+					(u8 *)out + out_nbytes,
+					out_nbytes_avail - out_nbytes,
+					&in_used, &out_used);
+		if (result != LIBDEFLATE_SUCCESS)
+			return result;
+		in_next += in_used;
+		out_nbytes += out_used;
+	}
+
+	return parallel_finish(out_nbytes, out_nbytes_avail,
+			       actual_out_nbytes_ret);
+}
+
+LIBDEFLATEAPI void
+libdeflate_free_parallel_decompressor(struct libdeflate_parallel_decompressor *pd)
+{
+	unsigned i;
+
+	if (pd) {
+		for (i = 0; i < pd->num_tasks; i++) {
+			libdeflate_free_marker_buf(pd->tasks[i].d,
+						   &pd->tasks[i].buf);
+			libdeflate_free_decompressor(pd->tasks[i].d);
+		}
+		(*pd->free_func)(pd);
+	}
+}
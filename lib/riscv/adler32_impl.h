@@ -0,0 +1,109 @@
+/*
+ * riscv/adler32_impl.h - RISC-V implementations of Adler-32 checksum algorithm
+ *
+ * Copyright 2024 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef LIB_RISCV_ADLER32_IMPL_H
+#define LIB_RISCV_ADLER32_IMPL_H
+
+#include "cpu_features.h"
+
+/*
+ * RISC-V Vector Extension implementation.  This works on vectors of 'vl' bytes,
+ * widened to 32-bit lanes.  v_byte_sums holds the sum of the bytes at each
+ * index i in [0, vl) across all vectors so far, and v_s1_sums accumulates the
+ * previous v_byte_sums for each new vector, which with the multiplication by
+ * 'vl' delayed until the end gives those bytes' contribution to s2 from the
+ * vectors after them.  Within each vector the byte at index i contributes
+ * (vl - i) times to s2.  The lanes are summed with widening reductions.
+ *
+ * Each value, including the partial sums, is at most the final s2 of the chunk
+ * (before reduction mod DIVISOR), which fits in 32 bits since the chunk length
+ * is at most MAX_CHUNK_LEN.  So none of the 32-bit lanes can overflow.
+ */
+#if HAVE_V_INTRIN
+static u32 MAYBE_UNUSED
+adler32_riscv_v(u32 adler, const u8 *p, size_t len)
+{
+	const size_t vl = __riscv_vsetvl_e8m1(256);
+	const vuint32m4_t mults =
+		__riscv_vrsub_vx_u32m4(__riscv_vid_v_u32m4(vl), vl, vl);
+	const vuint64m1_t zero = __riscv_vmv_s_x_u64m1(0, 1);
+	u32 s1 = adler & 0xFFFF;
+	u32 s2 = adler >> 16;
+
+	while (len) {
+		size_t n = MIN(len, MAX_CHUNK_LEN);
+
+		len -= n;
+
+		if (n >= vl) {
+			vuint32m4_t v_byte_sums = __riscv_vmv_v_x_u32m4(0, vl);
+			vuint32m4_t v_s1_sums = __riscv_vmv_v_x_u32m4(0, vl);
+
+			s2 += s1 * (n - (n % vl));
+
+			do {
+				vuint32m4_t bytes = __riscv_vzext_vf4_u32m4(
+					__riscv_vle8_v_u8m1(p, vl), vl);
+
+				v_s1_sums = __riscv_vadd_vv_u32m4(v_s1_sums,
+								  v_byte_sums,
+								  vl);
+				v_byte_sums = __riscv_vadd_vv_u32m4(v_byte_sums,
+								    bytes, vl);
+				p += vl;
+				n -= vl;
+			} while (n >= vl);
+
+			s1 += __riscv_vmv_x_s_u64m1_u64(
+				__riscv_vwredsumu_vs_u32m4_u64m1(v_byte_sums,
+								 zero, vl));
+			s2 += vl * __riscv_vmv_x_s_u64m1_u64(
+				__riscv_vwredsumu_vs_u32m4_u64m1(v_s1_sums,
+								 zero, vl));
+			s2 += __riscv_vmv_x_s_u64m1_u64(
+				__riscv_vwredsumu_vs_u32m4_u64m1(
+					__riscv_vmul_vv_u32m4(v_byte_sums,
+							      mults, vl),
+					zero, vl));
+		}
+		/*
+		 * Process the last 0 <= n < vl bytes of the chunk using scalar
+		 * instructions and reduce s1 and s2 mod DIVISOR.
+		 */
+		ADLER32_CHUNK(s1, s2, p, n);
+	}
+	return (s2 << 16) | s1;
+}
+#define adler32_riscv_v	adler32_riscv_v
+#endif /* HAVE_V_INTRIN */
+
+#ifdef adler32_riscv_v
+#define DEFAULT_IMPL	adler32_riscv_v
+#endif
+
+#endif /* LIB_RISCV_ADLER32_IMPL_H */
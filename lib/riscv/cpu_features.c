@@ -0,0 +1,96 @@
+/*
+ * riscv/cpu_features.c - feature detection for RISC-V CPUs
+ *
+ * Copyright 2024 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * On Linux, RISC-V CPU features are detected with the riscv_hwprobe() system
+ * call, which is available since Linux 6.4.  Unlike AT_HWCAP, it can report
+ * multi-letter extensions such as Zbc.
+ */
+
+#undef _GNU_SOURCE
+#define _GNU_SOURCE /* for syscall() */
+
+#include "../cpu_features_common.h" /* must be included first */
+#include "cpu_features.h"
+
+#ifdef RISCV_CPU_FEATURES_KNOWN
+/* Runtime RISC-V CPU feature detection is supported. */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* These are from <asm/hwprobe.h>, which older kernel headers don't have. */
+#ifndef __NR_riscv_hwprobe
+#  define __NR_riscv_hwprobe		258
+#endif
+#define RISCV_HWPROBE_KEY_IMA_EXT_0	4
+#define RISCV_HWPROBE_IMA_V		(1 << 2)
+#define RISCV_HWPROBE_EXT_ZBC		(1 << 7)
+
+struct riscv_hwprobe_pair {
+	s64 key;
+	u64 value;
+};
+
+static u32 query_riscv_cpu_features(void)
+{
+	struct riscv_hwprobe_pair pair = { .key = RISCV_HWPROBE_KEY_IMA_EXT_0 };
+	u32 features = 0;
+
+	/*
+	 * On older kernels this fails with ENOSYS, or the kernel clears the key
+	 * to -1 if it doesn't know it.  Either way, no features are detected.
+	 */
+	if (syscall(__NR_riscv_hwprobe, &pair, 1, 0, NULL, 0) != 0 ||
+	    pair.key != RISCV_HWPROBE_KEY_IMA_EXT_0)
+		return 0;
+
+	if (pair.value & RISCV_HWPROBE_IMA_V)
+		features |= RISCV_CPU_FEATURE_V;
+	if (pair.value & RISCV_HWPROBE_EXT_ZBC)
+		features |= RISCV_CPU_FEATURE_ZBC;
+	return features;
+}
+
+static const struct cpu_feature riscv_cpu_feature_table[] = {
+	{RISCV_CPU_FEATURE_V,		"v"},
+	{RISCV_CPU_FEATURE_ZBC,		"zbc"},
+};
+
+volatile u32 libdeflate_riscv_cpu_features = 0;
+
+void libdeflate_init_riscv_cpu_features(void)
+{
+	u32 features = query_riscv_cpu_features();
+
+	disable_cpu_features_for_testing(&features, riscv_cpu_feature_table,
+					 ARRAY_LEN(riscv_cpu_feature_table));
+
+	libdeflate_riscv_cpu_features = features | RISCV_CPU_FEATURES_KNOWN;
+}
+
+#endif /* RISCV_CPU_FEATURES_KNOWN */
@@ -0,0 +1,114 @@
+/*
+ * riscv/cpu_features.h - feature detection for RISC-V CPUs
+ *
+ * Copyright 2024 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIB_RISCV_CPU_FEATURES_H
+#define LIB_RISCV_CPU_FEATURES_H
+
+#include "../lib_common.h"
+
+/*
+ * This and the CRC-32 and Adler-32 code that uses it haven't been run on RISC-V
+ * yet, so they're only built when LIBDEFLATE_RISCV_CHECKSUMS is defined.
+ */
+#if defined(ARCH_RISCV) && defined(LIBDEFLATE_RISCV_CHECKSUMS)
+
+#define RISCV_CPU_FEATURE_V		(1 << 0)
+#define RISCV_CPU_FEATURE_ZBC		(1 << 1)
+
+#if !defined(FREESTANDING) && \
+    (defined(__GNUC__) || defined(__clang__)) && defined(__linux__)
+/* Runtime RISC-V CPU feature detection is supported. */
+#  define RISCV_CPU_FEATURES_KNOWN	(1U << 31)
+extern volatile u32 libdeflate_riscv_cpu_features;
+
+void libdeflate_init_riscv_cpu_features(void);
+
+static inline u32 get_riscv_cpu_features(void)
+{
+	if (libdeflate_riscv_cpu_features == 0)
+		libdeflate_init_riscv_cpu_features();
+	return libdeflate_riscv_cpu_features;
+}
+#else
+static inline u32 get_riscv_cpu_features(void) { return 0; }
+#endif
+
+/*
+ * V (the Vector Extension).  The vector intrinsics need the main target to have
+ * V enabled already, so the runtime check only matters for testing.
+ */
+#ifdef __riscv_vector
+#  define HAVE_V(features)	1
+#  define HAVE_V_INTRIN		1
+#  include <riscv_vector.h>
+#else
+#  define HAVE_V(features)	((features) & RISCV_CPU_FEATURE_V)
+#  define HAVE_V_INTRIN		0
+#endif
+
+/*
+ * Zbc (carry-less multiplication).  This is only used on RV64, where clmul and
+ * clmulh give the low and high halves of a 64 x 64 => 128 bit product.  It's
+ * used via inline assembly that gives the raw instruction encodings, which
+ * works whether or not the compiler and assembler have Zbc enabled.
+ */
+#ifdef __riscv_zbc
+#  define HAVE_ZBC(features)	1
+#else
+#  define HAVE_ZBC(features)	((features) & RISCV_CPU_FEATURE_ZBC)
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && \
+	defined(__riscv_xlen) && __riscv_xlen == 64
+#  define HAVE_ZBC_ASM		1
+static forceinline u64
+riscv_clmul(u64 a, u64 b)
+{
+	u64 res;
+
+	/* clmul: OP opcode, funct3 = 1, funct7 = 5 */
+	__asm__(".insn r 0x33, 1, 5, %0, %1, %2"
+		: "=r" (res) : "r" (a), "r" (b));
+	return res;
+}
+
+static forceinline u64
+riscv_clmulh(u64 a, u64 b)
+{
+	u64 res;
+
+	/* clmulh: OP opcode, funct3 = 3, funct7 = 5 */
+	__asm__(".insn r 0x33, 3, 5, %0, %1, %2"
+		: "=r" (res) : "r" (a), "r" (b));
+	return res;
+}
+#else
+#  define HAVE_ZBC_ASM		0
+#endif
+
+#endif /* ARCH_RISCV && LIBDEFLATE_RISCV_CHECKSUMS */
+
+#endif /* LIB_RISCV_CPU_FEATURES_H */
@@ -0,0 +1,168 @@
+/*
+ * riscv/crc32_impl.h - RISC-V implementations of the gzip CRC-32 algorithm
+ *
+ * Copyright 2024 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef LIB_RISCV_CRC32_IMPL_H
+#define LIB_RISCV_CRC32_IMPL_H
+
+#include "cpu_features.h"
+
+#if HAVE_ZBC_ASM
+/*
+ * crc32_riscv_zbc() - implementation using the Zbc carry-less multiplication
+ * instructions
+ *
+ * This works like the x86 PCLMULQDQ implementation with 16-byte vectors, and it
+ * uses the same multipliers, except that each 128-bit polynomial is held in two
+ * 64-bit registers: 'lo' holds the first 8 bytes and 'hi' the next 8.  Folding
+ * one polynomial into another takes four multiplications, so the main loop
+ * folds four independent polynomials to keep several in flight at once.
+ */
+
+/*
+ * Fold the 128-bit polynomial (src_lo, src_hi) into (*dst_lo, *dst_hi), which
+ * comes 'n' bits later, where mult_lo = x^(n+31) mod G and
+ * mult_hi = x^(n-33) mod G.
+ */
+static forceinline void
+crc32_riscv_fold(u64 src_lo, u64 src_hi, u64 *dst_lo, u64 *dst_hi,
+		 u64 mult_lo, u64 mult_hi)
+{
+	*dst_lo ^= riscv_clmul(src_lo, mult_lo) ^ riscv_clmul(src_hi, mult_hi);
+	*dst_hi ^= riscv_clmulh(src_lo, mult_lo) ^ riscv_clmulh(src_hi, mult_hi);
+}
+
+static u32 MAYBE_UNUSED
+crc32_riscv_zbc(u32 crc, const u8 *p, size_t len)
+{
+	u64 x0_lo, x0_hi, x1_lo, x1_hi, x2_lo, x2_hi, x3_lo, x3_hi;
+	u64 tmp;
+
+	if (len < 16)
+		return crc32_slice1(crc, p, len);
+
+	x0_lo = get_unaligned_le64(p) ^ crc;
+	x0_hi = get_unaligned_le64(p + 8);
+	p += 16;
+	len -= 16;
+
+	if (len >= 48) {
+		x1_lo = get_unaligned_le64(p + 0);
+		x1_hi = get_unaligned_le64(p + 8);
+		x2_lo = get_unaligned_le64(p + 16);
+		x2_hi = get_unaligned_le64(p + 24);
+		x3_lo = get_unaligned_le64(p + 32);
+		x3_hi = get_unaligned_le64(p + 40);
+		p += 48;
+		len -= 48;
+
+		/* Fold 64 bytes at a time into the four polynomials. */
+		while (len >= 64) {
+			u64 d0_lo = get_unaligned_le64(p + 0);
+			u64 d0_hi = get_unaligned_le64(p + 8);
+			u64 d1_lo = get_unaligned_le64(p + 16);
+			u64 d1_hi = get_unaligned_le64(p + 24);
+			u64 d2_lo = get_unaligned_le64(p + 32);
+			u64 d2_hi = get_unaligned_le64(p + 40);
+			u64 d3_lo = get_unaligned_le64(p + 48);
+			u64 d3_hi = get_unaligned_le64(p + 56);
+
+			crc32_riscv_fold(x0_lo, x0_hi, &d0_lo, &d0_hi,
+					 CRC32_X543_MODG, CRC32_X479_MODG);
+			crc32_riscv_fold(x1_lo, x1_hi, &d1_lo, &d1_hi,
+					 CRC32_X543_MODG, CRC32_X479_MODG);
+			crc32_riscv_fold(x2_lo, x2_hi, &d2_lo, &d2_hi,
+					 CRC32_X543_MODG, CRC32_X479_MODG);
+			crc32_riscv_fold(x3_lo, x3_hi, &d3_lo, &d3_hi,
+					 CRC32_X543_MODG, CRC32_X479_MODG);
+			x0_lo = d0_lo; x0_hi = d0_hi;
+			x1_lo = d1_lo; x1_hi = d1_hi;
+			x2_lo = d2_lo; x2_hi = d2_hi;
+			x3_lo = d3_lo; x3_hi = d3_hi;
+			p += 64;
+			len -= 64;
+		}
+
+		/* Fold the four polynomials into one. */
+		crc32_riscv_fold(x0_lo, x0_hi, &x2_lo, &x2_hi,
+				 CRC32_X287_MODG, CRC32_X223_MODG);
+		crc32_riscv_fold(x1_lo, x1_hi, &x3_lo, &x3_hi,
+				 CRC32_X287_MODG, CRC32_X223_MODG);
+		crc32_riscv_fold(x2_lo, x2_hi, &x3_lo, &x3_hi,
+				 CRC32_X159_MODG, CRC32_X95_MODG);
+		x0_lo = x3_lo;
+		x0_hi = x3_hi;
+	}
+
+	/* Fold in any remaining 16-byte segments. */
+	while (len >= 16) {
+		u64 d_lo = get_unaligned_le64(p);
+		u64 d_hi = get_unaligned_le64(p + 8);
+
+		crc32_riscv_fold(x0_lo, x0_hi, &d_lo, &d_hi,
+				 CRC32_X159_MODG, CRC32_X95_MODG);
+		x0_lo = d_lo;
+		x0_hi = d_hi;
+		p += 16;
+		len -= 16;
+	}
+
+	/*
+	 * Reduce the 128-bit polynomial to the 32-bit CRC using Barrett
+	 * reduction, the same way as the x86 implementation does; see there for
+	 * the details.  First reduce the half in x0_lo and add the result to
+	 * x0_hi, then reduce x0_hi.
+	 */
+	tmp = riscv_clmul(x0_lo, CRC32_BARRETT_CONSTANT_1);
+	x0_hi ^= (u32)riscv_clmulh(tmp, CRC32_BARRETT_CONSTANT_2);
+	tmp = riscv_clmul(x0_hi, CRC32_BARRETT_CONSTANT_1);
+	crc = riscv_clmulh(tmp, CRC32_BARRETT_CONSTANT_2);
+
+	/* Handle any remainder of 1 to 15 bytes. */
+	return crc32_slice1(crc, p, len);
+}
+#define crc32_riscv_zbc	crc32_riscv_zbc
+#endif /* HAVE_ZBC_ASM */
+
+#if defined(crc32_riscv_zbc) && defined(__riscv_zbc)
+#define DEFAULT_IMPL	crc32_riscv_zbc
+#else
+static inline crc32_func_t
+arch_select_crc32_func(void)
+{
+	const u32 features MAYBE_UNUSED = get_riscv_cpu_features();
+
+#ifdef crc32_riscv_zbc
+	if (HAVE_ZBC(features))
+		return crc32_riscv_zbc;
+#endif
+	return NULL;
+}
+#define arch_select_crc32_func	arch_select_crc32_func
+#endif
+
+#endif /* LIB_RISCV_CRC32_IMPL_H */
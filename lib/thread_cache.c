@@ -0,0 +1,354 @@
+/*
+ * thread_cache.c - per-thread caches of compressors and decompressors
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib_common.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+/*
+ * The default limit on the total memory of the objects in all threads' caches.
+ * This fits a couple of compressors for levels 10-14 plus a handful of others.
+ */
+#define DEFAULT_THREAD_CACHE_LIMIT	((size_t)32 << 20)
+
+/* A cache slot for each compression level, then one for the decompressor */
+#define NUM_COMPRESSOR_SLOTS		15
+#define DECOMPRESSOR_SLOT		NUM_COMPRESSOR_SLOTS
+#define NUM_SLOTS			(NUM_COMPRESSOR_SLOTS + 1)
+
+struct thread_cache_slot {
+	/* The cached compressor or decompressor, or NULL if none */
+	void *obj;
+
+	/* The memory that 'obj' was counted as using */
+	size_t size;
+
+	/* The value of the cache's 'use_counter' when 'obj' was last returned */
+	u64 last_use;
+};
+
+struct thread_cache {
+	struct thread_cache_slot slots[NUM_SLOTS];
+	u64 use_counter;
+
+	/* The free() function for this struct */
+	free_func_t free_func;
+};
+
+/*
+ * The limit on the total memory of the cached objects, and that total.  Both
+ * are protected by the lock below.
+ */
+static size_t thread_cache_limit = DEFAULT_THREAD_CACHE_LIMIT;
+static size_t thread_cache_total;
+
+static void
+thread_cache_free_slot(struct thread_cache_slot *slot, int i)
+{
+	if (i == DECOMPRESSOR_SLOT)
+		libdeflate_free_decompressor(slot->obj);
+	else
+		libdeflate_free_compressor(slot->obj);
+	slot->obj = NULL;
+}
+
+static void thread_cache_lock(void);
+static void thread_cache_unlock(void);
+
+/* Free all the objects in a thread's cache, and the cache itself. */
+static void
+thread_cache_destroy(struct thread_cache *tc)
+{
+	size_t freed = 0;
+	int i;
+
+	for (i = 0; i < NUM_SLOTS; i++) {
+		if (tc->slots[i].obj != NULL) {
+			freed += tc->slots[i].size;
+			thread_cache_free_slot(&tc->slots[i], i);
+		}
+	}
+	thread_cache_lock();
+	thread_cache_total -= freed;
+	thread_cache_unlock();
+	(*tc->free_func)(tc);
+}
+
+#ifdef _WIN32
+
+static SRWLOCK thread_cache_srwlock = SRWLOCK_INIT;
+static INIT_ONCE thread_cache_once = INIT_ONCE_STATIC_INIT;
+static DWORD thread_cache_index = FLS_OUT_OF_INDEXES;
+
+static void
+thread_cache_lock(void)
+{
+	AcquireSRWLockExclusive(&thread_cache_srwlock);
+}
+
+static void
+thread_cache_unlock(void)
+{
+	ReleaseSRWLockExclusive(&thread_cache_srwlock);
+}
+
+static VOID NTAPI
+thread_cache_exit_callback(PVOID data)
+{
+	if (data != NULL)
+		thread_cache_destroy(data);
+}
+
+static BOOL CALLBACK
+thread_cache_init_index(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	(void)once;
+	(void)param;
+	(void)context;
+	thread_cache_index = FlsAlloc(thread_cache_exit_callback);
+	return TRUE;
+}
+
+/* Set up the per-thread storage if needed, and return whether it works. */
+static bool
+thread_cache_init(void)
+{
+	InitOnceExecuteOnce(&thread_cache_once, thread_cache_init_index,
+			    NULL, NULL);
+	return thread_cache_index != FLS_OUT_OF_INDEXES;
+}
+
+static struct thread_cache *
+thread_cache_get(void)
+{
+	return FlsGetValue(thread_cache_index);
+}
+
+static bool
+thread_cache_set(struct thread_cache *tc)
+{
+	return FlsSetValue(thread_cache_index, tc);
+}
+
+#else /* _WIN32 */
+
+static pthread_mutex_t thread_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_cache_key;
+static bool thread_cache_key_valid;
+
+static void
+thread_cache_lock(void)
+{
+	pthread_mutex_lock(&thread_cache_mutex);
+}
+
+static void
+thread_cache_unlock(void)
+{
+	pthread_mutex_unlock(&thread_cache_mutex);
+}
+
+static void
+thread_cache_exit_callback(void *data)
+{
+	thread_cache_destroy(data);
+}
+
+static void
+thread_cache_init_key(void)
+{
+	thread_cache_key_valid =
+		(pthread_key_create(&thread_cache_key,
+				    thread_cache_exit_callback) == 0);
+}
+
+/* Set up the per-thread storage if needed, and return whether it works. */
+static bool
+thread_cache_init(void)
+{
+	pthread_once(&thread_cache_once, thread_cache_init_key);
+	return thread_cache_key_valid;
+}
+
+static struct thread_cache *
+thread_cache_get(void)
+{
+	return pthread_getspecific(thread_cache_key);
+}
+
+static bool
+thread_cache_set(struct thread_cache *tc)
+{
+	return pthread_setspecific(thread_cache_key, tc) == 0;
+}
+
+#endif /* !_WIN32 */
+
+/* Get the calling thread's cache, creating it if it doesn't exist yet. */
+static struct thread_cache *
+thread_cache_get_or_create(void)
+{
+	struct thread_cache *tc;
+
+	if (!thread_cache_init())
+		return NULL;
+	tc = thread_cache_get();
+	if (tc != NULL)
+		return tc;
+	tc = (*libdeflate_default_malloc_func)(sizeof(*tc));
+	if (tc == NULL)
+		return NULL;
+	memset(tc, 0, sizeof(*tc));
+	tc->free_func = libdeflate_default_free_func;
+	if (!thread_cache_set(tc)) {
+		(*tc->free_func)(tc);
+		return NULL;
+	}
+	return tc;
+}
+
+/*
+ * Make room for a new object of 'size' bytes in the calling thread's cache by
+ * freeing the least recently used compressors in it, as long as the total is
+ * over the limit.  Other threads' objects may be in use, so they are left
+ * alone, and so is the decompressor, which is small and may be in use together
+ * with a compressor.  Then count the new object in the total.
+ */
+static void
+thread_cache_make_room(struct thread_cache *tc, size_t size)
+{
+	for (;;) {
+		struct thread_cache_slot *lru = NULL;
+		int lru_index = 0;
+		int i;
+
+		thread_cache_lock();
+		if (thread_cache_total + size <= thread_cache_limit) {
+			thread_cache_total += size;
+			thread_cache_unlock();
+			return;
+		}
+		for (i = 0; i < NUM_COMPRESSOR_SLOTS; i++) {
+			struct thread_cache_slot *slot = &tc->slots[i];
+
+			if (slot->obj != NULL &&
+			    (lru == NULL || slot->last_use < lru->last_use)) {
+				lru = slot;
+				lru_index = i;
+			}
+		}
+		if (lru == NULL) {
+			/* Go over the limit rather than fail. */
+			thread_cache_total += size;
+			thread_cache_unlock();
+			return;
+		}
+		thread_cache_total -= lru->size;
+		thread_cache_unlock();
+		thread_cache_free_slot(lru, lru_index);
+	}
+}
+
+static void *
+thread_cache_lookup(int slot_index)
+{
+	struct thread_cache *tc = thread_cache_get_or_create();
+	struct thread_cache_slot *slot;
+
+	if (tc == NULL)
+		return NULL;
+	slot = &tc->slots[slot_index];
+	if (slot->obj == NULL) {
+		size_t size;
+
+		if (slot_index == DECOMPRESSOR_SLOT) {
+			size = libdeflate_decompressor_alloc_size();
+			thread_cache_lock();
+			thread_cache_total += size;
+			thread_cache_unlock();
+		} else {
+			size = libdeflate_compressor_memory_size(slot_index,
+								 NULL);
+			thread_cache_make_room(tc, size);
+		}
+		if (slot_index == DECOMPRESSOR_SLOT)
+			slot->obj = libdeflate_alloc_decompressor();
+		else
+			slot->obj = libdeflate_alloc_compressor(slot_index);
+		if (slot->obj == NULL) {
+			thread_cache_lock();
+			thread_cache_total -= size;
+			thread_cache_unlock();
+			return NULL;
+		}
+		slot->size = size;
+	}
+	slot->last_use = ++tc->use_counter;
+	return slot->obj;
+}
+
+LIBDEFLATEAPI struct libdeflate_compressor *
+libdeflate_get_thread_compressor(int compression_level)
+{
+	if (compression_level < 0 ||
+	    compression_level >= NUM_COMPRESSOR_SLOTS)
+		return NULL;
+	return thread_cache_lookup(compression_level);
+}
+
+LIBDEFLATEAPI struct libdeflate_decompressor *
+libdeflate_get_thread_decompressor(void)
+{
+	return thread_cache_lookup(DECOMPRESSOR_SLOT);
+}
+
+LIBDEFLATEAPI void
+libdeflate_free_thread_cache(void)
+{
+	struct thread_cache *tc;
+
+	if (!thread_cache_init())
+		return;
+	tc = thread_cache_get();
+	if (tc != NULL) {
+		thread_cache_set(NULL);
+		thread_cache_destroy(tc);
+	}
+}
+
+LIBDEFLATEAPI void
+libdeflate_set_thread_cache_limit(size_t max_bytes)
+{
+	thread_cache_lock();
+	thread_cache_limit = max_bytes;
+	thread_cache_unlock();
+}
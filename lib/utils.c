@@ -33,6 +33,9 @@
 #else
 #  include <stdlib.h>
 #endif
+#if SUPPORT_HUGE_PAGES
+#  include <sys/mman.h>
+#endif
 
 malloc_func_t libdeflate_default_malloc_func = malloc;
 free_func_t libdeflate_default_free_func = free;
@@ -41,7 +44,7 @@ void *
 libdeflate_aligned_malloc(malloc_func_t malloc_func,
 			  size_t alignment, size_t size)
 {
-	void *ptr = (*malloc_func)(sizeof(void *) + alignment - 1 + size);
+	void *ptr = (*malloc_func)(ALIGNED_MALLOC_SIZE(alignment, size));
 
 	if (ptr) {
 		void *orig_ptr = ptr;
@@ -58,6 +61,62 @@ libdeflate_aligned_free(free_func_t free_func, void *ptr)
 	(*free_func)(((void **)ptr)[-1]);
 }
 
+/*
+ * Ask the kernel to back the given memory, which must be aligned to
+ * HUGE_PAGE_SIZE and not yet touched, with huge pages.  This is only a hint,
+ * so errors are ignored.
+ */
+void
+libdeflate_advise_huge_pages(void *ptr, size_t size)
+{
+#if SUPPORT_HUGE_PAGES && defined(MADV_HUGEPAGE)
+	(void)madvise(ptr, size, MADV_HUGEPAGE);
+#else
+	(void)ptr;
+	(void)size;
+#endif
+}
+
+/*
+ * Copy the user-provided options into *out, filling in any fields that the
+ * caller's version of the struct doesn't have with 0 (their default).  The
+ * oldest struct accepted is the one from libdeflate v1.19, which ended with
+ * 'free_func'.  Return false if 'sizeof_options' isn't a supported size.
+ */
+bool
+libdeflate_get_options(const struct libdeflate_options *options,
+		       struct libdeflate_options *out)
+{
+	const size_t min_size = offsetof(struct libdeflate_options, free_func) +
+				sizeof(options->free_func);
+
+	if (options->sizeof_options < min_size ||
+	    options->sizeof_options > sizeof(*out))
+		return false;
+	memset(out, 0, sizeof(*out));
+	memcpy(out, options, options->sizeof_options);
+	out->sizeof_options = sizeof(*out);
+	return true;
+}
+
+/*
+ * Copy the user-provided backend into *out, like libdeflate_get_options().  A
+ * NULL backend gives one with no functions.  Return false if 'sizeof_backend'
+ * isn't a supported size.
+ */
+bool
+libdeflate_get_backend(const struct libdeflate_backend *backend,
+		       struct libdeflate_backend *out)
+{
+	memset(out, 0, sizeof(*out));
+	if (backend == NULL)
+		return true;
+	if (backend->sizeof_backend != sizeof(*out))
+		return false;
+	memcpy(out, backend, sizeof(*out));
+	return true;
+}
+
 LIBDEFLATEAPI void
 libdeflate_set_memory_allocator(malloc_func_t malloc_func,
 				free_func_t free_func)
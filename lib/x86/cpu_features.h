@@ -123,8 +123,10 @@ static inline u32 get_x86_cpu_features(void) { return 0; }
 
 #ifdef __AVX2__
 #  define HAVE_AVX2(features)		1
+#  define HAVE_AVX2_NATIVE		1
 #else
 #  define HAVE_AVX2(features)		((features) & X86_CPU_FEATURE_AVX2)
+#  define HAVE_AVX2_NATIVE		0
 #endif
 
 #if defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__))
@@ -30,18 +30,11 @@
 
 #include "cpu_features.h"
 
-/*
- * pshufb(x, shift_tab[len..len+15]) left shifts x by 16-len bytes.
- * pshufb(x, shift_tab[len+16..len+31]) right shifts x by len bytes.
- */
-static const u8 MAYBE_UNUSED shift_tab[48] = {
-	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
-	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-};
+/* Parameters of crc32_pclmul_template.h for the gzip CRC-32 */
+#define CRC_BITS		32
+#define CRC_CONST(name)		CRC32_##name
+#define CRC_FUNC		crc32_x86
+#define CRC_SLICE1		crc32_slice1
 
 #if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
 /*
@@ -157,4 +150,9 @@ arch_select_crc32_func(void)
 }
 #define arch_select_crc32_func	arch_select_crc32_func
 
+#undef CRC_BITS
+#undef CRC_CONST
+#undef CRC_FUNC
+#undef CRC_SLICE1
+
 #endif /* LIB_X86_CRC32_IMPL_H */
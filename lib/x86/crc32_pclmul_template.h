@@ -1,5 +1,5 @@
 /*
- * x86/crc32_pclmul_template.h - gzip CRC-32 with PCLMULQDQ instructions
+ * x86/crc32_pclmul_template.h - CRCs with PCLMULQDQ instructions
  *
  * Copyright 2016 Eric Biggers
  *
@@ -26,9 +26,19 @@
  */
 
 /*
- * This file is a "template" for instantiating PCLMULQDQ-based crc32_x86
- * functions.  The "parameters" are:
+ * This file is a "template" for instantiating PCLMULQDQ-based CRC functions.
+ * The "parameters" are:
  *
+ * CRC_BITS:
+ *	Length of the CRC in bits.  Must be 32 or 64.  The CRC must be LSB-first
+ *	(bit-reflected), as the gzip CRC-32, CRC-32C and CRC-64/XZ are.
+ * CRC_CONST(name):
+ *	Expands to the constant 'name' for the CRC's polynomial, for example
+ *	CRC32_##name.  See scripts/gen-crc32-consts.py for the constants.
+ * CRC_FUNC:
+ *	Base name of the instantiated function, for example crc32_x86.
+ * CRC_SLICE1:
+ *	The generic byte-at-a-time function, to use for very short lengths.
  * SUFFIX:
  *	Name suffix to append to all instantiated functions.
  * ATTRIBUTES:
@@ -48,8 +58,9 @@
  *	not support AVX-512.
  *
  * The overall algorithm used is CRC folding with carryless multiplication
- * instructions.  Note that the x86 crc32 instruction cannot be used, as it is
- * for a different polynomial, not the gzip one.  For an explanation of CRC
+ * instructions, which works for any polynomial.  (The x86 crc32 instruction is
+ * only for CRC-32C, and is slower than folding on long buffers.)  For an
+ * explanation of CRC
  * folding with carryless multiplication instructions, see
  * scripts/gen-crc32-consts.py and the following blog posts and papers:
  *
@@ -65,38 +76,73 @@
  * or AVX512VL, or four in combination with AVX512F.
  */
 
+#ifndef CRC_PCLMUL_SHIFT_TAB_DEFINED
+#define CRC_PCLMUL_SHIFT_TAB_DEFINED
+/*
+ * pshufb(x, shift_tab[len..len+15]) left shifts x by 16-len bytes.
+ * pshufb(x, shift_tab[len+16..len+31]) right shifts x by len bytes.
+ */
+static const u8 MAYBE_UNUSED shift_tab[48] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+#endif
+
+#if CRC_BITS == 32
+#  define crc_t			u32
+#elif CRC_BITS == 64
+#  define crc_t			u64
+#else
+#  error "unsupported CRC length"
+#endif
+
+/*
+ * The two multipliers for folding across 'bits' bits, in the order that
+ * _mm_set_epi64x() takes them
+ */
+#define FOLD_MULTS(bits)	CRC_CONST(FOLD_ACROSS_##bits##_BITS_CONST_2), \
+				CRC_CONST(FOLD_ACROSS_##bits##_BITS_CONST_1)
+
 #if VL == 16
 #  define vec_t			__m128i
 #  define fold_vec		fold_vec128
 #  define VLOADU(p)		_mm_loadu_si128((const void *)(p))
 #  define VXOR(a, b)		_mm_xor_si128((a), (b))
 #  define M128I_TO_VEC(a)	a
-#  define MULTS_8V		_mm_set_epi64x(CRC32_X991_MODG, CRC32_X1055_MODG)
-#  define MULTS_4V		_mm_set_epi64x(CRC32_X479_MODG, CRC32_X543_MODG)
-#  define MULTS_2V		_mm_set_epi64x(CRC32_X223_MODG, CRC32_X287_MODG)
-#  define MULTS_1V		_mm_set_epi64x(CRC32_X95_MODG, CRC32_X159_MODG)
+#  define MULTS_8V		_mm_set_epi64x(FOLD_MULTS(1024))
+#  define MULTS_4V		_mm_set_epi64x(FOLD_MULTS(512))
+#  define MULTS_2V		_mm_set_epi64x(FOLD_MULTS(256))
+#  define MULTS_1V		_mm_set_epi64x(FOLD_MULTS(128))
 #elif VL == 32
 #  define vec_t			__m256i
 #  define fold_vec		fold_vec256
 #  define VLOADU(p)		_mm256_loadu_si256((const void *)(p))
 #  define VXOR(a, b)		_mm256_xor_si256((a), (b))
 #  define M128I_TO_VEC(a)	_mm256_zextsi128_si256(a)
-#  define MULTS(a, b)		_mm256_set_epi64x(a, b, a, b)
-#  define MULTS_8V		MULTS(CRC32_X2015_MODG, CRC32_X2079_MODG)
-#  define MULTS_4V		MULTS(CRC32_X991_MODG, CRC32_X1055_MODG)
-#  define MULTS_2V		MULTS(CRC32_X479_MODG, CRC32_X543_MODG)
-#  define MULTS_1V		MULTS(CRC32_X223_MODG, CRC32_X287_MODG)
+#  define MULTS(bits)		_mm256_set_epi64x(FOLD_MULTS(bits), \
+						  FOLD_MULTS(bits))
+#  define MULTS_8V		MULTS(2048)
+#  define MULTS_4V		MULTS(1024)
+#  define MULTS_2V		MULTS(512)
+#  define MULTS_1V		MULTS(256)
 #elif VL == 64
 #  define vec_t			__m512i
 #  define fold_vec		fold_vec512
 #  define VLOADU(p)		_mm512_loadu_si512((const void *)(p))
 #  define VXOR(a, b)		_mm512_xor_si512((a), (b))
 #  define M128I_TO_VEC(a)	_mm512_zextsi128_si512(a)
-#  define MULTS(a, b)		_mm512_set_epi64(a, b, a, b, a, b, a, b)
-#  define MULTS_8V		MULTS(CRC32_X4063_MODG, CRC32_X4127_MODG)
-#  define MULTS_4V		MULTS(CRC32_X2015_MODG, CRC32_X2079_MODG)
-#  define MULTS_2V		MULTS(CRC32_X991_MODG, CRC32_X1055_MODG)
-#  define MULTS_1V		MULTS(CRC32_X479_MODG, CRC32_X543_MODG)
+#  define MULTS(bits)		_mm512_set_epi64(FOLD_MULTS(bits), \
+						 FOLD_MULTS(bits), \
+						 FOLD_MULTS(bits), \
+						 FOLD_MULTS(bits))
+#  define MULTS_8V		MULTS(4096)
+#  define MULTS_4V		MULTS(2048)
+#  define MULTS_2V		MULTS(1024)
+#  define MULTS_1V		MULTS(512)
 #else
 #  error "unsupported vector length"
 #endif
@@ -180,27 +226,32 @@ ADD_SUFFIX(fold_lessthan16bytes)(__m128i x, const u8 *p, size_t len,
 }
 #define fold_lessthan16bytes	ADD_SUFFIX(fold_lessthan16bytes)
 
-static ATTRIBUTES u32
-ADD_SUFFIX(crc32_x86)(u32 crc, const u8 *p, size_t len)
+static ATTRIBUTES crc_t
+ADD_SUFFIX(CRC_FUNC)(crc_t crc, const u8 *p, size_t len)
 {
 	/*
 	 * mults_{N}v are the vectors of multipliers for folding across N vec_t
 	 * vectors, i.e. N*VL*8 bits.  mults_128b are the two multipliers for
 	 * folding across 128 bits.  mults_128b differs from mults_1v when
 	 * VL != 16.  All multipliers are 64-bit, to match what pclmulqdq needs,
-	 * but since this is for CRC-32 only their low 32 bits are nonzero.
-	 * For more details, see scripts/gen-crc32-consts.py.
+	 * but for a 32-bit CRC only their low 32 bits are nonzero.  For more
+	 * details, see scripts/gen-crc32-consts.py.
 	 */
 	const vec_t mults_8v = MULTS_8V;
 	const vec_t mults_4v = MULTS_4V;
 	const vec_t mults_2v = MULTS_2V;
 	const vec_t mults_1v = MULTS_1V;
-	const __m128i mults_128b = _mm_set_epi64x(CRC32_X95_MODG, CRC32_X159_MODG);
+	const __m128i mults_128b = _mm_set_epi64x(FOLD_MULTS(128));
 	const __m128i barrett_reduction_constants =
-		_mm_set_epi64x(CRC32_BARRETT_CONSTANT_2, CRC32_BARRETT_CONSTANT_1);
+		_mm_set_epi64x(CRC_CONST(BARRETT_CONSTANT_2),
+			       CRC_CONST(BARRETT_CONSTANT_1));
+#if CRC_BITS == 32
 	const __m128i mask32 = _mm_set_epi32(0, 0xFFFFFFFF, 0, 0);
-	vec_t v0, v1, v2, v3, v4, v5, v6, v7;
 	__m128i x0 = _mm_cvtsi32_si128(crc);
+#else
+	__m128i x0 = _mm_set_epi64x(0, crc);
+#endif
+	vec_t v0, v1, v2, v3, v4, v5, v6, v7;
 	__m128i x1;
 
 	if (len < 8*VL) {
@@ -208,16 +259,17 @@ ADD_SUFFIX(crc32_x86)(u32 crc, const u8 *p, size_t len)
 			STATIC_ASSERT(VL == 16 || VL == 32 || VL == 64);
 			if (len < 16) {
 			#if USE_AVX512
-				if (len < 4)
-					return crc32_slice1(crc, p, len);
+				if (len < CRC_BITS / 8)
+					return CRC_SLICE1(crc, p, len);
 				/*
-				 * Handle 4 <= len <= 15 bytes by doing a masked
-				 * load, XOR'ing the current CRC with the first
-				 * 4 bytes, left-shifting by '16 - len' bytes to
-				 * align the result to the end of x0 (so that it
-				 * becomes the low-order coefficients of a
-				 * 128-bit polynomial), and then doing the usual
-				 * reduction from 128 bits to 32 bits.
+				 * Handle CRC_BITS/8 <= len <= 15 bytes by doing
+				 * a masked load, XOR'ing the current CRC with
+				 * the first CRC_BITS/8 bytes, left-shifting by
+				 * '16 - len' bytes to align the result to the
+				 * end of x0 (so that it becomes the low-order
+				 * coefficients of a 128-bit polynomial), and
+				 * then doing the usual reduction from 128 bits
+				 * to CRC_BITS bits.
 				 */
 				x0 = _mm_xor_si128(
 					x0, _mm_maskz_loadu_epi8((1 << len) - 1, p));
@@ -225,7 +277,7 @@ ADD_SUFFIX(crc32_x86)(u32 crc, const u8 *p, size_t len)
 					x0, _mm_loadu_si128((const void *)&shift_tab[len]));
 				goto reduce_x0;
 			#else
-				return crc32_slice1(crc, p, len);
+				return CRC_SLICE1(crc, p, len);
 			#endif
 			}
 			/*
@@ -362,8 +414,7 @@ less_than_vl_remaining:
 		__m256i y0 = v0;
 	#else
 		const __m256i mults_256b =
-			_mm256_set_epi64x(CRC32_X223_MODG, CRC32_X287_MODG,
-					  CRC32_X223_MODG, CRC32_X287_MODG);
+			_mm256_set_epi64x(FOLD_MULTS(256), FOLD_MULTS(256));
 		__m256i y0 = fold_vec256(_mm512_extracti64x4_epi64(v0, 0),
 					 _mm512_extracti64x4_epi64(v0, 1),
 					 mults_256b);
@@ -411,15 +462,16 @@ reduce_x0:
 	 *	A_L := x^(64-n)*crc + A_L
 	 *	crc := floor((A_L * floor(x^(m+n) / G)) / x^m) * G mod x^n
 	 *
-	 * For the gzip crc, n = 32 and the bit order is LSB (least significant
-	 * bit) first.  'm' must be an integer >= 63 (the max degree of A_L and
-	 * A_H) for sufficient precision to be carried through the calculation.
-	 * As the gzip crc is LSB-first we use m == 63, which results in
+	 * Here n = CRC_BITS and the bit order is LSB (least significant bit)
+	 * first.  'm' must be an integer >= 63 (the max degree of A_L and A_H)
+	 * for sufficient precision to be carried through the calculation.  As
+	 * the CRC is LSB-first we use m == 63, which results in
 	 * floor(x^(m+n) / G) being 64-bit which is the most pclmulqdq can
 	 * accept.  The multiplication with floor(x^(63+n) / G) then produces a
 	 * 127-bit product, and the floored division by x^63 just takes the
 	 * first qword.
 	 */
+#if CRC_BITS == 32
 
 	/* tmp := floor((A_H * floor(x^(63+n) / G)) / x^63) */
 	x1 = _mm_clmulepi64_si128(x0, barrett_reduction_constants, 0x00);
@@ -448,6 +500,43 @@ reduce_x0:
 
 	/* Extract the CRC from bits [64:64+n) of x0. */
 	return _mm_extract_epi32(x0, 2);
+#else /* CRC_BITS == 64 */
+	/*
+	 * With n = 64, G has 65 coefficients, one more than pclmulqdq can take.
+	 * But G = x*G' + x^64 + 1, and x^64 vanishes mod x^64, so the
+	 * multiplication by G is done as tmp*G' (which comes out multiplied by
+	 * x, as the products of LSB-first polynomials always do) plus tmp.
+	 */
+
+	/* tmp := floor((A_H * floor(x^(63+n) / G)) / x^63) */
+	x1 = _mm_clmulepi64_si128(x0, barrett_reduction_constants, 0x00);
+	/* tmp is in bits [0:64) of x1. */
+
+	/* crc := tmp * G mod x^n */
+	x1 = _mm_xor_si128(
+		_mm_clmulepi64_si128(x1, barrett_reduction_constants, 0x10),
+		_mm_slli_si128(x1, 8));
+	/* crc is in bits [64:128) of x1. */
+
+	/*
+	 * A_L := crc + A_L
+	 * Bits [0:64) of x0 are no longer needed, so no mask is needed.
+	 */
+	x0 = _mm_xor_si128(x0, x1);
+
+	/*
+	 * crc := floor((A_L * floor(x^(m+n) / G)) / x^m) * G mod x^n
+	 * Same as previous but uses the low-order 64 coefficients of A.
+	 */
+	x1 = _mm_clmulepi64_si128(x0, barrett_reduction_constants, 0x01);
+	x0 = _mm_xor_si128(
+		_mm_clmulepi64_si128(x1, barrett_reduction_constants, 0x10),
+		_mm_slli_si128(x1, 8));
+
+	/* Extract the CRC from bits [64:128) of x0. */
+	return ((u64)(u32)_mm_extract_epi32(x0, 3) << 32) |
+	       (u32)_mm_extract_epi32(x0, 2);
+#endif
 }
 
 #undef vec_t
@@ -460,6 +549,8 @@ reduce_x0:
 #undef MULTS_4V
 #undef MULTS_2V
 #undef MULTS_1V
+#undef FOLD_MULTS
+#undef crc_t
 
 #undef SUFFIX
 #undef ATTRIBUTES
@@ -18,6 +18,7 @@
 #if defined(__GNUC__) || defined(__clang__) || MSVC_PREREQ(1930)
 #  define deflate_decompress_bmi2	deflate_decompress_bmi2
 #  define FUNCNAME			deflate_decompress_bmi2
+#  define STREAM_FUNCNAME		deflate_decompress_stream_bmi2
 #  define ATTRIBUTES			_target_attribute("bmi2")
    /*
     * Even with __attribute__((target("bmi2"))), gcc doesn't reliably use the
@@ -39,19 +40,203 @@
 #  include "../decompress_template.h"
 #endif
 
-#if defined(deflate_decompress_bmi2) && HAVE_BMI2_NATIVE
-#define DEFAULT_IMPL	deflate_decompress_bmi2
+/*
+ * BMI2 + AVX2 optimized decompression function.  This is the same as the BMI2
+ * one, except that the fastloop copies matches with copy_match_avx2().
+ */
+#if defined(__GNUC__) || defined(__clang__) || MSVC_PREREQ(1930)
+
+#  include "../copy_match_tables.h"
+
+/*
+ * Copy the match that ends at @end from @src = @dst - @offset to @dst, writing
+ * up to 31 bytes past @end.  Offsets of 32 or more get 32-byte moves and
+ * offsets of 16 to 31 get 16-byte moves, which never read bytes that the same
+ * move writes.  Smaller offsets, i.e. short repeating patterns such as runs of
+ * the same byte, are replicated into a full vector by a shuffle, which is then
+ * stored repeatedly without any further loads.
+ */
+static forceinline _target_attribute("avx2") void
+copy_match_avx2(u8 *dst, const u8 *src, u32 offset, const u8 *end)
+{
+	if (offset >= 32) {
+		do {
+			_mm256_storeu_si256((__m256i *)dst,
+				_mm256_loadu_si256((const __m256i *)src));
+			src += 32;
+			dst += 32;
+		} while (dst < end);
+	} else if (offset >= 16) {
+		do {
+			_mm_storeu_si128((__m128i *)dst,
+				_mm_loadu_si128((const __m128i *)src));
+			src += 16;
+			dst += 16;
+		} while (dst < end);
+	} else {
+		const __m256i v = _mm256_shuffle_epi8(
+			_mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)src)),
+			_mm256_load_si256(
+				(const __m256i *)copy_match_shufs[offset]));
+		const u32 advance = copy_match_advances[offset];
+
+		do {
+			_mm256_storeu_si256((__m256i *)dst, v);
+			dst += advance;
+		} while (dst < end);
+	}
+}
+
+/*
+ * AVX2 version of build_literal_pairs(), which does 8 entries at a time and
+ * loads the entries for their second codewords with a gather.  Entries at index
+ * 8 and above only refer to entries below their group of 8, which haven't been
+ * changed yet since the groups are processed in descending order.
+ */
+static _target_attribute("avx2") void
+build_literal_pairs_avx2(u32 decode_table[], unsigned table_bits)
+{
+	const __m256i lenmask = _mm256_set1_epi32(0xF);
+	const __m256i literal = _mm256_set1_epi32(HUFFDEC_LITERAL);
+	const __m256i lit_hi_mask = _mm256_set1_epi32(0x007F0000);
+	const __m256i pair_flag = _mm256_set1_epi32(HUFFDEC_2LITERALS);
+	const __m256i max_len_plus_1 = _mm256_set1_epi32(table_bits + 1);
+	__m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	unsigned i = 1U << table_bits;
+
+	if (i < 16) {
+		build_literal_pairs_below(decode_table, table_bits, i);
+		return;
+	}
+	idx = _mm256_add_epi32(idx, _mm256_set1_epi32(i));
+	do {
+		__m256i entry, entry2, len, len2, both_literals, fits, add;
+
+		i -= 8;
+		idx = _mm256_sub_epi32(idx, _mm256_set1_epi32(8));
+		entry = _mm256_loadu_si256((const __m256i *)&decode_table[i]);
+		len = _mm256_and_si256(entry, lenmask);
+		entry2 = _mm256_i32gather_epi32((const int *)decode_table,
+						_mm256_srlv_epi32(idx, len), 4);
+		len2 = _mm256_and_si256(entry2, lenmask);
+
+		both_literals = _mm256_andnot_si256(
+			_mm256_slli_epi32(entry2, 8),
+			_mm256_and_si256(_mm256_and_si256(entry, entry2),
+					 literal));
+		both_literals = _mm256_cmpeq_epi32(both_literals, literal);
+		fits = _mm256_cmpgt_epi32(max_len_plus_1,
+					  _mm256_add_epi32(len, len2));
+		add = _mm256_add_epi32(
+			_mm256_add_epi32(len2, pair_flag),
+			_mm256_slli_epi32(_mm256_and_si256(entry2,
+							   lit_hi_mask), 8));
+		add = _mm256_and_si256(add,
+				       _mm256_and_si256(both_literals, fits));
+		_mm256_storeu_si256((__m256i *)&decode_table[i],
+				    _mm256_add_epi32(entry, add));
+	} while (i > 8);
+	build_literal_pairs_below(decode_table, table_bits, 8);
+}
+
+/*
+ * AVX2 version of sort_syms(), for the litlen code.  Rather than scattering the
+ * symbols through 'offsets[]', which makes each store depend on the previous
+ * one with the same length, it makes a bitmask of the symbols with each length
+ * and appends their indices in order.  It reads @lens in 32-byte vectors, so
+ * the array must be readable up to @num_syms rounded up to a multiple of 32;
+ * d->u.l.lens is, since the offset codeword lengths follow the litlen ones.
+ */
+static _target_attribute("avx2") u16 *
+sort_syms_avx2(const u8 lens[], unsigned num_syms, unsigned len_counts[],
+	       u16 sorted_syms[])
+{
+	unsigned pos = 0;
+	unsigned len, i;
+
+	for (len = 1; len <= DEFLATE_MAX_CODEWORD_LEN; len++) {
+		const __m256i v_len = _mm256_set1_epi8(len);
+		unsigned start = pos;
+
+		for (i = 0; i < num_syms; i += 32) {
+			u32 bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *)&lens[i]),
+				v_len));
+
+			if (num_syms - i < 32)
+				bits &= ((u32)1 << (num_syms - i)) - 1;
+			while (bits) {
+				sorted_syms[pos++] = i + bsf32(bits);
+				bits &= bits - 1;
+			}
+		}
+		len_counts[len] = pos - start;
+	}
+	len_counts[0] = num_syms - pos;
+	return sorted_syms;
+}
+
+static const struct litlen_table_funcs avx2_litlen_table_funcs = {
+	.sort_syms = sort_syms_avx2,
+	.build_literal_pairs = build_literal_pairs_avx2,
+};
+
+#  define deflate_decompress_avx2	deflate_decompress_avx2
+#  define FUNCNAME			deflate_decompress_avx2
+#  define STREAM_FUNCNAME		deflate_decompress_stream_avx2
+#  define ATTRIBUTES			_target_attribute("bmi2,avx2")
+#  define COPY_MATCH			copy_match_avx2
+#  define LITLEN_TABLE_FUNCS		(&avx2_litlen_table_funcs)
+#  ifndef __clang__
+#    ifdef ARCH_X86_64
+#      define EXTRACT_VARBITS(word, count)  _bzhi_u64((word), (count))
+#      define EXTRACT_VARBITS8(word, count) _bzhi_u64((word), (count))
+#    else
+#      define EXTRACT_VARBITS(word, count)  _bzhi_u32((word), (count))
+#      define EXTRACT_VARBITS8(word, count) _bzhi_u32((word), (count))
+#    endif
+#  endif
+#  include "../decompress_template.h"
+#endif
+
+#if defined(deflate_decompress_avx2) && HAVE_AVX2_NATIVE && HAVE_BMI2_NATIVE
+#define DEFAULT_IMPL		deflate_decompress_avx2
+#define DEFAULT_STREAM_IMPL	deflate_decompress_stream_avx2
 #else
 static inline decompress_func_t
 arch_select_decompress_func(void)
 {
+	const u32 features MAYBE_UNUSED = get_x86_cpu_features();
+
+#ifdef deflate_decompress_avx2
+	if (HAVE_AVX2(features) && HAVE_BMI2(features))
+		return deflate_decompress_avx2;
+#endif
 #ifdef deflate_decompress_bmi2
-	if (HAVE_BMI2(get_x86_cpu_features()))
+	if (HAVE_BMI2(features))
 		return deflate_decompress_bmi2;
 #endif
 	return NULL;
 }
 #define arch_select_decompress_func	arch_select_decompress_func
+
+static inline decompress_stream_func_t
+arch_select_decompress_stream_func(void)
+{
+	const u32 features MAYBE_UNUSED = get_x86_cpu_features();
+
+#ifdef deflate_decompress_avx2
+	if (HAVE_AVX2(features) && HAVE_BMI2(features))
+		return deflate_decompress_stream_avx2;
+#endif
+#ifdef deflate_decompress_bmi2
+	if (HAVE_BMI2(features))
+		return deflate_decompress_stream_bmi2;
+#endif
+	return NULL;
+}
+#define arch_select_decompress_stream_func	arch_select_decompress_stream_func
 #endif
 
 #endif /* LIB_X86_DECOMPRESS_IMPL_H */
@@ -30,7 +30,51 @@
 
 #include "cpu_features.h"
 
-#ifdef __AVX2__
+#ifdef __AVX512BW__
+static forceinline void
+matchfinder_init_avx512(mf_pos_t *data, size_t size)
+{
+	__m512i *p = (__m512i *)data;
+	__m512i v = _mm512_set1_epi16(MATCHFINDER_INITVAL);
+
+	STATIC_ASSERT(MATCHFINDER_MEM_ALIGNMENT % sizeof(*p) == 0);
+	STATIC_ASSERT(MATCHFINDER_SIZE_ALIGNMENT % (4 * sizeof(*p)) == 0);
+	STATIC_ASSERT(sizeof(mf_pos_t) == 2);
+
+	do {
+		p[0] = v;
+		p[1] = v;
+		p[2] = v;
+		p[3] = v;
+		p += 4;
+		size -= 4 * sizeof(*p);
+	} while (size != 0);
+}
+#define matchfinder_init matchfinder_init_avx512
+
+static forceinline void
+matchfinder_rebase_avx512(mf_pos_t *data, size_t size)
+{
+	__m512i *p = (__m512i *)data;
+	__m512i v = _mm512_set1_epi16((u16)-MATCHFINDER_WINDOW_SIZE);
+
+	STATIC_ASSERT(MATCHFINDER_MEM_ALIGNMENT % sizeof(*p) == 0);
+	STATIC_ASSERT(MATCHFINDER_SIZE_ALIGNMENT % (4 * sizeof(*p)) == 0);
+	STATIC_ASSERT(sizeof(mf_pos_t) == 2);
+
+	do {
+		/* VPADDSW: Add Packed Signed Integers With Signed Saturation  */
+		p[0] = _mm512_adds_epi16(p[0], v);
+		p[1] = _mm512_adds_epi16(p[1], v);
+		p[2] = _mm512_adds_epi16(p[2], v);
+		p[3] = _mm512_adds_epi16(p[3], v);
+		p += 4;
+		size -= 4 * sizeof(*p);
+	} while (size != 0);
+}
+#define matchfinder_rebase matchfinder_rebase_avx512
+
+#elif defined(__AVX2__)
 static forceinline void
 matchfinder_init_avx2(mf_pos_t *data, size_t size)
 {
@@ -119,4 +163,53 @@ matchfinder_rebase_sse2(mf_pos_t *data, size_t size)
 #define matchfinder_rebase matchfinder_rebase_sse2
 #endif /* HAVE_SSE2_NATIVE */
 
+#if HAVE_SSE2_NATIVE
+/*
+ * lz_extend() that compares 16 bytes at a time, or 32 bytes at a time if AVX2
+ * is enabled at compile time, and finds the first mismatch from the byte
+ * comparison mask.  Once fewer than 16 bytes remain, the last 16 bytes before
+ * @max_len are compared instead, overlapping bytes already known to match, so
+ * no bytewise loop is needed unless @max_len itself is less than 16.
+ */
+static forceinline unsigned
+lz_extend_sse2(const u8 * const strptr, const u8 * const matchptr,
+	       const unsigned start_len, const unsigned max_len)
+{
+	unsigned len = start_len;
+	u32 mask;
+
+#ifdef __AVX2__
+	while (len + 32 <= max_len) {
+		mask = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)&strptr[len]),
+			_mm256_loadu_si256((const __m256i *)&matchptr[len])));
+		if (mask != 0)
+			return len + bsf32(mask);
+		len += 32;
+	}
+#endif
+	while (len + 16 <= max_len) {
+		mask = 0xFFFF ^ (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)&strptr[len]),
+			_mm_loadu_si128((const __m128i *)&matchptr[len])));
+		if (mask != 0)
+			return len + bsf32(mask);
+		len += 16;
+	}
+	if (len < max_len) {
+		if (max_len >= 16) {
+			len = max_len - 16;
+			mask = 0xFFFF ^ (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *)&strptr[len]),
+				_mm_loadu_si128((const __m128i *)&matchptr[len])));
+			return (mask != 0) ? len + bsf32(mask) : max_len;
+		}
+		while (len < max_len && matchptr[len] == strptr[len])
+			len++;
+	}
+	return len;
+}
+#define lz_extend lz_extend_sse2
+#endif /* HAVE_SSE2_NATIVE */
+
 #endif /* LIB_X86_MATCHFINDER_IMPL_H */
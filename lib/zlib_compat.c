@@ -0,0 +1,1002 @@
+/*
+ * zlib_compat.c - zlib's API, implemented with libdeflate
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * This file is built only into the separate zlib compatibility library, which
+ * programs written for zlib can be relinked against, or which can be loaded
+ * with LD_PRELOAD, to use libdeflate instead.  It's compiled against the
+ * system's <zlib.h>, so that the types and constants match the zlib ABI that
+ * the programs were built for.
+ *
+ * The streaming functions are built on libdeflate's streaming compression and
+ * decompression.  Supported are deflateInit(), deflateInit2(), deflate() with
+ * all flush modes, deflateReset(), deflateEnd(), deflateBound(), inflateInit(),
+ * inflateInit2() including automatic zlib/gzip detection, inflate(),
+ * inflateReset(), inflateReset2(), inflateEnd(), and the one-shot and checksum
+ * functions.  Preset dictionaries and the other functions that take a z_stream
+ * return Z_STREAM_ERROR rather than being left undefined, so that with
+ * LD_PRELOAD the real zlib never sees a stream whose state belongs to this
+ * library.  The z_stream's zalloc and zfree are ignored.
+ *
+ * Compression levels 10-14 are accepted in addition to zlib's 0-9.  Setting
+ * the environment variable LIBDEFLATE_ZLIB_LEVEL to a level from 1 to 14
+ * overrides every nonzero level requested, e.g. to use the near-optimal levels
+ * in programs that can't be changed.
+ */
+
+#include "lib_common.h"
+#include "libdeflate.h"
+#include "gzip_constants.h"
+#include "zlib_constants.h"
+
+#include <stdlib.h>
+#include <zlib.h>
+
+#define ZLIBAPI		LIBDEFLATEAPI
+
+/* The amount of input that deflate() gives to the compressor at a time */
+#define DEFLATE_CHUNK_LENGTH	65536
+
+/* The largest zlib or gzip header and footer that deflate() writes */
+#define MAX_WRAPPER_NBYTES	(GZIP_MIN_HEADER_SIZE + GZIP_FOOTER_SIZE)
+
+enum zcompat_wrap {
+	WRAP_RAW,
+	WRAP_ZLIB,
+	WRAP_GZIP,
+	WRAP_AUTO,	/* inflate only: zlib or gzip, whichever is found */
+};
+
+/*
+ * Decode the 'windowBits' argument of deflateInit2() and inflateInit2() into
+ * the wrapper format.  Return -1 if it's invalid.
+ */
+static int
+zcompat_get_wrap(int window_bits, bool inflating)
+{
+	if (window_bits >= -15 && window_bits <= -8)
+		return WRAP_RAW;
+	if ((window_bits >= 8 && window_bits <= 15) ||
+	    (inflating && window_bits == 0))
+		return WRAP_ZLIB;
+	if (window_bits >= 16 + 8 && window_bits <= 16 + 15)
+		return WRAP_GZIP;
+	if (inflating && window_bits >= 32 + 8 && window_bits <= 32 + 15)
+		return WRAP_AUTO;
+	return -1;
+}
+
+static bool
+zcompat_check_version(const char *version, int stream_size)
+{
+	return version != NULL && version[0] == ZLIB_VERSION[0] &&
+	       stream_size == (int)sizeof(z_stream);
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                 Compression                                */
+/* -------------------------------------------------------------------------- */
+
+struct zcompat_deflate_state {
+	struct libdeflate_compressor *c;
+	int level;
+	int wrap;
+	int window_bits;
+
+	/* Checksum of the uncompressed data so far, and its size mod 2^32 */
+	u32 checksum;
+	u32 isize;
+
+	/* Whether the header has been written and the stream ended */
+	bool header_written;
+	bool finished;
+
+	/* Whether there has been input since the last flush */
+	bool need_flush;
+
+	/*
+	 * Output that didn't fit in the caller's buffer yet.  'pending_pos' is
+	 * how much of it has been copied out.
+	 */
+	u8 *pending;
+	size_t pending_nbytes;
+	size_t pending_pos;
+	size_t pending_capacity;
+};
+
+/* Map a zlib compression level to a libdeflate one.  Return -1 if invalid. */
+static int
+zcompat_get_level(int level)
+{
+	const char *env;
+
+	if (level == Z_DEFAULT_COMPRESSION)
+		level = 6;
+	if (level < 0 || level > 14)
+		return -1;
+	env = getenv("LIBDEFLATE_ZLIB_LEVEL");
+	if (level != 0 && env != NULL && atoi(env) >= 1 && atoi(env) <= 14)
+		level = atoi(env);
+	return level;
+}
+
+static enum libdeflate_strategy
+zcompat_get_strategy(int strategy)
+{
+	switch (strategy) {
+	case Z_HUFFMAN_ONLY:
+		return LIBDEFLATE_STRATEGY_HUFFMAN_ONLY;
+	case Z_RLE:
+		return LIBDEFLATE_STRATEGY_RLE;
+	default:
+		/* Z_FILTERED and Z_FIXED have no equivalent. */
+		return LIBDEFLATE_STRATEGY_DEFAULT;
+	}
+}
+
+static int
+zcompat_deflate_reset(struct zcompat_deflate_state *s, z_streamp strm)
+{
+	if (libdeflate_deflate_compress_stream_begin(s->c) != 0)
+		return Z_MEM_ERROR;
+	s->checksum = (s->wrap == WRAP_GZIP) ? libdeflate_crc32(0, NULL, 0) :
+					       libdeflate_adler32(1, NULL, 0);
+	s->isize = 0;
+	s->header_written = false;
+	s->finished = false;
+	s->need_flush = true;
+	s->pending_nbytes = 0;
+	s->pending_pos = 0;
+	strm->total_in = 0;
+	strm->total_out = 0;
+	strm->adler = s->checksum;
+	strm->msg = NULL;
+	return Z_OK;
+}
+
+ZLIBAPI int
+deflateInit2_(z_streamp strm, int level, int method, int windowBits,
+	      int memLevel, int strategy, const char *version, int stream_size)
+{
+	struct libdeflate_options options;
+	struct zcompat_deflate_state *s;
+	int wrap = zcompat_get_wrap(windowBits, false);
+	int ret;
+
+	if (!zcompat_check_version(version, stream_size))
+		return Z_VERSION_ERROR;
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+	strm->state = NULL;
+	level = zcompat_get_level(level);
+	if (level < 0 || method != Z_DEFLATED || wrap < 0 ||
+	    memLevel < 1 || memLevel > MAX_MEM_LEVEL ||
+	    strategy < 0 || strategy > Z_FIXED)
+		return Z_STREAM_ERROR;
+
+	s = malloc(sizeof(*s));
+	if (s == NULL)
+		return Z_MEM_ERROR;
+	memset(&options, 0, sizeof(options));
+	options.sizeof_options = sizeof(options);
+	options.strategy = zcompat_get_strategy(strategy);
+	/* Like zlib, use a 512-byte window when a 256-byte one is requested. */
+	s->window_bits = MAX(windowBits < 0 ? -windowBits : windowBits & 15, 9);
+	options.window_bits = s->window_bits;
+	s->c = libdeflate_alloc_compressor_ex(level, &options);
+	s->level = level;
+	s->wrap = wrap;
+	s->pending_capacity = libdeflate_deflate_compress_stream_bound(
+				s->c, DEFLATE_CHUNK_LENGTH) + MAX_WRAPPER_NBYTES;
+	s->pending = malloc(s->pending_capacity);
+	if (s->c == NULL || s->pending == NULL) {
+		ret = Z_MEM_ERROR;
+		goto err;
+	}
+	ret = zcompat_deflate_reset(s, strm);
+	if (ret != Z_OK)
+		goto err;
+	strm->state = (struct internal_state *)s;
+	return Z_OK;
+
+err:
+	libdeflate_free_compressor(s->c);
+	free(s->pending);
+	free(s);
+	return ret;
+}
+
+ZLIBAPI int
+deflateInit_(z_streamp strm, int level, const char *version, int stream_size)
+{
+	return deflateInit2_(strm, level, Z_DEFLATED, MAX_WBITS, 8,
+			     Z_DEFAULT_STRATEGY, version, stream_size);
+}
+
+static struct zcompat_deflate_state *
+zcompat_deflate_state(z_streamp strm)
+{
+	if (strm == NULL || strm->state == NULL)
+		return NULL;
+	return (struct zcompat_deflate_state *)strm->state;
+}
+
+ZLIBAPI int
+deflateReset(z_streamp strm)
+{
+	struct zcompat_deflate_state *s = zcompat_deflate_state(strm);
+
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	return zcompat_deflate_reset(s, strm);
+}
+
+ZLIBAPI int
+deflateEnd(z_streamp strm)
+{
+	struct zcompat_deflate_state *s = zcompat_deflate_state(strm);
+
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	libdeflate_free_compressor(s->c);
+	free(s->pending);
+	free(s);
+	strm->state = NULL;
+	return Z_OK;
+}
+
+/* Write the zlib or gzip header, if any, to 'out'.  Return its length. */
+static size_t
+zcompat_write_header(const struct zcompat_deflate_state *s, u8 *out)
+{
+	if (s->wrap == WRAP_ZLIB) {
+		unsigned level_hint;
+		u16 hdr;
+
+		if (s->level < 2)
+			level_hint = ZLIB_FASTEST_COMPRESSION;
+		else if (s->level < 6)
+			level_hint = ZLIB_FAST_COMPRESSION;
+		else if (s->level < 8)
+			level_hint = ZLIB_DEFAULT_COMPRESSION;
+		else
+			level_hint = ZLIB_SLOWEST_COMPRESSION;
+		hdr = (ZLIB_CM_DEFLATE << 8) |
+		      (ZLIB_CINFO(s->window_bits) << 12) | (level_hint << 6);
+		hdr |= 31 - (hdr % 31);
+		put_unaligned_be16(hdr, out);
+		return 2;
+	}
+	if (s->wrap == WRAP_GZIP) {
+		out[0] = GZIP_ID1;
+		out[1] = GZIP_ID2;
+		out[2] = GZIP_CM_DEFLATE;
+		out[3] = 0;
+		put_unaligned_le32(GZIP_MTIME_UNAVAILABLE, &out[4]);
+		out[8] = (s->level < 2) ? GZIP_XFL_FASTEST_COMPRESSION :
+			 (s->level >= 8) ? GZIP_XFL_SLOWEST_COMPRESSION : 0;
+		out[9] = GZIP_OS_UNKNOWN;
+		return GZIP_MIN_HEADER_SIZE;
+	}
+	return 0;
+}
+
+/* Write the zlib or gzip footer, if any, to 'out'.  Return its length. */
+static size_t
+zcompat_write_footer(const struct zcompat_deflate_state *s, u8 *out)
+{
+	if (s->wrap == WRAP_ZLIB) {
+		put_unaligned_be32(s->checksum, out);
+		return ZLIB_FOOTER_SIZE;
+	}
+	if (s->wrap == WRAP_GZIP) {
+		put_unaligned_le32(s->checksum, out);
+		put_unaligned_le32(s->isize, &out[4]);
+		return GZIP_FOOTER_SIZE;
+	}
+	return 0;
+}
+
+/* Copy as much pending output as fits to the caller's buffer. */
+static void
+zcompat_deflate_drain(struct zcompat_deflate_state *s, z_streamp strm)
+{
+	size_t n = MIN(s->pending_nbytes - s->pending_pos, strm->avail_out);
+
+	memcpy(strm->next_out, &s->pending[s->pending_pos], n);
+	strm->next_out += n;
+	strm->avail_out -= n;
+	strm->total_out += n;
+	s->pending_pos += n;
+	if (s->pending_pos == s->pending_nbytes) {
+		s->pending_nbytes = 0;
+		s->pending_pos = 0;
+	}
+}
+
+/*
+ * Do one step of compression, writing the output to the pending buffer, or
+ * straight to the caller's buffer if it's certain to fit.  Return false if
+ * there's nothing left to do for now.
+ */
+static bool
+zcompat_deflate_step(struct zcompat_deflate_state *s, z_streamp strm,
+		     int flush, enum libdeflate_result *res)
+{
+	size_t in_nbytes = MIN(strm->avail_in, DEFLATE_CHUNK_LENGTH);
+	size_t bound = libdeflate_deflate_compress_stream_bound(s->c, in_nbytes)
+		       + MAX_WRAPPER_NBYTES;
+	bool direct = (strm->avail_out >= bound);
+	u8 *out = direct ? strm->next_out : s->pending;
+	size_t out_nbytes = 0;
+	size_t n;
+
+	if (!s->header_written) {
+		out_nbytes += zcompat_write_header(s, out);
+		s->header_written = true;
+	}
+	if (in_nbytes != 0) {
+		*res = libdeflate_deflate_compress_stream_update(
+				s->c, strm->next_in, in_nbytes,
+				&out[out_nbytes], bound - out_nbytes, &n);
+		if (s->wrap == WRAP_GZIP)
+			s->checksum = libdeflate_crc32(s->checksum,
+						       strm->next_in,
+						       in_nbytes);
+		else if (s->wrap == WRAP_ZLIB)
+			s->checksum = libdeflate_adler32(s->checksum,
+							 strm->next_in,
+							 in_nbytes);
+		s->isize += in_nbytes;
+		strm->next_in += in_nbytes;
+		strm->avail_in -= in_nbytes;
+		strm->total_in += in_nbytes;
+		s->need_flush = true;
+	} else if (flush == Z_FINISH) {
+		*res = libdeflate_deflate_compress_stream_finish(
+				s->c, &out[out_nbytes], bound - out_nbytes,
+				&n);
+		out_nbytes += n;
+		n = zcompat_write_footer(s, &out[out_nbytes]);
+		s->finished = true;
+	} else if (flush != Z_NO_FLUSH && s->need_flush) {
+		*res = libdeflate_deflate_compress_stream_flush(
+				s->c, flush == Z_FULL_FLUSH,
+				&out[out_nbytes], bound - out_nbytes, &n);
+		s->need_flush = false;
+	} else {
+		if (out_nbytes == 0)
+			return false;
+		n = 0;
+	}
+	out_nbytes += n;
+	if (direct) {
+		strm->next_out += out_nbytes;
+		strm->avail_out -= out_nbytes;
+		strm->total_out += out_nbytes;
+	} else {
+		s->pending_nbytes = out_nbytes;
+	}
+	return true;
+}
+
+ZLIBAPI int
+deflate(z_streamp strm, int flush)
+{
+	struct zcompat_deflate_state *s = zcompat_deflate_state(strm);
+	enum libdeflate_result res = LIBDEFLATE_SUCCESS;
+	uLong prev_total_in, prev_total_out;
+
+	if (s == NULL || flush < Z_NO_FLUSH || flush > Z_TREES ||
+	    strm->next_out == NULL ||
+	    (strm->next_in == NULL && strm->avail_in != 0))
+		return Z_STREAM_ERROR;
+	if (s->finished && flush != Z_FINISH) {
+		strm->msg = (char *)"stream error";
+		return Z_STREAM_ERROR;
+	}
+	if (strm->avail_out == 0) {
+		strm->msg = (char *)"buffer error";
+		return Z_BUF_ERROR;
+	}
+	prev_total_in = strm->total_in;
+	prev_total_out = strm->total_out;
+
+	for (;;) {
+		if (s->pending_nbytes != 0) {
+			zcompat_deflate_drain(s, strm);
+			if (s->pending_nbytes != 0)
+				break;
+		}
+		if (s->finished)
+			break;
+		if (!zcompat_deflate_step(s, strm, flush, &res))
+			break;
+		if (res != LIBDEFLATE_SUCCESS) {
+			/* Can't happen, since the output space is the bound. */
+			strm->msg = (char *)"internal error";
+			return Z_STREAM_ERROR;
+		}
+	}
+	strm->adler = s->checksum;
+
+	if (s->finished && s->pending_nbytes == 0)
+		return Z_STREAM_END;
+	if (strm->total_in == prev_total_in &&
+	    strm->total_out == prev_total_out)
+		return Z_BUF_ERROR;
+	return Z_OK;
+}
+
+ZLIBAPI uLong
+deflateBound(z_streamp strm, uLong sourceLen)
+{
+	struct zcompat_deflate_state *s = zcompat_deflate_state(strm);
+
+	return libdeflate_deflate_compress_stream_bound(s ? s->c : NULL,
+							sourceLen) +
+	       MAX_WRAPPER_NBYTES;
+}
+
+ZLIBAPI int
+compress2(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen,
+	  int level)
+{
+	struct libdeflate_compressor *c;
+	size_t n;
+
+	level = zcompat_get_level(level);
+	if (level < 0)
+		return Z_STREAM_ERROR;
+	c = libdeflate_alloc_compressor(level);
+	if (c == NULL)
+		return Z_MEM_ERROR;
+	n = libdeflate_zlib_compress(c, source, sourceLen, dest, *destLen);
+	libdeflate_free_compressor(c);
+	if (n == 0)
+		return Z_BUF_ERROR;
+	*destLen = n;
+	return Z_OK;
+}
+
+ZLIBAPI int
+compress(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen)
+{
+	return compress2(dest, destLen, source, sourceLen,
+			 Z_DEFAULT_COMPRESSION);
+}
+
+ZLIBAPI uLong
+compressBound(uLong sourceLen)
+{
+	return libdeflate_zlib_compress_bound(NULL, sourceLen);
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                Decompression                               */
+/* -------------------------------------------------------------------------- */
+
+enum zcompat_inflate_mode {
+	MODE_HEADER,
+	MODE_GZIP_EXTRA_LEN,
+	MODE_GZIP_EXTRA,
+	MODE_GZIP_NAME,
+	MODE_GZIP_COMMENT,
+	MODE_GZIP_HCRC,
+	MODE_DATA,
+	MODE_FOOTER,
+	MODE_DONE,
+	MODE_ERROR,
+};
+
+struct zcompat_inflate_state {
+	struct libdeflate_decompressor *d;
+	int wrap;
+	enum zcompat_inflate_mode mode;
+
+	/* The header or footer bytes read so far, and how many */
+	u8 buf[GZIP_MIN_HEADER_SIZE];
+	unsigned buf_nbytes;
+
+	/* The gzip header flags, and the bytes left to skip of FEXTRA */
+	u8 gzip_flags;
+	u32 extra_remaining;
+
+	/* Checksum of the uncompressed data so far, and its size mod 2^32 */
+	u32 checksum;
+	u32 isize;
+};
+
+static int
+zcompat_inflate_reset(struct zcompat_inflate_state *s, z_streamp strm)
+{
+	if (libdeflate_deflate_decompress_stream_begin(s->d) != 0)
+		return Z_MEM_ERROR;
+	s->mode = (s->wrap == WRAP_RAW) ? MODE_DATA : MODE_HEADER;
+	s->buf_nbytes = 0;
+	s->checksum = (s->wrap == WRAP_ZLIB) ? 1 : 0;
+	s->isize = 0;
+	strm->total_in = 0;
+	strm->total_out = 0;
+	strm->adler = s->checksum;
+	strm->msg = NULL;
+	return Z_OK;
+}
+
+ZLIBAPI int
+inflateInit2_(z_streamp strm, int windowBits, const char *version,
+	      int stream_size)
+{
+	struct zcompat_inflate_state *s;
+	int wrap = zcompat_get_wrap(windowBits, true);
+
+	if (!zcompat_check_version(version, stream_size))
+		return Z_VERSION_ERROR;
+	if (strm == NULL)
+		return Z_STREAM_ERROR;
+	strm->state = NULL;
+	if (wrap < 0)
+		return Z_STREAM_ERROR;
+
+	s = malloc(sizeof(*s));
+	if (s == NULL)
+		return Z_MEM_ERROR;
+	s->d = libdeflate_alloc_decompressor();
+	s->wrap = wrap;
+	if (s->d == NULL || zcompat_inflate_reset(s, strm) != Z_OK) {
+		libdeflate_free_decompressor(s->d);
+		free(s);
+		return Z_MEM_ERROR;
+	}
+	strm->state = (struct internal_state *)s;
+	return Z_OK;
+}
+
+ZLIBAPI int
+inflateInit_(z_streamp strm, const char *version, int stream_size)
+{
+	return inflateInit2_(strm, MAX_WBITS, version, stream_size);
+}
+
+static struct zcompat_inflate_state *
+zcompat_inflate_state(z_streamp strm)
+{
+	if (strm == NULL || strm->state == NULL)
+		return NULL;
+	return (struct zcompat_inflate_state *)strm->state;
+}
+
+ZLIBAPI int
+inflateReset(z_streamp strm)
+{
+	struct zcompat_inflate_state *s = zcompat_inflate_state(strm);
+
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	return zcompat_inflate_reset(s, strm);
+}
+
+ZLIBAPI int
+inflateReset2(z_streamp strm, int windowBits)
+{
+	struct zcompat_inflate_state *s = zcompat_inflate_state(strm);
+	int wrap = zcompat_get_wrap(windowBits, true);
+
+	if (s == NULL || wrap < 0)
+		return Z_STREAM_ERROR;
+	s->wrap = wrap;
+	return zcompat_inflate_reset(s, strm);
+}
+
+ZLIBAPI int
+inflateEnd(z_streamp strm)
+{
+	struct zcompat_inflate_state *s = zcompat_inflate_state(strm);
+
+	if (s == NULL)
+		return Z_STREAM_ERROR;
+	libdeflate_free_decompressor(s->d);
+	free(s);
+	strm->state = NULL;
+	return Z_OK;
+}
+
+static int
+zcompat_inflate_error(struct zcompat_inflate_state *s, z_streamp strm,
+		      const char *msg)
+{
+	s->mode = MODE_ERROR;
+	strm->msg = (char *)msg;
+	return Z_DATA_ERROR;
+}
+
+/* Consume one byte of input, which the caller made sure there is. */
+static u8
+zcompat_next_byte(z_streamp strm)
+{
+	strm->avail_in--;
+	strm->total_in++;
+	return *strm->next_in++;
+}
+
+/*
+ * Parse as much of the zlib or gzip header as is available.  Return Z_OK if
+ * there may be more to do, or an error code.
+ */
+static int
+zcompat_parse_header(struct zcompat_inflate_state *s, z_streamp strm)
+{
+	while (strm->avail_in != 0) {
+		u8 b;
+
+		switch (s->mode) {
+		case MODE_HEADER:
+			if (s->wrap == WRAP_AUTO)
+				s->wrap = (strm->next_in[0] == GZIP_ID1) ?
+					  WRAP_GZIP : WRAP_ZLIB;
+			s->buf[s->buf_nbytes++] = zcompat_next_byte(strm);
+			if (s->wrap == WRAP_ZLIB && s->buf_nbytes == 2) {
+				u16 hdr = get_unaligned_be16(s->buf);
+
+				if ((hdr >> 8) != ((ZLIB_CINFO_32K_WINDOW << 4) |
+						    ZLIB_CM_DEFLATE) &&
+				    ((hdr >> 8) & 0xF) != ZLIB_CM_DEFLATE)
+					return zcompat_inflate_error(
+						s, strm,
+						"unknown compression method");
+				if ((hdr >> 12) > ZLIB_CINFO_32K_WINDOW)
+					return zcompat_inflate_error(
+						s, strm, "invalid window size");
+				if (hdr % 31 != 0)
+					return zcompat_inflate_error(
+						s, strm, "incorrect header check");
+				if (hdr & (1 << 5))
+					return zcompat_inflate_error(
+						s, strm,
+						"preset dictionary not supported");
+				s->checksum = 1;
+				s->mode = MODE_DATA;
+				return Z_OK;
+			}
+			if (s->wrap == WRAP_GZIP &&
+			    s->buf_nbytes == GZIP_MIN_HEADER_SIZE) {
+				if (s->buf[0] != GZIP_ID1 ||
+				    s->buf[1] != GZIP_ID2)
+					return zcompat_inflate_error(
+						s, strm, "incorrect header check");
+				if (s->buf[2] != GZIP_CM_DEFLATE)
+					return zcompat_inflate_error(
+						s, strm,
+						"unknown compression method");
+				s->gzip_flags = s->buf[3];
+				if (s->gzip_flags & GZIP_FRESERVED)
+					return zcompat_inflate_error(
+						s, strm, "unknown header flags set");
+				s->buf_nbytes = 0;
+				s->mode = MODE_GZIP_EXTRA_LEN;
+				/* Skip the optional fields that aren't there. */
+				if (!(s->gzip_flags & GZIP_FEXTRA))
+					s->mode = MODE_GZIP_NAME;
+			}
+			break;
+		case MODE_GZIP_EXTRA_LEN:
+			s->buf[s->buf_nbytes++] = zcompat_next_byte(strm);
+			if (s->buf_nbytes == 2) {
+				s->extra_remaining = get_unaligned_le16(s->buf);
+				s->buf_nbytes = 0;
+				s->mode = MODE_GZIP_EXTRA;
+			}
+			break;
+		case MODE_GZIP_EXTRA:
+			if (s->extra_remaining != 0) {
+				zcompat_next_byte(strm);
+				s->extra_remaining--;
+			}
+			break;
+		case MODE_GZIP_NAME:
+			if (s->gzip_flags & GZIP_FNAME) {
+				b = zcompat_next_byte(strm);
+				if (b == 0)
+					s->gzip_flags &= ~GZIP_FNAME;
+			}
+			break;
+		case MODE_GZIP_COMMENT:
+			if (s->gzip_flags & GZIP_FCOMMENT) {
+				b = zcompat_next_byte(strm);
+				if (b == 0)
+					s->gzip_flags &= ~GZIP_FCOMMENT;
+			}
+			break;
+		case MODE_GZIP_HCRC:
+			if (s->gzip_flags & GZIP_FHCRC) {
+				zcompat_next_byte(strm);
+				if (++s->buf_nbytes == 2)
+					s->gzip_flags &= ~GZIP_FHCRC;
+			}
+			break;
+		default:
+			return Z_OK;
+		}
+		/* Move past the optional gzip fields that are done. */
+		if (s->mode == MODE_GZIP_EXTRA && s->extra_remaining == 0)
+			s->mode = MODE_GZIP_NAME;
+		if (s->mode == MODE_GZIP_NAME &&
+		    !(s->gzip_flags & GZIP_FNAME))
+			s->mode = MODE_GZIP_COMMENT;
+		if (s->mode == MODE_GZIP_COMMENT &&
+		    !(s->gzip_flags & GZIP_FCOMMENT))
+			s->mode = MODE_GZIP_HCRC;
+		if (s->mode == MODE_GZIP_HCRC && !(s->gzip_flags & GZIP_FHCRC)) {
+			s->checksum = 0;
+			s->mode = MODE_DATA;
+			return Z_OK;
+		}
+	}
+	return Z_OK;
+}
+
+/* Read and check as much of the footer as is available. */
+static int
+zcompat_parse_footer(struct zcompat_inflate_state *s, z_streamp strm)
+{
+	unsigned footer_nbytes = (s->wrap == WRAP_GZIP) ? GZIP_FOOTER_SIZE :
+							  ZLIB_FOOTER_SIZE;
+
+	while (strm->avail_in != 0 && s->buf_nbytes < footer_nbytes)
+		s->buf[s->buf_nbytes++] = zcompat_next_byte(strm);
+	if (s->buf_nbytes < footer_nbytes)
+		return Z_OK;
+	if (s->wrap == WRAP_GZIP) {
+		if (get_unaligned_le32(s->buf) != s->checksum)
+			return zcompat_inflate_error(s, strm,
+						     "incorrect data check");
+		if (get_unaligned_le32(&s->buf[4]) != s->isize)
+			return zcompat_inflate_error(s, strm,
+						     "incorrect length check");
+	} else if (get_unaligned_be32(s->buf) != s->checksum) {
+		return zcompat_inflate_error(s, strm, "incorrect data check");
+	}
+	s->mode = MODE_DONE;
+	return Z_OK;
+}
+
+ZLIBAPI int
+inflate(z_streamp strm, int flush)
+{
+	struct zcompat_inflate_state *s = zcompat_inflate_state(strm);
+	uLong prev_total_in, prev_total_out;
+	int ret = Z_OK;
+
+	if (s == NULL || strm->next_out == NULL ||
+	    (strm->next_in == NULL && strm->avail_in != 0))
+		return Z_STREAM_ERROR;
+	if (s->mode == MODE_ERROR)
+		return Z_DATA_ERROR;
+	prev_total_in = strm->total_in;
+	prev_total_out = strm->total_out;
+
+	if (s->mode < MODE_DATA)
+		ret = zcompat_parse_header(s, strm);
+
+	if (ret == Z_OK && s->mode == MODE_DATA) {
+		size_t actual_in, actual_out;
+		enum libdeflate_result res;
+
+		res = libdeflate_deflate_decompress_stream_update(
+				s->d, strm->next_in, strm->avail_in,
+				strm->next_out, strm->avail_out,
+				&actual_in, &actual_out);
+		if (s->wrap == WRAP_GZIP)
+			s->checksum = libdeflate_crc32(s->checksum,
+						       strm->next_out,
+						       actual_out);
+		else if (s->wrap == WRAP_ZLIB)
+			s->checksum = libdeflate_adler32(s->checksum,
+							 strm->next_out,
+							 actual_out);
+		s->isize += actual_out;
+		strm->next_in += actual_in;
+		strm->avail_in -= actual_in;
+		strm->total_in += actual_in;
+		strm->next_out += actual_out;
+		strm->avail_out -= actual_out;
+		strm->total_out += actual_out;
+		if (res == LIBDEFLATE_BAD_DATA) {
+			ret = zcompat_inflate_error(s, strm,
+						    "invalid deflate data");
+		} else if (res == LIBDEFLATE_SUCCESS) {
+			s->buf_nbytes = 0;
+			s->mode = (s->wrap == WRAP_RAW) ? MODE_DONE :
+							  MODE_FOOTER;
+		}
+	}
+
+	if (ret == Z_OK && s->mode == MODE_FOOTER)
+		ret = zcompat_parse_footer(s, strm);
+
+	strm->adler = s->checksum;
+	if (ret != Z_OK)
+		return ret;
+	if (s->mode == MODE_DONE)
+		return Z_STREAM_END;
+	if ((strm->total_in == prev_total_in &&
+	     strm->total_out == prev_total_out) || flush == Z_FINISH)
+		return Z_BUF_ERROR;
+	return Z_OK;
+}
+
+ZLIBAPI int
+uncompress2(Bytef *dest, uLongf *destLen, const Bytef *source,
+	    uLong *sourceLen)
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	size_t actual_in, actual_out;
+	enum libdeflate_result res;
+
+	if (d == NULL)
+		return Z_MEM_ERROR;
+	res = libdeflate_zlib_decompress_ex(d, source, *sourceLen, dest,
+					    *destLen, &actual_in, &actual_out);
+	libdeflate_free_decompressor(d);
+	if (res == LIBDEFLATE_INSUFFICIENT_SPACE)
+		return Z_BUF_ERROR;
+	if (res != LIBDEFLATE_SUCCESS)
+		return Z_DATA_ERROR;
+	*sourceLen = actual_in;
+	*destLen = actual_out;
+	return Z_OK;
+}
+
+ZLIBAPI int
+uncompress(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen)
+{
+	return uncompress2(dest, destLen, source, &sourceLen);
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                  Checksums                                 */
+/* -------------------------------------------------------------------------- */
+
+ZLIBAPI uLong
+adler32_z(uLong adler, const Bytef *buf, z_size_t len)
+{
+	return libdeflate_adler32(adler, buf, len);
+}
+
+ZLIBAPI uLong
+adler32(uLong adler, const Bytef *buf, uInt len)
+{
+	return libdeflate_adler32(adler, buf, len);
+}
+
+ZLIBAPI uLong
+crc32_z(uLong crc, const Bytef *buf, z_size_t len)
+{
+	return libdeflate_crc32(crc, buf, len);
+}
+
+ZLIBAPI uLong
+crc32(uLong crc, const Bytef *buf, uInt len)
+{
+	return libdeflate_crc32(crc, buf, len);
+}
+
+/* -------------------------------------------------------------------------- */
+/*                               Everything else                              */
+/* -------------------------------------------------------------------------- */
+
+ZLIBAPI const char *
+zlibVersion(void)
+{
+	return ZLIB_VERSION;
+}
+
+ZLIBAPI const char *
+zError(int err)
+{
+	switch (err) {
+	case Z_STREAM_END:
+		return "stream end";
+	case Z_OK:
+		return "";
+	case Z_NEED_DICT:
+		return "need dictionary";
+	case Z_ERRNO:
+		return "file error";
+	case Z_STREAM_ERROR:
+		return "stream error";
+	case Z_DATA_ERROR:
+		return "data error";
+	case Z_MEM_ERROR:
+		return "insufficient memory";
+	case Z_BUF_ERROR:
+		return "buffer error";
+	case Z_VERSION_ERROR:
+		return "incompatible version";
+	}
+	return "";
+}
+
+ZLIBAPI int
+deflateSetDictionary(z_streamp strm, const Bytef *dictionary, uInt dictLength)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+deflateParams(z_streamp strm, int level, int strategy)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+deflateCopy(z_streamp dest, z_streamp source)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+deflatePrime(z_streamp strm, int bits, int value)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+deflateSetHeader(z_streamp strm, gz_headerp head)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+inflateSetDictionary(z_streamp strm, const Bytef *dictionary, uInt dictLength)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+inflateSync(z_streamp strm)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+inflateCopy(z_streamp dest, z_streamp source)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+inflatePrime(z_streamp strm, int bits, int value)
+{
+	return Z_STREAM_ERROR;
+}
+
+ZLIBAPI int
+inflateGetHeader(z_streamp strm, gz_headerp head)
+{
+	return Z_STREAM_ERROR;
+}
@@ -28,22 +28,35 @@
 #include "deflate_compress.h"
 #include "zlib_constants.h"
 
-LIBDEFLATEAPI size_t
-libdeflate_zlib_compress(struct libdeflate_compressor *c,
-			 const void *in, size_t in_nbytes,
-			 void *out, size_t out_nbytes_avail)
+/*
+ * Compress the concatenation of the @iovcnt segments @iov to the zlib format.
+ * If @dict_nbytes isn't 0, then the preset dictionary @dict is used, in which
+ * case it may have been prepared as @pd, and there must be exactly one segment.
+ */
+static size_t
+zlib_compress(struct libdeflate_compressor *c,
+	      const void *dict, size_t dict_nbytes,
+	      const struct libdeflate_compression_dict *pd,
+	      const struct libdeflate_iovec *iov, size_t iovcnt,
+	      void *out, size_t out_nbytes_avail)
 {
 	u8 *out_next = out;
 	u16 hdr;
 	unsigned compression_level;
 	unsigned level_hint;
+	size_t overhead = ZLIB_MIN_OVERHEAD;
 	size_t deflate_size;
+	u32 adler = 1;
+	size_t i;
 
-	if (out_nbytes_avail <= ZLIB_MIN_OVERHEAD)
+	if (dict_nbytes)
+		overhead += ZLIB_DICTID_SIZE;
+	if (out_nbytes_avail <= overhead)
 		return 0;
 
 	/* 2 byte header: CMF and FLG  */
-	hdr = (ZLIB_CM_DEFLATE << 8) | (ZLIB_CINFO_32K_WINDOW << 12);
+	hdr = (ZLIB_CM_DEFLATE << 8) |
+	      (ZLIB_CINFO(libdeflate_get_compression_window_order(c)) << 12);
 	compression_level = libdeflate_get_compression_level(c);
 	if (compression_level < 2)
 		level_hint = ZLIB_FASTEST_COMPRESSION;
@@ -54,29 +67,113 @@ libdeflate_zlib_compress(struct libdeflate_compressor *c,
 	else
 		level_hint = ZLIB_SLOWEST_COMPRESSION;
 	hdr |= level_hint << 6;
+	if (dict_nbytes)
+		hdr |= ZLIB_FDICT;
 	hdr |= 31 - (hdr % 31);
 
 	put_unaligned_be16(hdr, out_next);
 	out_next += 2;
 
-	/* Compressed data  */
-	deflate_size = libdeflate_deflate_compress(c, in, in_nbytes, out_next,
-					out_nbytes_avail - ZLIB_MIN_OVERHEAD);
+	/* DICTID  */
+	if (dict_nbytes) {
+		put_unaligned_be32(libdeflate_adler32(1, dict, dict_nbytes),
+				   out_next);
+		out_next += 4;
+	}
+
+	/*
+	 * Compressed data.  With a single segment, its Adler-32 is computed
+	 * along the way, on each block while it is still in the cache.
+	 */
+	if (iovcnt == 1)
+		libdeflate_begin_input_checksum(c, libdeflate_adler32, 1,
+						iov->data);
+	if (pd)
+		deflate_size = libdeflate_deflate_compress_with_prepared_dict(
+				c, pd, iov->data, iov->nbytes, out_next,
+				out_nbytes_avail - overhead);
+	else if (dict_nbytes)
+		deflate_size = libdeflate_deflate_compress_with_dict(
+				c, dict, dict_nbytes, iov->data, iov->nbytes,
+				out_next, out_nbytes_avail - overhead);
+	else
+		deflate_size = libdeflate_deflate_compress_iov(
+				c, iov, iovcnt, out_next,
+				out_nbytes_avail - overhead);
+	if (iovcnt == 1)
+		adler = libdeflate_end_input_checksum(c, iov->data,
+						      deflate_size ?
+						      iov->nbytes : 0);
 	if (deflate_size == 0)
 		return 0;
 	out_next += deflate_size;
 
 	/* ADLER32  */
-	put_unaligned_be32(libdeflate_adler32(1, in, in_nbytes), out_next);
+	if (iovcnt != 1) {
+		for (i = 0; i < iovcnt; i++)
+			adler = libdeflate_adler32(adler, iov[i].data,
+						   iov[i].nbytes);
+	}
+	put_unaligned_be32(adler, out_next);
 	out_next += 4;
 
 	return out_next - (u8 *)out;
 }
 
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress(struct libdeflate_compressor *c,
+			 const void *in, size_t in_nbytes,
+			 void *out, size_t out_nbytes_avail)
+{
+	struct libdeflate_iovec iov = { in, in_nbytes };
+
+	return zlib_compress(c, NULL, 0, NULL, &iov, 1, out, out_nbytes_avail);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress_iov(struct libdeflate_compressor *c,
+			     const struct libdeflate_iovec *iov, size_t iovcnt,
+			     void *out, size_t out_nbytes_avail)
+{
+	return zlib_compress(c, NULL, 0, NULL, iov, iovcnt,
+			     out, out_nbytes_avail);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress_with_dict(struct libdeflate_compressor *c,
+				   const void *dict, size_t dict_nbytes,
+				   const void *in, size_t in_nbytes,
+				   void *out, size_t out_nbytes_avail)
+{
+	struct libdeflate_iovec iov = { in, in_nbytes };
+
+	return zlib_compress(c, dict, dict_nbytes, NULL, &iov, 1,
+			     out, out_nbytes_avail);
+}
+
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress_with_prepared_dict(
+			struct libdeflate_compressor *c,
+			const struct libdeflate_compression_dict *pd,
+			const void *in, size_t in_nbytes,
+			void *out, size_t out_nbytes_avail)
+{
+	struct libdeflate_iovec iov = { in, in_nbytes };
+	const void *dict;
+	size_t dict_nbytes;
+
+	libdeflate_get_compression_dict(pd, &dict, &dict_nbytes);
+	if (dict_nbytes == 0)
+		pd = NULL;
+	return zlib_compress(c, dict, dict_nbytes, pd, &iov, 1,
+			     out, out_nbytes_avail);
+}
+
 LIBDEFLATEAPI size_t
 libdeflate_zlib_compress_bound(struct libdeflate_compressor *c,
 			       size_t in_nbytes)
 {
-	return ZLIB_MIN_OVERHEAD +
+	/* This includes space for a DICTID, in case a dictionary is used. */
+	return ZLIB_MIN_OVERHEAD + ZLIB_DICTID_SIZE +
 	       libdeflate_deflate_compress_bound(c, in_nbytes);
 }
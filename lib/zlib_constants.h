@@ -12,6 +12,11 @@
 #define ZLIB_CM_DEFLATE		8
 
 #define ZLIB_CINFO_32K_WINDOW	7
+/* The CINFO value for a window of 2^window_order bytes */
+#define ZLIB_CINFO(window_order)	((window_order) - 8)
+
+#define ZLIB_FDICT		0x20
+#define ZLIB_DICTID_SIZE	4
 
 #define ZLIB_FASTEST_COMPRESSION	0
 #define ZLIB_FAST_COMPRESSION		1
@@ -28,12 +28,16 @@
 #include "lib_common.h"
 #include "zlib_constants.h"
 
-LIBDEFLATEAPI enum libdeflate_result
-libdeflate_zlib_decompress_ex(struct libdeflate_decompressor *d,
-			      const void *in, size_t in_nbytes,
-			      void *out, size_t out_nbytes_avail,
-			      size_t *actual_in_nbytes_ret,
-			      size_t *actual_out_nbytes_ret)
+/*
+ * Decompress a zlib stream.  If it was compressed with a preset dictionary,
+ * then the dictionary must be @dict, otherwise @dict is unused.
+ */
+static enum libdeflate_result
+zlib_decompress(struct libdeflate_decompressor *d,
+		const void *dict, size_t dict_nbytes,
+		const void *in, size_t in_nbytes,
+		void *out, size_t out_nbytes_avail,
+		size_t *actual_in_nbytes_ret, size_t *actual_out_nbytes_ret)
 {
 	const u8 *in_next = in;
 	const u8 * const in_end = in_next + in_nbytes;
@@ -61,17 +65,31 @@ libdeflate_zlib_decompress_ex(struct libdeflate_decompressor *d,
 	if ((hdr >> 12) > ZLIB_CINFO_32K_WINDOW)
 		return LIBDEFLATE_BAD_DATA;
 
-	/* FDICT */
-	if ((hdr >> 5) & 1)
-		return LIBDEFLATE_BAD_DATA;
+	/* FDICT, then DICTID if set */
+	if (hdr & ZLIB_FDICT) {
+		if (dict == NULL ||
+		    in_end - in_next < ZLIB_DICTID_SIZE + ZLIB_FOOTER_SIZE ||
+		    get_unaligned_be32(in_next) !=
+		    libdeflate_adler32(1, dict, dict_nbytes))
+			return LIBDEFLATE_BAD_DATA;
+		in_next += ZLIB_DICTID_SIZE;
+	} else {
+		dict_nbytes = 0;
+	}
 
-	/* Compressed data  */
-	result = libdeflate_deflate_decompress_ex(d, in_next,
+	/* Compressed data, with the Adler-32 computed along the way */
+	libdeflate_set_index_in_offset(d, in_next - (const u8 *)in);
+	libdeflate_begin_checksum(d, libdeflate_adler32, 1);
+	result = libdeflate_deflate_decompress_with_dict(d, dict, dict_nbytes,
+					in_next,
 					in_end - ZLIB_FOOTER_SIZE - in_next,
 					out, out_nbytes_avail,
 					&actual_in_nbytes, actual_out_nbytes_ret);
-	if (result != LIBDEFLATE_SUCCESS)
+	libdeflate_set_index_in_offset(d, 0);
+	if (result != LIBDEFLATE_SUCCESS) {
+		libdeflate_end_checksum(d, out, 0);
 		return result;
+	}
 
 	if (actual_out_nbytes_ret)
 		actual_out_nbytes = *actual_out_nbytes_ret;
@@ -81,7 +99,7 @@ libdeflate_zlib_decompress_ex(struct libdeflate_decompressor *d,
 	in_next += actual_in_nbytes;
 
 	/* ADLER32  */
-	if (libdeflate_adler32(1, out, actual_out_nbytes) !=
+	if (libdeflate_end_checksum(d, out, actual_out_nbytes) !=
 	    get_unaligned_be32(in_next))
 		return LIBDEFLATE_BAD_DATA;
 	in_next += 4;
@@ -92,6 +110,31 @@ libdeflate_zlib_decompress_ex(struct libdeflate_decompressor *d,
 	return LIBDEFLATE_SUCCESS;
 }
 
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_zlib_decompress_ex(struct libdeflate_decompressor *d,
+			      const void *in, size_t in_nbytes,
+			      void *out, size_t out_nbytes_avail,
+			      size_t *actual_in_nbytes_ret,
+			      size_t *actual_out_nbytes_ret)
+{
+	return zlib_decompress(d, NULL, 0, in, in_nbytes, out,
+			       out_nbytes_avail, actual_in_nbytes_ret,
+			       actual_out_nbytes_ret);
+}
+
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_zlib_decompress_with_dict(struct libdeflate_decompressor *d,
+				     const void *dict, size_t dict_nbytes,
+				     const void *in, size_t in_nbytes,
+				     void *out, size_t out_nbytes_avail,
+				     size_t *actual_in_nbytes_ret,
+				     size_t *actual_out_nbytes_ret)
+{
+	return zlib_decompress(d, dict, dict_nbytes, in, in_nbytes, out,
+			       out_nbytes_avail, actual_in_nbytes_ret,
+			       actual_out_nbytes_ret);
+}
+
 LIBDEFLATEAPI enum libdeflate_result
 libdeflate_zlib_decompress(struct libdeflate_decompressor *d,
 			   const void *in, size_t in_nbytes,
@@ -41,16 +41,24 @@ struct libdeflate_options;
  * libdeflate_alloc_compressor() allocates a new compressor that supports
  * DEFLATE, zlib, and gzip compression.  'compression_level' is the compression
  * level on a zlib-like scale but with a higher maximum value (1 = fastest, 6 =
- * medium/default, 9 = slow, 12 = slowest).  Level 0 is also supported and means
- * "no compression", specifically "create a valid stream, but only emit
- * uncompressed blocks" (this will expand the data slightly).
+ * medium/default, 9 = slow, 12 = slower, 14 = slowest).  Level 0 is also
+ * supported and means "no compression", specifically "create a valid stream,
+ * but only emit uncompressed blocks" (this will expand the data slightly).
+ *
+ * Levels 13 and 14 are for data that is compressed once and decompressed many
+ * times.  They optimize each block until its cost stops improving, and rather
+ * than ending blocks where a heuristic detects that the data changed, as the
+ * lower levels do, they search for the split into blocks that costs the least,
+ * over candidate points 4096 or 1024 bytes apart and where the heuristic would
+ * have ended blocks.  They are about 3 and 8 times slower than level 12, for
+ * output typically 0.1-0.5% smaller.
  *
  * The return value is a pointer to the new compressor, or NULL if out of memory
- * or if the compression level is invalid (i.e. outside the range [0, 12]).
+ * or if the compression level is invalid (i.e. outside the range [0, 14]).
  *
- * Note: for compression, the sliding window size is defined at compilation time
- * to 32768, the largest size permissible in the DEFLATE format.  It cannot be
- * changed at runtime.
+ * Note: for compression, the sliding window size defaults to 32768, the largest
+ * size permissible in the DEFLATE format.  A smaller one can be chosen with
+ * libdeflate_options::window_bits.
  *
  * A single compressor is not safe to use by multiple threads concurrently.
  * However, different threads may use different compressors concurrently.
@@ -59,12 +67,27 @@ LIBDEFLATEAPI struct libdeflate_compressor *
 libdeflate_alloc_compressor(int compression_level);
 
 /*
- * Like libdeflate_alloc_compressor(), but adds the 'options' argument.
+ * Like libdeflate_alloc_compressor(), but adds the 'options' argument.  This
+ * also returns NULL if any compression parameter set in 'options' is invalid.
  */
 LIBDEFLATEAPI struct libdeflate_compressor *
 libdeflate_alloc_compressor_ex(int compression_level,
 			       const struct libdeflate_options *options);
 
+/*
+ * libdeflate_compressor_memory_size() returns the number of bytes that
+ * libdeflate_alloc_compressor_ex() would request from the malloc function for a
+ * compressor with the given compression level and options, or 0 if it would
+ * fail because the level or options are invalid.  'options' may be NULL for
+ * the defaults.  This is the only allocation made when the compressor is
+ * allocated, so a custom malloc function can be given exactly this much, e.g.
+ * from a pool or from memory on a particular NUMA node.  Streaming compression,
+ * dictionaries, and trained Huffman tables allocate more memory later.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_compressor_memory_size(int compression_level,
+				  const struct libdeflate_options *options);
+
 /*
  * libdeflate_deflate_compress() performs raw DEFLATE compression on a buffer of
  * data.  It attempts to compress 'in_nbytes' bytes of data located at 'in' and
@@ -114,6 +137,28 @@ LIBDEFLATEAPI size_t
 libdeflate_deflate_compress_bound(struct libdeflate_compressor *compressor,
 				  size_t in_nbytes);
 
+/*
+ * libdeflate_deflate_compress_fit() is like libdeflate_deflate_compress(), but
+ * if not all the data fits in 'out_nbytes_avail' bytes, then it compresses as
+ * much of the beginning of the data as it can fit instead, which is useful for
+ * filling fixed-size pages.  The output is always a complete raw DEFLATE
+ * stream that decompresses to the first '*actual_in_nbytes_ret' bytes of the
+ * input.  The return value is the compressed size in bytes, which is 0 only if
+ * 'out_nbytes_avail' is less than 2.
+ *
+ * This takes a single compression pass, over pieces of the input sized from
+ * the space that remains, so not much work goes to input that won't fit.  The
+ * stream is ended within the first block that doesn't fit, after the longest
+ * prefix of that block that fits with any of the ways of encoding it that were
+ * considered.  So the amount of input consumed is close to, but not always
+ * exactly, the most that could fit.  The offload backend is never used.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_fit(struct libdeflate_compressor *compressor,
+				const void *in, size_t in_nbytes,
+				void *out, size_t out_nbytes_avail,
+				size_t *actual_in_nbytes_ret);
+
 /*
  * Like libdeflate_deflate_compress(), but uses the zlib wrapper format instead
  * of raw DEFLATE.
@@ -126,7 +171,8 @@ libdeflate_zlib_compress(struct libdeflate_compressor *compressor,
 /*
  * Like libdeflate_deflate_compress_bound(), but assumes the data will be
  * compressed with libdeflate_zlib_compress() rather than with
- * libdeflate_deflate_compress().
+ * libdeflate_deflate_compress().  This is also valid for
+ * libdeflate_zlib_compress_with_dict().
  */
 LIBDEFLATEAPI size_t
 libdeflate_zlib_compress_bound(struct libdeflate_compressor *compressor,
@@ -205,6 +251,11 @@ enum libdeflate_result {
 	/* The data would have decompressed to more than 'out_nbytes_avail'
 	 * bytes.  */
 	LIBDEFLATE_INSUFFICIENT_SPACE = 3,
+
+	/* Streaming decompression needs more input or output space to continue
+	 * the stream.  Only returned by
+	 * libdeflate_deflate_decompress_stream_update().  */
+	LIBDEFLATE_IN_PROGRESS = 4,
 };
 
 /*
@@ -257,6 +308,31 @@ libdeflate_deflate_decompress_ex(struct libdeflate_decompressor *decompressor,
 				 size_t *actual_in_nbytes_ret,
 				 size_t *actual_out_nbytes_ret);
 
+/*
+ * The number of bytes past the ends of the input and output buffers that the
+ * caller of libdeflate_deflate_decompress_padded() must make accessible.
+ */
+#define LIBDEFLATE_DECOMPRESS_IN_PADDING	64
+#define LIBDEFLATE_DECOMPRESS_OUT_PADDING	320
+
+/*
+ * Like libdeflate_deflate_decompress_ex(), but the caller guarantees that the
+ * LIBDEFLATE_DECOMPRESS_IN_PADDING bytes after the input buffer are readable
+ * and the LIBDEFLATE_DECOMPRESS_OUT_PADDING bytes after the output buffer are
+ * writable.  Decompression can then use its fast path up to the very ends of
+ * the buffers, which makes decompressing small buffers, such as 4 KiB pages,
+ * faster.  The padding may be overwritten with anything, but it never affects
+ * the results for valid data.  For invalid data, LIBDEFLATE_BAD_DATA and
+ * LIBDEFLATE_INSUFFICIENT_SPACE may be returned in different cases than with
+ * libdeflate_deflate_decompress_ex().
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_padded(struct libdeflate_decompressor *decompressor,
+				     const void *in, size_t in_nbytes,
+				     void *out, size_t out_nbytes_avail,
+				     size_t *actual_in_nbytes_ret,
+				     size_t *actual_out_nbytes_ret);
+
 /*
  * Like libdeflate_deflate_decompress(), but assumes the zlib wrapper format
  * instead of raw DEFLATE.
@@ -313,6 +389,50 @@ libdeflate_gzip_decompress_ex(struct libdeflate_decompressor *decompressor,
 			      size_t *actual_in_nbytes_ret,
 			      size_t *actual_out_nbytes_ret);
 
+/*
+ * The fields of a gzip member's header.  The pointers point into the input
+ * buffer that the header was parsed from.
+ */
+struct libdeflate_gzip_header {
+	/* The size of the header in bytes */
+	size_t header_nbytes;
+
+	/* The FLG, MTIME, XFL, and OS fields */
+	unsigned int flags;
+	uint32_t mtime;
+	unsigned int xfl;
+	unsigned int os;
+
+	/* The extra field (FEXTRA), or NULL and 0 if there isn't one */
+	const void *extra;
+	size_t extra_nbytes;
+
+	/*
+	 * The original file name (FNAME) and the comment (FCOMMENT), each
+	 * terminated by a null byte, or NULL if not present
+	 */
+	const char *name;
+	const char *comment;
+
+	/*
+	 * The size of the whole member, including the header and footer, if
+	 * the header gives it, or else 0.  Currently this is given only by
+	 * BGZF members, in the "BC" subfield of the extra field.
+	 */
+	size_t member_nbytes;
+};
+
+/*
+ * libdeflate_gzip_parse_header_ex() parses the header of the gzip member that
+ * 'in' begins with into '*header', without decompressing anything.  It returns
+ * LIBDEFLATE_BAD_DATA if the header is invalid, or if it's truncated or not
+ * followed by at least the 8 bytes of a gzip footer.  The header CRC (FHCRC),
+ * if present, is skipped but not checked, as by the decompression functions.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_gzip_parse_header_ex(const void *in, size_t in_nbytes,
+				struct libdeflate_gzip_header *header);
+
 /*
  * libdeflate_free_decompressor() frees a decompressor that was allocated with
  * libdeflate_alloc_decompressor().  If a NULL pointer is passed in, no action
@@ -322,86 +442,1621 @@ LIBDEFLATEAPI void
 libdeflate_free_decompressor(struct libdeflate_decompressor *decompressor);
 
 /* ========================================================================== */
-/*                                Checksums                                   */
+/*                            Batch compression                               */
 /* ========================================================================== */
 
 /*
- * libdeflate_adler32() updates a running Adler-32 checksum with 'len' bytes of
- * data and returns the updated checksum.  When starting a new checksum, the
- * required initial value for 'adler' is 1.  This value is also returned when
- * 'buffer' is specified as NULL.
+ * A buffer to compress with libdeflate_deflate_compress_batch()
  */
-LIBDEFLATEAPI uint32_t
-libdeflate_adler32(uint32_t adler, const void *buffer, size_t len);
+struct libdeflate_compress_batch_item {
+	/* The uncompressed data */
+	const void *in;
+	size_t in_nbytes;
 
+	/* The buffer for the compressed data */
+	void *out;
+	size_t out_nbytes_avail;
+
+	/*
+	 * Set to the compressed size in bytes, or to 0 if the compressed data
+	 * didn't fit in 'out_nbytes_avail' bytes
+	 */
+	size_t out_nbytes;
+};
 
 /*
- * libdeflate_crc32() updates a running CRC-32 checksum with 'len' bytes of data
- * and returns the updated checksum.  When starting a new checksum, the required
- * initial value for 'crc' is 0.  This value is also returned when 'buffer' is
- * specified as NULL.
+ * libdeflate_deflate_compress_batch() compresses each of the 'num_items'
+ * buffers in 'items' into its own raw DEFLATE stream, exactly as
+ * libdeflate_deflate_compress() would, and sets each item's 'out_nbytes'.
+ *
+ * The setup cost of compressing a buffer is proportional to its size, so this
+ * is efficient even for many small buffers, e.g. messages of a few KB or less.
  */
-LIBDEFLATEAPI uint32_t
-libdeflate_crc32(uint32_t crc, const void *buffer, size_t len);
+LIBDEFLATEAPI void
+libdeflate_deflate_compress_batch(struct libdeflate_compressor *compressor,
+				  struct libdeflate_compress_batch_item *items,
+				  size_t num_items);
 
 /* ========================================================================== */
-/*                           Custom memory allocator                          */
+/*                          Streaming compression                             */
 /* ========================================================================== */
 
 /*
- * Install a custom memory allocator which libdeflate will use for all memory
- * allocations by default.  'malloc_func' is a function that must behave like
- * malloc(), and 'free_func' is a function that must behave like free().
+ * libdeflate_deflate_compress_stream_begin() starts compressing a raw DEFLATE
+ * stream whose data will be provided incrementally, with one or more calls to
+ * libdeflate_deflate_compress_stream_update() followed by one call to
+ * libdeflate_deflate_compress_stream_finish().  Unlike compressing independent
+ * chunks, matches can refer to data provided in earlier calls, so the result
+ * compresses about as well as passing all the data to
+ * libdeflate_deflate_compress() at once, while memory usage stays bounded.
  *
- * The per-(de)compressor custom memory allocator that can be specified in
- * 'struct libdeflate_options' takes priority over this.
+ * The first call on a given compressor allocates about 544 KiB of additional
+ * memory, which is kept until the compressor is freed.  The return value is 0
+ * on success or -1 if out of memory.  Calling this function again abandons any
+ * stream in progress.  While a stream is in progress, the compressor must not
+ * be used for anything else.
  *
- * This doesn't affect the free() function that will be used to free
- * (de)compressors that were already in existence when this is called.
+ * The streaming functions produce raw DEFLATE only.  To produce the zlib or
+ * gzip format, write the header and footer yourself, computing the checksum
+ * with libdeflate_adler32() or libdeflate_crc32().
  */
-LIBDEFLATEAPI void
-libdeflate_set_memory_allocator(void *(*malloc_func)(size_t),
-				void (*free_func)(void *));
+LIBDEFLATEAPI int
+libdeflate_deflate_compress_stream_begin(struct libdeflate_compressor *compressor);
 
 /*
- * Advanced options.  This is the options structure that
- * libdeflate_alloc_compressor_ex() and libdeflate_alloc_decompressor_ex()
- * require.  Most users won't need this and should just use the non-"_ex"
- * functions instead.  If you do need this, it should be initialized like this:
+ * libdeflate_deflate_compress_stream_update() adds 'in_nbytes' bytes of data to
+ * the stream.  The data is buffered internally, and whenever enough of it has
+ * accumulated it is compressed and written to 'out'.  The number of bytes
+ * written, which may be 0, is stored in '*actual_out_nbytes_ret'.  The output
+ * of all calls must be concatenated to form the compressed stream.
  *
- *	struct libdeflate_options options;
+ * 'out_nbytes_avail' should be at least
+ * libdeflate_deflate_compress_stream_bound(compressor, in_nbytes).  If the
+ * output doesn't fit, LIBDEFLATE_INSUFFICIENT_SPACE is returned and the stream
+ * can't be continued; it must be restarted from the beginning.  The same is
+ * returned if no stream is in progress.  Otherwise, LIBDEFLATE_SUCCESS is
+ * returned.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_compress_stream_update(struct libdeflate_compressor *compressor,
+					  const void *in, size_t in_nbytes,
+					  void *out, size_t out_nbytes_avail,
+					  size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_deflate_compress_stream_finish() compresses any data still
+ * buffered, ends the stream, and writes the remaining output to 'out', like
+ * libdeflate_deflate_compress_stream_update().  'out_nbytes_avail' should be
+ * at least libdeflate_deflate_compress_stream_bound(compressor, 0).
+ * Afterwards, a new stream can be started with
+ * libdeflate_deflate_compress_stream_begin().
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_compress_stream_finish(struct libdeflate_compressor *compressor,
+					  void *out, size_t out_nbytes_avail,
+					  size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_deflate_compress_stream_flush() compresses any data still
+ * buffered without ending the stream, then writes an empty uncompressed block,
+ * so that the output so far is byte-aligned and decompresses to all the data
+ * so far.  This is zlib's Z_SYNC_FLUSH, or Z_FULL_FLUSH if 'full_flush' is
+ * nonzero, in which case the data that follows won't refer to the data before,
+ * so decompression can start over from this point.  Flushing often worsens the
+ * compression ratio, since each flush ends a block early and data that is still
+ * buffered is compressed in a smaller piece.  The output is written like by
+ * libdeflate_deflate_compress_stream_finish(), and 'out_nbytes_avail' should be
+ * at least libdeflate_deflate_compress_stream_bound(compressor, 0).
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_compress_stream_flush(struct libdeflate_compressor *compressor,
+					 int full_flush,
+					 void *out, size_t out_nbytes_avail,
+					 size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_deflate_compress_stream_bound() returns the maximum number of
+ * bytes that a call to libdeflate_deflate_compress_stream_update() with
+ * 'in_nbytes' bytes of input, or to libdeflate_deflate_compress_stream_flush()
+ * or libdeflate_deflate_compress_stream_finish() if 'in_nbytes' is 0, can
+ * write.  This accounts for the data that previous calls may have left
+ * buffered.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_stream_bound(struct libdeflate_compressor *compressor,
+					 size_t in_nbytes);
+
+/* ========================================================================== */
+/*                       Compression of scattered input                       */
+/* ========================================================================== */
+
+/*
+ * A segment of the input to libdeflate_deflate_compress_iov() and friends
+ */
+struct libdeflate_iovec {
+	const void *data;
+	size_t nbytes;
+};
+
+/*
+ * libdeflate_deflate_compress_iov() is like libdeflate_deflate_compress(), but
+ * the data to compress is the concatenation of the 'iovcnt' segments in 'iov',
+ * which may be located anywhere in memory.  Matches can cross the boundaries
+ * between segments.
  *
- *	memset(&options, 0, sizeof(options));
- *	options.sizeof_options = sizeof(options);
- *	// Then set the fields that you need to override the defaults for.
+ * If there is only one nonempty segment, it is compressed in place.  Otherwise
+ * the segments are gathered, 512 KiB at a time plus 32 KiB of history, into
+ * the same buffer that streaming compression uses, so the first call that needs
+ * it allocates about 544 KiB of additional memory, and any stream in progress
+ * on the compressor is abandoned.  0 is returned if that allocation fails.
+ * When the total size is at most 544 KiB, the output is the same as
+ * libdeflate_deflate_compress() would produce for the concatenated data.
+ *
+ * The output is no larger than libdeflate_deflate_compress_bound() of the
+ * total size.
  */
-struct libdeflate_options {
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_iov(struct libdeflate_compressor *compressor,
+				const struct libdeflate_iovec *iov,
+				size_t iovcnt,
+				void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_deflate_compress_iov(), but uses the zlib wrapper format.
+ * The output is no larger than libdeflate_zlib_compress_bound().
+ */
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress_iov(struct libdeflate_compressor *compressor,
+			     const struct libdeflate_iovec *iov, size_t iovcnt,
+			     void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_deflate_compress_iov(), but uses the gzip wrapper format.
+ * The output is no larger than libdeflate_gzip_compress_bound().
+ */
+LIBDEFLATEAPI size_t
+libdeflate_gzip_compress_iov(struct libdeflate_compressor *compressor,
+			     const struct libdeflate_iovec *iov, size_t iovcnt,
+			     void *out, size_t out_nbytes_avail);
+
+/* ========================================================================== */
+/*                           Compression statistics                           */
+/* ========================================================================== */
+
+/*
+ * Statistics about the work a compressor has done, for choosing compression
+ * levels from telemetry.  A "block" here is a block as chosen by the
+ * compressor; an uncompressed block longer than 65535 bytes is actually written
+ * as several DEFLATE blocks.  Counting costs a few operations per block, so it
+ * is always enabled.
+ */
+struct libdeflate_compress_stats {
 
 	/*
-	 * This field must be set to the struct size.  This field exists for
-	 * extensibility, so that fields can be appended to this struct in
-	 * future versions of libdeflate while still supporting old binaries.
+	 * This field must be set to the struct size by the caller, like
+	 * libdeflate_options::sizeof_options, so that fields can be appended
+	 * to this struct in future versions.
 	 */
-	size_t sizeof_options;
+	size_t sizeof_stats;
+
+	/* The number of uncompressed bytes compressed */
+	uint64_t in_nbytes;
+
+	/* The number of blocks, and how many of them are of each type */
+	uint64_t num_blocks;
+	uint64_t num_uncompressed_blocks;
+	uint64_t num_static_blocks;
+	uint64_t num_dynamic_blocks;
+
+	/* Dynamic Huffman blocks that use a trained libdeflate_huffman_table */
+	uint64_t num_trained_blocks;
 
 	/*
-	 * An optional custom memory allocator to use for this (de)compressor.
-	 * 'malloc_func' must be a function that behaves like malloc(), and
-	 * 'free_func' must be a function that behaves like free().
-	 *
-	 * This is useful in cases where a process might have multiple users of
-	 * libdeflate who want to use different memory allocators.  For example,
-	 * a library might want to use libdeflate with a custom memory allocator
-	 * without interfering with user code that might use libdeflate too.
-	 *
-	 * This takes priority over the "global" memory allocator (which by
-	 * default is malloc() and free(), but can be changed by
-	 * libdeflate_set_memory_allocator()).  Moreover, libdeflate will never
-	 * call the "global" memory allocator if a per-(de)compressor custom
-	 * allocator is always given.
+	 * The literals and matches chosen by the parser, including in blocks
+	 * that ended up uncompressed.  Input too short to be worth compressing
+	 * counts as literals.  The average match length is
+	 * total_match_length / num_matches.
 	 */
-	void *(*malloc_func)(size_t);
-	void (*free_func)(void *);
+	uint64_t num_literals;
+	uint64_t num_matches;
+	uint64_t total_match_length;
+
+	/*
+	 * The number of times a block was ended early because the block
+	 * splitting heuristic detected a change in the data, rather than
+	 * because the block reached its maximum length or the data ended
+	 */
+	uint64_t num_block_split_ends;
+
+	/*
+	 * The number of optimization passes made by the near-optimal parser
+	 * (compression levels 10-14), summed over all blocks
+	 */
+	uint64_t num_optim_passes;
+
+	/*
+	 * The number of positions at which the matchfinder searched for
+	 * matches, and the number of earlier positions it compared against
+	 * them.  With the binary tree matchfinder (compression levels 10-14),
+	 * positions that the parser skips over are searched too, to keep the
+	 * tree up to date.  These are only counted if libdeflate was built with
+	 * LIBDEFLATE_ENABLE_COUNTERS defined, and are 0 otherwise.
+	 */
+	uint64_t num_match_searches;
+	uint64_t num_match_candidates;
+};
+
+/*
+ * libdeflate_get_compress_stats() retrieves the statistics of all compression
+ * done with 'compressor' since it was allocated or since the last call to
+ * libdeflate_reset_compress_stats().  To get them for a single call, reset
+ * them before it.  All compression functions are counted, but training a
+ * Huffman table isn't.
+ */
+LIBDEFLATEAPI void
+libdeflate_get_compress_stats(struct libdeflate_compressor *compressor,
+			      struct libdeflate_compress_stats *stats);
+
+/*
+ * libdeflate_reset_compress_stats() sets all of a compressor's statistics to 0.
+ */
+LIBDEFLATEAPI void
+libdeflate_reset_compress_stats(struct libdeflate_compressor *compressor);
+
+/* ========================================================================== */
+/*                         Streaming decompression                            */
+/* ========================================================================== */
+
+/*
+ * libdeflate_deflate_decompress_stream_begin() starts decompressing a raw
+ * DEFLATE stream whose compressed data will be provided incrementally, with
+ * one or more calls to libdeflate_deflate_decompress_stream_update().  Neither
+ * the whole input nor the whole output needs to be in memory at once.  Instead
+ * the decompressor keeps a sliding window of the most recent output, so memory
+ * usage stays bounded regardless of the size of the stream.
+ *
+ * The first call on a given decompressor allocates about 100 KiB of additional
+ * memory, which is kept until the decompressor is freed.  The return value is
+ * 0 on success or -1 if out of memory.  Calling this function again abandons
+ * any stream in progress.  While a stream is in progress, the decompressor
+ * must not be used for anything else.
+ *
+ * The streaming functions handle raw DEFLATE only.  To decompress the zlib or
+ * gzip format, parse the header and footer yourself and verify the checksum
+ * with libdeflate_adler32() or libdeflate_crc32().
+ */
+LIBDEFLATEAPI int
+libdeflate_deflate_decompress_stream_begin(struct libdeflate_decompressor *decompressor);
+
+/*
+ * libdeflate_deflate_decompress_stream_update() continues decompressing the
+ * stream, using up to 'in_nbytes' bytes of compressed data from 'in' and
+ * writing up to 'out_nbytes_avail' bytes of uncompressed data to 'out'.  The
+ * number of bytes consumed and written are stored in '*actual_in_nbytes_ret'
+ * and '*actual_out_nbytes_ret'.  Either may be 0.
+ *
+ * The return value is LIBDEFLATE_IN_PROGRESS if the stream hasn't ended yet.
+ * In that case, either all the input was consumed (some of it may be buffered
+ * internally), or the output buffer was filled, or both.  The caller should
+ * then call this function again with the unconsumed input and/or more input,
+ * and with a new output buffer.  A stream that is truncated just keeps
+ * returning LIBDEFLATE_IN_PROGRESS, so callers must detect that themselves.
+ *
+ * The return value is LIBDEFLATE_SUCCESS once the end of the stream has been
+ * reached and all its data has been written.  At that point, the input that was
+ * consumed ends at the byte boundary following the end of the stream, like
+ * libdeflate_deflate_decompress_ex().  Any further input, such as a gzip
+ * footer, is left unconsumed.
+ *
+ * The return value is LIBDEFLATE_BAD_DATA if the compressed data is invalid, or
+ * if no stream is in progress.  The stream can't be continued after an error.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_stream_update(struct libdeflate_decompressor *decompressor,
+					    const void *in, size_t in_nbytes,
+					    void *out, size_t out_nbytes_avail,
+					    size_t *actual_in_nbytes_ret,
+					    size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_deflate_decompress_to_sink() decompresses a whole raw DEFLATE
+ * stream from 'in', like libdeflate_deflate_decompress_ex(), but instead of
+ * writing the uncompressed data to one buffer, it passes it to 'sink' in order,
+ * in pieces as it is decoded.  Each call provides up to 96 KiB of
+ * data, which is only valid until the call returns.  The data comes straight
+ * from the decompressor's window, so no output buffer for the whole stream is
+ * needed.  If 'sink' returns nonzero, decompression stops and
+ * LIBDEFLATE_INSUFFICIENT_SPACE is returned.
+ *
+ * This uses the streaming decompression state, so the first call on a given
+ * decompressor allocates about 100 KiB of additional memory (and
+ * LIBDEFLATE_INSUFFICIENT_SPACE is returned if that fails), and any stream in
+ * progress is abandoned.  If the stream is invalid or truncated,
+ * LIBDEFLATE_BAD_DATA is returned, possibly after some data was passed to the
+ * sink.  On success, '*actual_in_nbytes_ret' and '*actual_out_nbytes_ret', if
+ * not NULL, are set to the compressed and uncompressed sizes.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_to_sink(struct libdeflate_decompressor *decompressor,
+				      const void *in, size_t in_nbytes,
+				      int (*sink)(void *ctx, const void *data,
+						  size_t nbytes),
+				      void *ctx,
+				      size_t *actual_in_nbytes_ret,
+				      size_t *actual_out_nbytes_ret);
+
+/*
+ * A segment of the output of libdeflate_deflate_decompress_iov()
+ */
+struct libdeflate_out_iovec {
+	void *data;
+	size_t nbytes;
+};
+
+/*
+ * libdeflate_deflate_decompress_iov() is like
+ * libdeflate_deflate_decompress_ex(), but the output space is the concatenation
+ * of the 'iovcnt' segments in 'iov', e.g. a list of pages, and matches are
+ * resolved across the boundaries between segments.  It is implemented with
+ * libdeflate_deflate_decompress_to_sink(), so the same notes about memory
+ * apply.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_iov(struct libdeflate_decompressor *decompressor,
+				  const void *in, size_t in_nbytes,
+				  const struct libdeflate_out_iovec *iov,
+				  size_t iovcnt,
+				  size_t *actual_in_nbytes_ret,
+				  size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_gzip_validate() checks that 'in' begins with a valid gzip member,
+ * including its CRC32 and ISIZE, without needing an output buffer: the data is
+ * decompressed into the decompressor's window and checksummed as it goes.  On
+ * success, '*actual_in_nbytes_ret' and '*actual_out_nbytes_ret', if not NULL,
+ * are set to the exact sizes of the member and of its uncompressed data.
+ * Unlike ISIZE, the uncompressed size isn't truncated to 32 bits.
+ *
+ * LIBDEFLATE_BAD_DATA is returned if the member is invalid or truncated.  This
+ * uses libdeflate_deflate_decompress_to_sink(), so the same notes about memory
+ * apply, and LIBDEFLATE_INSUFFICIENT_SPACE is returned if that memory can't be
+ * allocated.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_gzip_validate(struct libdeflate_decompressor *decompressor,
+			 const void *in, size_t in_nbytes,
+			 size_t *actual_in_nbytes_ret,
+			 size_t *actual_out_nbytes_ret);
+
+/* ========================================================================== */
+/*                      Compression with a preset dictionary                  */
+/* ========================================================================== */
+
+/*
+ * libdeflate_deflate_compress_with_dict() is like
+ * libdeflate_deflate_compress(), but matches can also refer to a preset
+ * dictionary, as if the dictionary had been compressed just before the data but
+ * without producing any output.  This can greatly improve compression of small
+ * inputs that resemble each other, given a dictionary of strings that are
+ * common in them.  Only the last 32768 bytes of the dictionary are used.  The
+ * same dictionary must be given to the decompressor.
+ *
+ * The first call on a given compressor allocates about 66 KiB of additional
+ * memory, which is kept until the compressor is freed.  0 is returned if that
+ * fails.  The output is no larger than libdeflate_deflate_compress_bound().
+ */
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_with_dict(struct libdeflate_compressor *compressor,
+				      const void *dict, size_t dict_nbytes,
+				      const void *in, size_t in_nbytes,
+				      void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_deflate_compress_with_dict(), but uses the zlib wrapper
+ * format.  This sets the FDICT flag and stores the Adler-32 checksum of the
+ * whole dictionary as DICTID, as zlib does.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress_with_dict(struct libdeflate_compressor *compressor,
+				   const void *dict, size_t dict_nbytes,
+				   const void *in, size_t in_nbytes,
+				   void *out, size_t out_nbytes_avail);
+
+/*
+ * A prepared dictionary saves the work of inserting the dictionary into the
+ * compressor's match-finding data structures on each call: they are computed
+ * once, then copied on each call.  This is worthwhile when compressing many
+ * small inputs with the same dictionary.
+ */
+struct libdeflate_compression_dict;
+
+/*
+ * libdeflate_prepare_compression_dict() prepares a dictionary for use with
+ * compressors that have the same compression level as 'compressor', which is
+ * used to do the work.  The dictionary data is copied.  NULL is returned if out
+ * of memory.  A prepared dictionary isn't modified by being used, so multiple
+ * threads can use it at the same time, each with their own compressor.
+ */
+LIBDEFLATEAPI struct libdeflate_compression_dict *
+libdeflate_prepare_compression_dict(struct libdeflate_compressor *compressor,
+				    const void *dict, size_t dict_nbytes);
+
+/*
+ * Like libdeflate_deflate_compress_with_dict(), but takes a prepared
+ * dictionary.  The output is the same.  If the compressor's compression level
+ * or match finding parameters differ from those of the compressor the
+ * dictionary was prepared with, then this still works but isn't any faster.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_deflate_compress_with_prepared_dict(struct libdeflate_compressor *compressor,
+					       const struct libdeflate_compression_dict *dict,
+					       const void *in, size_t in_nbytes,
+					       void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_zlib_compress_with_dict(), but takes a prepared dictionary.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_zlib_compress_with_prepared_dict(struct libdeflate_compressor *compressor,
+					    const struct libdeflate_compression_dict *dict,
+					    const void *in, size_t in_nbytes,
+					    void *out, size_t out_nbytes_avail);
+
+/*
+ * libdeflate_free_compression_dict() frees a prepared dictionary.  If a NULL
+ * pointer is passed in, no action is taken.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_compression_dict(struct libdeflate_compression_dict *dict);
+
+/* ========================================================================== */
+/*                            Trained Huffman codes                           */
+/* ========================================================================== */
+
+struct libdeflate_huffman_table;
+
+/*
+ * libdeflate_train_huffman_table() builds Huffman codes tailored to data like
+ * the 'num_samples' sample buffers, for use with
+ * libdeflate_set_huffman_table().  The samples are parsed into literals and
+ * matches by 'compressor', so the codes fit the choices made at its
+ * compression level.  The dynamic Huffman block header for the codes is
+ * generated once here, rather than for every block that uses them.
+ *
+ * This is mainly useful for many small, similar inputs, where making Huffman
+ * codes and their header for each input is a large part of the compression
+ * time.
+ *
+ * The return value is the new table, or NULL if out of memory or if
+ * 'compressor' has compression level 0 or uses LIBDEFLATE_STRATEGY_ULTRAFAST.
+ * The table is independent of the compressor afterwards, and it isn't modified
+ * by being used, so multiple compressors may use it concurrently.
+ */
+LIBDEFLATEAPI struct libdeflate_huffman_table *
+libdeflate_train_huffman_table(struct libdeflate_compressor *compressor,
+			       const void * const samples[],
+			       const size_t sample_nbytes[],
+			       size_t num_samples);
+
+/*
+ * libdeflate_set_huffman_table() makes 'compressor' use the trained Huffman
+ * codes 'table' for dynamic Huffman blocks instead of making codes for each
+ * block, which saves time.  At compression levels 10-14, where codes are made
+ * for each block anyway, the trained codes are just considered as another
+ * option.  Either way, a static Huffman or uncompressed block is still used
+ * when it is smaller.  Symbols that didn't occur in the samples lack codewords,
+ * so blocks containing them get their own codes as usual.
+ *
+ * The decompressor doesn't need to know about the table, since DEFLATE sends
+ * the codes in each block that uses them.  Because of that, codes made for the
+ * block itself are usually a bit smaller overall, so the benefit is mainly
+ * speed; this usually makes the output slightly larger.
+ *
+ * The table must remain valid for as long as it is set.  Pass NULL to stop
+ * using it.
+ */
+LIBDEFLATEAPI void
+libdeflate_set_huffman_table(struct libdeflate_compressor *compressor,
+			     const struct libdeflate_huffman_table *table);
+
+/*
+ * libdeflate_free_huffman_table() frees a trained Huffman table.  If a NULL
+ * pointer is passed in, no action is taken.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_huffman_table(struct libdeflate_huffman_table *table);
+
+/* ========================================================================== */
+/*                          Near-optimal cost models                          */
+/* ========================================================================== */
+
+struct libdeflate_cost_model;
+
+/*
+ * libdeflate_save_cost_model() saves the symbol costs that 'compressor' ended
+ * up with for the last block it compressed, together with that block's
+ * literal/match statistics, for use with libdeflate_set_cost_model().  The
+ * return value is the new cost model, or NULL if out of memory, if
+ * 'compressor' doesn't use LIBDEFLATE_STRATEGY_NEAR_OPTIMAL (levels 10-14), or
+ * if it hasn't compressed a block yet.
+ *
+ * The near-optimal parser makes several passes over each block, each using the
+ * symbol costs that the previous pass's Huffman codes imply.  Each block after
+ * the first starts from the previous block's costs, to the extent that the data
+ * seems similar, but the first block of each call starts from rough default
+ * costs.  So when compressing many small, similar inputs, nearly every block
+ * starts from the defaults.
+ */
+LIBDEFLATEAPI struct libdeflate_cost_model *
+libdeflate_save_cost_model(struct libdeflate_compressor *compressor);
+
+/*
+ * libdeflate_set_cost_model() makes 'compressor' start the first block of each
+ * call from the costs in 'model' rather than from the default costs, in the
+ * same way as for later blocks.  This mostly helps when few optimization
+ * passes are made, i.e. when libdeflate_options::max_optim_passes has been
+ * lowered to make compression faster, as the later passes mostly make up for
+ * the rough starting costs anyway.  It helps only for inputs similar to the one
+ * 'model' was saved after.  It has no effect on compressors that don't use
+ * LIBDEFLATE_STRATEGY_NEAR_OPTIMAL.
+ *
+ * The model must remain valid for as long as it is set.  Pass NULL to stop
+ * using it.  A model isn't modified by being used, so multiple compressors may
+ * use it concurrently.
+ */
+LIBDEFLATEAPI void
+libdeflate_set_cost_model(struct libdeflate_compressor *compressor,
+			  const struct libdeflate_cost_model *model);
+
+/*
+ * libdeflate_free_cost_model() frees a saved cost model.  If a NULL pointer is
+ * passed in, no action is taken.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_cost_model(struct libdeflate_cost_model *model);
+
+/* ========================================================================== */
+/*                    Decompression with a preset dictionary                  */
+/* ========================================================================== */
+
+/*
+ * libdeflate_deflate_decompress_with_dict() is like
+ * libdeflate_deflate_decompress_ex(), but matches can also refer to a preset
+ * dictionary, which must be the same one that was used for compression.
+ * Conceptually the dictionary precedes the output buffer, but it isn't copied
+ * there, and it can be anywhere in memory.  Only the last 32768 bytes of the
+ * dictionary can be referenced.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_with_dict(struct libdeflate_decompressor *decompressor,
+					const void *dict, size_t dict_nbytes,
+					const void *in, size_t in_nbytes,
+					void *out, size_t out_nbytes_avail,
+					size_t *actual_in_nbytes_ret,
+					size_t *actual_out_nbytes_ret);
+
+/*
+ * Like libdeflate_deflate_decompress_with_dict(), but for the zlib wrapper
+ * format.  If the stream's header has the FDICT flag set, then the Adler-32
+ * checksum of the whole dictionary must match the header's DICTID, otherwise
+ * LIBDEFLATE_BAD_DATA is returned.  If FDICT isn't set, the dictionary is
+ * ignored.  Note that libdeflate_zlib_decompress() and
+ * libdeflate_zlib_decompress_ex() return LIBDEFLATE_BAD_DATA for any stream
+ * with FDICT set.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_zlib_decompress_with_dict(struct libdeflate_decompressor *decompressor,
+				     const void *dict, size_t dict_nbytes,
+				     const void *in, size_t in_nbytes,
+				     void *out, size_t out_nbytes_avail,
+				     size_t *actual_in_nbytes_ret,
+				     size_t *actual_out_nbytes_ret);
+
+/* ========================================================================== */
+/*                        Random access decompression                         */
+/* ========================================================================== */
+
+/*
+ * A checkpoint is a point at the start of a DEFLATE block from which
+ * decompression can be resumed: its position in the compressed data, in bits,
+ * its position in the uncompressed data, and the up to 32768 bytes of
+ * uncompressed data preceding it, which matches after it may refer to.
+ *
+ * Checkpoints contain no pointers, so they can be saved to a file and used to
+ * decompress later, as long as they are only used with the same compressed
+ * data.
+ */
+struct libdeflate_checkpoint {
+	uint64_t in_bitpos;
+	uint64_t out_pos;
+	uint32_t window_nbytes;
+	uint8_t window[32768];
+};
+
+/*
+ * An index is a list of checkpoints recorded while decompressing a whole
+ * stream, allowing any part of the data to be decompressed later without
+ * starting from the beginning.
+ */
+struct libdeflate_index;
+
+/*
+ * libdeflate_alloc_index() allocates an empty index, using the memory allocator
+ * of 'decompressor'.  Checkpoints will be recorded at the first block
+ * boundaries after every 'spacing' bytes of uncompressed data, e.g. every few
+ * MiB.  Each checkpoint takes about 32 KiB of memory.  NULL is returned if out
+ * of memory.
+ */
+LIBDEFLATEAPI struct libdeflate_index *
+libdeflate_alloc_index(struct libdeflate_decompressor *decompressor,
+		       size_t spacing);
+
+/*
+ * libdeflate_set_index() makes the whole-buffer decompression functions of
+ * 'decompressor', e.g. libdeflate_gzip_decompress_ex(), record checkpoints
+ * into 'index'.  Each call clears the index, then adds checkpoints while
+ * decompressing.  Their input positions are relative to the start of the 'in'
+ * buffer of the call, including any zlib or gzip header.  If the call fails,
+ * the contents of the index are unspecified.  If memory runs out while
+ * recording, some checkpoints are left out.
+ *
+ * The index must remain valid for as long as it is set.  Pass NULL to stop
+ * recording.  The streaming decompressor doesn't record checkpoints.
+ */
+LIBDEFLATEAPI void
+libdeflate_set_index(struct libdeflate_decompressor *decompressor,
+		     struct libdeflate_index *index);
+
+/*
+ * libdeflate_index_num_checkpoints() returns the number of checkpoints in
+ * 'index', and libdeflate_index_get_checkpoint() returns the checkpoint at
+ * position 'i', or NULL if 'i' is out of range.  Checkpoints are in order of
+ * increasing position.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_index_num_checkpoints(const struct libdeflate_index *index);
+
+LIBDEFLATEAPI const struct libdeflate_checkpoint *
+libdeflate_index_get_checkpoint(const struct libdeflate_index *index,
+				size_t i);
+
+/*
+ * libdeflate_index_find_checkpoint() returns the last checkpoint in 'index'
+ * whose 'out_pos' is at most 'out_pos', i.e. the best one to start from to get
+ * the uncompressed data at 'out_pos', or NULL if there is none, in which case
+ * decompression must start at the beginning of the stream.
+ */
+LIBDEFLATEAPI const struct libdeflate_checkpoint *
+libdeflate_index_find_checkpoint(const struct libdeflate_index *index,
+				 uint64_t out_pos);
+
+/*
+ * libdeflate_free_index() frees an index.  If a NULL pointer is passed in, no
+ * action is taken.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_index(struct libdeflate_index *index);
+
+/*
+ * libdeflate_deflate_decompress_from_checkpoint() decompresses raw DEFLATE
+ * data starting at 'checkpoint'.  'in' must point to the byte of the
+ * compressed data at offset 'checkpoint->in_bitpos / 8', and the uncompressed
+ * data written to 'out' starts at offset 'checkpoint->out_pos'.  If
+ * 'checkpoint' is NULL, decompression starts at the beginning of the stream
+ * instead.
+ *
+ * Unlike with the other functions, an output buffer that is too small isn't an
+ * error: decompression stops successfully once 'out_nbytes_avail' bytes have
+ * been written, so that just the range of data wanted is decompressed.
+ * Otherwise, this is like libdeflate_deflate_decompress_ex(); in particular,
+ * if 'actual_out_nbytes_ret' is NULL, the stream ending before the buffer is
+ * full is an error.  The value stored in '*actual_in_nbytes_ret' is only
+ * meaningful if the end of the stream was reached.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_deflate_decompress_from_checkpoint(
+			struct libdeflate_decompressor *decompressor,
+			const struct libdeflate_checkpoint *checkpoint,
+			const void *in, size_t in_nbytes,
+			void *out, size_t out_nbytes_avail,
+			size_t *actual_in_nbytes_ret,
+			size_t *actual_out_nbytes_ret);
+
+/* ========================================================================== */
+/*                         Decompression introspection                        */
+/* ========================================================================== */
+
+/* Information about one DEFLATE block, passed to a block callback */
+struct libdeflate_block_info {
+
+	/* The block type: 0 = uncompressed, 1 = static Huffman, 2 = dynamic */
+	int block_type;
+
+	/* Nonzero if this is the final block of the stream */
+	int is_final;
+
+	/*
+	 * The position of the block's first bit in the input, counted from the
+	 * start of the buffer passed in (including any zlib or gzip header)
+	 */
+	uint64_t in_bitpos;
+
+	/*
+	 * The size of the block header in bits.  For an uncompressed block,
+	 * this includes the padding to a byte boundary and LEN and NLEN.
+	 */
+	uint64_t header_nbits;
+
+	/* The position in the output at which the block's data starts */
+	uint64_t out_pos;
+
+	/*
+	 * For Huffman blocks, the number of bits the main literal/length
+	 * decode table is indexed by, and the number of literal/length symbols
+	 * whose codewords are longer than that and thus need a second table
+	 * lookup.  Both are 0 for uncompressed blocks.
+	 */
+	unsigned litlen_tablebits;
+	unsigned litlen_subtable_syms;
+};
+
+/*
+ * libdeflate_set_block_callback() sets a function to be called at the start of
+ * each block decompressed by 'decompressor', after the block header has been
+ * read.  Pass NULL to remove it.  Blocks are reported by the whole-buffer
+ * decompression functions, including the zlib and gzip ones, but not by
+ * streaming decompression, which libdeflate_deflate_decompress_to_sink() and
+ * libdeflate_deflate_decompress_iov() also use.  If the data is invalid, blocks
+ * before the error may still have been reported.
+ */
+LIBDEFLATEAPI void
+libdeflate_set_block_callback(struct libdeflate_decompressor *decompressor,
+			      void (*callback)(void *ctx,
+					       const struct libdeflate_block_info *info),
+			      void *ctx);
+
+/*
+ * Statistics about the work a decompressor has done.  Like the block callback,
+ * they cover the whole-buffer decompression functions only.
+ */
+struct libdeflate_decompress_stats {
+
+	/*
+	 * This field must be set to the struct size by the caller, like
+	 * libdeflate_compress_stats::sizeof_stats.
+	 */
+	size_t sizeof_stats;
+
+	/* The number of blocks, and how many of them are of each type */
+	uint64_t num_blocks;
+	uint64_t num_uncompressed_blocks;
+	uint64_t num_static_blocks;
+	uint64_t num_dynamic_blocks;
+
+	/*
+	 * The number of bytes of Huffman block data decoded by the fast main
+	 * loop and by the slower loop that handles the ends of the buffers.
+	 * Lots of the latter means the input or output is often fragmented
+	 * into small pieces, or that blocks are short.
+	 */
+	uint64_t num_fastloop_bytes;
+	uint64_t num_generic_loop_bytes;
+
+	/*
+	 * The number of dynamic Huffman blocks whose codes were the same as
+	 * those the decompressor had last built decode tables for, including
+	 * in an earlier call, so that the tables were reused
+	 */
+	uint64_t num_reused_dynamic_codes;
+
+	/*
+	 * Counts of events in the inner loops, for tuning.  These are only
+	 * counted if libdeflate was built with LIBDEFLATE_ENABLE_COUNTERS
+	 * defined, and are 0 otherwise.  Unlike the other statistics, they
+	 * include streaming decompression.
+	 *
+	 * num_fastloop_refills is the number of bitbuffer refills in the
+	 * fastloop; num_litlen_subtable_lookups is the number of literal/length
+	 * symbols whose codeword was too long for the main decode table;
+	 * num_offset1_matches is the number of matches decoded by the fastloop
+	 * that have offset 1, i.e. runs of the same byte; and
+	 * num_generic_loop_entries is the number of times the generic loop was
+	 * entered, once per Huffman block that reaches it.
+	 */
+	uint64_t num_fastloop_refills;
+	uint64_t num_litlen_subtable_lookups;
+	uint64_t num_offset1_matches;
+	uint64_t num_generic_loop_entries;
+};
+
+/*
+ * libdeflate_get_decompress_stats() retrieves the statistics of 'decompressor'
+ * since it was allocated or since the last call to
+ * libdeflate_reset_decompress_stats().
+ */
+LIBDEFLATEAPI void
+libdeflate_get_decompress_stats(struct libdeflate_decompressor *decompressor,
+				struct libdeflate_decompress_stats *stats);
+
+/*
+ * libdeflate_reset_decompress_stats() sets all of a decompressor's statistics
+ * to 0.
+ */
+LIBDEFLATEAPI void
+libdeflate_reset_decompress_stats(struct libdeflate_decompressor *decompressor);
+
+/* ========================================================================== */
+/*                           Parallel compression                             */
+/* ========================================================================== */
+
+/*
+ * A parallel compressor splits its input into fixed-size chunks and compresses
+ * them independently, except that each chunk can still refer to the 32 KiB of
+ * data preceding it.  The compressed chunks are joined into a single stream in
+ * the DEFLATE, zlib, or gzip format, which any decompressor can decompress.
+ * The compression ratio is slightly worse than with a regular compressor.
+ *
+ * libdeflate never creates threads itself.  Instead, the chunks are compressed
+ * by tasks handed to a task submitter supplied by the caller, which may run
+ * them on its own thread pool in any order.  The output depends only on the
+ * input data and the compression level, not on the number of threads or on
+ * the order in which the tasks run.
+ */
+struct libdeflate_parallel_compressor;
+
+struct libdeflate_task_submitter {
+	/*
+	 * Arrange for 'func(arg)' to be called, possibly on another thread and
+	 * possibly before submit() returns.
+	 */
+	void (*submit)(void *ctx, void (*func)(void *arg), void *arg);
+
+	/* Wait until all tasks submitted so far have returned. */
+	void (*wait)(void *ctx);
+
+	/* An opaque value passed to submit() and wait() */
+	void *ctx;
+};
+
+/*
+ * libdeflate_alloc_parallel_compressor() allocates a new parallel compressor
+ * for the given compression level.  Up to 'num_threads' chunks are compressed
+ * at a time, each using a regular compressor and chunk-sized output buffers
+ * allocated up front, so memory usage is proportional to 'num_threads'.  At
+ * levels 10-14, each task compresses several chunks per batch, which balances
+ * the work better since the time per chunk varies more at those levels.
+ *
+ * If 'submitter' is NULL, the chunks are compressed one at a time on the
+ * calling thread.  Otherwise the submitter struct is copied, so it needn't
+ * stay valid, but the submitter itself must remain usable until the parallel
+ * compressor is freed.
+ *
+ * A single parallel compressor must not be used by multiple threads
+ * concurrently.  NULL is returned if the compression level is invalid,
+ * 'num_threads' is 0, or out of memory.
+ */
+LIBDEFLATEAPI struct libdeflate_parallel_compressor *
+libdeflate_alloc_parallel_compressor(int compression_level,
+				     unsigned int num_threads,
+				     const struct libdeflate_task_submitter *submitter);
+
+/*
+ * Like libdeflate_alloc_parallel_compressor(), but adds the 'options' argument.
+ */
+LIBDEFLATEAPI struct libdeflate_parallel_compressor *
+libdeflate_alloc_parallel_compressor_ex(int compression_level,
+					unsigned int num_threads,
+					const struct libdeflate_task_submitter *submitter,
+					const struct libdeflate_options *options);
+
+/*
+ * libdeflate_parallel_deflate_compress() is like libdeflate_deflate_compress(),
+ * but compresses the chunks of the input in parallel.  Returns the compressed
+ * size in bytes, or 0 if the output doesn't fit in 'out_nbytes_avail' bytes.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_deflate_compress(struct libdeflate_parallel_compressor *compressor,
+				     const void *in, size_t in_nbytes,
+				     void *out, size_t out_nbytes_avail);
+
+/*
+ * libdeflate_parallel_deflate_compress_bound() returns a worst-case upper bound
+ * on the number of bytes of compressed data that may be produced by
+ * libdeflate_parallel_deflate_compress() for 'in_nbytes' bytes of input.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_deflate_compress_bound(struct libdeflate_parallel_compressor *compressor,
+					   size_t in_nbytes);
+
+/*
+ * Like libdeflate_parallel_deflate_compress(), but uses the zlib wrapper
+ * format.  The Adler-32 checksums of the chunks are computed by the tasks too,
+ * then combined.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_zlib_compress(struct libdeflate_parallel_compressor *compressor,
+				  const void *in, size_t in_nbytes,
+				  void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_parallel_deflate_compress_bound(), but assumes the data will
+ * be compressed with libdeflate_parallel_zlib_compress().
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_zlib_compress_bound(struct libdeflate_parallel_compressor *compressor,
+					size_t in_nbytes);
+
+/*
+ * Like libdeflate_parallel_deflate_compress(), but uses the gzip wrapper
+ * format.  The CRC-32 checksums of the chunks are computed by the tasks too,
+ * then combined.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_gzip_compress(struct libdeflate_parallel_compressor *compressor,
+				  const void *in, size_t in_nbytes,
+				  void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_parallel_deflate_compress_bound(), but assumes the data will
+ * be compressed with libdeflate_parallel_gzip_compress().
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_gzip_compress_bound(struct libdeflate_parallel_compressor *compressor,
+					size_t in_nbytes);
+
+/*
+ * libdeflate_parallel_bgzf_compress() compresses to BGZF, the "blocked gzip"
+ * format used for genomics data.  BGZF is a series of gzip members, each with
+ * at most 64 KiB of compressed data and an extra field giving the member's
+ * size, followed by an empty member as the end-of-file marker.  Any gzip
+ * decompressor can decompress it, and readers that know the format can seek in
+ * it or decompress its members in parallel.  The members are compressed
+ * independently, so the compression ratio is somewhat worse than with
+ * libdeflate_parallel_gzip_compress().  Returns the compressed size in bytes,
+ * or 0 if the output doesn't fit in 'out_nbytes_avail' bytes.
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_bgzf_compress(struct libdeflate_parallel_compressor *compressor,
+				  const void *in, size_t in_nbytes,
+				  void *out, size_t out_nbytes_avail);
+
+/*
+ * Like libdeflate_parallel_deflate_compress_bound(), but assumes the data will
+ * be compressed with libdeflate_parallel_bgzf_compress().
+ */
+LIBDEFLATEAPI size_t
+libdeflate_parallel_bgzf_compress_bound(struct libdeflate_parallel_compressor *compressor,
+					size_t in_nbytes);
+
+/*
+ * libdeflate_free_parallel_compressor() frees a parallel compressor that was
+ * allocated with libdeflate_alloc_parallel_compressor().  If a NULL pointer is
+ * passed in, no action is taken.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_parallel_compressor(struct libdeflate_parallel_compressor *compressor);
+
+/* ========================================================================== */
+/*                          Parallel decompression                            */
+/* ========================================================================== */
+
+/*
+ * A parallel decompressor decompresses a single DEFLATE, zlib, or gzip stream
+ * using several tasks at once, even if the stream wasn't compressed in
+ * parallel.  It splits the compressed data into chunks, guesses where the first
+ * block of each chunk begins, and decompresses the chunks before the data that
+ * precedes them is known, recording references to that data as markers that
+ * are filled in afterwards.  A guess is only used if the preceding chunk ends
+ * exactly where it was made, so the result is always the same as with a
+ * regular decompressor.
+ *
+ * Only dynamic Huffman blocks are found this way, so long runs of other block
+ * types are decompressed by one task.  Streams with less than 2 MiB of
+ * compressed data are decompressed on the calling thread by a regular
+ * decompressor.  Memory usage is proportional to the number of threads and to
+ * the compression ratio, since each task holds the decompressed data of its
+ * chunk as 16-bit symbols until it's resolved.
+ *
+ * The tasks are run by a task submitter as with parallel compression.
+ */
+struct libdeflate_parallel_decompressor;
+
+/*
+ * libdeflate_alloc_parallel_decompressor() allocates a new parallel
+ * decompressor that decompresses up to 'num_threads' chunks at a time.  The
+ * submitter is handled as by libdeflate_alloc_parallel_compressor().  NULL is
+ * returned if 'num_threads' is 0 or out of memory.
+ */
+LIBDEFLATEAPI struct libdeflate_parallel_decompressor *
+libdeflate_alloc_parallel_decompressor(unsigned int num_threads,
+				       const struct libdeflate_task_submitter *submitter);
+
+/*
+ * Like libdeflate_alloc_parallel_decompressor(), but adds the 'options'
+ * argument.
+ */
+LIBDEFLATEAPI struct libdeflate_parallel_decompressor *
+libdeflate_alloc_parallel_decompressor_ex(unsigned int num_threads,
+					  const struct libdeflate_task_submitter *submitter,
+					  const struct libdeflate_options *options);
+
+/*
+ * libdeflate_parallel_deflate_decompress() is like
+ * libdeflate_deflate_decompress_ex(), but decompresses chunks of the stream in
+ * parallel.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_deflate_decompress(struct libdeflate_parallel_decompressor *decompressor,
+				       const void *in, size_t in_nbytes,
+				       void *out, size_t out_nbytes_avail,
+				       size_t *actual_in_nbytes_ret,
+				       size_t *actual_out_nbytes_ret);
+
+/*
+ * Like libdeflate_parallel_deflate_decompress(), but assumes the zlib wrapper
+ * format instead of raw DEFLATE.  Streams that need a preset dictionary aren't
+ * supported.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_zlib_decompress(struct libdeflate_parallel_decompressor *decompressor,
+				    const void *in, size_t in_nbytes,
+				    void *out, size_t out_nbytes_avail,
+				    size_t *actual_in_nbytes_ret,
+				    size_t *actual_out_nbytes_ret);
+
+/*
+ * Like libdeflate_parallel_deflate_decompress(), but assumes the gzip wrapper
+ * format instead of raw DEFLATE.  Only the first gzip member is decompressed,
+ * as with libdeflate_gzip_decompress_ex().
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_gzip_decompress(struct libdeflate_parallel_decompressor *decompressor,
+				    const void *in, size_t in_nbytes,
+				    void *out, size_t out_nbytes_avail,
+				    size_t *actual_in_nbytes_ret,
+				    size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_parallel_bgzf_decompress() decompresses the run of BGZF members
+ * at the start of 'in', up to the end of the input or the first gzip member
+ * that isn't a BGZF member.  Since each member gives its compressed and
+ * decompressed sizes, the members are divided among the tasks up front and
+ * decompressed independently.  Otherwise this is like
+ * libdeflate_parallel_gzip_decompress(); in particular, 'actual_in_nbytes_ret'
+ * gives where any following data begins.  LIBDEFLATE_BAD_DATA is returned if
+ * 'in' doesn't begin with a BGZF member.
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_bgzf_decompress(struct libdeflate_parallel_decompressor *decompressor,
+				    const void *in, size_t in_nbytes,
+				    void *out, size_t out_nbytes_avail,
+				    size_t *actual_in_nbytes_ret,
+				    size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_parallel_gzip_decompress_members() decompresses all of 'in', which
+ * must be one or more concatenated gzip members, as "gzip -d" would.  It
+ * guesses where the members begin by looking for plausible gzip headers, or
+ * from the sizes in BGZF headers, and has each task decompress a run of members
+ * into the place in 'out' given by the members' ISIZE fields.  If a guess turns
+ * out wrong, the rest of the data is decompressed one member at a time, so the
+ * result is always the same as decompressing the members in order with
+ * libdeflate_gzip_decompress_ex().  'out_nbytes_avail' and
+ * 'actual_out_nbytes_ret' are like in libdeflate_gzip_decompress().
+ */
+LIBDEFLATEAPI enum libdeflate_result
+libdeflate_parallel_gzip_decompress_members(struct libdeflate_parallel_decompressor *decompressor,
+					    const void *in, size_t in_nbytes,
+					    void *out, size_t out_nbytes_avail,
+					    size_t *actual_out_nbytes_ret);
+
+/*
+ * libdeflate_free_parallel_decompressor() frees a parallel decompressor that
+ * was allocated with libdeflate_alloc_parallel_decompressor().  If a NULL
+ * pointer is passed in, no action is taken.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_parallel_decompressor(struct libdeflate_parallel_decompressor *decompressor);
+
+/* ========================================================================== */
+/*                             Per-thread caches                              */
+/* ========================================================================== */
+
+/*
+ * Allocating a compressor is relatively slow, especially at levels 10-14, so
+ * programs that compress many small buffers should reuse compressors rather
+ * than allocate one per call.  These functions do that for them, by caching a
+ * compressor per compression level and a decompressor in each thread.  They
+ * use the default options and the memory allocator that was current when each
+ * object was allocated.  They are only available if libdeflate was built with
+ * LIBDEFLATE_THREAD_CACHE, which is the default except for freestanding builds.
+ */
+
+/*
+ * libdeflate_get_thread_compressor() returns the calling thread's cached
+ * compressor for 'compression_level', allocating it if there isn't one yet.
+ * Returns NULL if out of memory or if the level is invalid.
+ *
+ * The compressor belongs to the cache; don't free it.  It may be freed to make
+ * room for another compressor during a later call to
+ * libdeflate_get_thread_compressor() on the same thread, so use it only until
+ * then.  Other threads never free it, and it is freed when the thread exits.
+ */
+LIBDEFLATEAPI struct libdeflate_compressor *
+libdeflate_get_thread_compressor(int compression_level);
+
+/*
+ * libdeflate_get_thread_decompressor() is like
+ * libdeflate_get_thread_compressor(), but returns the calling thread's cached
+ * decompressor.  The decompressor is small, so it is only freed when the thread
+ * exits or calls libdeflate_free_thread_cache().
+ */
+LIBDEFLATEAPI struct libdeflate_decompressor *
+libdeflate_get_thread_decompressor(void);
+
+/*
+ * libdeflate_free_thread_cache() frees all of the calling thread's cached
+ * objects now, rather than when the thread exits, e.g. before a thread goes
+ * idle for a long time.
+ */
+LIBDEFLATEAPI void
+libdeflate_free_thread_cache(void);
+
+/*
+ * libdeflate_set_thread_cache_limit() sets the limit on the total memory of the
+ * objects cached by all threads, which is 32 MiB by default.  A compressor for
+ * levels 10-14 uses about 9 MiB.  When a thread needs a new object that would
+ * put the total over the limit, it first frees its own least recently used
+ * compressors.  It never frees other threads' objects, which may be in use, and
+ * it still allocates the new object if that isn't enough, so the total can go
+ * over the limit by up to a compressor and a decompressor per thread.  A lower
+ * limit takes effect as new compressors are allocated.
+ */
+LIBDEFLATEAPI void
+libdeflate_set_thread_cache_limit(size_t max_bytes);
+
+/* ========================================================================== */
+/*                                Checksums                                   */
+/* ========================================================================== */
+
+/*
+ * libdeflate_adler32() updates a running Adler-32 checksum with 'len' bytes of
+ * data and returns the updated checksum.  When starting a new checksum, the
+ * required initial value for 'adler' is 1.  This value is also returned when
+ * 'buffer' is specified as NULL.
+ */
+LIBDEFLATEAPI uint32_t
+libdeflate_adler32(uint32_t adler, const void *buffer, size_t len);
+
+
+/*
+ * libdeflate_crc32() updates a running CRC-32 checksum with 'len' bytes of data
+ * and returns the updated checksum.  When starting a new checksum, the required
+ * initial value for 'crc' is 0.  This value is also returned when 'buffer' is
+ * specified as NULL.
+ */
+LIBDEFLATEAPI uint32_t
+libdeflate_crc32(uint32_t crc, const void *buffer, size_t len);
+
+/*
+ * libdeflate_crc32c() and libdeflate_crc64() are like libdeflate_crc32(), but
+ * for CRC-32C (the Castagnoli CRC used by iSCSI and ext4) and for the CRC-64
+ * with the ECMA-182 polynomial that the xz format uses (CRC-64/XZ).  Neither is
+ * used by any of the compression formats; they are provided because they can
+ * use the same fast implementation.
+ */
+LIBDEFLATEAPI uint32_t
+libdeflate_crc32c(uint32_t crc, const void *buffer, size_t len);
+
+LIBDEFLATEAPI uint64_t
+libdeflate_crc64(uint64_t crc, const void *buffer, size_t len);
+
+/*
+ * libdeflate_adler32_copy() and libdeflate_crc32_copy() copy 'len' bytes from
+ * 'src' to 'dst', which must not overlap, and update a running checksum with
+ * them, like memcpy() followed by libdeflate_adler32() or libdeflate_crc32().
+ * But they work in pieces that stay in the CPU cache between the checksum and
+ * the copy, so the data is only read from memory once.
+ */
+LIBDEFLATEAPI uint32_t
+libdeflate_adler32_copy(uint32_t adler, void *dst, const void *src, size_t len);
+
+LIBDEFLATEAPI uint32_t
+libdeflate_crc32_copy(uint32_t crc, void *dst, const void *src, size_t len);
+
+/*
+ * libdeflate_adler32_multi() and libdeflate_crc32_multi() update the 'count'
+ * running checksums in 'checksums' with the data in the corresponding buffers
+ * 'bufs[i]' of length 'lens[i]', like calling libdeflate_adler32() or
+ * libdeflate_crc32() on each buffer in turn, but with less overhead per buffer.
+ *
+ * Only the portable table-driven CRC-32, used where the CPU has no CRC-32
+ * acceleration, works on several buffers at once, which is faster for many
+ * small ones.  Where CRC-32 is accelerated (PCLMULQDQ on x86, or the CRC32 or
+ * PMULL instructions on ARM), and for Adler-32 everywhere, the buffers are
+ * still processed one at a time.  There these functions are no faster than a
+ * loop over libdeflate_crc32() or libdeflate_adler32(), apart from the per-call
+ * overhead.
+ */
+LIBDEFLATEAPI void
+libdeflate_adler32_multi(const void * const bufs[], const size_t lens[],
+			 size_t count, uint32_t checksums[]);
+
+LIBDEFLATEAPI void
+libdeflate_crc32_multi(const void * const bufs[], const size_t lens[],
+		       size_t count, uint32_t checksums[]);
+
+/*
+ * libdeflate_adler32_combine() and libdeflate_crc32_combine() take the
+ * checksums of two consecutive pieces of data, where the second piece is 'len2'
+ * bytes long, and return the checksum of the concatenation of the two pieces.
+ * This allows the checksums of separate pieces to be computed independently,
+ * e.g. on different threads, and merged afterwards.  Each checksum must have
+ * been computed from the standard initial value (1 for Adler-32, 0 for CRC-32).
+ *
+ * These functions take time logarithmic in 'len2' and don't need the data.
+ */
+LIBDEFLATEAPI uint32_t
+libdeflate_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2);
+
+LIBDEFLATEAPI uint32_t
+libdeflate_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/* ========================================================================== */
+/*                           Custom memory allocator                          */
+/* ========================================================================== */
+
+/*
+ * Install a custom memory allocator which libdeflate will use for all memory
+ * allocations by default.  'malloc_func' is a function that must behave like
+ * malloc(), and 'free_func' is a function that must behave like free().
+ *
+ * The per-(de)compressor custom memory allocator that can be specified in
+ * 'struct libdeflate_options' takes priority over this.
+ *
+ * This doesn't affect the free() function that will be used to free
+ * (de)compressors that were already in existence when this is called.
+ */
+LIBDEFLATEAPI void
+libdeflate_set_memory_allocator(void *(*malloc_func)(size_t),
+				void (*free_func)(void *));
+
+/*
+ * The match finding and parsing strategies which 'struct libdeflate_options'
+ * can select.  Compression levels 1, 2-4, 5-7, 8-9, and 10-14 use FASTEST,
+ * GREEDY, LAZY, LAZY2, and NEAR_OPTIMAL respectively.  FASTEST uses a small
+ * hash table of recent match candidates, GREEDY through LAZY2 use hash chains,
+ * and NEAR_OPTIMAL uses binary trees.  If libdeflate was built without
+ * near-optimal parsing support, NEAR_OPTIMAL falls back to LAZY2, just like
+ * levels 10-14 do.
+ *
+ * HUFFMAN_ONLY and RLE aren't used by any compression level; they are like
+ * zlib's Z_HUFFMAN_ONLY and Z_RLE.  HUFFMAN_ONLY doesn't search for matches at
+ * all and just Huffman-codes the literals.  RLE only finds runs of a repeated
+ * byte, i.e. matches at distance 1.  Both are much faster than FASTEST and need
+ * no match finding memory, and they still beat level 0 on most data; RLE is
+ * especially suited to data like image rows where such runs are common.
+ *
+ * ULTRAFAST isn't used by any compression level either.  It is for when even
+ * level 1 is too slow and some compression ratio can be given up for speed.
+ * It checks just one match candidate per position, searches less and less
+ * often while it keeps finding no matches, and always uses the static Huffman
+ * codes, so it never spends time building Huffman codes.  It never uses or
+ * trains libdeflate_huffman_table's.
+ */
+enum libdeflate_strategy {
+	LIBDEFLATE_STRATEGY_DEFAULT = 0,
+	LIBDEFLATE_STRATEGY_FASTEST = 1,
+	LIBDEFLATE_STRATEGY_GREEDY = 2,
+	LIBDEFLATE_STRATEGY_LAZY = 3,
+	LIBDEFLATE_STRATEGY_LAZY2 = 4,
+	LIBDEFLATE_STRATEGY_NEAR_OPTIMAL = 5,
+	LIBDEFLATE_STRATEGY_HUFFMAN_ONLY = 6,
+	LIBDEFLATE_STRATEGY_RLE = 7,
+	LIBDEFLATE_STRATEGY_ULTRAFAST = 8,
+};
+
+/*
+ * Advanced options.  This is the options structure that
+ * libdeflate_alloc_compressor_ex() and libdeflate_alloc_decompressor_ex()
+ * require.  Most users won't need this and should just use the non-"_ex"
+ * functions instead.  If you do need this, it should be initialized like this:
+ *
+ *	struct libdeflate_options options;
+ *
+ *	memset(&options, 0, sizeof(options));
+ *	options.sizeof_options = sizeof(options);
+ *	// Then set the fields that you need to override the defaults for.
+ */
+struct libdeflate_options {
+
+	/*
+	 * This field must be set to the struct size.  This field exists for
+	 * extensibility, so that fields can be appended to this struct in
+	 * future versions of libdeflate while still supporting old binaries.
+	 * Sizes of older versions of this struct are accepted too, in which
+	 * case the fields they lack take their default values.
+	 */
+	size_t sizeof_options;
+
+	/*
+	 * An optional custom memory allocator to use for this (de)compressor.
+	 * 'malloc_func' must be a function that behaves like malloc(), and
+	 * 'free_func' must be a function that behaves like free().
+	 *
+	 * This is useful in cases where a process might have multiple users of
+	 * libdeflate who want to use different memory allocators.  For example,
+	 * a library might want to use libdeflate with a custom memory allocator
+	 * without interfering with user code that might use libdeflate too.
+	 *
+	 * This takes priority over the "global" memory allocator (which by
+	 * default is malloc() and free(), but can be changed by
+	 * libdeflate_set_memory_allocator()).  Moreover, libdeflate will never
+	 * call the "global" memory allocator if a per-(de)compressor custom
+	 * allocator is always given.
+	 */
+	void *(*malloc_func)(size_t);
+	void (*free_func)(void *);
+
+	/*
+	 * The remaining fields are fine-grained compression parameters which
+	 * override those implied by the compression level.  They are only used
+	 * by libdeflate_alloc_compressor_ex() and
+	 * libdeflate_alloc_parallel_compressor_ex(), and they are ignored at
+	 * compression level 0.  A value of 0 in any of them means "use the
+	 * default for the compression level".  If any of them is out of range,
+	 * the compressor allocation fails.
+	 *
+	 * These exist for tuning and experimentation.  The compression levels
+	 * are still the recommended interface; libdeflate may change what the
+	 * levels mean in future versions, but the parameters below will keep
+	 * their meaning as far as the underlying algorithm allows.
+	 */
+
+	/*
+	 * The match finding and parsing strategy.  If set, the other defaults
+	 * are taken from the compression level nearest to 'compression_level'
+	 * which uses this strategy; e.g. level 6 with LIBDEFLATE_STRATEGY_GREEDY
+	 * gets the defaults of level 4.  The lazy strategies double as the
+	 * "lazy matching depth": greedy considers no lazy matches, lazy
+	 * considers one position ahead, and lazy2 considers two.  HUFFMAN_ONLY,
+	 * RLE, and ULTRAFAST take their defaults from level 1.
+	 */
+	enum libdeflate_strategy strategy;
+
+	/*
+	 * The maximum number of match candidates to consider at each position.
+	 * Must be at least 1, or at least 4 with LIBDEFLATE_STRATEGY_LAZY and
+	 * LIBDEFLATE_STRATEGY_LAZY2.  This is unused by
+	 * LIBDEFLATE_STRATEGY_FASTEST and LIBDEFLATE_STRATEGY_ULTRAFAST, whose
+	 * hash tables have a fixed number of candidates, and by
+	 * LIBDEFLATE_STRATEGY_HUFFMAN_ONLY and LIBDEFLATE_STRATEGY_RLE, which
+	 * don't search for candidates.
+	 */
+	unsigned int max_search_depth;
+
+	/*
+	 * As soon as a match of this many bytes is found, it is chosen without
+	 * looking for a longer one.  Must be in the range [3, 258].  This is
+	 * unused by LIBDEFLATE_STRATEGY_HUFFMAN_ONLY, LIBDEFLATE_STRATEGY_RLE,
+	 * and LIBDEFLATE_STRATEGY_ULTRAFAST, which always extends a match as far
+	 * as it goes.
+	 */
+	unsigned int nice_match_length;
+
+	/*
+	 * The number of uncompressed bytes after which the compressor tries to
+	 * end the current block.  Must be at least 5000 and at most 65535 with
+	 * LIBDEFLATE_STRATEGY_FASTEST, LIBDEFLATE_STRATEGY_HUFFMAN_ONLY,
+	 * LIBDEFLATE_STRATEGY_RLE, and LIBDEFLATE_STRATEGY_ULTRAFAST, or at most
+	 * 300000 otherwise.
+	 */
+	unsigned int soft_max_block_length;
+
+	/*
+	 * The maximum number of optimization passes the near-optimal parser
+	 * makes over each block.  This is only used by
+	 * LIBDEFLATE_STRATEGY_NEAR_OPTIMAL.
+	 */
+	unsigned int max_optim_passes;
+
+	/*
+	 * If nonzero, bound the memory used by compressors that use
+	 * LIBDEFLATE_STRATEGY_NEAR_OPTIMAL (levels 10-14) by lowering the
+	 * default soft maximum block length to 65536, at the cost of a slightly
+	 * worse compression ratio.  Their memory usage is proportional to the
+	 * soft maximum block length, which can also be set directly.  The
+	 * memory used by a compressor is at most about:
+	 *
+	 *	level 0:	   5 KiB
+	 *	level 1:	 200 KiB
+	 *	levels 2-9:	 660 KiB
+	 *	levels 10-12:	8.6 MiB, or 2.3 MiB with 'low_memory'
+	 *	level 13:	8.9 MiB, or 2.4 MiB with 'low_memory'
+	 *	level 14:	9.5 MiB, or 2.5 MiB with 'low_memory'
+	 *
+	 * not counting the buffers that streaming compression and trained
+	 * Huffman tables allocate when first used.
+	 */
+	unsigned int low_memory;
+
+	/*
+	 * An optional hardware offload backend, or NULL for none.  Unlike the
+	 * fields above, this is used by decompressors too.  The struct it
+	 * points to is copied at allocation time, but its 'ctx' must stay valid
+	 * for the lifetime of the (de)compressor.  See struct
+	 * libdeflate_backend.
+	 */
+	const struct libdeflate_backend *backend;
+
+	/*
+	 * An optional task submitter for compressors that use
+	 * LIBDEFLATE_STRATEGY_NEAR_OPTIMAL (levels 10-14), or NULL for none.
+	 * With one, each block is optimized while a task finds the matches for
+	 * the next block, so a submitter that runs the task on another thread
+	 * speeds up compression of large buffers, most at level 10.  (At levels
+	 * 13 and 14, it runs only while the blocks chosen by the block split
+	 * search are optimized for the last time.)  The compressed data is the
+	 * same either way.  This uses about 6.3 MiB
+	 * more memory, or 1.4 MiB with 'low_memory'.  The struct is copied at
+	 * allocation time, but the submitter itself must remain usable for the
+	 * lifetime of the compressor.  Since the compressor waits on it, it
+	 * mustn't be shared with anything else running concurrently.  See
+	 * struct libdeflate_task_submitter.  Parallel compressors don't pass
+	 * it on to their chunks' compressors.
+	 */
+	const struct libdeflate_task_submitter *task_submitter;
+
+	/*
+	 * The alignment in bytes of the memory that compressors allocate for
+	 * themselves, or 0 for the default of 64.  Must be 0 or a power of 2;
+	 * values below the default are rounded up to it.  This applies at all
+	 * compression levels.
+	 */
+	unsigned int alloc_alignment;
+
+	/*
+	 * If nonzero, and the compressor is at least 2 MiB in size (levels
+	 * 10-14), ask the operating system to back it with huge pages.  Their
+	 * matchfinder tables, optimum nodes, and match cache are accessed all
+	 * over, so with 4 KiB pages much of the time can go to TLB misses.  The
+	 * memory is then aligned to and rounded up to 2 MiB, and is advised
+	 * with madvise(MADV_HUGEPAGE) before its first use.  This is currently
+	 * only done on Linux, where it matters when transparent huge pages are
+	 * in "madvise" mode; elsewhere this is ignored.
+	 */
+	unsigned int huge_pages;
+
+	/*
+	 * The base 2 logarithm of the sliding window size, like zlib's
+	 * 'windowBits': in the range [9, 15], or 0 for the default of 15 (a
+	 * 32768-byte window).  Matches then refer back fewer than 2^window_bits
+	 * bytes, and zlib streams declare that window size in their header, so
+	 * a decompressor that allocates its window from the header can use
+	 * less memory.  At levels 2-12 the compressor also uses less memory:
+	 * 2^(window_bits + 1) bytes for its hash chains at levels 2-9, or
+	 * 2^(window_bits + 2) bytes for its binary trees at levels 10-14.
+	 * Smaller windows are faster but compress worse, except on data whose
+	 * redundancy is all short-range.  Unlike the fields above, this also
+	 * applies at compression level 0, where it only sets the zlib header.
+	 * A compressor with a window smaller than 32768 bytes doesn't use an
+	 * offload backend.
+	 */
+	unsigned int window_bits;
+
+	/*
+	 * An optional target speed, or NULL for none.  With one, the compressor
+	 * times how long it takes to compress each stretch of up to
+	 * 'soft_max_block_length' bytes, and compresses the next one with the
+	 * parameters of whichever of compression levels 2 up to its own level
+	 * is expected to meet the target.  So when the machine is busy, it
+	 * falls back to faster levels, and when it is idle, it climbs back up
+	 * to its own level, which it starts at.  What it learns carries over
+	 * from call to call.  The compression level must be in the range
+	 * [2, 9] (after applying 'strategy'), since only those levels can
+	 * switch between each other at a block boundary.  Options that override
+	 * the level's parameters apply to its own level only.  The struct is
+	 * copied at allocation time.  See struct libdeflate_rate_control.
+	 * Parallel compressors don't pass it on to their chunks' compressors.
+	 */
+	const struct libdeflate_rate_control *rate_control;
+};
+
+/*
+ * A target speed for a compressor; see libdeflate_options::rate_control.  If
+ * both targets are set, the compressor aims to meet both.
+ */
+struct libdeflate_rate_control {
+
+	/*
+	 * Return the current time in nanoseconds since any fixed point, e.g.
+	 * from clock_gettime(CLOCK_MONOTONIC).  libdeflate doesn't read any
+	 * clock itself.  Must not be NULL.
+	 */
+	uint64_t (*get_time_ns)(void *ctx);
+
+	/* An opaque value passed to get_time_ns() */
+	void *ctx;
+
+	/*
+	 * The number of bytes of input to compress per second, or 0 for no
+	 * target throughput
+	 */
+	uint64_t target_bytes_per_sec;
+
+	/*
+	 * The time in nanoseconds that each call that compresses a buffer may
+	 * take, or 0 for no limit.  The compressor moves to faster levels as
+	 * the budget runs low.  Streaming compression compresses data in
+	 * pieces, each of which gets its own budget.
+	 */
+	uint64_t time_budget_ns;
+};
+
+/*
+ * A hardware offload backend, such as a driver for a compression accelerator.
+ * A (de)compressor that was allocated with one tries it first in
+ * libdeflate_deflate_compress() and libdeflate_deflate_decompress_ex() (and
+ * hence in the zlib and gzip functions built on them), and does the work in
+ * software instead when the buffer is below the backend's size threshold, when
+ * the backend reports failure for any reason, or when the call uses a feature
+ * the backend can't provide.  The latter are: compression level 0, a window
+ * smaller than 32768 bytes, training or using a trained Huffman table, and
+ * decompression with a checkpoint index or a block callback.  Preset
+ * dictionaries and streaming never use the backend.
+ *
+ * The backend's output must be valid raw DEFLATE, but it needn't match what
+ * libdeflate would have produced.  Work done by the backend isn't included in
+ * the compression and decompression statistics.
+ */
+struct libdeflate_backend {
+
+	/*
+	 * This field must be set to the struct size, like
+	 * libdeflate_options::sizeof_options.
+	 */
+	size_t sizeof_backend;
+
+	/* An opaque pointer which is passed to the functions below */
+	void *ctx;
+
+	/*
+	 * Compress 'in' to 'out' as raw DEFLATE, using 'compression_level' as a
+	 * hint.  Return the compressed size in bytes, or 0 if the backend didn't
+	 * compress the data, e.g. because it didn't fit in 'out_nbytes_avail'
+	 * bytes or because of a device error.  On 0, libdeflate compresses the
+	 * data in software, so the result is the same as without the backend.
+	 * NULL means that compression isn't offloaded.
+	 */
+	size_t (*deflate_compress)(void *ctx, int compression_level,
+				   const void *in, size_t in_nbytes,
+				   void *out, size_t out_nbytes_avail);
+
+	/*
+	 * Decompress the raw DEFLATE stream at the start of 'in' to 'out',
+	 * setting '*actual_in_nbytes_ret' and '*actual_out_nbytes_ret' to the
+	 * number of bytes consumed and produced.  These pointers are never NULL.
+	 * Return LIBDEFLATE_SUCCESS if the stream was decompressed in full.  On
+	 * any other value, libdeflate decompresses the data in software, which
+	 * decides the result code; so a backend needn't classify errors, nor
+	 * handle any case it doesn't want to.  NULL means that decompression
+	 * isn't offloaded.
+	 */
+	enum libdeflate_result (*deflate_decompress)(void *ctx,
+						      const void *in,
+						      size_t in_nbytes,
+						      void *out,
+						      size_t out_nbytes_avail,
+						      size_t *actual_in_nbytes_ret,
+						      size_t *actual_out_nbytes_ret);
+
+	/*
+	 * The smallest uncompressed size to offload compression of, and the
+	 * smallest compressed size to offload decompression of.  Offloading
+	 * usually has a fixed cost which makes small buffers faster in software.
+	 */
+	size_t min_compress_nbytes;
+	size_t min_decompress_nbytes;
 };
 
 #ifdef __cplusplus
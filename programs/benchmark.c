@@ -27,7 +27,21 @@
 
 #include "test_util.h"
 
-static const tchar *const optstring = T("0::1::2::3::4::5::6::7::8::9::C:D:eghs:VYZz");
+#ifdef _WIN32
+#  include <process.h>
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+static const tchar *const optstring =
+	T("0::1::2::3::4::5::6::7::8::9::C:D:egho:ps:T:VYZz");
 
 enum format {
 	DEFLATE_FORMAT,
@@ -390,20 +404,27 @@ static void
 show_usage(FILE *fp)
 {
 	fprintf(fp,
-"Usage: %"TS" [-LVL] [-C ENGINE] [-D ENGINE] [-ghVz] [-s SIZE] [FILE]...\n"
+"Usage: %"TS" [-LVL] [-C ENGINE] [-D ENGINE] [-ghpVz] [-o FORMAT] [-s SIZE]\n"
+"       [-T THREADS] [FILE]...\n"
 "Benchmark DEFLATE compression and decompression on the specified FILEs.\n"
 "\n"
 "Options:\n"
 "  -0        no compression\n"
 "  -1        fastest (worst) compression\n"
 "  -6        medium compression (default)\n"
-"  -12       slowest (best) compression\n"
+"  -12       slow compression\n"
+"  -14       slowest (best) compression\n"
 "  -C ENGINE compression engine\n"
 "  -D ENGINE decompression engine\n"
 "  -e        allow chunks to be expanded (implied by -0)\n"
 "  -g        use gzip format instead of raw DEFLATE\n"
 "  -h        print this help\n"
-"  -s SIZE   chunk size\n"
+"  -o FORMAT output format: text (default), json, or csv\n"
+"  -p        report hardware performance counters (Linux only)\n"
+"  -s SIZE   chunk size; also reports per-chunk latency percentiles\n"
+"  -T THREADS\n"
+"            number of threads, each compressing and decompressing all the\n"
+"            data; times are of the slowest thread, throughputs are totals\n"
 "  -V        show version and legal information\n"
 "  -z        use zlib format instead of raw DEFLATE\n"
 "\n", prog_invocation_name);
@@ -427,133 +448,984 @@ show_version(void)
 
 /******************************************************************************/
 
-static int
-do_benchmark(struct file_stream *in, void *original_buf, void *compressed_buf,
-	     void *decompressed_buf, u32 chunk_size,
-	     bool allow_expansion, size_t compressed_buf_size,
-	     struct compressor *compressor,
-	     struct decompressor *decompressor)
-{
-	u64 total_uncompressed_size = 0;
-	u64 total_compressed_size = 0;
-	u64 total_compress_time = 0;
-	u64 total_decompress_time = 0;
-	ssize_t ret;
+/*
+ * Hardware performance counters, read with perf_event_open() on Linux.  Each
+ * benchmark thread opens one group of counters for compression and one for
+ * decompression, enabled only around the calls being measured.  The events are
+ * in one group so that they are always counted over the same time, so they are
+ * limited to what the CPU can count at once.  Events that can't be opened at
+ * all are left out.
+ */
+
+enum perf_event {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	NUM_PERF_EVENTS,
+};
+
+struct perf_group {
+	int fds[NUM_PERF_EVENTS];
+};
+
+struct perf_counts {
+	u64 values[NUM_PERF_EVENTS];
+	bool valid[NUM_PERF_EVENTS];
+};
+
+static void
+perf_group_init(struct perf_group *g)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++)
+		g->fds[i] = -1;
+}
+
+#ifdef __linux__
+static bool
+perf_group_open(struct perf_group *g)
+{
+	static const struct {
+		u32 type;
+		u64 config;
+	} events[NUM_PERF_EVENTS] = {
+		[PERF_CYCLES] = {
+			PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+		},
+		[PERF_INSTRUCTIONS] = {
+			PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+		},
+		[PERF_BRANCH_MISSES] = {
+			PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+		},
+		[PERF_L1D_MISSES] = {
+			PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		},
+		[PERF_LLC_MISSES] = {
+			PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		},
+	};
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.disabled = (i == 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+				   PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+		g->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+				    i == 0 ? -1 : g->fds[0], 0);
+		if (g->fds[0] < 0) {
+			msg_errno("Unable to open hardware performance "
+				  "counters");
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+perf_group_close(struct perf_group *g)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++)
+		if (g->fds[i] >= 0)
+			close(g->fds[i]);
+}
+
+static forceinline void
+perf_group_enable(const struct perf_group *g)
+{
+	ioctl(g->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static forceinline void
+perf_group_disable(const struct perf_group *g)
+{
+	ioctl(g->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * Add the group's counts to 'counts'.  If the group had to share the hardware
+ * counters with other events, the counts are scaled up to estimates for the
+ * whole time the group was enabled.
+ */
+static void
+perf_group_read(const struct perf_group *g, struct perf_counts *counts)
+{
+	struct {
+		u64 nr;
+		u64 time_enabled;
+		u64 time_running;
+		struct {
+			u64 value;
+			u64 id;
+		} values[NUM_PERF_EVENTS];
+	} data;
+	u64 ids[NUM_PERF_EVENTS];
+	u64 j;
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++) {
+		if (g->fds[i] < 0 ||
+		    ioctl(g->fds[i], PERF_EVENT_IOC_ID, &ids[i]) != 0)
+			ids[i] = (u64)-1;
+	}
+	if (read(g->fds[0], &data, sizeof(data)) <
+	    (ssize_t)(3 * sizeof(u64)) ||
+	    data.time_running == 0)
+		return;
+
+	for (j = 0; j < data.nr && j < NUM_PERF_EVENTS; j++) {
+		for (i = 0; i < NUM_PERF_EVENTS; i++) {
+			if (data.values[j].id != ids[i])
+				continue;
+			counts->values[i] += (double)data.values[j].value *
+					     data.time_enabled /
+					     data.time_running;
+			counts->valid[i] = true;
+		}
+	}
+}
+#else /* __linux__ */
+static bool
+perf_group_open(struct perf_group *g)
+{
+	msg("Hardware performance counters are only supported on Linux");
+	return false;
+}
 
-	while ((ret = xread(in, original_buf, chunk_size)) > 0) {
-		u32 original_size = ret;
+static void
+perf_group_close(struct perf_group *g)
+{
+}
+
+static forceinline void
+perf_group_enable(const struct perf_group *g)
+{
+}
+
+static forceinline void
+perf_group_disable(const struct perf_group *g)
+{
+}
+
+static void
+perf_group_read(const struct perf_group *g, struct perf_counts *counts)
+{
+}
+#endif /* !__linux__ */
+
+static void
+add_perf_counts(struct perf_counts *dst, const struct perf_counts *src)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++) {
+		dst->values[i] += src->values[i];
+		dst->valid[i] |= src->valid[i];
+	}
+}
+
+/******************************************************************************/
+
+enum output_format {
+	TEXT_OUTPUT,
+	JSON_OUTPUT,
+	CSV_OUTPUT,
+};
+
+struct benchmark_params {
+	int level;
+	enum format format;
+	const struct engine *compress_engine;
+	const struct engine *decompress_engine;
+	u32 chunk_size;
+	bool allow_expansion;
+	unsigned int num_threads;
+	bool record_latencies;
+	bool use_perf_counters;
+	enum output_format output_format;
+};
+
+/*
+ * A benchmark thread.  Each thread has its own compressor, decompressor, and
+ * buffers, and compresses and decompresses all chunks of the same data.
+ */
+struct benchmark_thread {
+	const struct benchmark_params *params;
+	struct compressor compressor;
+	struct decompressor decompressor;
+	size_t compressed_buf_size;
+	void *compressed_buf;
+	void *decompressed_buf;
+
+	/* The file being benchmarked */
+	const tchar *name;
+	const u8 *data;
+	size_t data_size;
+
+	/* Results */
+	u64 compressed_size;
+	u64 compress_time;
+	u64 decompress_time;
+	u64 *compress_latencies;	/* per chunk, if params->record_latencies */
+	u64 *decompress_latencies;	/* per chunk that was decompressed */
+	size_t num_decompressed_chunks;
+	int ret;
+
+	/* Hardware performance counts, if params->use_perf_counters */
+	struct perf_counts compress_counts;
+	struct perf_counts decompress_counts;
+};
+
+static void
+run_benchmark_thread(struct benchmark_thread *t)
+{
+	const struct benchmark_params *params = t->params;
+	struct perf_group compress_perf;
+	struct perf_group decompress_perf;
+	size_t offset = 0;
+	size_t i = 0;
+
+	t->compressed_size = 0;
+	t->compress_time = 0;
+	t->decompress_time = 0;
+	t->num_decompressed_chunks = 0;
+	memset(&t->compress_counts, 0, sizeof(t->compress_counts));
+	memset(&t->decompress_counts, 0, sizeof(t->decompress_counts));
+	t->ret = -1;
+
+	/* Counters count only the thread that opened them, so open them here. */
+	perf_group_init(&compress_perf);
+	perf_group_init(&decompress_perf);
+	if (params->use_perf_counters &&
+	    (!perf_group_open(&compress_perf) ||
+	     !perf_group_open(&decompress_perf)))
+		goto out;
+
+	for (; offset < t->data_size; offset += params->chunk_size, i++) {
+		const u8 *original_buf = &t->data[offset];
+		u32 original_size = MIN(params->chunk_size,
+					t->data_size - offset);
 		size_t out_nbytes_avail;
 		u32 compressed_size;
 		u64 start_time;
+		u64 elapsed;
 		bool ok;
 
-		total_uncompressed_size += original_size;
-
-		if (allow_expansion) {
-			out_nbytes_avail = compress_bound(compressor,
+		if (params->allow_expansion) {
+			out_nbytes_avail = compress_bound(&t->compressor,
 							  original_size);
-			if (out_nbytes_avail > compressed_buf_size) {
-				msg("%"TS": bug in compress_bound()", in->name);
-				return -1;
+			if (out_nbytes_avail > t->compressed_buf_size) {
+				msg("%"TS": bug in compress_bound()", t->name);
+				goto out;
 			}
 		} else {
 			out_nbytes_avail = original_size - 1;
 		}
 
 		/* Compress the chunk of data. */
+		if (params->use_perf_counters)
+			perf_group_enable(&compress_perf);
 		start_time = timer_ticks();
-		compressed_size = do_compress(compressor,
+		compressed_size = do_compress(&t->compressor,
 					      original_buf,
 					      original_size,
-					      compressed_buf,
+					      t->compressed_buf,
 					      out_nbytes_avail);
-		total_compress_time += timer_ticks() - start_time;
+		elapsed = timer_ticks() - start_time;
+		if (params->use_perf_counters)
+			perf_group_disable(&compress_perf);
+		t->compress_time += elapsed;
+		if (params->record_latencies)
+			t->compress_latencies[i] = elapsed;
 
 		if (compressed_size) {
 			/* Successfully compressed the chunk of data. */
 
 			/* Decompress the data we just compressed and compare
 			 * the result with the original. */
+			if (params->use_perf_counters)
+				perf_group_enable(&decompress_perf);
 			start_time = timer_ticks();
-			ok = do_decompress(decompressor,
-					   compressed_buf, compressed_size,
-					   decompressed_buf, original_size);
-			total_decompress_time += timer_ticks() - start_time;
+			ok = do_decompress(&t->decompressor,
+					   t->compressed_buf, compressed_size,
+					   t->decompressed_buf, original_size);
+			elapsed = timer_ticks() - start_time;
+			if (params->use_perf_counters)
+				perf_group_disable(&decompress_perf);
+			t->decompress_time += elapsed;
+			if (params->record_latencies)
+				t->decompress_latencies[
+					t->num_decompressed_chunks] = elapsed;
+			t->num_decompressed_chunks++;
 
 			if (!ok) {
 				msg("%"TS": failed to decompress data",
-				    in->name);
-				return -1;
+				    t->name);
+				goto out;
 			}
 
-			if (memcmp(original_buf, decompressed_buf,
+			if (memcmp(original_buf, t->decompressed_buf,
 				   original_size) != 0)
 			{
 				msg("%"TS": data did not decompress to "
-				    "original", in->name);
-				return -1;
+				    "original", t->name);
+				goto out;
 			}
 
-			total_compressed_size += compressed_size;
+			t->compressed_size += compressed_size;
 		} else {
 			/*
 			 * The chunk would have compressed to more than
 			 * out_nbytes_avail bytes.
 			 */
-			if (allow_expansion) {
-				msg("%"TS": bug in compress_bound()", in->name);
-				return -1;
+			if (params->allow_expansion) {
+				msg("%"TS": bug in compress_bound()", t->name);
+				goto out;
 			}
-			total_compressed_size += original_size;
+			t->compressed_size += original_size;
 		}
 	}
+	if (params->use_perf_counters) {
+		perf_group_read(&compress_perf, &t->compress_counts);
+		perf_group_read(&decompress_perf, &t->decompress_counts);
+	}
+	t->ret = 0;
+out:
+	perf_group_close(&decompress_perf);
+	perf_group_close(&compress_perf);
+}
 
-	if (ret < 0)
+#ifdef _WIN32
+static unsigned __stdcall
+benchmark_thread_proc(void *arg)
+{
+	run_benchmark_thread(arg);
+	return 0;
+}
+#else
+static void *
+benchmark_thread_proc(void *arg)
+{
+	run_benchmark_thread(arg);
+	return NULL;
+}
+#endif
+
+/*
+ * Run all the benchmark threads concurrently and wait for them to finish.  The
+ * first one runs on the calling thread.
+ */
+static int
+run_benchmark_threads(struct benchmark_thread *threads,
+		      unsigned int num_threads)
+{
+#ifdef _WIN32
+	HANDLE *handles;
+#else
+	pthread_t *handles;
+#endif
+	unsigned int num_started = 1;
+	unsigned int i;
+	int ret = 0;
+
+	if (num_threads == 1) {
+		run_benchmark_thread(&threads[0]);
+		return threads[0].ret;
+	}
+
+	handles = xmalloc(num_threads * sizeof(handles[0]));
+	if (handles == NULL)
+		return -1;
+	for (; num_started < num_threads; num_started++) {
+#ifdef _WIN32
+		handles[num_started] = (HANDLE)_beginthreadex(
+					NULL, 0, benchmark_thread_proc,
+					&threads[num_started], 0, NULL);
+		if (handles[num_started] == 0) {
+#else
+		if (pthread_create(&handles[num_started], NULL,
+				   benchmark_thread_proc,
+				   &threads[num_started]) != 0) {
+#endif
+			msg("Unable to create thread");
+			ret = -1;
+			break;
+		}
+	}
+	run_benchmark_thread(&threads[0]);
+	for (i = 1; i < num_started; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+#else
+		pthread_join(handles[i], NULL);
+#endif
+	}
+	free(handles);
+	if (ret != 0)
 		return ret;
+	for (i = 0; i < num_threads; i++)
+		if (threads[i].ret != 0)
+			return threads[i].ret;
+	return 0;
+}
 
-	if (total_uncompressed_size == 0) {
-		printf("\tFile was empty.\n");
-		return 0;
+/******************************************************************************/
+
+/* Per-chunk latency percentiles, in microseconds */
+struct latency_stats {
+	u64 p50;
+	u64 p99;
+	u64 p999;
+};
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Return the value at the given permille of sorted values (nearest rank). */
+static u64
+get_percentile(const u64 *sorted, size_t n, unsigned int permille)
+{
+	size_t rank = ((u64)n * permille + 999) / 1000;
+
+	return timer_ticks_to_us(sorted[rank != 0 ? rank - 1 : 0]);
+}
+
+/*
+ * Compute the percentiles of the compression or decompression latencies of all
+ * threads' chunks together.  Returns false if there are none or out of memory.
+ */
+static bool
+compute_latency_stats(const struct benchmark_thread *threads,
+		      unsigned int num_threads, bool decompress,
+		      struct latency_stats *stats)
+{
+	const size_t num_chunks = DIV_ROUND_UP(threads[0].data_size,
+					       threads[0].params->chunk_size);
+	size_t total = 0;
+	u64 *all;
+	unsigned int i;
+
+	all = xmalloc(num_threads * num_chunks * sizeof(all[0]));
+	if (all == NULL)
+		return false;
+	for (i = 0; i < num_threads; i++) {
+		const struct benchmark_thread *t = &threads[i];
+
+		if (decompress) {
+			memcpy(&all[total], t->decompress_latencies,
+			       t->num_decompressed_chunks * sizeof(all[0]));
+			total += t->num_decompressed_chunks;
+		} else {
+			memcpy(&all[total], t->compress_latencies,
+			       num_chunks * sizeof(all[0]));
+			total += num_chunks;
+		}
+	}
+	if (total != 0) {
+		qsort(all, total, sizeof(all[0]), cmp_u64);
+		stats->p50 = get_percentile(all, total, 500);
+		stats->p99 = get_percentile(all, total, 990);
+		stats->p999 = get_percentile(all, total, 999);
+	}
+	free(all);
+	return total != 0;
+}
+
+static const char *
+format_name(enum format format)
+{
+	return format == DEFLATE_FORMAT ? "DEFLATE" :
+	       format == ZLIB_FORMAT ? "zlib" : "gzip";
+}
+
+static void
+print_json_string(const tchar *str)
+{
+	putchar('"');
+	for (; *str != 0; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%"TC, *str);
+		else if ((unsigned int)*str < 0x20)
+			printf("\\u%04x", (unsigned int)*str);
+		else
+			printf("%"TC, *str);
+	}
+	putchar('"');
+}
+
+static void
+print_csv_string(const tchar *str)
+{
+	putchar('"');
+	for (; *str != 0; str++) {
+		if (*str == '"')
+			putchar('"');
+		printf("%"TC, *str);
+	}
+	putchar('"');
+}
+
+static void
+print_json_latencies(const char *name, const struct latency_stats *stats)
+{
+	printf(", \"%s\": {\"p50\": %"PRIu64", \"p99\": %"PRIu64
+	       ", \"p999\": %"PRIu64"}", name, stats->p50, stats->p99,
+	       stats->p999);
+}
+
+static void
+print_csv_latencies(const struct latency_stats *stats, bool valid)
+{
+	if (valid)
+		printf(",%"PRIu64",%"PRIu64",%"PRIu64,
+		       stats->p50, stats->p99, stats->p999);
+	else
+		printf(",,,");
+}
+
+/* Counts per byte and per 1000 instructions, computed from perf_counts */
+struct perf_rates {
+	double values[NUM_PERF_EVENTS];
+	bool valid[NUM_PERF_EVENTS];
+};
+
+static const char * const perf_rate_names[NUM_PERF_EVENTS] = {
+	[PERF_CYCLES]		= "cycles_per_byte",
+	[PERF_INSTRUCTIONS]	= "instructions_per_byte",
+	[PERF_BRANCH_MISSES]	= "branch_mpki",
+	[PERF_L1D_MISSES]	= "l1d_mpki",
+	[PERF_LLC_MISSES]	= "llc_mpki",
+};
+
+static void
+compute_perf_rates(const struct perf_counts *counts, u64 nbytes,
+		   struct perf_rates *rates)
+{
+	const double instructions = counts->values[PERF_INSTRUCTIONS];
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++) {
+		if (i == PERF_CYCLES || i == PERF_INSTRUCTIONS) {
+			rates->valid[i] = counts->valid[i] && nbytes != 0;
+			if (rates->valid[i])
+				rates->values[i] = (double)counts->values[i] /
+						   nbytes;
+		} else {
+			/* Misses per 1000 instructions (MPKI) */
+			rates->valid[i] = counts->valid[i] &&
+					  counts->valid[PERF_INSTRUCTIONS] &&
+					  instructions != 0;
+			if (rates->valid[i])
+				rates->values[i] = counts->values[i] * 1000 /
+						   instructions;
+		}
+	}
+}
+
+static void
+print_text_perf_rates(const char *name, const struct perf_rates *rates)
+{
+	static const char * const labels[NUM_PERF_EVENTS] = {
+		[PERF_CYCLES]		= "cycles/byte",
+		[PERF_INSTRUCTIONS]	= "instructions/byte",
+		[PERF_BRANCH_MISSES]	= "branch-miss MPKI",
+		[PERF_L1D_MISSES]	= "L1D-miss MPKI",
+		[PERF_LLC_MISSES]	= "LLC-miss MPKI",
+	};
+	int i;
+
+	printf("\t%s counters:", name);
+	for (i = 0; i < NUM_PERF_EVENTS; i++) {
+		if (rates->valid[i])
+			printf("%s %.3f %s", i ? "," : "", rates->values[i],
+			       labels[i]);
+		else
+			printf("%s %s n/a", i ? "," : "", labels[i]);
 	}
+	printf("\n");
+}
+
+static void
+print_json_perf_rates(const char *prefix, const struct perf_rates *rates)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++)
+		if (rates->valid[i])
+			printf(", \"%s_%s\": %.3f", prefix, perf_rate_names[i],
+			       rates->values[i]);
+}
 
-	if (total_compress_time == 0)
-		total_compress_time = 1;
-	if (total_decompress_time == 0)
-		total_decompress_time = 1;
-
-	printf("\tCompressed %"PRIu64 " => %"PRIu64" bytes (%u.%03u%%)\n",
-	       total_uncompressed_size, total_compressed_size,
-	       (unsigned int)(total_compressed_size * 100 /
-				total_uncompressed_size),
-	       (unsigned int)(total_compressed_size * 100000 /
-				total_uncompressed_size % 1000));
-	printf("\tCompression time: %"PRIu64" ms (%"PRIu64" MB/s)\n",
-	       timer_ticks_to_ms(total_compress_time),
-	       timer_MB_per_s(total_uncompressed_size, total_compress_time));
-	printf("\tDecompression time: %"PRIu64" ms (%"PRIu64" MB/s)\n",
-	       timer_ticks_to_ms(total_decompress_time),
-	       timer_MB_per_s(total_uncompressed_size, total_decompress_time));
+static void
+print_csv_perf_rates(const struct perf_rates *rates)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF_EVENTS; i++) {
+		if (rates->valid[i])
+			printf(",%.3f", rates->values[i]);
+		else
+			printf(",");
+	}
+}
+
+static void
+print_header(const struct benchmark_params *params)
+{
+	int i;
+
+	switch (params->output_format) {
+	case TEXT_OUTPUT:
+		printf("Benchmarking %s compression:\n",
+		       format_name(params->format));
+		printf("\tCompression level: %d\n", params->level);
+		printf("\tChunk size: %"PRIu32"\n", params->chunk_size);
+		printf("\tThreads: %u\n", params->num_threads);
+		printf("\tCompression engine: %"TS"\n",
+		       params->compress_engine->name);
+		printf("\tDecompression engine: %"TS"\n",
+		       params->decompress_engine->name);
+		break;
+	case JSON_OUTPUT:
+		printf("[");
+		break;
+	case CSV_OUTPUT:
+		printf("file,format,level,chunk_size,threads,"
+		       "compress_engine,decompress_engine,"
+		       "uncompressed_size,compressed_size,"
+		       "compress_time_ms,compress_MB_per_s,"
+		       "decompress_time_ms,decompress_MB_per_s,"
+		       "compress_p50_us,compress_p99_us,compress_p999_us,"
+		       "decompress_p50_us,decompress_p99_us,"
+		       "decompress_p999_us");
+		for (i = 0; i < NUM_PERF_EVENTS; i++)
+			printf(",compress_%s", perf_rate_names[i]);
+		for (i = 0; i < NUM_PERF_EVENTS; i++)
+			printf(",decompress_%s", perf_rate_names[i]);
+		printf("\n");
+		break;
+	}
+}
+
+static void
+print_footer(const struct benchmark_params *params, bool any_files)
+{
+	if (params->output_format == JSON_OUTPUT)
+		printf(any_files ? "\n]\n" : "]\n");
+}
 
+/*
+ * Print the results of benchmarking one file.  The time is that of the slowest
+ * thread, and the throughput is the total over all threads.
+ */
+static void
+print_results(const struct benchmark_params *params,
+	      const struct benchmark_thread *threads, const tchar *path,
+	      bool first_file)
+{
+	const unsigned int num_threads = params->num_threads;
+	u64 total_uncompressed_size = threads[0].data_size;
+	u64 total_compressed_size = threads[0].compressed_size;
+	u64 total_compress_time = 1;
+	u64 total_decompress_time = 1;
+	u64 compress_MB_per_s, decompress_MB_per_s;
+	struct latency_stats compress_latency = { 0 };
+	struct latency_stats decompress_latency = { 0 };
+	bool have_compress_latency = false;
+	bool have_decompress_latency = false;
+	struct perf_counts compress_counts = { 0 };
+	struct perf_counts decompress_counts = { 0 };
+	struct perf_rates compress_rates;
+	struct perf_rates decompress_rates;
+	unsigned int i;
+
+	for (i = 0; i < num_threads; i++) {
+		total_compress_time = MAX(total_compress_time,
+					  threads[i].compress_time);
+		total_decompress_time = MAX(total_decompress_time,
+					    threads[i].decompress_time);
+	}
+	compress_MB_per_s = timer_MB_per_s(total_uncompressed_size *
+					   num_threads, total_compress_time);
+	decompress_MB_per_s = timer_MB_per_s(total_uncompressed_size *
+					     num_threads,
+					     total_decompress_time);
+
+	for (i = 0; i < num_threads; i++) {
+		add_perf_counts(&compress_counts, &threads[i].compress_counts);
+		add_perf_counts(&decompress_counts,
+				&threads[i].decompress_counts);
+	}
+	compute_perf_rates(&compress_counts,
+			   total_uncompressed_size * num_threads,
+			   &compress_rates);
+	compute_perf_rates(&decompress_counts,
+			   total_uncompressed_size * num_threads,
+			   &decompress_rates);
+
+	if (params->record_latencies) {
+		have_compress_latency = compute_latency_stats(
+				threads, num_threads, false, &compress_latency);
+		have_decompress_latency = compute_latency_stats(
+				threads, num_threads, true, &decompress_latency);
+	}
+
+	switch (params->output_format) {
+	case TEXT_OUTPUT:
+		if (total_uncompressed_size == 0) {
+			printf("\tFile was empty.\n");
+			break;
+		}
+		printf("\tCompressed %"PRIu64 " => %"PRIu64" bytes (%u.%03u%%)\n",
+		       total_uncompressed_size, total_compressed_size,
+		       (unsigned int)(total_compressed_size * 100 /
+					total_uncompressed_size),
+		       (unsigned int)(total_compressed_size * 100000 /
+					total_uncompressed_size % 1000));
+		printf("\tCompression time: %"PRIu64" ms (%"PRIu64" MB/s)\n",
+		       timer_ticks_to_ms(total_compress_time),
+		       compress_MB_per_s);
+		printf("\tDecompression time: %"PRIu64" ms (%"PRIu64" MB/s)\n",
+		       timer_ticks_to_ms(total_decompress_time),
+		       decompress_MB_per_s);
+		if (have_compress_latency)
+			printf("\tCompression latency per chunk: "
+			       "p50 %"PRIu64" us, p99 %"PRIu64" us, "
+			       "p99.9 %"PRIu64" us\n", compress_latency.p50,
+			       compress_latency.p99, compress_latency.p999);
+		if (have_decompress_latency)
+			printf("\tDecompression latency per chunk: "
+			       "p50 %"PRIu64" us, p99 %"PRIu64" us, "
+			       "p99.9 %"PRIu64" us\n", decompress_latency.p50,
+			       decompress_latency.p99,
+			       decompress_latency.p999);
+		if (params->use_perf_counters) {
+			print_text_perf_rates("Compression", &compress_rates);
+			print_text_perf_rates("Decompression",
+					      &decompress_rates);
+		}
+		break;
+	case JSON_OUTPUT:
+		printf("%s\n  {\"file\": ", first_file ? "" : ",");
+		print_json_string(path);
+		printf(", \"format\": \"%s\", \"level\": %d"
+		       ", \"chunk_size\": %"PRIu32", \"threads\": %u",
+		       format_name(params->format), params->level,
+		       params->chunk_size, num_threads);
+		printf(", \"compress_engine\": ");
+		print_json_string(params->compress_engine->name);
+		printf(", \"decompress_engine\": ");
+		print_json_string(params->decompress_engine->name);
+		printf(", \"uncompressed_size\": %"PRIu64
+		       ", \"compressed_size\": %"PRIu64
+		       ", \"compress_time_ms\": %"PRIu64
+		       ", \"compress_MB_per_s\": %"PRIu64
+		       ", \"decompress_time_ms\": %"PRIu64
+		       ", \"decompress_MB_per_s\": %"PRIu64,
+		       total_uncompressed_size, total_compressed_size,
+		       timer_ticks_to_ms(total_compress_time),
+		       compress_MB_per_s,
+		       timer_ticks_to_ms(total_decompress_time),
+		       decompress_MB_per_s);
+		if (have_compress_latency)
+			print_json_latencies("compress_latency_us",
+					     &compress_latency);
+		if (have_decompress_latency)
+			print_json_latencies("decompress_latency_us",
+					     &decompress_latency);
+		print_json_perf_rates("compress", &compress_rates);
+		print_json_perf_rates("decompress", &decompress_rates);
+		printf("}");
+		break;
+	case CSV_OUTPUT:
+		print_csv_string(path);
+		printf(",%s,%d,%"PRIu32",%u,", format_name(params->format),
+		       params->level, params->chunk_size, num_threads);
+		print_csv_string(params->compress_engine->name);
+		putchar(',');
+		print_csv_string(params->decompress_engine->name);
+		printf(",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64
+		       ",%"PRIu64",%"PRIu64,
+		       total_uncompressed_size, total_compressed_size,
+		       timer_ticks_to_ms(total_compress_time),
+		       compress_MB_per_s,
+		       timer_ticks_to_ms(total_decompress_time),
+		       decompress_MB_per_s);
+		print_csv_latencies(&compress_latency, have_compress_latency);
+		print_csv_latencies(&decompress_latency,
+				    have_decompress_latency);
+		print_csv_perf_rates(&compress_rates);
+		print_csv_perf_rates(&decompress_rates);
+		putchar('\n');
+		break;
+	}
+}
+
+/* Read the entire contents of a file into memory. */
+static int
+read_file(struct file_stream *in, u8 **data_ret, size_t *size_ret)
+{
+	size_t capacity = 1048576;
+	size_t size = 0;
+	u8 *data = xmalloc(capacity);
+	ssize_t ret;
+
+	if (data == NULL)
+		return -1;
+	while ((ret = xread(in, &data[size], capacity - size)) > 0) {
+		size += ret;
+		if (size == capacity) {
+			u8 *new_data = NULL;
+
+			if (capacity <= SIZE_MAX / 2)
+				new_data = realloc(data, capacity * 2);
+			if (new_data == NULL) {
+				msg("%"TS" is too large to be processed by "
+				    "this program", in->name);
+				free(data);
+				return -1;
+			}
+			data = new_data;
+			capacity *= 2;
+		}
+	}
+	if (ret < 0) {
+		free(data);
+		return -1;
+	}
+	*data_ret = data;
+	*size_ret = size;
 	return 0;
 }
 
+static int
+do_benchmark(struct file_stream *in, const tchar *path,
+	     const struct benchmark_params *params,
+	     struct benchmark_thread *threads, bool first_file)
+{
+	size_t num_chunks;
+	u8 *data;
+	size_t size;
+	unsigned int i;
+	int ret;
+
+	ret = read_file(in, &data, &size);
+	if (ret != 0)
+		return ret;
+
+	num_chunks = DIV_ROUND_UP(size, params->chunk_size);
+	for (i = 0; i < params->num_threads; i++) {
+		struct benchmark_thread *t = &threads[i];
+
+		t->name = in->name;
+		t->data = data;
+		t->data_size = size;
+		t->compress_latencies = NULL;
+		t->decompress_latencies = NULL;
+	}
+	ret = -1;
+	if (params->record_latencies) {
+		for (i = 0; i < params->num_threads; i++) {
+			struct benchmark_thread *t = &threads[i];
+
+			t->compress_latencies = xmalloc(num_chunks *
+						sizeof(t->compress_latencies[0]));
+			t->decompress_latencies = xmalloc(num_chunks *
+						sizeof(t->decompress_latencies[0]));
+			if (t->compress_latencies == NULL ||
+			    t->decompress_latencies == NULL)
+				goto out;
+		}
+	}
+
+	ret = run_benchmark_threads(threads, params->num_threads);
+	if (ret == 0)
+		print_results(params, threads, path, first_file);
+out:
+	for (i = 0; i < params->num_threads; i++) {
+		free(threads[i].decompress_latencies);
+		free(threads[i].compress_latencies);
+	}
+	free(data);
+	return ret;
+}
+
+static bool
+benchmark_thread_init(struct benchmark_thread *t,
+		      const struct benchmark_params *params)
+{
+	t->params = params;
+	if (!compressor_init(&t->compressor, params->level, params->format,
+			     params->compress_engine))
+		return false;
+	if (!decompressor_init(&t->decompressor, params->format,
+			       params->decompress_engine))
+		return false;
+
+	if (params->allow_expansion)
+		t->compressed_buf_size = compress_bound(&t->compressor,
+							params->chunk_size);
+	else
+		t->compressed_buf_size = params->chunk_size - 1;
+
+	t->compressed_buf = xmalloc(t->compressed_buf_size);
+	t->decompressed_buf = xmalloc(params->chunk_size);
+	return t->compressed_buf != NULL && t->decompressed_buf != NULL;
+}
+
+static void
+benchmark_thread_destroy(struct benchmark_thread *t)
+{
+	free(t->decompressed_buf);
+	free(t->compressed_buf);
+	decompressor_destroy(&t->decompressor);
+	compressor_destroy(&t->compressor);
+}
+
 int
 tmain(int argc, tchar *argv[])
 {
-	u32 chunk_size = 1048576;
-	int level = 6;
-	enum format format = DEFLATE_FORMAT;
-	const struct engine *compress_engine = &DEFAULT_ENGINE;
-	const struct engine *decompress_engine = &DEFAULT_ENGINE;
-	bool allow_expansion = false;
-	struct compressor compressor = { 0 };
-	struct decompressor decompressor = { 0 };
-	size_t compressed_buf_size;
-	void *original_buf = NULL;
-	void *compressed_buf = NULL;
-	void *decompressed_buf = NULL;
+	struct benchmark_params params = {
+		.level = 6,
+		.format = DEFLATE_FORMAT,
+		.compress_engine = &DEFAULT_ENGINE,
+		.decompress_engine = &DEFAULT_ENGINE,
+		.chunk_size = 1048576,
+		.allow_expansion = false,
+		.num_threads = 1,
+		.record_latencies = false,
+		.use_perf_counters = false,
+		.output_format = TEXT_OUTPUT,
+	};
+	struct benchmark_thread *threads = NULL;
 	tchar *default_file_list[] = { NULL };
 	int opt_char;
+	unsigned int j;
 	int i;
 	int ret;
 
@@ -571,53 +1443,78 @@ tmain(int argc, tchar *argv[])
 		case '7':
 		case '8':
 		case '9':
-			level = parse_compression_level(opt_char, toptarg);
-			if (level < 0)
+			params.level = parse_compression_level(opt_char,
+							       toptarg);
+			if (params.level < 0)
 				return 1;
 			break;
 		case 'C':
-			compress_engine = name_to_engine(toptarg);
-			if (compress_engine == NULL) {
+			params.compress_engine = name_to_engine(toptarg);
+			if (params.compress_engine == NULL) {
 				msg("invalid compression engine: \"%"TS"\"", toptarg);
 				show_available_engines(stderr);
 				return 1;
 			}
 			break;
 		case 'D':
-			decompress_engine = name_to_engine(toptarg);
-			if (decompress_engine == NULL) {
+			params.decompress_engine = name_to_engine(toptarg);
+			if (params.decompress_engine == NULL) {
 				msg("invalid decompression engine: \"%"TS"\"", toptarg);
 				show_available_engines(stderr);
 				return 1;
 			}
 			break;
 		case 'e':
-			allow_expansion = true;
+			params.allow_expansion = true;
 			break;
 		case 'g':
-			format = GZIP_FORMAT;
+			params.format = GZIP_FORMAT;
 			break;
 		case 'h':
 			show_usage(stdout);
 			return 0;
+		case 'o':
+			if (tstrcmp(toptarg, T("text")) == 0) {
+				params.output_format = TEXT_OUTPUT;
+			} else if (tstrcmp(toptarg, T("json")) == 0) {
+				params.output_format = JSON_OUTPUT;
+			} else if (tstrcmp(toptarg, T("csv")) == 0) {
+				params.output_format = CSV_OUTPUT;
+			} else {
+				msg("invalid output format: \"%"TS"\"", toptarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			params.use_perf_counters = true;
+			break;
 		case 's':
-			chunk_size = tstrtoul(toptarg, NULL, 10);
-			if (chunk_size == 0) {
+			params.chunk_size = tstrtoul(toptarg, NULL, 10);
+			if (params.chunk_size == 0) {
 				msg("invalid chunk size: \"%"TS"\"", toptarg);
 				return 1;
 			}
+			params.record_latencies = true;
+			break;
+		case 'T':
+			params.num_threads = tstrtoul(toptarg, NULL, 10);
+			if (params.num_threads == 0) {
+				msg("invalid number of threads: \"%"TS"\"",
+				    toptarg);
+				return 1;
+			}
 			break;
 		case 'V':
 			show_version();
 			return 0;
 		case 'Y': /* deprecated, use '-C libz' instead */
-			compress_engine = &libz_engine;
+			params.compress_engine = &libz_engine;
 			break;
 		case 'Z': /* deprecated, use '-D libz' instead */
-			decompress_engine = &libz_engine;
+			params.decompress_engine = &libz_engine;
 			break;
 		case 'z':
-			format = ZLIB_FORMAT;
+			params.format = ZLIB_FORMAT;
 			break;
 		default:
 			show_usage(stderr);
@@ -628,28 +1525,17 @@ tmain(int argc, tchar *argv[])
 	argc -= toptind;
 	argv += toptind;
 
-	if (level == 0)
-		allow_expansion = true;
+	if (params.level == 0)
+		params.allow_expansion = true;
 
 	ret = -1;
-	if (!compressor_init(&compressor, level, format, compress_engine))
-		goto out;
-	if (!decompressor_init(&decompressor, format, decompress_engine))
-		goto out;
-
-	if (allow_expansion)
-		compressed_buf_size = compress_bound(&compressor, chunk_size);
-	else
-		compressed_buf_size = chunk_size - 1;
-
-	original_buf = xmalloc(chunk_size);
-	compressed_buf = xmalloc(compressed_buf_size);
-	decompressed_buf = xmalloc(chunk_size);
-
-	ret = -1;
-	if (original_buf == NULL || compressed_buf == NULL ||
-	    decompressed_buf == NULL)
+	threads = xmalloc(params.num_threads * sizeof(threads[0]));
+	if (threads == NULL)
 		goto out;
+	memset(threads, 0, params.num_threads * sizeof(threads[0]));
+	for (j = 0; j < params.num_threads; j++)
+		if (!benchmark_thread_init(&threads[j], &params))
+			goto out;
 
 	if (argc == 0) {
 		argv = default_file_list;
@@ -660,13 +1546,7 @@ tmain(int argc, tchar *argv[])
 				argv[i] = NULL;
 	}
 
-	printf("Benchmarking %s compression:\n",
-	       format == DEFLATE_FORMAT ? "DEFLATE" :
-	       format == ZLIB_FORMAT ? "zlib" : "gzip");
-	printf("\tCompression level: %d\n", level);
-	printf("\tChunk size: %"PRIu32"\n", chunk_size);
-	printf("\tCompression engine: %"TS"\n", compress_engine->name);
-	printf("\tDecompression engine: %"TS"\n", decompress_engine->name);
+	print_header(&params);
 
 	for (i = 0; i < argc; i++) {
 		struct file_stream in;
@@ -675,22 +1555,22 @@ tmain(int argc, tchar *argv[])
 		if (ret != 0)
 			goto out;
 
-		printf("Processing %"TS"...\n", in.name);
+		if (params.output_format == TEXT_OUTPUT)
+			printf("Processing %"TS"...\n", in.name);
 
-		ret = do_benchmark(&in, original_buf, compressed_buf,
-				   decompressed_buf, chunk_size,
-				   allow_expansion, compressed_buf_size,
-				   &compressor, &decompressor);
+		ret = do_benchmark(&in, argv[i] != NULL ? argv[i] : T("-"),
+				   &params, threads, i == 0);
 		xclose(&in);
 		if (ret != 0)
 			goto out;
 	}
+	print_footer(&params, argc != 0);
 	ret = 0;
 out:
-	free(decompressed_buf);
-	free(compressed_buf);
-	free(original_buf);
-	decompressor_destroy(&decompressor);
-	compressor_destroy(&compressor);
+	if (threads != NULL) {
+		for (j = 0; j < params.num_threads; j++)
+			benchmark_thread_destroy(&threads[j]);
+		free(threads);
+	}
 	return -ret;
 }
@@ -27,53 +27,103 @@
 
 #include "test_util.h"
 
-static const tchar *const optstring = T("Ahm:s:tZ");
+#include <sys/stat.h>
+#ifdef _WIN32
+#  include <process.h>
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+static const tchar *const optstring = T("AChm:s:tT:XZ");
 
 static void
 show_usage(FILE *fp)
 {
 	fprintf(fp,
-"Usage: %"TS" [-A] [-h] [-m ALIGN] [-s SIZE] [-t] [-Z] [FILE]...\n"
-"Calculate Adler-32 or CRC-32 checksums of the specified FILEs.\n"
+"Usage: %"TS" [-A] [-C] [-h] [-m ALIGN] [-s SIZE] [-t] [-T NUM] [-X] [-Z]\n"
+"          [FILE]...\n"
+"Calculate Adler-32 or CRC checksums of the specified FILEs.\n"
 "\n"
 "Options:\n"
 "  -A        use Adler-32 (default is CRC-32)\n"
+"  -C        use CRC-32C\n"
 "  -h        print this help\n"
 "  -m ALIGN  misalign the buffer by ALIGN bytes\n"
 "  -s SIZE   chunk size in bytes\n"
-"  -t        show checksum speed, excluding I/O\n"
+"  -t        show checksum speed, excluding I/O unless -T is given\n"
+"  -T NUM    checksum each regular file in NUM ranges on NUM threads, then\n"
+"            combine the results (Adler-32 and CRC-32 only)\n"
+"  -X        use CRC-64 (the one in xz)\n"
 "  -Z        use zlib implementation instead of libdeflate\n",
 	prog_invocation_name);
 }
 
-typedef u32 (*cksum_fn_t)(u32, const void *, size_t);
+typedef u64 (*cksum_fn_t)(u64, const void *, size_t);
+typedef u64 (*combine_fn_t)(u64, u64, u64);
 
-static u32
-adler32_libdeflate(u32 adler, const void *buf, size_t len)
+static u64
+adler32_libdeflate(u64 adler, const void *buf, size_t len)
 {
 	return libdeflate_adler32(adler, buf, len);
 }
 
-static u32
-crc32_libdeflate(u32 crc, const void *buf, size_t len)
+static u64
+crc32_libdeflate(u64 crc, const void *buf, size_t len)
 {
 	return libdeflate_crc32(crc, buf, len);
 }
 
-static u32
-adler32_zlib(u32 adler, const void *buf, size_t len)
+static u64
+crc32c_libdeflate(u64 crc, const void *buf, size_t len)
+{
+	return libdeflate_crc32c(crc, buf, len);
+}
+
+static u64
+crc64_libdeflate(u64 crc, const void *buf, size_t len)
+{
+	return libdeflate_crc64(crc, buf, len);
+}
+
+static u64
+adler32_zlib(u64 adler, const void *buf, size_t len)
 {
 	return adler32(adler, buf, len);
 }
 
-static u32
-crc32_zlib(u32 crc, const void *buf, size_t len)
+static u64
+crc32_zlib(u64 crc, const void *buf, size_t len)
 {
 	return crc32(crc, buf, len);
 }
 
+static u64
+adler32_combine_libdeflate(u64 adler1, u64 adler2, u64 len2)
+{
+	return libdeflate_adler32_combine(adler1, adler2, len2);
+}
+
+static u64
+crc32_combine_libdeflate(u64 crc1, u64 crc2, u64 len2)
+{
+	return libdeflate_crc32_combine(crc1, crc2, len2);
+}
+
+static u64
+adler32_combine_zlib(u64 adler1, u64 adler2, u64 len2)
+{
+	return adler32_combine(adler1, adler2, len2);
+}
+
+static u64
+crc32_combine_zlib(u64 crc1, u64 crc2, u64 len2)
+{
+	return crc32_combine(crc1, crc2, len2);
+}
+
 static int
-checksum_stream(struct file_stream *in, cksum_fn_t cksum, u32 *sum,
+checksum_stream(struct file_stream *in, cksum_fn_t cksum, u64 *sum,
 		void *buf, size_t bufsize, u64 *size_ret, u64 *elapsed_ret)
 {
 	u64 size = 0;
@@ -102,18 +152,138 @@ checksum_stream(struct file_stream *in, cksum_fn_t cksum, u32 *sum,
 	return 0;
 }
 
+/* Ranges smaller than this aren't worth a thread of their own. */
+#define MIN_RANGE_SIZE		((size_t)1 << 20)
+
+/* A range of a file that one thread checksums */
+struct range_task {
+	cksum_fn_t cksum;
+	const u8 *data;
+	size_t size;
+	u64 sum;
+};
+
+static void
+checksum_range(struct range_task *task)
+{
+	task->sum = task->cksum(task->cksum(0, NULL, 0), task->data,
+				task->size);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall
+range_thread_proc(void *arg)
+{
+	checksum_range(arg);
+	return 0;
+}
+#else
+static void *
+range_thread_proc(void *arg)
+{
+	checksum_range(arg);
+	return NULL;
+}
+#endif
+
+/*
+ * Checksum the regular file 'in', which is mapped into memory, by splitting it
+ * into up to 'num_threads' ranges, checksumming the ranges concurrently, and
+ * combining their checksums in order.  The first range is done on the calling
+ * thread.  Reading the file is left to the page faults in the threads, so that
+ * it happens in parallel too and is included in the elapsed time.
+ */
+static int
+checksum_mapped_file(struct file_stream *in, cksum_fn_t cksum,
+		     combine_fn_t combine, unsigned int num_threads, u64 *sum,
+		     u64 *size_ret, u64 *elapsed_ret)
+{
+	const u8 *data = in->mmap_mem;
+	size_t size = in->mmap_size;
+	struct range_task *tasks;
+#ifdef _WIN32
+	HANDLE *handles;
+#else
+	pthread_t *handles;
+#endif
+	unsigned int num_started = 1;
+	size_t range_size;
+	u64 start_time;
+	unsigned int i;
+	int ret = 0;
+
+	num_threads = MIN(num_threads, MAX(size / MIN_RANGE_SIZE, 1));
+	range_size = DIV_ROUND_UP(size, num_threads);
+	tasks = xmalloc(num_threads * sizeof(tasks[0]));
+	handles = xmalloc(num_threads * sizeof(handles[0]));
+	if (tasks == NULL || handles == NULL) {
+		ret = -1;
+		goto out;
+	}
+	for (i = 0; i < num_threads; i++) {
+		size_t start = MIN(i * range_size, size);
+
+		tasks[i].cksum = cksum;
+		tasks[i].data = &data[start];
+		tasks[i].size = MIN(range_size, size - start);
+	}
+
+	start_time = timer_ticks();
+	for (; num_started < num_threads; num_started++) {
+#ifdef _WIN32
+		handles[num_started] = (HANDLE)_beginthreadex(
+					NULL, 0, range_thread_proc,
+					&tasks[num_started], 0, NULL);
+		if (handles[num_started] == 0) {
+#else
+		if (pthread_create(&handles[num_started], NULL,
+				   range_thread_proc,
+				   &tasks[num_started]) != 0) {
+#endif
+			msg("Unable to create thread");
+			ret = -1;
+			break;
+		}
+	}
+	checksum_range(&tasks[0]);
+	for (i = 1; i < num_started; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+#else
+		pthread_join(handles[i], NULL);
+#endif
+	}
+	if (ret != 0)
+		goto out;
+	*sum = tasks[0].sum;
+	for (i = 1; i < num_threads; i++)
+		*sum = combine(*sum, tasks[i].sum, tasks[i].size);
+	*elapsed_ret = MAX(timer_ticks() - start_time, 1);
+	*size_ret = size;
+out:
+	free(handles);
+	free(tasks);
+	return ret;
+}
+
 int
 tmain(int argc, tchar *argv[])
 {
 	bool use_adler32 = false;
+	bool use_crc32c = false;
+	bool use_crc64 = false;
 	bool use_zlib_impl = false;
 	bool do_timing = false;
+	unsigned int num_threads = 0;
 	void *orig_buf = NULL;
 	void *buf;
 	size_t misalignment = 0;
 	size_t bufsize = 131072;
 	tchar *default_file_list[] = { NULL };
 	cksum_fn_t cksum;
+	combine_fn_t combine = NULL;
+	int sum_width = 8;
 	int opt_char;
 	int i;
 	int ret;
@@ -125,6 +295,9 @@ tmain(int argc, tchar *argv[])
 		case 'A':
 			use_adler32 = true;
 			break;
+		case 'C':
+			use_crc32c = true;
+			break;
 		case 'h':
 			show_usage(stdout);
 			return 0;
@@ -145,6 +318,17 @@ tmain(int argc, tchar *argv[])
 		case 't':
 			do_timing = true;
 			break;
+		case 'T':
+			num_threads = tstrtoul(toptarg, NULL, 10);
+			if (num_threads == 0 || num_threads > 4096) {
+				msg("invalid number of threads: \"%"TS"\"",
+				    toptarg);
+				return 1;
+			}
+			break;
+		case 'X':
+			use_crc64 = true;
+			break;
 		case 'Z':
 			use_zlib_impl = true;
 			break;
@@ -157,16 +341,38 @@ tmain(int argc, tchar *argv[])
 	argc -= toptind;
 	argv += toptind;
 
+	if ((use_crc32c || use_crc64) && use_zlib_impl) {
+		msg("zlib has no CRC-32C or CRC-64 implementation");
+		return 1;
+	}
+
+	if ((use_crc32c || use_crc64) && num_threads != 0) {
+		msg("-T doesn't support CRC-32C or CRC-64, which can't be "
+		    "combined");
+		return 1;
+	}
+
 	if (use_adler32) {
-		if (use_zlib_impl)
+		if (use_zlib_impl) {
 			cksum = adler32_zlib;
-		else
+			combine = adler32_combine_zlib;
+		} else {
 			cksum = adler32_libdeflate;
+			combine = adler32_combine_libdeflate;
+		}
+	} else if (use_crc32c) {
+		cksum = crc32c_libdeflate;
+	} else if (use_crc64) {
+		cksum = crc64_libdeflate;
+		sum_width = 16;
 	} else {
-		if (use_zlib_impl)
+		if (use_zlib_impl) {
 			cksum = crc32_zlib;
-		else
+			combine = crc32_combine_zlib;
+		} else {
 			cksum = crc32_libdeflate;
+			combine = crc32_combine_libdeflate;
+		}
 	}
 
 	orig_buf = xmalloc(bufsize + 4096 + misalignment);
@@ -185,24 +391,40 @@ tmain(int argc, tchar *argv[])
 
 	for (i = 0; i < argc; i++) {
 		struct file_stream in;
-		u32 sum = cksum(0, NULL, 0);
+		u64 sum = cksum(0, NULL, 0);
 		u64 size = 0;
 		u64 elapsed = 0;
+		stat_t stbuf;
 
 		ret = xopen_for_read(argv[i], true, &in);
 		if (ret != 0)
 			goto out;
 
-		ret = checksum_stream(&in, cksum, &sum, buf, bufsize,
-				      &size, &elapsed);
+		/*
+		 * Only regular files are split into ranges, since the size of
+		 * other files, such as pipes, isn't known in advance.
+		 */
+		if (num_threads != 0 && tfstat(in.fd, &stbuf) == 0 &&
+		    S_ISREG(stbuf.st_mode) && stbuf.st_size != 0) {
+			ret = map_file_contents(&in, stbuf.st_size);
+			if (ret == 0)
+				ret = checksum_mapped_file(&in, cksum, combine,
+							   num_threads, &sum,
+							   &size, &elapsed);
+		} else {
+			ret = checksum_stream(&in, cksum, &sum, buf, bufsize,
+					      &size, &elapsed);
+		}
 		if (ret == 0) {
 			if (do_timing) {
-				printf("%08"PRIx32"\t%"TS"\t"
+				printf("%0*"PRIx64"\t%"TS"\t"
 				       "%"PRIu64" ms\t%"PRIu64" MB/s\n",
-				       sum, in.name, timer_ticks_to_ms(elapsed),
+				       sum_width, sum, in.name,
+				       timer_ticks_to_ms(elapsed),
 				       timer_MB_per_s(size, elapsed));
 			} else {
-				printf("%08"PRIx32"\t%"TS"\t\n", sum, in.name);
+				printf("%0*"PRIx64"\t%"TS"\t\n", sum_width, sum,
+				       in.name);
 			}
 		}
 
@@ -30,8 +30,11 @@
 #include <errno.h>
 #include <sys/stat.h>
 #ifdef _WIN32
+#  include <process.h>
 #  include <sys/utime.h>
+#  include <windows.h>
 #else
+#  include <pthread.h>
 #  include <sys/time.h>
 #  include <unistd.h>
 #  include <utime.h>
@@ -42,6 +45,24 @@
 #define GZIP_MIN_OVERHEAD	(GZIP_MIN_HEADER_SIZE + GZIP_FOOTER_SIZE)
 #define GZIP_ID1		0x1F
 #define GZIP_ID2		0x8B
+#define GZIP_CM_DEFLATE		8
+#define GZIP_FHCRC		0x02
+#define GZIP_FEXTRA		0x04
+#define GZIP_FNAME		0x08
+#define GZIP_FCOMMENT		0x10
+#define GZIP_FRESERVED		0xE0
+#define GZIP_XFL_SLOWEST_COMPRESSION	0x02
+#define GZIP_XFL_FASTEST_COMPRESSION	0x04
+#define GZIP_OS_UNKNOWN		255
+#define BGZF_EOF_MARKER_SIZE	28
+
+/*
+ * The size of the chunks that input that isn't a regular file, such as a pipe,
+ * is read and processed in.  Such input is streamed rather than read into
+ * memory all at once.  This is a multiple of the input size of a BGZF member,
+ * so that BGZF output is the same either way.
+ */
+#define STREAM_CHUNK_SIZE	(16 * 65280)
 
 struct options {
 	bool to_stdout;
@@ -49,23 +70,28 @@ struct options {
 	bool force;
 	bool keep;
 	bool test;
+	bool bgzf;
+	bool parallel;
 	int compression_level;
+	unsigned int num_threads;
 	const tchar *suffix;
 };
 
-static const tchar *const optstring = T("1::2::3::4::5::6::7::8::9::cdfhknqS:tV");
+static const tchar *const optstring = T("1::2::3::4::5::6::7::8::9::bcdfhknp:qS:tV");
 
 static void
 show_usage(FILE *fp)
 {
 	fprintf(fp,
-"Usage: %"TS" [-LEVEL] [-cdfhkqtV] [-S SUF] FILE...\n"
+"Usage: %"TS" [-LEVEL] [-bcdfhkqtV] [-p NUM] [-S SUF] FILE...\n"
 "Compress or decompress the specified FILEs.\n"
 "\n"
 "Options:\n"
 "  -1        fastest (worst) compression\n"
 "  -6        medium compression (default)\n"
-"  -12       slowest (best) compression\n"
+"  -12       slow compression\n"
+"  -14       slowest (best) compression\n"
+"  -b        compress to BGZF, the blocked gzip format, using multiple threads\n"
 "  -c        write to standard output\n"
 "  -d        decompress\n"
 "  -f        overwrite existing output files; (de)compress hard-linked files;\n"
@@ -73,6 +99,8 @@ show_usage(FILE *fp)
 "            with gunzip -c, pass through non-gzipped data\n"
 "  -h        print this help\n"
 "  -k        don't delete input files\n"
+"  -p NUM    use NUM threads (default: number of processors); given explicitly,\n"
+"            also compress each file in chunks on several threads\n"
 "  -q        suppress warnings\n"
 "  -S SUF    use suffix SUF instead of .gz\n"
 "  -t        test file integrity\n"
@@ -146,6 +174,161 @@ append_suffix(const tchar *path, const tchar *suffix)
 	return suffixed_path;
 }
 
+/*
+ * A task submitter for the parallel compressor and decompressor that runs each
+ * task on a new thread, then joins the threads when waited on.  The tasks are
+ * large, so creating the threads costs little by comparison.
+ */
+struct thread_submitter {
+	unsigned int max_threads;
+	unsigned int num_threads;
+	struct thread_task {
+		void (*func)(void *arg);
+		void *arg;
+#ifdef _WIN32
+		HANDLE handle;
+#else
+		pthread_t handle;
+#endif
+	} *tasks;
+};
+
+#ifdef _WIN32
+static unsigned __stdcall
+thread_task_proc(void *arg)
+{
+	struct thread_task *task = arg;
+
+	(*task->func)(task->arg);
+	return 0;
+}
+#else
+static void *
+thread_task_proc(void *arg)
+{
+	struct thread_task *task = arg;
+
+	(*task->func)(task->arg);
+	return NULL;
+}
+#endif
+
+static void
+thread_submit(void *ctx, void (*func)(void *arg), void *arg)
+{
+	struct thread_submitter *ts = ctx;
+	struct thread_task *task;
+
+	/* Run the task on this thread if another one can't be started. */
+	if (ts->num_threads == ts->max_threads) {
+		(*func)(arg);
+		return;
+	}
+	task = &ts->tasks[ts->num_threads];
+	task->func = func;
+	task->arg = arg;
+#ifdef _WIN32
+	task->handle = (HANDLE)_beginthreadex(NULL, 0, thread_task_proc, task,
+					      0, NULL);
+	if (task->handle == 0) {
+#else
+	if (pthread_create(&task->handle, NULL, thread_task_proc, task) != 0) {
+#endif
+		(*func)(arg);
+		return;
+	}
+	ts->num_threads++;
+}
+
+static void
+thread_wait(void *ctx)
+{
+	struct thread_submitter *ts = ctx;
+	unsigned int i;
+
+	for (i = 0; i < ts->num_threads; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(ts->tasks[i].handle, INFINITE);
+		CloseHandle(ts->tasks[i].handle);
+#else
+		pthread_join(ts->tasks[i].handle, NULL);
+#endif
+	}
+	ts->num_threads = 0;
+}
+
+static int
+init_thread_submitter(struct thread_submitter *ts,
+		      struct libdeflate_task_submitter *submitter,
+		      unsigned int num_threads)
+{
+	ts->max_threads = num_threads;
+	ts->num_threads = 0;
+	ts->tasks = xmalloc(num_threads * sizeof(ts->tasks[0]));
+	if (ts->tasks == NULL)
+		return -1;
+	submitter->submit = thread_submit;
+	submitter->wait = thread_wait;
+	submitter->ctx = ts;
+	return 0;
+}
+
+static unsigned int
+get_default_num_threads(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return MAX(info.dwNumberOfProcessors, 1);
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n >= 1 && n <= 1024) ? n : 1;
+#endif
+}
+
+/* Compress to gzip or BGZF with the parallel compressor. */
+static int
+do_compress_parallel(struct libdeflate_parallel_compressor *compressor,
+		     struct file_stream *in, struct file_stream *out, bool bgzf)
+{
+	size_t max_compressed_size;
+	size_t actual_compressed_size;
+	void *compressed_data;
+	int ret;
+
+	if (bgzf)
+		max_compressed_size = libdeflate_parallel_bgzf_compress_bound(
+						compressor, in->mmap_size);
+	else
+		max_compressed_size = libdeflate_parallel_gzip_compress_bound(
+						compressor, in->mmap_size);
+	compressed_data = xmalloc(max_compressed_size);
+	if (compressed_data == NULL) {
+		msg("%"TS": file is probably too large to be processed by this "
+		    "program", in->name);
+		return -1;
+	}
+	if (bgzf)
+		actual_compressed_size = libdeflate_parallel_bgzf_compress(
+					compressor, in->mmap_mem, in->mmap_size,
+					compressed_data, max_compressed_size);
+	else
+		actual_compressed_size = libdeflate_parallel_gzip_compress(
+					compressor, in->mmap_mem, in->mmap_size,
+					compressed_data, max_compressed_size);
+	if (actual_compressed_size == 0) {
+		msg("Bug in libdeflate_parallel_%s_compress_bound()!",
+		    bgzf ? "bgzf" : "gzip");
+		ret = -1;
+	} else {
+		ret = full_write(out, compressed_data, actual_compressed_size);
+	}
+	free(compressed_data);
+	return ret;
+}
+
 static int
 do_compress(struct libdeflate_compressor *compressor,
 	    struct file_stream *in, struct file_stream *out)
@@ -185,7 +368,7 @@ out:
 }
 
 static int
-do_decompress(struct libdeflate_decompressor *decompressor,
+do_decompress(struct libdeflate_parallel_decompressor *decompressor,
 	      struct file_stream *in, struct file_stream *out,
 	      const struct options *options)
 {
@@ -194,7 +377,6 @@ do_decompress(struct libdeflate_decompressor *decompressor,
 	void *uncompressed_data = NULL;
 	size_t uncompressed_size;
 	size_t max_uncompressed_size;
-	size_t actual_in_nbytes;
 	size_t actual_out_nbytes;
 	enum libdeflate_result result;
 	int ret = 0;
@@ -233,7 +415,7 @@ do_decompress(struct libdeflate_decompressor *decompressor,
 	else
 		max_uncompressed_size = SIZE_MAX;
 
-	do {
+	for (;;) {
 		if (uncompressed_data == NULL) {
 			uncompressed_size = MIN(uncompressed_size,
 						max_uncompressed_size);
@@ -246,17 +428,15 @@ do_decompress(struct libdeflate_decompressor *decompressor,
 			}
 		}
 
-		result = libdeflate_gzip_decompress_ex(decompressor,
-						       compressed_data,
-						       compressed_size,
-						       uncompressed_data,
-						       uncompressed_size,
-						       &actual_in_nbytes,
-						       &actual_out_nbytes);
+		/* Decompress all the gzip members, in parallel if possible. */
+		result = libdeflate_parallel_gzip_decompress_members(
+				decompressor, compressed_data, compressed_size,
+				uncompressed_data, uncompressed_size,
+				&actual_out_nbytes);
 
 		if (result == LIBDEFLATE_INSUFFICIENT_SPACE) {
 			if (uncompressed_size >= max_uncompressed_size) {
-				msg("Bug in libdeflate_gzip_decompress_ex(): data expanded too much!");
+				msg("Bug in libdeflate_parallel_gzip_decompress_members(): data expanded too much!");
 				ret = -1;
 				goto out;
 			}
@@ -279,26 +459,414 @@ do_decompress(struct libdeflate_decompressor *decompressor,
 			goto out;
 		}
 
-		if (actual_in_nbytes == 0 ||
-		    actual_in_nbytes > compressed_size ||
-		    actual_out_nbytes > uncompressed_size) {
-			msg("Bug in libdeflate_gzip_decompress_ex(): impossible actual_nbytes value!");
+		if (actual_out_nbytes > uncompressed_size) {
+			msg("Bug in libdeflate_parallel_gzip_decompress_members(): impossible actual_nbytes value!");
+			ret = -1;
+			goto out;
+		}
+
+		if (!options->test)
+			ret = full_write(out, uncompressed_data,
+					 actual_out_nbytes);
+		break;
+	}
+out:
+	free(uncompressed_data);
+	return ret;
+}
+
+/*
+ * Reads a stream in chunks of STREAM_CHUNK_SIZE bytes, with the reads of the
+ * next few chunks running on another thread while the current one is processed
+ */
+struct stream_reader {
+	struct async_io *io;
+	bool eof;
+
+	/* The unprocessed part of the current chunk */
+	const u8 *next;
+	const u8 *end;
+};
+
+static int
+stream_reader_init(struct stream_reader *r, struct file_stream *strm)
+{
+	r->io = async_io_start_reading(strm, STREAM_CHUNK_SIZE);
+	if (r->io == NULL)
+		return -1;
+	r->eof = false;
+	r->next = r->end = NULL;
+	return 0;
+}
+
+static void
+stream_reader_destroy(struct stream_reader *r)
+{
+	async_io_finish(r->io);
+}
+
+/*
+ * Move on to the next chunk, letting the current one's buffer be read into
+ * again.  Return 1 if there is a next chunk, 0 at the end of the stream, or -1
+ * on a read error.
+ */
+static int
+stream_reader_refill(struct stream_reader *r)
+{
+	u8 *buf;
+	ssize_t ret;
+
+	if (r->eof)
+		return 0;
+	ret = async_io_next_chunk(r->io, &buf);
+	if (ret < 0)
+		return -1;
+	if (ret != STREAM_CHUNK_SIZE)
+		r->eof = true;
+	if (ret == 0)
+		return 0;
+	r->next = buf;
+	r->end = buf + ret;
+	return 1;
+}
+
+/*
+ * Copy the next @count bytes of the stream to @buf.  Return 0 if they were all
+ * there, 1 if the stream ended first, or -1 on a read error.
+ */
+static int
+stream_reader_read(struct stream_reader *r, u8 *buf, size_t count)
+{
+	while (count != 0) {
+		size_t n;
+
+		if (r->next == r->end) {
+			int ret = stream_reader_refill(r);
+
+			if (ret <= 0)
+				return ret < 0 ? -1 : 1;
+		}
+		n = MIN(count, (size_t)(r->end - r->next));
+		if (buf != NULL) {
+			memcpy(buf, r->next, n);
+			buf += n;
+		}
+		r->next += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/*
+ * Writes a stream from a few buffers in turn, with the writes of the filled
+ * ones running on another thread while the next one is filled
+ */
+struct stream_writer {
+	struct async_io *io;
+	u8 *buf;
+};
+
+static int
+stream_writer_init(struct stream_writer *w, struct file_stream *strm,
+		   size_t buf_size, bool discard)
+{
+	w->io = async_io_start_writing(strm, buf_size, discard);
+	if (w->io == NULL)
+		return -1;
+	w->buf = async_io_get_buf(w->io);
+	return 0;
+}
+
+/*
+ * Queue the first @count bytes of the current buffer to be written, and move on
+ * to the next buffer.
+ */
+static int
+stream_writer_write(struct stream_writer *w, size_t count)
+{
+	if (async_io_write_chunk(w->io, count) != 0)
+		return -1;
+	w->buf = async_io_get_buf(w->io);
+	return 0;
+}
+
+/* Finish the queued writes, and return whether they all succeeded. */
+static int
+stream_writer_destroy(struct stream_writer *w)
+{
+	return async_io_finish(w->io);
+}
+
+/*
+ * Compress a stream to gzip, or to BGZF if @parallel_compressor is given, one
+ * chunk at a time.  The gzip output is a single member, made with the streaming
+ * compression functions.
+ */
+static int
+do_compress_stream(struct libdeflate_compressor *compressor,
+		   struct libdeflate_parallel_compressor *parallel_compressor,
+		   int compression_level,
+		   struct file_stream *in, struct file_stream *out)
+{
+	struct stream_reader r;
+	struct stream_writer w;
+	size_t buf_size;
+	size_t out_pos = 0;
+	u32 crc = 0;
+	u32 isize = 0;
+	int ret;
+
+	if (parallel_compressor != NULL)
+		buf_size = libdeflate_parallel_bgzf_compress_bound(
+				parallel_compressor, STREAM_CHUNK_SIZE);
+	else
+		buf_size = libdeflate_deflate_compress_stream_bound(
+				compressor, STREAM_CHUNK_SIZE) +
+			   GZIP_MIN_OVERHEAD;
+	if (stream_reader_init(&r, in) != 0)
+		return -1;
+	if (stream_writer_init(&w, out, buf_size, false) != 0) {
+		stream_reader_destroy(&r);
+		return -1;
+	}
+
+	if (parallel_compressor == NULL) {
+		u8 *hdr = w.buf;
+
+		hdr[0] = GZIP_ID1;
+		hdr[1] = GZIP_ID2;
+		hdr[2] = GZIP_CM_DEFLATE;
+		hdr[3] = 0;
+		put_unaligned_le32(0, &hdr[4]);
+		hdr[8] = 0;
+		if (compression_level < 2)
+			hdr[8] = GZIP_XFL_FASTEST_COMPRESSION;
+		else if (compression_level >= 8)
+			hdr[8] = GZIP_XFL_SLOWEST_COMPRESSION;
+		hdr[9] = GZIP_OS_UNKNOWN;
+		out_pos = GZIP_MIN_HEADER_SIZE;
+		libdeflate_deflate_compress_stream_begin(compressor);
+	}
+
+	while ((ret = stream_reader_refill(&r)) > 0) {
+		size_t in_nbytes = r.end - r.next;
+		u8 *out_next = &w.buf[out_pos];
+		size_t actual_out_nbytes;
+
+		if (parallel_compressor != NULL) {
+			/* Leave off the EOF marker until the end. */
+			actual_out_nbytes = libdeflate_parallel_bgzf_compress(
+						parallel_compressor, r.next,
+						in_nbytes, out_next,
+						buf_size - out_pos) -
+					    BGZF_EOF_MARKER_SIZE;
+		} else {
+			crc = libdeflate_crc32(crc, r.next, in_nbytes);
+			isize += in_nbytes;
+			if (libdeflate_deflate_compress_stream_update(
+					compressor, r.next, in_nbytes,
+					out_next, buf_size - out_pos,
+					&actual_out_nbytes) !=
+			    LIBDEFLATE_SUCCESS) {
+				msg("Bug in libdeflate_deflate_compress_stream_bound()!");
+				ret = -1;
+				goto out;
+			}
+		}
+		r.next = r.end;
+		ret = stream_writer_write(&w, out_pos + actual_out_nbytes);
+		if (ret != 0)
+			goto out;
+		out_pos = 0;
+	}
+	if (ret < 0)
+		goto out;
+
+	if (parallel_compressor != NULL) {
+		out_pos += libdeflate_parallel_bgzf_compress(
+				parallel_compressor, NULL, 0,
+				&w.buf[out_pos], buf_size - out_pos);
+	} else {
+		size_t actual_out_nbytes;
+
+		if (libdeflate_deflate_compress_stream_finish(
+				compressor, &w.buf[out_pos],
+				buf_size - out_pos, &actual_out_nbytes) !=
+		    LIBDEFLATE_SUCCESS) {
+			msg("Bug in libdeflate_deflate_compress_stream_bound()!");
 			ret = -1;
 			goto out;
 		}
+		out_pos += actual_out_nbytes;
+		put_unaligned_le32(crc, &w.buf[out_pos]);
+		put_unaligned_le32(isize, &w.buf[out_pos + 4]);
+		out_pos += GZIP_FOOTER_SIZE;
+	}
+	ret = stream_writer_write(&w, out_pos);
+out:
+	stream_reader_destroy(&r);
+	if (stream_writer_destroy(&w) != 0 && ret == 0)
+		ret = -1;
+	return ret;
+}
+
+/* Skip over a gzip header's fields after the first 10 bytes. */
+static int
+skip_gzip_header_fields(struct stream_reader *r, u8 flg)
+{
+	u8 b[2];
+	int ret;
+
+	if (flg & GZIP_FEXTRA) {
+		ret = stream_reader_read(r, b, 2);
+		if (ret == 0)
+			ret = stream_reader_read(r, NULL,
+						 get_unaligned_le16(b));
+		if (ret != 0)
+			return ret;
+	}
+	if (flg & GZIP_FNAME) {
+		do {
+			ret = stream_reader_read(r, b, 1);
+		} while (ret == 0 && b[0] != 0);
+		if (ret != 0)
+			return ret;
+	}
+	if (flg & GZIP_FCOMMENT) {
+		do {
+			ret = stream_reader_read(r, b, 1);
+		} while (ret == 0 && b[0] != 0);
+		if (ret != 0)
+			return ret;
+	}
+	if (flg & GZIP_FHCRC)
+		return stream_reader_read(r, NULL, 2);
+	return 0;
+}
+
+/*
+ * Decompress a stream of one or more gzip members, one chunk at a time, with
+ * the streaming decompression functions
+ */
+static int
+do_decompress_stream(struct libdeflate_decompressor *decompressor,
+		     struct file_stream *in, struct file_stream *out,
+		     const struct options *options)
+{
+	struct stream_reader r;
+	struct stream_writer w;
+	u8 hdr[GZIP_MIN_HEADER_SIZE];
+	bool first = true;
+	int ret;
+
+	if (stream_reader_init(&r, in) != 0)
+		return -1;
+	if (stream_writer_init(&w, out, STREAM_CHUNK_SIZE, options->test) != 0) {
+		stream_reader_destroy(&r);
+		return -1;
+	}
 
-		if (!options->test) {
-			ret = full_write(out, uncompressed_data, actual_out_nbytes);
-			if (ret != 0)
+	for (;;) {
+		size_t out_pos = 0;
+		u32 crc = 0;
+		u32 isize = 0;
+		enum libdeflate_result result;
+
+		/* Header */
+		if (r.next == r.end) {
+			ret = stream_reader_refill(&r);
+			if (ret < 0)
 				goto out;
+			if (ret == 0 && !first)
+				break;
 		}
+		if (first && (r.end - r.next < GZIP_MIN_OVERHEAD ||
+			      r.next[0] != GZIP_ID1 || r.next[1] != GZIP_ID2)) {
+			if (options->force && options->to_stdout) {
+				/* Pass the data through unchanged. */
+				do {
+					memcpy(w.buf, r.next,
+					       r.end - r.next);
+					ret = stream_writer_write(
+						&w, r.end - r.next);
+				} while (ret == 0 &&
+					 (ret = stream_reader_refill(&r)) > 0);
+				goto out;
+			}
+			msg("%"TS": not in gzip format", in->name);
+			ret = -1;
+			goto out;
+		}
+		ret = stream_reader_read(&r, hdr, sizeof(hdr));
+		if (ret < 0)
+			goto out;
+		if (ret > 0 || hdr[0] != GZIP_ID1 || hdr[1] != GZIP_ID2)
+			goto corrupt;
+		if (hdr[2] != GZIP_CM_DEFLATE || (hdr[3] & GZIP_FRESERVED))
+			goto corrupt;
+		ret = skip_gzip_header_fields(&r, hdr[3]);
+		if (ret < 0)
+			goto out;
+		if (ret > 0)
+			goto corrupt;
+		first = false;
+
+		/* Compressed data */
+		if (libdeflate_deflate_decompress_stream_begin(decompressor)
+		    != 0) {
+			msg("%"TS": out of memory", in->name);
+			ret = -1;
+			goto out;
+		}
+		do {
+			size_t actual_in_nbytes, actual_out_nbytes;
+			u8 *out_next = &w.buf[out_pos];
+
+			if (r.next == r.end) {
+				ret = stream_reader_refill(&r);
+				if (ret < 0)
+					goto out;
+				if (ret == 0)
+					goto corrupt;
+			}
+			result = libdeflate_deflate_decompress_stream_update(
+					decompressor, r.next, r.end - r.next,
+					out_next, STREAM_CHUNK_SIZE - out_pos,
+					&actual_in_nbytes, &actual_out_nbytes);
+			if (result != LIBDEFLATE_SUCCESS &&
+			    result != LIBDEFLATE_IN_PROGRESS)
+				goto corrupt;
+			r.next += actual_in_nbytes;
+			crc = libdeflate_crc32(crc, out_next, actual_out_nbytes);
+			isize += actual_out_nbytes;
+			out_pos += actual_out_nbytes;
+			if (out_pos == STREAM_CHUNK_SIZE ||
+			    result == LIBDEFLATE_SUCCESS) {
+				ret = stream_writer_write(&w, out_pos);
+				if (ret != 0)
+					goto out;
+				out_pos = 0;
+			}
+		} while (result != LIBDEFLATE_SUCCESS);
 
-		compressed_data += actual_in_nbytes;
-		compressed_size -= actual_in_nbytes;
+		/* Footer */
+		ret = stream_reader_read(&r, hdr, GZIP_FOOTER_SIZE);
+		if (ret < 0)
+			goto out;
+		if (ret > 0 || get_unaligned_le32(&hdr[0]) != crc ||
+		    get_unaligned_le32(&hdr[4]) != isize)
+			goto corrupt;
+	}
+	ret = 0;
+	goto out;
 
-	} while (compressed_size != 0);
+corrupt:
+	msg("%"TS": file corrupt or not in gzip format", in->name);
+	ret = -1;
 out:
-	free(uncompressed_data);
+	stream_reader_destroy(&r);
+	if (stream_writer_destroy(&w) != 0 && ret == 0)
+		ret = -1;
 	return ret;
 }
 
@@ -380,8 +948,9 @@ restore_metadata(struct file_stream *out, const tchar *newpath,
 }
 
 static int
-decompress_file(struct libdeflate_decompressor *decompressor, const tchar *path,
-		const struct options *options)
+decompress_file(struct libdeflate_decompressor *decompressor,
+		struct libdeflate_parallel_decompressor *parallel_decompressor,
+		const tchar *path, const struct options *options)
 {
 	tchar *oldpath = (tchar *)path;
 	tchar *newpath = NULL;
@@ -448,12 +1017,18 @@ decompress_file(struct libdeflate_decompressor *decompressor, const tchar *path,
 	if (ret != 0)
 		goto out_close_in;
 
-	/* TODO: need a streaming-friendly solution */
-	ret = map_file_contents(&in, stbuf.st_size);
-	if (ret != 0)
-		goto out_close_out;
-
-	ret = do_decompress(decompressor, &in, &out, options);
+	/*
+	 * Stream input that isn't a regular file, such as a pipe, since its
+	 * size isn't known and it could be very large.
+	 */
+	if (!S_ISREG(stbuf.st_mode)) {
+		ret = do_decompress_stream(decompressor, &in, &out, options);
+	} else {
+		ret = map_file_contents(&in, stbuf.st_size);
+		if (ret != 0)
+			goto out_close_out;
+		ret = do_decompress(parallel_decompressor, &in, &out, options);
+	}
 	if (ret != 0)
 		goto out_close_out;
 
@@ -479,8 +1054,9 @@ out_free_paths:
 }
 
 static int
-compress_file(struct libdeflate_compressor *compressor, const tchar *path,
-	      const struct options *options)
+compress_file(struct libdeflate_compressor *compressor,
+	      struct libdeflate_parallel_compressor *parallel_compressor,
+	      const tchar *path, const struct options *options)
 {
 	tchar *newpath = NULL;
 	struct file_stream in;
@@ -520,12 +1096,25 @@ compress_file(struct libdeflate_compressor *compressor, const tchar *path,
 		goto out_close_out;
 	}
 
-	/* TODO: need a streaming-friendly solution */
-	ret = map_file_contents(&in, stbuf.st_size);
-	if (ret != 0)
-		goto out_close_out;
-
-	ret = do_compress(compressor, &in, &out);
+	/*
+	 * Stream input that isn't a regular file, such as a pipe, since its
+	 * size isn't known and it could be very large.
+	 */
+	if (!S_ISREG(stbuf.st_mode)) {
+		ret = do_compress_stream(compressor,
+					 options->bgzf ? parallel_compressor :
+							 NULL,
+					 options->compression_level, &in, &out);
+	} else {
+		ret = map_file_contents(&in, stbuf.st_size);
+		if (ret != 0)
+			goto out_close_out;
+		if (parallel_compressor != NULL)
+			ret = do_compress_parallel(parallel_compressor, &in,
+						   &out, options->bgzf);
+		else
+			ret = do_compress(compressor, &in, &out);
+	}
 	if (ret != 0)
 		goto out_close_out;
 
@@ -547,6 +1136,196 @@ out_free_newpath:
 	return ret;
 }
 
+/*
+ * The files still to be processed.  Several threads can take files from it at
+ * once, so the next file's index is protected by a lock.
+ */
+struct file_queue {
+	tchar **paths;
+	int num_paths;
+	int next;
+#ifdef _WIN32
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+/*
+ * What a thread needs to process files: the compressor or decompressor objects,
+ * with a thread submitter of their own for the parallel ones
+ */
+struct file_worker {
+	struct thread_submitter ts;
+	struct libdeflate_task_submitter submitter;
+	struct libdeflate_compressor *compressor;
+	struct libdeflate_parallel_compressor *parallel_compressor;
+	struct libdeflate_decompressor *decompressor;
+	struct libdeflate_parallel_decompressor *parallel_decompressor;
+	struct file_queue *queue;
+	const struct options *options;
+	int ret;
+};
+
+/* Take the next file from the queue, or return false if there are none left. */
+static bool
+file_queue_next(struct file_queue *q, tchar **path_ret)
+{
+	bool have_path;
+
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&q->lock);
+#else
+	pthread_mutex_lock(&q->lock);
+#endif
+	have_path = (q->next < q->num_paths);
+	if (have_path)
+		*path_ret = q->paths[q->next++];
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&q->lock);
+#else
+	pthread_mutex_unlock(&q->lock);
+#endif
+	return have_path;
+}
+
+static void
+free_file_worker(struct file_worker *w)
+{
+	libdeflate_free_parallel_decompressor(w->parallel_decompressor);
+	libdeflate_free_decompressor(w->decompressor);
+	libdeflate_free_parallel_compressor(w->parallel_compressor);
+	libdeflate_free_compressor(w->compressor);
+	free(w->ts.tasks);
+}
+
+static int
+init_file_worker(struct file_worker *w, struct file_queue *q,
+		 const struct options *options, unsigned int num_threads)
+{
+	memset(w, 0, sizeof(*w));
+	w->queue = q;
+	w->options = options;
+	if (init_thread_submitter(&w->ts, &w->submitter, num_threads) != 0)
+		return -1;
+	if (options->decompress) {
+		/* The regular decompressor is for streams. */
+		w->decompressor = alloc_decompressor();
+		if (w->decompressor == NULL)
+			goto err;
+		w->parallel_decompressor = libdeflate_alloc_parallel_decompressor(
+						num_threads, &w->submitter);
+		if (w->parallel_decompressor == NULL) {
+			msg("Unable to allocate parallel decompressor");
+			goto err;
+		}
+		return 0;
+	}
+	if (options->bgzf || options->parallel) {
+		w->parallel_compressor = libdeflate_alloc_parallel_compressor(
+						options->compression_level,
+						num_threads, &w->submitter);
+		if (w->parallel_compressor == NULL) {
+			msg("Unable to allocate parallel compressor");
+			goto err;
+		}
+	}
+	/* The regular compressor is also for streams. */
+	if (!options->bgzf) {
+		w->compressor = alloc_compressor(options->compression_level);
+		if (w->compressor == NULL)
+			goto err;
+	}
+	return 0;
+
+err:
+	free_file_worker(w);
+	return -1;
+}
+
+/* Process files from the queue until it's empty. */
+static void
+file_worker_proc(void *arg)
+{
+	struct file_worker *w = arg;
+	tchar *path;
+
+	while (file_queue_next(w->queue, &path)) {
+		if (w->options->decompress)
+			w->ret |= -decompress_file(w->decompressor,
+						   w->parallel_decompressor,
+						   path, w->options);
+		else
+			w->ret |= -compress_file(w->compressor,
+						 w->parallel_compressor, path,
+						 w->options);
+	}
+}
+
+/*
+ * Process the files.  With several files, split the threads among several
+ * workers that take files from a shared queue.  Output to standard output has
+ * to be in order, though, so then the files are processed one at a time.
+ */
+static int
+process_files(tchar **paths, int num_paths, const struct options *options)
+{
+	struct file_queue queue;
+	struct file_worker *workers;
+	struct thread_submitter ts;
+	struct libdeflate_task_submitter submitter;
+	unsigned int num_workers = 1;
+	unsigned int i;
+	int ret = 0;
+
+	if (!options->to_stdout || options->test)
+		num_workers = MIN(options->num_threads, (unsigned int)num_paths);
+
+	queue.paths = paths;
+	queue.num_paths = num_paths;
+	queue.next = 0;
+#ifdef _WIN32
+	InitializeSRWLock(&queue.lock);
+#else
+	pthread_mutex_init(&queue.lock, NULL);
+#endif
+	workers = xmalloc(num_workers * sizeof(workers[0]));
+	if (workers == NULL)
+		return 1;
+	for (i = 0; i < num_workers; i++) {
+		if (init_file_worker(&workers[i], &queue, options,
+				     MAX(options->num_threads / num_workers,
+					 1)) != 0) {
+			while (i--)
+				free_file_worker(&workers[i]);
+			free(workers);
+			return 1;
+		}
+	}
+
+	if (num_workers == 1) {
+		file_worker_proc(&workers[0]);
+	} else if (init_thread_submitter(&ts, &submitter, num_workers) == 0) {
+		for (i = 0; i < num_workers; i++)
+			(*submitter.submit)(submitter.ctx, file_worker_proc,
+					    &workers[i]);
+		(*submitter.wait)(submitter.ctx);
+		free(ts.tasks);
+	} else {
+		ret = 1;
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		ret |= workers[i].ret;
+		free_file_worker(&workers[i]);
+	}
+	free(workers);
+#ifndef _WIN32
+	pthread_mutex_destroy(&queue.lock);
+#endif
+	return ret;
+}
+
 int
 tmain(int argc, tchar *argv[])
 {
@@ -563,7 +1342,10 @@ tmain(int argc, tchar *argv[])
 	options.force = false;
 	options.keep = false;
 	options.test = false;
+	options.bgzf = false;
+	options.parallel = false;
 	options.compression_level = 6;
+	options.num_threads = 0;
 	options.suffix = T(".gz");
 
 	while ((opt_char = tgetopt(argc, argv, optstring)) != -1) {
@@ -582,6 +1364,9 @@ tmain(int argc, tchar *argv[])
 			if (options.compression_level < 0)
 				return 1;
 			break;
+		case 'b':
+			options.bgzf = true;
+			break;
 		case 'c':
 			options.to_stdout = true;
 			break;
@@ -605,6 +1390,15 @@ tmain(int argc, tchar *argv[])
 			 *  option as a no-op.
 			 */
 			break;
+		case 'p':
+			options.num_threads = tstrtoul(toptarg, NULL, 10);
+			if (options.num_threads == 0) {
+				msg("invalid number of threads: \"%"TS"\"",
+				    toptarg);
+				return 1;
+			}
+			options.parallel = true;
+			break;
 		case 'q':
 			suppress_warnings = true;
 			break;
@@ -647,30 +1441,16 @@ tmain(int argc, tchar *argv[])
 				argv[i] = NULL;
 	}
 
-	ret = 0;
-	if (options.decompress) {
-		struct libdeflate_decompressor *d;
-
-		d = alloc_decompressor();
-		if (d == NULL)
-			return 1;
-
-		for (i = 0; i < argc; i++)
-			ret |= -decompress_file(d, argv[i], &options);
-
-		libdeflate_free_decompressor(d);
-	} else {
-		struct libdeflate_compressor *c;
-
-		c = alloc_compressor(options.compression_level);
-		if (c == NULL)
-			return 1;
-
-		for (i = 0; i < argc; i++)
-			ret |= -compress_file(c, argv[i], &options);
+	/*
+	 * The parallel compressor's output doesn't depend on the number of
+	 * threads, but it does differ from the regular compressor's.  So that
+	 * the output doesn't depend on the machine, gzip members are compressed
+	 * in parallel only if -p is given.
+	 */
+	if (options.num_threads == 0)
+		options.num_threads = get_default_num_threads();
 
-		libdeflate_free_compressor(c);
-	}
+	ret = process_files(argv, argc, &options);
 
 	switch (ret) {
 	case 0:
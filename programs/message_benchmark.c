@@ -0,0 +1,709 @@
+/*
+ * message_benchmark.c - a benchmark program for small messages and for the
+ * cost of allocating and freeing compressors and decompressors
+ *
+ * Copyright 2016 Eric Biggers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test_util.h"
+
+#ifndef _WIN32
+#  include <sys/resource.h>
+#endif
+
+static const tchar *const optstring = T("c:hl:o:s:t:");
+
+/* The size of each generated corpus, which the messages are taken from */
+#define CORPUS_SIZE		262144
+
+#define MAX_LIST_LEN		32
+
+enum corpus_kind {
+	CORPUS_TEXT,
+	CORPUS_JSON,
+	CORPUS_BINARY,
+	CORPUS_RANDOM,
+	NUM_CORPUS_KINDS,
+};
+
+static const char * const corpus_names[NUM_CORPUS_KINDS] = {
+	[CORPUS_TEXT] = "text",
+	[CORPUS_JSON] = "json",
+	[CORPUS_BINARY] = "binary",
+	[CORPUS_RANDOM] = "random",
+};
+
+struct benchmark_params {
+	int levels[MAX_LIST_LEN];
+	unsigned int num_levels;
+	size_t sizes[MAX_LIST_LEN];
+	unsigned int num_sizes;
+	bool corpora[NUM_CORPUS_KINDS];
+	bool csv;
+	u64 min_ns;
+};
+
+static void
+show_usage(FILE *fp)
+{
+	fprintf(fp,
+"Usage: %"TS" [-c CORPORA] [-h] [-l LEVELS] [-o FORMAT] [-s SIZES] [-t MS]\n"
+"Benchmark the compression and decompression of small messages, and the\n"
+"allocation and freeing of compressors and decompressors, on generated data.\n"
+"Lists are comma-separated.\n"
+"\n"
+"Options:\n"
+"  -c CORPORA  generated data to use: text, json, binary, and/or random\n"
+"              (default: all)\n"
+"  -h          print this help\n"
+"  -l LEVELS   compression levels (default: 0,1,3,6,9,12)\n"
+"  -o FORMAT   output format: text (default) or csv\n"
+"  -s SIZES    message sizes in bytes (default: 64,256,1024,4096)\n"
+"  -t MS       minimum time of each measurement (default: 50)\n"
+"\n"
+"Times are nanoseconds per call.  Peak RSS is that of the whole process so\n"
+"far, so it only grows; list the levels in order of increasing memory usage\n"
+"to see each one's.\n",
+	prog_invocation_name);
+}
+
+/******************************************************************************/
+
+/*
+ * The corpus generators.  They use their own pseudorandom number generator
+ * with a fixed seed, so that they generate the same data on all machines.
+ */
+
+static u32 prng_state;
+
+static u32
+prng_next(void)
+{
+	/* xorshift32 */
+	prng_state ^= prng_state << 13;
+	prng_state ^= prng_state >> 17;
+	prng_state ^= prng_state << 5;
+	return prng_state;
+}
+
+/* Return a number in [0, n) that is more likely to be small */
+static u32
+prng_skewed(u32 n)
+{
+	u32 a = prng_next() % n;
+	u32 b = prng_next() % n;
+
+	return a * b / n;
+}
+
+static const char * const words[] = {
+	"the", "of", "and", "to", "a", "in", "is", "it", "that", "was", "for",
+	"on", "are", "with", "as", "be", "at", "one", "have", "this", "from",
+	"by", "not", "but", "what", "all", "were", "when", "we", "there", "can",
+	"an", "your", "which", "their", "said", "each", "time", "data", "will",
+	"about", "many", "then", "them", "would", "write", "like", "these",
+	"long", "make", "thing", "see", "him", "two", "has", "look", "more",
+	"day", "could", "come", "number", "sound", "most", "people", "over",
+	"know", "water", "than", "call", "first", "who", "may", "down", "side",
+	"been", "now", "find", "compression", "message", "server", "request",
+};
+
+struct corpus_writer {
+	u8 *data;
+	size_t pos;
+};
+
+static void
+put_byte(struct corpus_writer *w, u8 b)
+{
+	if (w->pos < CORPUS_SIZE)
+		w->data[w->pos++] = b;
+}
+
+static void
+put_string(struct corpus_writer *w, const char *s)
+{
+	while (*s)
+		put_byte(w, *s++);
+}
+
+static void
+put_le(struct corpus_writer *w, u32 v, int nbytes)
+{
+	for (; nbytes > 0; nbytes--, v >>= 8)
+		put_byte(w, v);
+}
+
+static const char *
+random_word(void)
+{
+	return words[prng_skewed(ARRAY_LEN(words))];
+}
+
+/* English-like text: sentences of common words, in paragraphs */
+static void
+generate_text(struct corpus_writer *w)
+{
+	while (w->pos < CORPUS_SIZE) {
+		unsigned int num_words = 6 + prng_next() % 15;
+		const char *word = random_word();
+		unsigned int i;
+
+		put_byte(w, word[0] - 'a' + 'A');
+		put_string(w, &word[1]);
+		for (i = 1; i < num_words; i++) {
+			put_string(w, prng_next() % 12 == 0 ? ", " : " ");
+			put_string(w, random_word());
+		}
+		put_string(w, prng_next() % 5 == 0 ? ".\n\n" : ". ");
+	}
+}
+
+/* Log-like JSON records with a fixed schema */
+static void
+generate_json(struct corpus_writer *w)
+{
+	u32 id = 100000;
+	u32 timestamp = 1700000000;
+	char buf[256];
+
+	while (w->pos < CORPUS_SIZE) {
+		id += 1 + prng_next() % 3;
+		timestamp += prng_next() % 60;
+		sprintf(buf, "{\"id\":%u,\"ts\":%u,\"user\":\"%s_%s\","
+			"\"tags\":[\"%s\",\"%s\"],\"score\":%u.%02u,"
+			"\"active\":%s}\n",
+			(unsigned)id, (unsigned)timestamp, random_word(),
+			random_word(), random_word(), random_word(),
+			(unsigned)prng_skewed(1000),
+			(unsigned)(prng_next() % 100),
+			prng_next() % 4 ? "true" : "false");
+		put_string(w, buf);
+	}
+}
+
+/*
+ * Binary records like those of a telemetry protocol: a fixed header, counters
+ * that increase, and sensor values that change by small steps
+ */
+static void
+generate_binary(struct corpus_writer *w)
+{
+	u32 seq = 0;
+	u32 timestamp = 0;
+	u32 values[6] = { 0 };
+	int i;
+
+	while (w->pos < CORPUS_SIZE) {
+		put_le(w, 0xBEEF, 2);
+		put_byte(w, prng_skewed(4));
+		put_byte(w, prng_next() % 8 == 0 ? 0x80 : 0);
+		put_le(w, seq++, 4);
+		timestamp += 1000 + prng_next() % 16;
+		put_le(w, timestamp, 4);
+		for (i = 0; i < 6; i++) {
+			values[i] += (prng_next() % 7) - 3;
+			put_le(w, values[i], 2);
+		}
+		put_le(w, prng_next(), 4);
+	}
+}
+
+static void
+generate_random(struct corpus_writer *w)
+{
+	while (w->pos < CORPUS_SIZE)
+		put_byte(w, prng_next());
+}
+
+static void
+generate_corpus(enum corpus_kind kind, u8 *data)
+{
+	struct corpus_writer w = { data, 0 };
+
+	prng_state = 0x12345678 + kind;
+	switch (kind) {
+	case CORPUS_TEXT:
+		generate_text(&w);
+		break;
+	case CORPUS_JSON:
+		generate_json(&w);
+		break;
+	case CORPUS_BINARY:
+		generate_binary(&w);
+		break;
+	default:
+		generate_random(&w);
+		break;
+	}
+}
+
+/******************************************************************************/
+
+/* Return the peak resident set size of this process in KiB, or 0 if unknown. */
+static u64
+get_peak_rss_kib(void)
+{
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#  ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#  else
+	return usage.ru_maxrss;
+#  endif
+#endif
+}
+
+/* The average number of ticks that reading the timer twice takes */
+static u64 timer_overhead;
+
+static void
+measure_timer_overhead(void)
+{
+	u64 total = 0;
+	int i;
+
+	for (i = 0; i < 10000; i++) {
+		u64 start = timer_ticks();
+
+		total += timer_ticks() - start;
+	}
+	timer_overhead = total / 10000;
+}
+
+/* Return the ticks elapsed since @start, not counting the timer's overhead. */
+static u64
+ticks_since(u64 start)
+{
+	u64 elapsed = timer_ticks() - start;
+
+	return elapsed > timer_overhead ? elapsed - timer_overhead : 0;
+}
+
+struct lifecycle_result {
+	size_t instance_size;
+	u64 alloc_ns;
+	u64 free_ns;
+};
+
+/* Counts the bytes that libdeflate allocates with count_malloc() */
+static size_t allocated_bytes;
+
+static void *
+count_malloc(size_t size)
+{
+	allocated_bytes += size;
+	return malloc(size);
+}
+
+/*
+ * Time allocating and freeing a compressor of level @level, or a decompressor
+ * if @level < 0.  Each call is timed on its own, so that at most one instance
+ * exists at a time and the peak RSS isn't inflated.
+ */
+static void
+measure_lifecycle(int level, const struct benchmark_params *params,
+		  struct lifecycle_result *res)
+{
+	u64 alloc_ticks = 0, free_ticks = 0;
+	u64 num_calls = 0;
+
+	if (level >= 0) {
+		res->instance_size = libdeflate_compressor_memory_size(level,
+								       NULL);
+	} else {
+		struct libdeflate_options options = {
+			.sizeof_options = sizeof(options),
+			.malloc_func = count_malloc,
+			.free_func = free,
+		};
+
+		allocated_bytes = 0;
+		libdeflate_free_decompressor(
+			libdeflate_alloc_decompressor_ex(&options));
+		res->instance_size = allocated_bytes;
+	}
+
+	do {
+		struct libdeflate_compressor *c = NULL;
+		struct libdeflate_decompressor *d = NULL;
+		u64 start;
+
+		start = timer_ticks();
+		if (level >= 0)
+			c = libdeflate_alloc_compressor(level);
+		else
+			d = libdeflate_alloc_decompressor();
+		alloc_ticks += ticks_since(start);
+		ASSERT(c != NULL || d != NULL);
+
+		start = timer_ticks();
+		if (level >= 0)
+			libdeflate_free_compressor(c);
+		else
+			libdeflate_free_decompressor(d);
+		free_ticks += ticks_since(start);
+		num_calls++;
+	} while (timer_ticks_to_ns(alloc_ticks + free_ticks) < params->min_ns);
+
+	res->alloc_ns = timer_ticks_to_ns(alloc_ticks) / num_calls;
+	res->free_ns = timer_ticks_to_ns(free_ticks) / num_calls;
+}
+
+struct message_result {
+	u64 compressed_nbytes;
+	u64 original_nbytes;
+	u64 compress_ns;
+	u64 decompress_ns;
+};
+
+/*
+ * The number of calls between reads of the timer when timing compression and
+ * decompression, so that reading it costs little per call
+ */
+#define CALLS_PER_TIMER_READ	16
+
+/*
+ * Compress and decompress the messages of size @size that @corpus divides into,
+ * one after another, cycling through them until the minimum time has passed.
+ * Using different messages keeps the branch predictors from learning one.
+ */
+static void
+measure_messages(struct libdeflate_compressor *c,
+		 struct libdeflate_decompressor *d, const u8 *corpus,
+		 size_t size, const struct benchmark_params *params,
+		 struct message_result *res)
+{
+	const size_t num_msgs = CORPUS_SIZE / size;
+	const size_t bound = libdeflate_deflate_compress_bound(c, size);
+	u8 *compressed = xmalloc(num_msgs * bound);
+	size_t *csizes = xmalloc(num_msgs * sizeof(csizes[0]));
+	u8 *decompressed = xmalloc(size);
+	u64 num_calls, start, elapsed;
+	size_t i;
+	int j;
+
+	ASSERT(compressed != NULL && csizes != NULL && decompressed != NULL);
+
+	/* Compress each message once, for the ratio and for decompression. */
+	res->compressed_nbytes = 0;
+	res->original_nbytes = num_msgs * size;
+	for (i = 0; i < num_msgs; i++) {
+		csizes[i] = libdeflate_deflate_compress(c, &corpus[i * size],
+							size,
+							&compressed[i * bound],
+							bound);
+		ASSERT(csizes[i] != 0);
+		res->compressed_nbytes += csizes[i];
+	}
+
+	num_calls = 0;
+	i = 0;
+	start = timer_ticks();
+	do {
+		for (j = 0; j < CALLS_PER_TIMER_READ; j++) {
+			ASSERT(libdeflate_deflate_compress(
+					c, &corpus[i * size], size,
+					&compressed[i * bound], bound) ==
+			       csizes[i]);
+			i = (i + 1 == num_msgs) ? 0 : i + 1;
+		}
+		num_calls += CALLS_PER_TIMER_READ;
+		elapsed = timer_ticks_to_ns(timer_ticks() - start);
+	} while (elapsed < params->min_ns);
+	res->compress_ns = elapsed / num_calls;
+
+	num_calls = 0;
+	i = 0;
+	start = timer_ticks();
+	do {
+		for (j = 0; j < CALLS_PER_TIMER_READ; j++) {
+			ASSERT(libdeflate_deflate_decompress(
+					d, &compressed[i * bound], csizes[i],
+					decompressed, size, NULL) ==
+			       LIBDEFLATE_SUCCESS);
+			i = (i + 1 == num_msgs) ? 0 : i + 1;
+		}
+		num_calls += CALLS_PER_TIMER_READ;
+		elapsed = timer_ticks_to_ns(timer_ticks() - start);
+	} while (elapsed < params->min_ns);
+	res->decompress_ns = elapsed / num_calls;
+
+	ASSERT(memcmp(decompressed, &corpus[((i + num_msgs - 1) % num_msgs) *
+					    size], size) == 0);
+	free(decompressed);
+	free(csizes);
+	free(compressed);
+}
+
+/* Format the compressed size as a percentage of the original size. */
+static void
+print_ratio(const struct message_result *res)
+{
+	u64 permille = res->compressed_nbytes * 1000 / res->original_nbytes;
+
+	printf("%3u.%u%%", (unsigned)(permille / 10), (unsigned)(permille % 10));
+}
+
+static void
+run_benchmark(const struct benchmark_params *params, u8 *corpora[])
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	struct lifecycle_result dres;
+	unsigned int i, j;
+	int k;
+
+	ASSERT(d != NULL);
+	measure_lifecycle(-1, params, &dres);
+	if (params->csv) {
+		printf("corpus,level,size,compressed_size_permille,"
+		       "compress_ns,decompress_ns,compressor_bytes,"
+		       "compressor_alloc_ns,compressor_free_ns,"
+		       "decompressor_bytes,decompressor_alloc_ns,"
+		       "decompressor_free_ns,peak_rss_kib\n");
+	} else {
+		printf("Decompressor: %"PRIu64" bytes, alloc %"PRIu64" ns, "
+		       "free %"PRIu64" ns\n\n",
+		       (u64)dres.instance_size, dres.alloc_ns, dres.free_ns);
+	}
+
+	for (i = 0; i < params->num_levels; i++) {
+		const int level = params->levels[i];
+		struct libdeflate_compressor *c;
+		struct lifecycle_result cres;
+
+		measure_lifecycle(level, params, &cres);
+		c = libdeflate_alloc_compressor(level);
+		ASSERT(c != NULL);
+		if (!params->csv) {
+			printf("Level %d: %"PRIu64" bytes, alloc %"PRIu64" ns, "
+			       "free %"PRIu64" ns\n", level,
+			       (u64)cres.instance_size, cres.alloc_ns,
+			       cres.free_ns);
+			printf("  %-7s %6s %7s %12s %14s %20s\n", "Corpus",
+			       "Size", "Ratio", "Compress ns", "Decompress ns",
+			       "Alloc+compress+free");
+		}
+		for (k = 0; k < NUM_CORPUS_KINDS; k++) {
+			if (!params->corpora[k])
+				continue;
+			for (j = 0; j < params->num_sizes; j++) {
+				const size_t size = params->sizes[j];
+				struct message_result mres;
+
+				measure_messages(c, d, corpora[k], size,
+						 params, &mres);
+				if (params->csv) {
+					printf("%s,%d,%"PRIu64",%"PRIu64","
+					       "%"PRIu64",%"PRIu64",%"PRIu64","
+					       "%"PRIu64",%"PRIu64",%"PRIu64","
+					       "%"PRIu64",%"PRIu64",%"PRIu64"\n",
+					       corpus_names[k], level,
+					       (u64)size,
+					       mres.compressed_nbytes * 1000 /
+					       mres.original_nbytes,
+					       mres.compress_ns,
+					       mres.decompress_ns,
+					       (u64)cres.instance_size,
+					       cres.alloc_ns, cres.free_ns,
+					       (u64)dres.instance_size,
+					       dres.alloc_ns, dres.free_ns,
+					       get_peak_rss_kib());
+					continue;
+				}
+				printf("  %-7s %6"PRIu64" ", corpus_names[k],
+				       (u64)size);
+				print_ratio(&mres);
+				printf(" %12"PRIu64" %14"PRIu64" %20"PRIu64"\n",
+				       mres.compress_ns, mres.decompress_ns,
+				       cres.alloc_ns + mres.compress_ns +
+				       cres.free_ns);
+			}
+		}
+		if (!params->csv) {
+			u64 rss = get_peak_rss_kib();
+
+			if (rss != 0)
+				printf("  Peak RSS: %"PRIu64" KiB\n", rss);
+			printf("\n");
+		}
+		libdeflate_free_compressor(c);
+	}
+	libdeflate_free_decompressor(d);
+}
+
+/*
+ * Parse a comma-separated list of numbers no greater than @max into @list.
+ * Return the number of entries, or 0 if the list is invalid.
+ */
+static unsigned int
+parse_number_list(const tchar *arg, u32 max, u32 list[MAX_LIST_LEN])
+{
+	unsigned int n = 0;
+
+	for (;;) {
+		tchar *end;
+		unsigned long v = tstrtoul(arg, &end, 10);
+
+		if (end == arg || v > max || n == MAX_LIST_LEN)
+			return 0;
+		list[n++] = v;
+		if (*end == '\0')
+			return n;
+		if (*end != ',')
+			return 0;
+		arg = end + 1;
+	}
+}
+
+/* Parse a comma-separated list of corpus names into @corpora. */
+static bool
+parse_corpus_list(const tchar *arg, bool corpora[NUM_CORPUS_KINDS])
+{
+	memset(corpora, 0, NUM_CORPUS_KINDS * sizeof(corpora[0]));
+	for (;;) {
+		int k;
+
+		for (k = 0; k < NUM_CORPUS_KINDS; k++) {
+			const char *name = corpus_names[k];
+			size_t len = strlen(name);
+			size_t i;
+
+			for (i = 0; i < len && arg[i] == (tchar)name[i]; i++)
+				;
+			if (i == len && (arg[len] == ',' || arg[len] == '\0'))
+				break;
+		}
+		if (k == NUM_CORPUS_KINDS)
+			return false;
+		corpora[k] = true;
+		arg += strlen(corpus_names[k]);
+		if (*arg == '\0')
+			return true;
+		arg++;
+	}
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const int default_levels[] = { 0, 1, 3, 6, 9, 12 };
+	static const size_t default_sizes[] = { 64, 256, 1024, 4096 };
+	struct benchmark_params params;
+	u8 *corpora[NUM_CORPUS_KINDS];
+	u32 list[MAX_LIST_LEN];
+	unsigned int i;
+	int opt_char;
+	int k;
+
+	begin_program(argv);
+
+	memset(&params, 0, sizeof(params));
+	for (i = 0; i < ARRAY_LEN(default_levels); i++)
+		params.levels[i] = default_levels[i];
+	params.num_levels = ARRAY_LEN(default_levels);
+	for (i = 0; i < ARRAY_LEN(default_sizes); i++)
+		params.sizes[i] = default_sizes[i];
+	params.num_sizes = ARRAY_LEN(default_sizes);
+	for (k = 0; k < NUM_CORPUS_KINDS; k++)
+		params.corpora[k] = true;
+	params.min_ns = 50000000;
+
+	while ((opt_char = tgetopt(argc, argv, optstring)) != -1) {
+		switch (opt_char) {
+		case 'c':
+			if (!parse_corpus_list(toptarg, params.corpora)) {
+				msg("invalid corpus list: \"%"TS"\"", toptarg);
+				return 1;
+			}
+			break;
+		case 'h':
+			show_usage(stdout);
+			return 0;
+		case 'l':
+			params.num_levels = parse_number_list(toptarg, 14,
+							      list);
+			if (params.num_levels == 0) {
+				msg("invalid level list: \"%"TS"\"", toptarg);
+				return 1;
+			}
+			for (i = 0; i < params.num_levels; i++)
+				params.levels[i] = list[i];
+			break;
+		case 'o':
+			if (tstrcmp(toptarg, T("csv")) == 0) {
+				params.csv = true;
+			} else if (tstrcmp(toptarg, T("text")) == 0) {
+				params.csv = false;
+			} else {
+				msg("invalid output format: \"%"TS"\"",
+				    toptarg);
+				return 1;
+			}
+			break;
+		case 's':
+			params.num_sizes = parse_number_list(toptarg,
+							     CORPUS_SIZE,
+							     list);
+			for (i = 0; i < params.num_sizes; i++)
+				if (list[i] == 0)
+					params.num_sizes = 0;
+			if (params.num_sizes == 0) {
+				msg("invalid size list: \"%"TS"\"", toptarg);
+				return 1;
+			}
+			for (i = 0; i < params.num_sizes; i++)
+				params.sizes[i] = list[i];
+			break;
+		case 't':
+			params.min_ns = (u64)tstrtoul(toptarg, NULL, 10) *
+					1000000;
+			if (params.min_ns == 0) {
+				msg("invalid time: \"%"TS"\"", toptarg);
+				return 1;
+			}
+			break;
+		default:
+			show_usage(stderr);
+			return 1;
+		}
+	}
+
+	for (k = 0; k < NUM_CORPUS_KINDS; k++) {
+		corpora[k] = xmalloc(CORPUS_SIZE);
+		if (corpora[k] == NULL)
+			return 1;
+		generate_corpus(k, corpora[k]);
+	}
+	measure_timer_overhead();
+	run_benchmark(&params, corpora);
+	for (k = 0; k < NUM_CORPUS_KINDS; k++)
+		free(corpora[k]);
+	return 0;
+}
@@ -31,8 +31,10 @@
 #include <fcntl.h>
 #include <stdarg.h>
 #ifdef _WIN32
+#  include <process.h>
 #  include <windows.h>
 #else
+#  include <pthread.h>
 #  include <unistd.h>
 #  include <sys/mman.h>
 #endif
@@ -456,6 +458,312 @@ xclose(struct file_stream *strm)
 	return ret;
 }
 
+/*
+ * An async_io reads a stream into, or writes it from, a ring of
+ * ASYNC_IO_NUM_BUFS chunk buffers.  One thread does all the I/O for the stream,
+ * in order, so that several chunks can be in flight while the caller works on
+ * another one.  Operation number k always uses buffer k % ASYNC_IO_NUM_BUFS;
+ * 'submitted' and 'completed' count the operations, and they and the flags are
+ * protected by the lock.
+ */
+struct async_io {
+	struct file_stream *strm;
+	size_t chunk_size;
+	u8 *bufs[ASYNC_IO_NUM_BUFS];
+	/* The size to write, or the result of the read, for each buffer */
+	ssize_t sizes[ASYNC_IO_NUM_BUFS];
+	u64 submitted;
+	u64 completed;
+	u64 consumed;	/* reading only: the chunks given to the caller */
+	bool writing;
+	bool discard;
+	bool eof;	/* reading only: a short read or an error happened */
+	bool failed;	/* writing only: a write failed */
+	bool stop;
+#ifdef _WIN32
+	SRWLOCK lock;
+	CONDITION_VARIABLE cond;
+	HANDLE thread;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+#endif
+};
+
+static void
+async_io_lock(struct async_io *io)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&io->lock);
+#else
+	pthread_mutex_lock(&io->lock);
+#endif
+}
+
+static void
+async_io_unlock(struct async_io *io)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&io->lock);
+#else
+	pthread_mutex_unlock(&io->lock);
+#endif
+}
+
+/* Wait for the other thread to change something.  Must hold the lock. */
+static void
+async_io_wait(struct async_io *io)
+{
+#ifdef _WIN32
+	SleepConditionVariableSRW(&io->cond, &io->lock, INFINITE, 0);
+#else
+	pthread_cond_wait(&io->cond, &io->lock);
+#endif
+}
+
+static void
+async_io_wake(struct async_io *io)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&io->cond);
+#else
+	pthread_cond_broadcast(&io->cond);
+#endif
+}
+
+static void
+async_io_thread(struct async_io *io)
+{
+	async_io_lock(io);
+	for (;;) {
+		unsigned int i;
+		ssize_t ret;
+
+		if (io->writing) {
+			/* Finish the queued writes before stopping. */
+			while (io->completed == io->submitted && !io->stop)
+				async_io_wait(io);
+			if (io->completed == io->submitted)
+				break;
+		} else {
+			while ((io->completed == io->submitted || io->eof) &&
+			       !io->stop)
+				async_io_wait(io);
+			if (io->stop)
+				break;
+		}
+		i = io->completed % ASYNC_IO_NUM_BUFS;
+		async_io_unlock(io);
+
+		if (io->writing) {
+			ret = 0;
+			if (!io->failed)
+				ret = full_write(io->strm, io->bufs[i],
+						 io->sizes[i]);
+		} else {
+			ret = xread(io->strm, io->bufs[i], io->chunk_size);
+		}
+
+		async_io_lock(io);
+		if (io->writing) {
+			if (ret != 0)
+				io->failed = true;
+		} else {
+			io->sizes[i] = ret;
+			if (ret != (ssize_t)io->chunk_size)
+				io->eof = true;
+		}
+		io->completed++;
+		async_io_wake(io);
+	}
+	async_io_unlock(io);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall
+async_io_thread_proc(void *arg)
+{
+	async_io_thread(arg);
+	return 0;
+}
+#else
+static void *
+async_io_thread_proc(void *arg)
+{
+	async_io_thread(arg);
+	return NULL;
+}
+#endif
+
+static struct async_io *
+async_io_start(struct file_stream *strm, size_t chunk_size, bool writing,
+	       bool discard)
+{
+	struct async_io *io = xmalloc(sizeof(*io));
+	unsigned int i;
+
+	if (io == NULL)
+		return NULL;
+	memset(io, 0, sizeof(*io));
+	io->strm = strm;
+	io->chunk_size = chunk_size;
+	io->writing = writing;
+	io->discard = discard;
+	io->bufs[0] = xmalloc(ASYNC_IO_NUM_BUFS * chunk_size);
+	if (io->bufs[0] == NULL)
+		goto err;
+	for (i = 1; i < ASYNC_IO_NUM_BUFS; i++)
+		io->bufs[i] = io->bufs[i - 1] + chunk_size;
+	/* Start reading into all the buffers straight away. */
+	if (!writing)
+		io->submitted = ASYNC_IO_NUM_BUFS;
+#ifdef _WIN32
+	InitializeSRWLock(&io->lock);
+	InitializeConditionVariable(&io->cond);
+	io->thread = (HANDLE)_beginthreadex(NULL, 0, async_io_thread_proc,
+					    io, 0, NULL);
+	if (io->thread == 0) {
+		msg("Unable to create I/O thread");
+		goto err;
+	}
+#else
+	if (pthread_mutex_init(&io->lock, NULL) != 0)
+		goto err;
+	if (pthread_cond_init(&io->cond, NULL) != 0) {
+		pthread_mutex_destroy(&io->lock);
+		goto err;
+	}
+	if (pthread_create(&io->thread, NULL, async_io_thread_proc, io) != 0) {
+		msg("Unable to create I/O thread");
+		pthread_cond_destroy(&io->cond);
+		pthread_mutex_destroy(&io->lock);
+		goto err;
+	}
+#endif
+	return io;
+
+err:
+	free(io->bufs[0]);
+	free(io);
+	return NULL;
+}
+
+/*
+ * Start reading @strm in chunks of @chunk_size bytes on another thread.  Return
+ * NULL on error.
+ */
+struct async_io *
+async_io_start_reading(struct file_stream *strm, size_t chunk_size)
+{
+	return async_io_start(strm, chunk_size, false, false);
+}
+
+/*
+ * Start writing to @strm from chunk buffers of @chunk_size bytes on another
+ * thread.  If @discard is true, the chunks are thrown away instead of written.
+ * Return NULL on error.
+ */
+struct async_io *
+async_io_start_writing(struct file_stream *strm, size_t chunk_size,
+		       bool discard)
+{
+	return async_io_start(strm, chunk_size, true, discard);
+}
+
+/*
+ * Give the buffer of the previous chunk back to be read into again, and wait
+ * for the next chunk.  Set *@buf_ret to it, and return its size, which is less
+ * than the chunk size only for the last chunk and is 0 at the end of the
+ * stream.  Return -1 on a read error.
+ */
+ssize_t
+async_io_next_chunk(struct async_io *io, u8 **buf_ret)
+{
+	unsigned int i;
+	ssize_t ret = 0;
+
+	async_io_lock(io);
+	if (io->consumed != 0 && !io->eof) {
+		io->submitted++;
+		async_io_wake(io);
+	}
+	while (io->completed == io->consumed && !io->eof)
+		async_io_wait(io);
+	if (io->completed != io->consumed) {
+		i = io->consumed++ % ASYNC_IO_NUM_BUFS;
+		*buf_ret = io->bufs[i];
+		ret = io->sizes[i];
+	}
+	async_io_unlock(io);
+	return ret;
+}
+
+/*
+ * Return the buffer to fill with the next chunk to write, waiting for one to be
+ * free if they are all being written
+ */
+u8 *
+async_io_get_buf(struct async_io *io)
+{
+	u8 *buf;
+
+	async_io_lock(io);
+	while (io->submitted - io->completed == ASYNC_IO_NUM_BUFS)
+		async_io_wait(io);
+	buf = io->bufs[io->submitted % ASYNC_IO_NUM_BUFS];
+	async_io_unlock(io);
+	return buf;
+}
+
+/*
+ * Queue the first @count bytes of the buffer from async_io_get_buf() to be
+ * written.  Return 0, or -1 if an earlier write failed.
+ */
+int
+async_io_write_chunk(struct async_io *io, size_t count)
+{
+	int ret = 0;
+
+	async_io_lock(io);
+	if (io->failed) {
+		ret = -1;
+	} else if (count != 0 && !io->discard) {
+		io->sizes[io->submitted % ASYNC_IO_NUM_BUFS] = count;
+		io->submitted++;
+		async_io_wake(io);
+	}
+	async_io_unlock(io);
+	return ret;
+}
+
+/*
+ * Stop reading, or finish the queued writes, and free @io.  Return 0, or -1 if
+ * a write failed.
+ */
+int
+async_io_finish(struct async_io *io)
+{
+	int ret;
+
+	async_io_lock(io);
+	io->stop = true;
+	async_io_wake(io);
+	async_io_unlock(io);
+#ifdef _WIN32
+	WaitForSingleObject(io->thread, INFINITE);
+	CloseHandle(io->thread);
+#else
+	pthread_join(io->thread, NULL);
+	pthread_cond_destroy(&io->cond);
+	pthread_mutex_destroy(&io->lock);
+#endif
+	ret = io->failed ? -1 : 0;
+	free(io->bufs[0]);
+	free(io);
+	return ret;
+}
+
 /*
  * Parse the compression level given on the command line, returning the
  * compression level on success or -1 on error
@@ -482,14 +790,14 @@ parse_compression_level(tchar opt_char, const tchar *arg)
 		level = (level * 10) + (arg[0] - '0');
 	}
 
-	if (level < 0 || level > 12)
+	if (level < 0 || level > 14)
 		goto invalid;
 
 	return level;
 
 invalid:
 	msg("Invalid compression level: \"%"TC"%"TS"\".  "
-	    "Must be an integer in the range [0, 12].", opt_char, arg);
+	    "Must be an integer in the range [0, 14].", opt_char, arg);
 	return -1;
 }
 
@@ -210,6 +210,23 @@ int full_write(struct file_stream *strm, const void *buf, size_t count);
 
 int xclose(struct file_stream *strm);
 
+/*
+ * The number of chunks an async_io can have in flight: reads ahead of the one
+ * the caller is working on, or writes queued behind it
+ */
+#define ASYNC_IO_NUM_BUFS	4
+
+struct async_io;
+
+struct async_io *async_io_start_reading(struct file_stream *strm,
+					size_t chunk_size);
+struct async_io *async_io_start_writing(struct file_stream *strm,
+					size_t chunk_size, bool discard);
+ssize_t async_io_next_chunk(struct async_io *io, u8 **buf_ret);
+u8 *async_io_get_buf(struct async_io *io);
+int async_io_write_chunk(struct async_io *io, size_t count);
+int async_io_finish(struct async_io *io);
+
 int parse_compression_level(tchar opt_char, const tchar *arg);
 
 struct libdeflate_compressor *alloc_compressor(int level);
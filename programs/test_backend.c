@@ -0,0 +1,165 @@
+/*
+ * test_backend.c
+ *
+ * Test that compression and decompression are offloaded to a backend given in
+ * libdeflate_options, and that they fall back to software below the backend's
+ * size thresholds and when the backend fails.
+ */
+
+#include "test_util.h"
+
+#define NBYTES	100000
+
+/* A fake backend which does the work with a second, software (de)compressor */
+struct fake_backend {
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	bool fail;
+	int num_compress_calls;
+	int num_decompress_calls;
+};
+
+static size_t
+fake_compress(void *ctx, int compression_level,
+	      const void *in, size_t in_nbytes,
+	      void *out, size_t out_nbytes_avail)
+{
+	struct fake_backend *b = ctx;
+
+	ASSERT(compression_level == 6);
+	b->num_compress_calls++;
+	if (b->fail)
+		return 0;
+	return libdeflate_deflate_compress(b->c, in, in_nbytes,
+					   out, out_nbytes_avail);
+}
+
+static enum libdeflate_result
+fake_decompress(void *ctx, const void *in, size_t in_nbytes,
+		void *out, size_t out_nbytes_avail,
+		size_t *actual_in_nbytes_ret, size_t *actual_out_nbytes_ret)
+{
+	struct fake_backend *b = ctx;
+
+	ASSERT(actual_in_nbytes_ret != NULL);
+	ASSERT(actual_out_nbytes_ret != NULL);
+	b->num_decompress_calls++;
+	if (b->fail)
+		return LIBDEFLATE_BAD_DATA;
+	return libdeflate_deflate_decompress_ex(b->d, in, in_nbytes,
+						out, out_nbytes_avail,
+						actual_in_nbytes_ret,
+						actual_out_nbytes_ret);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	struct fake_backend fb;
+	struct libdeflate_backend backend;
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *decompressed;
+	size_t out_avail, csize, actual_in, actual_out;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	for (i = 0; i < NBYTES; i++)
+		original[i] = 'a' + (rand() % 8);
+	out_avail = libdeflate_deflate_compress_bound(NULL, NBYTES);
+	compressed = xmalloc(out_avail);
+	decompressed = xmalloc(NBYTES);
+
+	memset(&fb, 0, sizeof(fb));
+	fb.c = libdeflate_alloc_compressor(6);
+	fb.d = libdeflate_alloc_decompressor();
+	ASSERT(fb.c != NULL && fb.d != NULL);
+
+	memset(&backend, 0, sizeof(backend));
+	backend.sizeof_backend = sizeof(backend);
+	backend.ctx = &fb;
+	backend.deflate_compress = fake_compress;
+	backend.deflate_decompress = fake_decompress;
+	backend.min_compress_nbytes = 1000;
+	backend.min_decompress_nbytes = 1000;
+
+	memset(&options, 0, sizeof(options));
+	options.sizeof_options = sizeof(options);
+	options.backend = &backend;
+	c = libdeflate_alloc_compressor_ex(6, &options);
+	d = libdeflate_alloc_decompressor_ex(&options);
+	ASSERT(c != NULL && d != NULL);
+
+	/* The backend struct is copied, so it needn't outlive the call. */
+	memset(&backend, 0, sizeof(backend));
+
+	/* Both directions are offloaded. */
+	csize = libdeflate_deflate_compress(c, original, NBYTES,
+					    compressed, out_avail);
+	ASSERT(csize != 0);
+	ASSERT(fb.num_compress_calls == 1);
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+					     decompressed, NBYTES, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(fb.num_decompress_calls == 1);
+	ASSERT(memcmp(original, decompressed, NBYTES) == 0);
+
+	/* The result codes are kept for output that doesn't fill the buffer. */
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+					     decompressed, NBYTES + 1, NULL) ==
+	       LIBDEFLATE_SHORT_OUTPUT);
+	ASSERT(libdeflate_deflate_decompress_ex(d, compressed, csize,
+						decompressed, NBYTES + 1,
+						&actual_in, &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_in == csize && actual_out == NBYTES);
+
+	/* Small buffers stay in software. */
+	fb.num_compress_calls = 0;
+	fb.num_decompress_calls = 0;
+	csize = libdeflate_deflate_compress(c, original, 999,
+					    compressed, out_avail);
+	ASSERT(csize != 0 && csize < 1000);
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+					     decompressed, 999, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(fb.num_compress_calls == 0);
+	ASSERT(fb.num_decompress_calls == 0);
+
+	/*
+	 * A failing backend falls back to software, which gives the same
+	 * results as without a backend, including errors.
+	 */
+	fb.fail = true;
+	csize = libdeflate_deflate_compress(c, original, NBYTES,
+					    compressed, out_avail);
+	ASSERT(csize != 0);
+	ASSERT(fb.num_compress_calls == 1);
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+					     decompressed, NBYTES, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(fb.num_decompress_calls == 1);
+	ASSERT(memcmp(original, decompressed, NBYTES) == 0);
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+					     decompressed, NBYTES - 1, NULL) ==
+	       LIBDEFLATE_INSUFFICIENT_SPACE);
+	ASSERT(libdeflate_deflate_compress(c, original, NBYTES,
+					   compressed, 1000) == 0);
+
+	/* An unsupported struct size makes the allocation fail. */
+	backend.sizeof_backend = sizeof(backend) - 1;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	ASSERT(libdeflate_alloc_decompressor_ex(&options) == NULL);
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+	libdeflate_free_compressor(fb.c);
+	libdeflate_free_decompressor(fb.d);
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * test_bgzf.c
+ *
+ * Test BGZF compression and decompression: that the output is valid gzip made
+ * of BGZF members and ends with the EOF marker, that it doesn't depend on the
+ * number of threads, and that the parallel decompressor handles valid data,
+ * data followed by other gzip members, and corrupt data.
+ */
+
+#include "test_util.h"
+
+#define MAX_TASKS	16
+#define NBYTES		1500000
+
+static const u8 eof_marker[28] = {
+	0x1F, 0x8B, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x06, 0x00,
+	0x42, 0x43, 0x02, 0x00, 0x1B, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+/*
+ * A task submitter that just queues up the tasks, then runs them in reverse
+ * order when waited on.
+ */
+struct reverse_submitter {
+	void (*funcs[MAX_TASKS])(void *arg);
+	void *args[MAX_TASKS];
+	unsigned num_tasks;
+	unsigned long num_tasks_run;
+};
+
+static void
+reverse_submit(void *ctx, void (*func)(void *arg), void *arg)
+{
+	struct reverse_submitter *s = ctx;
+
+	ASSERT(s->num_tasks < MAX_TASKS);
+	s->funcs[s->num_tasks] = func;
+	s->args[s->num_tasks] = arg;
+	s->num_tasks++;
+}
+
+static void
+reverse_wait(void *ctx)
+{
+	struct reverse_submitter *s = ctx;
+
+	while (s->num_tasks) {
+		s->num_tasks--;
+		(*s->funcs[s->num_tasks])(s->args[s->num_tasks]);
+		s->num_tasks_run++;
+	}
+}
+
+/* Text-like data, with a stretch of random bytes that won't compress */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 4 == 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = 'a' + (rand() % 32);
+	}
+	for (i = size / 3; i < MIN(size, size / 3 + 200000); i++)
+		data[i] = rand();
+}
+
+/*
+ * Check that @in is a series of BGZF members that decompress to @expected,
+ * ending with the EOF marker, using only the regular gzip decompressor.
+ */
+static void
+check_bgzf_members(const u8 *in, size_t in_nbytes,
+		   const u8 *expected, size_t expected_nbytes, u8 *buf)
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	size_t out_pos = 0;
+
+	ASSERT(d != NULL);
+	ASSERT(in_nbytes >= sizeof(eof_marker));
+	ASSERT(memcmp(&in[in_nbytes - sizeof(eof_marker)], eof_marker,
+		      sizeof(eof_marker)) == 0);
+	while (in_nbytes != 0) {
+		size_t bsize, actual_in, actual_out;
+
+		ASSERT(in_nbytes >= 18);
+		ASSERT(in[3] == 0x04);		/* FLG.FEXTRA */
+		ASSERT(in[12] == 'B' && in[13] == 'C');
+		bsize = get_unaligned_le16(&in[16]);
+		ASSERT(bsize + 1 <= in_nbytes);
+		ASSERT(libdeflate_gzip_decompress_ex(d, in, in_nbytes,
+						     &buf[out_pos],
+						     NBYTES - out_pos,
+						     &actual_in, &actual_out) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(actual_in == bsize + 1);
+		ASSERT(actual_out <= 65280);
+		in += actual_in;
+		in_nbytes -= actual_in;
+		out_pos += actual_out;
+	}
+	ASSERT(out_pos == expected_nbytes);
+	ASSERT(memcmp(buf, expected, expected_nbytes) == 0);
+	libdeflate_free_decompressor(d);
+}
+
+static size_t
+bgzf_compress(int level, unsigned num_threads, const u8 *in, size_t in_nbytes,
+	      u8 *out, size_t out_nbytes_avail)
+{
+	struct reverse_submitter rs = { .num_tasks = 0 };
+	const struct libdeflate_task_submitter submitter = {
+		.submit = reverse_submit,
+		.wait = reverse_wait,
+		.ctx = &rs,
+	};
+	struct libdeflate_parallel_compressor *pc;
+	size_t csize;
+
+	pc = libdeflate_alloc_parallel_compressor(level, num_threads,
+						  &submitter);
+	ASSERT(pc != NULL);
+	ASSERT(libdeflate_parallel_bgzf_compress_bound(pc, in_nbytes) <=
+	       out_nbytes_avail);
+	csize = libdeflate_parallel_bgzf_compress(pc, in, in_nbytes, out,
+						  out_nbytes_avail);
+	ASSERT(csize != 0);
+	ASSERT(libdeflate_parallel_bgzf_compress(pc, in, in_nbytes, out,
+						 csize - 1) == 0);
+	libdeflate_free_parallel_compressor(pc);
+	return csize;
+}
+
+static void
+test_decompress(unsigned num_threads, u8 *in, size_t in_nbytes,
+		const u8 *expected, size_t expected_nbytes, u8 *buf)
+{
+	struct reverse_submitter rs = { .num_tasks = 0 };
+	const struct libdeflate_task_submitter submitter = {
+		.submit = reverse_submit,
+		.wait = reverse_wait,
+		.ctx = &rs,
+	};
+	struct libdeflate_parallel_decompressor *pd;
+	size_t actual_in, actual_out;
+
+	pd = libdeflate_alloc_parallel_decompressor(num_threads, &submitter);
+	ASSERT(pd != NULL);
+
+	ASSERT(libdeflate_parallel_bgzf_decompress(pd, in, in_nbytes, buf,
+						   NBYTES, &actual_in,
+						   &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_in == in_nbytes);
+	ASSERT(actual_out == expected_nbytes);
+	ASSERT(memcmp(buf, expected, expected_nbytes) == 0);
+	if (expected_nbytes >= (size_t)num_threads * 4 * 65280)
+		ASSERT(rs.num_tasks_run == num_threads);
+
+	/* Without 'actual_out_nbytes_ret', the size must be exact. */
+	ASSERT(libdeflate_parallel_bgzf_decompress(pd, in, in_nbytes, buf,
+						   expected_nbytes, NULL,
+						   NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	if (expected_nbytes != 0) {
+		ASSERT(libdeflate_parallel_bgzf_decompress(
+				pd, in, in_nbytes, buf, expected_nbytes - 1,
+				NULL, NULL) == LIBDEFLATE_INSUFFICIENT_SPACE);
+	}
+
+	/* Corrupted compressed data is detected. */
+	if (expected_nbytes != 0) {
+		size_t pos = 18 + 1;
+
+		in[pos] ^= 0x40;
+		ASSERT(libdeflate_parallel_bgzf_decompress(
+				pd, in, in_nbytes, buf, NBYTES, NULL,
+				&actual_out) != LIBDEFLATE_SUCCESS);
+		in[pos] ^= 0x40;
+	}
+
+	libdeflate_free_parallel_decompressor(pd);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const size_t sizes[] = {
+		0, 1, 65280, 65281, 4 * 65280 + 1, NBYTES,
+	};
+	const size_t out_avail = 2 * NBYTES;
+	struct libdeflate_compressor *c;
+	struct libdeflate_parallel_decompressor *pd;
+	u8 *original, *compressed, *compressed2, *buf;
+	size_t csize, gzip_size, actual_in, actual_out;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	compressed = xmalloc(out_avail);
+	compressed2 = xmalloc(out_avail);
+	buf = xmalloc(NBYTES);
+	generate_test_data(original, NBYTES);
+
+	for (i = 0; i < ARRAY_LEN(sizes); i++) {
+		int level = (i == ARRAY_LEN(sizes) - 1) ? 6 : (int)(i * 2);
+
+		csize = bgzf_compress(level, 1, original, sizes[i],
+				      compressed, out_avail);
+		check_bgzf_members(compressed, csize, original, sizes[i], buf);
+
+		/* The output doesn't depend on the number of threads. */
+		ASSERT(bgzf_compress(level, 3, original, sizes[i],
+				     compressed2, out_avail) == csize);
+		ASSERT(memcmp(compressed, compressed2, csize) == 0);
+
+		test_decompress(1, compressed, csize, original, sizes[i], buf);
+		test_decompress(5, compressed, csize, original, sizes[i], buf);
+	}
+
+	/* Incompressible data still fits in the members. */
+	csize = bgzf_compress(12, 2, &original[NBYTES / 3], 200000,
+			      compressed, out_avail);
+	check_bgzf_members(compressed, csize, &original[NBYTES / 3], 200000,
+			   buf);
+
+	/*
+	 * Decompression stops at a gzip member that isn't a BGZF member, and
+	 * rejects data that doesn't begin with one.
+	 */
+	c = libdeflate_alloc_compressor(6);
+	pd = libdeflate_alloc_parallel_decompressor(2, NULL);
+	ASSERT(c != NULL && pd != NULL);
+	csize = bgzf_compress(6, 2, original, 100000, compressed, out_avail);
+	gzip_size = libdeflate_gzip_compress(c, original, 1000,
+					     &compressed[csize],
+					     out_avail - csize);
+	ASSERT(gzip_size != 0);
+	ASSERT(libdeflate_parallel_bgzf_decompress(pd, compressed,
+						   csize + gzip_size, buf,
+						   NBYTES, &actual_in,
+						   &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_in == csize);
+	ASSERT(actual_out == 100000);
+	ASSERT(libdeflate_parallel_bgzf_decompress(pd, &compressed[csize],
+						   gzip_size, buf, NBYTES,
+						   &actual_in, &actual_out) ==
+	       LIBDEFLATE_BAD_DATA);
+	libdeflate_free_compressor(c);
+	libdeflate_free_parallel_decompressor(pd);
+
+	free(original);
+	free(compressed);
+	free(compressed2);
+	free(buf);
+	return 0;
+}
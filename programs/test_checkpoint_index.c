@@ -0,0 +1,204 @@
+/*
+ * test_checkpoint_index.c
+ *
+ * Test recording a checkpoint index during decompression, then decompressing
+ * random ranges of the data starting from the checkpoints.
+ */
+
+#include "test_util.h"
+
+#define DATA_SIZE	1000000
+#define SPACING		100000
+
+/* Generate data that is compressible in places and random in others. */
+static void
+generate_data(u8 *data, size_t size)
+{
+	static const char * const words[] = {
+		"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ",
+		"dog ", "\n",
+	};
+	size_t i = 0;
+
+	while (i < size) {
+		if (rand() % 16 == 0) {
+			size_t n = 1 + (rand() % 5000);
+
+			while (n-- && i < size)
+				data[i++] = rand();
+		} else {
+			const char *w = words[rand() % ARRAY_LEN(words)];
+
+			while (*w && i < size)
+				data[i++] = *w++;
+		}
+	}
+}
+
+/* Decompress the range [start, end) of the data, starting from the index. */
+static void
+test_range(struct libdeflate_decompressor *d,
+	   const struct libdeflate_index *index,
+	   const u8 *compressed, size_t csize, size_t deflate_offset,
+	   const u8 *original, size_t start, size_t end)
+{
+	const struct libdeflate_checkpoint *cp =
+		libdeflate_index_find_checkpoint(index, start);
+	size_t in_pos = cp ? cp->in_bitpos / 8 : deflate_offset;
+	size_t out_pos = cp ? cp->out_pos : 0;
+	size_t out_avail = end - out_pos;
+	size_t actual_out;
+	u8 *out, *out_end;
+
+	ASSERT(out_pos <= start);
+	alloc_guarded_buffer(out_avail, &out, &out_end);
+	ASSERT(libdeflate_deflate_decompress_from_checkpoint(
+			d, cp, &compressed[in_pos], csize - in_pos,
+			out, out_avail, NULL, &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_out == out_avail);
+	ASSERT(memcmp(&out[start - out_pos], &original[start],
+		      end - start) == 0);
+	free_guarded_buffer(out, out_end);
+}
+
+static void
+test_format(struct libdeflate_compressor *c,
+	    struct libdeflate_decompressor *d, bool gzip,
+	    const u8 *original, u8 *compressed, size_t compressed_avail,
+	    u8 *decompressed)
+{
+	struct libdeflate_index *index = libdeflate_alloc_index(d, SPACING);
+	size_t csize, deflate_offset, i;
+	size_t prev_out_pos = 0;
+	enum libdeflate_result res;
+
+	ASSERT(index != NULL);
+	if (gzip) {
+		csize = libdeflate_gzip_compress(c, original, DATA_SIZE,
+						 compressed, compressed_avail);
+		deflate_offset = 10;
+	} else {
+		csize = libdeflate_deflate_compress(c, original, DATA_SIZE,
+						    compressed,
+						    compressed_avail);
+		deflate_offset = 0;
+	}
+	ASSERT(csize != 0);
+
+	libdeflate_set_index(d, index);
+	if (gzip)
+		res = libdeflate_gzip_decompress(d, compressed, csize,
+						 decompressed, DATA_SIZE, NULL);
+	else
+		res = libdeflate_deflate_decompress(d, compressed, csize,
+						    decompressed, DATA_SIZE,
+						    NULL);
+	ASSERT(res == LIBDEFLATE_SUCCESS);
+	libdeflate_set_index(d, NULL);
+	ASSERT(memcmp(decompressed, original, DATA_SIZE) == 0);
+
+	/* Check the checkpoints themselves. */
+	ASSERT(libdeflate_index_num_checkpoints(index) >= 2);
+	for (i = 0; i < libdeflate_index_num_checkpoints(index); i++) {
+		const struct libdeflate_checkpoint *cp =
+			libdeflate_index_get_checkpoint(index, i);
+
+		ASSERT(cp->out_pos >= prev_out_pos + SPACING);
+		ASSERT(cp->out_pos < DATA_SIZE);
+		ASSERT(cp->in_bitpos >= deflate_offset * 8);
+		ASSERT(cp->in_bitpos < csize * 8);
+		ASSERT(cp->window_nbytes == MIN(cp->out_pos, 32768));
+		ASSERT(memcmp(cp->window,
+			      &original[cp->out_pos - cp->window_nbytes],
+			      cp->window_nbytes) == 0);
+		prev_out_pos = cp->out_pos;
+	}
+	ASSERT(libdeflate_index_get_checkpoint(index, i) == NULL);
+
+	/*
+	 * Ranges near the start need no checkpoint, and ranges at the end run
+	 * into the end of the stream.
+	 */
+	test_range(d, index, compressed, csize, deflate_offset, original,
+		   0, 1);
+	test_range(d, index, compressed, csize, deflate_offset, original,
+		   100, 1000);
+	test_range(d, index, compressed, csize, deflate_offset, original,
+		   DATA_SIZE - 1000, DATA_SIZE);
+	for (i = 0; i < 100; i++) {
+		size_t start = rand() % DATA_SIZE;
+		size_t len = 1 + (rand() % 20000);
+		size_t end = MIN(start + len, DATA_SIZE);
+
+		test_range(d, index, compressed, csize, deflate_offset,
+			   original, start, end);
+	}
+
+	/* A buffer larger than the rest of the stream gets just the rest. */
+	if (!gzip) {
+		const struct libdeflate_checkpoint *cp =
+			libdeflate_index_get_checkpoint(index, 0);
+		size_t actual_in, actual_out;
+
+		ASSERT(libdeflate_deflate_decompress_from_checkpoint(
+				d, cp, &compressed[cp->in_bitpos / 8],
+				csize - (cp->in_bitpos / 8),
+				decompressed, DATA_SIZE, &actual_in,
+				&actual_out) == LIBDEFLATE_SUCCESS);
+		ASSERT(actual_in == csize - (cp->in_bitpos / 8));
+		ASSERT(actual_out == DATA_SIZE - cp->out_pos);
+		ASSERT(memcmp(decompressed, &original[cp->out_pos],
+			      actual_out) == 0);
+		ASSERT(libdeflate_deflate_decompress_from_checkpoint(
+				d, cp, &compressed[cp->in_bitpos / 8],
+				csize - (cp->in_bitpos / 8),
+				decompressed, DATA_SIZE, NULL, NULL) ==
+		       LIBDEFLATE_SHORT_OUTPUT);
+	}
+
+	/* Without an index set, normal decompression still works. */
+	ASSERT(libdeflate_deflate_decompress(d, &compressed[deflate_offset],
+					     csize - deflate_offset,
+					     decompressed, DATA_SIZE / 2,
+					     NULL) ==
+	       LIBDEFLATE_INSUFFICIENT_SPACE);
+	libdeflate_free_index(index);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const int levels[] = { 0, 1, 6, 9 };
+	const size_t compressed_avail = 2 * DATA_SIZE;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *decompressed;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(DATA_SIZE);
+	compressed = xmalloc(compressed_avail);
+	decompressed = xmalloc(DATA_SIZE);
+	generate_data(original, DATA_SIZE);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+
+	for (i = 0; i < ARRAY_LEN(levels); i++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(levels[i]);
+
+		ASSERT(c != NULL);
+		test_format(c, d, false, original, compressed,
+			    compressed_avail, decompressed);
+		test_format(c, d, true, original, compressed,
+			    compressed_avail, decompressed);
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
@@ -1,8 +1,10 @@
 /*
  * test_checksums.c
  *
- * Verify that libdeflate's Adler-32 and CRC-32 functions produce the same
- * results as their zlib equivalents.
+ * Verify that libdeflate's Adler-32 and CRC-32 functions, including the
+ * functions that combine checksums, produce the same results as their zlib
+ * equivalents, and that the functions that also copy the data are consistent
+ * with them.
  */
 
 #include "test_util.h"
@@ -150,6 +152,114 @@ static void test_random_buffers(u8 *buf_start, u8 *buf_end, size_t limit,
 	}
 }
 
+/*
+ * Verify that combining the checksums of two pieces of a buffer gives the
+ * checksum of the whole buffer, and that combining checksums of arbitrary
+ * values for arbitrary lengths agrees with zlib.
+ */
+static void
+test_combine(const u8 *buf, size_t size)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		size_t len = rand() % (size + 1);
+		size_t len1 = rand() % (len + 1);
+		size_t len2 = len - len1;
+		u32 whole, first, second;
+		u32 a, b;
+		z_off_t n;
+
+		whole = libdeflate_adler32(1, buf, len);
+		first = libdeflate_adler32(1, buf, len1);
+		second = libdeflate_adler32(1, &buf[len1], len2);
+		ASSERT(libdeflate_adler32_combine(first, second, len2) ==
+		       whole);
+
+		whole = libdeflate_crc32(0, buf, len);
+		first = libdeflate_crc32(0, buf, len1);
+		second = libdeflate_crc32(0, &buf[len1], len2);
+		ASSERT(libdeflate_crc32_combine(first, second, len2) == whole);
+
+		/* zlib's length type may be only 32 bits. */
+		n = ((u32)rand() << 16 ^ rand()) & 0x7FFFFFFF;
+		if (i % 4 == 0)
+			n %= 100;
+		a = libdeflate_adler32(1, buf, rand() % (size + 1));
+		b = libdeflate_adler32(1, buf, rand() % (size + 1));
+		ASSERT(libdeflate_adler32_combine(a, b, n) ==
+		       adler32_combine(a, b, n));
+		a = libdeflate_crc32(0, buf, rand() % (size + 1));
+		b = libdeflate_crc32(0, buf, rand() % (size + 1));
+		ASSERT(libdeflate_crc32_combine(a, b, n) ==
+		       crc32_combine(a, b, n));
+	}
+}
+
+/*
+ * Verify that copying and checksumming a buffer at once gives the same copy
+ * and checksum as doing them separately.
+ */
+static void
+test_copy(const u8 *buf, size_t size)
+{
+	u8 *copy = xmalloc(size);
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		size_t offset = rand() % (size + 1);
+		size_t len = rand() % (size - offset + 1);
+		u32 initial = ((u32)rand() << 16) ^ rand();
+
+		if (i % 2)
+			len %= 100;
+		memset(copy, 0, size);
+		ASSERT(libdeflate_adler32_copy(initial % 65521, copy,
+					       &buf[offset], len) ==
+		       libdeflate_adler32(initial % 65521, &buf[offset], len));
+		ASSERT(memcmp(copy, &buf[offset], len) == 0);
+		memset(copy, 0, size);
+		ASSERT(libdeflate_crc32_copy(initial, copy, &buf[offset], len) ==
+		       libdeflate_crc32(initial, &buf[offset], len));
+		ASSERT(memcmp(copy, &buf[offset], len) == 0);
+	}
+	free(copy);
+}
+
+static void
+test_multi(const u8 *buf, size_t size)
+{
+	const void *bufs[100];
+	size_t lens[100];
+	u32 initial_adlers[100], initial_crcs[100];
+	u32 adlers[100], crcs[100];
+	size_t count, j;
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		count = rand() % (ARRAY_LEN(bufs) + 1);
+		for (j = 0; j < count; j++) {
+			size_t offset = rand() % (size + 1);
+
+			lens[j] = rand() % (size - offset + 1);
+			if (j % 4 != 0)
+				lens[j] %= (i % 2) ? 100 : 2000;
+			bufs[j] = &buf[offset];
+			initial_adlers[j] = adlers[j] = select_initial_adler();
+			initial_crcs[j] = crcs[j] = select_initial_crc();
+		}
+		libdeflate_adler32_multi(bufs, lens, count, adlers);
+		libdeflate_crc32_multi(bufs, lens, count, crcs);
+		for (j = 0; j < count; j++) {
+			ASSERT(adlers[j] == libdeflate_adler32(initial_adlers[j],
+							       bufs[j],
+							       lens[j]));
+			ASSERT(crcs[j] == libdeflate_crc32(initial_crcs[j],
+							   bufs[j], lens[j]));
+		}
+	}
+}
+
 int
 tmain(int argc, tchar *argv[])
 {
@@ -173,6 +283,17 @@ tmain(int argc, tchar *argv[])
 	test_random_buffers(buf_start, buf_end, 32768,  50);
 	test_random_buffers(buf_start, buf_end, 262144, 50);
 
+	/* Test combining checksums */
+	for (size_t i = 0; i < 262144; i++)
+		buf_start[i] = rand();
+	test_combine(buf_start, 262144);
+
+	/* Test copying and checksumming at once */
+	test_copy(buf_start, 262144);
+
+	/* Test checksumming many buffers at once */
+	test_multi(buf_start, 262144);
+
 	/*
 	 * Test Adler-32 overflow cases.  For example, given all 0xFF bytes and
 	 * the highest possible initial (s1, s2) of (65520, 65520), then s2 if
@@ -0,0 +1,115 @@
+/*
+ * test_compress_batch.c
+ *
+ * Test that batch compression gives exactly the same results as compressing
+ * each buffer separately, for a mix of buffer sizes and output buffer sizes.
+ */
+
+#include "test_util.h"
+
+#define NUM_ITEMS	200
+#define MAX_ITEM_LEN	20000
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 100 && rand() % 8 != 0)
+			data[i] = data[i - 1 - (rand() % 100)];
+		else
+			data[i] = rand() % 32;
+	}
+}
+
+/* Return a random item length, usually small but sometimes large. */
+static size_t
+random_item_len(void)
+{
+	switch (rand() % 8) {
+	case 0:
+		return rand() % 64;
+	case 1:
+		return rand() % (MAX_ITEM_LEN + 1);
+	default:
+		return rand() % 2500;
+	}
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	struct libdeflate_compress_batch_item items[NUM_ITEMS];
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *expected, *decompressed;
+	const size_t out_avail = 2 * MAX_ITEM_LEN + 100;
+	int level;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(NUM_ITEMS * MAX_ITEM_LEN);
+	compressed = xmalloc(NUM_ITEMS * out_avail);
+	expected = xmalloc(out_avail);
+	decompressed = xmalloc(MAX_ITEM_LEN);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, NUM_ITEMS * MAX_ITEM_LEN);
+
+	for (level = 0; level <= 12; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+
+		ASSERT(c != NULL);
+
+		/* An empty batch must be accepted. */
+		libdeflate_deflate_compress_batch(c, items, 0);
+
+		for (i = 0; i < NUM_ITEMS; i++) {
+			size_t in_nbytes = random_item_len();
+
+			items[i].in = &original[rand() % ((NUM_ITEMS - 1) *
+							  MAX_ITEM_LEN)];
+			items[i].in_nbytes = in_nbytes;
+			items[i].out = &compressed[i * out_avail];
+			items[i].out_nbytes_avail = out_avail;
+			/* Sometimes give too little space for the output. */
+			if (rand() % 8 == 0)
+				items[i].out_nbytes_avail = rand() %
+							    (in_nbytes / 2 + 1);
+			items[i].out_nbytes = 12345;
+		}
+		libdeflate_deflate_compress_batch(c, items, NUM_ITEMS);
+
+		for (i = 0; i < NUM_ITEMS; i++) {
+			size_t expected_size;
+
+			expected_size = libdeflate_deflate_compress(
+						c, items[i].in,
+						items[i].in_nbytes, expected,
+						items[i].out_nbytes_avail);
+			ASSERT(items[i].out_nbytes == expected_size);
+			if (expected_size == 0)
+				continue;
+			ASSERT(memcmp(items[i].out, expected,
+				      expected_size) == 0);
+			ASSERT(libdeflate_deflate_decompress(
+					d, items[i].out, items[i].out_nbytes,
+					decompressed, items[i].in_nbytes,
+					NULL) == LIBDEFLATE_SUCCESS);
+			ASSERT(items[i].in_nbytes == 0 ||
+			       memcmp(decompressed, items[i].in,
+				      items[i].in_nbytes) == 0);
+		}
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(expected);
+	free(decompressed);
+	return 0;
+}
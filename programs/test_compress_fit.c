@@ -0,0 +1,211 @@
+/*
+ * test_compress_fit.c
+ *
+ * Test libdeflate_deflate_compress_fit(): that its output fits in the buffer
+ * and is a valid stream that decompresses to a prefix of the input, and that
+ * the prefix is about as long as the longest one that
+ * libdeflate_deflate_compress() can fit in the buffer.  At the levels that use
+ * binary trees, also check the output against data built to catch a piece end
+ * that is inserted into the trees without enough lookahead.
+ */
+
+#include "test_util.h"
+
+#define NBYTES		300000
+
+/* Compressible filler after each piece-end trap, so that fit resumes often */
+#define TRAP_FILLER_NBYTES	1500
+
+/* Text-like data, with a stretch of random bytes that won't compress */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 4 == 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = 'a' + (rand() % 32);
+	}
+	for (i = size / 2; i < size / 2 + 50000; i++)
+		data[i] = rand();
+}
+
+/*
+ * Compress with libdeflate_deflate_compress_fit() and check the result.
+ * Return the number of input bytes consumed.
+ */
+static size_t
+fit_compress(struct libdeflate_compressor *c,
+	     struct libdeflate_decompressor *d,
+	     const u8 *in, size_t in_nbytes, size_t out_nbytes_avail,
+	     u8 *out, u8 *buf)
+{
+	size_t csize, consumed, actual_in, actual_out;
+
+	csize = libdeflate_deflate_compress_fit(c, in, in_nbytes, out,
+						out_nbytes_avail, &consumed);
+	if (out_nbytes_avail < 2) {
+		ASSERT(csize == 0 && consumed == 0);
+		return 0;
+	}
+	ASSERT(csize != 0 && csize <= out_nbytes_avail);
+	ASSERT(consumed <= in_nbytes);
+	ASSERT(libdeflate_deflate_decompress_ex(d, out, csize, buf, NBYTES,
+						&actual_in, &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_in == csize);
+	ASSERT(actual_out == consumed);
+	ASSERT(consumed == 0 || memcmp(buf, in, consumed) == 0);
+	return consumed;
+}
+
+/*
+ * Return the length of the longest prefix of @in that libdeflate_deflate_
+ * compress() compresses to @out_nbytes_avail bytes or fewer, by binary search.
+ */
+static size_t
+longest_fitting_prefix(struct libdeflate_compressor *c, const u8 *in,
+		       size_t in_nbytes, size_t out_nbytes_avail, u8 *out)
+{
+	size_t lo = 0, hi = in_nbytes;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo + 1) / 2;
+
+		if (libdeflate_deflate_compress(c, in, mid, out,
+						out_nbytes_avail) != 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+static void
+test_compressor(struct libdeflate_compressor *c,
+		struct libdeflate_decompressor *d, const u8 *in,
+		u8 *out, u8 *buf, bool check_ratio)
+{
+	static const size_t page_sizes[] = { 4096, 16384 };
+	static const size_t small_sizes[] = { 0, 1, 2, 3, 5, 9, 100 };
+	size_t i, consumed, best;
+
+	/* Fixed-size pages, from compressible and incompressible data */
+	for (i = 0; i < ARRAY_LEN(page_sizes); i++) {
+		consumed = fit_compress(c, d, in, NBYTES, page_sizes[i], out,
+					buf);
+		ASSERT(consumed < NBYTES);
+		if (check_ratio) {
+			best = longest_fitting_prefix(c, in, NBYTES,
+						      page_sizes[i], out);
+			ASSERT(consumed >= best - best / 20);
+		}
+		consumed = fit_compress(c, d, &in[NBYTES / 2], 50000,
+					page_sizes[i], out, buf);
+		ASSERT(consumed >= page_sizes[i] - 16);
+	}
+
+	/* Tiny buffers, which may only hold an empty stream */
+	for (i = 0; i < ARRAY_LEN(small_sizes); i++)
+		fit_compress(c, d, in, NBYTES, small_sizes[i], out, buf);
+
+	/* All the input is consumed when it fits. */
+	ASSERT(fit_compress(c, d, in, NBYTES,
+			    libdeflate_deflate_compress_bound(c, NBYTES), out,
+			    buf) == NBYTES);
+	ASSERT(fit_compress(c, d, in, 0, 100, out, buf) == 0);
+	ASSERT(fit_compress(c, d, in, 10, 100, out, buf) == 10);
+}
+
+/*
+ * Fit many buffer sizes around the first few kilobytes of piece-end traps, so
+ * that the fitted pieces end at every offset within a trap unit and the
+ * decoded bytes are compared against the input each time.
+ */
+static void
+test_piece_ends(struct libdeflate_compressor *c,
+		struct libdeflate_decompressor *d, const u8 *traps,
+		u8 *out, u8 *buf)
+{
+	size_t avail;
+
+	/* The traps compress better than 4:1, so this spans a whole unit. */
+	for (avail = 2000;
+	     avail < 2000 + (PIECE_END_TRAP_UNIT_LENGTH +
+			     TRAP_FILLER_NBYTES) / 4 + 20;
+	     avail += 2)
+		fit_compress(c, d, traps, NBYTES, avail, out, buf);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const enum libdeflate_strategy strategies[] = {
+		LIBDEFLATE_STRATEGY_HUFFMAN_ONLY,
+		LIBDEFLATE_STRATEGY_RLE,
+		LIBDEFLATE_STRATEGY_ULTRAFAST,
+	};
+	struct libdeflate_decompressor *d;
+	u8 *original, *traps, *compressed, *buf;
+	int level;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	traps = xmalloc(NBYTES);
+	compressed = xmalloc(2 * NBYTES);
+	buf = xmalloc(NBYTES);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, NBYTES);
+	generate_piece_end_traps(traps, NBYTES, TRAP_FILLER_NBYTES);
+
+	for (level = 0; level <= 14; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+
+		ASSERT(c != NULL);
+		test_compressor(c, d, original, compressed, buf, level != 0);
+		if (level >= 10)
+			test_piece_ends(c, d, traps, compressed, buf);
+
+		/* Blocks may also use trained codes. */
+		if (level == 6 || level == 11) {
+			const void *sample = original;
+			const size_t sample_nbytes = 100000;
+			struct libdeflate_huffman_table *table =
+				libdeflate_train_huffman_table(c, &sample,
+							       &sample_nbytes,
+							       1);
+
+			ASSERT(table != NULL);
+			libdeflate_set_huffman_table(c, table);
+			test_compressor(c, d, original, compressed, buf, true);
+			libdeflate_free_huffman_table(table);
+		}
+		libdeflate_free_compressor(c);
+	}
+
+	for (i = 0; i < ARRAY_LEN(strategies); i++) {
+		struct libdeflate_options options = {
+			.sizeof_options = sizeof(options),
+			.strategy = strategies[i],
+		};
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor_ex(6, &options);
+
+		ASSERT(c != NULL);
+		test_compressor(c, d, original, compressed, buf, false);
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(traps);
+	free(compressed);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * test_compress_iov.c
+ *
+ * Test that compressing scattered input with the _iov functions produces valid
+ * streams that decompress to the concatenated input, and that the output stays
+ * within the documented bounds.
+ */
+
+#include "test_util.h"
+
+#define MAX_SEGMENTS	1000
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand();
+	}
+}
+
+/*
+ * Split @in into segments of random lengths up to @max_segment_len, some of
+ * them empty.  Return the number of segments.
+ */
+static size_t
+split_input(const u8 *in, size_t in_nbytes, size_t max_segment_len,
+	    struct libdeflate_iovec *iov)
+{
+	size_t pos = 0;
+	size_t n = 0;
+
+	while (pos < in_nbytes && n < MAX_SEGMENTS - 1) {
+		size_t len = rand() % (max_segment_len + 1);
+
+		len = MIN(len, in_nbytes - pos);
+		iov[n].data = &in[pos];
+		iov[n].nbytes = len;
+		pos += len;
+		n++;
+	}
+	iov[n].data = &in[pos];
+	iov[n].nbytes = in_nbytes - pos;
+	return n + 1;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 2000000;
+	const size_t out_avail = 2 * max_nbytes;
+	static const size_t sizes[] = { 0, 1, 4096, 100000, 557056, 557057,
+					2000000 };
+	struct libdeflate_iovec *iov;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *contiguous, *decompressed;
+	int level;
+	size_t i;
+
+	begin_program(argv);
+
+	iov = xmalloc(MAX_SEGMENTS * sizeof(iov[0]));
+	original = xmalloc(max_nbytes);
+	compressed = xmalloc(out_avail);
+	contiguous = xmalloc(out_avail);
+	decompressed = xmalloc(max_nbytes);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, max_nbytes);
+
+	for (level = 0; level <= 12; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+
+		ASSERT(c != NULL);
+		for (i = 0; i < ARRAY_LEN(sizes); i++) {
+			size_t in_nbytes = sizes[i];
+			size_t max_segment_len = 1 + (rand() % 65536);
+			size_t iovcnt, size, whole_size;
+
+			/* Only test the largest size at a few levels. */
+			if (in_nbytes > 1000000 && level % 4 != 1)
+				continue;
+
+			iovcnt = split_input(original, in_nbytes,
+					     max_segment_len, iov);
+
+			/* raw DEFLATE */
+			size = libdeflate_deflate_compress_iov(
+					c, iov, iovcnt, compressed, out_avail);
+			ASSERT(size != 0);
+			ASSERT(size <= libdeflate_deflate_compress_bound(
+						c, in_nbytes));
+			ASSERT(libdeflate_deflate_decompress(
+					d, compressed, size, decompressed,
+					in_nbytes, NULL) == LIBDEFLATE_SUCCESS);
+			ASSERT(in_nbytes == 0 ||
+			       memcmp(decompressed, original, in_nbytes) == 0);
+
+			/*
+			 * Input that fits in the gather buffer is compressed
+			 * exactly like the concatenated input.  Larger input
+			 * should still compress nearly as well.
+			 */
+			whole_size = libdeflate_deflate_compress(
+					c, original, in_nbytes,
+					contiguous, out_avail);
+			if (in_nbytes <= 557056) {
+				ASSERT(size == whole_size &&
+				       memcmp(compressed, contiguous,
+					      size) == 0);
+			} else {
+				ASSERT(size <= whole_size +
+					       (whole_size / 50) + 64);
+			}
+
+			/* Too small an output buffer must fail cleanly. */
+			if (size > 1)
+				ASSERT(libdeflate_deflate_compress_iov(
+						c, iov, iovcnt, compressed,
+						size - 1) == 0);
+
+			/* zlib */
+			size = libdeflate_zlib_compress_iov(
+					c, iov, iovcnt, compressed, out_avail);
+			ASSERT(size != 0);
+			ASSERT(size <= libdeflate_zlib_compress_bound(
+						c, in_nbytes));
+			ASSERT(libdeflate_zlib_decompress(
+					d, compressed, size, decompressed,
+					in_nbytes, NULL) == LIBDEFLATE_SUCCESS);
+			ASSERT(in_nbytes == 0 ||
+			       memcmp(decompressed, original, in_nbytes) == 0);
+
+			/* gzip */
+			size = libdeflate_gzip_compress_iov(
+					c, iov, iovcnt, compressed, out_avail);
+			ASSERT(size != 0);
+			ASSERT(size <= libdeflate_gzip_compress_bound(
+						c, in_nbytes));
+			ASSERT(libdeflate_gzip_decompress(
+					d, compressed, size, decompressed,
+					in_nbytes, NULL) == LIBDEFLATE_SUCCESS);
+			ASSERT(in_nbytes == 0 ||
+			       memcmp(decompressed, original, in_nbytes) == 0);
+		}
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(iov);
+	free(original);
+	free(compressed);
+	free(contiguous);
+	free(decompressed);
+	return 0;
+}
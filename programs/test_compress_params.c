@@ -0,0 +1,384 @@
+/*
+ * test_compress_params.c
+ *
+ * Test the compression parameters in struct libdeflate_options: that invalid
+ * values are rejected, that explicitly requesting a level's own parameters
+ * changes nothing, and that any valid combination round-trips.
+ */
+
+#include "test_util.h"
+
+#define MAX_NBYTES	400000
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand() % 64;
+	}
+}
+
+static void
+init_options(struct libdeflate_options *options)
+{
+	memset(options, 0, sizeof(*options));
+	options->sizeof_options = sizeof(*options);
+}
+
+static size_t
+compress_with_options(int level, const struct libdeflate_options *options,
+		      const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail)
+{
+	struct libdeflate_compressor *c;
+	size_t csize;
+
+	c = libdeflate_alloc_compressor_ex(level, options);
+	ASSERT(c != NULL);
+	csize = libdeflate_deflate_compress(c, in, in_nbytes, out, out_avail);
+	ASSERT(csize != 0);
+	libdeflate_free_compressor(c);
+	return csize;
+}
+
+static void
+test_invalid_options(void)
+{
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c;
+
+	init_options(&options);
+	options.sizeof_options = sizeof(options) + 1;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	ASSERT(libdeflate_alloc_decompressor_ex(&options) == NULL);
+
+	init_options(&options);
+	options.strategy = (enum libdeflate_strategy)9;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+
+	init_options(&options);
+	options.nice_match_length = 2;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	options.nice_match_length = 259;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+
+	init_options(&options);
+	options.soft_max_block_length = 4999;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	options.soft_max_block_length = 300001;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	options.soft_max_block_length = 65536;
+	ASSERT(libdeflate_alloc_compressor_ex(1, &options) == NULL);
+	options.strategy = LIBDEFLATE_STRATEGY_FASTEST;
+	ASSERT(libdeflate_alloc_compressor_ex(9, &options) == NULL);
+
+	init_options(&options);
+	options.max_search_depth = 3;
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	options.strategy = LIBDEFLATE_STRATEGY_GREEDY;
+	c = libdeflate_alloc_compressor_ex(6, &options);
+	ASSERT(c != NULL);
+	libdeflate_free_compressor(c);
+}
+
+/*
+ * Explicitly requesting the parameters that a level uses anyway must give the
+ * same output as not requesting them, and so must leaving the new fields out
+ * of the struct entirely.
+ */
+static void
+test_explicit_defaults(const u8 *in, size_t in_nbytes,
+		       u8 *out1, u8 *out2, size_t out_avail)
+{
+	static const struct {
+		int level;
+		enum libdeflate_strategy strategy;
+		unsigned max_search_depth;
+		unsigned nice_match_length;
+		unsigned soft_max_block_length;
+		unsigned max_optim_passes;
+	} tests[] = {
+		{ 1, LIBDEFLATE_STRATEGY_FASTEST, 0, 32, 65535, 0 },
+		{ 4, LIBDEFLATE_STRATEGY_GREEDY, 16, 30, 300000, 0 },
+		{ 6, LIBDEFLATE_STRATEGY_LAZY, 35, 65, 300000, 0 },
+		{ 9, LIBDEFLATE_STRATEGY_LAZY2, 600, 258, 300000, 0 },
+		{ 12, LIBDEFLATE_STRATEGY_NEAR_OPTIMAL, 300, 258, 300000, 10 },
+	};
+	struct libdeflate_options options;
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(tests); i++) {
+		struct libdeflate_compressor *c;
+		size_t size1, size2;
+
+		c = libdeflate_alloc_compressor(tests[i].level);
+		ASSERT(c != NULL);
+		size1 = libdeflate_deflate_compress(c, in, in_nbytes,
+						    out1, out_avail);
+		ASSERT(size1 != 0);
+		libdeflate_free_compressor(c);
+
+		init_options(&options);
+		options.strategy = tests[i].strategy;
+		options.max_search_depth = tests[i].max_search_depth;
+		options.nice_match_length = tests[i].nice_match_length;
+		options.soft_max_block_length = tests[i].soft_max_block_length;
+		options.max_optim_passes = tests[i].max_optim_passes;
+		size2 = compress_with_options(tests[i].level, &options,
+					      in, in_nbytes, out2, out_avail);
+		ASSERT(size2 == size1 && memcmp(out1, out2, size1) == 0);
+
+		init_options(&options);
+		options.sizeof_options =
+			offsetof(struct libdeflate_options, strategy);
+		size2 = compress_with_options(tests[i].level, &options,
+					      in, in_nbytes, out2, out_avail);
+		ASSERT(size2 == size1 && memcmp(out1, out2, size1) == 0);
+	}
+
+	/* A strategy takes its defaults from the nearest level using it. */
+	{
+		struct libdeflate_compressor *c;
+		size_t size1, size2;
+
+		c = libdeflate_alloc_compressor(4);
+		ASSERT(c != NULL);
+		size1 = libdeflate_deflate_compress(c, in, in_nbytes,
+						    out1, out_avail);
+		ASSERT(size1 != 0);
+		libdeflate_free_compressor(c);
+
+		init_options(&options);
+		options.strategy = LIBDEFLATE_STRATEGY_GREEDY;
+		size2 = compress_with_options(9, &options, in, in_nbytes,
+					      out2, out_avail);
+		ASSERT(size2 == size1 && memcmp(out1, out2, size1) == 0);
+	}
+}
+
+static unsigned
+random_param(unsigned min_val, unsigned max_val)
+{
+	if (rand() % 2 == 0)
+		return 0; /* use the default */
+	return min_val + (rand() % (max_val - min_val + 1));
+}
+
+/* Random valid parameters must round-trip with every strategy. */
+static void
+test_random_options(struct libdeflate_decompressor *d,
+		    const u8 *in, u8 *out, size_t out_avail, u8 *decompressed)
+{
+	int i;
+
+	for (i = 0; i < 60; i++) {
+		struct libdeflate_options options;
+		int level = 1 + (rand() % 12);
+		size_t in_nbytes = rand() % (MAX_NBYTES + 1);
+		size_t csize;
+		size_t actual_nbytes;
+
+		init_options(&options);
+		options.strategy = rand() % 9;
+		options.max_search_depth = random_param(4, 100);
+		options.nice_match_length = random_param(3, 258);
+		options.soft_max_block_length = random_param(5000, 65535);
+		options.max_optim_passes = random_param(1, 4);
+
+		csize = compress_with_options(level, &options, in, in_nbytes,
+					      out, out_avail);
+		ASSERT(libdeflate_deflate_decompress(d, out, csize,
+						     decompressed, in_nbytes,
+						     &actual_nbytes) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(actual_nbytes == in_nbytes);
+		ASSERT(in_nbytes == 0 ||
+		       memcmp(decompressed, in, in_nbytes) == 0);
+	}
+}
+
+/*
+ * ULTRAFAST must compress data with repeats and round-trip, including through
+ * the streaming interface and when the output buffer is only just big enough,
+ * which makes it write blocks to its own buffer first.  It only uses static
+ * Huffman codes.
+ */
+static void
+test_ultrafast(struct libdeflate_decompressor *d, u8 *in,
+	       size_t in_nbytes, u8 *out, size_t out_avail, u8 *decompressed)
+{
+	const void *sample = in;
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c;
+	struct libdeflate_compress_stats stats;
+	size_t csize, stream_size, in_pos, actual_out;
+	size_t i = 0;
+
+	/* Generate data with matches of length 4 or more. */
+	while (i < in_nbytes) {
+		size_t offset = 1 + (rand() % 1000);
+		size_t len = 4 + (rand() % 30);
+
+		if (i < 1000 || rand() % 4 == 0) {
+			in[i++] = rand() % 64;
+			continue;
+		}
+		for (; len != 0 && i < in_nbytes; len--, i++)
+			in[i] = in[i - offset];
+	}
+
+	init_options(&options);
+	options.strategy = LIBDEFLATE_STRATEGY_ULTRAFAST;
+	c = libdeflate_alloc_compressor_ex(6, &options);
+	ASSERT(c != NULL);
+
+	csize = libdeflate_deflate_compress(c, in, in_nbytes, out, out_avail);
+	ASSERT(csize != 0 && csize < in_nbytes / 2);
+	ASSERT(libdeflate_deflate_decompress(d, out, csize, decompressed,
+					     in_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+	stats.sizeof_stats = sizeof(stats);
+	libdeflate_get_compress_stats(c, &stats);
+	ASSERT(stats.num_static_blocks >= 1);
+	ASSERT(stats.num_dynamic_blocks == 0 && stats.num_trained_blocks == 0);
+
+	ASSERT(libdeflate_deflate_compress(c, in, in_nbytes, decompressed,
+					   csize) == csize);
+	ASSERT(memcmp(decompressed, out, csize) == 0);
+	ASSERT(libdeflate_deflate_compress(c, in, in_nbytes, decompressed,
+					   csize - 1) == 0);
+
+	ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+	stream_size = 0;
+	for (in_pos = 0; in_pos < in_nbytes; in_pos += 100000) {
+		size_t n = MIN(100000, in_nbytes - in_pos);
+
+		ASSERT(libdeflate_deflate_compress_stream_update(
+				c, &in[in_pos], n, &out[stream_size],
+				out_avail - stream_size,
+				&actual_out) == LIBDEFLATE_SUCCESS);
+		stream_size += actual_out;
+	}
+	ASSERT(libdeflate_deflate_compress_stream_finish(
+			c, &out[stream_size], out_avail - stream_size,
+			&actual_out) == LIBDEFLATE_SUCCESS);
+	stream_size += actual_out;
+	ASSERT(libdeflate_deflate_decompress(d, out, stream_size,
+					     decompressed, in_nbytes,
+					     NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+
+	ASSERT(libdeflate_train_huffman_table(c, &sample, &in_nbytes, 1) ==
+	       NULL);
+	libdeflate_free_compressor(c);
+}
+
+/* Fill a buffer like an image row: runs of a few distinct, noisy values. */
+static void
+generate_rle_data(u8 *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		size_t run = 1 + (rand() % 40);
+		u8 b = 64 + (rand() % 16);
+
+		while (run-- && i < size)
+			data[i++] = b;
+	}
+}
+
+/*
+ * HUFFMAN_ONLY and RLE must beat level 0 and round-trip, including when used
+ * through the streaming interface, where runs can continue across pieces.
+ */
+static void
+test_huffman_only_and_rle(struct libdeflate_decompressor *d,
+			  u8 *in, size_t in_nbytes, u8 *out, size_t out_avail,
+			  u8 *decompressed)
+{
+	static const enum libdeflate_strategy strategies[] = {
+		LIBDEFLATE_STRATEGY_HUFFMAN_ONLY,
+		LIBDEFLATE_STRATEGY_RLE,
+	};
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c;
+	size_t csize[ARRAY_LEN(strategies)];
+	size_t stream_size, in_pos, actual_out;
+	size_t i;
+
+	generate_rle_data(in, in_nbytes);
+	for (i = 0; i < ARRAY_LEN(strategies); i++) {
+		init_options(&options);
+		options.strategy = strategies[i];
+		c = libdeflate_alloc_compressor_ex(6, &options);
+		ASSERT(c != NULL);
+
+		csize[i] = libdeflate_deflate_compress(c, in, in_nbytes,
+						       out, out_avail);
+		ASSERT(csize[i] != 0 && csize[i] < in_nbytes * 2 / 3);
+		ASSERT(libdeflate_deflate_decompress(d, out, csize[i],
+						     decompressed, in_nbytes,
+						     NULL) == LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+
+		ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+		stream_size = 0;
+		for (in_pos = 0; in_pos < in_nbytes; in_pos += 100000) {
+			size_t n = MIN(100000, in_nbytes - in_pos);
+
+			ASSERT(libdeflate_deflate_compress_stream_update(
+					c, &in[in_pos], n, &out[stream_size],
+					out_avail - stream_size,
+					&actual_out) == LIBDEFLATE_SUCCESS);
+			stream_size += actual_out;
+		}
+		ASSERT(libdeflate_deflate_compress_stream_finish(
+				c, &out[stream_size], out_avail - stream_size,
+				&actual_out) == LIBDEFLATE_SUCCESS);
+		stream_size += actual_out;
+		ASSERT(libdeflate_deflate_decompress(d, out, stream_size,
+						     decompressed, in_nbytes,
+						     NULL) == LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+		libdeflate_free_compressor(c);
+	}
+	/* RLE should do much better than Huffman-only on this data. */
+	ASSERT(csize[1] < csize[0] / 2);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t out_avail = 2 * MAX_NBYTES;
+	struct libdeflate_decompressor *d;
+	u8 *original, *out1, *out2;
+
+	begin_program(argv);
+
+	original = xmalloc(MAX_NBYTES);
+	out1 = xmalloc(out_avail);
+	out2 = xmalloc(out_avail);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, MAX_NBYTES);
+
+	test_invalid_options();
+	test_explicit_defaults(original, MAX_NBYTES, out1, out2, out_avail);
+	test_random_options(d, original, out1, out_avail, out2);
+	test_ultrafast(d, original, MAX_NBYTES, out1, out_avail, out2);
+	test_huffman_only_and_rle(d, original, MAX_NBYTES, out1, out_avail,
+				  out2);
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(out1);
+	free(out2);
+	return 0;
+}
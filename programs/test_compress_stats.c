@@ -0,0 +1,136 @@
+/*
+ * test_compress_stats.c
+ *
+ * Test that the compression statistics are consistent with the data that was
+ * compressed.
+ */
+
+#include "test_util.h"
+
+/* Generate data whose statistics change partway through. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i < size / 2)
+			data[i] = 'a' + (rand() % 4);
+		else if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand();
+	}
+}
+
+static void
+check_stats(struct libdeflate_compressor *c, int level, size_t in_nbytes)
+{
+	struct libdeflate_compress_stats stats;
+
+	stats.sizeof_stats = sizeof(stats);
+	libdeflate_get_compress_stats(c, &stats);
+
+	ASSERT(stats.sizeof_stats == sizeof(stats));
+	ASSERT(stats.in_nbytes == in_nbytes);
+	ASSERT(stats.num_blocks >= 1);
+	ASSERT(stats.num_blocks == stats.num_uncompressed_blocks +
+				   stats.num_static_blocks +
+				   stats.num_dynamic_blocks +
+				   stats.num_trained_blocks);
+	ASSERT(stats.num_literals + stats.total_match_length == in_nbytes);
+	ASSERT(stats.total_match_length >= 3 * stats.num_matches);
+	ASSERT(stats.total_match_length <= 258 * stats.num_matches);
+	ASSERT(stats.num_block_split_ends < stats.num_blocks);
+	if (level == 0) {
+		ASSERT(stats.num_matches == 0);
+		ASSERT(stats.num_blocks == stats.num_uncompressed_blocks);
+	}
+	if (level < 10) {
+		ASSERT(stats.num_optim_passes == 0);
+	} else if (in_nbytes > 100) {
+		ASSERT(stats.num_optim_passes >= stats.num_blocks);
+	}
+#ifdef LIBDEFLATE_ENABLE_COUNTERS
+	if (level == 0) {
+		ASSERT(stats.num_match_searches == 0);
+	} else if (in_nbytes >= 1000) {
+		ASSERT(stats.num_match_searches > 0);
+		ASSERT(stats.num_match_candidates > 0);
+	}
+#else
+	ASSERT(stats.num_match_searches == 0);
+	ASSERT(stats.num_match_candidates == 0);
+#endif
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 200000;
+	static const size_t sizes[] = { 0, 10, 1000, 200000 };
+	u8 *original, *compressed;
+	size_t out_avail;
+	int level;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(max_nbytes);
+	out_avail = libdeflate_deflate_compress_bound(NULL, max_nbytes);
+	compressed = xmalloc(out_avail);
+	generate_test_data(original, max_nbytes);
+
+	for (level = 0; level <= 12; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+		struct libdeflate_compress_stats stats;
+
+		ASSERT(c != NULL);
+
+		/* A new compressor has no statistics. */
+		stats.sizeof_stats = sizeof(stats);
+		libdeflate_get_compress_stats(c, &stats);
+		ASSERT(stats.in_nbytes == 0 && stats.num_blocks == 0 &&
+		       stats.num_literals == 0);
+
+		for (i = 0; i < ARRAY_LEN(sizes); i++) {
+			libdeflate_reset_compress_stats(c);
+			ASSERT(libdeflate_deflate_compress(c, original,
+							   sizes[i], compressed,
+							   out_avail) != 0);
+			check_stats(c, level, sizes[i]);
+		}
+
+		/* The statistics accumulate over calls. */
+		libdeflate_reset_compress_stats(c);
+		for (i = 0; i < ARRAY_LEN(sizes); i++)
+			ASSERT(libdeflate_deflate_compress(c, original,
+							   sizes[i], compressed,
+							   out_avail) != 0);
+		check_stats(c, level, 0 + 10 + 1000 + 200000);
+
+		/* An older, shorter version of the struct is accepted. */
+		memset(&stats, 0xFF, sizeof(stats));
+		stats.sizeof_stats = offsetof(struct libdeflate_compress_stats,
+					      num_blocks);
+		libdeflate_get_compress_stats(c, &stats);
+		ASSERT(stats.in_nbytes == 0 + 10 + 1000 + 200000);
+		ASSERT(stats.num_blocks == (uint64_t)-1);
+
+		/* The data changes halfway, so the block should be split. */
+		if (level >= 2) {
+			libdeflate_reset_compress_stats(c);
+			libdeflate_deflate_compress(c, original, max_nbytes,
+						    compressed, out_avail);
+			stats.sizeof_stats = sizeof(stats);
+			libdeflate_get_compress_stats(c, &stats);
+			ASSERT(stats.num_block_split_ends >= 1);
+		}
+		libdeflate_free_compressor(c);
+	}
+
+	free(original);
+	free(compressed);
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * test_compressor_memory.c
+ *
+ * Test that libdeflate_compressor_memory_size() gives exactly the size that
+ * compressor allocation requests, so that the memory can come from a pool, and
+ * that the 'alloc_alignment' and 'huge_pages' options are honored.
+ */
+
+#include "test_util.h"
+
+static u8 *pool;
+static size_t pool_size;
+static bool pool_used;
+
+/* A malloc function that hands out a preallocated buffer of exact size */
+static void *
+pool_malloc(size_t size)
+{
+	ASSERT(!pool_used);
+	ASSERT(size == pool_size);
+	pool_used = true;
+	return pool;
+}
+
+static void
+pool_free(void *ptr)
+{
+	ASSERT(pool_used && ptr == pool);
+	pool_used = false;
+}
+
+static void
+check_compressor(int level, struct libdeflate_options *options,
+		 size_t alignment, const u8 *in, size_t in_nbytes,
+		 u8 *out, size_t out_avail)
+{
+	struct libdeflate_compressor *c;
+
+	pool_size = libdeflate_compressor_memory_size(level, options);
+	ASSERT(pool_size != 0);
+	pool = xmalloc(pool_size);
+	options->malloc_func = pool_malloc;
+	options->free_func = pool_free;
+	c = libdeflate_alloc_compressor_ex(level, options);
+	ASSERT(c != NULL && pool_used);
+	ASSERT((uintptr_t)c % alignment == 0);
+	ASSERT(libdeflate_deflate_compress(c, in, in_nbytes,
+					   out, out_avail) != 0);
+	libdeflate_free_compressor(c);
+	ASSERT(!pool_used);
+	free(pool);
+	options->malloc_func = NULL;
+	options->free_func = NULL;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const struct libdeflate_task_submitter submitter;
+	static const char text[] =
+		"It was the best of times, it was the worst of times";
+	struct libdeflate_options options;
+	u8 in[4 * sizeof(text)];
+	u8 out[8 * sizeof(text)];
+	int level;
+	size_t size, i;
+
+	begin_program(argv);
+
+	for (i = 0; i < 4; i++)
+		memcpy(&in[i * sizeof(text)], text, sizeof(text));
+
+	memset(&options, 0, sizeof(options));
+	options.sizeof_options = sizeof(options);
+	ASSERT(libdeflate_compressor_memory_size(-1, NULL) == 0);
+	ASSERT(libdeflate_compressor_memory_size(15, NULL) == 0);
+	options.alloc_alignment = 3000;
+	ASSERT(libdeflate_compressor_memory_size(6, &options) == 0);
+	ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+
+	for (level = 0; level <= 14; level++) {
+		memset(&options, 0, sizeof(options));
+		options.sizeof_options = sizeof(options);
+		ASSERT(libdeflate_compressor_memory_size(level, NULL) ==
+		       libdeflate_compressor_memory_size(level, &options));
+		check_compressor(level, &options, 64, in, sizeof(in),
+				 out, sizeof(out));
+
+		options.low_memory = 1;
+		check_compressor(level, &options, 64, in, sizeof(in),
+				 out, sizeof(out));
+		options.low_memory = 0;
+
+		options.task_submitter = &submitter;
+		check_compressor(level, &options, 64, in, sizeof(in),
+				 out, sizeof(out));
+		options.task_submitter = NULL;
+
+		options.strategy = LIBDEFLATE_STRATEGY_RLE;
+		check_compressor(level, &options, 64, in, sizeof(in),
+				 out, sizeof(out));
+		options.strategy = LIBDEFLATE_STRATEGY_DEFAULT;
+
+		options.alloc_alignment = 4096;
+		check_compressor(level, &options, 4096, in, sizeof(in),
+				 out, sizeof(out));
+		options.alloc_alignment = 0;
+
+		/*
+		 * Huge pages, where supported, are used only for compressors
+		 * that would fill one.
+		 */
+		options.huge_pages = 1;
+		size = libdeflate_compressor_memory_size(level, &options);
+		if (size == libdeflate_compressor_memory_size(level, NULL)) {
+			check_compressor(level, &options, 64, in, sizeof(in),
+					 out, sizeof(out));
+		} else {
+			ASSERT(level >= 10);
+			check_compressor(level, &options, 2 << 20, in,
+					 sizeof(in), out, sizeof(out));
+		}
+	}
+	return 0;
+}
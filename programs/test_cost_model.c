@@ -0,0 +1,126 @@
+/*
+ * test_cost_model.c
+ *
+ * Test saving the cost model of a near-optimal compressor and starting later
+ * calls from it: the output must still decompress correctly, should be smaller
+ * when only one optimization pass is made, and must be unaffected once the
+ * model is unset or for compressors that don't use the near-optimal parser.
+ */
+
+#include "test_util.h"
+
+#define NUM_DOCS	50
+#define MAX_DOC_LEN	8000
+
+/*
+ * Generate a text-like document: words from a fixed vocabulary, with some much
+ * more common than others.
+ */
+static size_t
+generate_doc(u8 *data)
+{
+	static const char * const words[] = {
+		"the", "of", "and", "compression", "a", "to", "in", "block",
+		"is", "that", "for", "match", "it", "with", "as", "literal",
+		"was", "on", "be", "huffman", "at", "by", "this", "offset",
+		"had", "not", "are", "length", "but", "from", "or", "symbol",
+	};
+	size_t size = 2000 + (rand() % (MAX_DOC_LEN - 2000));
+	size_t i = 0;
+
+	while (i < size) {
+		const char *word = words[(rand() % 32) * (rand() % 32) / 32];
+		size_t len = MIN(strlen(word), size - i);
+
+		memcpy(&data[i], word, len);
+		i += len;
+		if (i < size)
+			data[i++] = (rand() % 8 == 0) ? ',' : ' ';
+	}
+	return size;
+}
+
+static size_t
+compress_and_check(struct libdeflate_compressor *c,
+		   struct libdeflate_decompressor *d,
+		   const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail)
+{
+	u8 decompressed[MAX_DOC_LEN];
+	size_t out_nbytes;
+
+	out_nbytes = libdeflate_deflate_compress(c, in, in_nbytes,
+						 out, out_avail);
+	ASSERT(out_nbytes != 0);
+	ASSERT(libdeflate_deflate_decompress(d, out, out_nbytes, decompressed,
+					     in_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+	return out_nbytes;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c6, *cold, *warm;
+	struct libdeflate_decompressor *d;
+	struct libdeflate_cost_model *model;
+	u8 in[MAX_DOC_LEN];
+	u8 out1[2 * MAX_DOC_LEN];
+	u8 out2[2 * MAX_DOC_LEN];
+	size_t in_nbytes, size1, size2;
+	size_t cold_total = 0, warm_total = 0;
+	int i;
+
+	begin_program(argv);
+
+	memset(&options, 0, sizeof(options));
+	options.sizeof_options = sizeof(options);
+	options.max_optim_passes = 1;
+	c6 = libdeflate_alloc_compressor(6);
+	cold = libdeflate_alloc_compressor_ex(12, &options);
+	warm = libdeflate_alloc_compressor_ex(12, &options);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(c6 != NULL && cold != NULL && warm != NULL && d != NULL);
+
+	/* There's no model before a block has been optimized. */
+	ASSERT(libdeflate_save_cost_model(warm) == NULL);
+
+	in_nbytes = generate_doc(in);
+	compress_and_check(c6, d, in, in_nbytes, out1, sizeof(out1));
+	ASSERT(libdeflate_save_cost_model(c6) == NULL);
+	compress_and_check(warm, d, in, in_nbytes, out1, sizeof(out1));
+	model = libdeflate_save_cost_model(warm);
+	ASSERT(model != NULL);
+	libdeflate_set_cost_model(warm, model);
+	libdeflate_set_cost_model(c6, model);
+
+	for (i = 0; i < NUM_DOCS; i++) {
+		in_nbytes = generate_doc(in);
+		cold_total += compress_and_check(cold, d, in, in_nbytes,
+						 out1, sizeof(out1));
+		warm_total += compress_and_check(warm, d, in, in_nbytes,
+						 out2, sizeof(out2));
+	}
+	ASSERT(warm_total < cold_total);
+
+	/* The model does nothing at levels that don't use it. */
+	size1 = compress_and_check(c6, d, in, in_nbytes, out1, sizeof(out1));
+	libdeflate_set_cost_model(c6, NULL);
+	size2 = compress_and_check(c6, d, in, in_nbytes, out2, sizeof(out2));
+	ASSERT(size1 == size2 && memcmp(out1, out2, size1) == 0);
+
+	/* Unsetting the model gives the same output as never setting it. */
+	libdeflate_set_cost_model(warm, NULL);
+	size1 = compress_and_check(cold, d, in, in_nbytes, out1, sizeof(out1));
+	size2 = compress_and_check(warm, d, in, in_nbytes, out2, sizeof(out2));
+	ASSERT(size1 == size2 && memcmp(out1, out2, size1) == 0);
+
+	libdeflate_free_cost_model(model);
+	libdeflate_free_cost_model(NULL);
+	libdeflate_free_compressor(c6);
+	libdeflate_free_compressor(cold);
+	libdeflate_free_compressor(warm);
+	libdeflate_free_decompressor(d);
+	return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * test_crc_variants.c
+ *
+ * Verify that libdeflate_crc32c() and libdeflate_crc64() give the standard
+ * check values, and that they agree with a bit-at-a-time implementation of the
+ * same CRCs for different buffer sizes, alignments, and initial values, both
+ * when checksumming a buffer at once and in pieces.
+ */
+
+#include "test_util.h"
+
+#include <time.h>
+
+/* CRC-32C and CRC-64 as in their definitions, one bit at a time */
+static u32
+crc32c_bitwise(u32 crc, const u8 *p, size_t len)
+{
+	size_t i;
+	int j;
+
+	crc = ~crc;
+	for (i = 0; i < len; i++) {
+		crc ^= p[i];
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+	}
+	return ~crc;
+}
+
+static u64
+crc64_bitwise(u64 crc, const u8 *p, size_t len)
+{
+	size_t i;
+	int j;
+
+	crc = ~crc;
+	for (i = 0; i < len; i++) {
+		crc ^= p[i];
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xC96C5795D7870F42 : 0);
+	}
+	return ~crc;
+}
+
+static u64
+select_initial_crc(void)
+{
+	if (rand() & 1)
+		return 0;
+	return ((u64)rand() << 48) ^ ((u64)rand() << 32) ^
+	       ((u64)rand() << 16) ^ rand();
+}
+
+/*
+ * Check the CRCs of 'len' bytes at 'p', all at once and in two pieces, against
+ * the bitwise implementations.
+ */
+static void
+check_crcs(const u8 *p, size_t len)
+{
+	u64 initial = select_initial_crc();
+	u32 crc32c = crc32c_bitwise(initial, p, len);
+	u64 crc64 = crc64_bitwise(initial, p, len);
+	size_t split = rand() % (len + 1);
+
+	ASSERT(libdeflate_crc32c(initial, p, len) == crc32c);
+	ASSERT(libdeflate_crc64(initial, p, len) == crc64);
+
+	ASSERT(libdeflate_crc32c(libdeflate_crc32c(initial, p, split),
+				 p + split, len - split) == crc32c);
+	ASSERT(libdeflate_crc64(libdeflate_crc64(initial, p, split),
+				p + split, len - split) == crc64);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const u8 check_input[] = "123456789";
+	u8 *buf_start, *buf_end;
+	size_t len;
+	int i;
+
+	begin_program(argv);
+
+	alloc_guarded_buffer(262144, &buf_start, &buf_end);
+	for (i = 0; i < 262144; i++)
+		buf_start[i] = rand();
+
+	/* The check values from the catalogue of parametrised CRC algorithms */
+	ASSERT(libdeflate_crc32c(0, check_input, 9) == 0xE3069283);
+	ASSERT(libdeflate_crc64(0, check_input, 9) == 0x995DC9BBDF1939FA);
+	ASSERT(crc32c_bitwise(0, check_input, 9) == 0xE3069283);
+	ASSERT(crc64_bitwise(0, check_input, 9) == 0x995DC9BBDF1939FA);
+
+	/* The initial value */
+	ASSERT(libdeflate_crc32c(0x12345678, NULL, 100) == 0);
+	ASSERT(libdeflate_crc64(0x12345678, NULL, 100) == 0);
+	ASSERT(libdeflate_crc32c(0x12345678, buf_start, 0) == 0x12345678);
+	ASSERT(libdeflate_crc64(0x12345678, buf_start, 0) == 0x12345678);
+
+	srand(time(NULL));
+
+	/*
+	 * Every length up to a few vectors, at the start and end of the buffer
+	 * so that overreads would be caught, and at a random alignment
+	 */
+	for (len = 0; len <= 1100; len++) {
+		check_crcs(buf_start, len);
+		check_crcs(buf_end - len, len);
+		check_crcs(buf_start + (rand() % 64), len);
+	}
+
+	/* Long lengths, which take the main loops and alignment code */
+	for (i = 0; i < 20; i++) {
+		len = rand() % 262144;
+		check_crcs(buf_end - len, len);
+		check_crcs(buf_start + (rand() % (262144 - len + 1)), len);
+	}
+	check_crcs(buf_start, 262144);
+
+	free_guarded_buffer(buf_start, buf_end);
+	return 0;
+}
@@ -2,7 +2,8 @@
  * test_custom_malloc.c
  *
  * Test the support for custom memory allocators.
- * Also test injecting allocation failures.
+ * Also test injecting allocation failures, and that nothing depends on the
+ * allocator returning zeroed memory.
  */
 
 #include "test_util.h"
@@ -22,6 +23,22 @@ static void *do_fail_malloc(size_t size)
 	return NULL;
 }
 
+/* Value that do_garbage_malloc() fills each allocation with */
+static const void *garbage_ptr;
+
+static void *do_garbage_malloc(size_t size)
+{
+	const void **p = malloc(size);
+	size_t i;
+
+	malloc_count++;
+	if (p != NULL) {
+		for (i = 0; i < size / sizeof(*p); i++)
+			p[i] = garbage_ptr;
+	}
+	return p;
+}
+
 static void do_free(void *ptr)
 {
 	free_count++;
@@ -142,6 +159,54 @@ static void do_fault_injection_test(void)
 	reset_state();
 }
 
+/*
+ * Test compressing with an allocator that fills memory with a pointer into the
+ * input, so that any pointer field of the compressor that isn't initialized
+ * looks plausible.
+ */
+static void do_garbage_memory_test(void)
+{
+	static const struct libdeflate_options options = {
+		.sizeof_options = sizeof(options),
+		.malloc_func = do_garbage_malloc,
+		.free_func = do_free,
+	};
+	const size_t in_nbytes = 100000;
+	u8 *in = xmalloc(in_nbytes);
+	u8 *out = xmalloc(2 * in_nbytes);
+	u8 *decompressed = xmalloc(in_nbytes);
+	struct libdeflate_decompressor *d;
+	size_t i;
+	int level;
+
+	for (i = 0; i < in_nbytes; i++)
+		in[i] = (i % 1000 < 100) ? rand() : 'a' + (i % 7);
+	garbage_ptr = in;
+	d = libdeflate_alloc_decompressor_ex(&options);
+	ASSERT(d != NULL);
+	for (level = 0; level <= 14; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor_ex(level, &options);
+		size_t csize;
+
+		ASSERT(c != NULL);
+		csize = libdeflate_deflate_compress(c, in, in_nbytes, out,
+						    2 * in_nbytes);
+		ASSERT(csize != 0);
+		ASSERT(libdeflate_deflate_decompress(d, out, csize,
+						     decompressed, in_nbytes,
+						     NULL) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+		libdeflate_free_compressor(c);
+	}
+	libdeflate_free_decompressor(d);
+	free(in);
+	free(out);
+	free(decompressed);
+	reset_state();
+}
+
 int
 tmain(int argc, tchar *argv[])
 {
@@ -151,5 +216,6 @@ tmain(int argc, tchar *argv[])
 	do_custom_memalloc_test(false);
 	do_options_test();
 	do_fault_injection_test();
+	do_garbage_memory_test();
 	return 0;
 }
@@ -0,0 +1,194 @@
+/*
+ * test_decompress_iov.c
+ *
+ * Test decompressing into a list of output segments and into a sink callback,
+ * including matches that cross segment boundaries, too little output space,
+ * and a sink that stops decompression early.
+ */
+
+#include "test_util.h"
+
+#define MAX_SEGMENTS	2000
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand();
+	}
+}
+
+/*
+ * Split @buf into segments of random lengths up to @max_segment_len, some of
+ * them empty.  Return the number of segments.
+ */
+static size_t
+split_buffer(u8 *buf, size_t size, size_t max_segment_len,
+	     struct libdeflate_out_iovec *iov)
+{
+	size_t pos = 0;
+	size_t n = 0;
+
+	while (pos < size && n < MAX_SEGMENTS - 1) {
+		size_t len = rand() % (max_segment_len + 1);
+
+		len = MIN(len, size - pos);
+		iov[n].data = &buf[pos];
+		iov[n].nbytes = len;
+		pos += len;
+		n++;
+	}
+	iov[n].data = &buf[pos];
+	iov[n].nbytes = size - pos;
+	return n + 1;
+}
+
+struct sink_state {
+	const u8 *expected;
+	size_t pos;
+	size_t limit;
+	size_t max_call_nbytes;
+};
+
+/* Check the data against the original, and stop once 'limit' is exceeded. */
+static int
+check_sink(void *ctx, const void *data, size_t nbytes)
+{
+	struct sink_state *state = ctx;
+
+	ASSERT(nbytes != 0);
+	if (state->pos + nbytes > state->limit)
+		return 1;
+	ASSERT(memcmp(data, &state->expected[state->pos], nbytes) == 0);
+	state->pos += nbytes;
+	state->max_call_nbytes = MAX(state->max_call_nbytes, nbytes);
+	return 0;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 1000000;
+	static const size_t sizes[] = { 0, 1, 4096, 100000, 1000000 };
+	struct libdeflate_out_iovec *iov;
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *decompressed;
+	size_t compressed_avail;
+	size_t i;
+
+	begin_program(argv);
+
+	iov = xmalloc(MAX_SEGMENTS * sizeof(iov[0]));
+	original = xmalloc(max_nbytes);
+	decompressed = xmalloc(max_nbytes + 1);
+	c = libdeflate_alloc_compressor(6);
+	ASSERT(c != NULL);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	compressed_avail = libdeflate_deflate_compress_bound(c, max_nbytes) + 1;
+	compressed = xmalloc(compressed_avail);
+	generate_test_data(original, max_nbytes);
+
+	for (i = 0; i < ARRAY_LEN(sizes); i++) {
+		size_t in_nbytes = sizes[i];
+		size_t csize, iovcnt, actual_in, actual_out;
+		struct sink_state state;
+		int trial;
+
+		csize = libdeflate_deflate_compress(c, original, in_nbytes,
+						    compressed,
+						    compressed_avail - 1);
+		ASSERT(csize != 0);
+		/* A trailing byte must be left unconsumed. */
+		compressed[csize] = 0xAA;
+
+		for (trial = 0; trial < 4; trial++) {
+			size_t max_segment_len = 1 + (rand() % 40000);
+
+			/* Exact output size */
+			memset(decompressed, 0, max_nbytes + 1);
+			iovcnt = split_buffer(decompressed, in_nbytes,
+					      max_segment_len, iov);
+			ASSERT(libdeflate_deflate_decompress_iov(
+					d, compressed, csize + 1, iov, iovcnt,
+					&actual_in, NULL) ==
+			       LIBDEFLATE_SUCCESS);
+			ASSERT(actual_in == csize);
+			ASSERT(in_nbytes == 0 ||
+			       memcmp(decompressed, original, in_nbytes) == 0);
+
+			/* More output space than needed */
+			iovcnt = split_buffer(decompressed, in_nbytes + 1,
+					      max_segment_len, iov);
+			ASSERT(libdeflate_deflate_decompress_iov(
+					d, compressed, csize, iov, iovcnt,
+					NULL, NULL) ==
+			       LIBDEFLATE_SHORT_OUTPUT);
+			ASSERT(libdeflate_deflate_decompress_iov(
+					d, compressed, csize, iov, iovcnt,
+					NULL, &actual_out) ==
+			       LIBDEFLATE_SUCCESS);
+			ASSERT(actual_out == in_nbytes);
+
+			/* Too little output space */
+			if (in_nbytes != 0) {
+				iovcnt = split_buffer(decompressed,
+						      in_nbytes - 1,
+						      max_segment_len, iov);
+				ASSERT(libdeflate_deflate_decompress_iov(
+						d, compressed, csize, iov,
+						iovcnt, NULL, &actual_out) ==
+				       LIBDEFLATE_INSUFFICIENT_SPACE);
+			}
+		}
+
+		/* Sink */
+		memset(&state, 0, sizeof(state));
+		state.expected = original;
+		state.limit = SIZE_MAX;
+		ASSERT(libdeflate_deflate_decompress_to_sink(
+				d, compressed, csize + 1, check_sink, &state,
+				&actual_in, &actual_out) == LIBDEFLATE_SUCCESS);
+		ASSERT(actual_in == csize);
+		ASSERT(actual_out == in_nbytes);
+		ASSERT(state.pos == in_nbytes);
+		ASSERT(state.max_call_nbytes <= 98304);
+
+		/* A sink that stops early */
+		if (in_nbytes != 0) {
+			memset(&state, 0, sizeof(state));
+			state.expected = original;
+			state.limit = in_nbytes / 2;
+			ASSERT(libdeflate_deflate_decompress_to_sink(
+					d, compressed, csize, check_sink,
+					&state, NULL, NULL) ==
+			       LIBDEFLATE_INSUFFICIENT_SPACE);
+		}
+
+		/* Truncated input */
+		if (csize > 1) {
+			memset(&state, 0, sizeof(state));
+			state.expected = original;
+			state.limit = SIZE_MAX;
+			ASSERT(libdeflate_deflate_decompress_to_sink(
+					d, compressed, csize - 1, check_sink,
+					&state, NULL, NULL) ==
+			       LIBDEFLATE_BAD_DATA);
+		}
+	}
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+	free(iov);
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
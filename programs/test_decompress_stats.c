@@ -0,0 +1,205 @@
+/*
+ * test_decompress_stats.c
+ *
+ * Test that the block callback and the decompression statistics are
+ * consistent with the data that was decompressed.
+ */
+
+#include "test_util.h"
+
+#define MAX_BLOCKS	1000
+
+struct block_list {
+	struct libdeflate_block_info blocks[MAX_BLOCKS];
+	size_t num_blocks;
+};
+
+static void
+record_block(void *ctx, const struct libdeflate_block_info *info)
+{
+	struct block_list *list = ctx;
+
+	ASSERT(list->num_blocks < MAX_BLOCKS);
+	list->blocks[list->num_blocks++] = *info;
+}
+
+/* Generate data that compresses into blocks of several types. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i < size / 3)
+			data[i] = rand();
+		else if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = 'a' + (rand() % 8);
+	}
+}
+
+static void
+check_blocks(struct libdeflate_decompressor *d, const struct block_list *list,
+	     size_t header_nbytes, size_t out_nbytes)
+{
+	struct libdeflate_decompress_stats stats;
+	uint64_t huffman_nbytes = 0;
+	uint64_t num_types[3] = { 0 };
+	size_t i;
+
+	ASSERT(list->num_blocks >= 1);
+	ASSERT(list->blocks[0].in_bitpos == 8 * header_nbytes);
+	ASSERT(list->blocks[0].out_pos == 0);
+	for (i = 0; i < list->num_blocks; i++) {
+		const struct libdeflate_block_info *info = &list->blocks[i];
+		uint64_t end = (i + 1 < list->num_blocks) ?
+			       list->blocks[i + 1].out_pos : out_nbytes;
+
+		ASSERT(info->block_type >= 0 && info->block_type <= 2);
+		num_types[info->block_type]++;
+		ASSERT(!info->is_final == (i + 1 < list->num_blocks));
+		ASSERT(info->out_pos <= end);
+		ASSERT(info->header_nbits >= 3);
+		if (i > 0) {
+			ASSERT(info->in_bitpos >= list->blocks[i - 1].in_bitpos +
+						  list->blocks[i - 1].header_nbits);
+		}
+		if (info->block_type == 0) {
+			ASSERT(info->header_nbits >= 3 + 32);
+			ASSERT((info->in_bitpos + info->header_nbits) % 8 == 0);
+			ASSERT(info->litlen_tablebits == 0);
+			ASSERT(info->litlen_subtable_syms == 0);
+		} else {
+			if (info->block_type == 1) {
+				ASSERT(info->header_nbits == 3);
+			}
+			ASSERT(info->litlen_tablebits >= 1 &&
+			       info->litlen_tablebits <= 15);
+			huffman_nbytes += end - info->out_pos;
+		}
+	}
+
+	stats.sizeof_stats = sizeof(stats);
+	libdeflate_get_decompress_stats(d, &stats);
+	ASSERT(stats.sizeof_stats == sizeof(stats));
+	ASSERT(stats.num_blocks == list->num_blocks);
+	ASSERT(stats.num_uncompressed_blocks == num_types[0]);
+	ASSERT(stats.num_static_blocks == num_types[1]);
+	ASSERT(stats.num_dynamic_blocks == num_types[2]);
+	ASSERT(stats.num_reused_dynamic_codes <= stats.num_dynamic_blocks);
+	ASSERT(stats.num_fastloop_bytes + stats.num_generic_loop_bytes ==
+	       huffman_nbytes);
+#ifdef LIBDEFLATE_ENABLE_COUNTERS
+	/* The generic loop is entered at most once per Huffman block. */
+	ASSERT(stats.num_generic_loop_entries <= num_types[1] + num_types[2]);
+	if (stats.num_fastloop_bytes != 0)
+		ASSERT(stats.num_fastloop_refills != 0);
+#else
+	ASSERT(stats.num_fastloop_refills == 0);
+	ASSERT(stats.num_litlen_subtable_lookups == 0);
+	ASSERT(stats.num_offset1_matches == 0);
+	ASSERT(stats.num_generic_loop_entries == 0);
+#endif
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 300000;
+	static const size_t sizes[] = { 0, 10, 1000, 300000 };
+	static const int levels[] = { 0, 1, 6, 12 };
+	struct libdeflate_decompressor *d;
+	struct libdeflate_decompress_stats stats;
+	struct block_list *list;
+	u8 *original, *compressed, *decompressed;
+	size_t out_avail;
+	size_t last_csize = 0;
+	size_t i, j;
+
+	begin_program(argv);
+
+	original = xmalloc(max_nbytes);
+	decompressed = xmalloc(max_nbytes);
+	out_avail = libdeflate_zlib_compress_bound(NULL, max_nbytes);
+	compressed = xmalloc(out_avail);
+	list = xmalloc(sizeof(*list));
+	generate_test_data(original, max_nbytes);
+
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+
+	/* A new decompressor has no statistics. */
+	stats.sizeof_stats = sizeof(stats);
+	libdeflate_get_decompress_stats(d, &stats);
+	ASSERT(stats.num_blocks == 0 && stats.num_fastloop_bytes == 0);
+
+	libdeflate_set_block_callback(d, record_block, list);
+	for (i = 0; i < ARRAY_LEN(levels); i++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(levels[i]);
+
+		ASSERT(c != NULL);
+		for (j = 0; j < ARRAY_LEN(sizes); j++) {
+			size_t csize;
+
+			/* raw DEFLATE */
+			csize = libdeflate_deflate_compress(c, original,
+							    sizes[j],
+							    compressed,
+							    out_avail);
+			ASSERT(csize != 0);
+			libdeflate_reset_decompress_stats(d);
+			list->num_blocks = 0;
+			ASSERT(libdeflate_deflate_decompress(d, compressed,
+							     csize,
+							     decompressed,
+							     sizes[j], NULL) ==
+			       LIBDEFLATE_SUCCESS);
+			check_blocks(d, list, 0, sizes[j]);
+
+			/* zlib: bit positions include the 2-byte header */
+			csize = libdeflate_zlib_compress(c, original, sizes[j],
+							 compressed, out_avail);
+			ASSERT(csize != 0);
+			libdeflate_reset_decompress_stats(d);
+			list->num_blocks = 0;
+			ASSERT(libdeflate_zlib_decompress(d, compressed, csize,
+							  decompressed,
+							  sizes[j], NULL) ==
+			       LIBDEFLATE_SUCCESS);
+			check_blocks(d, list, 2, sizes[j]);
+			last_csize = csize;
+		}
+		libdeflate_free_compressor(c);
+	}
+
+	/*
+	 * Without a callback, the statistics are still collected.  'compressed'
+	 * still holds the largest zlib stream from above.
+	 */
+	libdeflate_set_block_callback(d, NULL, NULL);
+	libdeflate_reset_decompress_stats(d);
+	list->num_blocks = 0;
+	ASSERT(libdeflate_zlib_decompress(d, compressed, last_csize,
+					  decompressed, max_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(list->num_blocks == 0);
+	stats.sizeof_stats = sizeof(stats);
+	libdeflate_get_decompress_stats(d, &stats);
+	ASSERT(stats.num_blocks >= 1);
+	ASSERT(stats.num_fastloop_bytes > 0);
+	ASSERT(stats.num_fastloop_bytes + stats.num_generic_loop_bytes <=
+	       max_nbytes);
+#ifdef LIBDEFLATE_ENABLE_COUNTERS
+	ASSERT(stats.num_fastloop_refills > 0);
+	ASSERT(stats.num_generic_loop_entries >= 1);
+#endif
+
+	libdeflate_free_decompressor(d);
+	free(list);
+	free(original);
+	free(decompressed);
+	free(compressed);
+	return 0;
+}
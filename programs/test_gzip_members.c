@@ -0,0 +1,312 @@
+/*
+ * test_gzip_members.c
+ *
+ * Test libdeflate_gzip_parse_header_ex() and
+ * libdeflate_parallel_gzip_decompress_members(): that the header fields are
+ * reported, and that concatenated gzip members decompress the same as they do
+ * one at a time, including when a gzip header appears inside a member's
+ * compressed data and when the data is corrupt.
+ */
+
+#include "test_util.h"
+
+#define MAX_TASKS	16
+#define NBYTES		1000000
+
+/*
+ * A task submitter that just queues up the tasks, then runs them in reverse
+ * order when waited on.
+ */
+struct reverse_submitter {
+	void (*funcs[MAX_TASKS])(void *arg);
+	void *args[MAX_TASKS];
+	unsigned num_tasks;
+};
+
+static void
+reverse_submit(void *ctx, void (*func)(void *arg), void *arg)
+{
+	struct reverse_submitter *s = ctx;
+
+	ASSERT(s->num_tasks < MAX_TASKS);
+	s->funcs[s->num_tasks] = func;
+	s->args[s->num_tasks] = arg;
+	s->num_tasks++;
+}
+
+static void
+reverse_wait(void *ctx)
+{
+	struct reverse_submitter *s = ctx;
+
+	while (s->num_tasks) {
+		s->num_tasks--;
+		(*s->funcs[s->num_tasks])(s->args[s->num_tasks]);
+	}
+}
+
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 4 == 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = 'a' + (rand() % 32);
+	}
+}
+
+static void
+test_header_fields(const u8 *data, u8 *buf, size_t buf_size)
+{
+	static const u8 fields[] = {
+		12, 0,				/* XLEN */
+		'X', 'Y', 2, 0, 'x', 'y',	/* some other subfield */
+		'B', 'C', 2, 0, 0, 0,		/* BGZF block size */
+		'n', 'a', 'm', 'e', 0,		/* FNAME */
+		'c', 0,				/* FCOMMENT */
+		0x12, 0x34,			/* FHCRC */
+	};
+	struct libdeflate_compressor *c = libdeflate_alloc_compressor(6);
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	struct libdeflate_gzip_header header;
+	size_t csize, member_nbytes, i;
+
+	ASSERT(c != NULL && d != NULL);
+	csize = libdeflate_gzip_compress(c, data, 1000, buf,
+					 buf_size - sizeof(fields));
+	ASSERT(csize != 0);
+
+	/* A header with no optional fields */
+	ASSERT(libdeflate_gzip_parse_header_ex(buf, csize, &header) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(header.header_nbytes == 10);
+	ASSERT(header.flags == 0);
+	ASSERT(header.os == buf[9]);
+	ASSERT(header.extra == NULL && header.extra_nbytes == 0);
+	ASSERT(header.name == NULL && header.comment == NULL);
+	ASSERT(header.member_nbytes == 0);
+
+	/* A header with all of them, including a BGZF block size */
+	member_nbytes = csize + sizeof(fields);
+	memmove(&buf[10 + sizeof(fields)], &buf[10], csize - 10);
+	memcpy(&buf[10], fields, sizeof(fields));
+	buf[3] = 0x02 | 0x04 | 0x08 | 0x10;
+	put_unaligned_le16(member_nbytes - 1, &buf[10 + 2 + 6 + 4]);
+	put_unaligned_le32(0x12345678, &buf[4]);
+	ASSERT(libdeflate_gzip_parse_header_ex(buf, member_nbytes, &header) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(header.header_nbytes == 10 + sizeof(fields));
+	ASSERT(header.flags == 0x1E);
+	ASSERT(header.mtime == 0x12345678);
+	ASSERT(header.extra == &buf[12]);
+	ASSERT(header.extra_nbytes == 12);
+	ASSERT(header.name == (const char *)&buf[24]);
+	ASSERT(strcmp(header.name, "name") == 0);
+	ASSERT(strcmp(header.comment, "c") == 0);
+	ASSERT(header.member_nbytes == member_nbytes);
+	ASSERT(libdeflate_gzip_decompress(d, buf, member_nbytes, buf + buf_size / 2,
+					  1000, NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf + buf_size / 2, data, 1000) == 0);
+
+	/* A block size too small for the member's header is ignored. */
+	put_unaligned_le16(20, &buf[10 + 2 + 6 + 4]);
+	ASSERT(libdeflate_gzip_parse_header_ex(buf, member_nbytes, &header) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(header.member_nbytes == 0);
+
+	/* A truncated header, or one without room for the footer, is invalid. */
+	for (i = 0; i < 10 + sizeof(fields) + 8; i++)
+		ASSERT(libdeflate_gzip_parse_header_ex(buf, i, &header) ==
+		       LIBDEFLATE_BAD_DATA);
+	buf[3] |= 0x20;
+	ASSERT(libdeflate_gzip_parse_header_ex(buf, member_nbytes, &header) ==
+	       LIBDEFLATE_BAD_DATA);
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+}
+
+/* Decompress the members one at a time with the regular decompressor. */
+static enum libdeflate_result
+decompress_serially(const u8 *in, size_t in_nbytes, u8 *out,
+		    size_t out_nbytes_avail, size_t *actual_out_nbytes_ret)
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	enum libdeflate_result res = LIBDEFLATE_SUCCESS;
+	size_t out_pos = 0;
+
+	ASSERT(d != NULL);
+	while (in_nbytes != 0) {
+		size_t actual_in, actual_out;
+
+		res = libdeflate_gzip_decompress_ex(d, in, in_nbytes,
+						    &out[out_pos],
+						    out_nbytes_avail - out_pos,
+						    &actual_in, &actual_out);
+		if (res != LIBDEFLATE_SUCCESS)
+			break;
+		in += actual_in;
+		in_nbytes -= actual_in;
+		out_pos += actual_out;
+	}
+	*actual_out_nbytes_ret = out_pos;
+	libdeflate_free_decompressor(d);
+	return res;
+}
+
+static void
+test_decompress(unsigned num_threads, const u8 *in, size_t in_nbytes,
+		u8 *buf, u8 *buf2, size_t buf_size)
+{
+	struct reverse_submitter rs = { .num_tasks = 0 };
+	const struct libdeflate_task_submitter submitter = {
+		.submit = reverse_submit,
+		.wait = reverse_wait,
+		.ctx = &rs,
+	};
+	struct libdeflate_parallel_decompressor *pd;
+	enum libdeflate_result expected_res, res;
+	size_t expected_nbytes, actual_out;
+
+	expected_res = decompress_serially(in, in_nbytes, buf, buf_size,
+					   &expected_nbytes);
+
+	pd = libdeflate_alloc_parallel_decompressor(num_threads, &submitter);
+	ASSERT(pd != NULL);
+	res = libdeflate_parallel_gzip_decompress_members(pd, in, in_nbytes,
+							  buf2, buf_size,
+							  &actual_out);
+	ASSERT(res == expected_res);
+	if (res == LIBDEFLATE_SUCCESS) {
+		ASSERT(actual_out == expected_nbytes);
+		ASSERT(memcmp(buf, buf2, expected_nbytes) == 0);
+
+		/* Without 'actual_out_nbytes_ret', the size must be exact. */
+		ASSERT(libdeflate_parallel_gzip_decompress_members(
+				pd, in, in_nbytes, buf2, expected_nbytes,
+				NULL) == LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(buf, buf2, expected_nbytes) == 0);
+		if (expected_nbytes != 0) {
+			ASSERT(libdeflate_parallel_gzip_decompress_members(
+					pd, in, in_nbytes, buf2,
+					expected_nbytes - 1, NULL) ==
+			       LIBDEFLATE_INSUFFICIENT_SPACE);
+		}
+	}
+	libdeflate_free_parallel_decompressor(pd);
+}
+
+static void
+test_all_thread_counts(const u8 *in, size_t in_nbytes,
+		       u8 *buf, u8 *buf2, size_t buf_size)
+{
+	test_decompress(1, in, in_nbytes, buf, buf2, buf_size);
+	test_decompress(2, in, in_nbytes, buf, buf2, buf_size);
+	test_decompress(7, in, in_nbytes, buf, buf2, buf_size);
+}
+
+/* Append a gzip member containing @data[0...@size-1] to @out. */
+static size_t
+append_member(struct libdeflate_compressor *c, const u8 *data, size_t size,
+	      u8 *out, size_t out_pos, size_t out_nbytes_avail)
+{
+	size_t csize = libdeflate_gzip_compress(c, data, size, &out[out_pos],
+						out_nbytes_avail - out_pos);
+
+	ASSERT(csize != 0);
+	return out_pos + csize;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t buf_size = 4 * NBYTES;
+	struct libdeflate_compressor *c6 = libdeflate_alloc_compressor(6);
+	struct libdeflate_compressor *c0 = libdeflate_alloc_compressor(0);
+	struct libdeflate_parallel_compressor *pc;
+	u8 *original, *compressed, *buf, *buf2;
+	size_t csize, pos, i;
+
+	begin_program(argv);
+
+	ASSERT(c6 != NULL && c0 != NULL);
+	original = xmalloc(NBYTES);
+	compressed = xmalloc(buf_size);
+	buf = xmalloc(buf_size);
+	buf2 = xmalloc(buf_size);
+	generate_test_data(original, NBYTES);
+
+	test_header_fields(original, buf, buf_size);
+
+	/* One member, large and small */
+	csize = append_member(c6, original, NBYTES, compressed, 0, buf_size);
+	test_all_thread_counts(compressed, csize, buf, buf2, buf_size);
+	csize = append_member(c6, original, 0, compressed, 0, buf_size);
+	test_all_thread_counts(compressed, csize, buf, buf2, buf_size);
+
+	/* Many members of various sizes, including empty ones */
+	csize = 0;
+	pos = 0;
+	for (i = 0; pos < NBYTES; i++) {
+		size_t n = (i % 5 == 0) ? 0 : rand() % 50000;
+
+		csize = append_member(c6, &original[rand() % (NBYTES - 50000)],
+				      n, compressed, csize, buf_size);
+		pos += n;
+	}
+	test_all_thread_counts(compressed, csize, buf, buf2, buf_size);
+
+	/* BGZF members followed by regular ones */
+	pc = libdeflate_alloc_parallel_compressor(6, 1, NULL);
+	ASSERT(pc != NULL);
+	pos = libdeflate_parallel_bgzf_compress(pc, original, NBYTES / 2,
+						compressed, buf_size);
+	ASSERT(pos != 0);
+	csize = append_member(c6, original, NBYTES / 2, compressed, pos,
+			      buf_size);
+	csize = append_member(c6, original, 100, compressed, csize, buf_size);
+	test_all_thread_counts(compressed, csize, buf, buf2, buf_size);
+	libdeflate_free_parallel_compressor(pc);
+
+	/*
+	 * Members whose compressed data contains gzip headers, from storing
+	 * gzip data uncompressed, so the members' boundaries are misguessed
+	 */
+	pos = 0;
+	for (i = 0; i < 10; i++)
+		pos = append_member(c6, &original[i * 1000], 1000 + i, buf,
+				    pos, buf_size);
+	csize = 0;
+	for (i = 0; i < 8; i++) {
+		csize = append_member(c0, buf, pos, compressed, csize,
+				      buf_size);
+		csize = append_member(c6, original, 200000, compressed, csize,
+				      buf_size);
+	}
+	test_all_thread_counts(compressed, csize, buf, buf2, buf_size);
+
+	/* Corrupt data, and data that isn't all gzip members */
+	for (i = 0; i < 20; i++) {
+		size_t p = rand() % csize;
+		u8 bit = 1 << (rand() % 8);
+
+		compressed[p] ^= bit;
+		test_decompress(4, compressed, csize, buf, buf2, buf_size);
+		compressed[p] ^= bit;
+	}
+	compressed[csize] = 0;
+	test_all_thread_counts(compressed, csize + 1, buf, buf2, buf_size);
+	compressed[0] = 0;
+	test_all_thread_counts(compressed, csize, buf, buf2, buf_size);
+
+	libdeflate_free_compressor(c6);
+	libdeflate_free_compressor(c0);
+	free(original);
+	free(compressed);
+	free(buf);
+	free(buf2);
+	return 0;
+}
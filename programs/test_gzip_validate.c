@@ -0,0 +1,115 @@
+/*
+ * test_gzip_validate.c
+ *
+ * Test that libdeflate_gzip_validate() gives the same results and sizes as
+ * libdeflate_gzip_decompress_ex(), for valid, truncated, and corrupted gzip
+ * members, without being given an output buffer.
+ */
+
+#include "test_util.h"
+
+#define NBYTES	500000
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		if (i >= 32768 && rand() % 2 != 0) {
+			size_t offset = 1 + (rand() % 32768);
+			size_t len = MIN(3 + (rand() % 20), size - i);
+
+			for (; len != 0; len--, i++)
+				data[i] = data[i - offset];
+		} else {
+			data[i++] = rand();
+		}
+	}
+}
+
+/* Check that validating gives the same result as decompressing. */
+static void
+check_same_result(struct libdeflate_decompressor *d,
+		  const u8 *in, size_t in_nbytes, u8 *out, size_t out_nbytes)
+{
+	size_t in1 = 0, in2 = 0, out1 = 0, out2 = 0;
+	enum libdeflate_result r1, r2;
+
+	r1 = libdeflate_gzip_validate(d, in, in_nbytes, &in1, &out1);
+	r2 = libdeflate_gzip_decompress_ex(d, in, in_nbytes, out, out_nbytes,
+					   &in2, &out2);
+	/*
+	 * The original data fills the output buffer, so data that doesn't fit
+	 * in it is invalid.
+	 */
+	if (r2 == LIBDEFLATE_INSUFFICIENT_SPACE)
+		r2 = LIBDEFLATE_BAD_DATA;
+	ASSERT(r1 == r2);
+	ASSERT(r1 != LIBDEFLATE_SUCCESS || (in1 == in2 && out1 == out2));
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *decompressed;
+	size_t bound, csize, actual_in, actual_out;
+	size_t pos;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	decompressed = xmalloc(NBYTES);
+	generate_test_data(original, NBYTES);
+	c = libdeflate_alloc_compressor(6);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(c != NULL && d != NULL);
+	bound = libdeflate_gzip_compress_bound(c, NBYTES) + 100;
+	compressed = xmalloc(bound);
+	csize = libdeflate_gzip_compress(c, original, NBYTES,
+					 compressed, bound - 100);
+	ASSERT(csize != 0);
+
+	/* The sizes are reported, and trailing data is left alone. */
+	memset(&compressed[csize], 0xAA, 100);
+	ASSERT(libdeflate_gzip_validate(d, compressed, csize + 100,
+					&actual_in, &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_in == csize);
+	ASSERT(actual_out == NBYTES);
+	ASSERT(libdeflate_gzip_validate(d, compressed, csize, NULL, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+
+	/* Truncated members */
+	for (pos = 0; pos < csize; pos += 1 + (pos / 4))
+		check_same_result(d, compressed, pos, decompressed, NBYTES);
+	check_same_result(d, compressed, csize - 1, decompressed, NBYTES);
+
+	/* Corrupted compressed data, CRC32, and ISIZE */
+	for (pos = 0; pos < csize; pos += 1 + rand() % 2000) {
+		u8 b = compressed[pos];
+
+		compressed[pos] ^= 1 << (rand() % 8);
+		check_same_result(d, compressed, csize, decompressed, NBYTES);
+		compressed[pos] = 0;
+		check_same_result(d, compressed, csize, decompressed, NBYTES);
+		compressed[pos] = b;
+	}
+	for (pos = csize - 8; pos < csize; pos++) {
+		compressed[pos] ^= 0x80;
+		ASSERT(libdeflate_gzip_validate(d, compressed, csize,
+						NULL, NULL) ==
+		       LIBDEFLATE_BAD_DATA);
+		compressed[pos] ^= 0x80;
+	}
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * test_huffman_table.c
+ *
+ * Test compression with trained Huffman codes: that the output round-trips
+ * whether or not the data fits the codes, that it is never larger at the levels
+ * that only consider the trained codes as an option, and that unsetting the
+ * codes restores the normal output.
+ */
+
+#include "test_util.h"
+
+#define NUM_SAMPLES	200
+#define MAX_SAMPLE_LEN	3000
+
+/* Generate a sample made of repeats and of bytes from a small alphabet. */
+static size_t
+generate_sample(u8 *data, u8 alphabet_base)
+{
+	size_t size = 1 + (rand() % MAX_SAMPLE_LEN);
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 50 && rand() % 4 != 0)
+			data[i] = data[i - 1 - (rand() % 50)];
+		else
+			data[i] = alphabet_base + (rand() % 32);
+	}
+	return size;
+}
+
+static void
+test_level(int level, const void * const samples[],
+	   const size_t sample_nbytes[], struct libdeflate_decompressor *d)
+{
+	struct libdeflate_compressor *c = libdeflate_alloc_compressor(level);
+	struct libdeflate_huffman_table *table;
+	u8 in[MAX_SAMPLE_LEN];
+	u8 out1[2 * MAX_SAMPLE_LEN];
+	u8 out2[2 * MAX_SAMPLE_LEN];
+	u8 decompressed[MAX_SAMPLE_LEN];
+	int i;
+
+	ASSERT(c != NULL);
+	table = libdeflate_train_huffman_table(c, samples, sample_nbytes,
+					       NUM_SAMPLES);
+	ASSERT(table != NULL);
+
+	for (i = 0; i < 100; i++) {
+		/* Sometimes use bytes that didn't occur in the samples. */
+		size_t in_nbytes = generate_sample(in, (i % 4 == 0) ? 128 : 0);
+		size_t size1, size2, actual_nbytes;
+
+		libdeflate_set_huffman_table(c, NULL);
+		size1 = libdeflate_deflate_compress(c, in, in_nbytes,
+						    out1, sizeof(out1));
+		ASSERT(size1 != 0);
+
+		libdeflate_set_huffman_table(c, table);
+		size2 = libdeflate_deflate_compress(c, in, in_nbytes,
+						    out2, sizeof(out2));
+		ASSERT(size2 != 0);
+		ASSERT(libdeflate_deflate_decompress(d, out2, size2,
+						     decompressed, in_nbytes,
+						     &actual_nbytes) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(actual_nbytes == in_nbytes);
+		ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+		if (level >= 10)
+			ASSERT(size2 <= size1);
+
+		/* Without the trained codes, nothing must have changed. */
+		libdeflate_set_huffman_table(c, NULL);
+		size2 = libdeflate_deflate_compress(c, in, in_nbytes,
+						    out2, sizeof(out2));
+		ASSERT(size2 == size1 && memcmp(out1, out2, size1) == 0);
+	}
+	libdeflate_free_huffman_table(table);
+	libdeflate_free_compressor(c);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const int levels[] = { 1, 2, 6, 9, 12 };
+	const void *samples[NUM_SAMPLES];
+	size_t sample_nbytes[NUM_SAMPLES];
+	struct libdeflate_decompressor *d;
+	struct libdeflate_compressor *c;
+	size_t i;
+
+	begin_program(argv);
+
+	for (i = 0; i < NUM_SAMPLES; i++) {
+		u8 *sample = xmalloc(MAX_SAMPLE_LEN);
+
+		sample_nbytes[i] = generate_sample(sample, 0);
+		samples[i] = sample;
+	}
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+
+	/* Level 0 doesn't use Huffman codes, so it can't train them. */
+	c = libdeflate_alloc_compressor(0);
+	ASSERT(c != NULL);
+	ASSERT(libdeflate_train_huffman_table(c, samples, sample_nbytes,
+					      NUM_SAMPLES) == NULL);
+	libdeflate_free_compressor(c);
+
+	for (i = 0; i < ARRAY_LEN(levels); i++)
+		test_level(levels[i], samples, sample_nbytes, d);
+
+	libdeflate_free_decompressor(d);
+	for (i = 0; i < NUM_SAMPLES; i++)
+		free((void *)samples[i]);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * test_incompressible.c
+ *
+ * Test that data which looks incompressible is output as uncompressed blocks,
+ * and that data which merely looks random byte-wise, but repeats, is still
+ * compressed.
+ */
+
+#include "test_util.h"
+
+#define TEXT_LEN	100000
+#define RANDOM_LEN	300000
+#define REPEAT_LEN	20000
+#define NUM_REPEATS	5
+#define NBYTES		(TEXT_LEN + RANDOM_LEN + NUM_REPEATS * REPEAT_LEN)
+
+/*
+ * Generate compressible data, then random data whose last REPEAT_LEN bytes are
+ * repeated NUM_REPEATS times.
+ */
+static void
+generate_test_data(u8 *data)
+{
+	size_t i;
+
+	for (i = 0; i < TEXT_LEN; i++)
+		data[i] = 'a' + (rand() % 8);
+	for (; i < TEXT_LEN + RANDOM_LEN; i++)
+		data[i] = rand();
+	for (; i < NBYTES; i++)
+		data[i] = data[i - REPEAT_LEN];
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t out_avail = libdeflate_deflate_compress_bound(NULL, NBYTES);
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *decompressed;
+	int level;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	compressed = xmalloc(out_avail);
+	decompressed = xmalloc(NBYTES);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original);
+
+	for (level = 2; level <= 12; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+		struct libdeflate_compress_stats stats;
+		size_t csize;
+
+		ASSERT(c != NULL);
+		csize = libdeflate_deflate_compress(c, original, NBYTES,
+						    compressed, out_avail);
+		ASSERT(csize != 0);
+		ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+						     decompressed, NBYTES,
+						     NULL) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(original, decompressed, NBYTES) == 0);
+
+		stats.sizeof_stats = sizeof(stats);
+		libdeflate_get_compress_stats(c, &stats);
+		ASSERT(stats.in_nbytes == NBYTES);
+		ASSERT(stats.num_uncompressed_blocks >= 1);
+
+		/*
+		 * The text should compress to well under half its size, and
+		 * the repeats to almost nothing.
+		 */
+		ASSERT(csize < TEXT_LEN / 2 + RANDOM_LEN + 1000);
+
+		/* Random data should expand only by the block headers. */
+		libdeflate_reset_compress_stats(c);
+		csize = libdeflate_deflate_compress(c, &original[TEXT_LEN],
+						    RANDOM_LEN - REPEAT_LEN,
+						    compressed, out_avail);
+		ASSERT(csize != 0);
+		ASSERT(csize <= RANDOM_LEN - REPEAT_LEN +
+				5 * (1 + (RANDOM_LEN - REPEAT_LEN) / 65535));
+		libdeflate_get_compress_stats(c, &stats);
+		ASSERT(stats.num_blocks == stats.num_uncompressed_blocks);
+		ASSERT(stats.num_matches == 0);
+
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
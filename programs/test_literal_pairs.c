@@ -0,0 +1,118 @@
+/*
+ * test_literal_pairs.c
+ *
+ * Test decompressing data whose literals have short codewords, so that the
+ * decompressor decodes them in pairs: it must give the right output, and it
+ * must not write past the end of an output buffer that is too small, even by
+ * the second literal of a pair.
+ */
+
+#include "test_util.h"
+
+/*
+ * Generate text from a small alphabet, which gets short literal codewords, with
+ * a few bytes >= 128 which can't be the second literal of a pair.
+ */
+static void
+generate_text(u8 *data, size_t size)
+{
+	static const char alphabet[] = "etaoin shr";
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (rand() % 64 == 0)
+			data[i] = 128 + (rand() % 128);
+		else
+			data[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+	}
+}
+
+static void
+test_decompress(struct libdeflate_decompressor *d,
+		const u8 *in, size_t in_nbytes, const u8 *original, size_t size)
+{
+	u8 *out, *out_end;
+	size_t actual_out, actual_in, out_pos;
+	enum libdeflate_result res;
+
+	/* Output buffer of exactly the right size */
+	alloc_guarded_buffer(size, &out, &out_end);
+	res = libdeflate_deflate_decompress(d, in, in_nbytes, out, size,
+					    &actual_out);
+	ASSERT(res == LIBDEFLATE_SUCCESS);
+	ASSERT(actual_out == size && memcmp(out, original, size) == 0);
+	free_guarded_buffer(out, out_end);
+
+	/*
+	 * Output buffers that are a little too small.  With some of the sizes,
+	 * the output fills up right after the first literal of a pair.
+	 */
+	for (out_pos = (size > 32 ? size - 32 : 0); out_pos < size; out_pos++) {
+		alloc_guarded_buffer(out_pos, &out, &out_end);
+		ASSERT(libdeflate_deflate_decompress(d, in, in_nbytes, out,
+						     out_pos, NULL) ==
+		       LIBDEFLATE_INSUFFICIENT_SPACE);
+		free_guarded_buffer(out, out_end);
+	}
+
+	/* Streaming, with the output provided one byte at a time */
+	alloc_guarded_buffer(size, &out, &out_end);
+	ASSERT(libdeflate_deflate_decompress_stream_begin(d) == 0);
+	out_pos = 0;
+	actual_in = 0;
+	do {
+		size_t in_used;
+
+		res = libdeflate_deflate_decompress_stream_update(
+				d, &in[actual_in], in_nbytes - actual_in,
+				&out[out_pos], MIN(1, size - out_pos),
+				&in_used, &actual_out);
+		actual_in += in_used;
+		out_pos += actual_out;
+	} while (res == LIBDEFLATE_IN_PROGRESS);
+	ASSERT(res == LIBDEFLATE_SUCCESS);
+	ASSERT(actual_in == in_nbytes && out_pos == size);
+	ASSERT(memcmp(out, original, size) == 0);
+	free_guarded_buffer(out, out_end);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const int levels[] = { 0, 1, 6, 9, 12 };
+	static const size_t sizes[] = { 1, 2, 3, 100, 5000, 100000 };
+	const size_t max_size = 100000;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed;
+	size_t i, j;
+
+	begin_program(argv);
+
+	original = xmalloc(max_size);
+	compressed = xmalloc(2 * max_size + 1000);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_text(original, max_size);
+
+	for (i = 0; i < ARRAY_LEN(levels); i++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(levels[i]);
+
+		ASSERT(c != NULL);
+		for (j = 0; j < ARRAY_LEN(sizes); j++) {
+			size_t csize = libdeflate_deflate_compress(
+					c, original, sizes[j], compressed,
+					2 * max_size + 1000);
+
+			ASSERT(csize != 0);
+			test_decompress(d, compressed, csize, original,
+					sizes[j]);
+		}
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * test_low_memory.c
+ *
+ * Test that the 'low_memory' option reduces the memory used by the
+ * near-optimal compression levels, and that small soft maximum block lengths,
+ * which shrink the match cache, still produce valid output even on data that
+ * has many matches at every position.
+ */
+
+#include "test_util.h"
+
+#define MAX_NBYTES	400000
+
+static size_t last_alloc_size;
+
+static void *
+record_malloc(size_t size)
+{
+	last_alloc_size = size;
+	return malloc(size);
+}
+
+static size_t
+compressor_size(int level, bool low_memory)
+{
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c;
+
+	memset(&options, 0, sizeof(options));
+	options.sizeof_options = sizeof(options);
+	options.malloc_func = record_malloc;
+	options.free_func = free;
+	options.low_memory = low_memory;
+	last_alloc_size = 0;
+	c = libdeflate_alloc_compressor_ex(level, &options);
+	ASSERT(c != NULL);
+	libdeflate_free_compressor(c);
+	return last_alloc_size;
+}
+
+static void
+do_round_trip(int level, const struct libdeflate_options *options,
+	      const u8 *in, size_t in_nbytes, u8 *compressed, u8 *decompressed,
+	      struct libdeflate_decompressor *d)
+{
+	size_t out_avail = libdeflate_deflate_compress_bound(NULL, in_nbytes);
+	struct libdeflate_compressor *c;
+	size_t csize;
+
+	c = libdeflate_alloc_compressor_ex(level, options);
+	ASSERT(c != NULL);
+	csize = libdeflate_deflate_compress(c, in, in_nbytes, compressed,
+					    out_avail);
+	ASSERT(csize != 0);
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize, decompressed,
+					     in_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+	libdeflate_free_compressor(c);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const unsigned int block_lengths[] = { 0, 5000, 20000 };
+	struct libdeflate_decompressor *d;
+	struct libdeflate_options options;
+	u8 *original, *compressed, *decompressed;
+	int level;
+	size_t i, j;
+
+	begin_program(argv);
+
+	/* 'low_memory' only affects levels 10-12, and there it helps a lot. */
+	for (level = 0; level <= 9; level++)
+		ASSERT(compressor_size(level, true) ==
+		       compressor_size(level, false));
+	for (level = 10; level <= 12; level++) {
+		ASSERT(compressor_size(level, true) <= 3000000);
+		ASSERT(compressor_size(level, true) * 3 <
+		       compressor_size(level, false));
+	}
+
+	original = xmalloc(MAX_NBYTES);
+	compressed = xmalloc(libdeflate_deflate_compress_bound(NULL,
+							       MAX_NBYTES));
+	decompressed = xmalloc(MAX_NBYTES);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+
+	for (i = 0; i < 2; i++) {
+		/*
+		 * Random data over a 2-symbol alphabet has matches of many
+		 * different lengths at nearly every position, so it fills the
+		 * match cache about as quickly as any data can.  Text-like data
+		 * is the common case.
+		 */
+		for (j = 0; j < MAX_NBYTES; j++) {
+			if (i == 0)
+				original[j] = rand() & 1;
+			else if (j >= 1000 && rand() % 16 != 0)
+				original[j] = original[j - 1 -
+						       (rand() % 1000)];
+			else
+				original[j] = 'a' + (rand() % 26);
+		}
+		for (level = 10; level <= 12; level++) {
+			for (j = 0; j < ARRAY_LEN(block_lengths); j++) {
+				memset(&options, 0, sizeof(options));
+				options.sizeof_options = sizeof(options);
+				options.soft_max_block_length =
+					block_lengths[j];
+				do_round_trip(level, &options, original,
+					      MAX_NBYTES, compressed,
+					      decompressed, d);
+				options.low_memory = 1;
+				do_round_trip(level, &options, original,
+					      MAX_NBYTES, compressed,
+					      decompressed, d);
+			}
+		}
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * test_padded_decompress.c
+ *
+ * Test that libdeflate_deflate_decompress_padded() gives the same results as
+ * libdeflate_deflate_decompress_ex() for valid data of many small sizes, with
+ * exact, too small, and too large output buffers, that it detects truncated
+ * and corrupted data, and that it stays within the padding.
+ */
+
+#include "test_util.h"
+
+#define MAX_NBYTES	20000
+
+#define IN_PADDING	LIBDEFLATE_DECOMPRESS_IN_PADDING
+#define OUT_PADDING	LIBDEFLATE_DECOMPRESS_OUT_PADDING
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 100 && rand() % 4 != 0)
+			data[i] = data[i - 1 - (rand() % 100)];
+		else
+			data[i] = 'a' + (rand() % 16);
+	}
+}
+
+/*
+ * Decompress @in with @d, from a buffer that has exactly the required padding,
+ * into a buffer with exactly the required padding.  The padding is filled with
+ * random bytes, which must not affect the result.
+ */
+static enum libdeflate_result
+decompress_padded(struct libdeflate_decompressor *d,
+		  const u8 *in, size_t in_nbytes,
+		  u8 *out, size_t out_nbytes_avail,
+		  size_t *actual_in_nbytes_ret, size_t *actual_out_nbytes_ret)
+{
+	u8 *in_buf = xmalloc(in_nbytes + IN_PADDING);
+	u8 *out_buf = xmalloc(out_nbytes_avail + OUT_PADDING);
+	enum libdeflate_result result;
+	size_t i;
+
+	memcpy(in_buf, in, in_nbytes);
+	for (i = 0; i < IN_PADDING; i++)
+		in_buf[in_nbytes + i] = rand();
+	result = libdeflate_deflate_decompress_padded(d, in_buf, in_nbytes,
+						      out_buf, out_nbytes_avail,
+						      actual_in_nbytes_ret,
+						      actual_out_nbytes_ret);
+	memcpy(out, out_buf, out_nbytes_avail);
+	free(in_buf);
+	free(out_buf);
+	return result;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *out1, *out2;
+	size_t bound;
+	int i;
+
+	begin_program(argv);
+
+	original = xmalloc(MAX_NBYTES);
+	out1 = xmalloc(MAX_NBYTES + 1);
+	out2 = xmalloc(MAX_NBYTES + 1);
+	generate_test_data(original, MAX_NBYTES);
+	c = libdeflate_alloc_compressor(6);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(c != NULL && d != NULL);
+	bound = libdeflate_deflate_compress_bound(c, MAX_NBYTES);
+	compressed = xmalloc(bound);
+
+	for (i = 0; i < 2000; i++) {
+		size_t nbytes = rand() % (MAX_NBYTES + 1);
+		size_t csize, in1, in2, out1_nbytes, out2_nbytes, pos;
+		enum libdeflate_result r1, r2;
+
+		csize = libdeflate_deflate_compress(c, original, nbytes,
+						    compressed, bound);
+		ASSERT(csize != 0);
+
+		/* Exact and larger output buffers */
+		ASSERT(decompress_padded(d, compressed, csize, out1, nbytes,
+					 &in1, &out1_nbytes) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(in1 == csize && out1_nbytes == nbytes);
+		ASSERT(memcmp(out1, original, nbytes) == 0);
+		ASSERT(decompress_padded(d, compressed, csize, out1, nbytes + 1,
+					 &in1, &out1_nbytes) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(in1 == csize && out1_nbytes == nbytes);
+		ASSERT(decompress_padded(d, compressed, csize, out1, nbytes + 1,
+					 NULL, NULL) ==
+		       LIBDEFLATE_SHORT_OUTPUT);
+
+		/* Output buffer too small */
+		if (nbytes != 0) {
+			ASSERT(decompress_padded(d, compressed, csize,
+						 out1, rand() % nbytes,
+						 NULL, NULL) ==
+			       LIBDEFLATE_INSUFFICIENT_SPACE);
+		}
+
+		/* Truncated data */
+		ASSERT(decompress_padded(d, compressed, rand() % csize,
+					 out1, nbytes, NULL, NULL) !=
+		       LIBDEFLATE_SUCCESS);
+
+		/*
+		 * Corrupted data: the results can only differ in which error is
+		 * reported.
+		 */
+		pos = rand() % csize;
+		compressed[pos] ^= 1 << (rand() % 8);
+		r1 = decompress_padded(d, compressed, csize, out1, nbytes,
+				       &in1, &out1_nbytes);
+		r2 = libdeflate_deflate_decompress_ex(d, compressed, csize,
+						      out2, nbytes,
+						      &in2, &out2_nbytes);
+		ASSERT((r1 == LIBDEFLATE_SUCCESS) == (r2 == LIBDEFLATE_SUCCESS));
+		if (r1 == LIBDEFLATE_SUCCESS) {
+			ASSERT(in1 == in2 && out1_nbytes == out2_nbytes);
+			ASSERT(memcmp(out1, out2, out1_nbytes) == 0);
+		}
+	}
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(out1);
+	free(out2);
+	return 0;
+}
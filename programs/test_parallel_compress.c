@@ -0,0 +1,195 @@
+/*
+ * test_parallel_compress.c
+ *
+ * Test that the parallel compressor produces valid DEFLATE, zlib, and gzip
+ * streams, and that its output doesn't depend on the number of threads or on
+ * the order in which the tasks run.
+ */
+
+#include "test_util.h"
+
+#define MAX_TASKS	64
+
+/*
+ * A task submitter that just queues up the tasks, then runs them in reverse
+ * order when waited on.
+ */
+struct reverse_submitter {
+	void (*funcs[MAX_TASKS])(void *arg);
+	void *args[MAX_TASKS];
+	unsigned num_tasks;
+};
+
+static void
+reverse_submit(void *ctx, void (*func)(void *arg), void *arg)
+{
+	struct reverse_submitter *s = ctx;
+
+	ASSERT(s->num_tasks < MAX_TASKS);
+	s->funcs[s->num_tasks] = func;
+	s->args[s->num_tasks] = arg;
+	s->num_tasks++;
+}
+
+static void
+reverse_wait(void *ctx)
+{
+	struct reverse_submitter *s = ctx;
+
+	while (s->num_tasks) {
+		s->num_tasks--;
+		(*s->funcs[s->num_tasks])(s->args[s->num_tasks]);
+	}
+}
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand();
+	}
+}
+
+typedef size_t (*parallel_compress_func_t)(
+		struct libdeflate_parallel_compressor *, const void *, size_t,
+		void *, size_t);
+
+static const struct {
+	parallel_compress_func_t compress;
+	size_t (*bound)(struct libdeflate_parallel_compressor *, size_t);
+	enum libdeflate_result (*decompress)(struct libdeflate_decompressor *,
+					     const void *, size_t, void *,
+					     size_t, size_t *);
+} formats[] = {
+	{
+		libdeflate_parallel_deflate_compress,
+		libdeflate_parallel_deflate_compress_bound,
+		libdeflate_deflate_decompress,
+	}, {
+		libdeflate_parallel_zlib_compress,
+		libdeflate_parallel_zlib_compress_bound,
+		libdeflate_zlib_decompress,
+	}, {
+		libdeflate_parallel_gzip_compress,
+		libdeflate_parallel_gzip_compress_bound,
+		libdeflate_gzip_decompress,
+	},
+};
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 2000000;
+	static const size_t sizes[] = { 0, 1, 100, 262144, 300000, 2000000 };
+	static const int levels[] = { 0, 1, 3, 6, 9, 10, 12, 13 };
+	static const unsigned thread_counts[] = { 1, 3, 8 };
+	struct reverse_submitter rs = { .num_tasks = 0 };
+	const struct libdeflate_task_submitter submitter = {
+		.submit = reverse_submit,
+		.wait = reverse_wait,
+		.ctx = &rs,
+	};
+	struct libdeflate_decompressor *d;
+	u8 *original, *decompressed, *expected, *actual;
+	size_t out_avail;
+	size_t i, j, k, f;
+
+	begin_program(argv);
+
+	original = xmalloc(max_nbytes);
+	decompressed = xmalloc(max_nbytes);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, max_nbytes);
+
+	ASSERT(libdeflate_alloc_parallel_compressor(6, 0, NULL) == NULL);
+	ASSERT(libdeflate_alloc_parallel_compressor(15, 1, NULL) == NULL);
+
+	for (i = 0; i < ARRAY_LEN(levels); i++) {
+		struct libdeflate_parallel_compressor *serial =
+			libdeflate_alloc_parallel_compressor(levels[i], 1, NULL);
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(levels[i]);
+
+		ASSERT(serial != NULL);
+		ASSERT(c != NULL);
+		out_avail = libdeflate_parallel_gzip_compress_bound(serial,
+								    max_nbytes);
+		expected = xmalloc(out_avail);
+		actual = xmalloc(out_avail);
+
+		for (j = 0; j < ARRAY_LEN(sizes); j++) {
+			size_t in_nbytes = sizes[j];
+
+			for (f = 0; f < ARRAY_LEN(formats); f++) {
+				size_t bound = (*formats[f].bound)(serial,
+								   in_nbytes);
+				size_t expected_size, actual_size, whole_size;
+
+				expected_size = (*formats[f].compress)(
+						serial, original, in_nbytes,
+						expected, bound);
+				ASSERT(expected_size != 0);
+				ASSERT(expected_size <= bound);
+				ASSERT((*formats[f].decompress)(
+						d, expected, expected_size,
+						decompressed, in_nbytes, NULL) ==
+				       LIBDEFLATE_SUCCESS);
+				ASSERT(in_nbytes == 0 ||
+				       memcmp(decompressed, original,
+					      in_nbytes) == 0);
+
+				/* Too small an output buffer must fail. */
+				ASSERT((*formats[f].compress)(
+						serial, original, in_nbytes,
+						actual, expected_size - 1) == 0);
+
+				for (k = 0; k < ARRAY_LEN(thread_counts); k++) {
+					struct libdeflate_parallel_compressor *pc =
+						libdeflate_alloc_parallel_compressor(
+							levels[i],
+							thread_counts[k],
+							&submitter);
+
+					ASSERT(pc != NULL);
+					actual_size = (*formats[f].compress)(
+							pc, original, in_nbytes,
+							actual, bound);
+					ASSERT(actual_size == expected_size);
+					ASSERT(memcmp(actual, expected,
+						      actual_size) == 0);
+					libdeflate_free_parallel_compressor(pc);
+				}
+
+				/*
+				 * Since each chunk can refer to the one before
+				 * it, the ratio should be close to that of
+				 * whole-buffer compression.
+				 */
+				if (f == 0) {
+					whole_size = libdeflate_deflate_compress(
+							c, original, in_nbytes,
+							actual, out_avail);
+					ASSERT(whole_size != 0);
+					ASSERT(expected_size <= whole_size +
+					       (whole_size / 50) + 64);
+				}
+			}
+		}
+		free(expected);
+		free(actual);
+		libdeflate_free_compressor(c);
+		libdeflate_free_parallel_compressor(serial);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(decompressed);
+	return 0;
+}
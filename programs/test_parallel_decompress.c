@@ -0,0 +1,213 @@
+/*
+ * test_parallel_decompress.c
+ *
+ * Test that the parallel decompressor gives the same results as the regular
+ * decompressor, for valid and invalid DEFLATE, zlib, and gzip streams, no
+ * matter the number of threads or the order in which the tasks run.
+ */
+
+#include "test_util.h"
+
+#define MAX_TASKS	64
+#define NBYTES		16000000
+
+/*
+ * A task submitter that just queues up the tasks, then runs them in reverse
+ * order when waited on.
+ */
+struct reverse_submitter {
+	void (*funcs[MAX_TASKS])(void *arg);
+	void *args[MAX_TASKS];
+	unsigned num_tasks;
+	unsigned long num_tasks_run;
+};
+
+static void
+reverse_submit(void *ctx, void (*func)(void *arg), void *arg)
+{
+	struct reverse_submitter *s = ctx;
+
+	ASSERT(s->num_tasks < MAX_TASKS);
+	s->funcs[s->num_tasks] = func;
+	s->args[s->num_tasks] = arg;
+	s->num_tasks++;
+}
+
+static void
+reverse_wait(void *ctx)
+{
+	struct reverse_submitter *s = ctx;
+
+	while (s->num_tasks) {
+		s->num_tasks--;
+		(*s->funcs[s->num_tasks])(s->args[s->num_tasks]);
+		s->num_tasks_run++;
+	}
+}
+
+/*
+ * Generate data that compresses to roughly a quarter of its size, with matches
+ * at all distances so that chunks refer to the data before them.
+ */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		if (i >= 32768 && rand() % 2 != 0) {
+			size_t offset = 1 + (rand() % 32768);
+			size_t len = MIN(3 + (rand() % 20), size - i);
+
+			for (; len != 0; len--, i++)
+				data[i] = data[i - offset];
+		} else {
+			data[i++] = 'a' + (rand() % 64);
+		}
+	}
+}
+
+typedef enum libdeflate_result (*parallel_decompress_func_t)(
+		struct libdeflate_parallel_decompressor *, const void *, size_t,
+		void *, size_t, size_t *, size_t *);
+
+static const struct {
+	size_t (*compress)(struct libdeflate_compressor *, const void *,
+			   size_t, void *, size_t);
+	parallel_decompress_func_t parallel_decompress;
+	enum libdeflate_result (*decompress)(struct libdeflate_decompressor *,
+					     const void *, size_t, void *,
+					     size_t, size_t *, size_t *);
+} formats[] = {
+	{
+		libdeflate_deflate_compress,
+		libdeflate_parallel_deflate_decompress,
+		libdeflate_deflate_decompress_ex,
+	}, {
+		libdeflate_zlib_compress,
+		libdeflate_parallel_zlib_decompress,
+		libdeflate_zlib_decompress_ex,
+	}, {
+		libdeflate_gzip_compress,
+		libdeflate_parallel_gzip_decompress,
+		libdeflate_gzip_decompress_ex,
+	},
+};
+
+/*
+ * Decompress 'in' with both 'pd' and the regular decompressor 'd', and check
+ * that the results are the same.
+ */
+static void
+check_same_result(struct libdeflate_parallel_decompressor *pd,
+		  struct libdeflate_decompressor *d, size_t f,
+		  const u8 *in, size_t in_nbytes, u8 *out1, u8 *out2,
+		  size_t out_nbytes_avail, bool want_sizes)
+{
+	size_t in1 = 0, in2 = 0, out1_nbytes = 0, out2_nbytes = 0;
+	enum libdeflate_result r1, r2;
+
+	r1 = (*formats[f].parallel_decompress)(pd, in, in_nbytes,
+					       out1, out_nbytes_avail,
+					       want_sizes ? &in1 : NULL,
+					       want_sizes ? &out1_nbytes :
+							    NULL);
+	r2 = (*formats[f].decompress)(d, in, in_nbytes, out2, out_nbytes_avail,
+				      want_sizes ? &in2 : NULL,
+				      want_sizes ? &out2_nbytes : NULL);
+	ASSERT(r1 == r2);
+	if (r1 != LIBDEFLATE_SUCCESS)
+		return;
+	ASSERT(in1 == in2);
+	ASSERT(out1_nbytes == out2_nbytes);
+	ASSERT(memcmp(out1, out2, want_sizes ? out1_nbytes :
+					       out_nbytes_avail) == 0);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const unsigned thread_counts[] = { 1, 4, 9 };
+	struct reverse_submitter rs = { .num_tasks = 0 };
+	const struct libdeflate_task_submitter submitter = {
+		.submit = reverse_submit,
+		.wait = reverse_wait,
+		.ctx = &rs,
+	};
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *out1, *out2;
+	size_t bound, csize;
+	size_t f, k;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	out1 = xmalloc(NBYTES + 1);
+	out2 = xmalloc(NBYTES + 1);
+	generate_test_data(original, NBYTES);
+	c = libdeflate_alloc_compressor(6);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(c != NULL && d != NULL);
+	bound = libdeflate_gzip_compress_bound(c, NBYTES);
+	compressed = xmalloc(bound);
+
+	ASSERT(libdeflate_alloc_parallel_decompressor(0, NULL) == NULL);
+
+	for (f = 0; f < ARRAY_LEN(formats); f++) {
+		csize = (*formats[f].compress)(c, original, NBYTES,
+					       compressed, bound);
+		ASSERT(csize > 3000000);
+
+		for (k = 0; k < ARRAY_LEN(thread_counts); k++) {
+			struct libdeflate_parallel_decompressor *pd =
+				libdeflate_alloc_parallel_decompressor(
+					thread_counts[k],
+					(k % 2) ? &submitter : NULL);
+			size_t pos;
+
+			ASSERT(pd != NULL);
+
+			/* Valid data, with exact and larger buffers */
+			rs.num_tasks_run = 0;
+			check_same_result(pd, d, f, compressed, csize,
+					  out1, out2, NBYTES, false);
+			ASSERT(memcmp(out1, original, NBYTES) == 0);
+			if (k % 2) {
+				/*
+				 * Most of the chunks should have been found and
+				 * decoded, not just the first of each batch.
+				 */
+				ASSERT(rs.num_tasks_run >=
+				       2 * (csize >> 20) - thread_counts[k]);
+			}
+			check_same_result(pd, d, f, compressed, csize,
+					  out1, out2, NBYTES + 1, true);
+
+			/* Output buffer too small, or too large for no size */
+			check_same_result(pd, d, f, compressed, csize,
+					  out1, out2, NBYTES - 1, false);
+			check_same_result(pd, d, f, compressed, csize,
+					  out1, out2, NBYTES + 1, false);
+
+			/* Truncated and corrupted data */
+			check_same_result(pd, d, f, compressed, csize / 2,
+					  out1, out2, NBYTES, true);
+			for (pos = 1000; pos < csize; pos += csize / 7) {
+				compressed[pos] ^= 0x10;
+				check_same_result(pd, d, f, compressed, csize,
+						  out1, out2, NBYTES, true);
+				compressed[pos] ^= 0x10;
+			}
+			libdeflate_free_parallel_decompressor(pd);
+		}
+	}
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(compressed);
+	free(out1);
+	free(out2);
+	return 0;
+}
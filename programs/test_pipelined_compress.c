@@ -0,0 +1,187 @@
+/*
+ * test_pipelined_compress.c
+ *
+ * Test that compressors at levels 10-14 which are given a task submitter, and
+ * so find matches for the next block while optimizing the current one, give
+ * the same compressed data as compressors without one.
+ */
+
+#include "test_util.h"
+
+#define NBYTES		1000000
+#define MAX_TASKS	4
+
+/*
+ * A task submitter that either runs each task right away, or queues up the
+ * tasks and runs them when waited on.
+ */
+struct test_submitter {
+	bool deferred;
+	void (*funcs[MAX_TASKS])(void *arg);
+	void *args[MAX_TASKS];
+	unsigned num_tasks;
+	unsigned long num_tasks_run;
+};
+
+static void
+test_submit(void *ctx, void (*func)(void *arg), void *arg)
+{
+	struct test_submitter *s = ctx;
+
+	if (!s->deferred) {
+		(*func)(arg);
+		s->num_tasks_run++;
+		return;
+	}
+	ASSERT(s->num_tasks < MAX_TASKS);
+	s->funcs[s->num_tasks] = func;
+	s->args[s->num_tasks] = arg;
+	s->num_tasks++;
+}
+
+static void
+test_wait(void *ctx)
+{
+	struct test_submitter *s = ctx;
+	unsigned i;
+
+	for (i = 0; i < s->num_tasks; i++) {
+		(*s->funcs[i])(s->args[i]);
+		s->num_tasks_run++;
+	}
+	s->num_tasks = 0;
+}
+
+/*
+ * Generate data made of varied regions, so that blocks end for all the possible
+ * reasons: text-like data, long repeats, runs, and random data which looks
+ * incompressible.
+ */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		size_t len = MIN(1000 + (rand() % 60000), size - i);
+		size_t j;
+
+		switch (rand() % 5) {
+		case 0:
+			for (j = 0; j < len; j++)
+				data[i + j] = 'a' + (rand() % 12);
+			break;
+		case 1:
+			/* This has many matches per position. */
+			for (j = 0; j < len; j++)
+				data[i + j] = 'a' + (rand() % 2);
+			break;
+		case 2:
+			if (i >= 32768) {
+				size_t offset = 1 + (rand() % 32768);
+
+				for (j = 0; j < len; j++)
+					data[i + j] = data[i + j - offset];
+				break;
+			}
+			/* fall through */
+		case 3:
+			memset(&data[i], rand(), len);
+			break;
+		default:
+			/* Make it long enough to be output uncompressed. */
+			len = MIN(len + 30000, size - i);
+			for (j = 0; j < len; j++)
+				data[i + j] = rand();
+			break;
+		}
+		i += len;
+	}
+}
+
+static void
+check_same_output(int level, unsigned soft_max_block_length,
+		  const u8 *dict, size_t dict_nbytes,
+		  const u8 *in, size_t in_nbytes, u8 *out1, u8 *out2,
+		  size_t out_nbytes_avail)
+{
+	struct test_submitter ts = { .deferred = (level % 2 == 0) };
+	const struct libdeflate_task_submitter submitter = {
+		.submit = test_submit,
+		.wait = test_wait,
+		.ctx = &ts,
+	};
+	struct libdeflate_options options;
+	struct libdeflate_compressor *c1, *c2;
+	size_t csize1, csize2;
+
+	memset(&options, 0, sizeof(options));
+	options.sizeof_options = sizeof(options);
+	options.soft_max_block_length = soft_max_block_length;
+	c1 = libdeflate_alloc_compressor_ex(level, &options);
+	options.task_submitter = &submitter;
+	c2 = libdeflate_alloc_compressor_ex(level, &options);
+	ASSERT(c1 != NULL && c2 != NULL);
+
+	if (dict != NULL) {
+		csize1 = libdeflate_deflate_compress_with_dict(
+				c1, dict, dict_nbytes, in, in_nbytes,
+				out1, out_nbytes_avail);
+		csize2 = libdeflate_deflate_compress_with_dict(
+				c2, dict, dict_nbytes, in, in_nbytes,
+				out2, out_nbytes_avail);
+	} else {
+		csize1 = libdeflate_deflate_compress(c1, in, in_nbytes,
+						     out1, out_nbytes_avail);
+		csize2 = libdeflate_deflate_compress(c2, in, in_nbytes,
+						     out2, out_nbytes_avail);
+	}
+	ASSERT(csize1 != 0);
+	ASSERT(csize1 == csize2);
+	ASSERT(memcmp(out1, out2, csize1) == 0);
+	ASSERT(ts.num_tasks == 0);
+	if (in_nbytes >= NBYTES)
+		ASSERT(ts.num_tasks_run >= 2);
+
+	/* Output that doesn't fit makes both fail. */
+	if (dict == NULL) {
+		ASSERT(libdeflate_deflate_compress(c2, in, in_nbytes,
+						   out2, csize1 - 1) == 0);
+		ASSERT(ts.num_tasks == 0);
+	}
+
+	libdeflate_free_compressor(c1);
+	libdeflate_free_compressor(c2);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t out_avail = libdeflate_deflate_compress_bound(NULL, NBYTES);
+	u8 *original, *out1, *out2;
+	int level;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	out1 = xmalloc(out_avail);
+	out2 = xmalloc(out_avail);
+	generate_test_data(original, NBYTES);
+
+	for (level = 10; level <= 14; level++) {
+		check_same_output(level, 0, NULL, 0, original, NBYTES,
+				  out1, out2, out_avail);
+		/* Small blocks, which can overflow the match cache */
+		check_same_output(level, 10000, NULL, 0, original, NBYTES / 2,
+				  out1, out2, out_avail);
+		/* With history before the data */
+		check_same_output(level, 0, original, 100000,
+				  original + 100000, NBYTES - 100000,
+				  out1, out2, out_avail);
+	}
+
+	free(original);
+	free(out1);
+	free(out2);
+	return 0;
+}
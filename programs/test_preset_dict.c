@@ -0,0 +1,251 @@
+/*
+ * test_preset_dict.c
+ *
+ * Test compression and decompression with a preset dictionary, checking that
+ * zlib can decompress the result given the same dictionary and vice versa, and
+ * that using a prepared dictionary gives the same result.
+ */
+
+#include "test_util.h"
+
+/*
+ * Generate some text-like data that after the first 'literal_nbytes' bytes
+ * mostly consists of repeated strings.
+ */
+static void
+generate_test_data(u8 *data, size_t size, size_t literal_nbytes)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		if (i >= literal_nbytes && rand() % 4 != 0) {
+			size_t len = 4 + (rand() % 40);
+			size_t offset = 1 + (rand() % 30000);
+
+			for (; len != 0 && i < size; len--, i++)
+				data[i] = data[i - offset];
+		} else {
+			data[i++] = 'a' + (rand() % 26);
+		}
+	}
+}
+
+/* Decompress with zlib, providing the dictionary when it's asked for. */
+static void
+verify_with_zlib(const u8 *in, size_t in_nbytes, bool is_zlib,
+		 const u8 *dict, size_t dict_nbytes,
+		 const u8 *expected, size_t expected_nbytes, u8 *out)
+{
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof(z));
+	ASSERT(inflateInit2(&z, is_zlib ? 15 : -15) == Z_OK);
+	if (!is_zlib && dict_nbytes != 0)
+		ASSERT(inflateSetDictionary(&z, dict, dict_nbytes) == Z_OK);
+	z.next_in = (u8 *)in;
+	z.avail_in = in_nbytes;
+	z.next_out = out;
+	z.avail_out = expected_nbytes + 1;
+	ret = inflate(&z, Z_FINISH);
+	if (is_zlib && dict_nbytes != 0) {
+		ASSERT(ret == Z_NEED_DICT);
+		ASSERT(z.adler == adler32(1, dict, dict_nbytes));
+		ASSERT(inflateSetDictionary(&z, dict, dict_nbytes) == Z_OK);
+		ret = inflate(&z, Z_FINISH);
+	}
+	ASSERT(ret == Z_STREAM_END);
+	ASSERT(z.total_out == expected_nbytes);
+	ASSERT(z.avail_in == 0);
+	ASSERT(memcmp(out, expected, expected_nbytes) == 0);
+	inflateEnd(&z);
+}
+
+/* Decompress with libdeflate, and check that the dictionary is needed. */
+static void
+verify_with_libdeflate(struct libdeflate_decompressor *d,
+		       const u8 *in, size_t in_nbytes, bool is_zlib,
+		       const u8 *dict, size_t dict_nbytes,
+		       const u8 *expected, size_t expected_nbytes, u8 *out)
+{
+	size_t actual_in, actual_out;
+
+	if (is_zlib) {
+		ASSERT(libdeflate_zlib_decompress_with_dict(
+				d, dict, dict_nbytes, in, in_nbytes,
+				out, expected_nbytes, &actual_in,
+				&actual_out) == LIBDEFLATE_SUCCESS);
+	} else {
+		ASSERT(libdeflate_deflate_decompress_with_dict(
+				d, dict, dict_nbytes, in, in_nbytes,
+				out, expected_nbytes, &actual_in,
+				&actual_out) == LIBDEFLATE_SUCCESS);
+	}
+	ASSERT(actual_in == in_nbytes);
+	ASSERT(actual_out == expected_nbytes);
+	ASSERT(memcmp(out, expected, expected_nbytes) == 0);
+
+	if (is_zlib && dict_nbytes != 0) {
+		u8 *wrong_dict = xmalloc(dict_nbytes);
+
+		ASSERT(libdeflate_zlib_decompress(d, in, in_nbytes, out,
+						  expected_nbytes, NULL) ==
+		       LIBDEFLATE_BAD_DATA);
+		memcpy(wrong_dict, dict, dict_nbytes);
+		wrong_dict[0] ^= 1;
+		ASSERT(libdeflate_zlib_decompress_with_dict(
+				d, wrong_dict, dict_nbytes, in, in_nbytes,
+				out, expected_nbytes, NULL, NULL) ==
+		       LIBDEFLATE_BAD_DATA);
+		free(wrong_dict);
+	}
+}
+
+/*
+ * Compress with zlib using a preset dictionary, and check that libdeflate can
+ * decompress the result.
+ */
+static void
+compress_with_zlib(struct libdeflate_decompressor *d, const u8 *in,
+		   size_t in_nbytes, const u8 *dict, size_t dict_nbytes,
+		   u8 *tmp, size_t tmp_avail, u8 *out)
+{
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+	ASSERT(deflateInit(&z, 6) == Z_OK);
+	if (dict_nbytes != 0)
+		ASSERT(deflateSetDictionary(&z, dict, dict_nbytes) == Z_OK);
+	z.next_in = (u8 *)in;
+	z.avail_in = in_nbytes;
+	z.next_out = tmp;
+	z.avail_out = tmp_avail;
+	ASSERT(deflate(&z, Z_FINISH) == Z_STREAM_END);
+	verify_with_libdeflate(d, tmp, z.total_out, true, dict, dict_nbytes,
+			       in, in_nbytes, out);
+	deflateEnd(&z);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 100000;
+	static const size_t dict_sizes[] = { 0, 1, 5, 6, 100, 32768, 40000 };
+	static const size_t sizes[] = {
+		0, 1, 2, 5, 20, 200, 2000, 35000, 35001, 100000
+	};
+	struct libdeflate_decompressor *d;
+	u8 *data, *decompressed, *out1, *out2;
+	size_t out_avail;
+	int level;
+	size_t i, j;
+
+	begin_program(argv);
+
+	/* The input is taken from right after the dictionary. */
+	data = xmalloc(40000 + max_nbytes);
+	decompressed = xmalloc(max_nbytes + 1);
+	generate_test_data(data, 40000 + max_nbytes, 30000);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+
+	for (level = 0; level <= 12; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+		struct libdeflate_compressor *c2 =
+			libdeflate_alloc_compressor((level + 1) % 13);
+
+		ASSERT(c != NULL);
+		ASSERT(c2 != NULL);
+		out_avail = libdeflate_zlib_compress_bound(c, max_nbytes);
+		out1 = xmalloc(out_avail);
+		out2 = xmalloc(out_avail);
+
+		for (i = 0; i < ARRAY_LEN(dict_sizes); i++) {
+			size_t dict_nbytes = dict_sizes[i];
+			const u8 *dict = &data[40000 - dict_nbytes];
+			struct libdeflate_compression_dict *pd =
+				libdeflate_prepare_compression_dict(
+					c, dict, dict_nbytes);
+
+			ASSERT(pd != NULL);
+			for (j = 0; j < ARRAY_LEN(sizes); j++) {
+				const u8 *in = &data[40000];
+				size_t in_nbytes = sizes[j];
+				size_t bound, size1, size2;
+
+				bound = libdeflate_deflate_compress_bound(
+						c, in_nbytes);
+				size1 = libdeflate_deflate_compress_with_dict(
+						c, dict, dict_nbytes,
+						in, in_nbytes, out1, bound);
+				ASSERT(size1 != 0);
+				verify_with_zlib(out1, size1, false,
+						 dict, dict_nbytes,
+						 in, in_nbytes, decompressed);
+				verify_with_libdeflate(d, out1, size1, false,
+						       dict, dict_nbytes,
+						       in, in_nbytes,
+						       decompressed);
+
+				size2 = libdeflate_deflate_compress_with_prepared_dict(
+						c, pd, in, in_nbytes, out2, bound);
+				ASSERT(size2 == size1);
+				ASSERT(memcmp(out1, out2, size1) == 0);
+
+				/* A different level must still work. */
+				size2 = libdeflate_deflate_compress_with_prepared_dict(
+						c2, pd, in, in_nbytes, out2,
+						out_avail);
+				ASSERT(size2 != 0);
+				verify_with_zlib(out2, size2, false,
+						 dict, dict_nbytes,
+						 in, in_nbytes, decompressed);
+
+				/*
+				 * The data follows the dictionary, so using the
+				 * dictionary must help.
+				 */
+				if (level != 0 && dict_nbytes >= 32768 &&
+				    in_nbytes >= 200)
+					ASSERT(size1 <
+					       libdeflate_deflate_compress(
+							c, in, in_nbytes,
+							out2, out_avail));
+
+				bound = libdeflate_zlib_compress_bound(
+						c, in_nbytes);
+				size1 = libdeflate_zlib_compress_with_dict(
+						c, dict, dict_nbytes,
+						in, in_nbytes, out1, bound);
+				ASSERT(size1 != 0);
+				verify_with_zlib(out1, size1, true,
+						 dict, dict_nbytes,
+						 in, in_nbytes, decompressed);
+				verify_with_libdeflate(d, out1, size1, true,
+						       dict, dict_nbytes,
+						       in, in_nbytes,
+						       decompressed);
+				size2 = libdeflate_zlib_compress_with_prepared_dict(
+						c, pd, in, in_nbytes, out2, bound);
+				ASSERT(size2 == size1);
+				ASSERT(memcmp(out1, out2, size1) == 0);
+
+				if (level == 6)
+					compress_with_zlib(d, in, in_nbytes,
+							   dict, dict_nbytes,
+							   out1, out_avail,
+							   decompressed);
+			}
+			libdeflate_free_compression_dict(pd);
+		}
+		free(out1);
+		free(out2);
+		libdeflate_free_compressor(c);
+		libdeflate_free_compressor(c2);
+	}
+	libdeflate_free_decompressor(d);
+	free(data);
+	free(decompressed);
+	return 0;
+}
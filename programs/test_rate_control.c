@@ -0,0 +1,219 @@
+/*
+ * test_rate_control.c
+ *
+ * Test the 'rate_control' option, with a fake clock: that a compressor that
+ * misses its target falls back one level at a time to level 2, then climbs
+ * back to its own level once it is fast enough again; that a time budget works
+ * the same way; that the output round-trips in one-shot and streaming
+ * compression; and that the option is rejected at levels that can't use it.
+ */
+
+#include "test_util.h"
+
+#define NBYTES		200000
+
+/* A clock that advances by 'tick' nanoseconds each time it is read */
+struct fake_clock {
+	u64 now;
+	u64 tick;
+};
+
+static uint64_t
+fake_get_time_ns(void *ctx)
+{
+	struct fake_clock *clock = ctx;
+
+	clock->now += clock->tick;
+	return clock->now;
+}
+
+/*
+ * Generate data with repeats of random lengths from anywhere in the window, so
+ * that each level up to 8 finds better matches than the one below it
+ */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		if (i >= 32768 && rand() % 4 != 0) {
+			size_t len = MIN(3 + (rand() % 40), size - i);
+			size_t offset = 1 + (rand() % 32768);
+
+			for (; len != 0; len--, i++)
+				data[i] = data[i - offset];
+		} else {
+			data[i++] = 'a' + (rand() % 16);
+		}
+	}
+}
+
+static struct libdeflate_compressor *
+alloc_rate_compressor(int level, struct fake_clock *clock,
+		      u64 target_bytes_per_sec, u64 time_budget_ns)
+{
+	struct libdeflate_rate_control rc = {
+		.get_time_ns = fake_get_time_ns,
+		.ctx = clock,
+		.target_bytes_per_sec = target_bytes_per_sec,
+		.time_budget_ns = time_budget_ns,
+	};
+	struct libdeflate_options options = {
+		.sizeof_options = sizeof(options),
+		.rate_control = &rc,
+	};
+
+	return libdeflate_alloc_compressor_ex(level, &options);
+}
+
+/* Compress @in with @c and return whether the output equals @expected. */
+static bool
+compress_matches(struct libdeflate_compressor *c, const u8 *in, u8 *out,
+		 size_t out_avail, const u8 *expected, size_t expected_size)
+{
+	size_t csize = libdeflate_deflate_compress(c, in, NBYTES, out,
+						   out_avail);
+
+	ASSERT(csize != 0);
+	return csize == expected_size && memcmp(out, expected, csize) == 0;
+}
+
+/* Compress @in with the streaming interface in pieces of random sizes */
+static void
+stream_compress_and_check(struct libdeflate_compressor *c, const u8 *in,
+			  u8 *out, size_t out_avail, u8 *buf)
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	size_t pos = 0, csize = 0, n;
+
+	ASSERT(d != NULL);
+	ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+	while (pos < NBYTES) {
+		size_t in_chunk = 1 + (rand() % 50000);
+
+		in_chunk = MIN(in_chunk, NBYTES - pos);
+		ASSERT(libdeflate_deflate_compress_stream_update(
+				c, &in[pos], in_chunk, &out[csize],
+				out_avail - csize, &n) == LIBDEFLATE_SUCCESS);
+		csize += n;
+		pos += in_chunk;
+	}
+	ASSERT(libdeflate_deflate_compress_stream_finish(
+			c, &out[csize], out_avail - csize, &n) ==
+	       LIBDEFLATE_SUCCESS);
+	csize += n;
+	ASSERT(libdeflate_deflate_decompress(d, out, csize, buf, NBYTES,
+					     NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf, in, NBYTES) == 0);
+	libdeflate_free_decompressor(d);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t out_avail = 2 * NBYTES;
+	struct libdeflate_compressor *c;
+	struct fake_clock clock = { 0, 0 };
+	u8 *in, *out, *buf, *level2_out, *level9_out;
+	size_t level2_size, level9_size;
+	int i;
+
+	begin_program(argv);
+
+	in = xmalloc(NBYTES);
+	out = xmalloc(out_avail);
+	buf = xmalloc(NBYTES);
+	level2_out = xmalloc(out_avail);
+	level9_out = xmalloc(out_avail);
+	generate_test_data(in, NBYTES);
+
+	c = libdeflate_alloc_compressor(2);
+	ASSERT(c != NULL);
+	level2_size = libdeflate_deflate_compress(c, in, NBYTES, level2_out,
+						  out_avail);
+	ASSERT(level2_size != 0);
+	libdeflate_free_compressor(c);
+	c = libdeflate_alloc_compressor(9);
+	ASSERT(c != NULL);
+	level9_size = libdeflate_deflate_compress(c, in, NBYTES, level9_out,
+						  out_avail);
+	ASSERT(level9_size != 0 && level9_size < level2_size);
+	libdeflate_free_compressor(c);
+
+	/*
+	 * Each call compresses one piece, which takes one tick.  At 100 ms per
+	 * 200 KB, a target of 100 MB/s is missed by far, so after starting at
+	 * level 9 the compressor steps down a level per call to level 2.
+	 */
+	clock.tick = 100000000;
+	c = alloc_rate_compressor(9, &clock, 100000000, 0);
+	ASSERT(c != NULL);
+	ASSERT(compress_matches(c, in, out, out_avail, level9_out,
+				level9_size));
+	for (i = 0; i < 6; i++)
+		ASSERT(!compress_matches(c, in, out, out_avail, level2_out,
+					 level2_size));
+	ASSERT(compress_matches(c, in, out, out_avail, level2_out,
+				level2_size));
+
+	/* At 100 us per 200 KB, it climbs back to level 9. */
+	clock.tick = 100000;
+	for (i = 0; i < 100; i++) {
+		if (compress_matches(c, in, out, out_avail, level9_out,
+				     level9_size))
+			break;
+	}
+	ASSERT(i < 100);
+	ASSERT(compress_matches(c, in, out, out_avail, level9_out,
+				level9_size));
+	stream_compress_and_check(c, in, out, out_avail, buf);
+	libdeflate_free_compressor(c);
+
+	/* A time budget that is used up before the first piece ends */
+	clock.tick = 100000000;
+	c = alloc_rate_compressor(6, &clock, 0, 1000);
+	ASSERT(c != NULL);
+	for (i = 0; i < 5; i++)
+		compress_matches(c, in, out, out_avail, level2_out,
+				 level2_size);
+	ASSERT(compress_matches(c, in, out, out_avail, level2_out,
+				level2_size));
+	stream_compress_and_check(c, in, out, out_avail, buf);
+	libdeflate_free_compressor(c);
+
+	/* A target that is always met leaves the compressor at its level. */
+	c = alloc_rate_compressor(9, &clock, 1, 0);
+	ASSERT(c != NULL);
+	for (i = 0; i < 3; i++)
+		ASSERT(compress_matches(c, in, out, out_avail, level9_out,
+					level9_size));
+	libdeflate_free_compressor(c);
+
+	/* Only levels 2-9 can switch between each other. */
+	ASSERT(alloc_rate_compressor(0, &clock, 1, 0) == NULL);
+	ASSERT(alloc_rate_compressor(1, &clock, 1, 0) == NULL);
+	ASSERT(alloc_rate_compressor(10, &clock, 1, 0) == NULL);
+	{
+		struct libdeflate_rate_control rc = {
+			.target_bytes_per_sec = 1,
+		};
+		struct libdeflate_options options = {
+			.sizeof_options = sizeof(options),
+			.rate_control = &rc,
+		};
+
+		ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+		options.strategy = LIBDEFLATE_STRATEGY_HUFFMAN_ONLY;
+		rc.get_time_ns = fake_get_time_ns;
+		rc.ctx = &clock;
+		ASSERT(libdeflate_alloc_compressor_ex(6, &options) == NULL);
+	}
+
+	free(in);
+	free(out);
+	free(buf);
+	free(level2_out);
+	free(level9_out);
+	return 0;
+}
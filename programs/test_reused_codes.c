@@ -0,0 +1,146 @@
+/*
+ * test_reused_codes.c
+ *
+ * Test that the decompressor gives correct results when dynamic Huffman blocks
+ * repeat the codes of the previous one, so that their decode tables are reused,
+ * including when blocks with other codes or static blocks come in between.
+ */
+
+#include "test_util.h"
+
+#define NUM_SAMPLES	100
+#define MAX_SAMPLE_LEN	5000
+
+/* Generate a sample made of repeats and of bytes from a small alphabet. */
+static size_t
+generate_sample(u8 *data)
+{
+	size_t size = 1000 + (rand() % (MAX_SAMPLE_LEN - 1000));
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 50 && rand() % 4 != 0)
+			data[i] = data[i - 1 - (rand() % 50)];
+		else
+			data[i] = 'a' + (rand() % 32);
+	}
+	return size;
+}
+
+static void
+check_decompress(struct libdeflate_decompressor *d, const u8 *in,
+		 size_t in_nbytes, const u8 *expected, size_t expected_nbytes)
+{
+	u8 out[MAX_SAMPLE_LEN];
+	size_t in_pos = 0, out_pos = 0;
+	size_t actual_in, actual_out;
+	enum libdeflate_result res;
+
+	ASSERT(libdeflate_deflate_decompress(d, in, in_nbytes, out,
+					     expected_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(out, expected, expected_nbytes) == 0);
+
+	/* The streaming decompressor, fed a few bytes at a time */
+	ASSERT(libdeflate_deflate_decompress_stream_begin(d) == 0);
+	do {
+		res = libdeflate_deflate_decompress_stream_update(
+				d, &in[in_pos], MIN(in_nbytes - in_pos, 7),
+				&out[out_pos], sizeof(out) - out_pos,
+				&actual_in, &actual_out);
+		in_pos += actual_in;
+		out_pos += actual_out;
+	} while (res == LIBDEFLATE_IN_PROGRESS && in_pos < in_nbytes);
+	ASSERT(res == LIBDEFLATE_SUCCESS);
+	ASSERT(out_pos == expected_nbytes);
+	ASSERT(memcmp(out, expected, expected_nbytes) == 0);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	struct libdeflate_compressor *c;
+	struct libdeflate_decompressor *d;
+	struct libdeflate_huffman_table *table;
+	struct libdeflate_decompress_stats stats;
+	const void *samples[NUM_SAMPLES];
+	size_t sample_nbytes[NUM_SAMPLES];
+	u8 *sample_data;
+	u8 in[MAX_SAMPLE_LEN];
+	u8 trained[2 * MAX_SAMPLE_LEN];
+	u8 own[2 * MAX_SAMPLE_LEN];
+	static const char text[] = "hello, hello, hello, hello, world";
+	u8 tiny[64];
+	size_t in_nbytes, trained_nbytes, own_nbytes, tiny_nbytes;
+	uint64_t num_reused = 0;
+	int i;
+
+	begin_program(argv);
+
+	sample_data = xmalloc(NUM_SAMPLES * MAX_SAMPLE_LEN);
+	for (i = 0; i < NUM_SAMPLES; i++) {
+		samples[i] = &sample_data[i * MAX_SAMPLE_LEN];
+		sample_nbytes[i] = generate_sample(&sample_data[i *
+								MAX_SAMPLE_LEN]);
+	}
+	c = libdeflate_alloc_compressor(6);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(c != NULL && d != NULL);
+	table = libdeflate_train_huffman_table(c, samples, sample_nbytes,
+					       NUM_SAMPLES);
+	ASSERT(table != NULL);
+
+	/* A static Huffman block */
+	tiny_nbytes = libdeflate_deflate_compress(c, text, sizeof(text) - 1,
+						  tiny, sizeof(tiny));
+	ASSERT(tiny_nbytes != 0 && (tiny[0] & 0x6) == 0x2);
+
+	for (i = 0; i < 200; i++) {
+		in_nbytes = generate_sample(in);
+
+		libdeflate_set_huffman_table(c, table);
+		trained_nbytes = libdeflate_deflate_compress(c, in, in_nbytes,
+							     trained,
+							     sizeof(trained));
+		ASSERT(trained_nbytes != 0);
+		libdeflate_set_huffman_table(c, NULL);
+		own_nbytes = libdeflate_deflate_compress(c, in, in_nbytes,
+							 own, sizeof(own));
+		ASSERT(own_nbytes != 0);
+
+		/*
+		 * The trained codes are usually reused from the previous
+		 * iteration, but sometimes come after the block's own codes or
+		 * after a static block.
+		 */
+		if (i % 3 == 1)
+			check_decompress(d, own, own_nbytes, in, in_nbytes);
+		if (i % 5 == 2)
+			check_decompress(d, tiny, tiny_nbytes,
+					 (const u8 *)text, sizeof(text) - 1);
+		libdeflate_reset_decompress_stats(d);
+		check_decompress(d, trained, trained_nbytes, in, in_nbytes);
+		stats.sizeof_stats = sizeof(stats);
+		libdeflate_get_decompress_stats(d, &stats);
+		ASSERT(stats.num_reused_dynamic_codes <=
+		       stats.num_dynamic_blocks);
+		num_reused += stats.num_reused_dynamic_codes;
+
+		/* A corrupted stream mustn't leave bad tables behind. */
+		if (i % 7 == 3) {
+			trained[trained_nbytes / 2] ^= 0x20;
+			(void)libdeflate_deflate_decompress(d, trained,
+							    trained_nbytes,
+							    own, in_nbytes,
+							    NULL);
+		}
+	}
+	/* Most of the trained streams must have reused the tables. */
+	ASSERT(num_reused >= 100);
+
+	libdeflate_free_huffman_table(table);
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+	free(sample_data);
+	return 0;
+}
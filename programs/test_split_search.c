@@ -0,0 +1,202 @@
+/*
+ * test_split_search.c
+ *
+ * Test compression levels 13 and 14, which search for where to end blocks:
+ * that their output round-trips in one-shot, streaming, and fixed-size output
+ * compression, with short and long blocks; that it is smaller than level 12's
+ * on data whose statistics change from region to region; and that levels above
+ * 14 are rejected.
+ */
+
+#include "test_util.h"
+
+#define NBYTES		400000
+
+/*
+ * Regions of varying lengths, each of which is text over a different small
+ * alphabet, skewed binary, or repetitions of a short random string
+ */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t pos = 0;
+
+	while (pos < size) {
+		size_t len = 2000 + (rand() % 40000);
+		unsigned kind = rand() % 3;
+		u8 base = rand();
+		size_t period = 1 + (rand() % 64);
+		size_t i;
+
+		len = MIN(len, size - pos);
+		for (i = pos; i < pos + len; i++) {
+			if (kind == 0)
+				data[i] = 'a' + (base % 8) + (rand() % 12);
+			else if (kind == 1)
+				data[i] = base + ((rand() % 16) * (rand() % 16));
+			else if (i - pos < period)
+				data[i] = rand();
+			else
+				data[i] = data[i - period];
+		}
+		pos += len;
+	}
+}
+
+static size_t
+compress_and_check(struct libdeflate_compressor *c,
+		   struct libdeflate_decompressor *d, const u8 *in,
+		   size_t in_nbytes, u8 *out, size_t out_avail, u8 *buf)
+{
+	size_t csize = libdeflate_deflate_compress(c, in, in_nbytes, out,
+						   out_avail);
+
+	ASSERT(csize != 0);
+	ASSERT(libdeflate_deflate_decompress(d, out, csize, buf, in_nbytes,
+					     NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf, in, in_nbytes) == 0);
+	return csize;
+}
+
+/* Compress @in with the streaming interface in pieces of random sizes */
+static void
+stream_compress_and_check(struct libdeflate_compressor *c,
+			  struct libdeflate_decompressor *d, const u8 *in,
+			  size_t in_nbytes, u8 *out, size_t out_avail, u8 *buf)
+{
+	size_t pos = 0, csize = 0, n;
+
+	ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+	while (pos < in_nbytes) {
+		size_t in_chunk = 1 + (rand() % 50000);
+
+		in_chunk = MIN(in_chunk, in_nbytes - pos);
+		ASSERT(libdeflate_deflate_compress_stream_update(
+				c, &in[pos], in_chunk, &out[csize],
+				out_avail - csize, &n) == LIBDEFLATE_SUCCESS);
+		csize += n;
+		pos += in_chunk;
+	}
+	ASSERT(libdeflate_deflate_compress_stream_finish(
+			c, &out[csize], out_avail - csize, &n) ==
+	       LIBDEFLATE_SUCCESS);
+	csize += n;
+	ASSERT(libdeflate_deflate_decompress(d, out, csize, buf, in_nbytes,
+					     NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf, in, in_nbytes) == 0);
+}
+
+/* Fill a fixed-size output and check that it holds a prefix of the input */
+static void
+fit_compress_and_check(struct libdeflate_compressor *c,
+		       struct libdeflate_decompressor *d, const u8 *in,
+		       size_t in_nbytes, size_t out_nbytes_avail, u8 *out,
+		       u8 *buf)
+{
+	size_t csize, consumed, actual_out;
+
+	csize = libdeflate_deflate_compress_fit(c, in, in_nbytes, out,
+						out_nbytes_avail, &consumed);
+	ASSERT(csize != 0 && csize <= out_nbytes_avail);
+	ASSERT(consumed > 0 && consumed < in_nbytes);
+	ASSERT(libdeflate_deflate_decompress(d, out, csize, buf, in_nbytes,
+					     &actual_out) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(actual_out == consumed);
+	ASSERT(memcmp(buf, in, consumed) == 0);
+}
+
+static struct libdeflate_compressor *
+alloc_split_compressor(int level, unsigned soft_max_block_length,
+		       int low_memory)
+{
+	struct libdeflate_options options = {
+		.sizeof_options = sizeof(options),
+		.soft_max_block_length = soft_max_block_length,
+		.low_memory = low_memory,
+	};
+
+	return libdeflate_alloc_compressor_ex(level, &options);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const unsigned block_lengths[] = { 0, 12000 };
+	const size_t out_avail = libdeflate_deflate_compress_bound(NULL,
+								   NBYTES);
+	struct libdeflate_decompressor *d;
+	struct libdeflate_compress_stats stats = {
+		.sizeof_stats = sizeof(stats),
+	};
+	u8 *original, *out, *buf;
+	size_t level12_size, csize;
+	int level;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	out = xmalloc(out_avail);
+	buf = xmalloc(NBYTES);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, NBYTES);
+
+	for (i = 0; i < ARRAY_LEN(block_lengths); i++) {
+		struct libdeflate_compressor *c =
+			alloc_split_compressor(12, block_lengths[i], 0);
+
+		ASSERT(c != NULL);
+		level12_size = compress_and_check(c, d, original, NBYTES, out,
+						  out_avail, buf);
+		libdeflate_free_compressor(c);
+
+		for (level = 13; level <= 14; level++) {
+			c = alloc_split_compressor(level, block_lengths[i], 0);
+			ASSERT(c != NULL);
+
+			/*
+			 * The regions end up in blocks of their own, and the
+			 * output is smaller than level 12's, or at least not
+			 * much larger where short blocks leave little choice.
+			 */
+			csize = compress_and_check(c, d, original, NBYTES, out,
+						   out_avail, buf);
+			if (block_lengths[i] == 0) {
+				ASSERT(csize < level12_size);
+			} else {
+				ASSERT(csize <= level12_size +
+						level12_size / 500);
+			}
+			libdeflate_get_compress_stats(c, &stats);
+			ASSERT(stats.num_blocks > NBYTES / 100000);
+
+			/* Too short to split */
+			compress_and_check(c, d, original, 9000, out,
+					   out_avail, buf);
+
+			stream_compress_and_check(c, d, original, NBYTES, out,
+						  out_avail, buf);
+			fit_compress_and_check(c, d, original, NBYTES, 16384,
+					       out, buf);
+			fit_compress_and_check(c, d, original, NBYTES,
+					       csize / 2, out, buf);
+			libdeflate_free_compressor(c);
+
+			c = alloc_split_compressor(level, block_lengths[i], 1);
+			ASSERT(c != NULL);
+			compress_and_check(c, d, original, NBYTES, out,
+					   out_avail, buf);
+			libdeflate_free_compressor(c);
+		}
+	}
+
+	ASSERT(libdeflate_alloc_compressor(15) == NULL);
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(out);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * test_stream_compress.c
+ *
+ * Test that the streaming compression interface produces valid DEFLATE
+ * streams, regardless of how the input is split up, and that matches can span
+ * the boundaries between the pieces, including at the levels whose matchfinder
+ * can't insert the end of a piece until the data that follows it is known.
+ * Also test that after each flush, the output so far decompresses to all the
+ * input so far.
+ */
+
+#include "test_util.h"
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand();
+	}
+}
+
+static size_t
+do_stream_compress(struct libdeflate_compressor *c,
+		   const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail,
+		   size_t max_update_len)
+{
+	size_t in_pos = 0;
+	size_t out_pos = 0;
+	size_t actual_out_nbytes;
+	enum libdeflate_result res;
+
+	ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+	while (in_pos < in_nbytes) {
+		size_t n = 1 + (rand() % max_update_len);
+		size_t bound;
+
+		n = MIN(n, in_nbytes - in_pos);
+		bound = libdeflate_deflate_compress_stream_bound(c, n);
+
+		ASSERT(out_avail - out_pos >= bound);
+		res = libdeflate_deflate_compress_stream_update(
+				c, &in[in_pos], n, &out[out_pos], bound,
+				&actual_out_nbytes);
+		ASSERT(res == LIBDEFLATE_SUCCESS);
+		ASSERT(actual_out_nbytes <= bound);
+		in_pos += n;
+		out_pos += actual_out_nbytes;
+	}
+	ASSERT(out_avail - out_pos >=
+	       libdeflate_deflate_compress_stream_bound(c, 0));
+	res = libdeflate_deflate_compress_stream_finish(
+			c, &out[out_pos], out_avail - out_pos,
+			&actual_out_nbytes);
+	ASSERT(res == LIBDEFLATE_SUCCESS);
+	return out_pos + actual_out_nbytes;
+}
+
+/*
+ * Stream data that has a trap for the binary tree matchfinder in each unit (see
+ * generate_piece_end_traps()), starting at enough offsets into it that some
+ * stream has a piece that ends in a trap wherever the pieces end, and check
+ * that the output decompresses to the input.
+ */
+static void
+do_piece_end_test(struct libdeflate_compressor *c,
+		  struct libdeflate_decompressor *d,
+		  const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail,
+		  u8 *decompressed)
+{
+	const size_t stream_nbytes = 1200000;
+	size_t offset;
+
+	ASSERT(in_nbytes >= stream_nbytes + PIECE_END_TRAP_UNIT_LENGTH);
+	for (offset = 0; offset < PIECE_END_TRAP_UNIT_LENGTH;
+	     offset += PIECE_END_TRAP_END - PIECE_END_TRAP_BEGIN) {
+		size_t stream_size = do_stream_compress(
+				c, &in[offset], stream_nbytes, out, out_avail,
+				1 + (rand() % 200000));
+
+		ASSERT(libdeflate_deflate_decompress(d, out, stream_size,
+						     decompressed,
+						     stream_nbytes, NULL) ==
+		       LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(decompressed, &in[offset], stream_nbytes) == 0);
+	}
+}
+
+/*
+ * Compress with flushes at random points, and after each one check that the
+ * streaming decompressor, given the new output, catches up with the input.
+ * At the binary tree levels this also runs on piece-end traps, since a flush
+ * ends a piece and the flushes land in the traps often enough to catch a
+ * match found through a badly inserted piece end.
+ */
+static void
+do_flush_test(struct libdeflate_compressor *c,
+	      struct libdeflate_decompressor *d,
+	      const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail,
+	      u8 *decompressed)
+{
+	size_t in_pos = 0, out_pos = 0, decomp_in_pos = 0, decomp_out_pos = 0;
+	size_t full_in_pos = 0, full_out_pos = 0;
+	size_t actual_in_nbytes, actual_out_nbytes;
+	enum libdeflate_result res;
+
+	ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+	ASSERT(libdeflate_deflate_decompress_stream_begin(d) == 0);
+	while (in_pos < in_nbytes) {
+		size_t n = 1 + (rand() % 50000);
+		int full_flush = (rand() % 4 == 0);
+
+		n = MIN(n, in_nbytes - in_pos);
+
+		res = libdeflate_deflate_compress_stream_update(
+				c, &in[in_pos], n, &out[out_pos],
+				out_avail - out_pos, &actual_out_nbytes);
+		ASSERT(res == LIBDEFLATE_SUCCESS);
+		in_pos += n;
+		out_pos += actual_out_nbytes;
+		ASSERT(out_avail - out_pos >=
+		       libdeflate_deflate_compress_stream_bound(c, 0));
+		res = libdeflate_deflate_compress_stream_flush(
+				c, full_flush, &out[out_pos],
+				out_avail - out_pos, &actual_out_nbytes);
+		ASSERT(res == LIBDEFLATE_SUCCESS);
+		out_pos += actual_out_nbytes;
+		if (full_flush) {
+			full_in_pos = in_pos;
+			full_out_pos = out_pos;
+		}
+
+		/* The flush ends with the 4-byte sync marker. */
+		ASSERT(out_pos >= 4 &&
+		       memcmp(&out[out_pos - 4], "\x00\x00\xff\xff", 4) == 0);
+		res = libdeflate_deflate_decompress_stream_update(
+				d, &out[decomp_in_pos], out_pos - decomp_in_pos,
+				&decompressed[decomp_out_pos],
+				in_nbytes - decomp_out_pos,
+				&actual_in_nbytes, &actual_out_nbytes);
+		ASSERT(res == LIBDEFLATE_IN_PROGRESS);
+		decomp_in_pos += actual_in_nbytes;
+		decomp_out_pos += actual_out_nbytes;
+		ASSERT(decomp_out_pos == in_pos);
+		ASSERT(memcmp(decompressed, in, in_pos) == 0);
+	}
+	res = libdeflate_deflate_compress_stream_finish(
+			c, &out[out_pos], out_avail - out_pos,
+			&actual_out_nbytes);
+	ASSERT(res == LIBDEFLATE_SUCCESS);
+	out_pos += actual_out_nbytes;
+	ASSERT(libdeflate_deflate_decompress(d, out, out_pos, decompressed,
+					     in_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(decompressed, in, in_nbytes) == 0);
+
+	/* The data after the last full flush decompresses on its own. */
+	ASSERT(libdeflate_deflate_decompress(d, &out[full_out_pos],
+					     out_pos - full_out_pos,
+					     decompressed,
+					     in_nbytes - full_in_pos, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(decompressed, &in[full_in_pos],
+		      in_nbytes - full_in_pos) == 0);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 3000000;
+	const size_t out_avail = 2 * max_nbytes;
+	static const size_t sizes[] = { 0, 1, 100, 70000, 600000, 3000000 };
+	struct libdeflate_decompressor *d;
+	u8 *original, *traps, *compressed, *decompressed;
+	size_t actual_out_nbytes;
+	int level;
+	size_t i;
+
+	begin_program(argv);
+
+	original = xmalloc(max_nbytes);
+	traps = xmalloc(max_nbytes);
+	compressed = xmalloc(out_avail);
+	decompressed = xmalloc(max_nbytes);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, max_nbytes);
+	generate_piece_end_traps(traps, max_nbytes, 0);
+
+	for (level = 0; level <= 12; level++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(level);
+
+		ASSERT(c != NULL);
+
+		/* Using the stream functions without a stream must fail. */
+		ASSERT(libdeflate_deflate_compress_stream_finish(
+				c, compressed, out_avail,
+				&actual_out_nbytes) ==
+		       LIBDEFLATE_INSUFFICIENT_SPACE);
+
+		for (i = 0; i < ARRAY_LEN(sizes); i++) {
+			size_t in_nbytes = sizes[i];
+			size_t whole_size, stream_size;
+
+			/* Only test the largest size at a few levels. */
+			if (in_nbytes > 1000000 && level % 4 != 1)
+				continue;
+
+			whole_size = libdeflate_deflate_compress(
+					c, original, in_nbytes,
+					compressed, out_avail);
+			ASSERT(whole_size != 0);
+
+			stream_size = do_stream_compress(
+					c, original, in_nbytes, compressed,
+					out_avail, 1 + (rand() % 200000));
+			ASSERT(libdeflate_deflate_decompress(
+					d, compressed, stream_size,
+					decompressed, in_nbytes, NULL) ==
+			       LIBDEFLATE_SUCCESS);
+			ASSERT(in_nbytes == 0 ||
+			       memcmp(decompressed, original, in_nbytes) == 0);
+
+			/*
+			 * Since matches can cross the boundaries between
+			 * pieces, the ratio should be close to whole-buffer
+			 * compression.
+			 */
+			ASSERT(stream_size <=
+			       whole_size + (whole_size / 50) + 64);
+		}
+		if (level >= 10)
+			do_piece_end_test(c, d, traps, max_nbytes, compressed,
+					  out_avail, decompressed);
+		do_flush_test(c, d, original, 600000, compressed, out_avail,
+			      decompressed);
+		if (level >= 10)
+			do_flush_test(c, d, traps, 600000, compressed,
+				      out_avail, decompressed);
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(traps);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
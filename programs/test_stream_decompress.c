@@ -0,0 +1,246 @@
+/*
+ * test_stream_decompress.c
+ *
+ * Test that the streaming decompression interface gives the same results as
+ * whole-buffer decompression, regardless of how the input and output are split
+ * up, and that it reports the exact end of the stream.
+ */
+
+#include "test_util.h"
+
+/* Generate some data that contains both literals and repeats. */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 16 != 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = rand();
+	}
+}
+
+/* Return a random piece size, usually small but sometimes large. */
+static size_t
+random_piece_size(size_t max_len)
+{
+	size_t n;
+
+	switch (rand() % 4) {
+	case 0:
+		n = 1;
+		break;
+	case 1:
+		n = 1 + (rand() % 16);
+		break;
+	default:
+		n = 1 + (rand() % max_len);
+		break;
+	}
+	return n;
+}
+
+/*
+ * Decompress 'in' using the streaming interface with random input and output
+ * piece sizes.  Return the result of the last call and the total number of
+ * bytes consumed and written.
+ */
+static enum libdeflate_result
+do_stream_decompress(struct libdeflate_decompressor *d,
+		     const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail,
+		     size_t max_piece_len, size_t *in_used_ret,
+		     size_t *out_used_ret)
+{
+	size_t in_pos = 0;
+	size_t out_pos = 0;
+	size_t in_piece_end = 0;
+	enum libdeflate_result res;
+
+	ASSERT(libdeflate_deflate_decompress_stream_begin(d) == 0);
+	do {
+		size_t out_n = random_piece_size(max_piece_len);
+		size_t actual_in, actual_out;
+
+		/* Only provide more input once the previous piece is used. */
+		if (in_piece_end == in_pos) {
+			in_piece_end += random_piece_size(max_piece_len);
+			in_piece_end = MIN(in_piece_end, in_nbytes);
+		}
+		out_n = MIN(out_n, out_avail - out_pos);
+
+		res = libdeflate_deflate_decompress_stream_update(
+				d, &in[in_pos], in_piece_end - in_pos,
+				&out[out_pos], out_n, &actual_in, &actual_out);
+		ASSERT(actual_in <= in_piece_end - in_pos);
+		ASSERT(actual_out <= out_n);
+		in_pos += actual_in;
+		out_pos += actual_out;
+		if (res == LIBDEFLATE_IN_PROGRESS && out_pos == out_avail)
+			break; /* output doesn't fit */
+		if (res == LIBDEFLATE_IN_PROGRESS && in_pos == in_nbytes &&
+		    actual_out == 0 && out_n != 0)
+			break; /* truncated stream */
+	} while (res == LIBDEFLATE_IN_PROGRESS);
+
+	*in_used_ret = in_pos;
+	*out_used_ret = out_pos;
+	return res;
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t max_nbytes = 300000;
+	const size_t out_avail = max_nbytes + 1;
+	static const size_t sizes[] = { 0, 1, 100, 70000, 300000 };
+	static const int levels[] = { 0, 1, 6, 12 };
+	struct libdeflate_decompressor *d;
+	u8 *original, *compressed, *decompressed;
+	size_t compressed_avail;
+	size_t i, j;
+
+	begin_program(argv);
+
+	original = xmalloc(max_nbytes);
+	decompressed = xmalloc(out_avail);
+	d = libdeflate_alloc_decompressor();
+	ASSERT(d != NULL);
+	generate_test_data(original, max_nbytes);
+
+	/* Using the stream functions without a stream must fail. */
+	{
+		size_t actual_in, actual_out;
+
+		ASSERT(libdeflate_deflate_decompress_stream_update(
+				d, original, 1, decompressed, 1,
+				&actual_in, &actual_out) ==
+		       LIBDEFLATE_BAD_DATA);
+	}
+
+	/*
+	 * Invalid data must not be reported as consuming more input than was
+	 * given, whether it arrives all at once, in pieces that go through the
+	 * carry buffer, or through libdeflate_deflate_decompress_iov().
+	 */
+	{
+		static const u8 corrupt[] = {
+			0x05, 0xc1, 0x81, 0x00, 0x00, 0x00, 0x00, 0x80, 0x20,
+			0x07, 0xfa, 0x71, 0x57, 0x2b, 0x90, 0x00, 0x00, 0x00,
+			0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x0d, 0x00,
+		};
+		struct libdeflate_out_iovec iov = {
+			.data = decompressed,
+			.nbytes = out_avail,
+		};
+		size_t actual_in, actual_out;
+		enum libdeflate_result res;
+
+		res = do_stream_decompress(d, corrupt, sizeof(corrupt),
+					   decompressed, out_avail,
+					   sizeof(corrupt), &actual_in,
+					   &actual_out);
+		ASSERT(res == LIBDEFLATE_BAD_DATA);
+		ASSERT(actual_in <= sizeof(corrupt));
+		for (j = 0; j < 100; j++) {
+			res = do_stream_decompress(d, corrupt, sizeof(corrupt),
+						   decompressed, out_avail, 4,
+						   &actual_in, &actual_out);
+			ASSERT(res == LIBDEFLATE_BAD_DATA);
+			ASSERT(actual_in <= sizeof(corrupt));
+		}
+		ASSERT(libdeflate_deflate_decompress_iov(
+				d, corrupt, sizeof(corrupt), &iov, 1,
+				&actual_in, &actual_out) ==
+		       LIBDEFLATE_BAD_DATA);
+		ASSERT(actual_in <= sizeof(corrupt));
+	}
+
+	for (i = 0; i < ARRAY_LEN(levels); i++) {
+		struct libdeflate_compressor *c =
+			libdeflate_alloc_compressor(levels[i]);
+
+		ASSERT(c != NULL);
+		compressed_avail = libdeflate_deflate_compress_bound(
+					c, max_nbytes) + 16;
+		compressed = xmalloc(compressed_avail);
+
+		for (j = 0; j < ARRAY_LEN(sizes); j++) {
+			size_t in_nbytes = sizes[j];
+			size_t csize, in_used, out_used;
+			enum libdeflate_result res;
+
+			csize = libdeflate_deflate_compress(c, original,
+							    in_nbytes,
+							    compressed,
+							    compressed_avail);
+			ASSERT(csize != 0);
+
+			/*
+			 * Append some trailing bytes, which must be left
+			 * unconsumed.
+			 */
+			memset(&compressed[csize], 0xAB, 16);
+
+			res = do_stream_decompress(d, compressed, csize + 16,
+						   decompressed, out_avail,
+						   1 + (rand() % 100000),
+						   &in_used, &out_used);
+			ASSERT(res == LIBDEFLATE_SUCCESS);
+			ASSERT(in_used == csize);
+			ASSERT(out_used == in_nbytes);
+			ASSERT(in_nbytes == 0 ||
+			       memcmp(decompressed, original, in_nbytes) == 0);
+
+			/* A truncated stream must not be reported as done. */
+			if (csize > 1) {
+				res = do_stream_decompress(d, compressed,
+							   csize - 1,
+							   decompressed,
+							   out_avail, 1000,
+							   &in_used,
+							   &out_used);
+				ASSERT(res == LIBDEFLATE_IN_PROGRESS);
+				ASSERT(out_used <= in_nbytes);
+			}
+
+			/*
+			 * Corrupt data must be accepted only if whole-buffer
+			 * decompression accepts it too, and vice versa.
+			 */
+			if (csize > 4) {
+				enum libdeflate_result whole_res;
+				size_t whole_out;
+
+				compressed[rand() % csize] ^= 1 << (rand() % 8);
+				whole_res = libdeflate_deflate_decompress(
+						d, compressed, csize + 16,
+						decompressed, out_avail,
+						&whole_out);
+				res = do_stream_decompress(d, compressed,
+							   csize + 16,
+							   decompressed,
+							   out_avail, 1000,
+							   &in_used,
+							   &out_used);
+				if (whole_res == LIBDEFLATE_SUCCESS) {
+					ASSERT(res == LIBDEFLATE_SUCCESS);
+					ASSERT(out_used == whole_out);
+				} else {
+					ASSERT(res != LIBDEFLATE_SUCCESS);
+				}
+			}
+		}
+		free(compressed);
+		libdeflate_free_compressor(c);
+	}
+
+	libdeflate_free_decompressor(d);
+	free(original);
+	free(decompressed);
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * test_thread_cache.c
+ *
+ * Test the per-thread caches of compressors and decompressors: that objects
+ * are reused, that the least recently used ones are freed to stay within the
+ * memory limit, and that each thread's objects are freed when it exits.
+ */
+
+#include "test_util.h"
+
+#ifdef _WIN32
+#  include <process.h>
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+#define NUM_THREADS	4
+
+/*
+ * A memory allocator that counts the calls to it and the live allocations.
+ * It may be called from several threads at once.
+ */
+#ifdef _WIN32
+static SRWLOCK count_lock = SRWLOCK_INIT;
+#  define lock_counts()		AcquireSRWLockExclusive(&count_lock)
+#  define unlock_counts()	ReleaseSRWLockExclusive(&count_lock)
+#else
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define lock_counts()		pthread_mutex_lock(&count_lock)
+#  define unlock_counts()	pthread_mutex_unlock(&count_lock)
+#endif
+static unsigned long num_mallocs;
+static long num_live;
+
+static void *
+count_malloc(size_t size)
+{
+	lock_counts();
+	num_mallocs++;
+	num_live++;
+	unlock_counts();
+	return malloc(size);
+}
+
+static void
+count_free(void *ptr)
+{
+	lock_counts();
+	num_live--;
+	unlock_counts();
+	free(ptr);
+}
+
+static unsigned long
+get_num_mallocs(void)
+{
+	unsigned long n;
+
+	lock_counts();
+	n = num_mallocs;
+	unlock_counts();
+	return n;
+}
+
+static long
+get_num_live(void)
+{
+	long n;
+
+	lock_counts();
+	n = num_live;
+	unlock_counts();
+	return n;
+}
+
+/* Compress and decompress a buffer with this thread's cached objects. */
+static void
+do_round_trip(int level, const u8 *in, size_t in_nbytes)
+{
+	struct libdeflate_compressor *c = libdeflate_get_thread_compressor(level);
+	struct libdeflate_decompressor *d = libdeflate_get_thread_decompressor();
+	u8 compressed[2048];
+	u8 decompressed[1024];
+	size_t csize;
+
+	ASSERT(c != NULL && d != NULL);
+	ASSERT(in_nbytes <= sizeof(decompressed));
+	csize = libdeflate_deflate_compress(c, in, in_nbytes, compressed,
+					    sizeof(compressed));
+	ASSERT(csize != 0);
+	ASSERT(libdeflate_deflate_decompress(d, compressed, csize,
+					     decompressed, in_nbytes, NULL) ==
+	       LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+}
+
+static u8 test_data[1024];
+
+static void
+thread_func(void *arg)
+{
+	int id = *(int *)arg;
+	int i;
+
+	for (i = 0; i < 100; i++)
+		do_round_trip((id + i) % 15, test_data, sizeof(test_data));
+}
+
+#ifdef _WIN32
+static unsigned __stdcall
+thread_proc(void *arg)
+{
+	thread_func(arg);
+	return 0;
+}
+#else
+static void *
+thread_proc(void *arg)
+{
+	thread_func(arg);
+	return NULL;
+}
+#endif
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t size12 = libdeflate_compressor_memory_size(12, NULL);
+	const size_t size1 = libdeflate_compressor_memory_size(1, NULL);
+	int ids[NUM_THREADS];
+	unsigned long n;
+	size_t i;
+
+	begin_program(argv);
+
+	for (i = 0; i < sizeof(test_data); i++)
+		test_data[i] = 'a' + (rand() % 4);
+	libdeflate_set_memory_allocator(count_malloc, count_free);
+
+	/* The same objects are returned each time. */
+	ASSERT(libdeflate_get_thread_compressor(-1) == NULL);
+	ASSERT(libdeflate_get_thread_compressor(15) == NULL);
+	ASSERT(libdeflate_get_thread_compressor(6) ==
+	       libdeflate_get_thread_compressor(6));
+	ASSERT(libdeflate_get_thread_compressor(6) !=
+	       libdeflate_get_thread_compressor(7));
+	ASSERT(libdeflate_get_thread_decompressor() ==
+	       libdeflate_get_thread_decompressor());
+	n = get_num_mallocs();
+	do_round_trip(6, test_data, sizeof(test_data));
+	ASSERT(get_num_mallocs() == n);
+	libdeflate_free_thread_cache();
+	ASSERT(get_num_live() == 0);
+
+	/* The least recently used objects are freed to stay in the limit. */
+	libdeflate_set_thread_cache_limit(size12 + size1 + size1 / 2);
+	ASSERT(libdeflate_get_thread_compressor(12) != NULL);
+	ASSERT(libdeflate_get_thread_compressor(1) != NULL);
+	n = get_num_mallocs();
+	ASSERT(libdeflate_get_thread_compressor(12) != NULL);
+	ASSERT(libdeflate_get_thread_compressor(1) != NULL);
+	ASSERT(get_num_mallocs() == n);
+	ASSERT(libdeflate_get_thread_compressor(6) != NULL); /* frees 12 */
+	ASSERT(libdeflate_get_thread_compressor(1) != NULL);
+	ASSERT(get_num_mallocs() == n + 1);
+	ASSERT(libdeflate_get_thread_compressor(12) != NULL); /* frees 6 */
+	ASSERT(get_num_mallocs() == n + 2);
+	ASSERT(libdeflate_get_thread_compressor(1) != NULL);
+	ASSERT(get_num_mallocs() == n + 2);
+
+	/* An object is still returned when it alone exceeds the limit. */
+	libdeflate_set_thread_cache_limit(0);
+	do_round_trip(9, test_data, sizeof(test_data));
+	ASSERT(get_num_live() == 3); /* the cache, the decompressor, level 9 */
+	libdeflate_free_thread_cache();
+	ASSERT(get_num_live() == 0);
+
+	/* Each thread has its own objects, which are freed when it exits. */
+	libdeflate_set_thread_cache_limit((size_t)64 << 20);
+	for (i = 0; i < NUM_THREADS; i++)
+		ids[i] = i;
+	{
+#ifdef _WIN32
+		HANDLE handles[NUM_THREADS];
+
+		for (i = 0; i < NUM_THREADS; i++) {
+			handles[i] = (HANDLE)_beginthreadex(NULL, 0,
+							    thread_proc,
+							    &ids[i], 0, NULL);
+			ASSERT(handles[i] != 0);
+		}
+		for (i = 0; i < NUM_THREADS; i++) {
+			WaitForSingleObject(handles[i], INFINITE);
+			CloseHandle(handles[i]);
+		}
+#else
+		pthread_t handles[NUM_THREADS];
+
+		for (i = 0; i < NUM_THREADS; i++)
+			ASSERT(pthread_create(&handles[i], NULL, thread_proc,
+					      &ids[i]) == 0);
+		for (i = 0; i < NUM_THREADS; i++)
+			pthread_join(handles[i], NULL);
+#endif
+	}
+	ASSERT(get_num_live() == 0);
+	return 0;
+}
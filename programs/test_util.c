@@ -191,6 +191,22 @@ u64 timer_ticks_to_ms(u64 ticks)
 	return ticks * 1000 / timer_frequency();
 }
 
+/*
+ * Convert a number of elapsed timer ticks to microseconds
+ */
+u64 timer_ticks_to_us(u64 ticks)
+{
+	return ticks * 1000000 / timer_frequency();
+}
+
+/*
+ * Convert a number of elapsed timer ticks to nanoseconds
+ */
+u64 timer_ticks_to_ns(u64 ticks)
+{
+	return ticks * 1000000000 / timer_frequency();
+}
+
 /*
  * Convert a byte count and a number of elapsed timer ticks to MB/s
  */
@@ -235,3 +251,92 @@ flush_bits(struct output_bitstream *os)
 	os->bitcount = 0;
 	return true;
 }
+
+static u8 *
+put_random_bytes(u8 *p, size_t n, int first, int range)
+{
+	while (n--)
+		*p++ = first + (rand() % range);
+	return p;
+}
+
+static u8 *
+put_bytes(u8 *p, const u8 *bytes, size_t n)
+{
+	memcpy(p, bytes, n);
+	return p + n;
+}
+
+/*
+ * Each unit holds five strings that begin with the same 60-byte prefix P, which
+ * no other unit uses, in this order:
+ *
+ *	Y = P 'm' <8 random> '5' R
+ *	A = P 'c' Q '1'
+ *	M = P 'z'
+ *	T = P 'c' Q '9'
+ *	S = P 'c' Q '5' R
+ *
+ * If the data ends within P of T, then all that's known of T matches M, so the
+ * binary tree matchfinder puts T in M's place, where Y is on the wrong side of
+ * it once the rest of T is known.  Searching for S then goes left at T and
+ * right at A, both of which share 69 bytes with S, so it assumes that Y does
+ * too.  But Y only shares P with S, and after the byte that the search
+ * compares next it matches R, so it seems to match at least 110 bytes.
+ */
+void
+generate_piece_end_traps(u8 *data, size_t size, size_t filler_nbytes)
+{
+	static const char filler[] = "the quick brown fox jumps over the lazy dog ";
+	u8 *p = data;
+	u8 * const end = data + size;
+	size_t unit = 0;
+	size_t i;
+
+	while (end - p >= PIECE_END_TRAP_UNIT_LENGTH + filler_nbytes) {
+		u8 prefix[60], q[8], r[40];
+		size_t n = unit++;
+
+		for (i = 0; i < 4; i++, n /= 26)
+			prefix[i] = 'A' + (n % 26);
+		put_random_bytes(&prefix[4], sizeof(prefix) - 4, 'A', 26);
+		put_random_bytes(q, sizeof(q), 'a', 26);
+		put_random_bytes(r, sizeof(r), '0', 10);
+
+		/* Y */
+		p = put_bytes(p, prefix, sizeof(prefix));
+		*p++ = 'm';
+		p = put_random_bytes(p, sizeof(q), 'a', 26);
+		*p++ = '5';
+		p = put_bytes(p, r, sizeof(r));
+		p = put_random_bytes(p, 8, 'a', 26);
+		/* A */
+		p = put_bytes(p, prefix, sizeof(prefix));
+		*p++ = 'c';
+		p = put_bytes(p, q, sizeof(q));
+		*p++ = '1';
+		p = put_random_bytes(p, 8, 'a', 26);
+		/* M */
+		p = put_bytes(p, prefix, sizeof(prefix));
+		*p++ = 'z';
+		p = put_random_bytes(p, 8, 'a', 26);
+		/* T, which begins PIECE_END_TRAP_BEGIN - 5 bytes into the unit */
+		p = put_bytes(p, prefix, sizeof(prefix));
+		*p++ = 'c';
+		p = put_bytes(p, q, sizeof(q));
+		*p++ = '9';
+		p = put_random_bytes(p, 8, 'a', 26);
+		/* S */
+		p = put_bytes(p, prefix, sizeof(prefix));
+		*p++ = 'c';
+		p = put_bytes(p, q, sizeof(q));
+		*p++ = '5';
+		p = put_bytes(p, r, sizeof(r));
+		p = put_random_bytes(p, 8, 'a', 26);
+
+		for (i = 0; i < filler_nbytes; i++)
+			*p++ = filler[i % (sizeof(filler) - 1)];
+	}
+	while (p < end)
+		*p++ = filler[rand() % (sizeof(filler) - 1)];
+}
@@ -45,6 +45,8 @@ void free_guarded_buffer(u8 *start, u8 *end);
 
 u64 timer_ticks(void);
 u64 timer_ticks_to_ms(u64 ticks);
+u64 timer_ticks_to_us(u64 ticks);
+u64 timer_ticks_to_ns(u64 ticks);
 u64 timer_MB_per_s(u64 bytes, u64 ticks);
 u64 timer_KB_per_s(u64 bytes, u64 ticks);
 
@@ -58,4 +60,18 @@ struct output_bitstream {
 bool put_bits(struct output_bitstream *os, machine_word_t bits, int num_bits);
 bool flush_bits(struct output_bitstream *os);
 
+/*
+ * Text-like test data made of units of PIECE_END_TRAP_UNIT_LENGTH bytes plus
+ * @filler_nbytes bytes of easily compressed text.  If the data that the
+ * compressor is given in one go ends between PIECE_END_TRAP_BEGIN and
+ * PIECE_END_TRAP_END bytes into a unit, then a binary tree matchfinder that
+ * inserts the positions just before the end without knowing what follows them
+ * later finds a match that is longer than what the data actually matches.
+ */
+#define PIECE_END_TRAP_UNIT_LENGTH	461
+#define PIECE_END_TRAP_BEGIN		270
+#define PIECE_END_TRAP_END		326
+
+void generate_piece_end_traps(u8 *data, size_t size, size_t filler_nbytes);
+
 #endif /* PROGRAMS_TEST_UTIL_H */
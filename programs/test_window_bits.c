@@ -0,0 +1,237 @@
+/*
+ * test_window_bits.c
+ *
+ * Test the 'window_bits' option: that compressors never refer back as far as
+ * the window size, but do use the whole window, in one-shot and streaming
+ * compression and with preset dictionaries; that zlib headers declare the
+ * window size; that smaller windows use less memory; and that invalid window
+ * sizes are rejected.
+ */
+
+#include "test_util.h"
+
+#define NBYTES		200000
+
+/*
+ * Random bytes that repeat with the given period.  Return the size they
+ * compress to with Huffman coding alone, which is less than their size if the
+ * period is short.
+ */
+static size_t
+generate_periodic_data(u8 *data, size_t size, size_t period, u8 *out,
+		       size_t out_avail)
+{
+	struct libdeflate_options options = {
+		.sizeof_options = sizeof(options),
+		.strategy = LIBDEFLATE_STRATEGY_HUFFMAN_ONLY,
+	};
+	struct libdeflate_compressor *c =
+		libdeflate_alloc_compressor_ex(1, &options);
+	size_t csize;
+	size_t i;
+
+	ASSERT(c != NULL);
+	for (i = 0; i < size; i++)
+		data[i] = (i < period) ? rand() : data[i - period];
+	csize = libdeflate_deflate_compress(c, data, size, out, out_avail);
+	ASSERT(csize != 0);
+	libdeflate_free_compressor(c);
+	return csize;
+}
+
+static struct libdeflate_compressor *
+alloc_windowed_compressor(int level, enum libdeflate_strategy strategy,
+			  unsigned window_bits)
+{
+	struct libdeflate_options options = {
+		.sizeof_options = sizeof(options),
+		.strategy = strategy,
+		.window_bits = window_bits,
+	};
+
+	return libdeflate_alloc_compressor_ex(level, &options);
+}
+
+/* Compress @in as zlib, check the header and the round trip, return the size */
+static size_t
+zlib_compress(struct libdeflate_compressor *c, unsigned window_bits,
+	      const u8 *in, size_t in_nbytes, u8 *out, size_t out_avail,
+	      u8 *buf)
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	size_t csize;
+
+	ASSERT(d != NULL);
+	csize = libdeflate_zlib_compress(c, in, in_nbytes, out, out_avail);
+	ASSERT(csize != 0);
+	ASSERT(out[0] == (((window_bits - 8) << 4) | 8));
+	ASSERT(get_unaligned_be16(out) % 31 == 0);
+	ASSERT(libdeflate_zlib_decompress(d, out, csize, buf, in_nbytes,
+					  NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf, in, in_nbytes) == 0);
+	libdeflate_free_decompressor(d);
+	return csize;
+}
+
+/* Compress @in with the streaming interface in small pieces */
+static size_t
+stream_compress(struct libdeflate_compressor *c, const u8 *in,
+		size_t in_nbytes, u8 *out, size_t out_avail, u8 *buf)
+{
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	size_t pos = 0, csize = 0, n;
+
+	ASSERT(d != NULL);
+	ASSERT(libdeflate_deflate_compress_stream_begin(c) == 0);
+	while (pos < in_nbytes) {
+		size_t in_chunk = 1 + (rand() % 20000);
+
+		in_chunk = MIN(in_chunk, in_nbytes - pos);
+
+		ASSERT(libdeflate_deflate_compress_stream_update(
+				c, &in[pos], in_chunk, &out[csize],
+				out_avail - csize, &n) == LIBDEFLATE_SUCCESS);
+		csize += n;
+		pos += in_chunk;
+	}
+	ASSERT(libdeflate_deflate_compress_stream_finish(
+			c, &out[csize], out_avail - csize, &n) ==
+	       LIBDEFLATE_SUCCESS);
+	csize += n;
+	ASSERT(libdeflate_deflate_decompress(d, out, csize, buf, in_nbytes,
+					     NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf, in, in_nbytes) == 0);
+	libdeflate_free_decompressor(d);
+	return csize;
+}
+
+static void
+test_window(int level, enum libdeflate_strategy strategy,
+	    unsigned window_bits, u8 *in, u8 *out, size_t out_avail, u8 *buf)
+{
+	const size_t window_size = (size_t)1 << window_bits;
+	struct libdeflate_compressor *c =
+		alloc_windowed_compressor(level, strategy, window_bits);
+	struct libdeflate_compressor *c2 =
+		alloc_windowed_compressor(level, strategy, 0);
+	struct libdeflate_compression_dict *pd;
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	size_t huffman_size, csize;
+
+	ASSERT(c != NULL && c2 != NULL && d != NULL);
+
+	/*
+	 * Data that repeats at exactly the window size can only be compressed
+	 * by referring back that far, which isn't allowed.  So it compresses
+	 * no better than with Huffman coding alone, give or take a few chance
+	 * matches.
+	 */
+	huffman_size = generate_periodic_data(in, NBYTES, window_size, out,
+					      out_avail);
+	csize = zlib_compress(c, window_bits, in, NBYTES, out, out_avail, buf);
+	ASSERT(csize >= huffman_size - NBYTES / 100);
+	csize = stream_compress(c, in, NBYTES, out, out_avail, buf);
+	ASSERT(csize >= huffman_size - NBYTES / 100);
+
+	/*
+	 * But the data from half a window back is all usable.  (The ultrafast
+	 * strategy doesn't insert the positions that matches cover, so it
+	 * finds few matches in such data when the window is small.)
+	 */
+	generate_periodic_data(in, NBYTES, window_size / 2, out, out_avail);
+	csize = zlib_compress(c, window_bits, in, NBYTES, out, out_avail, buf);
+	if (strategy != LIBDEFLATE_STRATEGY_ULTRAFAST)
+		ASSERT(csize <= window_size / 2 + NBYTES / 20);
+
+	/*
+	 * A preset dictionary is only referred to up to the window size back,
+	 * whether it was prepared with this compressor or with one that has the
+	 * default window size.
+	 */
+	generate_periodic_data(in, NBYTES, window_size, out, out_avail);
+	csize = libdeflate_deflate_compress_with_dict(c, in, window_size,
+						      &in[window_size],
+						      window_size, out,
+						      out_avail);
+	ASSERT(csize >= window_size - window_size / 8);
+	pd = libdeflate_prepare_compression_dict(c2, in, window_size);
+	ASSERT(pd != NULL);
+	csize = libdeflate_deflate_compress_with_prepared_dict(
+			c, pd, &in[window_size], window_size, out, out_avail);
+	ASSERT(csize >= window_size - window_size / 8);
+	ASSERT(libdeflate_deflate_decompress_with_dict(
+			d, in, window_size, out, csize, buf, window_size,
+			NULL, NULL) == LIBDEFLATE_SUCCESS);
+	ASSERT(memcmp(buf, &in[window_size], window_size) == 0);
+	libdeflate_free_compression_dict(pd);
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_compressor(c2);
+	libdeflate_free_decompressor(d);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	static const unsigned window_bits[] = { 9, 12, 15 };
+	const size_t out_avail = 2 * NBYTES;
+	u8 *in, *out, *buf;
+	size_t i;
+	int level;
+
+	begin_program(argv);
+
+	in = xmalloc(NBYTES);
+	out = xmalloc(out_avail);
+	buf = xmalloc(NBYTES);
+
+	for (level = 1; level <= 12; level++) {
+		for (i = 0; i < ARRAY_LEN(window_bits); i++)
+			test_window(level, LIBDEFLATE_STRATEGY_DEFAULT,
+				    window_bits[i], in, out, out_avail, buf);
+	}
+	for (i = 0; i < ARRAY_LEN(window_bits); i++)
+		test_window(1, LIBDEFLATE_STRATEGY_ULTRAFAST, window_bits[i],
+			    in, out, out_avail, buf);
+
+	/* Level 0 only declares the window size. */
+	for (i = 0; i < ARRAY_LEN(window_bits); i++) {
+		struct libdeflate_compressor *c =
+			alloc_windowed_compressor(
+				0, LIBDEFLATE_STRATEGY_DEFAULT, window_bits[i]);
+
+		ASSERT(c != NULL);
+		zlib_compress(c, window_bits[i], in, 1000, out, out_avail,
+			      buf);
+		libdeflate_free_compressor(c);
+	}
+
+	/* Smaller windows shrink the hash chains and binary trees. */
+	for (level = 2; level <= 12; level += 10) {
+		struct libdeflate_options options = {
+			.sizeof_options = sizeof(options),
+			.window_bits = 9,
+		};
+		size_t small = libdeflate_compressor_memory_size(level,
+								 &options);
+		size_t full;
+
+		options.window_bits = 0;
+		full = libdeflate_compressor_memory_size(level, &options);
+		ASSERT(small != 0 && full != 0);
+		ASSERT(full - small >= (level >= 10 ? 4 : 2) * (32768 - 512));
+	}
+
+	/* Window sizes outside [2^9, 2^15] are rejected. */
+	ASSERT(alloc_windowed_compressor(6, LIBDEFLATE_STRATEGY_DEFAULT,
+					 8) == NULL);
+	ASSERT(alloc_windowed_compressor(6, LIBDEFLATE_STRATEGY_DEFAULT,
+					 16) == NULL);
+	ASSERT(alloc_windowed_compressor(0, LIBDEFLATE_STRATEGY_DEFAULT,
+					 16) == NULL);
+
+	free(in);
+	free(out);
+	free(buf);
+	return 0;
+}
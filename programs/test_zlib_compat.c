@@ -0,0 +1,285 @@
+/*
+ * test_zlib_compat.c
+ *
+ * Test the zlib compatibility library, which this program is linked to ahead
+ * of the real zlib: that deflate() and inflate() round-trip data in all three
+ * formats with any buffer sizes and flush modes, that their output agrees with
+ * libdeflate's one-shot functions, and that the other functions work.
+ */
+
+#include "test_util.h"
+
+#define NBYTES		300000
+
+/* Text-like data with some repeats, so that there are matches to find */
+static void
+generate_test_data(u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i >= 1000 && rand() % 8 == 0)
+			data[i] = data[i - 1 - (rand() % 1000)];
+		else
+			data[i] = 'a' + (rand() % 16);
+	}
+}
+
+static size_t
+random_chunk(size_t max)
+{
+	size_t n = 1 + (rand() % 20000);
+
+	if (rand() % 4 == 0)
+		n = 1 + (rand() % 8);
+	return MIN(n, max);
+}
+
+/*
+ * Compress 'in' with deflate(), giving it the input and output space in random
+ * pieces and flushing now and then.  Return the compressed size.
+ */
+static size_t
+shim_compress(int level, int window_bits, const u8 *in, size_t in_nbytes,
+	      u8 *out, size_t out_nbytes_avail, bool flushes)
+{
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof(z));
+	ASSERT(deflateInit2(&z, level, Z_DEFLATED, window_bits, 8,
+			    Z_DEFAULT_STRATEGY) == Z_OK);
+	z.next_in = (u8 *)in;
+	z.next_out = out;
+	do {
+		size_t in_avail = random_chunk(in_nbytes - z.total_in);
+		size_t out_avail = random_chunk(out_nbytes_avail - z.total_out);
+		static const int flush_modes[] = {
+			Z_NO_FLUSH, Z_PARTIAL_FLUSH, Z_SYNC_FLUSH, Z_FULL_FLUSH,
+			Z_BLOCK,
+		};
+		int flush = Z_NO_FLUSH;
+
+		if (z.total_in + in_avail == in_nbytes)
+			flush = Z_FINISH;
+		else if (flushes && rand() % 8 == 0)
+			flush = flush_modes[rand() % ARRAY_LEN(flush_modes)];
+		z.avail_in = in_avail;
+		z.avail_out = out_avail;
+		ret = deflate(&z, flush);
+		ASSERT(ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR);
+		ASSERT(z.avail_in == 0 || z.avail_out == 0 ||
+		       ret == Z_STREAM_END);
+	} while (ret != Z_STREAM_END);
+	ASSERT(z.total_in == in_nbytes);
+	ASSERT(deflateEnd(&z) == Z_OK);
+	return z.total_out;
+}
+
+/* Decompress 'in' with inflate(), giving it the buffers in random pieces. */
+static void
+shim_decompress(int window_bits, const u8 *in, size_t in_nbytes,
+		u8 *out, size_t expected_nbytes, u32 expected_checksum)
+{
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof(z));
+	ASSERT(inflateInit2(&z, window_bits) == Z_OK);
+	z.next_in = (u8 *)in;
+	z.next_out = out;
+	do {
+		z.avail_in = random_chunk(in_nbytes - z.total_in);
+		z.avail_out = random_chunk(expected_nbytes + 1 - z.total_out);
+		ret = inflate(&z, Z_NO_FLUSH);
+		ASSERT(ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR);
+	} while (ret != Z_STREAM_END);
+	ASSERT(z.total_in == in_nbytes);
+	ASSERT(z.total_out == expected_nbytes);
+	ASSERT(z.adler == expected_checksum);
+	ASSERT(inflateEnd(&z) == Z_OK);
+}
+
+static void
+test_format(int window_bits, const u8 *in, size_t in_nbytes,
+	    u8 *compressed, u8 *decompressed, size_t out_avail)
+{
+	struct libdeflate_compressor *c = libdeflate_alloc_compressor(6);
+	struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+	int format_bits = window_bits < 0 ? -15 : window_bits > 15 ? 31 : 15;
+	u32 checksum = (format_bits == 31) ? libdeflate_crc32(0, in, in_nbytes) :
+		       (format_bits == 15) ? libdeflate_adler32(1, in, in_nbytes) :
+		       0;
+	enum libdeflate_result res;
+	size_t csize;
+	int level;
+
+	ASSERT(c != NULL && d != NULL);
+
+	for (level = 0; level <= 12; level += 3) {
+		/* deflate() and inflate() round-trip the data. */
+		csize = shim_compress(level, window_bits, in, in_nbytes,
+				      compressed, out_avail, level % 2 != 0);
+		/* The zlib header declares the window size, at least 512. */
+		if (format_bits == 15)
+			ASSERT(compressed[0] >> 4 == MAX(window_bits, 9) - 8);
+		shim_decompress(window_bits, compressed, csize, decompressed,
+				in_nbytes, checksum);
+		ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+		if (format_bits != -15)
+			shim_decompress(47, compressed, csize, decompressed,
+					in_nbytes, checksum);
+
+		/* libdeflate's one-shot functions accept it too. */
+		if (format_bits == 31)
+			res = libdeflate_gzip_decompress(d, compressed, csize,
+							 decompressed,
+							 in_nbytes, NULL);
+		else if (format_bits == 15)
+			res = libdeflate_zlib_decompress(d, compressed, csize,
+							 decompressed,
+							 in_nbytes, NULL);
+		else
+			res = libdeflate_deflate_decompress(d, compressed,
+							    csize,
+							    decompressed,
+							    in_nbytes, NULL);
+		ASSERT(res == LIBDEFLATE_SUCCESS);
+		ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+	}
+
+	/* inflate() accepts libdeflate's one-shot output. */
+	if (format_bits == 31)
+		csize = libdeflate_gzip_compress(c, in, in_nbytes, compressed,
+						 out_avail);
+	else if (format_bits == 15)
+		csize = libdeflate_zlib_compress(c, in, in_nbytes, compressed,
+						 out_avail);
+	else
+		csize = libdeflate_deflate_compress(c, in, in_nbytes,
+						    compressed, out_avail);
+	ASSERT(csize != 0);
+	shim_decompress(window_bits, compressed, csize, decompressed,
+			in_nbytes, checksum);
+	ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+
+	/* Corrupting the checksum is detected. */
+	if (format_bits != -15) {
+		z_stream z;
+
+		compressed[csize - 1 - (format_bits == 31 ? 4 : 0)] ^= 1;
+		memset(&z, 0, sizeof(z));
+		ASSERT(inflateInit2(&z, window_bits) == Z_OK);
+		z.next_in = compressed;
+		z.avail_in = csize;
+		z.next_out = decompressed;
+		z.avail_out = in_nbytes;
+		ASSERT(inflate(&z, Z_FINISH) == Z_DATA_ERROR);
+		ASSERT(z.msg != NULL);
+		ASSERT(inflateEnd(&z) == Z_OK);
+	}
+
+	libdeflate_free_compressor(c);
+	libdeflate_free_decompressor(d);
+}
+
+/* A gzip header with all the optional fields is skipped over. */
+static void
+test_gzip_optional_fields(const u8 *in, size_t in_nbytes, u8 *compressed,
+			  u8 *decompressed, size_t out_avail)
+{
+	static const u8 fields[] = {
+		5, 0, 'x', 'x', 'x', 'x', 'x',	/* FEXTRA */
+		'n', 'a', 'm', 'e', 0,		/* FNAME */
+		'c', 0,				/* FCOMMENT */
+		0x12, 0x34,			/* FHCRC */
+	};
+	struct libdeflate_compressor *c = libdeflate_alloc_compressor(6);
+	size_t csize;
+
+	ASSERT(c != NULL);
+	csize = libdeflate_gzip_compress(c, in, in_nbytes, compressed,
+					 out_avail - sizeof(fields));
+	ASSERT(csize != 0);
+	memmove(&compressed[10 + sizeof(fields)], &compressed[10], csize - 10);
+	memcpy(&compressed[10], fields, sizeof(fields));
+	compressed[3] = 0x02 | 0x04 | 0x08 | 0x10;
+	shim_decompress(31, compressed, csize + sizeof(fields), decompressed,
+			in_nbytes, libdeflate_crc32(0, in, in_nbytes));
+	ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+	libdeflate_free_compressor(c);
+}
+
+static void
+test_one_shot_functions(const u8 *in, size_t in_nbytes, u8 *compressed,
+			u8 *decompressed)
+{
+	uLongf csize = compressBound(in_nbytes);
+	uLongf dsize = in_nbytes;
+	uLong src_nbytes;
+
+	ASSERT(compress2(compressed, &csize, in, in_nbytes, 9) == Z_OK);
+	ASSERT(uncompress(decompressed, &dsize, compressed, csize) == Z_OK);
+	ASSERT(dsize == in_nbytes);
+	ASSERT(memcmp(in, decompressed, in_nbytes) == 0);
+
+	dsize = in_nbytes - 1;
+	ASSERT(uncompress(decompressed, &dsize, compressed, csize) ==
+	       Z_BUF_ERROR);
+	csize = 10;
+	ASSERT(compress(compressed, &csize, in, in_nbytes) == Z_BUF_ERROR);
+
+	csize = compressBound(in_nbytes);
+	ASSERT(compress(compressed, &csize, in, in_nbytes) == Z_OK);
+	dsize = in_nbytes;
+	src_nbytes = csize + 100;
+	ASSERT(uncompress2(decompressed, &dsize, compressed, &src_nbytes) ==
+	       Z_OK);
+	ASSERT(src_nbytes == csize);
+	ASSERT(dsize == in_nbytes);
+}
+
+int
+tmain(int argc, tchar *argv[])
+{
+	const size_t out_avail = compressBound(NBYTES) + 1000;
+	u8 *original, *compressed, *decompressed;
+	z_stream z;
+
+	begin_program(argv);
+
+	original = xmalloc(NBYTES);
+	compressed = xmalloc(out_avail);
+	decompressed = xmalloc(NBYTES + 1);
+	generate_test_data(original, NBYTES);
+
+	/* This is really the compatibility library, not zlib. */
+	memset(&z, 0, sizeof(z));
+	ASSERT(deflateInit(&z, 14) == Z_OK);
+	ASSERT(deflateEnd(&z) == Z_OK);
+	ASSERT(deflateInit(&z, 15) == Z_STREAM_ERROR);
+
+	test_format(-15, original, NBYTES, compressed, decompressed, out_avail);
+	test_format(15, original, NBYTES, compressed, decompressed, out_avail);
+	test_format(8, original, NBYTES, compressed, decompressed, out_avail);
+	test_format(11, original, NBYTES, compressed, decompressed, out_avail);
+	test_format(-9, original, NBYTES, compressed, decompressed, out_avail);
+	test_format(31, original, NBYTES, compressed, decompressed, out_avail);
+	test_format(15, original, 0, compressed, decompressed, out_avail);
+	test_format(31, original, 1, compressed, decompressed, out_avail);
+	test_gzip_optional_fields(original, NBYTES, compressed, decompressed,
+				  out_avail);
+	test_one_shot_functions(original, NBYTES, compressed, decompressed);
+
+	ASSERT(crc32(0, original, NBYTES) ==
+	       libdeflate_crc32(0, original, NBYTES));
+	ASSERT(adler32(1, original, NBYTES) ==
+	       libdeflate_adler32(1, original, NBYTES));
+	ASSERT(adler32(0, NULL, 0) == 1);
+	ASSERT(crc32(0, NULL, 0) == 0);
+
+	free(original);
+	free(compressed);
+	free(decompressed);
+	return 0;
+}
@@ -110,10 +110,103 @@ single_file()
 	done
 }
 
-if (( $# > 1 )); then
+# Print the compression and decompression speeds in MB/s from the output of one
+# run of a benchmark program.  This works with old builds too.
+get_speeds()
+{
+	"$@" | awk '/Compression time/{c=substr($5, 2)}
+		    /Decompression time/{d=substr($5, 2)}
+		    END{print c, d}'
+}
+
+# Compare two builds of the benchmark program on a fixed set of files.  The two
+# are run alternately, so that slow drifts in the machine's speed affect both
+# equally.  A change in speed is marked as significant if Welch's t-test rejects
+# equal means at the 95% confidence level.
+compare()
+{
+	local old=$1 new=$2
+	local file level i speeds
+	local old_c old_d new_c new_d
+
+	shift 2
+	: "${NUM_ITERATIONS:=10}"
+	: "${LEVELS:=1 6 9 12}"
+
+	echo "File | Level | Operation | Old MB/s | New MB/s | Change | Significant"
+	echo "-----|-------|-----------|----------|----------|--------|------------"
+	for file in "$@"; do
+		for level in $LEVELS; do
+			old_c="" old_d="" new_c="" new_d=""
+			for i in $(seq "$NUM_ITERATIONS"); do
+				read -r -a speeds < <(get_speeds "$old" "-$level" "$file")
+				old_c+=" ${speeds[0]}"
+				old_d+=" ${speeds[1]}"
+				read -r -a speeds < <(get_speeds "$new" "-$level" "$file")
+				new_c+=" ${speeds[0]}"
+				new_d+=" ${speeds[1]}"
+				: "$i" # make shellcheck happy
+			done
+			welch_test "$(basename "$file") | $level | compress" \
+				"$old_c" "$new_c"
+			welch_test "$(basename "$file") | $level | decompress" \
+				"$old_d" "$new_d"
+		done
+	done
+}
+
+# Print a table row comparing two sets of samples with Welch's t-test.
+welch_test()
+{
+	awk -v label="$1" -v a="$2" -v b="$3" '
+	function stats(str, s,   n, i, v, sum, ss) {
+		n = split(str, v, " ")
+		for (i = 1; i <= n; i++)
+			sum += v[i]
+		s["n"] = n
+		s["mean"] = sum / n
+		for (i = 1; i <= n; i++)
+			ss += (v[i] - s["mean"]) ^ 2
+		s["var"] = (n > 1) ? ss / (n - 1) : 0
+	}
+	BEGIN {
+		# Two-sided critical values of the t distribution at p = 0.05
+		split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 " \
+		      "2.262 2.228 2.201 2.179 2.160 2.145 2.131 2.120 " \
+		      "2.110 2.101 2.093 2.086 2.080 2.074 2.069 2.064 " \
+		      "2.060 2.056 2.052 2.048 2.045 2.042", crit, " ")
+		stats(a, x)
+		stats(b, y)
+		qa = x["var"] / x["n"]
+		qb = y["var"] / y["n"]
+		if (qa + qb == 0) {
+			sig = (x["mean"] != y["mean"])
+		} else {
+			t = (y["mean"] - x["mean"]) / sqrt(qa + qb)
+			df = (qa + qb) ^ 2
+			if (x["n"] > 1 && qa > 0)
+				df_den += qa ^ 2 / (x["n"] - 1)
+			if (y["n"] > 1 && qb > 0)
+				df_den += qb ^ 2 / (y["n"] - 1)
+			df = int(df / df_den)
+			c = (df < 1) ? crit[1] : (df <= 30) ? crit[df] : 1.96
+			sig = (t > c || t < -c)
+		}
+		change = (x["mean"] > 0) ? \
+			 (y["mean"] - x["mean"]) * 100 / x["mean"] : 0
+		printf "%s | %.0f | %.0f | %+.1f%% | %s\n", label,
+		       x["mean"], y["mean"], change, sig ? "**yes**" : "no"
+	}'
+}
+
+if (( $# > 3 )) && [ "$1" = "--compare" ]; then
+	shift
+	compare "$@"
+elif (( $# > 1 )); then
 	multifile "$@"
 elif (( $# == 1 )); then
 	single_file "$@"
 else
 	echo 1>&2 "Usage: $0 FILE..."
+	echo 1>&2 "       $0 --compare OLD_BENCHMARK NEW_BENCHMARK FILE..."
 fi
@@ -1,12 +1,32 @@
 #!/usr/bin/env python3
 #
-# This script generates constants for efficient computation of the gzip CRC-32.
+# This script generates constants for efficient computation of the gzip CRC-32,
+# and of the other CRCs that libdeflate supports: CRC-32C and CRC-64.
 
 import sys
 
-# This is the generator polynomial G(x) of the gzip CRC-32, represented as an
-# int using the natural mapping between bits and polynomial coefficients.
-G = 0x104c11db7
+# A CRC variant.  'G' is its generator polynomial G(x), represented as an int
+# using the natural mapping between bits and polynomial coefficients.  All the
+# supported CRCs use bit-reversed polynomials, i.e. they are LSB-first.
+class Crc:
+    def __init__(self, name, prefix, G, description):
+        self.name = name
+        self.prefix = prefix
+        self.G = G
+        self.n = G.bit_length() - 1
+        self.description = description
+
+    def ctype(self):
+        return f'u{self.n}'
+
+    def fmt(self, poly):
+        if self.n == 32:
+            return f'0x{poly:08x}'
+        return f'0x{poly:016x}ULL'
+
+GZIP_CRC32 = Crc('crc32', 'CRC32', 0x104c11db7, 'CRC-32')
+CRC32C = Crc('crc32c', 'CRC32C', 0x11edc6f41, 'CRC-32C')
+CRC64 = Crc('crc64', 'CRC64', 0x142f0e1eba9ea3693, 'CRC-64')
 
 # XOR (add) an iterable of polynomials.
 def xor(iterable):
@@ -37,30 +57,31 @@ def bitreverse(poly, num_bits):
                if (poly & (1 << i)) != 0)
 
 # Compute x^d mod G.
-def x_to_the_d(d):
+def x_to_the_d(d, G=GZIP_CRC32.G):
     if d < G.bit_length() - 1:
         return 1 << d
-    t = x_to_the_d(d//2)
+    t = x_to_the_d(d//2, G)
     t = clmul(t, t)
     if d % 2 != 0:
         t <<= 1
     return reduce(t, G)
 
-def gen_tables():
+def gen_tables(crc):
     print('/*')
-    print(' * crc32_tables.h - data tables for CRC-32 computation')
+    print(f' * {crc.name}_tables.h - data tables for {crc.description} computation')
     print(' *')
     print(' * THIS FILE WAS GENERATED BY gen-crc32-consts.py.  DO NOT EDIT.')
     print(' */')
+    per_line = 4 if crc.n == 32 else 2
     for n in [1, 8]:
         print('')
-        print(f'static const u32 crc32_slice{n}_table[] MAYBE_UNUSED = {{')
-        # The i'th table entry is the CRC-32 of the message consisting of byte
+        print(f'static const {crc.ctype()} {crc.name}_slice{n}_table[] MAYBE_UNUSED = {{')
+        # The i'th table entry is the CRC of the message consisting of byte
         # i % 256 followed by i // 256 zero bytes.
-        polys = [bitreverse(i % 256, 8) << (32 + 8*(i//256)) for i in range(256 * n)]
-        polys = [bitreverse(reduce(poly, G), 32) for poly in polys]
-        for i in range(0, len(polys), 4):
-            print(f'\t0x{polys[i+0]:08x}, 0x{polys[i+1]:08x}, 0x{polys[i+2]:08x}, 0x{polys[i+3]:08x},')
+        polys = [bitreverse(i % 256, 8) << (crc.n + 8*(i//256)) for i in range(256 * n)]
+        polys = [bitreverse(reduce(poly, crc.G), crc.n) for poly in polys]
+        for i in range(0, len(polys), per_line):
+            print('\t' + ' '.join(crc.fmt(poly) + ',' for poly in polys[i:i+per_line]))
         print('};')
 
 # Compute the constant multipliers needed for "folding" over various distances
@@ -113,11 +134,9 @@ def gen_multipliers():
             print(f'#define CRC32_X{d}_MODG 0x{poly:08x} /* x^{d} mod G(x) */')
         print('')
 
-    # Compute constants for the final 128 => 32 bit reduction.
-    poly = bitreverse(div(1 << 95, G), 64)
-    print(f'#define CRC32_BARRETT_CONSTANT_1 0x{poly:016x}ULL /* floor(x^95 / G(x)) */')
-    poly = bitreverse(G, 33)
-    print(f'#define CRC32_BARRETT_CONSTANT_2 0x{poly:016x}ULL /* G(x) */')
+    # Compute the same multipliers under the names that the x86 template uses,
+    # and the constants for the final 128 => 32 bit reduction.
+    gen_pclmul_constants(GZIP_CRC32)
 
     # Compute multipliers for combining the CRCs of separate chunks.
     print('')
@@ -150,9 +169,62 @@ def gen_multipliers():
         poly = bitreverse(x_to_the_d(d), 32)
         print(f'#define CRC32_FIXED_CHUNK_MULT_{j} 0x{poly:08x} /* x^{d} mod G(x) */')
 
-with open('lib/crc32_tables.h', 'w') as f:
-    sys.stdout = f
-    gen_tables()
-with open('lib/crc32_multipliers.h', 'w') as f:
-    sys.stdout = f
-    gen_multipliers()
+    # Compute multipliers for combining the CRCs of two messages, where the
+    # length of the second message is arbitrary.  The k'th entry is the
+    # multiplier for appending 2^k zero bytes.
+    print('')
+    print('/* Multipliers for libdeflate_crc32_combine() */')
+    print('static const u32 crc32_combine_mults[64] MAYBE_UNUSED = {')
+    for k in range(64):
+        d = 8 * (1 << k)
+        poly = bitreverse(x_to_the_d(d), 32)
+        print(f'\t0x{poly:08x}, /* x^(8*2^{k}) mod G(x) */')
+    print('};')
+
+# Compute the constants that x86/crc32_pclmul_template.h needs, for any of the
+# CRC variants.  These are the same multipliers as above, but named after the
+# distance across which they fold rather than after their degree, since the
+# degree depends on the CRC length n: a 64-bit polynomial multiplied by an
+# n-bit one produces a (63+n)-bit one, so len(B(x)) = 63 + n.  Then there are
+# the constants for the final 128 => n bit reduction, which is done by Barrett
+# reduction as described in the template.
+def gen_pclmul_constants(crc):
+    n = crc.n
+    len_B = 63 + n
+    for fold_bits in [128, 256, 512, 1024, 2048, 4096]:
+        sep_lo = fold_bits - 128
+        sep_hi = sep_lo + 64
+        for i, d in enumerate([sep_hi + len_B, sep_lo + len_B]):
+            poly = bitreverse(x_to_the_d(d, crc.G), n)
+            print(f'#define {crc.prefix}_FOLD_ACROSS_{fold_bits}_BITS_CONST_{i+1} {crc.fmt(poly)} /* x^{d} mod G(x) */')
+    poly = bitreverse(div(1 << len_B, crc.G), 64)
+    print(f'#define {crc.prefix}_BARRETT_CONSTANT_1 0x{poly:016x}ULL /* floor(x^{len_B} / G(x)) */')
+    if n == 32:
+        poly = bitreverse(crc.G, 33)
+        print(f'#define {crc.prefix}_BARRETT_CONSTANT_2 0x{poly:016x}ULL /* G(x) */')
+    else:
+        # G(x) has 65 coefficients, one more than pclmulqdq can take, so leave
+        # out the x^64 and x^0 terms.  The template adds back the latter.
+        poly = bitreverse((crc.G ^ (1 << n) ^ 1) >> 1, 64)
+        print(f'#define {crc.prefix}_BARRETT_CONSTANT_2 0x{poly:016x}ULL /* (G(x) - x^{n} - 1) / x */')
+
+def gen_variant_multipliers(crc):
+    print('/*')
+    print(f' * {crc.name}_multipliers.h - constants for {crc.description} folding')
+    print(' *')
+    print(' * THIS FILE WAS GENERATED BY gen-crc32-consts.py.  DO NOT EDIT.')
+    print(' */')
+    print('')
+    gen_pclmul_constants(crc)
+
+G = GZIP_CRC32.G
+for crc in [GZIP_CRC32, CRC32C, CRC64]:
+    with open(f'lib/{crc.name}_tables.h', 'w') as f:
+        sys.stdout = f
+        gen_tables(crc)
+    with open(f'lib/{crc.name}_multipliers.h', 'w') as f:
+        sys.stdout = f
+        if crc is GZIP_CRC32:
+            gen_multipliers()
+        else:
+            gen_variant_multipliers(crc)
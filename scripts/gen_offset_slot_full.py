@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+#
+# This script generates lib/deflate_offset_slot_full.h, which contains the
+# deflate_offset_slot_full[] array that maps 'offset => offset_slot' for all
+# offsets.
+
+DEFLATE_OFFSET_SLOT_BASE = [
+	1    , 2    , 3    , 4     , 5     , 7     , 9     , 13    ,
+	17   , 25   , 33   , 49    , 65    , 97    , 129   , 193   ,
+	257  , 385  , 513  , 769   , 1025  , 1537  , 2049  , 3073  ,
+	4097 , 6145 , 8193 , 12289 , 16385 , 24577 ,
+]
+DEFLATE_MAX_MATCH_OFFSET = 32768
+
+offset_slot_full = [0] * (DEFLATE_MAX_MATCH_OFFSET + 1)
+offset_slot = -1
+for offset in range(1, len(offset_slot_full)):
+    if (offset_slot + 1 < len(DEFLATE_OFFSET_SLOT_BASE) and
+            offset >= DEFLATE_OFFSET_SLOT_BASE[offset_slot + 1]):
+        offset_slot += 1
+    offset_slot_full[offset] = offset_slot
+
+print('/*')
+print(' * deflate_offset_slot_full.h - table that maps offset => offset slot')
+print(' *')
+print(' * THIS FILE WAS GENERATED BY gen_offset_slot_full.py.  DO NOT EDIT.')
+print(' */')
+print('')
+print('static const u8 deflate_offset_slot_full[DEFLATE_MAX_MATCH_OFFSET + 1] = {')
+for i in range(0, len(offset_slot_full), 16):
+    print('\t' + ' '.join(f'{v},' for v in offset_slot_full[i:i+16]))
+print('};')
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+#
+# This script generates deflate_static_codes, the codewords and codeword
+# lengths of the static Huffman codes, in the form used by the compressor.
+
+def static_litlen_len(sym):
+    if sym < 144:
+        return 8
+    if sym < 256:
+        return 9
+    if sym < 280:
+        return 7
+    return 8
+
+def gen_codewords(lens):
+    max_len = max(lens)
+    len_counts = [0] * (max_len + 1)
+    for l in lens:
+        len_counts[l] += 1
+    next_codewords = [0] * (max_len + 1)
+    for l in range(2, max_len + 1):
+        next_codewords[l] = (next_codewords[l - 1] + len_counts[l - 1]) << 1
+    codewords = []
+    for l in lens:
+        # DEFLATE requires bit-reversed codewords.
+        codewords.append(int(f'{next_codewords[l]:0{l}b}'[::-1], 2))
+        next_codewords[l] += 1
+    return codewords
+
+def print_array(name, values, fmt, per_line):
+    print(f'\t\t.{name} = {{')
+    for i in range(0, len(values), per_line):
+        print('\t\t\t' + ' '.join(f'{fmt.format(v)},'
+                                  for v in values[i:i+per_line]))
+    print('\t\t},')
+
+litlen_lens = [static_litlen_len(sym) for sym in range(288)]
+offset_lens = [5] * 32
+
+print('static const struct deflate_codes deflate_static_codes = {')
+print('\t.codewords = {')
+print_array('litlen', gen_codewords(litlen_lens), '0x{:03x}', 8)
+print_array('offset', gen_codewords(offset_lens), '0x{:02x}', 8)
+print('\t},')
+print('\t.lens = {')
+print_array('litlen', litlen_lens, '{}', 16)
+print_array('offset', offset_lens, '{}', 16)
+print('\t},')
+print('};')
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+#
+# This script generates static_litlen_decode_table[] and
+# static_offset_decode_table[], the decompressor's decode tables for the static
+# Huffman codes.  The entry format is described in lib/deflate_decompress.c.
+
+HUFFDEC_LITERAL = 0x80000000
+HUFFDEC_EXCEPTIONAL = 0x00008000
+HUFFDEC_END_OF_BLOCK = 0x00002000
+
+LENGTH_BASE = [
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 258, 258,
+]
+LENGTH_EXTRA_BITS = [
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 0, 0,
+]
+OFFSET_BASE = [
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577, 24577, 24577,
+]
+OFFSET_EXTRA_BITS = [
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 13, 13,
+]
+
+# The static part of each decode table entry, as in litlen_decode_results[] and
+# offset_decode_results[]
+litlen_results = [HUFFDEC_LITERAL | (sym << 16) for sym in range(256)]
+litlen_results.append(HUFFDEC_EXCEPTIONAL | HUFFDEC_END_OF_BLOCK)
+litlen_results += [(base << 16) | extra
+                   for base, extra in zip(LENGTH_BASE, LENGTH_EXTRA_BITS)]
+offset_results = [(base << 16) | extra
+                  for base, extra in zip(OFFSET_BASE, OFFSET_EXTRA_BITS)]
+
+def static_litlen_len(sym):
+    if sym < 144:
+        return 8
+    if sym < 256:
+        return 9
+    if sym < 280:
+        return 7
+    return 8
+
+# Build a decode table, indexed by bit-reversed codewords, for a canonical code
+# whose codewords are all no longer than table_bits.
+def build_decode_table(lens, results, table_bits):
+    max_len = max(lens)
+    len_counts = [0] * (max_len + 1)
+    for l in lens:
+        len_counts[l] += 1
+    next_codewords = [0] * (max_len + 1)
+    for l in range(2, max_len + 1):
+        next_codewords[l] = (next_codewords[l - 1] + len_counts[l - 1]) << 1
+    table = [None] * (1 << table_bits)
+    for sym, l in enumerate(lens):
+        codeword = int(f'{next_codewords[l]:0{l}b}'[::-1], 2)
+        next_codewords[l] += 1
+        for i in range(codeword, len(table), 1 << l):
+            table[i] = results[sym] + (l << 8) + l
+    return table
+
+def print_table(name, table):
+    print(f'static const u32 {name}[{len(table)}] = {{')
+    for i in range(0, len(table), 6):
+        print('\t' + ' '.join(f'0x{v:08x},' for v in table[i:i+6]))
+    print('};')
+
+# The litlen code's longest codeword is 9 bits, which is what build_decode_table()
+# in lib/deflate_decompress.c reduces the table to.  The offset table always
+# has OFFSET_TABLEBITS = 8 bits.
+print_table('static_litlen_decode_table',
+            build_decode_table([static_litlen_len(sym) for sym in range(288)],
+                               litlen_results, 9))
+print()
+print_table('static_offset_decode_table',
+            build_decode_table([5] * 32, offset_results, 8))
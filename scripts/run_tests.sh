@@ -148,6 +148,9 @@ build_and_run_tests()
 		arm*|aarch*)
 			features+=(dotprod sha3 prefer_pmull crc32 pmull neon)
 			;;
+		riscv*)
+			features+=(zbc)
+			;;
 		esac
 	fi
 	local disable_str=""
@@ -354,6 +357,34 @@ use_shared_lib_test()
 }
 TEST_FUNCS+=(use_shared_lib_test)
 
+# Test the code paths that are off by default until they've been run on real
+# hardware, when running on that hardware.
+neon_decompress_test()
+{
+	case "$ARCH" in
+	aarch64|arm64)
+		build_and_run_tests -DLIBDEFLATE_NEON_DECOMPRESS=1
+		;;
+	*)
+		log "Not on arm64; skipping NEON decompression test"
+		;;
+	esac
+}
+TEST_FUNCS+=(neon_decompress_test)
+
+riscv_checksums_test()
+{
+	case "$ARCH" in
+	riscv*)
+		build_and_run_tests -DLIBDEFLATE_RISCV_CHECKSUMS=1
+		;;
+	*)
+		log "Not on RISC-V; skipping RISC-V checksum test"
+		;;
+	esac
+}
+TEST_FUNCS+=(riscv_checksums_test)
+
 freestanding_test()
 {
 	if [ "$UNAME" = Darwin ]; then